@@ -162,6 +162,20 @@ function inspect()
 	Mac OS X).
 
 
+The console script also adds a micro-benchmark to the console object:
+function benchmarkVectorOps([iterations : Number]) : String
+	Times a loop of Vector3D and Quaternion arithmetic, each step of which
+	creates new vector and quaternion objects, and reports operations per
+	second. Also reports console.jsPrivatePoolStatistics. Keep iterations
+	modest (default 20000) as the time limiter applies.
+
+function benchmarkEntityQuery([role : String [, range : Number [, iterations : Number]]]) : String
+	Compares system.queryEntities() with the equivalent system.filteredEntities()
+	closure, for ships with the given role (default "trader") within range
+	(default 25600 m) of the player, checks that both return the same
+	entities, and reports the time taken by each.
+
+
 Oolite Debug OXP
 
 Copyright © 2007-2014 the Oolite team
@@ -765,6 +779,77 @@ Object.defineProperty(console, "dumpStackForWarnings",
 console.__dumpStackForWarnings = console.settings["dump-stack-for-warnings"];
 
 
+// Micro-benchmark for Vector3D and Quaternion object creation and arithmetic.
+Object.defineProperty(console, "benchmarkVectorOps", { value: function benchmarkVectorOps(iterations)
+{
+	iterations = iterations || 20000;
+	
+	var v = new Vector3D(1, 2, 3);
+	var w = new Vector3D(-3, 0.5, 2);
+	var q = new Quaternion(1, 0, 0, 0);
+	var r = new Quaternion(0.99, 0.1, 0, 0).normalize();
+	var sum = 0;
+	
+	var start = Date.now();
+	for (var i = 0; i < iterations; i++)
+	{
+		v = v.add(w).multiply(0.5).subtract(w);			// 3 vectors
+		sum += v.dot(w) + v.cross(w).magnitude();		// 1 vector
+		q = q.multiply(r);								// 1 quaternion
+		v = v.rotateBy(q);								// 1 vector
+	}
+	var elapsed = (Date.now() - start) / 1000;
+	var ops = iterations * 6;
+	
+	var result = "benchmarkVectorOps: " + ops + " object-creating operations in " + elapsed.toFixed(3) + " s";
+	if (elapsed > 0)  result += " (" + Math.round(ops / elapsed) + " ops/s)";
+	if (console.jsPrivatePoolStatistics !== undefined)  result += "\n" + console.jsPrivatePoolStatistics;
+	if (!isFinite(sum))  result += "\n(non-finite checksum)";
+	return result;
+}});
+
+
+// Compatibility benchmark for system.queryEntities() against system.filteredEntities().
+Object.defineProperty(console, "benchmarkEntityQuery", { value: function benchmarkEntityQuery(role, range, iterations)
+{
+	role = role || "trader";
+	range = range || 25600;
+	iterations = iterations || 100;
+	
+	var ship = player.ship;
+	var i, filtered, queried;
+	
+	var start = Date.now();
+	for (i = 0; i < iterations; i++)
+	{
+		filtered = system.filteredEntities(this, function (entity)
+		{
+			return entity.isShip && entity.hasRole(role);
+		}, ship, range);
+	}
+	var filteredTime = (Date.now() - start) / 1000;
+	
+	start = Date.now();
+	for (i = 0; i < iterations; i++)
+	{
+		queried = system.queryEntities({ roles: role, near: ship, range: range });
+	}
+	var queriedTime = (Date.now() - start) / 1000;
+	
+	var same = filtered.length == queried.length;
+	for (i = 0; same && i < filtered.length; i++)
+	{
+		// filteredEntities() does not sort when relative to the player, so compare as sets.
+		same = queried.indexOf(filtered[i]) != -1;
+	}
+	
+	return "benchmarkEntityQuery: " + queried.length + " ships with role \"" + role + "\" within " + range + " m, " + iterations + " iterations\n" +
+		"  filteredEntities: " + filteredTime.toFixed(3) + " s\n" +
+		"     queryEntities: " + queriedTime.toFixed(3) + " s" +
+		(same ? "" : "\n  ** RESULTS DIFFER (" + filtered.length + " vs " + queried.length + ") **");
+}});
+
+
 /*	As a convenience, make player, player.ship, system and missionVariables
 	available to console commands as short variables:
 */
@@ -41,6 +41,7 @@ MA 02110-1301, USA.
 	NSString			*ownerDesc;					// describes the object this is the AI for
 	
 	NSDictionary		*stateMachine;
+	NSDictionary		*compiledStateMachine;		// state -> message -> actions with selectors resolved, built from stateMachine
 	NSString			*stateMachineName;
 	NSString			*currentState;
 	NSMutableSet		*pendingMessages;
@@ -107,3 +108,15 @@ MA 02110-1301, USA.
 - (void)dumpState;
 
 @end
+
+
+#ifndef NDEBUG
+/*	Decode the UPDATE handlers of 500 simulated ships running
+	route1traderAI.plist and pirateAI.plist for 200 ticks, once by parsing
+	the action strings as -takeAction: does and once from the compiled
+	actions, and compare the time per ship per tick. The actions are
+	resolved but not performed. Logged under "ai.benchmark" and returned as
+	a string.
+*/
+NSString *OOAIRunDispatchBenchmark(void);
+#endif
@@ -33,6 +33,10 @@ MA 02110-1301, USA.
 #import "ShipEntity.h"
 #import "ShipEntityAI.h"
 
+#ifndef NDEBUG
+#import "OOProfilingStopwatch.h"
+#endif
+
 
 enum
 {
@@ -49,8 +53,26 @@ typedef struct
 } OOAIDeferredCallTrampolineInfo;
 
 
+/*	An AI action with its selector resolved and its argument split off, as
+	-takeAction: would find them by parsing the action string.
+*/
+typedef struct
+{
+	SEL				selector;		// NULL for an empty action.
+	NSString		*argument;		// nil if the method is called without an argument.
+	NSString		*source;		// The action as written, for logging.
+} OOAIAction;
+
+
 static AI *sCurrentlyRunningAI = nil;
 
+// Compiled state machines by name, each with the plist it was compiled from.
+static NSMutableDictionary *sCompiledStateMachines = nil;
+
+
+static OOAIAction CompileAction(NSString *action);
+static NSDictionary *CompiledStateMachine(NSDictionary *stateMachine, NSString *name);
+
 
 @interface AI (OOPrivate)
 
@@ -69,6 +91,26 @@ static AI *sCurrentlyRunningAI = nil;
 - (NSDictionary *) cleanHandlers:(NSDictionary *)handlers forState:(NSString *)stateKey stateMachine:(NSString *)smName;
 - (NSArray *) cleanActions:(NSArray *)actions forHandler:(NSString *)handlerKey state:(NSString *)stateKey stateMachine:(NSString *)smName;
 
+- (void) performAction:(const OOAIAction *)action;
+
+@end
+
+
+/*	The actions of one message handler, compiled once when the state machine
+	is loaded so that dispatching a message doesn't parse strings.
+*/
+@interface OOAIActionList: NSObject
+{
+@private
+	NSUInteger			_count;
+	OOAIAction			*_actions;
+}
+
+- (instancetype) initWithActions:(NSArray *)actions;
+
+@property (readonly) NSUInteger count;
+@property (readonly) const OOAIAction *actions;
+
 @end
 
 
@@ -161,6 +203,7 @@ extern void GenerateGraphVizForAIStateMachine(NSDictionary *stateMachine, NSStri
 	DESTROY(ownerDesc);
 	DESTROY(aiStack);
 	DESTROY(stateMachine);
+	DESTROY(compiledStateMachine);
 	DESTROY(stateMachineName);
 	DESTROY(currentState);
 	DESTROY(pendingMessages);
@@ -409,7 +452,7 @@ static AIStackElement *sStack = NULL;
 - (void) reactToMessage:(NSString *) message context:(NSString *)debugContext
 {
 	unsigned		i;
-	NSArray			*actions = nil;
+	OOAIActionList	*actions = nil;
 	NSDictionary	*messagesForState = nil;
 	ShipEntity		*owner = [self owner];
 	static unsigned	recursionLimiter = 0;
@@ -463,7 +506,7 @@ static AIStackElement *sStack = NULL;
 		return;
 	}
 	
-	messagesForState = [stateMachine objectForKey:currentState];
+	messagesForState = [compiledStateMachine objectForKey:currentState];
 	if (messagesForState == nil)  return;
 	
 #ifndef NDEBUG
@@ -473,7 +516,8 @@ static AIStackElement *sStack = NULL;
 	}
 #endif
 	
-	actions = [[[messagesForState objectForKey:message] copy] autorelease];
+	// Retained because an action may replace the state machine.
+	actions = [[[messagesForState objectForKey:message] retain] autorelease];
 	
 	sCurrentlyRunningAI = self;
 	if ([actions count] > 0)
@@ -481,9 +525,10 @@ static AIStackElement *sStack = NULL;
 		++recursionLimiter;
 		@try
 		{
+			const OOAIAction *compiledActions = [actions actions];
 			for (i = 0; i < [actions count]; i++)
 			{
-				[self takeAction:[actions objectAtIndex:i]];
+				[self performAction:&compiledActions[i]];
 			}
 		}
 		@catch (NSException *exception)
@@ -513,6 +558,13 @@ static AIStackElement *sStack = NULL;
 
 
 - (void) takeAction:(NSString *)action
+{
+	OOAIAction compiled = CompileAction(action);
+	[self performAction:&compiled];
+}
+
+
+- (void) performAction:(const OOAIAction *)action
 {
 	ShipEntity *owner = [self owner];
 	
@@ -520,51 +572,36 @@ static AIStackElement *sStack = NULL;
 	BOOL report = [owner reportAIMessages];
 	if (report)
 	{
-		OOLog(@"ai.takeAction", @"%@ to take action %@", ownerDesc, action);
+		OOLog(@"ai.takeAction", @"%@ to take action %@", ownerDesc, action->source);
 		OOLogIndent();
 	}
 #endif
 	
-	NSArray *tokens = ScanTokensFromString(action);
-	NSUInteger tokenCount = [tokens count];
-	
-	if (tokenCount != 0)
+	if (action->selector != NULL)
 	{
-		NSString *selectorStr = [tokens objectAtIndex:0];
+		SEL selector = action->selector;
 		
 		if (owner != nil)
 		{
-			NSString *dataString = nil;
-			
-			if (tokenCount == 2)
-			{
-				dataString = [tokens objectAtIndex:1];
-			}
-			else if ([tokens count] > 1)
-			{
-				dataString = [[tokens subarrayWithRange:NSMakeRange(1, tokenCount - 1)] componentsJoinedByString:@" "];
-			}
-			
-			SEL selector = NSSelectorFromString(selectorStr);
 			if ([owner respondsToSelector:selector])
 			{
-				if (dataString != nil)  [owner performSelector:selector withObject:dataString];
+				if (action->argument != nil)  [owner performSelector:selector withObject:action->argument];
 				else  [owner performSelector:selector];
 			}
 			else
 			{
-				OOLogERR(@"ai.takeAction.badSelector", @"in AI %@ in state %@: %@ does not respond to %@", stateMachineName, currentState, ownerDesc, selectorStr);
+				OOLogERR(@"ai.takeAction.badSelector", @"in AI %@ in state %@: %@ does not respond to %@", stateMachineName, currentState, ownerDesc, NSStringFromSelector(selector));
 			}
 		}
 		else
 		{
-			OOLog(@"ai.takeAction.orphaned", @"***** AI %@, trying to perform %@, is orphaned (no owner)", stateMachineName, selectorStr);
+			OOLog(@"ai.takeAction.orphaned", @"***** AI %@, trying to perform %@, is orphaned (no owner)", stateMachineName, NSStringFromSelector(selector));
 		}
 	}
 	else
 	{
 #ifndef NDEBUG
-		if (report)  OOLog(@"ai.takeAction.noAction", @"DEBUG: - no action '%@'", action);
+		if (report)  OOLog(@"ai.takeAction.noAction", @"DEBUG: - no action '%@'", action->source);
 #endif
 	}
 	
@@ -772,6 +809,8 @@ static AIStackElement *sStack = NULL;
 	{
 		[stateMachine release];
 		stateMachine = [newSM copy];
+		[compiledStateMachine release];
+		compiledStateMachine = [CompiledStateMachine(stateMachine, name) retain];
 	}
 	if (stateMachineName != name)
 	{
@@ -1018,3 +1057,253 @@ static AIStackElement *sStack = NULL;
 
 
 @end
+
+
+@implementation OOAIActionList
+
+- (instancetype) initWithActions:(NSArray *)actions
+{
+	if ((self = [super init]))
+	{
+		NSUInteger count = [actions count];
+		if (count != 0)
+		{
+			_actions = malloc(count * sizeof *_actions);
+			if (_actions == NULL)
+			{
+				[self release];
+				return nil;
+			}
+		}
+		
+		NSString *action = nil;
+		foreach (action, actions)
+		{
+			OOAIAction compiled = CompileAction(action);
+			[compiled.argument retain];
+			[compiled.source retain];
+			_actions[_count++] = compiled;
+		}
+	}
+	
+	return self;
+}
+
+
+- (void) dealloc
+{
+	NSUInteger i;
+	for (i = 0; i < _count; i++)
+	{
+		[_actions[i].argument release];
+		[_actions[i].source release];
+	}
+	free(_actions);
+	
+	[super dealloc];
+}
+
+
+- (NSUInteger) count
+{
+	return _count;
+}
+
+
+- (const OOAIAction *) actions
+{
+	return _actions;
+}
+
+@end
+
+
+static OOAIAction CompileAction(NSString *action)
+{
+	OOAIAction	result = { NULL, nil, action };
+	NSArray		*tokens = ScanTokensFromString(action);
+	NSUInteger	tokenCount = [tokens count];
+	
+	if (tokenCount != 0)
+	{
+		result.selector = NSSelectorFromString([tokens objectAtIndex:0]);
+		
+		if (tokenCount == 2)
+		{
+			result.argument = [tokens objectAtIndex:1];
+		}
+		else if (tokenCount > 2)
+		{
+			result.argument = [[tokens subarrayWithRange:NSMakeRange(1, tokenCount - 1)] componentsJoinedByString:@" "];
+		}
+	}
+	
+	return result;
+}
+
+
+/*	The compiled form of a state machine: state -> message -> OOAIActionList.
+	Selectors can't be stored in the property list cache, so compiled state
+	machines are kept here, and reused while the cache hands out the same
+	plist for the name.
+*/
+static NSDictionary *CompiledStateMachine(NSDictionary *stateMachine, NSString *name)
+{
+	if (stateMachine == nil)  return nil;
+	
+	NSArray *entry = [sCompiledStateMachines objectForKey:name];
+	if (entry != nil && [entry objectAtIndex:0] == stateMachine)  return [entry objectAtIndex:1];
+	
+	NSMutableDictionary		*compiled = [NSMutableDictionary dictionaryWithCapacity:[stateMachine count]];
+	NSString				*stateKey = nil;
+	NSString				*handlerKey = nil;
+	
+	foreachkey (stateKey, stateMachine)
+	{
+		// Skips the jsScript entry.
+		NSDictionary *handlers = [stateMachine objectForKey:stateKey];
+		if (![handlers isKindOfClass:[NSDictionary class]])  continue;
+		
+		NSMutableDictionary *compiledHandlers = [NSMutableDictionary dictionaryWithCapacity:[handlers count]];
+		foreachkey (handlerKey, handlers)
+		{
+			OOAIActionList *actions = [[OOAIActionList alloc] initWithActions:[handlers oo_arrayForKey:handlerKey]];
+			if (actions != nil)  [compiledHandlers setObject:actions forKey:handlerKey];
+			[actions release];
+		}
+		[compiled setObject:compiledHandlers forKey:stateKey];
+	}
+	
+	// nullAI.plist isn't cached by -loadStateMachine:jsName:, since it depends on the JS AI.
+	if (name != nil && ![name isEqualToString:@"nullAI.plist"])
+	{
+		if (sCompiledStateMachines == nil)  sCompiledStateMachines = [[NSMutableDictionary alloc] init];
+		[sCompiledStateMachines setObject:[NSArray arrayWithObjects:stateMachine, compiled, nil] forKey:name];
+	}
+	
+	return compiled;
+}
+
+
+#ifndef NDEBUG
+
+enum
+{
+	kBenchmarkShipCount			= 500,
+	kBenchmarkTickCount			= 200
+};
+
+
+NSString *OOAIRunDispatchBenchmark(void)
+{
+	NSAutoreleasePool		*pool = [[NSAutoreleasePool alloc] init];
+	NSArray					*aiNames = [NSArray arrayWithObjects:@"route1traderAI.plist", @"pirateAI.plist", nil];
+	NSMutableArray			*parsedHandlers = [NSMutableArray array];
+	NSMutableArray			*compiledHandlers = [NSMutableArray array];
+	AI						*loader = [[AI alloc] init];
+	OOProfilingStopwatch	*stopwatch = [OOProfilingStopwatch stopwatch];
+	OOTimeDelta				parsedTime = 0, compiledTime = 0;
+	NSUInteger				i, j, tick, actionsPerTick = 0, mismatches = 0;
+	NSUInteger				parsedHits = 0, compiledHits = 0, parsedArguments = 0, compiledArguments = 0;
+	NSString				*aiName = nil;
+	
+	// Collect the UPDATE handlers of every state of each AI, in both forms.
+	foreach (aiName, aiNames)
+	{
+		NSDictionary *stateMachine = [loader loadStateMachine:aiName jsName:@"oolite-nullAI.js"];
+		NSDictionary *compiled = CompiledStateMachine(stateMachine, aiName);
+		NSString *stateKey = nil;
+		
+		foreachkey (stateKey, compiled)
+		{
+			OOAIActionList *actions = [[compiled objectForKey:stateKey] objectForKey:@"UPDATE"];
+			if ([actions count] == 0)  continue;
+			
+			[parsedHandlers addObject:[[stateMachine objectForKey:stateKey] objectForKey:@"UPDATE"]];
+			[compiledHandlers addObject:actions];
+		}
+	}
+	[loader release];
+	
+	NSUInteger handlerCount = [parsedHandlers count];
+	if (handlerCount == 0)
+	{
+		[pool release];
+		return @"No UPDATE handlers found.";
+	}
+	
+	// Check that both forms agree.
+	for (i = 0; i < handlerCount; i++)
+	{
+		NSArray *parsed = [parsedHandlers objectAtIndex:i];
+		OOAIActionList *compiled = [compiledHandlers objectAtIndex:i];
+		for (j = 0; j < [compiled count]; j++)
+		{
+			OOAIAction reparsed = CompileAction([parsed objectAtIndex:j]);
+			const OOAIAction *action = &[compiled actions][j];
+			if (reparsed.selector != action->selector || (reparsed.argument != action->argument && ![reparsed.argument isEqualToString:action->argument]))  mismatches++;
+		}
+	}
+	
+	// Ship i runs the UPDATE handler of state i % handlerCount.
+	for (i = 0; i < kBenchmarkShipCount; i++)  actionsPerTick += [[compiledHandlers objectAtIndex:i % handlerCount] count];
+	
+	for (tick = 0; tick < kBenchmarkTickCount; tick++)
+	{
+		NSAutoreleasePool *tickPool = [[NSAutoreleasePool alloc] init];
+		
+		[stopwatch reset];
+		for (i = 0; i < kBenchmarkShipCount; i++)
+		{
+			NSString *action = nil;
+			foreach (action, [parsedHandlers objectAtIndex:i % handlerCount])
+			{
+				// As -takeAction: did before actions were compiled.
+				NSArray *tokens = ScanTokensFromString(action);
+				NSUInteger tokenCount = [tokens count];
+				if (tokenCount == 0)  continue;
+				
+				NSString *dataString = nil;
+				if (tokenCount == 2)  dataString = [tokens objectAtIndex:1];
+				else if (tokenCount > 2)  dataString = [[tokens subarrayWithRange:NSMakeRange(1, tokenCount - 1)] componentsJoinedByString:@" "];
+				
+				SEL selector = NSSelectorFromString([tokens objectAtIndex:0]);
+				if ([ShipEntity instancesRespondToSelector:selector])  parsedHits++;
+				if (dataString != nil)  parsedArguments++;
+			}
+		}
+		parsedTime += [stopwatch reset];
+		
+		for (i = 0; i < kBenchmarkShipCount; i++)
+		{
+			OOAIActionList *actions = [compiledHandlers objectAtIndex:i % handlerCount];
+			const OOAIAction *compiledActions = [actions actions];
+			NSUInteger count = [actions count];
+			for (j = 0; j < count; j++)
+			{
+				if (compiledActions[j].selector == NULL)  continue;
+				if ([ShipEntity instancesRespondToSelector:compiledActions[j].selector])  compiledHits++;
+				if (compiledActions[j].argument != nil)  compiledArguments++;
+			}
+		}
+		compiledTime += [stopwatch reset];
+		
+		[tickPool release];
+	}
+	
+	if (parsedHits != compiledHits || parsedArguments != compiledArguments)  mismatches++;
+	
+	double scale = 1e6 / ((double)kBenchmarkShipCount * kBenchmarkTickCount);
+	NSString *result = [NSString stringWithFormat:@"%u ships for %u ticks, %lu actions per tick from %lu UPDATE handlers: parsed %.3f us/ship, compiled %.3f us/ship (%.1fx)%@",
+						kBenchmarkShipCount, kBenchmarkTickCount, actionsPerTick, handlerCount,
+						parsedTime * scale, compiledTime * scale, (compiledTime > 0) ? parsedTime / compiledTime : 0.0,
+						(mismatches == 0) ? @"" : [NSString stringWithFormat:@" ** %lu MISMATCHES **", mismatches]];
+	OOLog(@"ai.benchmark", @"%@", result);
+	
+	[result retain];
+	[pool release];
+	
+	return [result autorelease];
+}
+
+#endif
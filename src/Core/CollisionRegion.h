@@ -33,7 +33,7 @@ MA 02110-1301, USA.
 #define	COLLISION_MAX_ENTITIES			128
 #define MINIMUM_SHADOWING_ENTITY_RADIUS 75.0
 
-@class Entity, OOSunEntity;
+@class Entity, OOSunEntity, OOCollisionBroadphase, OOShadowCache;
 
 
 @interface CollisionRegion: NSObject
@@ -58,6 +58,8 @@ MA 02110-1301, USA.
 	unsigned			max_entities;	// so storage can be expanded
 	
 	CollisionRegion		*parentRegion;
+	
+	OOShadowCache		*shadowCache;	// Universe region only; subregions use their root's.
 }
 
 - (instancetype) initAsUniverse;
@@ -72,6 +74,8 @@ MA 02110-1301, USA.
 - (BOOL) checkEntity:(Entity *)ent;
 
 - (void) findCollisions;
+// Narrow phase for the pairs found by a spatial hash broadphase, used instead of -findCollisions. Call on the universe region only.
+- (void) findCollisionsWithBroadphase:(OOCollisionBroadphase *)broadphase;
 - (void) findShadowedEntities;
 
 // Description for FPS HUD
@@ -32,6 +32,8 @@ MA 02110-1301, USA.
 #import "StationEntity.h"
 #import "PlayerEntity.h"
 #import "OODebugFlags.h"
+#import "OOCollisionBroadphase.h"
+#import "OOShadowCache.h"
 
 
 static BOOL positionIsWithinRegion(HPVector position, CollisionRegion *region);
@@ -69,6 +71,7 @@ static int crid_counter = 1;
 	if ((self = [self init]))
 	{
 		isUniverse = YES;
+		shadowCache = [[OOShadowCache alloc] init];
 	}
 	return self;
 }
@@ -91,6 +94,7 @@ static int crid_counter = 1;
 {
 	free(entity_array);
 	DESTROY(subregions);
+	DESTROY(shadowCache);
 	
 	[super dealloc];
 }
@@ -252,6 +256,120 @@ static BOOL positionIsWithinBorders(HPVector position, CollisionRegion *region)
 }
 
 
+static void CheckPotentialCollision(CollisionRegion *region, Entity *e1, Entity *e2)
+{
+	HPVector	p1 = e1->position;
+	double		dist2, r1 = e1->collision_radius, r2, r0, min_dist2;
+	
+	region->checks_this_tick++;
+	if (e1->isShip && e2->isShip && 
+		[(ShipEntity *)e1 collisionExceptedFor:(ShipEntity *)e2]) 
+	{
+		// nothing happens
+	} 
+	else
+	{
+
+		r2 = e2->collision_radius;
+		r0 = r1 + r2;
+		dist2 = HPdistance2(e2->position, p1);
+		min_dist2 = r0 * r0;
+		if (dist2 < PROXIMITY_WARN_DISTANCE2 * min_dist2)
+		{
+#ifndef NDEBUG
+			if (gDebugFlags & DEBUG_COLLISIONS)
+			{
+				OOLog(@"collisionRegion.debug", @"DEBUG Testing collision between %@ (%@) and %@ (%@)",
+					  e1, (e1->collisionTestFilter==3)?@"YES":@"NO", e2, (e2->collisionTestFilter==3)?@"YES":@"NO");
+			}
+#endif
+			region->checks_within_range++;
+		
+			if (e1->isShip && e2->isShip)
+			{
+				if ((dist2 < PROXIMITY_WARN_DISTANCE2 * r2 * r2) || (dist2 < PROXIMITY_WARN_DISTANCE2 * r1 * r1))
+				{
+					[(ShipEntity*)e1 setProximityAlert:(ShipEntity*)e2];
+					[(ShipEntity*)e2 setProximityAlert:(ShipEntity*)e1];
+				}
+
+				if (dist2 >= min_dist2)
+				{
+					if (e1->isStation)
+					{
+						StationEntity* se1 = (StationEntity *)e1;
+						[se1 shipIsInDockingCorridor:(ShipEntity *)e2];
+					}
+					else if (e2->isStation)
+					{
+						StationEntity* se2 = (StationEntity *)e2;
+						[se2 shipIsInDockingCorridor:(ShipEntity *)e1];
+					}
+				}
+
+			}
+			if (dist2 < min_dist2)
+			{
+				BOOL collision = NO;
+			
+				if (e1->isStation)
+				{
+					StationEntity* se1 = (StationEntity *)e1;
+					if ([se1 shipIsInDockingCorridor:(ShipEntity *)e2])
+					{
+						collision = NO;
+					}
+					else
+					{
+						collision = [e1 checkCloseCollisionWith:e2];
+					}
+				}
+				else if (e2->isStation)
+				{
+					StationEntity* se2 = (StationEntity *)e2;
+					if ([se2 shipIsInDockingCorridor:(ShipEntity *)e1])
+					{
+						collision = NO;
+					}
+					else
+					{
+						collision = [e2 checkCloseCollisionWith:e1];
+					}
+				}
+				else
+				{
+					collision = [e1 checkCloseCollisionWith:e2];
+				}
+		
+				if (collision)
+				{
+					// now we have no need to check the e2-e1 collision
+					if (e1->collider)
+					{
+						[[e1 collisionArray] addObject:e1->collider];
+					}
+					else
+					{
+						[[e1 collisionArray] addObject:e2];
+					}
+					e1->hasCollided = YES;
+				
+					if (e2->collider)
+					{
+						[[e2 collisionArray] addObject:e2->collider];
+					}
+					else
+					{
+						[[e2 collisionArray] addObject:e1];
+					}
+					e2->hasCollided = YES;
+				}
+			}
+		}
+	}
+}
+
+
 - (void) findCollisions
 {
 	// test for collisions in each subregion
@@ -264,8 +382,6 @@ static BOOL positionIsWithinBorders(HPVector position, CollisionRegion *region)
 	// According to Shark, when this was in Universe this was where Oolite spent most time!
 	//
 	Entity		*e1, *e2;
-	HPVector		p1;
-	double		dist2, r1, r2, r0, min_dist2;
 	unsigned	i;
 	Entity		*entities_to_test[n_entities];
 	
@@ -314,121 +430,13 @@ static BOOL positionIsWithinBorders(HPVector position, CollisionRegion *region)
 	for (i = 0; i < n_entities_to_test; i++)
 	{
 		e1 = entities_to_test[i];
-		p1 = e1->position;
-		r1 = e1->collision_radius;
-	
-	
-
+		
 		// check against the first in the collision chain
 		e2 = e1->collision_chain;
 		while (e2 != nil)
 		{
-			checks_this_tick++;
-			if (e1->isShip && e2->isShip && 
-				[(ShipEntity *)e1 collisionExceptedFor:(ShipEntity *)e2]) 
-			{
-				// nothing happens
-			} 
-			else
-			{
-
-				r2 = e2->collision_radius;
-				r0 = r1 + r2;
-				dist2 = HPdistance2(e2->position, p1);
-				min_dist2 = r0 * r0;
-				if (dist2 < PROXIMITY_WARN_DISTANCE2 * min_dist2)
-				{
-#ifndef NDEBUG
-					if (gDebugFlags & DEBUG_COLLISIONS)
-					{
-						OOLog(@"collisionRegion.debug", @"DEBUG Testing collision between %@ (%@) and %@ (%@)",
-							  e1, (e1->collisionTestFilter==3)?@"YES":@"NO", e2, (e2->collisionTestFilter==3)?@"YES":@"NO");
-					}
-#endif
-					checks_within_range++;
-				
-					if (e1->isShip && e2->isShip)
-					{
-						if ((dist2 < PROXIMITY_WARN_DISTANCE2 * r2 * r2) || (dist2 < PROXIMITY_WARN_DISTANCE2 * r1 * r1))
-						{
-							[(ShipEntity*)e1 setProximityAlert:(ShipEntity*)e2];
-							[(ShipEntity*)e2 setProximityAlert:(ShipEntity*)e1];
-						}
-
-						if (dist2 >= min_dist2)
-						{
-							if (e1->isStation)
-							{
-								StationEntity* se1 = (StationEntity *)e1;
-								[se1 shipIsInDockingCorridor:(ShipEntity *)e2];
-							}
-							else if (e2->isStation)
-							{
-								StationEntity* se2 = (StationEntity *)e2;
-								[se2 shipIsInDockingCorridor:(ShipEntity *)e1];
-							}
-						}
-
-					}
-					if (dist2 < min_dist2)
-					{
-						BOOL collision = NO;
-					
-						if (e1->isStation)
-						{
-							StationEntity* se1 = (StationEntity *)e1;
-							if ([se1 shipIsInDockingCorridor:(ShipEntity *)e2])
-							{
-								collision = NO;
-							}
-							else
-							{
-								collision = [e1 checkCloseCollisionWith:e2];
-							}
-						}
-						else if (e2->isStation)
-						{
-							StationEntity* se2 = (StationEntity *)e2;
-							if ([se2 shipIsInDockingCorridor:(ShipEntity *)e1])
-							{
-								collision = NO;
-							}
-							else
-							{
-								collision = [e2 checkCloseCollisionWith:e1];
-							}
-						}
-						else
-						{
-							collision = [e1 checkCloseCollisionWith:e2];
-						}
-				
-						if (collision)
-						{
-							// now we have no need to check the e2-e1 collision
-							if (e1->collider)
-							{
-								[[e1 collisionArray] addObject:e1->collider];
-							}
-							else
-							{
-								[[e1 collisionArray] addObject:e2];
-							}
-							e1->hasCollided = YES;
-						
-							if (e2->collider)
-							{
-								[[e2 collisionArray] addObject:e2->collider];
-							}
-							else
-							{
-								[[e2 collisionArray] addObject:e1];
-							}
-							e2->hasCollided = YES;
-						}
-					}
-				}
-			}
+			CheckPotentialCollision(self, e1, e2);
+			
 			// check the next in the collision chain
 			e2 = e2->collision_chain;
 		}
@@ -443,6 +451,50 @@ static BOOL positionIsWithinBorders(HPVector position, CollisionRegion *region)
 }
 
 
+- (void) findCollisionsWithBroadphase:(OOCollisionBroadphase *)broadphase
+{
+	NSUInteger						i, count = [broadphase bodyCount];
+	const OOCollisionBroadphasePair	*pairs = [broadphase pairs];
+	NSUInteger						pairCount = [broadphase pairCount];
+	
+	//	clear collision variables
+	//
+	for (i = 0; i < count; i++)
+	{
+		Entity *e1 = [broadphase entityAtIndex:i];
+		if (e1->hasCollided)
+		{
+			[[e1 collisionArray] removeAllObjects];
+			e1->hasCollided = NO;
+		}
+		if (e1->isShip)
+		{
+			[(ShipEntity*)e1 setProximityAlert:nil];
+		}
+		e1->collider = nil;
+	}
+	
+	checks_this_tick = 0;
+	checks_within_range = 0;
+	
+	/*	Like the collision chains, which are built from the global x-sorted
+		lists, the broadphase pairs ignore regions: every pair is tested, so
+		entities on either side of a region boundary can still collide.
+	*/
+	for (i = 0; i < pairCount; i++)
+	{
+		CheckPotentialCollision(self, [broadphase entityAtIndex:pairs[i].a], [broadphase entityAtIndex:pairs[i].b]);
+	}
+	
+#ifndef NDEBUG
+	if (gDebugFlags & DEBUG_COLLISIONS)
+	{
+		OOLog(@"collisionRegion.debug",@"Broadphase collision test: %lu box tests, %lu pairs, checks %d, within range %d, for %lu entities",[broadphase candidateTestCount],pairCount,checks_this_tick,checks_within_range,count);
+	}
+#endif
+}
+
+
 // an outValue of 1 means it's just being occluded.
 static BOOL entityByEntityOcclusionToValue(Entity *e1, Entity *e2, OOSunEntity *the_sun, float *outValue)
 {
@@ -580,6 +632,13 @@ static inline BOOL testEntityOccludedByEntity(Entity *e1, Entity *e2, OOSunEntit
 }
 
 
+static OOShadowCache *RootShadowCache(CollisionRegion *region)
+{
+	while (region->parentRegion != nil)  region = region->parentRegion;
+	return region->shadowCache;
+}
+
+
 - (void) findShadowedEntities
 {
 	// reject trivial cases
@@ -599,11 +658,15 @@ static inline BOOL testEntityOccludedByEntity(Entity *e1, Entity *e2, OOSunEntit
 		return;	// sun is required
 	}
 	
+	OOShadowCache *cache = RootShadowCache(self);
+	if (isUniverse)  [cache beginFrameWithSunPosition:[the_sun position]];
+	
 	unsigned	ent_count =	UNIVERSE->n_entities;
 	Entity		**uni_entities = UNIVERSE->sortedEntities;	// grab the public sorted list
-	Entity		*planets[ent_count];
+	// Planets go in the first half of the snapshot and ships in the second.
+	Entity		**planets = [UNIVERSE beginEntitySnapshot:ent_count * 2];
 	unsigned	n_planets = 0;
-	Entity		*ships[ent_count];
+	Entity		**ships = planets + ent_count;
 	unsigned	n_ships = 0;
 	
 	for (i = 0; i < ent_count; i++)
@@ -669,6 +732,7 @@ static inline BOOL testEntityOccludedByEntity(Entity *e1, Entity *e2, OOSunEntit
 			// test last occluder (most likely case)
 			if (occluder)
 			{
+				[cache noteFullTest];
 				if (testEntityOccludedByEntity(e1, occluder, the_sun))	
 				{
 					e1->isSunlit = NO;
@@ -685,6 +749,15 @@ static inline BOOL testEntityOccludedByEntity(Entity *e1, Entity *e2, OOSunEntit
 			for (j = 0; j < n_planets; j++)
 			{
 				float occlusionNumber;
+				if ([e1 isPlayer])
+				{
+					// The player's occlusion level needs the full test's value.
+					[cache noteFullTest];
+				}
+				else if ([cache occluder:planets[j] cannotShadeEntity:e1])
+				{
+					continue;
+				}
 				if (entityByEntityOcclusionToValue(e1, planets[j], the_sun, &occlusionNumber))
 				{
 					e1->isSunlit = NO;
@@ -705,6 +778,10 @@ static inline BOOL testEntityOccludedByEntity(Entity *e1, Entity *e2, OOSunEntit
 			// test local entities
 			for (j = 0; j < n_ships; j++)
 			{
+				if (ships[j] == e1 || [cache occluder:ships[j] cannotShadeEntity:e1])
+				{
+					continue;
+				}
 				if (testEntityOccludedByEntity(e1, ships[j], the_sun))
 				{
 					e1->isSunlit = NO;
@@ -714,12 +791,20 @@ static inline BOOL testEntityOccludedByEntity(Entity *e1, Entity *e2, OOSunEntit
 			}
 		}
 	}
+	
+	[UNIVERSE endEntitySnapshot:planets];
 }
 
 
 - (NSString *) collisionDescription
 {
-	return [NSString stringWithFormat:@"p%u - c%u", checks_this_tick, checks_within_range];
+	NSString *result = [NSString stringWithFormat:@"p%u - c%u", checks_this_tick, checks_within_range];
+	if (shadowCache != nil)
+	{
+		// Shadow tests last frame: full, cached rejections, cone rejections.
+		result = [result stringByAppendingFormat:@" - s%lu/%lu/%lu", (unsigned long)[shadowCache fullTests], (unsigned long)[shadowCache cacheHits], (unsigned long)[shadowCache coneRejections]];
+	}
+	return result;
 }
 
 
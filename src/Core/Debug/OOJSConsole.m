@@ -33,8 +33,11 @@ SOFTWARE.
 #include <stdint.h>
 
 #import "OOJSEngineTimeManagement.h"
+#import "OOJSContinuousProfiler.h"
+#import "OOLogOutputHandler.h"
 #import "OOJSScript.h"
 #import "OOJSVector.h"
+#import "OOJSQuaternion.h"
 #import "OOJSEntity.h"
 #import "OOJSCall.h"
 #import "OOLoggingExtended.h"
@@ -44,6 +47,20 @@ SOFTWARE.
 #import "OODebugMonitor.h"
 #import "OOProfilingStopwatch.h"
 #import "ResourceManager.h"
+#import "OOCollisionBroadphase.h"
+#import "OOShipBVH.h"
+#import "OOPhysicsStore.h"
+#import "AI.h"
+#import "PlayerEntity.h"
+#import "OOJSEventHandlerIndex.h"
+#import "OOShipRegistry.h"
+#import "OODATTokenizer.h"
+#import "OOMesh.h"
+#import "OOZipArchive.h"
+#import "OOStringExpander.h"
+#import "PlayerEntityLegacyScriptEngine.h"
+#import "OOScriptTimer.h"
+#import "OOJSFrameCallbacks.h"
 
 
 @interface Entity (OODebugInspector)
@@ -81,6 +98,20 @@ static JSBool ConsoleWriteLogMarker(JSContext *context, uintN argc, jsval *vp);
 static JSBool ConsoleWriteMemoryStats(JSContext *context, uintN argc, jsval *vp);
 static JSBool ConsoleWriteJSMemoryStats(JSContext *context, uintN argc, jsval *vp);
 static JSBool ConsoleGarbageCollect(JSContext *context, uintN argc, jsval *vp);
+#ifndef NDEBUG
+static JSBool ConsoleBenchmarkCollisionBroadphase(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleBenchmarkLaserBVH(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleBenchmarkPhysicsIntegration(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleBenchmarkAIDispatch(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleCheckParallelUpdateDeterminism(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleBenchmarkScriptTimers(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleBenchmarkStringExpansion(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleBenchmarkOXZReads(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleBenchmarkMeshLoading(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleBenchmarkDATParsing(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleCheckShipRegistryIncremental(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleCheckLegacyScriptConformance(JSContext *context, uintN argc, jsval *vp);
+#endif
 #if DEBUG
 static JSBool ConsoleDumpNamedRoots(JSContext *context, uintN argc, jsval *vp);
 static JSBool ConsoleDumpHeap(JSContext *context, uintN argc, jsval *vp);
@@ -89,6 +120,9 @@ static JSBool ConsoleDumpHeap(JSContext *context, uintN argc, jsval *vp);
 static JSBool ConsoleProfile(JSContext *context, uintN argc, jsval *vp);
 static JSBool ConsoleGetProfile(JSContext *context, uintN argc, jsval *vp);
 static JSBool ConsoleTrace(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleStartContinuousProfiling(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleStopContinuousProfiling(JSContext *context, uintN argc, jsval *vp);
+static JSBool ConsoleWriteContinuousProfile(JSContext *context, uintN argc, jsval *vp);
 #endif
 
 static JSBool ConsoleSettingsDeleteProperty(JSContext *context, JSObject *this, jsid propID, jsval *value);
@@ -135,6 +169,14 @@ enum
 	kConsole_glRendererString,					// OpenGL GL_RENDERER string, string, read-only
 	kConsole_glFixedFunctionTextureUnitCount,	// GL_MAX_TEXTURE_UNITS_ARB, integer, read-only
 	kConsole_glFragmentShaderTextureUnitCount,	// GL_MAX_TEXTURE_IMAGE_UNITS_ARB, integer, read-only
+	kConsole_collisionBroadphase,				// collision broadphase, symbolic string, read/write
+	kConsole_parallelEntityUpdate,				// update effects on job pool, boolean, read/write
+	kConsole_batchShipIntegration,				// integrate ship movement in one pass, boolean, read/write
+	kConsole_worldScriptCallsMade,				// world script event handler calls, number, read-only
+	kConsole_worldScriptCallsAvoided,			// world script calls skipped for lack of a handler, number, read-only
+	kConsole_jsPrivatePoolStatistics,			// Vector3D and Quaternion private pool statistics, string, read-only
+	kConsole_frameCallbackBudget,				// time frame callbacks may take per frame in ms, 0 for no limit, number, read/write
+	kConsole_frameCallbackStatistics,			// per-callback scheduling and timing, array, read-only
 	
 	// Symbolic constants for debug flags:
 	kConsole_DEBUG_LINKED_LISTS,
@@ -169,6 +211,14 @@ static JSPropertySpec sConsoleProperties[] =
 	{ "glRendererString",					kConsole_glRendererString,					OOJS_PROP_READONLY_CB },
 	{ "glFixedFunctionTextureUnitCount",	kConsole_glFixedFunctionTextureUnitCount,	OOJS_PROP_READONLY_CB },
 	{ "glFragmentShaderTextureUnitCount",	kConsole_glFragmentShaderTextureUnitCount,	OOJS_PROP_READONLY_CB },
+	{ "collisionBroadphase",				kConsole_collisionBroadphase,				OOJS_PROP_READWRITE_CB },
+	{ "parallelEntityUpdate",				kConsole_parallelEntityUpdate,				OOJS_PROP_READWRITE_CB },
+	{ "batchShipIntegration",				kConsole_batchShipIntegration,				OOJS_PROP_READWRITE_CB },
+	{ "worldScriptCallsMade",				kConsole_worldScriptCallsMade,				OOJS_PROP_READONLY_CB },
+	{ "worldScriptCallsAvoided",			kConsole_worldScriptCallsAvoided,			OOJS_PROP_READONLY_CB },
+	{ "jsPrivatePoolStatistics",			kConsole_jsPrivatePoolStatistics,			OOJS_PROP_READONLY_CB },
+	{ "frameCallbackBudget",				kConsole_frameCallbackBudget,				OOJS_PROP_READWRITE_CB },
+	{ "frameCallbackStatistics",			kConsole_frameCallbackStatistics,			OOJS_PROP_READONLY_CB },
 	
 #define DEBUG_FLAG_DECL(x) { #x, kConsole_##x, OOJS_PROP_READONLY_CB }
 	DEBUG_FLAG_DECL(DEBUG_LINKED_LISTS),
@@ -206,6 +256,20 @@ static JSFunctionSpec sConsoleMethods[] =
 	{ "writeMemoryStats",				ConsoleWriteMemoryStats,			0 },
 	{ "writeJSMemoryStats",				ConsoleWriteJSMemoryStats,			0 },
 	{ "garbageCollect",					ConsoleGarbageCollect,				0 },
+#ifndef NDEBUG
+	{ "benchmarkCollisionBroadphase",	ConsoleBenchmarkCollisionBroadphase,	0 },
+	{ "benchmarkLaserBVH",				ConsoleBenchmarkLaserBVH,			0 },
+	{ "benchmarkPhysicsIntegration",	ConsoleBenchmarkPhysicsIntegration,	0 },
+	{ "benchmarkAIDispatch",			ConsoleBenchmarkAIDispatch,			0 },
+	{ "checkParallelUpdateDeterminism",	ConsoleCheckParallelUpdateDeterminism,	0 },
+	{ "benchmarkScriptTimers",			ConsoleBenchmarkScriptTimers,		0 },
+	{ "benchmarkStringExpansion",		ConsoleBenchmarkStringExpansion,	0 },
+	{ "benchmarkOXZReads",				ConsoleBenchmarkOXZReads,			0 },
+	{ "benchmarkMeshLoading",			ConsoleBenchmarkMeshLoading,		0 },
+	{ "benchmarkDATParsing",			ConsoleBenchmarkDATParsing,			0 },
+	{ "checkShipRegistryIncremental",	ConsoleCheckShipRegistryIncremental,	0 },
+	{ "checkLegacyScriptConformance",	ConsoleCheckLegacyScriptConformance,	0 },
+#endif
 #if DEBUG
 	{ "dumpNamedRoots",					ConsoleDumpNamedRoots,				0 },
 	{ "dumpHeap",						ConsoleDumpHeap,					0 },
@@ -214,6 +278,9 @@ static JSFunctionSpec sConsoleMethods[] =
 	{ "profile",						ConsoleProfile,						1 },
 	{ "getProfile",						ConsoleGetProfile,					1 },
 	{ "trace",							ConsoleTrace,						1 },
+	{ "startContinuousProfiling",		ConsoleStartContinuousProfiling,	0 },
+	{ "stopContinuousProfiling",		ConsoleStopContinuousProfiling,		0 },
+	{ "writeContinuousProfile",			ConsoleWriteContinuousProfile,		1 },
 #endif
 	{ 0 }
 };
@@ -374,6 +441,38 @@ static JSBool ConsoleGetProperty(JSContext *context, JSObject *this, jsid propID
 			*value = INT_TO_JSVAL([[OOOpenGLExtensionManager sharedManager] textureImageUnitCount]);
 			break;
 			
+		case kConsole_collisionBroadphase:
+			*value = OOJSValueFromNativeObject(context, OOStringFromCollisionBroadphaseMode([UNIVERSE collisionBroadphaseMode]));
+			break;
+			
+		case kConsole_parallelEntityUpdate:
+			*value = OOJSValueFromBOOL([UNIVERSE parallelEntityUpdate]);
+			break;
+			
+		case kConsole_batchShipIntegration:
+			*value = OOJSValueFromBOOL([UNIVERSE batchShipIntegration]);
+			break;
+			
+		case kConsole_worldScriptCallsMade:
+			JS_NewNumberValue(context, [[PLAYER worldScriptEventIndex] callsMade], value);
+			break;
+			
+		case kConsole_worldScriptCallsAvoided:
+			JS_NewNumberValue(context, [[PLAYER worldScriptEventIndex] callsAvoided], value);
+			break;
+			
+		case kConsole_jsPrivatePoolStatistics:
+			*value = OOJSValueFromNativeObject(context, [NSString stringWithFormat:@"%@\n%@", JSVectorPrivatePoolDescription(), JSQuaternionPrivatePoolDescription()]);
+			break;
+			
+		case kConsole_frameCallbackBudget:
+			JS_NewNumberValue(context, OOJSFrameCallbacksGetBudget() * 1000.0, value);
+			break;
+			
+		case kConsole_frameCallbackStatistics:
+			*value = OOJSValueFromNativeObject(context, OOJSFrameCallbacksStatistics());
+			break;
+			
 #define DEBUG_FLAG_CASE(x) case kConsole_##x: *value = INT_TO_JSVAL(x); break;
 		DEBUG_FLAG_CASE(DEBUG_LINKED_LISTS);
 		DEBUG_FLAG_CASE(DEBUG_COLLISIONS);
@@ -408,6 +507,7 @@ static JSBool ConsoleSetProperty(JSContext *context, JSObject *this, jsid propID
 	
 	int32						iValue;
 	JSBool						bValue = NO;
+	jsdouble					dValue;
 	NSString					*sValue;
 	
 	switch (JSID_TO_INT(propID))
@@ -434,6 +534,34 @@ static JSBool ConsoleSetProperty(JSContext *context, JSObject *this, jsid propID
 			}
 			break;
 			
+		case kConsole_collisionBroadphase:
+			sValue = OOStringFromJSValue(context, *value);
+			OOJS_BEGIN_FULL_NATIVE(context)
+			[UNIVERSE setCollisionBroadphaseMode:OOCollisionBroadphaseModeFromString(sValue)];
+			OOJS_END_FULL_NATIVE
+			break;
+			
+		case kConsole_parallelEntityUpdate:
+			if (JS_ValueToBoolean(context, *value, &bValue))
+			{
+				[UNIVERSE setParallelEntityUpdate:bValue];
+			}
+			break;
+			
+		case kConsole_batchShipIntegration:
+			if (JS_ValueToBoolean(context, *value, &bValue))
+			{
+				[UNIVERSE setBatchShipIntegration:bValue];
+			}
+			break;
+			
+		case kConsole_frameCallbackBudget:
+			if (JS_ValueToNumber(context, *value, &dValue))
+			{
+				OOJSFrameCallbacksSetBudget(dValue / 1000.0);
+			}
+			break;
+			
 		case kConsole_pedanticMode:
 			if (JS_ValueToBoolean(context, *value, &bValue))
 			{
@@ -912,6 +1040,125 @@ static JSBool ConsoleGarbageCollect(JSContext *context, uintN argc, jsval *vp)
 }
 
 
+#ifndef NDEBUG
+/*	Shared body of the benchmark and self-check functions below, which take
+	no arguments and return the report string from a native function.
+*/
+static JSBool ConsoleRunReport(JSContext *context, jsval *vp, NSString *(*report)(void))
+{
+	OOJS_NATIVE_ENTER(context)
+	
+	NSString *result = nil;
+	
+	OOJS_BEGIN_FULL_NATIVE(context)
+	result = report();
+	OOJS_END_FULL_NATIVE
+	
+	OOJS_RETURN_OBJECT(result);
+	
+	OOJS_NATIVE_EXIT
+}
+
+
+// function benchmarkCollisionBroadphase() : String
+static JSBool ConsoleBenchmarkCollisionBroadphase(JSContext *context, uintN argc, jsval *vp)
+{
+	return ConsoleRunReport(context, vp, OOCollisionBroadphaseRunBenchmark);
+}
+
+
+// function benchmarkLaserBVH() : String
+static JSBool ConsoleBenchmarkLaserBVH(JSContext *context, uintN argc, jsval *vp)
+{
+	return ConsoleRunReport(context, vp, OOShipBVHRunBenchmark);
+}
+
+
+// function benchmarkPhysicsIntegration() : String
+static JSBool ConsoleBenchmarkPhysicsIntegration(JSContext *context, uintN argc, jsval *vp)
+{
+	return ConsoleRunReport(context, vp, OOPhysicsStoreRunBenchmark);
+}
+
+
+// function benchmarkAIDispatch() : String
+static JSBool ConsoleBenchmarkAIDispatch(JSContext *context, uintN argc, jsval *vp)
+{
+	return ConsoleRunReport(context, vp, OOAIRunDispatchBenchmark);
+}
+
+
+// function benchmarkScriptTimers() : String
+static JSBool ConsoleBenchmarkScriptTimers(JSContext *context, uintN argc, jsval *vp)
+{
+	return ConsoleRunReport(context, vp, OOScriptTimerRunBenchmark);
+}
+
+
+// function benchmarkStringExpansion() : String
+static JSBool ConsoleBenchmarkStringExpansion(JSContext *context, uintN argc, jsval *vp)
+{
+	return ConsoleRunReport(context, vp, OOStringExpanderRunBenchmark);
+}
+
+
+// function benchmarkOXZReads() : String
+static JSBool ConsoleBenchmarkOXZReads(JSContext *context, uintN argc, jsval *vp)
+{
+	return ConsoleRunReport(context, vp, OOZipArchiveRunBenchmark);
+}
+
+
+// function benchmarkMeshLoading() : String
+static JSBool ConsoleBenchmarkMeshLoading(JSContext *context, uintN argc, jsval *vp)
+{
+	return ConsoleRunReport(context, vp, OOMeshRunLoaderBenchmark);
+}
+
+
+// function benchmarkDATParsing() : String
+static JSBool ConsoleBenchmarkDATParsing(JSContext *context, uintN argc, jsval *vp)
+{
+	return ConsoleRunReport(context, vp, OODATTokenizerRunBenchmark);
+}
+
+
+// function checkShipRegistryIncremental() : String
+static JSBool ConsoleCheckShipRegistryIncremental(JSContext *context, uintN argc, jsval *vp)
+{
+	return ConsoleRunReport(context, vp, OOShipRegistryRunIncrementalCheck);
+}
+
+
+// function checkLegacyScriptConformance() : String
+static JSBool ConsoleCheckLegacyScriptConformance(JSContext *context, uintN argc, jsval *vp)
+{
+	return ConsoleRunReport(context, vp, OOLegacyScriptRunConformanceCheck);
+}
+
+
+// function checkParallelUpdateDeterminism([ticks : Number]) : String
+static JSBool ConsoleCheckParallelUpdateDeterminism(JSContext *context, uintN argc, jsval *vp)
+{
+	OOJS_NATIVE_ENTER(context)
+	
+	int32 ticks = 120;
+	NSString *result = nil;
+	
+	if (argc > 0 && !JS_ValueToInt32(context, OOJS_ARGV[0], &ticks))  return NO;
+	if (ticks < 1)  ticks = 1;
+	
+	OOJS_BEGIN_FULL_NATIVE(context)
+	result = [UNIVERSE checkParallelEntityUpdateDeterminism:ticks];
+	OOJS_END_FULL_NATIVE
+	
+	OOJS_RETURN_OBJECT(result);
+	
+	OOJS_NATIVE_EXIT
+}
+#endif
+
+
 #if DEBUG
 typedef struct
 {
@@ -1075,6 +1322,82 @@ static JSBool ConsoleTrace(JSContext *context, uintN argc, jsval *vp)
 }
 
 
+// function startContinuousProfiling([capacity : Number]) : Boolean
+static JSBool ConsoleStartContinuousProfiling(JSContext *context, uintN argc, jsval *vp)
+{
+	OOJS_NATIVE_ENTER(context)
+	
+	jsdouble capacity = 0;
+	if (argc > 0 && (!JS_ValueToNumber(context, OOJS_ARGV[0], &capacity) || !(capacity >= 0)))
+	{
+		OOJSReportBadArguments(context, @"Console", @"startContinuousProfiling", 1, OOJS_ARGV, nil, @"record count");
+		return NO;
+	}
+	
+	OOJS_RETURN_BOOL(OOJSBeginContinuousProfiling((NSUInteger)fmin(capacity, UINT32_MAX)));
+	
+	OOJS_NATIVE_EXIT
+}
+
+
+// function stopContinuousProfiling() : String
+static JSBool ConsoleStopContinuousProfiling(JSContext *context, uintN argc, jsval *vp)
+{
+	OOJS_NATIVE_ENTER(context)
+	
+	OOJSEndContinuousProfiling();
+	OOJS_RETURN_OBJECT(OOJSContinuousProfileSummary(30));
+	
+	OOJS_NATIVE_EXIT
+}
+
+
+/*	function writeContinuousProfile(fileName : String [, format : String]) : String
+	
+	Format is "collapsed" (flamegraph.pl) or "chrome" (trace event JSON); by
+	default, "chrome" if fileName ends in .json. Relative names are placed in
+	the log directory. Returns the full path; the file is written in the
+	background.
+*/
+static JSBool ConsoleWriteContinuousProfile(JSContext *context, uintN argc, jsval *vp)
+{
+	OOJS_NATIVE_ENTER(context)
+	
+	NSString *path = nil;
+	if (argc > 0)  path = OOStringFromJSValue(context, OOJS_ARGV[0]);
+	if (path == nil)
+	{
+		OOJSReportBadArguments(context, @"Console", @"writeContinuousProfile", MIN(argc, 1U), OOJS_ARGV, nil, @"file name");
+		return NO;
+	}
+	
+	NSString *formatName = nil;
+	if (argc > 1)  formatName = OOStringFromJSValue(context, OOJS_ARGV[1]);
+	if (formatName == nil)  formatName = [[path pathExtension] isEqualToString:@"json"] ? @"chrome" : @"collapsed";
+	
+	OOJSProfileFormat format;
+	if ([formatName isEqualToString:@"collapsed"])  format = kOOJSProfileFormatCollapsedStacks;
+	else if ([formatName isEqualToString:@"chrome"])  format = kOOJSProfileFormatChromeTrace;
+	else
+	{
+		OOJSReportBadArguments(context, @"Console", @"writeContinuousProfile", argc - 1, OOJS_ARGV + 1, nil, @"\"collapsed\" or \"chrome\"");
+		return NO;
+	}
+	
+	if (![path isAbsolutePath])  path = [OOLogHandlerGetLogBasePath() stringByAppendingPathComponent:path];
+	
+	if (!OOJSWriteContinuousProfile(path, format))
+	{
+		OOJSReportError(context, @"There is no continuous profile to write.");
+		return NO;
+	}
+	
+	OOJS_RETURN_OBJECT(path);
+	
+	OOJS_NATIVE_EXIT
+}
+
+
 static JSBool PerformProfiling(JSContext *context, NSString *nominalFunction, uintN argc, jsval *argv, jsval *outRval, BOOL trace, OOTimeProfile **outProfile)
 {
 	// Get function.
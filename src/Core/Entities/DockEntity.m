@@ -997,7 +997,7 @@ MA 02110-1301, USA.
 	BOOL			isEmpty = YES;
 	int				ent_count =		UNIVERSE->n_entities;
 	Entity			**uni_entities =	UNIVERSE->sortedEntities;	// grab the public sorted list
-	Entity			*my_entities[ent_count];
+	Entity			**my_entities = [UNIVERSE beginEntitySnapshot:ent_count];
 	int i;
 	int ship_count = 0;
 	
@@ -1006,7 +1006,7 @@ MA 02110-1301, USA.
 		//on red alert, launch even if the player is trying block the corridor. Ignore cargopods or other small debris.
 		if ([uni_entities[i] isShip] && ([station alertLevel] < STATION_ALERT_LEVEL_RED || ![uni_entities[i] isPlayer]) && [uni_entities[i] mass] > 1000)
 		{
-			my_entities[ship_count++] = [uni_entities[i] retain];		//	retained
+			my_entities[ship_count++] = uni_entities[i];
 		}
 	}
 
@@ -1041,10 +1041,7 @@ MA 02110-1301, USA.
 		}
 	}
 	
-	for (i = 0; i < ship_count; i++)
-	{
-		[my_entities[i] release];		//released
-	}
+	[UNIVERSE endEntitySnapshot:my_entities];
 
 	return isEmpty;
 }
@@ -1057,7 +1054,7 @@ MA 02110-1301, USA.
 	BOOL			isClear = YES;
 	int				ent_count =			UNIVERSE->n_entities;
 	Entity			**uni_entities =	UNIVERSE->sortedEntities;	// grab the public sorted list
-	Entity			*my_entities[ent_count];
+	Entity			**my_entities = [UNIVERSE beginEntitySnapshot:ent_count];
 	int i;
 	int ship_count = 0;
 	
@@ -1065,7 +1062,7 @@ MA 02110-1301, USA.
 	{
 		if (uni_entities[i]->isShip)
 		{
-			my_entities[ship_count++] = [uni_entities[i] retain];		//	retained
+			my_entities[ship_count++] = uni_entities[i];
 		}
 	}
 
@@ -1115,10 +1112,7 @@ MA 02110-1301, USA.
 		}
 	}
 	
-	for (i = 0; i < ship_count; i++)
-	{
-		[my_entities[i] release];		//released
-	}
+	[UNIVERSE endEntitySnapshot:my_entities];
 
 }
 
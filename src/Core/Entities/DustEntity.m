@@ -182,6 +182,17 @@ enum
 }
 
 
+- (BOOL) canUpdateConcurrently
+{
+#if OO_SHADERS
+	// Deciding the shader mode consults the Universe, so do that the first time on the main thread.
+	return shaderMode != kShaderModeUnknown;
+#else
+	return YES;
+#endif
+}
+
+
 #if OO_SHADERS
 - (OOShaderProgram *) shader
 {
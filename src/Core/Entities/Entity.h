@@ -32,7 +32,7 @@ MA 02110-1301, USA.
 #import "OOWeakReference.h"
 #import "OOColor.h"
 
-@class Universe, CollisionRegion, ShipEntity, OOVisualEffectEntity;
+@class Universe, CollisionRegion, ShipEntity, OOVisualEffectEntity, OOPhysicsStore;
 
 
 #ifndef NDEBUG
@@ -170,6 +170,9 @@ enum OOScanClass
 	
 	struct JSObject			*_jsSelf;
 	
+	OOPhysicsStore			*physicsStore;			// not retained; non-nil between -beginBatchIntegrationInStore: and -finishBatchIntegration
+	NSUInteger				physicsSlot;
+	
 @private
 	NSUInteger				_sessionID;
 	
@@ -272,6 +275,28 @@ enum OOScanClass
 
 - (void) update:(OOTimeDelta)delta_t;
 
+/*	When parallel entity update is on, the universe calls -update: on a worker
+	thread for entities whose canUpdateConcurrently is YES. Such an -update:
+	may only change the entity's own state and read the player's. Removing
+	itself from the universe, touching other entities and running scripts go
+	in -finishConcurrentUpdate, which the universe calls on the main thread
+	after -update: in either mode. Both default to doing nothing special.
+*/
+@property (readonly, atomic) BOOL canUpdateConcurrently;
+- (void) finishConcurrentUpdate;
+
+/*	When batch ship integration is on, the universe calls
+	-beginBatchIntegrationInStore: before -update: for entities whose
+	canIntegrateInBatch is YES. Until -finishBatchIntegration, which the
+	universe calls after the update loop, -moveForward: and -applyVelocity:
+	record their movement in the store instead of applying it, and the store
+	applies it to all such entities at once. canIntegrateInBatch defaults to
+	NO.
+*/
+@property (readonly, atomic) BOOL canIntegrateInBatch;
+- (void) beginBatchIntegrationInStore:(OOPhysicsStore *)store;
+- (void) finishBatchIntegration;
+
 - (void) applyVelocity:(OOTimeDelta)delta_t;
 - (BOOL) checkCloseCollisionWith:(Entity *)other;
 
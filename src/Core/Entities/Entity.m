@@ -34,6 +34,7 @@ MA 02110-1301, USA.
 #import "OOConstToString.h"
 
 #import "CollisionRegion.h"
+#import "OOPhysicsStore.h"
 
 #import "NSScannerOOExtensions.h"
 #import "OODebugFlags.h"
@@ -737,6 +738,13 @@ static NSString * const kOOLogEntityVerificationError		= @"entity.linkedList.ver
 
 - (void) moveForward:(double)amount
 {
+	if (physicsStore != nil)
+	{
+		[physicsStore addForwardDistance:amount atSlot:physicsSlot];
+		distanceTravelled += amount;
+		return;
+	}
+	
 	HPVector forward = HPvector_multiply_scalar(HPvector_forward_from_quaternion(orientation), amount);
 	position = HPvector_add(position, forward);
 	distanceTravelled += amount;
@@ -820,8 +828,77 @@ static NSString * const kOOLogEntityVerificationError		= @"entity.linkedList.ver
 }
 
 
+- (BOOL) canUpdateConcurrently
+{
+	return NO;
+}
+
+
+- (void) finishConcurrentUpdate
+{
+}
+
+
+- (BOOL) canIntegrateInBatch
+{
+	return NO;
+}
+
+
+- (void) beginBatchIntegrationInStore:(OOPhysicsStore *)store
+{
+	NSParameterAssert(store != nil && physicsStore == nil);
+	
+	physicsSlot = [store addEntity:self];
+	physicsStore = store;
+}
+
+
+- (void) finishBatchIntegration
+{
+	if (physicsStore == nil)  return;
+	
+	HPVector	newPosition;
+	Quaternion	newOrientation;
+	BOOL		rotated, moved;
+	
+	[physicsStore getPosition:&newPosition orientation:&newOrientation rotated:&rotated moved:&moved atSlot:physicsSlot];
+	physicsStore = nil;
+	physicsSlot = 0;
+	
+	// -update: has already set lastPosition and lastOrientation to the state before this movement.
+	if (rotated)
+	{
+		orientation = newOrientation;
+		[self orientationChanged];
+		hasRotated = hasRotated || !quaternion_equal(orientation, lastOrientation);
+		lastOrientation = orientation;
+	}
+	
+	if (moved)
+	{
+		position = newPosition;
+		hasMoved = hasMoved || !HPvector_equal(position, lastPosition);
+		lastPosition = position;
+		
+		if (_status != STATUS_COCKPIT_DISPLAY && ![self isSubEntity])
+		{
+			zero_distance = HPdistance2(PLAYER->position, position);
+			cam_zero_distance = HPdistance2([PLAYER viewpointPosition], position);
+			[self updateCameraRelativePosition];
+		}
+	}
+}
+
+
 - (void) applyVelocity:(OOTimeDelta)delta_t
 {
+	if (physicsStore != nil)
+	{
+		[physicsStore setDriftsAtSlot:physicsSlot];
+		return;
+	}
+	
 	position = HPvector_add(position, HPvector_multiply_scalar(vectorToHPVector(velocity), delta_t));
 }
 
@@ -117,9 +117,19 @@ static OOTexture *sFlashTexture = nil;
 	// Fade in and out.
 	OOTimeDelta lifeTime = [self timeElapsedSinceSpawn];
 	_colorComponents[3] = _alpha * ((lifeTime < tf) ? (lifeTime / tf) : (_duration - lifeTime) / tf1);
-	
+}
+
+
+- (BOOL) canUpdateConcurrently
+{
+	return YES;
+}
+
+
+- (void) finishConcurrentUpdate
+{
 	// Disappear as necessary.
-	if (lifeTime > _duration)  [UNIVERSE removeEntity:self];
+	if ([self timeElapsedSinceSpawn] > _duration)  [UNIVERSE removeEntity:self];
 }
 
 
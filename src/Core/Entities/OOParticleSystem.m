@@ -124,7 +124,17 @@ MA 02110-1301, USA.
 	{
 		particlePosition[i] = vector_add(particlePosition[i], vector_multiply_scalar(particleVelocity[i], delta_t));
 	}
-	
+}
+
+
+- (BOOL) canUpdateConcurrently
+{
+	return YES;
+}
+
+
+- (void) finishConcurrentUpdate
+{
 	// disappear eventually.
 	if (_timePassed > _duration)  [UNIVERSE removeEntity:self];
 }
@@ -123,7 +123,17 @@ static struct { float x, y; } sCircleVerts[kCircleSegments];	// holds vector coo
 	
 	_innerRadius += delta_t * _innerGrowthRate;
 	_outerRadius += delta_t * _outerGrowthRate;
-	
+}
+
+
+- (BOOL) canUpdateConcurrently
+{
+	return YES;
+}
+
+
+- (void) finishConcurrentUpdate
+{
 	if (_timePassed > kRingDuration)
 	{
 		[UNIVERSE removeEntity:self];
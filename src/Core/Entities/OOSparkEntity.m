@@ -77,9 +77,19 @@ MA 02110-1301, USA.
 	_colorComponents[1] = mix * _baseRGBA[1];
 	_colorComponents[2] = mix * _baseRGBA[2];
 	_colorComponents[3] = mix * _baseRGBA[3];
-	
+}
+
+
+- (BOOL) canUpdateConcurrently
+{
+	return YES;
+}
+
+
+- (void) finishConcurrentUpdate
+{
 	// Disappear when gone.
-	if (mix == 0)  [UNIVERSE removeEntity:self];
+	if (OOClamp_0_1_f(_timeRemaining / _duration) == 0)  [UNIVERSE removeEntity:self];
 }
 
 @end
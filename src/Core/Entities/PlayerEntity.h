@@ -37,7 +37,7 @@ MA 02110-1301, USA.
 @class GuiDisplayGen, OOTrumble, MyOpenGLView, HeadUpDisplay, ShipEntity;
 @class OOSound, OOSoundSource, OOSoundReferencePoint;
 @class OOJoystickManager, OOTexture, OOLaserShotEntity;
-@class StickProfileScreen;
+@class StickProfileScreen, OOJSEventHandlerIndex;
 
 #define ALLOW_CUSTOM_VIEWS_WHILE_PAUSED	1
 #define SCRIPT_TIMER_INTERVAL			10.0
@@ -362,6 +362,7 @@ typedef NS_ENUM(unsigned int, OOMarketSorterMode)
 	
 	NSDictionary			*worldScripts;
 	NSDictionary			*worldScriptsRequiringTickle;
+	OOJSEventHandlerIndex	*worldScriptEventIndex;		// Which world scripts handle which events; built on demand.
 	NSMutableDictionary		*commodityScripts;
 	NSMutableDictionary		*mission_variables;
 	NSMutableDictionary		*localVariables;
@@ -1129,6 +1130,8 @@ typedef NS_ENUM(unsigned int, OOMarketSorterMode)
 // will forward to the world scripts.
 - (BOOL) doWorldEventUntilMissionScreen:(jsid)message;
 - (void) doWorldScriptEvent:(jsid)message inContext:(JSContext *)context withArguments:(jsval *)argv count:(uintN)argc timeLimit:(OOTimeDelta)limit;
+// Only calls world scripts which define a handler; see OOJSEventHandlerIndex.h.
+@property (readonly, atomic) OOJSEventHandlerIndex *worldScriptEventIndex;
 
 @property (readonly, atomic) BOOL showInfoFlag;
 
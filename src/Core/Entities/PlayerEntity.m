@@ -74,6 +74,7 @@ MA 02110-1301, USA.
 #import "CollisionRegion.h"
 
 #import "OOJSScript.h"
+#import "OOJSEventHandlerIndex.h"
 #import "OOScriptTimer.h"
 #import "OOJSEngineTimeManagement.h"
 #import "OOJSInterfaceDefinition.h"
@@ -1809,6 +1810,7 @@ NSComparisonResult marketSorterByMassUnit(id a, id b, void *market);
 	[UNIVERSE setBlockJSPlayerShipProps:NO];	// full access to player.ship properties!
 	DESTROY(worldScripts);
 	DESTROY(worldScriptsRequiringTickle);
+	DESTROY(worldScriptEventIndex);
 	DESTROY(commodityScripts);
 
 #if OOLITE_WINDOWS
@@ -2267,6 +2269,7 @@ NSComparisonResult marketSorterByMassUnit(id a, id b, void *market);
 	DESTROY(eqScripts);
 	DESTROY(worldScripts);
 	DESTROY(worldScriptsRequiringTickle);
+	DESTROY(worldScriptEventIndex);
 	DESTROY(commodityScripts);
 	DESTROY(mission_variables);
 	
@@ -3049,11 +3052,11 @@ NSComparisonResult marketSorterByMassUnit(id a, id b, void *market);
 
 	int				i, ent_count	= UNIVERSE->n_entities;
 	Entity			**uni_entities	= UNIVERSE->sortedEntities;	// grab the public sorted list
-	Entity			*my_entities[ent_count];
+	Entity			**my_entities = [UNIVERSE beginEntitySnapshot:ent_count];
 	Entity			*scannedEntity = nil;
 	for (i = 0; i < ent_count; i++)
 	{
-		my_entities[i] = [uni_entities[i] retain];	// retained
+		my_entities[i] = uni_entities[i];
 	}
 	BOOL massLocked = NO;
 	BOOL foundHostiles = NO;
@@ -3145,10 +3148,7 @@ NSComparisonResult marketSorterByMassUnit(id a, id b, void *market);
 		
 	[self setAlertFlag:ALERT_FLAG_HOSTILES to:foundHostiles];
 
-	for (i = 0; i < ent_count; i++)
-	{
-		[my_entities[i] release];	//	released
-	}
+	[UNIVERSE endEntitySnapshot:my_entities];
 	
 	BOOL energyCritical = NO;
 	if (energy < 64 && energy < maxEnergy * 0.8)
@@ -6623,10 +6623,10 @@ NSComparisonResult marketSorterByMassUnit(id a, id b, void *market);
 		return;
 	int			ent_count =		UNIVERSE->n_entities;
 	Entity**	uni_entities =	UNIVERSE->sortedEntities;	// grab the public sorted list
-	Entity*		my_entities[ent_count];
+	Entity**		my_entities = [UNIVERSE beginEntitySnapshot:ent_count];
 	int i;
 	for (i = 0; i < ent_count; i++)
-		my_entities[i] = [uni_entities[i] retain];		//	retained
+		my_entities[i] = uni_entities[i];
 	for (i = 0; i < ent_count ; i++)
 	{
 		Entity* thing = my_entities[i];
@@ -6639,10 +6639,7 @@ NSComparisonResult marketSorterByMassUnit(id a, id b, void *market);
 			}
 		}
 	}
-	for (i = 0; i < ent_count; i++)
-	{
-		[my_entities[i] release];		//	released
-	}
+	[UNIVERSE endEntitySnapshot:my_entities];
 }
 
 
@@ -12241,7 +12238,7 @@ static NSString *last_outfitting_key=nil;
 
 - (BOOL) doWorldEventUntilMissionScreen:(jsid)message
 {
-	NSEnumerator	*scriptEnum = [worldScripts objectEnumerator];
+	NSEnumerator	*scriptEnum = nil;
 	OOScript		*theScript;
 
 	// Check for the presence of report messages first.
@@ -12253,6 +12250,7 @@ static NSString *last_outfitting_key=nil;
 	}
 	
 	JSContext *context = OOJSAcquireContext();
+	scriptEnum = [[[self worldScriptEventIndex] scriptsHandlingEvent:message inContext:context] objectEnumerator];
 	while ((theScript = [scriptEnum nextObject]) && gui_screen != GUI_SCREEN_MISSION && [self isDocked])
 	{
 		[theScript callMethod:message inContext:context withArguments:NULL count:0 result:NULL];
@@ -12274,14 +12272,18 @@ static NSString *last_outfitting_key=nil;
 {
 	NSParameterAssert(context != NULL && JS_IsInRequest(context));
 	
-	OOScript				*theScript = nil;
-	
-	foreach (theScript, [worldScripts allValues])
+	[[self worldScriptEventIndex] dispatchEvent:message inContext:context withArguments:argv count:argc timeLimit:limit];
+}
+
+
+- (OOJSEventHandlerIndex *) worldScriptEventIndex
+{
+	if (worldScriptEventIndex == nil && worldScripts != nil)
 	{
-		OOJSStartTimeLimiterWithTimeLimit(limit);
-		[theScript callMethod:message inContext:context withArguments:argv count:argc result:NULL];
-		OOJSStopTimeLimiter();
+		worldScriptEventIndex = [[OOJSEventHandlerIndex alloc] initWithScripts:[worldScripts allValues]];
 	}
+	// A handler may reload the world scripts while the index is dispatching.
+	return [[worldScriptEventIndex retain] autorelease];
 }
 
 @synthesize galacticHyperspaceBehaviour;
@@ -27,7 +27,7 @@ MA 02110-1301, USA.
 #import "PlayerEntity.h"
 
 
-@class OOScript;
+@class OOScript, OOLegacyActionList;
 
 
 typedef NS_ENUM(unsigned int, OOComparisonType)
@@ -61,6 +61,7 @@ typedef NS_ENUM(unsigned int, OOOperationType)
 @property (strong) ShipEntity *scriptTarget;
 
 - (void) runScriptActions:(NSArray *)sanitizedActions withContextName:(NSString *)contextName forTarget:(ShipEntity *)target;
+- (void) runCompiledScriptActions:(OOLegacyActionList *)compiledActions withContextName:(NSString *)contextName forTarget:(ShipEntity *)target;
 - (void) runUnsanitizedScriptActions:(NSArray *)unsanitizedActions allowingAIMethods:(BOOL)allowAIMethods withContextName:(NSString *)contextName forTarget:(ShipEntity *)target;
 
 // Test (sanitized) legacy script conditions array.
@@ -262,3 +263,13 @@ typedef NS_ENUM(unsigned int, OOOperationType)
 @end
 
 NSString *OOComparisonTypeToString(OOComparisonType type) CONST_FUNC;
+
+
+#ifndef NDEBUG
+/*	Evaluate every condition of every loaded plist world script both
+	interpreted and compiled (see OOLegacyScriptCompiler.h), with the random
+	state reset between the two so d100_number and friends agree, and compare
+	the results and compiled actions. Returns a summary with timings.
+*/
+NSString *OOLegacyScriptRunConformanceCheck(void);
+#endif
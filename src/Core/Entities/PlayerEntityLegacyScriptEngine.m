@@ -48,11 +48,18 @@ MA 02110-1301, USA.
 #import "StationEntity.h"
 #import "Comparison.h"
 #import "OOLegacyScriptWhitelist.h"
+#import "OOLegacyScriptCompiler.h"
 #import "OOJavaScriptEngine.h"
 #import "OOEquipmentType.h"
 #import "HeadUpDisplay.h"
 #import "OOSystemDescriptionManager.h"
 #import "OOEntityFilterPredicate.h"
+#import "OOPListScript.h"
+#import "legacy_random.h"
+
+#ifndef NDEBUG
+#import "OOProfilingStopwatch.h"
+#endif
 
 
 static NSString * const kOOLogScriptAddShipsFailed			= @"script.addShips.failed";
@@ -107,6 +114,11 @@ static ShipEntity	*scriptTarget = nil;
 - (BOOL) scriptTestCondition:(NSArray *)scriptCondition;
 - (NSString *) expandScriptRightHandSide:(NSArray *)rhsComponents;
 
+- (BOOL) scriptTestCompiledCondition:(const OOLegacyCondition *)condition;
+- (NSString *) expandCompiledRightHandSide:(const OOLegacyCondition *)condition;
+
+- (void) runScriptActions:(NSArray *)actions compiledActions:(OOLegacyActionList *)compiledActions withContextName:(NSString *)contextName forTarget:(ShipEntity *)target;
+
 - (void) scriptActions:(NSArray *)actions forTarget:(ShipEntity *)target missionKey:(NSString *)missionKey;
 - (NSString *) expandMessage:(NSString *)valueString;
 
@@ -137,6 +149,10 @@ static void PerformConditionalStatment(NSArray *actions, Entity *target);
 static void PerformActionStatment(NSArray *statement, Entity *target);
 static BOOL TestScriptConditions(NSArray *conditions);
 
+static void PerformCompiledScriptActions(OOLegacyActionList *actions, Entity *target);
+static void PerformCompiledActionStatement(const OOLegacyStatement *statement, Entity *target);
+static BOOL TestCompiledScriptConditions(OOLegacyConditionList *conditions);
+
 
 static void PerformScriptActions(NSArray *actions, Entity *target)
 {
@@ -245,6 +261,78 @@ static BOOL TestScriptConditions(NSArray *conditions)
 }
 
 
+/*	Compiled equivalents of the above; see OOLegacyScriptCompiler.h. They
+	must behave exactly like the interpreted versions, which
+	OOLegacyScriptRunConformanceCheck() verifies.
+*/
+static void PerformCompiledScriptActions(OOLegacyActionList *actions, Entity *target)
+{
+	const OOLegacyStatement	*statements = [actions statements];
+	NSUInteger				i, count = [actions count];
+	
+	for (i = 0; i < count; i++)
+	{
+		const OOLegacyStatement *statement = &statements[i];
+		if (statement->isConditional)
+		{
+			if (TestCompiledScriptConditions(statement->conditions))
+			{
+				PerformCompiledScriptActions(statement->ifTrue, target);
+			}
+			else
+			{
+				PerformCompiledScriptActions(statement->ifFalse, target);
+			}
+		}
+		else
+		{
+			PerformCompiledActionStatement(statement, target);
+		}
+	}
+}
+
+
+static void PerformCompiledActionStatement(const OOLegacyStatement *statement, Entity *target)
+{
+	NSString				*expandedString = nil;
+	NSMutableDictionary		*locals = nil;
+	PlayerEntity			*player = PLAYER;
+	SEL						selector = statement->selector;
+	
+	if (target == nil || ![target respondsToSelector:selector])
+	{
+		target = player;
+	}
+	
+	if (statement->argument != nil)
+	{
+		locals = [player localVariablesForMission:sCurrentMissionKey];
+		expandedString = OOExpandDescriptionString(OOStringExpanderDefaultRandomSeed(), statement->argument, nil, locals, nil, kOOExpandNoOptions);
+		
+		[target performSelector:selector withObject:expandedString];
+	}
+	else
+	{
+		[target performSelector:selector];
+	}
+}
+
+
+static BOOL TestCompiledScriptConditions(OOLegacyConditionList *conditions)
+{
+	const OOLegacyCondition	*compiled = [conditions conditions];
+	NSUInteger				i, count = [conditions count];
+	PlayerEntity			*player = PLAYER;
+	
+	for (i = 0; i < count; i++)
+	{
+		if (![player scriptTestCompiledCondition:&compiled[i]])  return NO;
+	}
+	
+	return YES;
+}
+
+
 - (void) setScriptTarget:(ShipEntity *)ship
 {
 	scriptTarget = ship;
@@ -359,6 +447,19 @@ static BOOL sRunningScript = NO;
 
 
 - (void)runScriptActions:(NSArray *)actions withContextName:(NSString *)contextName forTarget:(ShipEntity *)target
+{
+	[self runScriptActions:actions compiledActions:nil withContextName:contextName forTarget:target];
+}
+
+
+- (void) runCompiledScriptActions:(OOLegacyActionList *)compiledActions withContextName:(NSString *)contextName forTarget:(ShipEntity *)target
+{
+	[self runScriptActions:nil compiledActions:compiledActions withContextName:contextName forTarget:target];
+}
+
+
+// Exactly one of actions and compiledActions is expected to be non-nil.
+- (void) runScriptActions:(NSArray *)actions compiledActions:(OOLegacyActionList *)compiledActions withContextName:(NSString *)contextName forTarget:(ShipEntity *)target
 {
 	NSAutoreleasePool		*pool = nil;
 	NSString				*oldMissionKey = nil;
@@ -372,7 +473,8 @@ static BOOL sRunningScript = NO;
 	
 	@try
 	{
-		PerformScriptActions(actions, target);
+		if (compiledActions != nil)  PerformCompiledScriptActions(compiledActions, target);
+		else  PerformScriptActions(actions, target);
 	}
 	@catch (NSException *exception)
 	{
@@ -641,6 +743,200 @@ static BOOL sRunningScript = NO;
 }
 
 
+- (BOOL) scriptTestCompiledCondition:(const OOLegacyCondition *)condition
+{
+	/*	Compiled equivalent of -scriptTestCondition:. The right-hand side is
+		still evaluated before the left-hand side, and mission/local variables
+		still go through -mission_string, so that selectors with side effects
+		(such as d100_number) are called in the same order.
+	*/
+	
+	OOOperationType				opType = condition->opType;
+	OOComparisonType			comparator = condition->comparator;
+	SEL							selector = condition->selector;
+	BOOL						constantRHS = condition->rhsIsConstant;
+	NSString					*lhsString = nil;
+	NSString					*expandedRHS = nil;
+	NSArray						*rhsComponents = nil;
+	NSUInteger					i, count;
+	NSCharacterSet				*whitespace = nil;
+	double						lhsValue, rhsValue;
+	BOOL						lhsFlag, rhsFlag;
+	
+	if (opType == OP_FALSE)  return NO;
+	
+	if (opType == OP_MISSION_VAR)
+	{
+		sMissionStringValue = [mission_variables objectForKey:condition->variableName];
+		selector = @selector(mission_string);
+		opType = OP_STRING;
+	}
+	else if (opType == OP_LOCAL_VAR)
+	{
+		sMissionStringValue = [[self localVariablesForMission:sCurrentMissionKey] objectForKey:condition->variableName];
+		selector = @selector(mission_string);
+		opType = OP_STRING;
+	}
+	
+	if (constantRHS)  expandedRHS = condition->constantRHS;
+	else  expandedRHS = [self expandCompiledRightHandSide:condition];
+	
+	if (opType == OP_STRING)
+	{
+		lhsString = [self performSelector:selector];
+		
+		switch (comparator)
+		{
+			case COMPARISON_UNDEFINED:
+				return lhsString == nil;
+				
+			case COMPARISON_EQUAL:
+				return [lhsString isEqualToString:expandedRHS];
+				
+			case COMPARISON_NOTEQUAL:
+				return ![lhsString isEqualToString:expandedRHS];
+				
+			case COMPARISON_LESSTHAN:
+				return DOUBLEVAL(lhsString) < (constantRHS ? condition->constantNumber : DOUBLEVAL(expandedRHS));
+				
+			case COMPARISON_GREATERTHAN:
+				return DOUBLEVAL(lhsString) > (constantRHS ? condition->constantNumber : DOUBLEVAL(expandedRHS));
+				
+			case COMPARISON_ONEOF:
+				{
+					whitespace = [NSCharacterSet whitespaceCharacterSet];
+					lhsString = [lhsString stringByTrimmingCharactersInSet:whitespace];
+					
+					if (constantRHS)
+					{
+						NSString *rhsItem = nil;
+						foreach (rhsItem, condition->constantStrings)
+						{
+							if ([lhsString isEqualToString:rhsItem])  return YES;
+						}
+					}
+					else
+					{
+						rhsComponents = [expandedRHS componentsSeparatedByString:@","];
+						count = [rhsComponents count];
+						
+						for (i = 0; i < count; i++)
+						{
+							if ([lhsString isEqualToString:[[rhsComponents objectAtIndex:i] stringByTrimmingCharactersInSet:whitespace]])
+							{
+								return YES;
+							}
+						}
+					}
+				}
+				return NO;
+		}
+	}
+	else if (opType == OP_NUMBER)
+	{
+		lhsValue = [[self performSelector:selector] doubleValue];
+		
+		if (comparator == COMPARISON_ONEOF)
+		{
+			if (constantRHS)
+			{
+				count = condition->constantNumberCount;
+				for (i = 0; i < count; i++)
+				{
+					if (lhsValue == condition->constantNumbers[i])  return YES;
+				}
+			}
+			else
+			{
+				rhsComponents = [expandedRHS componentsSeparatedByString:@","];
+				count = [rhsComponents count];
+				
+				for (i = 0; i < count; i++)
+				{
+					if (lhsValue == [[rhsComponents objectAtIndex:i] doubleValue])  return YES;
+				}
+			}
+			
+			return NO;
+		}
+		else
+		{
+			rhsValue = constantRHS ? condition->constantNumber : [expandedRHS doubleValue];
+			
+			switch (comparator)
+			{
+				case COMPARISON_EQUAL:
+					return lhsValue == rhsValue;
+					
+				case COMPARISON_NOTEQUAL:
+					return lhsValue != rhsValue;
+					
+				case COMPARISON_LESSTHAN:
+					return lhsValue < rhsValue;
+					
+				case COMPARISON_GREATERTHAN:
+					return lhsValue > rhsValue;
+					
+				case COMPARISON_UNDEFINED:
+				case COMPARISON_ONEOF:
+					OOLog(@"script.error.unexpectedOperator", @"***** SCRIPT ERROR: in %@, operator %@ is not valid for numbers, evaluating to false.", CurrentScriptDesc(), OOComparisonTypeToString(comparator));
+					return NO;
+			}
+		}
+	}
+	else if (opType == OP_BOOL)
+	{
+		lhsFlag = [[self performSelector:selector] isEqualToString:@"YES"];
+		rhsFlag = constantRHS ? condition->constantFlag : [expandedRHS isEqualToString:@"YES"];
+		
+		switch (comparator)
+		{
+			case COMPARISON_EQUAL:
+				return lhsFlag == rhsFlag;
+				
+			case COMPARISON_NOTEQUAL:
+				return lhsFlag != rhsFlag;
+				
+			case COMPARISON_LESSTHAN:
+			case COMPARISON_GREATERTHAN:
+			case COMPARISON_UNDEFINED:
+			case COMPARISON_ONEOF:
+				OOLog(@"script.error.unexpectedOperator", @"***** SCRIPT ERROR: in %@, operator %@ is not valid for booleans, evaluating to false.", CurrentScriptDesc(), OOComparisonTypeToString(comparator));
+				return NO;
+		}
+	}
+	
+	OOLog(@"script.error.fallthrough", @"***** SCRIPT ERROR: in %@, unhandled condition '%@' (%@). %@", CurrentScriptDesc(), [condition->source objectAtIndex:1], condition->source, @"This is an internal error, please report it.");
+	return NO;
+}
+
+
+- (NSString *) expandCompiledRightHandSide:(const OOLegacyCondition *)condition
+{
+	NSUInteger				i, count = condition->operandCount;
+	NSMutableArray			*result = [NSMutableArray arrayWithCapacity:count];
+	NSString				*value = nil;
+	
+	for (i = 0; i < count; i++)
+	{
+		const OOLegacyOperand *operand = &condition->operands[i];
+		if (operand->selector != NULL)
+		{
+			value = [[self performSelector:operand->selector] description];
+			if (value == nil)  value = @"(null)";	// for backwards compatibility
+		}
+		else
+		{
+			value = operand->literal;
+		}
+		
+		[result addObject:value];
+	}
+	
+	return [result componentsJoinedByString:@" "];
+}
+
+
 - (NSDictionary *) missionVariables
 {
 	return mission_variables;
@@ -2257,10 +2553,10 @@ static int shipsFound;
 		return;
 	int			ent_count =		UNIVERSE->n_entities;
 	Entity**	uni_entities =	UNIVERSE->sortedEntities;	// grab the public sorted list
-	Entity*		my_entities[ent_count];
+	Entity**		my_entities = [UNIVERSE beginEntitySnapshot:ent_count];
 	int i;
 	for (i = 0; i < ent_count; i++)
-		my_entities[i] = [uni_entities[i] retain];		//	retained
+		my_entities[i] = uni_entities[i];
 
 	for (i = 1; i < ent_count; i++)
 	{
@@ -2284,10 +2580,7 @@ static int shipsFound;
 		}
 	}
 	
-	for (i = 0; i < ent_count; i++)
-	{
-		[my_entities[i] release];		//	released
-	}
+	[UNIVERSE endEntitySnapshot:my_entities];
 }
 
 
@@ -2978,3 +3271,166 @@ NSString *OOComparisonTypeToString(OOComparisonType type)
 	}
 	return @"<error: invalid comparison type>";
 }
+
+
+#ifndef NDEBUG
+
+enum
+{
+	kConformanceTimingRepeats		= 32
+};
+
+
+typedef struct
+{
+	NSUInteger				scripts;
+	NSUInteger				conditions;
+	NSUInteger				actions;
+	NSUInteger				mismatches;
+	OOTimeDelta				interpretedTime;
+	OOTimeDelta				compiledTime;
+	OOProfilingStopwatch	*stopwatch;
+} ConformanceState;
+
+
+// Returns -1 if the condition throws.
+static int TestConditionForConformance(PlayerEntity *player, NSArray *sanitized, const OOLegacyCondition *compiled)
+{
+	@try
+	{
+		if (compiled != NULL)  return [player scriptTestCompiledCondition:compiled];
+		else  return [player scriptTestCondition:sanitized];
+	}
+	@catch (NSException *exception)
+	{
+		return -1;
+	}
+}
+
+
+static void CheckConditionConformance(NSArray *sanitized, const OOLegacyCondition *compiled, ConformanceState *state)
+{
+	PlayerEntity	*player = PLAYER;
+	OORandomState	randomState = OOSaveRandomState();
+	unsigned		i;
+	
+	int interpreted = TestConditionForConformance(player, sanitized, NULL);
+	OORestoreRandomState(randomState);
+	int fromCompiled = TestConditionForConformance(player, nil, compiled);
+	
+	state->conditions++;
+	if (interpreted != fromCompiled)
+	{
+		state->mismatches++;
+		OOLog(@"script.legacy.conformance.mismatch", @"Legacy condition \"%@\" in %@ evaluated to %i interpreted but %i compiled.", [sanitized objectAtIndex:1], CurrentScriptDesc(), interpreted, fromCompiled);
+	}
+	
+	// Timing, with the same random state for both.
+	OORestoreRandomState(randomState);
+	[state->stopwatch reset];
+	for (i = 0; i < kConformanceTimingRepeats; i++)  TestConditionForConformance(player, sanitized, NULL);
+	state->interpretedTime += [state->stopwatch reset];
+	
+	OORestoreRandomState(randomState);
+	[state->stopwatch reset];
+	for (i = 0; i < kConformanceTimingRepeats; i++)  TestConditionForConformance(player, nil, compiled);
+	state->compiledTime += [state->stopwatch reset];
+	
+	OORestoreRandomState(randomState);
+}
+
+
+static void CheckActionsConformance(NSArray *sanitized, OOLegacyActionList *compiled, ConformanceState *state)
+{
+	NSUInteger					i, j, count = [sanitized count];
+	const OOLegacyStatement		*statements = [compiled statements];
+	
+	if (count != [compiled count])
+	{
+		state->mismatches++;
+		OOLog(@"script.legacy.conformance.mismatch", @"Compiled action list in %@ has %lu statements, expected %lu.", CurrentScriptDesc(), (unsigned long)[compiled count], (unsigned long)count);
+		return;
+	}
+	
+	for (i = 0; i < count; i++)
+	{
+		NSArray *statement = [sanitized objectAtIndex:i];
+		const OOLegacyStatement *compiledStatement = &statements[i];
+		
+		if ([[statement objectAtIndex:0] boolValue] != compiledStatement->isConditional)
+		{
+			state->mismatches++;
+			OOLog(@"script.legacy.conformance.mismatch", @"Statement kind mismatch for %@ in %@.", statement, CurrentScriptDesc());
+			continue;
+		}
+		
+		if (compiledStatement->isConditional)
+		{
+			NSArray *conditions = [statement oo_arrayAtIndex:1];
+			OOLegacyConditionList *compiledConditions = compiledStatement->conditions;
+			NSUInteger conditionCount = [conditions count];
+			
+			if (conditionCount != [compiledConditions count])
+			{
+				state->mismatches++;
+				OOLog(@"script.legacy.conformance.mismatch", @"Compiled condition list for %@ in %@ has the wrong length.", statement, CurrentScriptDesc());
+			}
+			else
+			{
+				for (j = 0; j < conditionCount; j++)
+				{
+					CheckConditionConformance([conditions objectAtIndex:j], &[compiledConditions conditions][j], state);
+				}
+			}
+			
+			CheckActionsConformance([statement oo_arrayAtIndex:2], compiledStatement->ifTrue, state);
+			CheckActionsConformance([statement oo_arrayAtIndex:3], compiledStatement->ifFalse, state);
+		}
+		else
+		{
+			NSString *argument = ([statement count] > 2) ? [statement objectAtIndex:2] : nil;
+			
+			state->actions++;
+			if (![NSStringFromSelector(compiledStatement->selector) isEqualToString:[statement objectAtIndex:1]] ||
+				(argument != compiledStatement->argument && ![argument isEqualToString:compiledStatement->argument]))
+			{
+				state->mismatches++;
+				OOLog(@"script.legacy.conformance.mismatch", @"Compiled action %@ %@ does not match %@ in %@.", NSStringFromSelector(compiledStatement->selector), compiledStatement->argument, statement, CurrentScriptDesc());
+			}
+		}
+	}
+}
+
+
+NSString *OOLegacyScriptRunConformanceCheck(void)
+{
+	NSAutoreleasePool		*pool = [[NSAutoreleasePool alloc] init];
+	ConformanceState		state = { 0, 0, 0, 0, 0, 0, [OOProfilingStopwatch stopwatch] };
+	NSString				*oldMissionKey = sCurrentMissionKey;
+	OOScript				*script = nil;
+	
+	foreach (script, [[PLAYER worldScriptsByName] allValues])
+	{
+		if (![script isKindOfClass:[OOPListScript class]])  continue;
+		OOPListScript *plistScript = (OOPListScript *)script;
+		
+		state.scripts++;
+		sCurrentMissionKey = [plistScript name];
+		CheckActionsConformance([plistScript sanitizedScript], [plistScript compiledScript], &state);
+	}
+	sCurrentMissionKey = oldMissionKey;
+	
+	double scale = 1e6 / kConformanceTimingRepeats;
+	NSString *result = [NSString stringWithFormat:@"%lu legacy scripts, %lu conditions, %lu actions: interpreted conditions %.1f us/pass, compiled %.1f us/pass (%.1fx)%@",
+						(unsigned long)state.scripts, (unsigned long)state.conditions, (unsigned long)state.actions,
+						state.interpretedTime * scale, state.compiledTime * scale,
+						(state.compiledTime > 0) ? state.interpretedTime / state.compiledTime : 0.0,
+						(state.mismatches == 0) ? @"" : [NSString stringWithFormat:@" ** %lu MISMATCHES **", (unsigned long)state.mismatches]];
+	OOLog(@"script.legacy.conformance", @"%@", result);
+	
+	[result retain];
+	[pool release];
+	return [result autorelease];
+}
+
+#endif
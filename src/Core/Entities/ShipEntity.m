@@ -82,6 +82,8 @@ MA 02110-1301, USA.
 #import "GuiDisplayGen.h"
 #import "HeadUpDisplay.h"
 #import "OOEntityFilterPredicate.h"
+#import "OOShipNeighbourCache.h"
+#import "OOPhysicsStore.h"
 #import "OOShipRegistry.h"
 #import "OOEquipmentType.h"
 
@@ -146,6 +148,7 @@ static GLfloat calcFuelChargeRate (GLfloat myMass)
 @property (readonly, strong, atomic) Entity<OOStellarBody> *lastAegisLock;
 
 - (void) addSubEntity:(Entity<OOSubEntity> *) subent;
+- (void) updateSubEntities:(OOTimeDelta)delta_t;
 
 - (void) refreshEscortPositions;
 - (HPVector) coordinatesForEscortPosition:(unsigned)idx;
@@ -2235,21 +2238,7 @@ ShipEntity* doOctreesCollide(ShipEntity* prime, ShipEntity* other)
 		}
 
 		[super update:delta_t];
-		if ([self subEntityCount] > 0)
-		{
-			// only copy the subent array if there are subentities
-			ShipEntity *se = nil;
-			foreach (se, [self subEntities])
-			{
-				[se update:delta_t];
-				if ([se isShip])
-				{
-					BoundingBox sebb = [se findSubentityBoundingBox];
-					bounding_box_add_vector(&totalBoundingBox, sebb.max);
-					bounding_box_add_vector(&totalBoundingBox, sebb.min);
-				}
-			}
-		}
+		[self updateSubEntities:delta_t];
 		return;
 	}
 
@@ -2652,8 +2641,19 @@ ShipEntity* doOctreesCollide(ShipEntity* prime, ShipEntity* other)
 	// super update
 	[super update:delta_t];
 
-	// update subentities
+	// update subentities; in batch integration, they follow the ship's movement in -finishBatchIntegration.
+	if (physicsStore == nil)  [self updateSubEntities:delta_t];
+	
+	if (aiScriptWakeTime > 0 && [PLAYER clockTimeAdjusted] > aiScriptWakeTime)
+	{
+		aiScriptWakeTime = 0;
+		[self doScriptEvent:OOJSID("aiAwoken")];
+	}
+}
+
 
+- (void) updateSubEntities:(OOTimeDelta)delta_t
+{
 	if ([self subEntityCount] > 0)
 	{
 		// only copy the subent array if there are subentities
@@ -2669,12 +2669,24 @@ ShipEntity* doOctreesCollide(ShipEntity* prime, ShipEntity* other)
 			}
 		}
 	}
+}
+
+
+- (BOOL) canIntegrateInBatch
+{
+	// Subentities move with their parent, and the player's flight model is its own.
+	return [self status] == STATUS_IN_FLIGHT && ![self isPlayer] && ![self isSubEntity] && !isDemoShip &&
+		(quaternion_equal(subentityRotationalVelocity, kIdentityQuaternion) ||
+		 quaternion_equal(subentityRotationalVelocity, kZeroQuaternion));
+}
+
+
+- (void) finishBatchIntegration
+{
+	if (physicsStore == nil)  return;
 	
-	if (aiScriptWakeTime > 0 && [PLAYER clockTimeAdjusted] > aiScriptWakeTime)
-	{
-		aiScriptWakeTime = 0;
-		[self doScriptEvent:OOJSID("aiAwoken")];
-	}
+	[super finishBatchIntegration];
+	[self updateSubEntities:[UNIVERSE getTimeDelta]];
 }
 
 
@@ -6628,6 +6640,12 @@ static GLfloat scripted_color[4] = 	{ 0.0, 0.0, 0.0, 0.0};	// to be defined by s
 	if (roll1)  quaternion_rotate_about_z(&q1, -roll1);
 	if (climb1)  quaternion_rotate_about_x(&q1, -climb1);
 
+	if (physicsStore != nil)
+	{
+		[physicsStore addRotation:q1 atSlot:physicsSlot];
+		return;
+	}
+	
 	orientation = quaternion_multiply(q1, orientation);
 	[self orientationChanged];
 }
@@ -6647,6 +6665,12 @@ static GLfloat scripted_color[4] = 	{ 0.0, 0.0, 0.0, 0.0};	// to be defined by s
 	if (yaw1)
 		quaternion_rotate_about_y(&q1, -yaw1);
 
+	if (physicsStore != nil)
+	{
+		[physicsStore addRotation:q1 atSlot:physicsSlot];
+		return;
+	}
+	
 	orientation = quaternion_multiply(q1, orientation);
 	[self orientationChanged];
 }
@@ -8767,7 +8791,7 @@ NSComparisonResult ComparePlanetsBySurfaceDistance(id i1, id i2, void* context)
 				[UNIVERSE addEntity:ring];
 			}
 			
-			BOOL add_debris = (UNIVERSE->n_entities < 0.95 * UNIVERSE_MAX_ENTITIES) &&
+			BOOL add_debris = (UNIVERSE->n_entities < 0.95 * UNIVERSE_DEBRIS_ENTITY_LIMIT) &&
 									  ([UNIVERSE getTimeDelta] < 0.125);	  // FPS > 8
 			
 			
@@ -8903,7 +8927,7 @@ NSComparisonResult ComparePlanetsBySurfaceDistance(id i1, id i2, void* context)
 				{
 					NSUInteger n_wreckage = 0;
 					
-					if (UNIVERSE->n_entities < 0.50 * UNIVERSE_MAX_ENTITIES)
+					if (UNIVERSE->n_entities < 0.50 * UNIVERSE_DEBRIS_ENTITY_LIMIT)
 					{
 						// Create wreckage only when UNIVERSE is less than half full.
 						// (condition set in r906 - was < 0.75 before) --Kaks 2011.10.17
@@ -9358,86 +9382,43 @@ Vector positionOffsetForShipInRotationToAlignment(ShipEntity* ship, Quaternion q
 
 - (void) checkScanner
 {
-	Entity* scan;
+	const OOShipNeighbour	*neighbours = NULL;
+	NSUInteger				i, count = [[UNIVERSE shipNeighbourCache] getNeighbours:&neighbours ofShip:self inRange:scannerRange];
+	
+	// Neighbours come nearest first, so the nearest MAX_SCAN_NUMBER ships are kept.
 	n_scanned_ships = 0;
-	//
-	scan = z_previous;	while ((scan)&&(scan->isShip == NO))	scan = scan->z_previous;	// skip non-ships
-	GLfloat scannerRange2 = scannerRange * scannerRange;
-	while ((scan)&&(scan->position.z > position.z - scannerRange)&&(n_scanned_ships < MAX_SCAN_NUMBER))
+	for (i = 0; i < count && n_scanned_ships < MAX_SCAN_NUMBER; i++)
 	{
+		ShipEntity *ship = neighbours[i].ship;
+		
 		// can't scan cloaked ships
-		if (scan->isShip && ![(ShipEntity*)scan isCloaked] && [self isValidTarget:scan])
+		if (![ship isCloaked] && [self isValidTarget:ship])
 		{
-			distance2_scanned_ships[n_scanned_ships] = HPdistance2(position, scan->position);
-			if (distance2_scanned_ships[n_scanned_ships] < scannerRange2)
-				scanned_ships[n_scanned_ships++] = (ShipEntity*)scan;
+			distance2_scanned_ships[n_scanned_ships] = neighbours[i].distanceSquared;
+			scanned_ships[n_scanned_ships++] = ship;
 		}
-		scan = scan->z_previous;	while ((scan)&&(scan->isShip == NO))	scan = scan->z_previous;
 	}
-	//
-	scan = z_next;	while ((scan)&&(scan->isShip == NO))	scan = scan->z_next;	// skip non-ships
-	while ((scan)&&(scan->position.z < position.z + scannerRange)&&(n_scanned_ships < MAX_SCAN_NUMBER))
-	{
-		if (scan->isShip && ![(ShipEntity*)scan isCloaked] && [self isValidTarget:scan])
-		{
-			distance2_scanned_ships[n_scanned_ships] = HPdistance2(position, scan->position);
-			if (distance2_scanned_ships[n_scanned_ships] < scannerRange2)
-				scanned_ships[n_scanned_ships++] = (ShipEntity*)scan;
-		}
-		scan = scan->z_next;	while ((scan)&&(scan->isShip == NO))	scan = scan->z_next;	// skip non-ships
-	}
-	//
 	scanned_ships[n_scanned_ships] = nil;	// terminate array
 }
 
 
 - (void) checkScannerIgnoringUnpowered
 {
-	Entity* scan;
+	const OOShipNeighbour	*neighbours = NULL;
+	NSUInteger				i, count = [[UNIVERSE shipNeighbourCache] getNeighbours:&neighbours ofShip:self inRange:scannerRange];
+	
 	n_scanned_ships = 0;
-	//
-	GLfloat scannerRange2 = scannerRange * scannerRange;
-	scan = z_previous;	
-	while ((scan)&&((scan->isShip == NO)||(scan->scanClass==CLASS_ROCK)||(scan->scanClass==CLASS_CARGO)))	
-	{
-		scan = scan->z_previous;	// skip non-ships
-	}
-	while ((scan)&&(scan->position.z > position.z - scannerRange)&&(n_scanned_ships < MAX_SCAN_NUMBER))
+	for (i = 0; i < count && n_scanned_ships < MAX_SCAN_NUMBER; i++)
 	{
-		if (scan->isShip && ![(ShipEntity*)scan isCloaked])
-		{
-			distance2_scanned_ships[n_scanned_ships] = HPdistance2(position, scan->position);
-			if (distance2_scanned_ships[n_scanned_ships] < scannerRange2)
-				scanned_ships[n_scanned_ships++] = (ShipEntity*)scan;
-		}
-		scan = scan->z_previous;
-		while ((scan)&&((scan->isShip == NO)||(scan->scanClass==CLASS_ROCK)||(scan->scanClass==CLASS_CARGO)))	
-		{
-			scan = scan->z_previous;	// skip non-ships
-		}
-	}
-	//
-	scan = z_next;	
-	while ((scan)&&((scan->isShip == NO)||(scan->scanClass==CLASS_ROCK)||(scan->scanClass==CLASS_CARGO)))	
-	{
-		scan = scan->z_next;	// skip non-ships
-	}
-
-	while ((scan)&&(scan->position.z < position.z + scannerRange)&&(n_scanned_ships < MAX_SCAN_NUMBER))
-	{
-		if (scan->isShip && ![(ShipEntity*)scan isCloaked])
-		{
-			distance2_scanned_ships[n_scanned_ships] = HPdistance2(position, scan->position);
-			if (distance2_scanned_ships[n_scanned_ships] < scannerRange2)
-				scanned_ships[n_scanned_ships++] = (ShipEntity*)scan;
-		}
-		scan = scan->z_next;
-		while ((scan)&&((scan->isShip == NO)||(scan->scanClass==CLASS_ROCK)||(scan->scanClass==CLASS_CARGO)))	
+		ShipEntity *ship = neighbours[i].ship;
+		
+		// skip rocks, cargo and cloaked ships
+		if (ship->scanClass != CLASS_ROCK && ship->scanClass != CLASS_CARGO && ![ship isCloaked])
 		{
-			scan = scan->z_next;	// skip non-ships
+			distance2_scanned_ships[n_scanned_ships] = neighbours[i].distanceSquared;
+			scanned_ships[n_scanned_ships++] = ship;
 		}
 	}
-	//
 	scanned_ships[n_scanned_ships] = nil;	// terminate array
 }
 
@@ -13432,12 +13413,12 @@ Vector positionOffsetForShipInRotationToAlignment(ShipEntity* ship, Quaternion q
 		return;
 	int			ent_count = UNIVERSE->n_entities;
 	Entity		**uni_entities = UNIVERSE->sortedEntities;	// grab the public sorted list
-	Entity		*my_entities[ent_count];
+	Entity		**my_entities = [UNIVERSE beginEntitySnapshot:ent_count];
 	int i;
 	int station_count = 0;
 	for (i = 0; i < ent_count; i++)
 		if (uni_entities[i]->isStation)
-			my_entities[station_count++] = [uni_entities[i] retain];		//	retained
+			my_entities[station_count++] = uni_entities[i];
 	//
 	StationEntity *thing = nil, *station = nil;
 	double range2, nearest2 = SCANNER_MAX_RANGE2 * 1000000.0; // 1000x typical scanner range (25600 km), squared.
@@ -13451,8 +13432,7 @@ Vector positionOffsetForShipInRotationToAlignment(ShipEntity* ship, Quaternion q
 			nearest2 = range2;
 		}
 	}
-	for (i = 0; i < station_count; i++)
-		[my_entities[i] release];		//	released
+	[UNIVERSE endEntitySnapshot:my_entities];
 	//
 	if (station)
 	{
@@ -13835,13 +13815,13 @@ static BOOL AuthorityPredicate(Entity *entity, void *parameter)
 
 	int			ent_count =		UNIVERSE->n_entities;
 	Entity**	uni_entities =	UNIVERSE->sortedEntities;	// grab the public sorted list
-	ShipEntity*	my_entities[ent_count];
+	ShipEntity**	my_entities = (ShipEntity **)[UNIVERSE beginEntitySnapshot:ent_count];
 	int i;
 
 	int ship_count = 0;
 	for (i = 0; i < ent_count; i++)
 		if ((uni_entities[i]->isShip)&&(uni_entities[i] != self))
-			my_entities[ship_count++] = (ShipEntity*)[uni_entities[i] retain];		//	retained
+			my_entities[ship_count++] = (ShipEntity*)uni_entities[i];
 	//
 	for (i = 0; (i < ship_count)&&(result == NO_TARGET) ; i++)
 	{
@@ -13854,8 +13834,7 @@ static BOOL AuthorityPredicate(Entity *entity, void *parameter)
 				result = [ship universalID];
 		}
 	}
-	for (i = 0; i < ship_count; i++)
-		[my_entities[i] release];	//		released
+	[UNIVERSE endEntitySnapshot:(Entity **)my_entities];
 
 	return result;
 }
@@ -653,12 +653,12 @@
 		// locate nearest wormhole
 		int				ent_count =		UNIVERSE->n_entities;
 		Entity**		uni_entities =	UNIVERSE->sortedEntities;	// grab the public sorted list
-		WormholeEntity*	wormholes[ent_count];
+		WormholeEntity**	wormholes = (WormholeEntity **)[UNIVERSE beginEntitySnapshot:ent_count];
 		int i;
 		int wh_count = 0;
 		for (i = 0; i < ent_count; i++)
 			if (uni_entities[i]->isWormhole)
-				wormholes[wh_count++] = [(WormholeEntity *)uni_entities[i] retain];
+				wormholes[wh_count++] = (WormholeEntity *)uni_entities[i];
 		//
 		//double found_d2 = scannerRange * scannerRange;
 		for (i = 0; i < wh_count ; i++)
@@ -670,8 +670,8 @@
 				whole = wh;
 				found_d2 = d2;
 			}
-			[wh release];
 		}
+		[UNIVERSE endEntitySnapshot:(Entity **)wormholes];
 	}
 	
 	[self enterWormhole:whole replacing:NO];
@@ -2485,7 +2485,7 @@
 	/*- selects the nearest station it can find -*/
 	int				ent_count = UNIVERSE->n_entities;
 	Entity			**uni_entities = UNIVERSE->sortedEntities;	// grab the public sorted list
-	Entity			*my_entities[ent_count];
+	Entity			**my_entities = [UNIVERSE beginEntitySnapshot:ent_count];
 	StationEntity	*station = nil, *my_station = nil;
 	double			maxRange2 = desired_range * desired_range;
 	int				i;
@@ -2499,7 +2499,7 @@
 			my_station = (StationEntity*)uni_entities[i];
 			if ([my_station maxFlightSpeed] == 0 && [my_station hasNPCTraffic] && HPdistance2(position, [my_station position]) < maxRange2)
 			{
-				my_entities[station_count++] = [uni_entities[i] retain];		//	retained
+				my_entities[station_count++] = uni_entities[i];
 			}
 		}
 	}
@@ -2518,8 +2518,7 @@
 		}
 	}
 	
-	for (i = 0; i < station_count; i++)
-		[my_entities[i] release];		//	released
+	[UNIVERSE endEntitySnapshot:my_entities];
 	//
 	if (station)
 	{
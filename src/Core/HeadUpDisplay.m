@@ -1183,12 +1183,12 @@ static void prefetchData(NSDictionary *info, struct CachedInfo *data)
 	// use a non-mutable copy so this can't be changed under us.
 	int				ent_count		= UNIVERSE->n_entities;
 	Entity			**uni_entities	= UNIVERSE->sortedEntities;	// grab the public sorted list
-	Entity			*my_entities[ent_count];
+	Entity			**my_entities = [UNIVERSE beginEntitySnapshot:ent_count];
 	Entity			*scannedEntity = nil;
 	
 	for (i = 0; i < ent_count; i++)
 	{
-		my_entities[i] = [uni_entities[i] retain];	// retained
+		my_entities[i] = uni_entities[i];
 	}
 	
 	if (!emptyDial)
@@ -1405,10 +1405,7 @@ static void prefetchData(NSDictionary *info, struct CachedInfo *data)
 		
 	}
 	
-	for (i = 0; i < ent_count; i++)
-	{
-		[my_entities[i] release];	//	released
-	}
+	[UNIVERSE endEntitySnapshot:my_entities];
 	
 	OOVerifyOpenGLState();
 	
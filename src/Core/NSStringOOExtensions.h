@@ -38,6 +38,7 @@ MA 02110-1301, USA.
 	* Otherwise, assume ISO-Latin-1.
 */
 + (instancetype) stringWithContentsOfUnicodeFile:(NSString *)path;
++ (instancetype) stringWithUnicodeData:(NSData *)data;	// As above, for file contents already read.
 
 
 /*	+stringWithUTF16String:
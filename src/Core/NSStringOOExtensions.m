@@ -30,16 +30,21 @@ MA 02110-1301, USA.
 @implementation NSString (OOExtensions)
 
 + (instancetype) stringWithContentsOfUnicodeFile:(NSString *)path
+{
+	return [self stringWithUnicodeData:[NSData oo_dataWithOXZFile:path]];
+}
+
+
++ (instancetype) stringWithUnicodeData:(NSData *)data
 {
 	id				result = nil;
 	BOOL			OK = YES;
-	NSData			*data = nil;
 	const uint8_t	*bytes = NULL;
 	size_t			length = 0;
 	const uint8_t	*effectiveBytes = NULL;
 	size_t			effectiveLength = 0;
 	
-	data = [[NSData oo_dataWithOXZFile:path] retain];
+	[data retain];
 	if (data == nil) OK = NO;
 	
 	if (OK)
@@ -68,7 +73,7 @@ MA 02110-1301, USA.
 		{
 			// File starts with UTF-8 BOM; skip it.
 			effectiveBytes = bytes + 3;
-			effectiveLength = length + 3;
+			effectiveLength = length - 3;
 		}
 		else
 		{
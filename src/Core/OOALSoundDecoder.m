@@ -29,8 +29,9 @@ SOFTWARE.
 #import "OOALSoundDecoder.h"
 #import "NSDataOOExtensions.h"
 #import <vorbis/vorbisfile.h>
+#import <errno.h>
 #import "OOLogging.h"
-#import "unzip.h"
+#import "OOZipArchive.h"
 
 enum
 {
@@ -38,19 +39,20 @@ enum
 };
 
 static size_t OOReadOXZVorbis (void *ptr, size_t size, size_t nmemb, void *datasource);
+static int OOSeekOXZVorbis  (void *datasource, ogg_int64_t offset, int whence);
 static int OOCloseOXZVorbis (void *datasource);
-// not practical to implement these
-//static int OOSeekOXZVorbis  (void *datasource, ogg_int64_t offset, int whence);
-//static long OOTellOXZVorbis (void *datasource);
+static long OOTellOXZVorbis (void *datasource);
+static size_t OOReadOXZVorbisStream (void *ptr, size_t size, size_t nmemb, void *datasource);
 
 @interface OOALSoundVorbisCodec: OOALSoundDecoder
 {
 	OggVorbis_File			_vf;
 	NSString				*_name;
 	BOOL					_readStarted;
-	BOOL					_seekableStream;
 @public
-	unzFile					uf;
+	NSData					*_oxzData;		// Whole file, if stored in the OXZ.
+	size_t					_oxzPosition;
+	OOZipEntryStream		*_oxzStream;	// Otherwise, inflated as it is read.
 }
 
 @property (atomic, readonly, copy) NSDictionary *comments;
@@ -141,25 +143,13 @@ static int OOCloseOXZVorbis (void *datasource);
 
 		_name = [[path lastPathComponent] retain];
 
-		NSUInteger i, cl;
-		NSArray *components = [path pathComponents];
-		cl = [components count];
-		for (i = 0 ; i < cl ; i++)
-		{
-			NSString *component = [components objectAtIndex:i];
-			if ([[[component pathExtension] lowercaseString] isEqualToString:@"oxz"])
-			{
-				break;
-			}
-		}
-		// if i == cl then the path is entirely uncompressed
-		if (i == cl)
+		NSString *zipFile = nil;
+		NSString *containedFile = nil;
+		if (!OOSplitOXZPath(path, &zipFile, &containedFile))
 		{
 			/* Get vorbis data from a standard file stream */
 			int					err;
 			FILE				*file;
-	
-			_seekableStream = YES;
 		
 			if (nil != path)
 			{
@@ -183,82 +173,56 @@ static int OOCloseOXZVorbis (void *datasource);
 		}
 		else
 		{
-			_seekableStream = NO;
-
-			NSRange range;
-			range.location = 0; range.length = i+1;
-			NSString *zipFile = [NSString pathWithComponents:[components subarrayWithRange:range]];
-			range.location = i+1; range.length = cl-(i+1);
-			NSString *containedFile = [NSString pathWithComponents:[components subarrayWithRange:range]];
-
-	
-			const char* zipname = [zipFile UTF8String];
-			if (zipname != NULL)
-			{
-				uf = unzOpen64(zipname);
-			}
-			if (uf == NULL)
+			/*	A stored file - as Ogg files usually are - is used in place in
+				the mapped OXZ, so the stream can be seekable. A deflated one
+				is inflated a chunk at a time as it is played, rather than
+				held in memory in full; like a pipe, it can only be rewound.
+			*/
+			OOZipArchive *archive = [OOZipArchive archiveWithPath:zipFile];
+			if ([archive entryIsCompressed:containedFile])
 			{
-				OOLog(kOOLogFileNotFound, @"Could not unzip OXZ at %@", zipFile);
-				[self release];
-				self = nil;
-			}
-			else 
-			{
-				const char* filename = [containedFile UTF8String];
-				// unzLocateFile(*, *, 1) = case-sensitive extract
-				if (unzLocateFile(uf, filename, 1) != UNZ_OK)
+				_oxzStream = [[archive streamForEntry:containedFile] retain];
+				if (_oxzStream == nil)
 				{
-					unzClose(uf);
-					[self release];
-					self = nil;
+					OOLog(kOOLogFileNotFound, @"Could not read %@ within OXZ at %@", containedFile, zipFile);
 				}
 				else
 				{
-					int err = UNZ_OK;
-					unz_file_info64 file_info = {0};
-					err = unzGetCurrentFileInfo64(uf, &file_info, NULL, 0, NULL, 0, NULL, 0);
-					if (err != UNZ_OK)
-					{
-						unzClose(uf);
-						OOLog(kOOLogFileNotFound, @"Could not get properties of %@ within OXZ at %@", containedFile, zipFile);
-						[self release];
-						self = nil;
-					}
-					else
+					ov_callbacks _callbacks = {
+						OOReadOXZVorbisStream, // read sequentially
+						NULL, // no seek
+						OOCloseOXZVorbis, // close file
+						NULL, // no tell
+					};
+					if (0 == ov_open_callbacks(self, &_vf, NULL, 0, _callbacks))
 					{
-						err = unzOpenCurrentFile(uf);
-						if (err != UNZ_OK)
-						{
-							unzClose(uf);
-							OOLog(kOOLogFileNotFound, @"Could not read %@ within OXZ at %@", containedFile, zipFile);
-							[self release];
-							self = nil;
-						}
-						else
-						{
-							ov_callbacks _callbacks = {
-								OOReadOXZVorbis, // read sequentially
-								NULL, // no seek
-								OOCloseOXZVorbis, // close file
-								NULL, // no tell
-							};
-							err = ov_open_callbacks(self, &_vf, NULL, 0, _callbacks);
-							if (0 == err)
-							{
-								OK = YES;
-								_readStarted = NO;
-							}
-							if (!OK)
-							{
-								unzClose(uf);
-								[self release];
-								self = nil;
-							}
-						}
+						OK = YES;
 					}
 				}
 			}
+			else if ((_oxzData = [[archive dataForEntry:containedFile] retain]) == nil)
+			{
+				OOLog(kOOLogFileNotFound, @"Could not read %@ within OXZ at %@", containedFile, zipFile);
+			}
+			else
+			{
+				ov_callbacks _callbacks = {
+					OOReadOXZVorbis,
+					OOSeekOXZVorbis,
+					OOCloseOXZVorbis,
+					OOTellOXZVorbis
+				};
+				if (0 == ov_open_callbacks(self, &_vf, NULL, 0, _callbacks))
+				{
+					OK = YES;
+				}
+			}
+
+			if (!OK)
+			{
+				[self release];
+				self = nil;
+			}
 		}
 	}
 #ifdef OOLITE_DEBUG_SOUND_FILE_OPENING
@@ -282,7 +246,8 @@ static int OOCloseOXZVorbis (void *datasource);
 
 	[_name release];
 	ov_clear(&_vf);
-	unzClose(uf);
+	[_oxzData release];
+	[_oxzStream release];
 	
 	[super dealloc];
 }
@@ -469,17 +434,16 @@ static int OOCloseOXZVorbis (void *datasource);
 	{
 		return; // don't need to do anything
 	}
-	if (_seekableStream)
+	if (_oxzStream == nil)
 	{
 		ov_pcm_seek(&_vf, 0);
 		return;
 	}
-	// reset current file pointer in OXZ
-	unzOpenCurrentFile(uf);
-	// reopen OGG streamer
+	// rewind the inflater and reopen OGG streamer
 	ov_clear(&_vf);
+	[_oxzStream rewind];
 	ov_callbacks _callbacks = {
-		OOReadOXZVorbis, // read sequentially
+		OOReadOXZVorbisStream, // read sequentially
 		NULL, // no seek
 		OOCloseOXZVorbis, // close file
 		NULL, // no tell
@@ -500,28 +464,61 @@ static int OOCloseOXZVorbis (void *datasource);
 static size_t OOReadOXZVorbis (void *ptr, size_t size, size_t nmemb, void *datasource)
 {
 	OOALSoundVorbisCodec *src = (OOALSoundVorbisCodec *)datasource;
+	size_t length = [src->_oxzData length];
 	size_t toRead = size*nmemb;
-	void *buf = (void*)malloc(toRead);
-	int err = UNZ_OK;
-	err = unzReadCurrentFile(src->uf, buf, (unsigned int)toRead);
-//	OOLog(@"sound.replay",@"Read %d blocks, got %d",toRead,err);
-	if (err > 0)
+	
+	if (src->_oxzPosition >= length)  return 0;
+	if (toRead > length - src->_oxzPosition)  toRead = length - src->_oxzPosition;
+	
+	memcpy(ptr, (const char *)[src->_oxzData bytes] + src->_oxzPosition, toRead);
+	src->_oxzPosition += toRead;
+	return toRead;
+}
+
+
+static size_t OOReadOXZVorbisStream (void *ptr, size_t size, size_t nmemb, void *datasource)
+{
+	OOALSoundVorbisCodec *src = (OOALSoundVorbisCodec *)datasource;
+	NSInteger result = [src->_oxzStream readBytes:ptr maxLength:size*nmemb];
+	if (result < 0)
 	{
-		memcpy(ptr, buf, err);
+		// vorbisfile takes a short read with errno set as a read error.
+		errno = EIO;
+		return 0;
 	}
-	if (err < 0)
+	return (size_t)result;
+}
+
+
+static int OOSeekOXZVorbis (void *datasource, ogg_int64_t offset, int whence)
+{
+	OOALSoundVorbisCodec *src = (OOALSoundVorbisCodec *)datasource;
+	ogg_int64_t length = (ogg_int64_t)[src->_oxzData length];
+	ogg_int64_t position;
+	
+	switch (whence)
 	{
-		return OV_EREAD;
+		case SEEK_SET:  position = offset; break;
+		case SEEK_CUR:  position = (ogg_int64_t)src->_oxzPosition + offset; break;
+		case SEEK_END:  position = length + offset; break;
+		default:  return -1;
 	}
-	return err;
+	if (position < 0 || position > length)  return -1;
+	
+	src->_oxzPosition = (size_t)position;
+	return 0;
 }
 
 
 static int OOCloseOXZVorbis (void *datasource)
 {
-//  doing this prevents replaying
-//	OOALSoundVorbisCodec *src = (OOALSoundVorbisCodec *)datasource;
-//	unzClose(src->uf);
+	// The data is released in -dealloc, so the stream can be replayed.
 	return 0;
 }
 
+
+static long OOTellOXZVorbis (void *datasource)
+{
+	OOALSoundVorbisCodec *src = (OOALSoundVorbisCodec *)datasource;
+	return (long)src->_oxzPosition;
+}
@@ -35,10 +35,12 @@ MA 02110-1301, USA.
 @interface OOCacheManager: NSObject
 {
 @private
-	NSMutableDictionary		*_caches;
-	id						_scheduledWrite;
+	NSMutableDictionary		*_caches;		// Cache name -> OOCacheSegment, opened on first use.
+	NSString				*_version;
+	NSMutableDictionary		*_prunedBlobKeys;	// Store name -> keys used this session, for stores pruned on clear.
 	BOOL					_permitWrites;
-	BOOL					_dirty;
+	BOOL					_clearedAll;
+	BOOL					_pruneBlobs;
 }
 
 + (OOCacheManager *)sharedCache;
@@ -50,11 +52,34 @@ MA 02110-1301, USA.
 - (void)clearAllCaches;
 - (void) reloadAllCaches;
 
+/*	Blobs are stored as separate files in a subdirectory of the cache
+	directory, named by inStoreName, rather than in the data cache. They are
+	not discarded when the data cache is, so they are only suitable for data
+	whose key changes whenever the data would, such as a content hash.
+	Blobs are returned mapped rather than read into memory; -setBlob:... writes
+	a new file, so a blob already returned is not affected by replacing it.
+*/
+- (NSData *)blobForKey:(NSString *)inKey inStore:(NSString *)inStoreName;
+- (void)setBlob:(NSData *)inBlob forKey:(NSString *)inKey inStore:(NSString *)inStoreName;
+
+/*	A store whose keys are orphaned whenever its data changes, such as one
+	keyed by content hash, would otherwise grow without limit. For a store
+	registered here, the first flush after -clearAllCaches deletes every blob
+	not retrieved or written since the store was registered.
+*/
+- (void)pruneBlobStoreWhenCleared:(NSString *)inStoreName;
+
 - (void)setAllowCacheWrites:(BOOL)flag;
 
 - (NSString *)cacheDirectoryPathCreatingIfNecessary:(BOOL)create;
 
+/*	Each cache is stored in its own append-only file (see OOCacheSegment.h),
+	so -flush only writes entries changed since the last flush. -compactAllCaches
+	rewrites every cache file without superseded entries; this also happens
+	automatically for a cache when more than half of its file is dead space.
+*/
 - (void)flush;
-- (void)finishOngoingFlush;	// Wait for flush to complete. Does nothing if async flushing is disabled.
+- (void)finishOngoingFlush;	// Flushing is synchronous, so this does nothing.
+- (void)compactAllCaches;
 
 @end
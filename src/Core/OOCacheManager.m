@@ -23,57 +23,43 @@ MA 02110-1301, USA.
 */
 
 #import "OOCacheManager.h"
+#import "OOCacheSegment.h"
 #import "OOPListParsing.h"
-#import "OODeepCopy.h"
 #import "OOCollectionExtractors.h"
 #import "OOJavaScriptEngine.h"
 #import "NSFileManagerOOExtensions.h"
 
 
-#define WRITE_ASYNC				1
-#define PROFILE_WRITES			0
-
-
-// Use the (presumed) most efficient plist format for each platform.
-#if OOLITE_MAC_OS_X
-#define CACHE_PLIST_FORMAT	NSPropertyListBinaryFormat_v1_0
-#else
-#define CACHE_PLIST_FORMAT	NSPropertyListGNUstepBinaryFormat
-#endif
-
-
-#if WRITE_ASYNC
-#import "OOAsyncWorkManager.h"
-#endif
-#if PROFILE_WRITES
-#import "OOProfilingStopwatch.h"
-#endif
-
-
 static NSString * const kOOLogDataCacheFound				= @"dataCache.found";
 static NSString * const kOOLogDataCacheNotFound				= @"dataCache.notFound";
 static NSString * const kOOLogDataCacheRebuild				= @"dataCache.rebuild";
+static NSString * const kOOLogDataCacheImport				= @"dataCache.import";
 static NSString * const kOOLogDataCacheWriteSuccess			= @"dataCache.write.success";
 static NSString * const kOOLogDataCacheWriteFailed			= @"dataCache.write.failed";
 static NSString * const kOOLogDataCacheRetrieveSuccess		= @"dataCache.retrieve.success";
 static NSString * const kOOLogDataCacheRetrieveFailed		= @"dataCache.retrieve.failed";
 static NSString * const kOOLogDataCacheSetSuccess			= @"dataCache.set.success";
-static NSString * const kOOLogDataCacheSetFailed			= @"dataCache.set.failed";
 static NSString * const kOOLogDataCacheRemoveSuccess		= @"dataCache.remove.success";
 static NSString * const kOOLogDataCacheClearSuccess			= @"dataCache.clear.success";
 static NSString * const kOOLogDataCacheBuildPathError		= @"dataCache.write.buildPath.failed";
-static NSString * const kOOLogDataCacheSerializationError	= @"dataCache.write.serialize.failed";
+static NSString * const kOOLogDataCacheBlobWriteFailed		= @"dataCache.blob.write.failed";
+static NSString * const kOOLogDataCacheBlobPrune			= @"dataCache.blob.prune";
 
 static NSString * const kCacheKeyVersion					= @"version";
 static NSString * const kCacheKeyEndianTag					= @"endian tag";
 static NSString * const kCacheKeyFormatVersion				= @"format version";
 static NSString * const kCacheKeyCaches						= @"caches";
 
+static NSString * const kCacheDirectoryName				= @"org.aegidian.oolite";
+static NSString * const kSegmentDirectoryName				= @"Data Cache";
+static NSString * const kSegmentPathExtension				= @"oocache";
 
+
+//	Checks for the monolithic property list cache used before segments.
 enum
 {
-	kEndianTagValue			= 0x0123456789ABCDEFULL,
-	kFormatVersionValue		= 219
+	kLegacyEndianTagValue		= 0x0123456789ABCDEFULL,
+	kLegacyFormatVersionValue	= 219
 };
 
 
@@ -83,16 +69,20 @@ static OOCacheManager *sSingleton = nil;
 @interface OOCacheManager (Private)
 
 - (void)loadCache;
-- (void)write;
 - (void)clear;
 @property (readonly) BOOL dirty;
-- (void)markClean;
 
-@property (readonly, copy) NSDictionary *loadDict;
-- (BOOL)writeDict:(NSDictionary *)inDict;
+- (OOCacheSegment *)segmentNamed:(NSString *)inCacheKey;
+- (NSString *)segmentDirectoryPathCreatingIfNecessary:(BOOL)inCreate;
+@property (readonly, copy) NSString *segmentDirectoryPath;
+- (NSString *)segmentPathForCache:(NSString *)inCacheKey;
+- (void)removeSegmentFiles;
+
+- (void)noteBlobKey:(NSString *)inKey usedInStore:(NSString *)inStoreName;
+- (void)pruneBlobStores;
 
-- (void)buildCachesFromDictionary:(NSDictionary *)inDict;
-- (NSDictionary *)dictionaryOfCaches;
+- (void)importLegacyCache;
+@property (readonly, copy) NSDictionary *loadLegacyDict;
 
 - (BOOL)directoryExists:(NSString *)inPath create:(BOOL)inCreate;
 
@@ -101,23 +91,9 @@ static OOCacheManager *sSingleton = nil;
 
 @interface OOCacheManager (PlatformSpecific)
 
-- (NSString *)cachePathCreatingIfNecessary:(BOOL)inCreate;
-
-@end
-
-
-#if WRITE_ASYNC
-@interface OOAsyncCacheWriter: NSObject <OOAsyncWorkTask>
-{
-@private
-	NSDictionary			*_cacheContents;
-}
-
-- (instancetype) init UNAVAILABLE_ATTRIBUTE;
-- (instancetype) initWithCacheContents:(NSDictionary *)cacheContents NS_DESIGNATED_INITIALIZER;
+- (NSString *)legacyCachePathCreatingIfNecessary:(BOOL)inCreate;
 
 @end
-#endif
 
 
 @implementation OOCacheManager
@@ -128,6 +104,8 @@ static OOCacheManager *sSingleton = nil;
 	if (self != nil)
 	{
 		_permitWrites = YES;
+		_version = [[[[NSBundle mainBundle] infoDictionary] objectForKey:@"CFBundleVersion"] copy];
+		if (_version == nil)  _version = @"";
 		[self loadCache];
 	}
 	return self;
@@ -137,6 +115,8 @@ static OOCacheManager *sSingleton = nil;
 - (void)dealloc
 {
 	[self clear];
+	DESTROY(_version);
+	DESTROY(_prunedBlobKeys);
 	
 	[super dealloc];
 }
@@ -162,12 +142,12 @@ static OOCacheManager *sSingleton = nil;
 
 - (id)objectForKey:(NSString *)inKey inCache:(NSString *)inCacheKey
 {
-	NSMutableDictionary		*cache = nil;
+	OOCacheSegment			*cache = nil;
 	id						result = nil;
 	
 	NSParameterAssert(inKey != nil && inCacheKey != nil);
 	
-	cache = [_caches objectForKey:inCacheKey];
+	cache = [self segmentNamed:inCacheKey];
 	if (cache != nil)
 	{
 		result = [cache objectForKey:inKey];
@@ -192,53 +172,26 @@ static OOCacheManager *sSingleton = nil;
 
 - (void)setObject:(id)inObject forKey:(NSString *)inKey inCache:(NSString *)inCacheKey
 {
-	NSMutableDictionary		*cache = nil;
-	
 	NSParameterAssert(inObject != nil && inKey != nil && inCacheKey != nil);
 	
 	if (EXPECT_NOT(_caches == nil))  return;
 	
-	cache = [_caches objectForKey:inCacheKey];
-	if (cache == nil)
-	{
-		cache = [NSMutableDictionary dictionary];
-		if (cache == nil)
-		{
-			OODebugLog(kOOLogDataCacheSetFailed, @"Failed to create cache for key \"%@\".", inCacheKey);
-			return;
-		}
-		[_caches setObject:cache forKey:inCacheKey];
-	}
-	
-	[cache setObject:inObject forKey:inKey];
-	_dirty = YES;
+	[[self segmentNamed:inCacheKey] setObject:inObject forKey:inKey];
 	OODebugLog(kOOLogDataCacheSetSuccess, @"Updated entry %@ in cache \"%@\".", inKey, inCacheKey);
 }
 
 
 - (void)removeObjectForKey:(NSString *)inKey inCache:(NSString *)inCacheKey
 {
-	NSMutableDictionary		*cache = nil;
-	
 	NSParameterAssert(inKey != nil && inCacheKey != nil);
 	
-	cache = [_caches objectForKey:inCacheKey];
-	if (cache != nil)
+	if ([[self segmentNamed:inCacheKey] removeObjectForKey:inKey])
 	{
-		if (nil != [cache objectForKey:inKey])
-		{
-			[cache removeObjectForKey:inKey];
-			_dirty = YES;
-			OODebugLog(kOOLogDataCacheRemoveSuccess, @"Removed entry keyed %@ from cache \"%@\".", inKey, inCacheKey);
-		}
-		else
-		{
-			OODebugLog(kOOLogDataCacheRemoveSuccess, @"No need to remove non-existent entry keyed %@ from cache \"%@\".", inKey, inCacheKey);
-		}
+		OODebugLog(kOOLogDataCacheRemoveSuccess, @"Removed entry keyed %@ from cache \"%@\".", inKey, inCacheKey);
 	}
 	else
 	{
-		OODebugLog(kOOLogDataCacheRemoveSuccess, @"No need to remove entry keyed %@ from non-existent cache \"%@\".", inKey, inCacheKey);
+		OODebugLog(kOOLogDataCacheRemoveSuccess, @"No need to remove non-existent entry keyed %@ from cache \"%@\".", inKey, inCacheKey);
 	}
 }
 
@@ -247,24 +200,20 @@ static OOCacheManager *sSingleton = nil;
 {
 	NSParameterAssert(inCacheKey != nil);
 	
-	if (nil != [_caches objectForKey:inCacheKey])
-	{
-		[_caches removeObjectForKey:inCacheKey];
-		_dirty = YES;
-		OODebugLog(kOOLogDataCacheClearSuccess, @"Cleared cache \"%@\".", inCacheKey);
-	}
-	else
-	{
-		OODebugLog(kOOLogDataCacheClearSuccess, @"No need to clear non-existent cache \"%@\".", inCacheKey);
-	}
+	[[self segmentNamed:inCacheKey] removeAllObjects];
+	OODebugLog(kOOLogDataCacheClearSuccess, @"Cleared cache \"%@\".", inCacheKey);
 }
 
 
 - (void)clearAllCaches
 {
+	/*	Segment files are only deleted at the next flush, since writes may not
+		be permitted; until then, caches are opened empty.
+	*/
 	[self clear];
 	_caches = [[NSMutableDictionary alloc] init];
-	_dirty = YES;
+	_clearedAll = YES;
+	_pruneBlobs = YES;
 }
 
 
@@ -275,21 +224,134 @@ static OOCacheManager *sSingleton = nil;
 }
 
 
+- (NSData *)blobForKey:(NSString *)inKey inStore:(NSString *)inStoreName
+{
+	NSParameterAssert(inKey != nil && inStoreName != nil);
+	
+	NSString *path = [[[self cacheDirectoryPathCreatingIfNecessary:NO] stringByAppendingPathComponent:inStoreName] stringByAppendingPathComponent:inKey];
+	if (path == nil)  return nil;
+	
+	// Mapped rather than read, so large blobs such as meshes can be used in place.
+	if (![[NSFileManager defaultManager] fileExistsAtPath:path])  return nil;
+	NSData *result = [NSData dataWithContentsOfMappedFile:path];
+	if (result != nil)
+	{
+		OODebugLog(kOOLogDataCacheRetrieveSuccess, @"Retrieved blob %@ from store \"%@\".", inKey, inStoreName);
+		[self noteBlobKey:inKey usedInStore:inStoreName];
+	}
+	return result;
+}
+
+
+- (void)setBlob:(NSData *)inBlob forKey:(NSString *)inKey inStore:(NSString *)inStoreName
+{
+	NSParameterAssert(inBlob != nil && inKey != nil && inStoreName != nil);
+	
+	if (!_permitWrites)  return;
+	
+	NSString *directory = [[self cacheDirectoryPathCreatingIfNecessary:YES] stringByAppendingPathComponent:inStoreName];
+	if (directory == nil || ![self directoryExists:directory create:YES])
+	{
+		OOLog(kOOLogDataCacheBuildPathError, @"Failed to create directory for blob store \"%@\".", inStoreName);
+		return;
+	}
+	
+	if ([inBlob writeToFile:[directory stringByAppendingPathComponent:inKey] atomically:YES])
+	{
+		[self noteBlobKey:inKey usedInStore:inStoreName];
+	}
+	else
+	{
+		OOLog(kOOLogDataCacheBlobWriteFailed, @"Failed to write blob %@ to store \"%@\".", inKey, inStoreName);
+	}
+}
+
+
+- (void)pruneBlobStoreWhenCleared:(NSString *)inStoreName
+{
+	NSParameterAssert(inStoreName != nil);
+	
+	if (_prunedBlobKeys == nil)  _prunedBlobKeys = [[NSMutableDictionary alloc] init];
+	if ([_prunedBlobKeys objectForKey:inStoreName] == nil)
+	{
+		[_prunedBlobKeys setObject:[NSMutableSet set] forKey:inStoreName];
+	}
+}
+
+
 - (void)flush
 {
-	if (_permitWrites && [self dirty] && _scheduledWrite == nil)
+	OOCacheSegment			*segment = nil;
+	NSUInteger				written = 0;
+	BOOL					OK = YES;
+	
+	if (!_permitWrites)  return;
+	
+	if (_pruneBlobs)
 	{
-		[self write];
-		[self markClean];
+		[self pruneBlobStores];
+		_pruneBlobs = NO;
+	}
+	
+	if (![self dirty])  return;
+	
+	if ([self segmentDirectoryPathCreatingIfNecessary:YES] == nil)
+	{
+		OOLog(kOOLogDataCacheWriteFailed, @"%@", @"Failed to write data cache.");
+		return;
+	}
+	
+	if (_clearedAll)
+	{
+		[self removeSegmentFiles];
+		_clearedAll = NO;
+	}
+	
+	foreach (segment, [_caches allValues])
+	{
+		if (![segment hasChanges])  continue;
+		
+		if ([segment writeChanges])  written++;
+		else  OK = NO;
+	}
+	
+	if (OK)
+	{
+		OOLog(kOOLogDataCacheWriteSuccess, @"Wrote data cache (%lu caches changed).", (unsigned long)written);
+	}
+	else
+	{
+		OOLog(kOOLogDataCacheWriteFailed, @"%@", @"Failed to write data cache.");
 	}
 }
 
 
 - (void)finishOngoingFlush
 {
-#if WRITE_ASYNC
-	[[OOAsyncWorkManager sharedAsyncWorkManager] waitForTaskToComplete:_scheduledWrite];
-#endif
+	// Flushing is synchronous; appending changes is cheap enough not to need a worker thread.
+}
+
+
+- (void)compactAllCaches
+{
+	NSString				*directory = nil;
+	NSString				*fileName = nil;
+	OOCacheSegment			*segment = nil;
+	
+	if (!_permitWrites)  return;
+	
+	[self flush];
+	
+	directory = [self segmentDirectoryPathCreatingIfNecessary:NO];
+	if (directory == nil)  return;
+	
+	foreach (fileName, [[NSFileManager defaultManager] oo_directoryContentsAtPath:directory])
+	{
+		if (![[fileName pathExtension] isEqualToString:kSegmentPathExtension])  continue;
+		
+		segment = [self segmentNamed:[fileName stringByDeletingPathExtension]];
+		if ([segment deadBytes] != 0)  [segment compact];
+	}
 }
 
 
@@ -317,7 +379,7 @@ static OOCacheManager *sSingleton = nil;
 	[[NSFileManager defaultManager] removeFileAtPath:[cachePath stringByAppendingPathComponent:@"Oolite-cache.plist"] handler:nil];
 #endif
 
-	cachePath = [cachePath stringByAppendingPathComponent:@"org.aegidian.oolite"];
+	cachePath = [cachePath stringByAppendingPathComponent:kCacheDirectoryName];
 	if (![self directoryExists:cachePath create:create]) return nil;
 	return cachePath;
 }
@@ -328,37 +390,198 @@ static OOCacheManager *sSingleton = nil;
 @implementation OOCacheManager (Private)
 
 - (void)loadCache
+{
+	[self clear];
+	_caches = [[NSMutableDictionary alloc] init];
+	_clearedAll = NO;
+	
+	if ([self segmentDirectoryPathCreatingIfNecessary:NO] != nil)
+	{
+		// Segments are opened, and their versions checked, on first use.
+		OOLog(kOOLogDataCacheFound, @"%@", @"Found data cache.");
+	}
+	else if ([[NSFileManager defaultManager] fileExistsAtPath:[self legacyCachePathCreatingIfNecessary:NO]])
+	{
+		[self importLegacyCache];
+	}
+	else
+	{
+		OOLog(kOOLogDataCacheNotFound, @"%@", @"No data cache found, starting from scratch.");
+	}
+}
+
+
+- (void)clear
+{
+	[_caches release];
+	_caches = nil;
+}
+
+
+- (void)noteBlobKey:(NSString *)inKey usedInStore:(NSString *)inStoreName
+{
+	[[_prunedBlobKeys objectForKey:inStoreName] addObject:inKey];
+}
+
+
+/*	Called from the first flush after -clearAllCaches, rather than from
+	-clearAllCaches itself, so that blobs used while the game loads are kept.
+*/
+- (void)pruneBlobStores
+{
+	NSFileManager			*fmgr = [NSFileManager defaultManager];
+	NSString				*cacheDirectory = nil;
+	NSString				*storeName = nil;
+	NSString				*directory = nil;
+	NSSet					*usedKeys = nil;
+	NSString				*key = nil;
+	NSUInteger				removed;
+	
+	cacheDirectory = [self cacheDirectoryPathCreatingIfNecessary:NO];
+	if (cacheDirectory == nil)  return;
+	
+	foreach (storeName, [_prunedBlobKeys allKeys])
+	{
+		directory = [cacheDirectory stringByAppendingPathComponent:storeName];
+		usedKeys = [_prunedBlobKeys objectForKey:storeName];
+		removed = 0;
+		
+		foreach (key, [fmgr oo_directoryContentsAtPath:directory])
+		{
+			if ([usedKeys containsObject:key])  continue;
+			if ([fmgr oo_removeItemAtPath:[directory stringByAppendingPathComponent:key]])  removed++;
+		}
+		
+		if (removed != 0)
+		{
+			OOLog(kOOLogDataCacheBlobPrune, @"Removed %lu unused blobs from store \"%@\".", (unsigned long)removed, storeName);
+		}
+	}
+}
+
+
+- (BOOL)dirty
+{
+	OOCacheSegment			*segment = nil;
+	
+	if (_clearedAll)  return YES;
+	foreach (segment, [_caches allValues])
+	{
+		if ([segment hasChanges])  return YES;
+	}
+	return NO;
+}
+
+
+- (OOCacheSegment *)segmentNamed:(NSString *)inCacheKey
+{
+	OOCacheSegment			*segment = nil;
+	NSString				*path = nil;
+	
+	if (EXPECT_NOT(_caches == nil))  return nil;
+	
+	segment = [_caches objectForKey:inCacheKey];
+	if (segment == nil)
+	{
+		path = [self segmentPathForCache:inCacheKey];
+		if (path == nil)  return nil;
+		
+		segment = [[OOCacheSegment alloc] initWithPath:path name:inCacheKey version:_version load:!_clearedAll];
+		if (segment == nil)  return nil;
+		
+		[_caches setObject:segment forKey:inCacheKey];
+		[segment release];
+	}
+	
+	return segment;
+}
+
+
+- (NSString *)segmentDirectoryPathCreatingIfNecessary:(BOOL)inCreate
+{
+	NSString *path = [[self cacheDirectoryPathCreatingIfNecessary:inCreate] stringByAppendingPathComponent:kSegmentDirectoryName];
+	if (path == nil || ![self directoryExists:path create:inCreate])  return nil;
+	return path;
+}
+
+
+- (NSString *)segmentPathForCache:(NSString *)inCacheKey
+{
+	// Cache names are constants chosen by the code that uses them, so they are used directly as file names.
+	NSAssert1([inCacheKey rangeOfString:@"/"].location == NSNotFound, @"Data cache name \"%@\" cannot be used as a file name.", inCacheKey);
+	
+	// Looking a segment up must not create anything; -flush makes the directory before writing.
+	NSString *directory = [self segmentDirectoryPath];
+	if (directory == nil)  return nil;
+	
+	return [[directory stringByAppendingPathComponent:inCacheKey] stringByAppendingPathExtension:kSegmentPathExtension];
+}
+
+
+//	Where the segment files go, whether or not the directory exists yet.
+- (NSString *)segmentDirectoryPath
+{
+	NSString *cachePath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject;
+	if (cachePath == nil)  return nil;
+	
+	return [[cachePath stringByAppendingPathComponent:kCacheDirectoryName] stringByAppendingPathComponent:kSegmentDirectoryName];
+}
+
+
+- (void)removeSegmentFiles
+{
+	NSFileManager			*fmgr = [NSFileManager defaultManager];
+	NSString				*directory = nil;
+	NSString				*fileName = nil;
+	
+	directory = [self segmentDirectoryPathCreatingIfNecessary:NO];
+	if (directory == nil)  return;
+	
+	foreach (fileName, [fmgr oo_directoryContentsAtPath:directory])
+	{
+		if ([[fileName pathExtension] isEqualToString:kSegmentPathExtension])
+		{
+			[fmgr oo_removeItemAtPath:[directory stringByAppendingPathComponent:fileName]];
+		}
+	}
+}
+
+
+/*	Convert the monolithic property list used by earlier versions into
+	segments, then delete it. This is done in process rather than by a
+	separate tool because the GNUstep binary property list format can only be
+	read by Foundation.
+*/
+- (void)importLegacyCache
 {
 	NSDictionary			*cache = nil;
+	NSDictionary			*caches = nil;
 	NSString				*cacheVersion = nil;
-	NSString				*ooliteVersion = nil;
 	NSData					*endianTag = nil;
 	NSNumber				*formatVersion = nil;
+	NSString				*cacheKey = nil;
+	NSString				*key = nil;
 	BOOL					accept = YES;
 	uint64_t				endianTagValue = 0;
 	
-	ooliteVersion = [[[NSBundle mainBundle] infoDictionary] objectForKey:@"CFBundleVersion"];
-	
-	[self clear];
-	
-	cache = [self loadDict];
+	cache = [self loadLegacyDict];
 	if (cache != nil)
 	{
 		// We have a cache
-		OOLog(kOOLogDataCacheFound, @"%@", @"Found data cache.");
+		OOLog(kOOLogDataCacheFound, @"%@", @"Found data cache in old format.");
 		OOLogIndentIf(kOOLogDataCacheFound);
 		
 		cacheVersion = [cache objectForKey:kCacheKeyVersion];
-		if (![cacheVersion isEqual:ooliteVersion])
+		if (![cacheVersion isEqual:_version])
 		{
-			OOLog(kOOLogDataCacheRebuild, @"Data cache version (%@) does not match Oolite version (%@), rebuilding cache.", cacheVersion, ooliteVersion);
+			OOLog(kOOLogDataCacheRebuild, @"Data cache version (%@) does not match Oolite version (%@), rebuilding cache.", cacheVersion, _version);
 			accept = NO;
 		}
 		
 		formatVersion = [cache objectForKey:kCacheKeyFormatVersion];
-		if (accept && [formatVersion unsignedIntValue] != kFormatVersionValue)
+		if (accept && [formatVersion unsignedIntValue] != kLegacyFormatVersionValue)
 		{
-			OOLog(kOOLogDataCacheRebuild, @"Data cache format (%@) is not supported format (%u), rebuilding cache.", formatVersion, kFormatVersionValue);
+			OOLog(kOOLogDataCacheRebuild, @"Data cache format (%@) is not supported format (%u), rebuilding cache.", formatVersion, kLegacyFormatVersionValue);
 			accept = NO;
 		}
 		
@@ -373,7 +596,7 @@ static OOCacheManager *sSingleton = nil;
 			else
 			{
 				endianTagValue = *(const uint64_t *)[endianTag bytes];
-				if (endianTagValue != kEndianTagValue)
+				if (endianTagValue != kLegacyEndianTagValue)
 				{
 					OOLog(kOOLogDataCacheRebuild, @"%@", @"Data cache endianness is inappropriate for this system, rebuilding cache.");
 					accept = NO;
@@ -384,121 +607,36 @@ static OOCacheManager *sSingleton = nil;
 		if (accept)
 		{
 			// We have a cache, and it's the right format.
-			[self buildCachesFromDictionary:[cache objectForKey:kCacheKeyCaches]];
+			caches = [cache oo_dictionaryForKey:kCacheKeyCaches];
+			_clearedAll = YES;
+			foreachkey (cacheKey, caches)
+			{
+				NSDictionary *contents = [caches oo_dictionaryForKey:cacheKey];
+				OOCacheSegment *segment = [self segmentNamed:cacheKey];
+				foreachkey (key, contents)
+				{
+					[segment setObject:[contents objectForKey:key] forKey:key];
+				}
+			}
+			[self flush];
+			OOLog(kOOLogDataCacheImport, @"Converted %lu caches to the segmented format.", (unsigned long)[caches count]);
 		}
 		
 		OOLogOutdentIf(kOOLogDataCacheFound);
 	}
-	else
-	{
-		// No cache
-		OOLog(kOOLogDataCacheNotFound, @"%@", @"No data cache found, starting from scratch.");
-	}
-	
-	// If loading failed, or there was a version or endianness conflict
-	if (_caches == nil) _caches = [[NSMutableDictionary alloc] init];
-	[self markClean];
-}
-
-
-- (void)write
-{
-	NSMutableDictionary		*newCache = nil;
-	NSString				*ooliteVersion = nil;
-	NSData					*endianTag = nil;
-	NSNumber				*formatVersion = nil;
-	NSDictionary			*pListRep = nil;
-	uint64_t				endianTagValue = kEndianTagValue;
-	
-	if (_caches == nil) return;
-	if (_scheduledWrite != nil)  return;
-	
-#if PROFILE_WRITES
-	OOProfilingStopwatch *stopwatch = [OOProfilingStopwatch stopwatch];
-#endif
-	
-#if WRITE_ASYNC
-	OOLog(@"dataCache.willWrite", @"%@", @"Scheduling data cache write.");
-#else
-	OOLog(@"dataCache.willWrite", @"%@", @"About to write cache.");
-#endif
-	
-	ooliteVersion = [[[NSBundle mainBundle] infoDictionary] objectForKey:@"CFBundleVersion"];
-	endianTag = [NSData dataWithBytes:&endianTagValue length:sizeof endianTagValue];
-	formatVersion = @((unsigned int)kFormatVersionValue);
-	
-	pListRep = [self dictionaryOfCaches];
-	if (ooliteVersion == nil || endianTag == nil || formatVersion == nil || pListRep == nil)
-	{
-		OOLog(@"dataCache.cantWrite", @"%@", @"Failed to write data cache -- prerequisites not fulfilled. This is an internal error, please report it.");
-		return;
-	}
-	
-	newCache = [NSMutableDictionary dictionaryWithCapacity:4];
-	[newCache setObject:ooliteVersion forKey:kCacheKeyVersion];
-	[newCache setObject:formatVersion forKey:kCacheKeyFormatVersion];
-	[newCache setObject:endianTag forKey:kCacheKeyEndianTag];
-	[newCache setObject:pListRep forKey:kCacheKeyCaches];
-	
-#if PROFILE_WRITES && !WRITE_ASYNC
-	OOTimeDelta prepareT = [stopwatch reset];
-#endif
-	
-#if WRITE_ASYNC
-	NSDictionary *cacheData = newCache;
-	_scheduledWrite = [[OOAsyncCacheWriter alloc] initWithCacheContents:cacheData];
 	
-#if PROFILE_WRITES
-	OOTimeDelta endT = [stopwatch reset];
-	OOLog(@"dataCache.profile", @"Time to prepare cache data: %g seconds.", endT);
-#endif
-	
-	[[OOAsyncWorkManager sharedAsyncWorkManager] addTask:_scheduledWrite priority:kOOAsyncPriorityLow];
-#else
-#if PROFILE_WRITES
-	OOLog(@"dataCache.profile", @"Time to prepare cache data: %g seconds.", prepareT);
-#endif
-	
-	if ([self writeDict:newCache])
-	{
-		[self markClean];
-		OOLog(kOOLogDataCacheWriteSuccess, @"%@", @"Wrote data cache.");
-	}
-	else
-	{
-		OOLog(kOOLogDataCacheWriteFailed, @"%@", @"Failed to write data cache.");
-	}
-#endif
-}
-
-
-- (void)clear
-{
-	[_caches release];
-	_caches = nil;
-}
-
-
-- (BOOL)dirty
-{
-	return _dirty;
+	[[NSFileManager defaultManager] oo_removeItemAtPath:[self legacyCachePathCreatingIfNecessary:NO]];
 }
 
 
-- (void)markClean
-{
-	_dirty = NO;
-}
-
-
-- (NSDictionary *)loadDict
+- (NSDictionary *)loadLegacyDict
 {
 	NSString			*path = nil;
 	NSData				*data = nil;
 	NSString			*errorString = nil;
 	id					contents = nil;
 	
-	path = [self cachePathCreatingIfNecessary:NO];
+	path = [self legacyCachePathCreatingIfNecessary:NO];
 	if (path == nil) return nil;
 	
 	@try
@@ -531,80 +669,6 @@ static OOCacheManager *sSingleton = nil;
 }
 
 
-- (BOOL)writeDict:(NSDictionary *)inDict
-{
-	NSString			*path = nil;
-	NSData				*plist = nil;
-	NSString			*errorDesc = nil;
-	
-	path = [self cachePathCreatingIfNecessary:YES];
-	if (path == nil) return NO;	
-	
-#if PROFILE_WRITES
-	OOProfilingStopwatch *stopwatch = [OOProfilingStopwatch stopwatch];
-#endif
-	
-	plist = [NSPropertyListSerialization dataFromPropertyList:inDict format:CACHE_PLIST_FORMAT errorDescription:&errorDesc];
-	if (plist == nil)
-	{
-#if OOLITE_RELEASE_PLIST_ERROR_STRINGS
-		[errorDesc autorelease];
-#endif
-		OOLog(kOOLogDataCacheSerializationError, @"Could not convert data cache to property list data: %@", errorDesc);
-		return NO;
-	}
-	
-#if PROFILE_WRITES
-	OOTimeDelta serializeT = [stopwatch reset];
-#endif
-	
-	BOOL result = [plist writeToFile:path atomically:NO];
-	
-#if PROFILE_WRITES
-	OOTimeDelta writeT = [stopwatch reset];
-	
-	OOLog(@"dataCache.profile", @"Time to serialize cache: %g seconds. Time to write data: %g seconds.", serializeT, writeT);
-#endif
-	
-#if WRITE_ASYNC
-	DESTROY(_scheduledWrite);
-#endif
-	return result;
-}
-
-
-- (void)buildCachesFromDictionary:(NSDictionary *)inDict
-{
-	id							key = nil;
-	id							value = nil;
-	NSMutableDictionary			*cache = nil;
-	
-	if (inDict == nil ) return;
-	
-	[_caches release];
-	_caches = [[NSMutableDictionary alloc] initWithCapacity:[inDict count]];
-	
-	foreachkey (key, inDict)
-	{
-		value = [inDict oo_dictionaryForKey:key];
-		if (value != nil)
-		{
-			cache = [NSMutableDictionary dictionaryWithDictionary:value];
-			if (cache != nil)
-			{
-				[_caches setObject:cache forKey:key];
-			}
-		}
-	}
-}
-
-
-- (NSDictionary *)dictionaryOfCaches
-{
-	return [OODeepCopy(_caches) autorelease];
-}
-
-
 - (BOOL)directoryExists:(NSString *)inPath create:(BOOL)inCreate
 {
 	BOOL				exists, directory;
@@ -633,7 +697,7 @@ static OOCacheManager *sSingleton = nil;
 
 #if OOLITE_MAC_OS_X
 
-- (NSString *)cachePathCreatingIfNecessary:(BOOL)create
+- (NSString *)legacyCachePathCreatingIfNecessary:(BOOL)create
 {
 	NSString *cachePath = [self cacheDirectoryPathCreatingIfNecessary:create];
 	return [cachePath stringByAppendingPathComponent:@"Data Cache.plist"];
@@ -641,7 +705,7 @@ static OOCacheManager *sSingleton = nil;
 
 #else
 
-- (NSString *)cachePathCreatingIfNecessary:(BOOL)create
+- (NSString *)legacyCachePathCreatingIfNecessary:(BOOL)create
 {
 	NSString *cachePath = [self cacheDirectoryPathCreatingIfNecessary:create];
 	return [cachePath stringByAppendingPathComponent:@"Oolite-cache.plist"];
@@ -700,53 +764,3 @@ static OOCacheManager *sSingleton = nil;
 }
 
 @end
-
-
-#if WRITE_ASYNC
-@implementation OOAsyncCacheWriter
-
-- (instancetype) initWithCacheContents:(NSDictionary *)cacheContents
-{
-	if ((self = [super init]))
-	{
-		_cacheContents = [cacheContents copy];
-		if (_cacheContents == nil)
-		{
-			[self release];
-			self = nil;
-		}
-	}
-	
-	return self;
-}
-
-
-- (void) dealloc
-{
-	DESTROY(_cacheContents);
-	
-	[super dealloc];
-}
-
-
-- (void) performAsyncTask
-{
-	if ([[OOCacheManager sharedCache] writeDict:_cacheContents])
-	{
-		OOLog(kOOLogDataCacheWriteSuccess, @"%@", @"Wrote data cache.");
-	}
-	else
-	{
-		OOLog(kOOLogDataCacheWriteFailed, @"%@", @"Failed to write data cache.");
-	}
-	DESTROY(_cacheContents);
-}
-
-
-- (void) completeAsyncTask
-{
-	// Don't need to do anything, but this needs to be here so we can wait on it.
-}
-
-@end
-#endif	// WRITE_ASYNC
@@ -0,0 +1,89 @@
+/*
+
+OOCacheSegment.h
+
+On-disk storage for one OOCacheManager cache.
+
+A segment is an append-only file of records, each holding a key and a value
+serialized as a binary property list. Later records supersede earlier ones
+with the same key, and a removal is recorded as a record with no value.
+Opening a segment maps the file and reads only the record headers, building
+an index of key -> offset and length; values are deserialized the first time
+they are asked for. Writing changes appends one record per changed key, so the
+cost of a flush is proportional to what changed rather than to the size of the
+cache.
+
+Superseded records are dead space. When more than half the file is dead (and
+the file is not trivially small), or when -compact is called, the live records
+are copied to a new file which replaces the old one.
+
+The file header carries the Oolite version, a format version and an endian
+tag. A segment whose header does not match is discarded, as the monolithic
+data cache was.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCocoa.h"
+
+
+@interface OOCacheSegment: NSObject
+{
+@private
+	NSString				*_path;
+	NSString				*_name;
+	NSString				*_version;
+	NSData					*_mapping;
+	NSMutableDictionary		*_index;		// Key -> NSValue of OOCacheRecordLocation, for records on disk.
+	NSMutableDictionary		*_objects;		// Key -> deserialized value.
+	NSMutableDictionary		*_pending;		// Key -> value, or NSNull for removal; not yet on disk.
+	unsigned long long		_fileLength;
+	unsigned long long		_deadBytes;
+	BOOL					_rewrite;
+}
+
+- (instancetype) init UNAVAILABLE_ATTRIBUTE;
+
+/*	If load is NO, or the file is missing or unacceptable, the segment starts
+	empty and the file will be replaced on the next write. version is the
+	Oolite version to check against and to record.
+*/
+- (instancetype) initWithPath:(NSString *)path name:(NSString *)name version:(NSString *)version load:(BOOL)load NS_DESIGNATED_INITIALIZER;
+
+@property (readonly, copy) NSString *name;
+@property (readonly, copy) NSString *path;
+
+- (id) objectForKey:(NSString *)key;
+- (void) setObject:(id)object forKey:(NSString *)key;
+- (BOOL) removeObjectForKey:(NSString *)key;	// Returns NO if there was no such entry.
+- (void) removeAllObjects;
+
+@property (readonly) BOOL hasChanges;
+@property (readonly) unsigned long long fileLength;
+@property (readonly) unsigned long long deadBytes;
+
+//	Append pending changes, compacting if that leaves too much dead space.
+- (BOOL) writeChanges;
+
+//	Rewrite the file with only live records, including pending changes.
+- (BOOL) compact;
+
+@end
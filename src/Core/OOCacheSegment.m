@@ -0,0 +1,631 @@
+/*
+
+OOCacheSegment.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCacheSegment.h"
+
+
+// Use the (presumed) most efficient plist format for each platform.
+#if OOLITE_MAC_OS_X
+#define CACHE_PLIST_FORMAT	NSPropertyListBinaryFormat_v1_0
+#else
+#define CACHE_PLIST_FORMAT	NSPropertyListGNUstepBinaryFormat
+#endif
+
+
+static NSString * const kOOLogDataCacheRebuild				= @"dataCache.rebuild";
+static NSString * const kOOLogDataCacheTruncated			= @"dataCache.segment.truncated";
+static NSString * const kOOLogDataCacheCompact				= @"dataCache.compact";
+static NSString * const kOOLogDataCacheWriteFailed			= @"dataCache.write.failed";
+static NSString * const kOOLogDataCacheRetrieveFailed		= @"dataCache.retrieve.failed";
+static NSString * const kOOLogDataCacheSerializationError	= @"dataCache.write.serialize.failed";
+
+
+static const char kSegmentMagic[4] = { 'O', 'O', 'C', 'S' };
+
+enum
+{
+	kSegmentFormatVersion		= 1,
+	kCompactMinimumDeadBytes	= 256 << 10,
+
+	kRecordFlagRemoved			= 0x00000001
+};
+
+static const uint64_t kEndianTagValue = 0x0123456789ABCDEFULL;
+
+
+/*	The file is a header, the Oolite version and cache name as UTF-8, and then
+	records. All integers are in native byte order, as guarded by endianTag.
+*/
+typedef struct
+{
+	char				magic[4];
+	uint32_t			formatVersion;
+	uint64_t			endianTag;
+	uint32_t			versionLength;
+	uint32_t			nameLength;
+} OOCacheSegmentHeader;
+
+
+//	Followed by keyLength bytes of UTF-8 key and valueLength bytes of property list.
+typedef struct
+{
+	uint32_t			keyLength;
+	uint32_t			valueLength;
+	uint32_t			flags;
+	uint32_t			checksum;		// FNV-1a of key and value.
+} OOCacheRecordHeader;
+
+
+typedef struct
+{
+	uint64_t			offset;			// Of the record header.
+	uint32_t			valueLength;
+	uint32_t			recordLength;
+} OOCacheRecordLocation;
+
+
+static uint32_t RecordChecksum(const void *key, uint32_t keyLength, const void *value, uint32_t valueLength);
+static OOCacheRecordLocation AppendRecord(NSMutableData *data, unsigned long long base, NSData *keyData, const void *value, uint32_t valueLength, uint32_t flags);
+static NSData *SerializeValue(id value, NSString *key, NSString *cacheName);
+static id DeserializeValue(NSData *data, NSString *key, NSString *cacheName);
+
+OOINLINE NSValue *LocationValue(OOCacheRecordLocation location)
+{
+	return [NSValue valueWithBytes:&location objCType:@encode(OOCacheRecordLocation)];
+}
+
+OOINLINE OOCacheRecordLocation LocationFromValue(NSValue *value)
+{
+	OOCacheRecordLocation location;
+	[value getValue:&location];
+	return location;
+}
+
+
+@interface OOCacheSegment (Private)
+
+- (void) load;
+- (BOOL) mapFile;
+- (BOOL) readHeaderReturningLength:(NSUInteger *)outLength;
+- (void) scanRecordsFromOffset:(NSUInteger)offset;
+- (NSData *) headerData;
+
+@end
+
+
+@implementation OOCacheSegment
+
+- (instancetype) initWithPath:(NSString *)path name:(NSString *)name version:(NSString *)version load:(BOOL)load
+{
+	NSParameterAssert(path != nil && name != nil && version != nil);
+
+	if ((self = [super init]))
+	{
+		_path = [path copy];
+		_name = [name copy];
+		_version = [version copy];
+		_index = [[NSMutableDictionary alloc] init];
+		_objects = [[NSMutableDictionary alloc] init];
+		_pending = [[NSMutableDictionary alloc] init];
+
+		if (load)  [self load];
+		else  _rewrite = YES;
+	}
+
+	return self;
+}
+
+
+- (void) dealloc
+{
+	DESTROY(_path);
+	DESTROY(_name);
+	DESTROY(_version);
+	DESTROY(_mapping);
+	DESTROY(_index);
+	DESTROY(_objects);
+	DESTROY(_pending);
+
+	[super dealloc];
+}
+
+
+- (NSString *) descriptionComponents
+{
+	return [NSString stringWithFormat:@"\"%@\", %lu entries, %llu bytes (%llu dead), %lu pending", _name, (unsigned long)[_index count], _fileLength, _deadBytes, (unsigned long)[_pending count]];
+}
+
+
+@synthesize name = _name;
+@synthesize path = _path;
+@synthesize fileLength = _fileLength;
+@synthesize deadBytes = _deadBytes;
+
+
+- (id) objectForKey:(NSString *)key
+{
+	id result = [_objects objectForKey:key];
+	if (result != nil)  return result;
+
+	NSValue *locationValue = [_index objectForKey:key];
+	if (locationValue == nil || [_pending objectForKey:key] != nil)  return nil;
+
+	OOCacheRecordLocation location = LocationFromValue(locationValue);
+	if (location.offset + location.recordLength > [_mapping length])
+	{
+		// Written since the file was mapped - or the file has shrunk under us, in which case the record is gone.
+		if (![self mapFile])  return nil;
+		if (location.offset + location.recordLength > [_mapping length])
+		{
+			OOLog(kOOLogDataCacheRetrieveFailed, @"Data cache entry %@ in \"%@\" is missing from the file, ignoring it.", key, _name);
+			[_index removeObjectForKey:key];
+			return nil;
+		}
+	}
+
+	const uint8_t *bytes = (const uint8_t *)[_mapping bytes] + location.offset;
+	OOCacheRecordHeader record;
+	memcpy(&record, bytes, sizeof record);
+
+	const uint8_t *value = bytes + sizeof record + record.keyLength;
+	if ((unsigned long long)sizeof record + record.keyLength + record.valueLength <= location.recordLength &&
+		record.checksum == RecordChecksum(bytes + sizeof record, record.keyLength, value, record.valueLength))
+	{
+		result = DeserializeValue([NSData dataWithBytes:value length:record.valueLength], key, _name);
+	}
+	else
+	{
+		OOLog(kOOLogDataCacheRetrieveFailed, @"Data cache entry %@ in \"%@\" is damaged, ignoring it.", key, _name);
+	}
+
+	if (result != nil)
+	{
+		[_objects setObject:result forKey:key];
+	}
+	else
+	{
+		// Don't try again; the dead record goes away at the next compaction.
+		[_index removeObjectForKey:key];
+		_deadBytes += location.recordLength;
+	}
+
+	return result;
+}
+
+
+- (void) setObject:(id)object forKey:(NSString *)key
+{
+	[_objects setObject:object forKey:key];
+	[_pending setObject:object forKey:key];
+}
+
+
+- (BOOL) removeObjectForKey:(NSString *)key
+{
+	BOOL onDisk = [_index objectForKey:key] != nil;
+	id pending = [_pending objectForKey:key];
+
+	if (pending == [NSNull null])  return NO;
+	if (!onDisk && pending == nil)  return NO;
+
+	[_objects removeObjectForKey:key];
+	if (onDisk)  [_pending setObject:[NSNull null] forKey:key];
+	else  [_pending removeObjectForKey:key];
+	return YES;
+}
+
+
+- (void) removeAllObjects
+{
+	[_index removeAllObjects];
+	[_objects removeAllObjects];
+	[_pending removeAllObjects];
+	DESTROY(_mapping);
+	_fileLength = 0;
+	_deadBytes = 0;
+	_rewrite = YES;
+}
+
+
+- (BOOL) hasChanges
+{
+	return _rewrite || [_pending count] != 0;
+}
+
+
+- (BOOL) writeChanges
+{
+	if (![self hasChanges])  return YES;
+	if (_rewrite)  return [self compact];
+
+	NSMutableData			*records = [NSMutableData data];
+	NSMutableDictionary		*locations = [NSMutableDictionary dictionaryWithCapacity:[_pending count]];
+	NSString				*key = nil;
+
+	foreachkey (key, _pending)
+	{
+		id value = [_pending objectForKey:key];
+		NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+		OOCacheRecordLocation location;
+
+		if (value == [NSNull null])
+		{
+			location = AppendRecord(records, _fileLength, keyData, NULL, 0, kRecordFlagRemoved);
+			[locations setObject:[NSNull null] forKey:key];
+		}
+		else
+		{
+			NSData *valueData = SerializeValue(value, key, _name);
+			if (valueData == nil)  continue;
+
+			location = AppendRecord(records, _fileLength, keyData, [valueData bytes], (uint32_t)[valueData length], 0);
+			[locations setObject:LocationValue(location) forKey:key];
+		}
+	}
+
+	NSFileHandle *file = [NSFileHandle fileHandleForUpdatingAtPath:_path];
+	if (file == nil)
+	{
+		// The file has gone away; write everything we still know about.
+		return [self compact];
+	}
+
+	@try
+	{
+		[file seekToFileOffset:_fileLength];
+		[file writeData:records];
+		[file truncateFileAtOffset:_fileLength + [records length]];
+		[file closeFile];
+	}
+	@catch (NSException *exception)
+	{
+		OOLog(kOOLogDataCacheWriteFailed, @"Failed to append to data cache \"%@\": %@", _name, [exception reason]);
+		return NO;
+	}
+
+	foreachkey (key, locations)
+	{
+		NSValue *oldLocation = [_index objectForKey:key];
+		if (oldLocation != nil)  _deadBytes += LocationFromValue(oldLocation).recordLength;
+
+		id location = [locations objectForKey:key];
+		if (location == [NSNull null])
+		{
+			[_index removeObjectForKey:key];
+			_deadBytes += sizeof (OOCacheRecordHeader) + [[key dataUsingEncoding:NSUTF8StringEncoding] length];
+		}
+		else
+		{
+			[_index setObject:location forKey:key];
+		}
+	}
+
+	_fileLength += [records length];
+	[_pending removeAllObjects];
+
+	if (_deadBytes >= kCompactMinimumDeadBytes && _deadBytes * 2 > _fileLength)
+	{
+		return [self compact];
+	}
+	return YES;
+}
+
+
+- (BOOL) compact
+{
+	NSMutableData			*data = nil;
+	NSMutableDictionary		*index = nil;
+	NSString				*key = nil;
+	unsigned long long		oldLength = _fileLength;
+
+	if (_fileLength > [_mapping length] && ![self mapFile])
+	{
+		// The file has gone away, so only pending changes can be kept.
+		[_index removeAllObjects];
+	}
+
+	data = [NSMutableData dataWithData:[self headerData]];
+	index = [NSMutableDictionary dictionaryWithCapacity:[_index count] + [_pending count]];
+
+	// Records on disk are copied as they are, without deserializing them.
+	const uint8_t *bytes = [_mapping bytes];
+	foreachkey (key, _index)
+	{
+		if ([_pending objectForKey:key] != nil)  continue;
+
+		OOCacheRecordLocation location = LocationFromValue([_index objectForKey:key]);
+		if (location.offset + location.recordLength > [_mapping length])  continue;
+		OOCacheRecordLocation newLocation = location;
+		newLocation.offset = [data length];
+
+		[data appendBytes:bytes + location.offset length:location.recordLength];
+		[index setObject:LocationValue(newLocation) forKey:key];
+	}
+
+	foreachkey (key, _pending)
+	{
+		id value = [_pending objectForKey:key];
+		if (value == [NSNull null])  continue;
+
+		NSData *valueData = SerializeValue(value, key, _name);
+		if (valueData == nil)  continue;
+
+		OOCacheRecordLocation location = AppendRecord(data, 0, [key dataUsingEncoding:NSUTF8StringEncoding], [valueData bytes], (uint32_t)[valueData length], 0);
+		[index setObject:LocationValue(location) forKey:key];
+	}
+
+	if (![data writeToFile:_path atomically:YES])
+	{
+		OOLog(kOOLogDataCacheWriteFailed, @"Failed to write data cache \"%@\".", _name);
+		return NO;
+	}
+
+	if (!_rewrite)
+	{
+		OOLog(kOOLogDataCacheCompact, @"Compacted data cache \"%@\" from %llu to %lu bytes.", _name, oldLength, (unsigned long)[data length]);
+	}
+
+	// The old mapping stays valid until released, since the file was replaced rather than overwritten.
+	DESTROY(_mapping);
+	[_index setDictionary:index];
+	[_pending removeAllObjects];
+	_fileLength = [data length];
+	_deadBytes = 0;
+	_rewrite = NO;
+
+	return YES;
+}
+
+@end
+
+
+@implementation OOCacheSegment (Private)
+
+- (void) load
+{
+	NSUInteger headerLength;
+
+	if (![self mapFile] || ![self readHeaderReturningLength:&headerLength])
+	{
+		DESTROY(_mapping);
+		_rewrite = YES;
+		return;
+	}
+
+	[self scanRecordsFromOffset:headerLength];
+}
+
+
+- (BOOL) mapFile
+{
+	[_mapping release];
+	_mapping = [[NSData dataWithContentsOfMappedFile:_path] retain];
+	return _mapping != nil;
+}
+
+
+- (BOOL) readHeaderReturningLength:(NSUInteger *)outLength
+{
+	NSUInteger				length = [_mapping length];
+	const uint8_t			*bytes = [_mapping bytes];
+	OOCacheSegmentHeader	header;
+
+	if (length < sizeof header)
+	{
+		OOLog(kOOLogDataCacheRebuild, @"Data cache \"%@\" is truncated, rebuilding it.", _name);
+		return NO;
+	}
+	memcpy(&header, bytes, sizeof header);
+
+	if (memcmp(header.magic, kSegmentMagic, sizeof header.magic) != 0)
+	{
+		OOLog(kOOLogDataCacheRebuild, @"Data cache \"%@\" is not a data cache file, rebuilding it.", _name);
+		return NO;
+	}
+	if (header.endianTag != kEndianTagValue)
+	{
+		OOLog(kOOLogDataCacheRebuild, @"Data cache \"%@\" endianness is inappropriate for this system, rebuilding it.", _name);
+		return NO;
+	}
+	if (header.formatVersion != kSegmentFormatVersion)
+	{
+		OOLog(kOOLogDataCacheRebuild, @"Data cache \"%@\" format (%u) is not supported format (%u), rebuilding it.", _name, header.formatVersion, kSegmentFormatVersion);
+		return NO;
+	}
+
+	unsigned long long headerLength = (unsigned long long)sizeof header + header.versionLength + header.nameLength;
+	if (headerLength > length)
+	{
+		OOLog(kOOLogDataCacheRebuild, @"Data cache \"%@\" is truncated, rebuilding it.", _name);
+		return NO;
+	}
+
+	NSString *version = [[[NSString alloc] initWithBytes:bytes + sizeof header length:header.versionLength encoding:NSUTF8StringEncoding] autorelease];
+	if (![version isEqualToString:_version])
+	{
+		OOLog(kOOLogDataCacheRebuild, @"Data cache \"%@\" version (%@) does not match Oolite version (%@), rebuilding it.", _name, version, _version);
+		return NO;
+	}
+
+	*outLength = (NSUInteger)headerLength;
+	return YES;
+}
+
+
+- (void) scanRecordsFromOffset:(NSUInteger)offset
+{
+	NSUInteger				length = [_mapping length];
+	const uint8_t			*bytes = [_mapping bytes];
+	OOCacheRecordHeader		record;
+
+	while (offset < length)
+	{
+		if (length - offset < sizeof record)  break;
+		memcpy(&record, bytes + offset, sizeof record);
+
+		unsigned long long recordLength = (unsigned long long)sizeof record + record.keyLength + record.valueLength;
+		if (recordLength > length - offset)  break;
+
+		NSString *key = [[NSString alloc] initWithBytes:bytes + offset + sizeof record length:record.keyLength encoding:NSUTF8StringEncoding];
+		if (key == nil)  break;
+
+		NSValue *oldLocation = [_index objectForKey:key];
+		if (oldLocation != nil)  _deadBytes += LocationFromValue(oldLocation).recordLength;
+
+		if (record.flags & kRecordFlagRemoved)
+		{
+			[_index removeObjectForKey:key];
+			_deadBytes += recordLength;
+		}
+		else
+		{
+			OOCacheRecordLocation location = { offset, record.valueLength, (uint32_t)recordLength };
+			[_index setObject:LocationValue(location) forKey:key];
+		}
+		[key release];
+
+		offset += (NSUInteger)recordLength;
+	}
+
+	if (offset < length)
+	{
+		// Most likely an interrupted write. Keep what we have and replace the file at the next flush.
+		OOLog(kOOLogDataCacheTruncated, @"Data cache \"%@\" has a damaged record at offset %lu; discarding the rest of it.", _name, (unsigned long)offset);
+		_rewrite = YES;
+	}
+
+	_fileLength = offset;
+}
+
+
+- (NSData *) headerData
+{
+	OOCacheSegmentHeader	header;
+	NSData					*versionData = [_version dataUsingEncoding:NSUTF8StringEncoding];
+	NSData					*nameData = [_name dataUsingEncoding:NSUTF8StringEncoding];
+
+	memcpy(header.magic, kSegmentMagic, sizeof header.magic);
+	header.formatVersion = kSegmentFormatVersion;
+	header.endianTag = kEndianTagValue;
+	header.versionLength = (uint32_t)[versionData length];
+	header.nameLength = (uint32_t)[nameData length];
+
+	NSMutableData *result = [NSMutableData dataWithBytes:&header length:sizeof header];
+	[result appendData:versionData];
+	[result appendData:nameData];
+	return result;
+}
+
+@end
+
+
+static uint32_t RecordChecksum(const void *key, uint32_t keyLength, const void *value, uint32_t valueLength)
+{
+	uint32_t		hash = 2166136261U;
+	const uint8_t	*bytes = key;
+	uint32_t		i;
+
+	for (i = 0; i < keyLength; i++)  hash = (hash ^ bytes[i]) * 16777619U;
+	bytes = value;
+	for (i = 0; i < valueLength; i++)  hash = (hash ^ bytes[i]) * 16777619U;
+
+	return hash;
+}
+
+
+static OOCacheRecordLocation AppendRecord(NSMutableData *data, unsigned long long base, NSData *keyData, const void *value, uint32_t valueLength, uint32_t flags)
+{
+	OOCacheRecordHeader		record;
+	OOCacheRecordLocation	location;
+
+	record.keyLength = (uint32_t)[keyData length];
+	record.valueLength = valueLength;
+	record.flags = flags;
+	record.checksum = RecordChecksum([keyData bytes], record.keyLength, value, valueLength);
+
+	location.offset = base + [data length];
+	location.valueLength = valueLength;
+	location.recordLength = (uint32_t)(sizeof record + record.keyLength + valueLength);
+
+	[data appendBytes:&record length:sizeof record];
+	[data appendData:keyData];
+	if (valueLength != 0)  [data appendBytes:value length:valueLength];
+
+	return location;
+}
+
+
+static NSData *SerializeValue(id value, NSString *key, NSString *cacheName)
+{
+	NSString			*errorDesc = nil;
+	NSData				*result = nil;
+
+	result = [NSPropertyListSerialization dataFromPropertyList:value format:CACHE_PLIST_FORMAT errorDescription:&errorDesc];
+	if (result == nil)
+	{
+#if OOLITE_RELEASE_PLIST_ERROR_STRINGS
+		[errorDesc autorelease];
+#endif
+		OOLog(kOOLogDataCacheSerializationError, @"Could not convert data cache entry %@ in \"%@\" to property list data: %@", key, cacheName, errorDesc);
+	}
+	else if ([result length] > UINT32_MAX)
+	{
+		OOLog(kOOLogDataCacheSerializationError, @"Data cache entry %@ in \"%@\" is too large to cache.", key, cacheName);
+		result = nil;
+	}
+
+	return result;
+}
+
+
+static id DeserializeValue(NSData *data, NSString *key, NSString *cacheName)
+{
+	NSString			*errorString = nil;
+	id					result = nil;
+
+	@try
+	{
+		result = [NSPropertyListSerialization propertyListFromData:data
+												  mutabilityOption:NSPropertyListImmutable
+															format:NULL
+												  errorDescription:&errorString];
+	}
+	@catch (NSException *exception)
+	{
+		errorString = [exception reason];
+		result = nil;
+	}
+
+	if (errorString != nil)
+	{
+		OOLog(kOOLogDataCacheRetrieveFailed, @"Could not read data cache entry %@ in \"%@\": %@", key, cacheName, errorString);
+#if OOLITE_RELEASE_PLIST_ERROR_STRINGS
+		[errorString release];
+#endif
+		return nil;
+	}
+
+	return result;
+}
@@ -0,0 +1,137 @@
+/*
+
+OOCollisionBroadphase.h
+
+Spatial hash broadphase for collision detection.
+
+The classic broadphase threads every entity through three linked lists sorted
+by position on each axis (see Entity's x_next/y_next/z_next and
+-[Universe filterSortedLists]). This class is an alternative which keeps
+positions and radii in contiguous arrays, buckets them into a loose uniform
+grid and reports the candidate pairs whose expanded bounding boxes overlap.
+The candidate test is the same as the one used by -filterSortedLists: two
+bodies are candidates if, on every axis, their centres are closer than twice
+the sum of their radii.
+
+The body order from the previous update is kept, and the cell-sorted order is
+repaired with an insertion sort, so a scene where few bodies change cell costs
+close to O(n) per update. Bodies too big for the grid are kept in a separate
+list and tested against everything.
+
+This class is *not* thread-safe.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCocoa.h"
+#import "OOMaths.h"
+
+@class Entity;
+
+
+typedef enum
+{
+	kOOCollisionBroadphaseSweepAndPrune,	// Axis-sorted linked lists and collision chains.
+	kOOCollisionBroadphaseSpatialHash,		// OOCollisionBroadphase.
+
+	kOOCollisionBroadphaseDefault			= kOOCollisionBroadphaseSweepAndPrune
+} OOCollisionBroadphaseMode;
+
+
+typedef struct OOCollisionBroadphasePair
+{
+	uint32_t				a, b;		// Body indices, a < b.
+} OOCollisionBroadphasePair;
+
+
+@interface OOCollisionBroadphase: NSObject
+{
+@private
+	OOHPScalar				_cellSize;
+
+	// Body data, indexed by body index.
+	NSUInteger				_count;
+	NSUInteger				_capacity;
+	OOHPScalar				*_x, *_y, *_z;
+	GLfloat					*_reach;		// Half-extent of expanded bounding box (2 * collision radius).
+	uint64_t				*_cellKey;
+	Entity					**_entities;
+
+	// Body indices sorted by cell key; persists between updates.
+	uint32_t				*_order;
+	NSUInteger				_orderCount;
+
+	// Bodies too big for the grid.
+	uint32_t				*_oversize;
+	NSUInteger				_oversizeCount;
+
+	// Open-addressed cell table: cell key -> run in _order.
+	uint64_t				*_cellKeys;
+	uint32_t				*_cellStart;
+	uint32_t				*_cellLength;
+	NSUInteger				_cellTableSize;
+
+	OOCollisionBroadphasePair *_pairs;
+	NSUInteger				_pairCount;
+	NSUInteger				_pairCapacity;
+
+	NSUInteger				_candidateTests;
+}
+
+- (instancetype) init;
+- (instancetype) initWithCellSize:(OOHPScalar)cellSize NS_DESIGNATED_INITIALIZER;
+
+/*	Rebuild the grid from the entities which can collide, and find candidate
+	pairs. Entities which can't collide are skipped. As a side effect, each
+	entity's collision_chain is cleared and its collisionTestFilter is set to
+	0 or 3, exactly as -[Universe filterSortedLists] would for a collidable or
+	non-collidable entity.
+*/
+- (void) updateWithEntities:(Entity **)entities count:(NSUInteger)count;
+
+/*	Same, for synthetic data (benchmarks and tests). positions and radii must
+	each have count elements. -entityAtIndex: returns nil after this.
+*/
+- (void) updateWithPositions:(const HPVector *)positions radii:(const GLfloat *)radii count:(NSUInteger)count;
+
+@property (readonly) NSUInteger bodyCount;
+@property (readonly) NSUInteger pairCount;
+@property (readonly) const OOCollisionBroadphasePair *pairs;
+- (Entity *) entityAtIndex:(NSUInteger)index;
+
+// Number of bounding box tests in the last update, for the FPS display.
+@property (readonly) NSUInteger candidateTestCount;
+
+@end
+
+
+OOCollisionBroadphaseMode OOCollisionBroadphaseModeFromString(NSString *string);
+NSString *OOStringFromCollisionBroadphaseMode(OOCollisionBroadphaseMode mode);
+
+
+#ifndef NDEBUG
+/*	Benchmark the spatial hash against a single-axis sort-and-sweep (the same
+	candidate test as the legacy z-list filter) and a brute force reference,
+	with 100, 500 and 2000 synthetic bodies. Results are logged under
+	"collision.broadphase.benchmark" and returned as a string.
+*/
+NSString *OOCollisionBroadphaseRunBenchmark(void);
+#endif
@@ -0,0 +1,120 @@
+/*
+
+OODATTokenizer.h
+
+Single-pass reader for the text DAT model format, shared by OOMesh and the OXP
+verifier's model stage.
+
+The tokenizer works directly on the bytes of the file, without creating
+strings or copying anything, and tracks the line number for error messages.
+It reads the format as the NSScanner-based parser it replaces did: comments
+(from # or // to the end of the line) and commas count as whitespace, section
+keywords are matched case-insensitively, and numbers are read as -[NSScanner
+scanInt:] and -scanFloat: read them. Floats are converted without strtod()
+unless they have more significant digits or a larger exponent than can be
+converted exactly, which DAT files in practice never do.
+
+The tokenizer does not retain its data. UTF-16 files are converted to UTF-8
+when the tokenizer is set up, so the converted data lives in the current
+autorelease pool.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCocoa.h"
+#import "OOMaths.h"
+
+
+//	Section keywords, in the order they appear in a DAT file.
+typedef enum
+{
+	kOODATSectionNone,
+	kOODATSectionNVerts,
+	kOODATSectionNFaces,
+	kOODATSectionVertex,
+	kOODATSectionFaces,
+	kOODATSectionTextures,
+	kOODATSectionNames,
+	kOODATSectionNormals,
+	kOODATSectionTangents,
+	kOODATSectionEnd
+} OODATSection;
+
+
+typedef struct
+{
+	const uint8_t			*cursor;
+	const uint8_t			*end;
+	NSUInteger				line;			// One-based line number of cursor.
+} OODATTokenizer;
+
+
+/*	Set up a tokenizer for the contents of a DAT file. Returns NO if data is
+	nil or can't be decoded.
+*/
+BOOL OODATTokenizerInit(OODATTokenizer *tokenizer, NSData *data);
+
+//	YES if only whitespace and comments remain.
+BOOL OODATAtEnd(OODATTokenizer *tokenizer);
+
+/*	If the next token starts with the keyword for section, consume the keyword
+	and return YES. Like NSScanner, this matches a prefix, so "FACES" is also
+	found at the start of "FACESX".
+*/
+BOOL OODATScanSection(OODATTokenizer *tokenizer, OODATSection section);
+
+//	The section keyword at the cursor, or kOODATSectionNone. Nothing is consumed.
+OODATSection OODATPeekSection(OODATTokenizer *tokenizer);
+
+NSString *OODATSectionName(OODATSection section);
+
+/*	Number scanners. On failure, the cursor is left at the start of the
+	offending token.
+*/
+BOOL OODATScanInt(OODATTokenizer *tokenizer, int *outValue);
+BOOL OODATScanFloat(OODATTokenizer *tokenizer, float *outValue);
+BOOL OODATScanVector(OODATTokenizer *tokenizer, Vector *outValue);
+
+/*	Scan a word (such as a texture name) up to whitespace, a comma or a
+	comment. The result points into the file data.
+*/
+BOOL OODATScanWord(OODATTokenizer *tokenizer, const uint8_t **outBytes, NSUInteger *outLength);
+
+/*	Scan the rest of the current line (used for NAMES entries), or the next
+	non-blank line if the cursor is at the end of one. Trailing whitespace is
+	kept and commas become spaces, as in the old parser. Returns nil if there
+	is nothing before the end of the file.
+*/
+NSString *OODATScanLine(OODATTokenizer *tokenizer);
+
+//	A string for a word from OODATScanWord(): UTF-8, or ISO Latin-1 if it isn't valid UTF-8.
+NSString *OODATStringWithBytes(const uint8_t *bytes, NSUInteger length);
+
+
+#ifndef NDEBUG
+/*	For every built-in DAT model, read every token both with the tokenizer and
+	with the old NSString/NSScanner preprocessing and scanning, timing both
+	and comparing the results. Then do the same for randomly damaged copies
+	of each model (bytes replaced, inserted and removed, and files truncated)
+	to check that both read malformed input the same way.
+*/
+NSString *OODATTokenizerRunBenchmark(void);
+#endif
@@ -0,0 +1,667 @@
+/*
+
+OODATTokenizer.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OODATTokenizer.h"
+#import "NSStringOOExtensions.h"
+
+#ifndef NDEBUG
+#import "ResourceManager.h"
+#import "OOProfilingStopwatch.h"
+#import "NSFileManagerOOExtensions.h"
+#import "legacy_random.h"
+#endif
+
+
+static const char * const kSectionKeywords[] =
+{
+	[kOODATSectionNone]		= "",
+	[kOODATSectionNVerts]	= "NVERTS",
+	[kOODATSectionNFaces]	= "NFACES",
+	[kOODATSectionVertex]	= "VERTEX",
+	[kOODATSectionFaces]	= "FACES",
+	[kOODATSectionTextures]	= "TEXTURES",
+	[kOODATSectionNames]	= "NAMES",
+	[kOODATSectionNormals]	= "NORMALS",
+	[kOODATSectionTangents]	= "TANGENTS",
+	[kOODATSectionEnd]		= "END"
+};
+
+
+/*	Powers of ten that are exact in a double. A decimal with at most 53 bits
+	of significand, multiplied or divided by one of these, is correctly
+	rounded (Clinger's fast path).
+*/
+static const double kPowersOfTen[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+enum
+{
+	kMaxExactPowerOfTen			= sizeof kPowersOfTen / sizeof *kPowersOfTen - 1,
+	kMaxMantissaDigits			= 18
+};
+
+
+OOINLINE BOOL IsDigit(uint8_t c)
+{
+	return (uint8_t)(c - '0') < 10;
+}
+
+
+OOINLINE BOOL IsCommentStart(const uint8_t *p, const uint8_t *end)
+{
+	return *p == '#' || (*p == '/' && p + 1 < end && p[1] == '/');
+}
+
+
+OOINLINE BOOL IsSeparator(uint8_t c)
+{
+	return c == ' ' || c == '\t' || c == ',' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+static void SkipWhitespace(OODATTokenizer *tokenizer)
+{
+	const uint8_t	*p = tokenizer->cursor;
+	const uint8_t	*end = tokenizer->end;
+	NSUInteger		line = tokenizer->line;
+
+	while (p < end)
+	{
+		uint8_t c = *p;
+		if (c == ' ' || c == '\t' || c == ',' || c == '\v' || c == '\f')
+		{
+			p++;
+		}
+		else if (c == '\n')
+		{
+			p++;
+			line++;
+		}
+		else if (c == '\r')
+		{
+			p++;
+			if (p == end || *p != '\n')  line++;
+		}
+		else if (IsCommentStart(p, end))
+		{
+			while (p < end && *p != '\n' && *p != '\r')  p++;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	tokenizer->cursor = p;
+	tokenizer->line = line;
+}
+
+
+BOOL OODATTokenizerInit(OODATTokenizer *tokenizer, NSData *data)
+{
+	NSCParameterAssert(tokenizer != NULL);
+
+	if (data == nil)  return NO;
+
+	const uint8_t *bytes = [data bytes];
+	NSUInteger length = [data length];
+
+	if (length >= 2 && (length % sizeof (unichar)) == 0 &&
+		((bytes[0] == 0xFF && bytes[1] == 0xFE) || (bytes[0] == 0xFE && bytes[1] == 0xFF)))
+	{
+		// UTF-16 DAT files are rare enough that converting them is fine.
+		data = [[NSString stringWithUnicodeData:data] dataUsingEncoding:NSUTF8StringEncoding];
+		if (data == nil)  return NO;
+		bytes = [data bytes];
+		length = [data length];
+	}
+	else if (length >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF)
+	{
+		bytes += 3;
+		length -= 3;
+	}
+
+	tokenizer->cursor = bytes;
+	tokenizer->end = bytes + length;
+	tokenizer->line = 1;
+	return YES;
+}
+
+
+BOOL OODATAtEnd(OODATTokenizer *tokenizer)
+{
+	SkipWhitespace(tokenizer);
+	return tokenizer->cursor == tokenizer->end;
+}
+
+
+static BOOL MatchKeyword(const OODATTokenizer *tokenizer, const char *keyword, NSUInteger *outLength)
+{
+	const uint8_t	*p = tokenizer->cursor;
+	NSUInteger		i;
+
+	for (i = 0; keyword[i] != '\0'; i++)
+	{
+		if (p + i == tokenizer->end)  return NO;
+		uint8_t c = p[i];
+		if (c >= 'a' && c <= 'z')  c -= 'a' - 'A';
+		if (c != (uint8_t)keyword[i])  return NO;
+	}
+
+	*outLength = i;
+	return i != 0;
+}
+
+
+BOOL OODATScanSection(OODATTokenizer *tokenizer, OODATSection section)
+{
+	NSUInteger length;
+
+	NSCParameterAssert(section > kOODATSectionNone && section <= kOODATSectionEnd);
+
+	SkipWhitespace(tokenizer);
+	if (!MatchKeyword(tokenizer, kSectionKeywords[section], &length))  return NO;
+	tokenizer->cursor += length;
+	return YES;
+}
+
+
+OODATSection OODATPeekSection(OODATTokenizer *tokenizer)
+{
+	OODATSection	section;
+	NSUInteger		length;
+
+	SkipWhitespace(tokenizer);
+	for (section = kOODATSectionNVerts; section <= kOODATSectionEnd; section++)
+	{
+		if (MatchKeyword(tokenizer, kSectionKeywords[section], &length))  return section;
+	}
+	return kOODATSectionNone;
+}
+
+
+NSString *OODATSectionName(OODATSection section)
+{
+	if (section <= kOODATSectionNone || section > kOODATSectionEnd)  return nil;
+	return [NSString stringWithUTF8String:kSectionKeywords[section]];
+}
+
+
+BOOL OODATScanInt(OODATTokenizer *tokenizer, int *outValue)
+{
+	SkipWhitespace(tokenizer);
+
+	const uint8_t	*p = tokenizer->cursor;
+	const uint8_t	*end = tokenizer->end;
+	BOOL			negative = NO;
+	int64_t			value = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
+	if (p == end || !IsDigit(*p))  return NO;
+
+	// Out-of-range values are clamped, as NSScanner does.
+	for (; p < end && IsDigit(*p); p++)
+	{
+		if (value <= INT_MAX)  value = value * 10 + (*p - '0');
+	}
+	if (negative)  value = -value;
+	if (value > INT_MAX)  value = INT_MAX;
+	if (value < INT_MIN)  value = INT_MIN;
+
+	tokenizer->cursor = p;
+	*outValue = (int)value;
+	return YES;
+}
+
+
+static double SlowParseDouble(const uint8_t *start, NSUInteger length)
+{
+	char		buffer[64];
+	char		*string = buffer;
+	double		result;
+
+	if (length >= sizeof buffer)
+	{
+		string = malloc(length + 1);
+		if (string == NULL)  return 0.0;
+	}
+	memcpy(string, start, length);
+	string[length] = '\0';
+
+	result = strtod(string, NULL);
+
+	if (string != buffer)  free(string);
+	return result;
+}
+
+
+BOOL OODATScanFloat(OODATTokenizer *tokenizer, float *outValue)
+{
+	SkipWhitespace(tokenizer);
+
+	const uint8_t	*start = tokenizer->cursor;
+	const uint8_t	*p = start;
+	const uint8_t	*end = tokenizer->end;
+	BOOL			negative = NO;
+	BOOL			exact = YES;
+	uint64_t		mantissa = 0;
+	unsigned		mantissaDigits = 0;
+	unsigned		digits = 0;
+	int				exponent = 0;
+	double			value;
+
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
+
+	// Integer part. Digits past the 18th only scale the value.
+	for (; p < end && IsDigit(*p); p++, digits++)
+	{
+		unsigned d = *p - '0';
+		if (mantissaDigits < kMaxMantissaDigits)
+		{
+			mantissa = mantissa * 10 + d;
+			if (mantissa != 0)  mantissaDigits++;
+		}
+		else
+		{
+			exponent++;
+			if (d != 0)  exact = NO;
+		}
+	}
+
+	// Fractional part.
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && IsDigit(*p); p++, digits++)
+		{
+			unsigned d = *p - '0';
+			if (mantissaDigits < kMaxMantissaDigits)
+			{
+				mantissa = mantissa * 10 + d;
+				if (mantissa != 0)  mantissaDigits++;
+				exponent--;
+			}
+			else if (d != 0)
+			{
+				exact = NO;
+			}
+		}
+	}
+
+	if (digits == 0)  return NO;
+
+	// Exponent, only if it has digits; otherwise the "e" is left for the next token.
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const uint8_t *q = p + 1;
+		BOOL negativeExponent = NO;
+		int explicitExponent = 0;
+
+		if (q < end && (*q == '-' || *q == '+'))
+		{
+			negativeExponent = (*q == '-');
+			q++;
+		}
+		if (q < end && IsDigit(*q))
+		{
+			for (; q < end && IsDigit(*q); q++)
+			{
+				if (explicitExponent < 100000)  explicitExponent = explicitExponent * 10 + (*q - '0');
+			}
+			exponent += negativeExponent ? -explicitExponent : explicitExponent;
+			p = q;
+		}
+	}
+
+	if (mantissa == 0)
+	{
+		value = 0.0;
+	}
+	else if (exact && mantissa <= (1ULL << 53) && exponent >= -kMaxExactPowerOfTen && exponent <= kMaxExactPowerOfTen)
+	{
+		value = (double)mantissa;
+		if (exponent < 0)  value /= kPowersOfTen[-exponent];
+		else  value *= kPowersOfTen[exponent];
+	}
+	else
+	{
+		value = fabs(SlowParseDouble(start, p - start));
+	}
+
+	tokenizer->cursor = p;
+	*outValue = (float)(negative ? -value : value);
+	return YES;
+}
+
+
+BOOL OODATScanVector(OODATTokenizer *tokenizer, Vector *outValue)
+{
+	float x, y, z;
+
+	if (!OODATScanFloat(tokenizer, &x))  return NO;
+	if (!OODATScanFloat(tokenizer, &y))  return NO;
+	if (!OODATScanFloat(tokenizer, &z))  return NO;
+
+	*outValue = make_vector(x, y, z);
+	return YES;
+}
+
+
+BOOL OODATScanWord(OODATTokenizer *tokenizer, const uint8_t **outBytes, NSUInteger *outLength)
+{
+	SkipWhitespace(tokenizer);
+
+	const uint8_t	*start = tokenizer->cursor;
+	const uint8_t	*p = start;
+	const uint8_t	*end = tokenizer->end;
+
+	while (p < end && !IsSeparator(*p) && !IsCommentStart(p, end))  p++;
+	if (p == start)  return NO;
+
+	tokenizer->cursor = p;
+	*outBytes = start;
+	*outLength = p - start;
+	return YES;
+}
+
+
+NSString *OODATScanLine(OODATTokenizer *tokenizer)
+{
+	SkipWhitespace(tokenizer);
+
+	const uint8_t	*start = tokenizer->cursor;
+	const uint8_t	*p = start;
+	const uint8_t	*end = tokenizer->end;
+
+	while (p < end && *p != '\n' && *p != '\r' && !IsCommentStart(p, end))  p++;
+	if (p == start)  return nil;
+
+	tokenizer->cursor = p;
+	NSString *result = OODATStringWithBytes(start, p - start);
+	if (memchr(start, ',', p - start) != NULL)
+	{
+		result = [result stringByReplacingOccurrencesOfString:@"," withString:@" "];
+	}
+	return result;
+}
+
+
+NSString *OODATStringWithBytes(const uint8_t *bytes, NSUInteger length)
+{
+	NSString *result = [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+	if (result == nil)  result = [[NSString alloc] initWithBytes:bytes length:length encoding:NSISOLatin1StringEncoding];
+	return [result autorelease];
+}
+
+
+#ifndef NDEBUG
+
+enum
+{
+	kFuzzVariantsPerModel		= 16,
+	kFuzzMaxEdits				= 8
+};
+
+
+//	The preprocessing done by the old OOMesh parser.
+static NSScanner *ReferenceScanner(NSData *data)
+{
+	NSString *string = [NSString stringWithUnicodeData:data];
+	if (string == nil)  return nil;
+
+	NSMutableArray *lines = [NSMutableArray arrayWithArray:[string componentsSeparatedByString:@"\n"]];
+	NSUInteger i, count = [lines count];
+	for (i = 0; i < count; i++)
+	{
+		NSString *line = [lines objectAtIndex:i];
+		line = [[line componentsSeparatedByString:@"#"] objectAtIndex:0];
+		line = [[line componentsSeparatedByString:@"//"] objectAtIndex:0];
+		line = [[line componentsSeparatedByString:@","] componentsJoinedByString:@" "];
+		[lines replaceObjectAtIndex:i withObject:line];
+	}
+
+	return [NSScanner scannerWithString:[lines componentsJoinedByString:@"\n"]];
+}
+
+
+/*	Read a file as a sequence of floats and words with the old parser. If
+	tokens is not nil, they are collected (as NSNumbers and NSStrings).
+*/
+static NSUInteger ReferenceScan(NSData *data, NSMutableArray *tokens)
+{
+	NSCharacterSet	*separators = [NSCharacterSet whitespaceAndNewlineCharacterSet];
+	NSScanner		*scanner = ReferenceScanner(data);
+	NSUInteger		count = 0;
+	float			value;
+	NSString		*word = nil;
+
+	while (![scanner isAtEnd])
+	{
+		if ([scanner scanFloat:&value])
+		{
+			[tokens addObject:@(value)];
+		}
+		else if ([scanner scanUpToCharactersFromSet:separators intoString:&word])
+		{
+			[tokens addObject:word];
+		}
+		else
+		{
+			break;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+
+/*	Read a file as a sequence of floats and words with the tokenizer. If
+	reference is not nil, compare with it, and return NSNotFound on success
+	or the index of the first mismatch.
+*/
+static NSUInteger TokenizerScan(NSData *data, NSArray *reference, NSUInteger *outLine)
+{
+	OODATTokenizer	tokenizer;
+	NSUInteger		count = 0, referenceCount = [reference count];
+	float			value;
+	const uint8_t	*word = NULL;
+	NSUInteger		wordLength;
+
+	if (!OODATTokenizerInit(&tokenizer, data))  return (reference != nil && referenceCount == 0) ? NSNotFound : 0;
+
+	while (!OODATAtEnd(&tokenizer))
+	{
+		if (outLine != NULL)  *outLine = tokenizer.line;
+		if (OODATScanFloat(&tokenizer, &value))
+		{
+			if (reference != nil)
+			{
+				if (count >= referenceCount)  return count;
+				id expected = [reference objectAtIndex:count];
+				if (![expected isKindOfClass:[NSNumber class]])  return count;
+				float expectedValue = [expected floatValue];
+				if (expectedValue != value && !(isnan(expectedValue) && isnan(value)))  return count;
+			}
+		}
+		else if (OODATScanWord(&tokenizer, &word, &wordLength))
+		{
+			if (reference != nil)
+			{
+				if (count >= referenceCount)  return count;
+				id expected = [reference objectAtIndex:count];
+				if (![expected isKindOfClass:[NSString class]] || ![expected isEqualToString:OODATStringWithBytes(word, wordLength)])  return count;
+			}
+		}
+		else
+		{
+			break;
+		}
+		count++;
+	}
+
+	if (reference != nil)  return (count == referenceCount) ? NSNotFound : count;
+	return count;
+}
+
+
+static NSData *FuzzedData(NSData *data, RANROTSeed *seed)
+{
+	static const char kFuzzBytes[] = " \t\n\r,#/.-+eE0123456789aZ";
+	NSMutableData	*result = [NSMutableData dataWithData:data];
+	unsigned		i, edits = RanrotWithSeed(seed) % kFuzzMaxEdits + 1;
+
+	for (i = 0; i < edits && [result length] != 0; i++)
+	{
+		NSUInteger length = [result length];
+		NSUInteger location = RanrotWithSeed(seed) % length;
+		uint8_t byte = kFuzzBytes[RanrotWithSeed(seed) % (sizeof kFuzzBytes - 1)];
+
+		switch (RanrotWithSeed(seed) % 8)
+		{
+			case 0:
+			case 1:
+			case 2:
+				[result replaceBytesInRange:NSMakeRange(location, 1) withBytes:&byte length:1];
+				break;
+
+			case 3:
+			case 4:
+				[result replaceBytesInRange:NSMakeRange(location, 0) withBytes:&byte length:1];
+				break;
+
+			case 5:
+			case 6:
+				[result replaceBytesInRange:NSMakeRange(location, 1) withBytes:NULL length:0];
+				break;
+
+			case 7:
+				[result setLength:location];
+				break;
+		}
+	}
+
+	return result;
+}
+
+
+NSString *OODATTokenizerRunBenchmark(void)
+{
+	NSAutoreleasePool		*pool = [[NSAutoreleasePool alloc] init];
+	NSFileManager			*fmgr = [NSFileManager defaultManager];
+	OOProfilingStopwatch	*stopwatch = [OOProfilingStopwatch stopwatch];
+	NSString				*modelsPath = nil;
+	NSString				*name = nil;
+	NSMutableArray			*models = [NSMutableArray array];
+	NSMutableArray			*modelNames = [NSMutableArray array];
+	NSData					*data = nil;
+	NSUInteger				i, tokenCount = 0, mismatches = 0, fuzzCount = 0, fuzzMismatches = 0;
+	unsigned long long		byteCount = 0;
+	OOTimeDelta				referenceTime, tokenizerTime;
+	RANROTSeed				seed = MakeRanrotSeed(0x0DA7F11E);
+
+	modelsPath = [[ResourceManager builtInPath] stringByAppendingPathComponent:@"Models"];
+	foreach (name, [[fmgr oo_directoryContentsAtPath:modelsPath] sortedArrayUsingSelector:@selector(compare:)])
+	{
+		if (![[[name pathExtension] lowercaseString] isEqualToString:@"dat"])  continue;
+		data = [NSData dataWithContentsOfFile:[modelsPath stringByAppendingPathComponent:name]];
+		if (data == nil)  continue;
+		[models addObject:data];
+		[modelNames addObject:name];
+		byteCount += [data length];
+	}
+
+	// Timing.
+	[stopwatch reset];
+	foreach (data, models)
+	{
+		NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+		tokenCount += ReferenceScan(data, nil);
+		[innerPool release];
+	}
+	referenceTime = [stopwatch reset];
+	foreach (data, models)
+	{
+		TokenizerScan(data, nil, NULL);
+	}
+	tokenizerTime = [stopwatch reset];
+
+	// Comparison, for the models as shipped and for damaged copies.
+	for (i = 0; i < [models count]; i++)
+	{
+		unsigned variant;
+		for (variant = 0; variant <= kFuzzVariantsPerModel; variant++)
+		{
+			NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+			NSMutableArray *reference = [NSMutableArray array];
+			NSUInteger line = 0;
+
+			data = [models objectAtIndex:i];
+			if (variant != 0)
+			{
+				data = FuzzedData(data, &seed);
+				fuzzCount++;
+			}
+
+			ReferenceScan(data, reference);
+			NSUInteger mismatch = TokenizerScan(data, reference, &line);
+			if (mismatch != NSNotFound)
+			{
+				if (variant == 0)  mismatches++;
+				else  fuzzMismatches++;
+
+				OOLog(@"dat.tokenizer.benchmark.mismatch", @"Tokenizer disagrees with NSScanner for %@%@ at token %lu (line %lu): expected %@.",
+					  [modelNames objectAtIndex:i], (variant == 0) ? @"" : [NSString stringWithFormat:@" (damaged copy %u)", variant],
+					  (unsigned long)mismatch, (unsigned long)line,
+					  (mismatch < [reference count]) ? [reference objectAtIndex:mismatch] : @"end of file");
+			}
+
+			[innerPool release];
+		}
+	}
+
+	NSString *result = [NSString stringWithFormat:@"%lu models, %lu tokens (%.1f MiB): NSScanner %.2f ms, tokenizer %.2f ms (%.1fx); %lu damaged copies%@%@",
+						(unsigned long)[models count], (unsigned long)tokenCount, byteCount / (1024.0 * 1024.0),
+						referenceTime * 1e3, tokenizerTime * 1e3, (tokenizerTime > 0) ? referenceTime / tokenizerTime : 0.0,
+						(unsigned long)fuzzCount,
+						(mismatches == 0) ? @"" : [NSString stringWithFormat:@" ** %lu MISMATCHES **", (unsigned long)mismatches],
+						(fuzzMismatches == 0) ? @"" : [NSString stringWithFormat:@" ** %lu DAMAGED COPY MISMATCHES **", (unsigned long)fuzzMismatches]];
+	OOLog(@"dat.tokenizer.benchmark", @"%@", result);
+
+	[result retain];
+	[pool release];
+	return [result autorelease];
+}
+
+#endif
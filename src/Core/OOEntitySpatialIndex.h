@@ -0,0 +1,101 @@
+/*
+
+OOEntitySpatialIndex.h
+
+kd-tree over entity positions, for range-limited predicate queries such as
+-[Universe findEntitiesMatchingPredicate:parameter:inRange:ofEntity:].
+
+Each node of the tree is an entity: the median of its range along the axis
+of greatest spread, with the entities below it on that axis to the left and
+those above to the right. The tree is implicit in the order of the entity
+array, and per-node data is stored at the node's own index. Each node also
+records the largest sphere radius below it, so that sphere queries can tell
+which sides of a splitting plane might hold an entity touching the sphere.
+
+The Universe builds one index per update, the first time a query needs it.
+Entities keep moving while the update runs, so each entity's radius is
+padded by the distance it can cover in one frame. Range queries therefore
+return a superset of the entities touching the sphere, which the caller must
+test against current positions; the nearest-entity query does that itself.
+
+This class is *not* thread-safe.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCocoa.h"
+#import "OOMaths.h"
+
+@class Entity;
+
+
+// Same signature as EntityFilterPredicate.
+typedef BOOL (*OOEntitySpatialIndexFilter)(Entity *entity, void *parameter);
+
+
+@interface OOEntitySpatialIndex: NSObject
+{
+@private
+	NSUInteger				_count;
+	NSUInteger				_capacity;
+
+	// Indexed by tree position.
+	Entity					**_entities;
+	HPVector				*_centres;
+	OOHPScalar				*_radii;			// Collision radius plus motion padding.
+	OOHPScalar				*_pads;				// Motion padding alone.
+	OOHPScalar				*_subtreeRadii;		// Largest of _radii in the node's subtree.
+	OOHPScalar				*_subtreePads;		// Largest of _pads in the node's subtree.
+	uint8_t					*_axes;
+
+	NSUInteger				_visitCount;
+}
+
+/*	Rebuild the index from the given entities. Each radius is padded by the
+	distance the entity covers in motionTime at its current speed. Entities
+	are not retained.
+*/
+- (void) rebuildWithEntities:(Entity **)entities count:(NSUInteger)count motionTime:(OOTimeDelta)motionTime;
+
+@property (readonly) NSUInteger entityCount;
+
+/*	Write to outEntities each entity whose padded sphere, at its position when
+	the index was built, touches the given sphere. outEntities must have room
+	for entityCount entities. Returns the number written.
+*/
+- (NSUInteger) getEntities:(Entity **)outEntities inSphere:(HPVector)centre radius:(OOHPScalar)radius;
+
+/*	Find the entity with the nearest current position to point which passes
+	filter, skipping excluded and any entity no longer in the universe. Ties
+	go to the entity earliest in the universe's sorted entity list, and the
+	distance is compared at float precision, both as a linear scan of the
+	sorted entity list would. filter is only called for entities nearer than
+	the best so far.
+*/
+- (Entity *) nearestEntityToPoint:(HPVector)point
+						excluding:(Entity *)excluded
+						   filter:(OOEntitySpatialIndexFilter)filter
+						parameter:(void *)parameter;
+
+// Number of entities examined in the last query.
+@property (readonly) NSUInteger visitCount;
+
+@end
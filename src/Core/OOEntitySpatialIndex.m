@@ -0,0 +1,317 @@
+/*
+
+OOEntitySpatialIndex.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOEntitySpatialIndex.h"
+#import "Entity.h"
+
+
+enum
+{
+	kMaxTraversalDepth		= 64		// Median splits halve the range, so this is never reached.
+};
+
+/*	Entities can speed up during the frame, and the frame's delta_t is not
+	quite the time between this update's build and the last query in it.
+*/
+#define kMotionSlack		1.5f
+#define kMotionMinimum		1.0f		// Metres; covers small nudges by stationary entities.
+
+
+typedef struct
+{
+	uint32_t				start, end;
+	float					minDistanceSq;		// Nearest-entity queries only.
+} IndexRange;
+
+
+@interface OOEntitySpatialIndex ()
+
+- (void) reserveEntities:(NSUInteger)count;
+
+@end
+
+
+static void BuildRange(OOEntitySpatialIndex *self, NSUInteger start, NSUInteger end);
+
+
+@implementation OOEntitySpatialIndex
+
+- (void) dealloc
+{
+	free(_entities);
+	free(_centres);
+	free(_radii);
+	free(_pads);
+	free(_subtreeRadii);
+	free(_subtreePads);
+	free(_axes);
+
+	[super dealloc];
+}
+
+
+- (NSString *) description
+{
+	return [NSString stringWithFormat:@"<%@ %p>{%lu entities}", [self class], self, _count];
+}
+
+
+- (void) rebuildWithEntities:(Entity **)entities count:(NSUInteger)count motionTime:(OOTimeDelta)motionTime
+{
+	NSUInteger		i;
+
+	NSParameterAssert(count < UINT32_MAX);
+	[self reserveEntities:count];
+
+	for (i = 0; i < count; i++)
+	{
+		Entity *entity = entities[i];
+		OOHPScalar pad = kMotionMinimum + kMotionSlack * [entity speed] * motionTime;
+
+		_entities[i] = entity;
+		_centres[i] = entity->position;
+		_pads[i] = pad;
+		_radii[i] = entity->collision_radius + pad;
+	}
+
+	_count = count;
+	if (count != 0)  BuildRange(self, 0, count);
+}
+
+
+- (NSUInteger) entityCount
+{
+	return _count;
+}
+
+
+- (NSUInteger) visitCount
+{
+	return _visitCount;
+}
+
+
+- (void) reserveEntities:(NSUInteger)count
+{
+	if (count <= _capacity)  return;
+
+	NSUInteger capacity = MAX(count, _capacity * 2);
+	_entities = realloc(_entities, capacity * sizeof *_entities);
+	_centres = realloc(_centres, capacity * sizeof *_centres);
+	_radii = realloc(_radii, capacity * sizeof *_radii);
+	_pads = realloc(_pads, capacity * sizeof *_pads);
+	_subtreeRadii = realloc(_subtreeRadii, capacity * sizeof *_subtreeRadii);
+	_subtreePads = realloc(_subtreePads, capacity * sizeof *_subtreePads);
+	_axes = realloc(_axes, capacity * sizeof *_axes);
+
+	if (_entities == NULL || _centres == NULL || _radii == NULL || _pads == NULL ||
+		_subtreeRadii == NULL || _subtreePads == NULL || _axes == NULL)
+	{
+		[NSException raise:NSMallocException format:@"Failed to allocate memory for entity spatial index."];
+	}
+	_capacity = capacity;
+}
+
+
+OOINLINE OOHPScalar CentreOnAxis(HPVector centre, unsigned axis)
+{
+	return (axis == 0) ? centre.x : (axis == 1) ? centre.y : centre.z;
+}
+
+
+static void SwapEntries(OOEntitySpatialIndex *self, NSUInteger i, NSUInteger j)
+{
+	Entity *entity = self->_entities[i];  self->_entities[i] = self->_entities[j];  self->_entities[j] = entity;
+	HPVector centre = self->_centres[i];  self->_centres[i] = self->_centres[j];  self->_centres[j] = centre;
+	OOHPScalar radius = self->_radii[i];  self->_radii[i] = self->_radii[j];  self->_radii[j] = radius;
+	OOHPScalar pad = self->_pads[i];  self->_pads[i] = self->_pads[j];  self->_pads[j] = pad;
+}
+
+
+// Partially sort [start, end) so that entry nth is the one it would be in fully sorted order.
+static void SelectNth(OOEntitySpatialIndex *self, NSUInteger start, NSUInteger end, NSUInteger nth, unsigned axis)
+{
+	while (end - start > 1)
+	{
+		OOHPScalar pivot = CentreOnAxis(self->_centres[start + (end - start - 1) / 2], axis);
+		NSUInteger i = start, j = end - 1;
+
+		for (;;)
+		{
+			while (CentreOnAxis(self->_centres[i], axis) < pivot)  i++;
+			while (CentreOnAxis(self->_centres[j], axis) > pivot)  j--;
+			if (i >= j)  break;
+
+			SwapEntries(self, i, j);
+			i++;
+			j--;
+		}
+
+		if (nth <= j)  end = j + 1;
+		else  start = j + 1;
+	}
+}
+
+
+static void BuildRange(OOEntitySpatialIndex *self, NSUInteger start, NSUInteger end)
+{
+	OOHPScalar		minimum[3] = { INFINITY, INFINITY, INFINITY };
+	OOHPScalar		maximum[3] = { -INFINITY, -INFINITY, -INFINITY };
+	OOHPScalar		subtreeRadius = 0, subtreePad = 0;
+	NSUInteger		i, mid = start + (end - start) / 2;
+	unsigned		axis, splitAxis = 0;
+
+	for (i = start; i < end; i++)
+	{
+		for (axis = 0; axis < 3; axis++)
+		{
+			OOHPScalar value = CentreOnAxis(self->_centres[i], axis);
+			minimum[axis] = fmin(minimum[axis], value);
+			maximum[axis] = fmax(maximum[axis], value);
+		}
+		subtreeRadius = fmax(subtreeRadius, self->_radii[i]);
+		subtreePad = fmax(subtreePad, self->_pads[i]);
+	}
+
+	for (axis = 1; axis < 3; axis++)
+	{
+		if (maximum[axis] - minimum[axis] > maximum[splitAxis] - minimum[splitAxis])  splitAxis = axis;
+	}
+
+	SelectNth(self, start, end, mid, splitAxis);
+	self->_axes[mid] = splitAxis;
+	self->_subtreeRadii[mid] = subtreeRadius;
+	self->_subtreePads[mid] = subtreePad;
+
+	if (start < mid)  BuildRange(self, start, mid);
+	if (mid + 1 < end)  BuildRange(self, mid + 1, end);
+}
+
+
+- (NSUInteger) getEntities:(Entity **)outEntities inSphere:(HPVector)centre radius:(OOHPScalar)radius
+{
+	IndexRange		stack[kMaxTraversalDepth];
+	unsigned		depth = 0;
+	NSUInteger		found = 0;
+
+	NSParameterAssert(outEntities != NULL || _count == 0);
+
+	_visitCount = 0;
+	if (_count == 0)  return 0;
+	stack[depth++] = (IndexRange){ 0, (uint32_t)_count, 0.0f };
+
+	while (depth > 0)
+	{
+		IndexRange range = stack[--depth];
+		uint32_t mid = range.start + (range.end - range.start) / 2;
+
+		_visitCount++;
+		OOHPScalar reach = radius + _radii[mid];
+		if (HPdistance2(_centres[mid], centre) <= reach * reach)
+		{
+			outEntities[found++] = _entities[mid];
+		}
+
+		// Entities on either side of the plane may reach this far across it.
+		OOHPScalar limit = radius + _subtreeRadii[mid];
+		OOHPScalar offset = CentreOnAxis(centre, _axes[mid]) - CentreOnAxis(_centres[mid], _axes[mid]);
+
+		NSAssert(depth + 2 <= kMaxTraversalDepth, @"Entity spatial index traversal stack overflow.");
+		if (range.start < mid && offset <= limit)  stack[depth++] = (IndexRange){ range.start, mid, 0.0f };
+		if (mid + 1 < range.end && -offset <= limit)  stack[depth++] = (IndexRange){ mid + 1, range.end, 0.0f };
+	}
+
+	return found;
+}
+
+
+- (Entity *) nearestEntityToPoint:(HPVector)point
+						excluding:(Entity *)excluded
+						   filter:(OOEntitySpatialIndexFilter)filter
+						parameter:(void *)parameter
+{
+	IndexRange		stack[kMaxTraversalDepth];
+	unsigned		depth = 0;
+	Entity			*best = nil;
+	float			bestDistanceSq = INFINITY;
+
+	NSParameterAssert(filter != NULL);
+
+	_visitCount = 0;
+	if (_count == 0)  return nil;
+	stack[depth++] = (IndexRange){ 0, (uint32_t)_count, 0.0f };
+
+	while (depth > 0)
+	{
+		IndexRange range = stack[--depth];
+		if (range.minDistanceSq > bestDistanceSq)  continue;
+		
+		uint32_t mid = range.start + (range.end - range.start) / 2;
+		unsigned axis = _axes[mid];
+
+		/*	Nothing across the splitting plane can have moved closer to the
+			point than the plane distance less the subtree's motion padding.
+			The bound is kept at float precision, so that an entity at the
+			same (float) distance as the best is not pruned.
+		*/
+		OOHPScalar offset = CentreOnAxis(point, axis) - CentreOnAxis(_centres[mid], axis);
+		OOHPScalar pad = _subtreePads[mid];
+
+		Entity *entity = _entities[mid];
+		if (entity != excluded && entity->zero_index >= 0)
+		{
+			float distanceSq = (float)HPdistance2(point, entity->position);
+			_visitCount++;
+
+			if ((distanceSq < bestDistanceSq || (distanceSq == bestDistanceSq && best != nil && entity->zero_index < best->zero_index)) &&
+				filter(entity, parameter))
+			{
+				best = entity;
+				bestDistanceSq = distanceSq;
+			}
+		}
+
+		uint32_t nearStart = range.start, nearEnd = mid, farStart = mid + 1, farEnd = range.end;
+		if (offset > 0)
+		{
+			nearStart = mid + 1;  nearEnd = range.end;
+			farStart = range.start;  farEnd = mid;
+		}
+
+		// Push the far side first, so the near side is searched first and tightens the bound.
+		NSAssert(depth + 2 <= kMaxTraversalDepth, @"Entity spatial index traversal stack overflow.");
+		OOHPScalar farGap = fmax(fabs(offset) - pad, 0.0);
+		float farDistanceSq = fmaxf((float)(farGap * farGap), range.minDistanceSq);
+		if (farStart < farEnd && farDistanceSq <= bestDistanceSq)
+		{
+			stack[depth++] = (IndexRange){ farStart, farEnd, farDistanceSq };
+		}
+		if (nearStart < nearEnd)  stack[depth++] = (IndexRange){ nearStart, nearEnd, range.minDistanceSq };
+	}
+
+	return best;
+}
+
+@end
@@ -0,0 +1,87 @@
+/*
+
+OOJobPool.h
+
+Fork/join thread pool for spreading a loop across all processors.
+
+-applyFunction:context:count:grain: cuts the index range into chunks of
+grain indices, deals the chunks out to one deque per thread, and runs them on
+the pool's worker threads and on the calling thread. Each thread works
+through its own deque from the front; a thread which runs out steals from the
+back of another thread's deque, so an uneven workload still balances. The
+call returns when every index has been processed.
+
+Each chunk runs inside its own autorelease pool. The function must be
+thread-safe; an exception it raises is logged and does not propagate, but the
+rest of the indices are still run and the call returns NO.
+
+The pool is sized from OOCPUCount(). It runs one job at a time: on a
+single-processor system, when called from inside a job, or when another
+thread is using the pool, the loop simply runs on the calling thread.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCocoa.h"
+
+
+typedef void (*OOJobPoolFunction)(void *context, NSUInteger index);
+
+
+typedef struct OOJobPoolDeque
+{
+	NSLock					*lock;
+	NSUInteger				front, back;	// Chunk indices [front, back) not yet taken.
+} OOJobPoolDeque;
+
+
+@interface OOJobPool: NSObject
+{
+@private
+	NSUInteger				_threadCount;		// Including the calling thread.
+	OOJobPoolDeque			*_deques;
+
+	NSCondition				*_condition;
+	NSUInteger				_generation;
+	NSUInteger				_busyWorkers;
+	NSLock					*_jobLock;			// Held by the thread running the current job.
+	BOOL					_failed;
+
+	// Current job.
+	OOJobPoolFunction		_function;
+	void					*_context;
+	NSUInteger				_count;
+	NSUInteger				_grain;
+}
+
++ (OOJobPool *) sharedJobPool;
+
+// Number of threads a job is spread over, including the calling thread.
+@property (readonly) NSUInteger threadCount;
+
+/*	Call function(context, i) for each i in [0, count), and wait for all of
+	the calls to finish. grain is the number of indices per chunk; it should
+	be large enough that one chunk is worth a lock round trip.
+	Returns NO if any of the calls raised an exception.
+*/
+- (BOOL) applyFunction:(OOJobPoolFunction)function context:(void *)context count:(NSUInteger)count grain:(NSUInteger)grain;
+
+@end
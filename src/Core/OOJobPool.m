@@ -0,0 +1,295 @@
+/*
+
+OOJobPool.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOJobPool.h"
+#import "OOCPUInfo.h"
+#import "NSThreadOOExtensions.h"
+
+
+enum
+{
+	kMaxJobThreads			= 16
+};
+
+
+static OOJobPool *sSharedJobPool = nil;
+
+
+@interface OOJobPool ()
+
+- (instancetype) initWithThreadCount:(NSUInteger)threadCount NS_DESIGNATED_INITIALIZER;
+
+- (void) runWorkerThread:(NSNumber *)threadIndex;
+
+@end
+
+
+@implementation OOJobPool
+
++ (OOJobPool *) sharedJobPool
+{
+	if (sSharedJobPool == nil)
+	{
+		sSharedJobPool = [[self alloc] initWithThreadCount:MIN(OOCPUCount(), (NSUInteger)kMaxJobThreads)];
+	}
+	return sSharedJobPool;
+}
+
+
+- (instancetype) init
+{
+	return [self initWithThreadCount:1];
+}
+
+
+- (instancetype) initWithThreadCount:(NSUInteger)threadCount
+{
+	if ((self = [super init]))
+	{
+		_threadCount = MAX(threadCount, (NSUInteger)1);
+		_deques = calloc(_threadCount, sizeof *_deques);
+		_condition = [[NSCondition alloc] init];
+		_jobLock = [[NSLock alloc] init];
+		if (_deques == NULL || _condition == nil || _jobLock == nil)
+		{
+			[self release];
+			return nil;
+		}
+
+		NSUInteger i;
+		for (i = 0; i < _threadCount; i++)
+		{
+			_deques[i].lock = [[NSLock alloc] init];
+		}
+
+		// Thread 0 is whoever calls -applyFunction:...; the rest are ours.
+		for (i = 1; i < _threadCount; i++)
+		{
+			[NSThread detachNewThreadSelector:@selector(runWorkerThread:) toTarget:self withObject:[NSNumber numberWithUnsignedInteger:i]];
+		}
+	}
+
+	return self;
+}
+
+
+- (void) dealloc
+{
+	// Worker threads retain the pool, so only a pool without workers gets here.
+	NSUInteger i;
+	if (_deques != NULL)
+	{
+		for (i = 0; i < _threadCount; i++)  [_deques[i].lock release];
+		free(_deques);
+	}
+	[_condition release];
+	[_jobLock release];
+
+	[super dealloc];
+}
+
+
+@synthesize threadCount = _threadCount;
+
+
+static BOOL TakeChunk(OOJobPoolDeque *deque, BOOL fromFront, NSUInteger *outChunk)
+{
+	BOOL result = NO;
+
+	[deque->lock lock];
+	if (deque->front < deque->back)
+	{
+		*outChunk = fromFront ? deque->front++ : --deque->back;
+		result = YES;
+	}
+	[deque->lock unlock];
+
+	return result;
+}
+
+
+/*	Call function for each index in [start, end). An exception is logged and
+	the remaining indices are still run; returns NO if there was one.
+*/
+static BOOL RunRange(OOJobPoolFunction function, void *context, NSUInteger start, NSUInteger end)
+{
+	NSUInteger i = start;
+	BOOL result = YES;
+
+	while (i < end)
+	{
+		@try
+		{
+			for (; i < end; i++)
+			{
+				function(context, i);
+			}
+		}
+		@catch (NSException *exception)
+		{
+			OOLog(@"jobPool.exception", @"***** Exception in job pool function for index %lu: %@ : %@", (unsigned long)i, [exception name], [exception reason]);
+			result = NO;
+			i++;
+		}
+	}
+
+	return result;
+}
+
+
+static void RunChunk(OOJobPool *pool, NSUInteger chunk)
+{
+	NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+
+	NSUInteger start = chunk * pool->_grain;
+	NSUInteger end = MIN(start + pool->_grain, pool->_count);
+
+	if (!RunRange(pool->_function, pool->_context, start, end))
+	{
+		[pool->_condition lock];
+		pool->_failed = YES;
+		[pool->_condition unlock];
+	}
+
+	[autoreleasePool release];
+}
+
+
+static void RunChunks(OOJobPool *pool, NSUInteger threadIndex)
+{
+	NSUInteger threadCount = pool->_threadCount;
+	NSUInteger chunk;
+
+	for (;;)
+	{
+		if (!TakeChunk(&pool->_deques[threadIndex], YES, &chunk))
+		{
+			// Own deque is empty; steal from the back of someone else's.
+			BOOL stolen = NO;
+			NSUInteger offset;
+			for (offset = 1; offset < threadCount && !stolen; offset++)
+			{
+				stolen = TakeChunk(&pool->_deques[(threadIndex + offset) % threadCount], NO, &chunk);
+			}
+
+			// Chunks are never added once a job starts, so if every deque is empty we're done.
+			if (!stolen)  return;
+		}
+
+		RunChunk(pool, chunk);
+	}
+}
+
+
+- (BOOL) applyFunction:(OOJobPoolFunction)function context:(void *)context count:(NSUInteger)count grain:(NSUInteger)grain
+{
+	NSParameterAssert(function != NULL);
+
+	if (count == 0)  return YES;
+	if (grain == 0)  grain = 1;
+	NSUInteger chunkCount = (count + grain - 1) / grain;
+
+	if (![_jobLock tryLock])
+	{
+		/*	Nested use from inside a job, or another thread has the pool; the
+			workers are busy, so just do it here.
+		*/
+		NSAutoreleasePool *autoreleasePool = [[NSAutoreleasePool alloc] init];
+		BOOL result = RunRange(function, context, 0, count);
+		[autoreleasePool release];
+		return result;
+	}
+
+	_function = function;
+	_context = context;
+	_count = count;
+	_grain = grain;
+	_failed = NO;
+
+	// Deal out contiguous runs of chunks, so each thread starts on neighbouring indices.
+	NSUInteger i;
+	for (i = 0; i < _threadCount; i++)
+	{
+		_deques[i].front = chunkCount * i / _threadCount;
+		_deques[i].back = chunkCount * (i + 1) / _threadCount;
+	}
+
+	if (_threadCount > 1 && chunkCount > 1)
+	{
+		[_condition lock];
+		_busyWorkers = _threadCount - 1;
+		_generation++;
+		[_condition broadcast];
+		[_condition unlock];
+
+		RunChunks(self, 0);
+
+		[_condition lock];
+		while (_busyWorkers != 0)  [_condition wait];
+		[_condition unlock];
+	}
+	else
+	{
+		// No workers, or not enough work to share; thread 0's deque is all of it.
+		_deques[0].front = 0;
+		_deques[0].back = chunkCount;
+		RunChunks(self, 0);
+	}
+
+	// Every worker has checked in under _condition, so _failed is settled.
+	BOOL result = !_failed;
+	_function = NULL;
+	_context = NULL;
+	[_jobLock unlock];
+
+	return result;
+}
+
+
+- (void) runWorkerThread:(NSNumber *)threadIndex
+{
+	NSAutoreleasePool *rootPool = [[NSAutoreleasePool alloc] init];
+
+	NSUInteger index = [threadIndex unsignedIntegerValue];
+	NSUInteger seenGeneration = 0;
+	[NSThread ooSetCurrentThreadName:[NSString stringWithFormat:@"OOJobPool thread %lu", (unsigned long)index]];
+
+	[_condition lock];
+	for (;;)
+	{
+		while (_generation == seenGeneration)  [_condition wait];
+		seenGeneration = _generation;
+		[_condition unlock];
+
+		RunChunks(self, index);
+
+		[_condition lock];
+		if (--_busyWorkers == 0)  [_condition broadcast];
+	}
+
+	[rootPool release];
+}
+
+@end
@@ -76,13 +76,14 @@ typedef struct
 
 typedef struct
 {
-	GLint					*indexArray;
+	GLuint					*indexArray;
 	GLfloat					*textureUVArray;
 	Vector					*vertexArray;
 	Vector					*normalArray;
 	Vector					*tangentArray;
 	
-	GLuint					count;
+	GLuint					count;			// Entries in indexArray.
+	GLuint					vertexCount;	// Entries in the other arrays, which are shared between faces.
 } OOMeshDisplayLists;
 
 
@@ -101,6 +102,10 @@ typedef struct
 	NSString				*baseFileOctreeCacheRef;
 	BOOL					_cacheWriteable;
 	
+	NSString				*_meshBlobKey;		// Set while the cached .oomesh for this mesh has no octree.
+	uint64_t				_sourceHash;
+	GLfloat					_sourceScale;
+	
 	Vector					*_vertices;
 	Vector					*_normals;
 	Vector					*_tangents;
@@ -187,10 +192,23 @@ typedef struct
 @end
 
 
+#ifndef NDEBUG
+/*	Load every DAT file in the built-in Models folder, per-face and smooth,
+	from text and then from the .oomesh built from it, and compare the draw
+	data. Nothing is read from or written to the cache.
+*/
+NSString *OOMeshRunLoaderBenchmark(void);
+#endif
+
+
 #import "OOCacheManager.h"
 @interface OOCacheManager (Octree)
 
 + (Octree *)octreeForModel:(NSString *)inKey;
 + (void)setOctree:(Octree *)inOctree forModel:(NSString *)inKey;
 
+// Octrees keyed by mesh content, which survive the data cache being rebuilt.
++ (Octree *)octreeForBlobKey:(NSString *)inKey;
++ (void)setOctree:(Octree *)inOctree forBlobKey:(NSString *)inKey;
+
 @end
@@ -36,6 +36,8 @@ MA 02110-1301, USA.
 */
 
 #import "OOMesh.h"
+#import "OOMeshBinaryFormat.h"
+#import "OODATTokenizer.h"
 #import "Universe.h"
 #import "OOMeshToOctreeConverter.h"
 #import "ResourceManager.h"
@@ -52,6 +54,8 @@ MA 02110-1301, USA.
 #import "OOProfilingStopwatch.h"
 #import "OODebugFlags.h"
 #import "NSObjectOOExtensions.h"
+#import "NSDataOOExtensions.h"
+#import "NSFileManagerOOExtensions.h"
 
 #import "OOJavaScriptEngine.h"
 #import "OODebugStandards.h"
@@ -140,6 +144,8 @@ shaderBindingTarget:(id<OOWeakReferenceSupport>)object
 	cacheWriteable:(BOOL)cacheWriteable;
 
 - (BOOL) loadData:(NSString *)filename scaleFactor:(float)scale;
+- (BOOL) loadShippedBinaryForModel:(NSString *)filename source:(NSData *)source scaleFactor:(float)scale;
+- (BOOL) loadDataFromDATFile:(NSData *)source name:(NSString *)filename scaleFactor:(float)scale;
 - (void) checkNormalsAndAdjustWinding;
 - (void) generateFaceTangents;
 - (void) calculateVertexNormalsAndTangentsWithFaceRefs:(VertexFaceRef *)faceRefs;
@@ -147,8 +153,8 @@ shaderBindingTarget:(id<OOWeakReferenceSupport>)object
 
 - (void) deleteDisplayLists;
 
-@property (readonly, copy) NSDictionary *modelData;
-- (BOOL) setModelFromModelData:(NSDictionary*) dict name:(NSString *)fileName;
+- (NSData *) binaryRepresentationWithOctree:(Octree *)octree depth:(unsigned)depth;
+- (BOOL) setModelFromBinaryRepresentation:(NSData *)data name:(NSString *)fileName;
 
 - (void) getNormal:(Vector *)outNormal andTangent:(Vector *)outTangent forVertex:(OOMeshVertexCount)v_index inSmoothGroup:(OOMeshSmoothGroup)smoothGroup;
 
@@ -158,6 +164,8 @@ shaderBindingTarget:(id<OOWeakReferenceSupport>)object
 
 - (void) rescaleByFactor:(GLfloat)factor;
 
+- (NSString *) octreeBlobKeyForDepth:(unsigned)depth;
+
 #ifndef NDEBUG
 - (void)debugDrawNormals;
 #endif
@@ -174,13 +182,18 @@ shaderBindingTarget:(id<OOWeakReferenceSupport>)object
 
 - (void) renameTexturesFrom:(NSString *)from to:(NSString *)to;
 
+#ifndef NDEBUG
++ (NSString *) runLoaderBenchmark;
+- (BOOL) hasSameDrawDataAsMesh:(OOMesh *)other;
+#endif
+
 @end
 
 
 @interface OOCacheManager (OOMesh)
 
-+ (NSDictionary *)meshDataForName:(NSString *)inShipName;
-+ (void)setMeshData:(NSDictionary *)inData forName:(NSString *)inShipName;
++ (NSData *)meshBlobForKey:(NSString *)inKey;
++ (void)setMeshBlob:(NSData *)inBlob forKey:(NSString *)inKey;
 
 @end
 
@@ -311,6 +324,7 @@ static BOOL IsPerVertexNormalMode(OOMeshNormalMode mode)
 	DESTROY(baseFileOctreeCacheRef);
 	DESTROY(baseFile);
 	DESTROY(octree);
+	DESTROY(_meshBlobKey);
 	
 	[self deleteDisplayLists];
 	
@@ -481,7 +495,7 @@ static NSString *NormalModeDescription(OOMeshNormalMode mode)
 			}
 			
 			[materials[ti] apply];
-			OOGL(glDrawArrays(GL_TRIANGLES, triangle_range[ti].location, triangle_range[ti].length));
+			OOGL(glDrawElements(GL_TRIANGLES, triangle_range[ti].length, GL_UNSIGNED_INT, _displayLists.indexArray + triangle_range[ti].location));
 		}
 		
 		listsReady = YES;
@@ -643,20 +657,43 @@ static NSString *NormalModeDescription(OOMeshNormalMode mode)
 		{
 			NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
 			
-			OOMeshToOctreeConverter *converter = [OOMeshToOctreeConverter converterWithCapacity:faceCount];
-			OOMeshFaceCount i;
-			for (i = 0; i < faceCount; i++)
+			/*	The data cache is thrown away whenever the set of OXPs changes,
+				so also look for the octree by mesh content in the blob cache.
+			*/
+			unsigned depth = [self octreeDepth];
+			NSString *blobKey = [self octreeBlobKeyForDepth:depth];
+			octree = [[OOCacheManager octreeForBlobKey:blobKey] retain];
+			if (octree != nil)
+			{
+				OOLog(@"mesh.load.octreeBlob", @"Retrieved octree \"%@\" from blob cache.", baseFileOctreeCacheRef);
+			}
+			else
 			{
-				// Somewhat surprisingly, this method doesn't even show up in profiles. -- Ahruman 2012-09-22
-				Triangle tri;
-				tri.v[0] = _vertices[_faces[i].vertex[0]];
-				tri.v[1] = _vertices[_faces[i].vertex[1]];
-				tri.v[2] = _vertices[_faces[i].vertex[2]];
-				[converter addTriangle:tri];
+				OOProfilingStopwatch *stopwatch = [OOProfilingStopwatch stopwatch];
+				
+				OOMeshToOctreeConverter *converter = [OOMeshToOctreeConverter converterWithCapacity:faceCount];
+				OOMeshFaceCount i;
+				for (i = 0; i < faceCount; i++)
+				{
+					// Somewhat surprisingly, this method doesn't even show up in profiles. -- Ahruman 2012-09-22
+					Triangle tri;
+					tri.v[0] = _vertices[_faces[i].vertex[0]];
+					tri.v[1] = _vertices[_faces[i].vertex[1]];
+					tri.v[2] = _vertices[_faces[i].vertex[2]];
+					[converter addTriangle:tri];
+				}
+				
+				octree = [converter findOctreeToDepth:depth];
+				[octree retain];
+				
+				OOLog(@"mesh.load.octree.build", @"Built octree \"%@\" (%u faces, depth %u) in %.1f ms.", baseFileOctreeCacheRef, faceCount, depth, [stopwatch currentTime] * 1000.0);
+				
+				if (EXPECT(_cacheWriteable))
+				{
+					[OOCacheManager setOctree:octree forBlobKey:blobKey];
+				}
 			}
 			
-			octree = [converter findOctreeToDepth:[self octreeDepth]];
-			[octree retain];
 			if (EXPECT(_cacheWriteable))
 			{
 				[OOCacheManager setOctree:octree forModel:baseFileOctreeCacheRef];
@@ -668,12 +705,45 @@ static NSString *NormalModeDescription(OOMeshNormalMode mode)
 		{
 			OOLog(@"mesh.load.octreeCached", @"Retrieved octree \"%@\" from cache.", baseFileOctreeCacheRef);
 		}
+		
+		if (_meshBlobKey != nil && octree != nil)
+		{
+			// Add the octree to the cached mesh file, so next time it's loaded with the mesh.
+			NSData *blob = [self binaryRepresentationWithOctree:octree depth:[self octreeDepth]];
+			if (blob != nil)  [OOCacheManager setMeshBlob:blob forKey:_meshBlobKey];
+			DESTROY(_meshBlobKey);
+		}
 	}
 	
 	return octree;
 }
 
 
+/*	Key for the octree in the blob cache: a 64-bit FNV-1a hash of the
+	triangles the converter is given, plus the depth.
+*/
+- (NSString *) octreeBlobKeyForDepth:(unsigned)depth
+{
+	uint64_t hash = 14695981039346656037ULL;
+	OOMeshFaceCount i;
+	unsigned j, k;
+	
+	for (i = 0; i < faceCount; i++)  for (j = 0; j < 3; j++)
+	{
+		Vector v = _vertices[_faces[i].vertex[j]];
+		float components[3] = { v.x, v.y, v.z };
+		const uint8_t *bytes = (const uint8_t *)components;
+		
+		for (k = 0; k < sizeof components; k++)
+		{
+			hash = (hash ^ bytes[k]) * 1099511628211ULL;
+		}
+	}
+	
+	return [NSString stringWithFormat:@"%016llx-%u-r%u.octree", (unsigned long long)hash, depth, kOOMeshLoaderRevision];
+}
+
+
 - (BoundingBox) findBoundingBoxRelativeToPosition:(Vector)opv
 											basis:(Vector)ri :(Vector)rj :(Vector)rk
 									 selfPosition:(Vector)position
@@ -806,7 +876,8 @@ static NSString *NormalModeDescription(OOMeshNormalMode mode)
 	if (_tangents != NULL)  result += sizeof *_tangents * vertexCount;
 	if (_faces != NULL)  result += sizeof *_faces * faceCount;
 	
-	result += _displayLists.count * (sizeof (GLint) + sizeof (GLfloat) + sizeof (Vector) * 3);
+	result += _displayLists.count * sizeof (GLuint);
+	result += _displayLists.vertexCount * (sizeof (GLfloat) * 2 + sizeof (Vector) * 3);
 	
 	OOMeshMaterialCount i;
 	for (i = 0; i != materialCount; i++)
@@ -915,6 +986,7 @@ shaderBindingTarget:(id<OOWeakReferenceSupport>)target
 		[result->baseFile retain];
 		[result->baseFileOctreeCacheRef retain];
 		[result->octree retain];
+		[result->_meshBlobKey retain];
 		[result->_retainedObjects retain];
 		[result->_materialDict retain];
 		[result->_shadersDict retain];
@@ -958,642 +1030,757 @@ shaderBindingTarget:(id<OOWeakReferenceSupport>)target
 }
 
 
-- (NSDictionary *)modelData
+OOINLINE uint64_t AlignBinaryMeshOffset(uint64_t offset)
+{
+	return (offset + kOOMeshBinaryAlignment - 1) & ~(uint64_t)(kOOMeshBinaryAlignment - 1);
+}
+
+
+- (NSData *) binaryRepresentationWithOctree:(Octree *)octreeToStore depth:(unsigned)depth
 {
 	OOJS_PROFILE_ENTER
 	
-	NSNumber			*vertCnt = nil,
-						*faceCnt = nil;
-	NSData				*vertData = nil,
-						*normData = nil,
-						*tanData = nil,
-						*faceData = nil;
-	NSArray				*mtlKeys = nil;
-	NSNumber			*normMode = nil;
+	OOMeshBinaryHeader	header;
+	NSMutableData		*materialKeyData = nil;
+	NSData				*octreeData = nil;
+	NSMutableData		*result = nil;
+	unsigned			i;
+	
+	if (_displayLists.indexArray == NULL)  return nil;
+	
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, "OOMB", sizeof header.magic);
+	header.formatVersion = kOOMeshBinaryFormatVersion;
+	header.endianTag = kOOMeshBinaryEndianTag;
+	header.vectorSize = sizeof (Vector);
+	header.faceSize = sizeof (OOMeshFace);
+	header.sourceHash = _sourceHash;
+	header.scale = _sourceScale;
+	header.normalMode = _normalMode;
+	header.loaderRevision = kOOMeshLoaderRevision;
+	header.materialCount = materialCount;
+	header.vertexCount = vertexCount;
+	header.faceCount = faceCount;
+	header.drawVertexCount = _displayLists.vertexCount;
+	header.indexCount = _displayLists.count;
+	
+	materialKeyData = [NSMutableData data];
+	for (i = 0; i != materialCount; i++)
+	{
+		header.materialRanges[i][0] = triangle_range[i].location;
+		header.materialRanges[i][1] = triangle_range[i].length;
+		
+		const char *key = [materialKeys[i] UTF8String];
+		[materialKeyData appendBytes:key length:strlen(key) + 1];
+	}
 	
-	BOOL includeNormals = IsPerVertexNormalMode(_normalMode);
+	octreeData = [octreeToStore binaryRepresentation];
+	if (octreeData != nil)  header.octreeDepth = depth;
 	
-	// Prepare cache data elements.
-	vertCnt = @(vertexCount);
-	faceCnt = @(faceCount);
+	const void *sectionBytes[kOOMeshSectionCount] =
+	{
+		[materialKeyData bytes],
+		_vertices,
+		_faces,
+		_displayLists.indexArray,
+		_displayLists.textureUVArray,
+		_displayLists.vertexArray,
+		_displayLists.normalArray,
+		_displayLists.tangentArray,
+		[octreeData bytes]
+	};
+	size_t sectionLengths[kOOMeshSectionCount] =
+	{
+		[materialKeyData length],
+		sizeof *_vertices * vertexCount,
+		sizeof *_faces * faceCount,
+		sizeof *_displayLists.indexArray * _displayLists.count,
+		sizeof *_displayLists.textureUVArray * 2 * _displayLists.vertexCount,
+		sizeof *_displayLists.vertexArray * _displayLists.vertexCount,
+		sizeof *_displayLists.normalArray * _displayLists.vertexCount,
+		sizeof *_displayLists.tangentArray * _displayLists.vertexCount,
+		[octreeData length]
+	};
 	
-	vertData = [_retainedObjects objectForKey:@"vertices"];
-	faceData = [_retainedObjects objectForKey:@"faces"];
-	if (includeNormals)
+	uint64_t offset = AlignBinaryMeshOffset(sizeof header);
+	for (i = 0; i != kOOMeshSectionCount; i++)
 	{
-		normData = [_retainedObjects objectForKey:@"normals"];
-		tanData = [_retainedObjects objectForKey:@"tangents"];
+		header.sections[i].offset = offset;
+		header.sections[i].length = sectionLengths[i];
+		offset = AlignBinaryMeshOffset(offset + sectionLengths[i]);
 	}
+	if (offset > UINT32_MAX)  return nil;
 	
-	if (materialCount != 0)
+	result = [NSMutableData dataWithLength:offset];
+	uint8_t *bytes = [result mutableBytes];
+	memcpy(bytes, &header, sizeof header);
+	for (i = 0; i != kOOMeshSectionCount; i++)
 	{
-		mtlKeys = [NSArray arrayWithObjects:materialKeys count:materialCount];
+		if (sectionLengths[i] != 0)  memcpy(bytes + header.sections[i].offset, sectionBytes[i], sectionLengths[i]);
 	}
-	else
+	
+	return result;
+	
+	OOJS_PROFILE_EXIT
+}
+
+
+/*	Check everything in a .oomesh file that the mesh will rely on, and read
+	the material keys. Indices are checked too, since they are used without
+	further checks both for drawing and for building octrees.
+*/
+static BOOL ValidateBinaryMesh(const OOMeshBinaryHeader *header, const uint8_t *bytes, NSUInteger length, NSString **outKeys)
+{
+	NSUInteger i;
+	
+	if (header->vertexCount == 0 || header->faceCount == 0 ||
+		header->materialCount == 0 || header->materialCount > kOOMeshMaxMaterials ||
+		header->normalMode > kNormalModeExplicit ||
+		header->indexCount != header->faceCount * 3 ||
+		header->drawVertexCount > header->indexCount)
 	{
-		mtlKeys = @[];
+		return NO;
 	}
-	normMode = @(_normalMode);
 	
-	// Ensure we have all the required data elements.
-	if (vertCnt == nil ||
-		faceCnt == nil ||
-		vertData == nil ||
-		faceData == nil ||
-		mtlKeys == nil ||
-		normMode == nil)
+	uint64_t expectedLengths[kOOMeshSectionCount] =
+	{
+		header->sections[kOOMeshSectionMaterialKeys].length,
+		sizeof (Vector) * (uint64_t)header->vertexCount,
+		sizeof (OOMeshFace) * (uint64_t)header->faceCount,
+		sizeof (GLuint) * (uint64_t)header->indexCount,
+		sizeof (GLfloat) * 2 * (uint64_t)header->drawVertexCount,
+		sizeof (Vector) * (uint64_t)header->drawVertexCount,
+		sizeof (Vector) * (uint64_t)header->drawVertexCount,
+		sizeof (Vector) * (uint64_t)header->drawVertexCount,
+		header->sections[kOOMeshSectionOctree].length
+	};
+	for (i = 0; i != kOOMeshSectionCount; i++)
+	{
+		OOMeshBinarySection section = header->sections[i];
+		if (section.offset % kOOMeshBinaryAlignment != 0 ||
+			(uint64_t)section.offset + section.length > length ||
+			section.length != expectedLengths[i])
+		{
+			return NO;
+		}
+	}
+	
+	// Material keys: exactly materialCount NUL-terminated strings.
+	OOMeshBinarySection keySection = header->sections[kOOMeshSectionMaterialKeys];
+	const char *key = (const char *)bytes + keySection.offset;
+	const char *keysEnd = key + keySection.length;
+	for (i = 0; i != header->materialCount; i++)
 	{
-		return nil;
+		const char *keyEnd = memchr(key, '\0', keysEnd - key);
+		if (keyEnd == NULL)  return NO;
+		outKeys[i] = [NSString stringWithUTF8String:key];
+		if (outKeys[i] == nil)  return NO;
+		key = keyEnd + 1;
 	}
+	if (key != keysEnd)  return NO;
 	
-	if (includeNormals)
+	for (i = 0; i != header->materialCount; i++)
 	{
-		if (normData == nil || tanData == nil)  return nil;
+		if ((uint64_t)header->materialRanges[i][0] + header->materialRanges[i][1] > header->indexCount)  return NO;
 	}
 	
-	// All OK; stick 'em in a dictionary.
-	return [NSDictionary dictionaryWithObjectsAndKeys:
-						vertCnt, @"vertex count",
-						vertData, @"vertex data",
-						faceCnt, @"face count",
-						faceData, @"face data",
-						mtlKeys, @"material keys",
-						normMode, @"normal mode",
-						/*	NOTE: order matters. Since normData and tanData
-							are last, if they're nil the dictionary will be
-							built without them, which is desired behaviour.
-						*/
-						normData, @"normal data",
-						tanData, @"tangent data",
-						nil];
+	const GLuint *indices = (const GLuint *)(bytes + header->sections[kOOMeshSectionIndices].offset);
+	for (i = 0; i != header->indexCount; i++)
+	{
+		if (indices[i] >= header->drawVertexCount)  return NO;
+	}
 	
-	OOJS_PROFILE_EXIT
+	const OOMeshFace *faces = (const OOMeshFace *)(bytes + header->sections[kOOMeshSectionFaces].offset);
+	for (i = 0; i != header->faceCount; i++)
+	{
+		if (faces[i].vertex[0] >= header->vertexCount ||
+			faces[i].vertex[1] >= header->vertexCount ||
+			faces[i].vertex[2] >= header->vertexCount)
+		{
+			return NO;
+		}
+	}
+	
+	return YES;
 }
 
 
-- (BOOL)setModelFromModelData:(NSDictionary *)dict name:(NSString *)fileName
+/*	Point the mesh at the arrays in a .oomesh file. Everything is checked
+	before anything is changed, so on failure the mesh can still be loaded
+	some other way.
+*/
+- (BOOL) setModelFromBinaryRepresentation:(NSData *)data name:(NSString *)fileName
 {
 	OOJS_PROFILE_ENTER
 	
-	NSData				*vertData = nil,
-						*normData = nil,
-						*tanData = nil,
-						*faceData = nil;
-	NSArray				*mtlKeys = nil;
-	NSString			*key = nil;
-	unsigned			i;
+	OOMeshBinaryHeader	header;
+	NSString			*keys[kOOMeshMaxMaterials];
+	const uint8_t		*bytes = NULL;
+	NSUInteger			length, i;
+	
+	length = [data length];
+	if (length < sizeof header)  return NO;
 	
-	if (dict == nil || ![dict isKindOfClass:[NSDictionary class]])  return NO;
+	// Data inside an OXZ need not be aligned; the arrays must be.
+	if (((uintptr_t)[data bytes] % kOOMeshBinaryAlignment) != 0)
+	{
+		data = [NSData dataWithBytes:[data bytes] length:length];
+	}
+	bytes = [data bytes];
+	memcpy(&header, bytes, sizeof header);
+	
+	if (memcmp(header.magic, "OOMB", sizeof header.magic) != 0 ||
+		header.formatVersion != kOOMeshBinaryFormatVersion ||
+		header.endianTag != kOOMeshBinaryEndianTag ||
+		header.vectorSize != sizeof (Vector) ||
+		header.faceSize != sizeof (OOMeshFace))
+	{
+		OOLog(@"mesh.load.binary.incompatible", @"Ignoring mesh file for \"%@\" written in an incompatible format.", fileName);
+		return NO;
+	}
 	
-	vertexCount = [dict oo_unsignedIntForKey:@"vertex count"];
-	faceCount = [dict oo_unsignedIntForKey:@"face count"];
+	if (!ValidateBinaryMesh(&header, bytes, length, keys))
+	{
+		OOLog(@"mesh.load.error.badCacheData", @"Ignoring bad mesh file for \"%@\".", fileName);
+		return NO;
+	}
 	
-	if (vertexCount == 0 || faceCount == 0)  return NO;
+	// All OK. The arrays are used in place, and never modified (see -rescaleByFactor:).
+	[self setRetainedObject:data forKey:@"mesh file"];
 	
-	// Read data elements from dictionary.
-	vertData = [dict oo_dataForKey:@"vertex data"];
-	faceData = [dict oo_dataForKey:@"face data"];
+	_normalMode = header.normalMode;
+	vertexCount = header.vertexCount;
+	faceCount = header.faceCount;
+	_vertices = (Vector *)(bytes + header.sections[kOOMeshSectionVertices].offset);
+	_faces = (OOMeshFace *)(bytes + header.sections[kOOMeshSectionFaces].offset);
+	_normals = NULL;
+	_tangents = NULL;
 	
-	mtlKeys = [dict oo_arrayForKey:@"material keys"];
-	_normalMode = [dict oo_unsignedCharForKey:@"normal mode"];
-	BOOL includeNormals = IsPerVertexNormalMode(_normalMode);
+	_displayLists.indexArray = (GLuint *)(bytes + header.sections[kOOMeshSectionIndices].offset);
+	_displayLists.textureUVArray = (GLfloat *)(bytes + header.sections[kOOMeshSectionTextureUVs].offset);
+	_displayLists.vertexArray = (Vector *)(bytes + header.sections[kOOMeshSectionDrawVertices].offset);
+	_displayLists.normalArray = (Vector *)(bytes + header.sections[kOOMeshSectionDrawNormals].offset);
+	_displayLists.tangentArray = (Vector *)(bytes + header.sections[kOOMeshSectionDrawTangents].offset);
+	_displayLists.count = header.indexCount;
+	_displayLists.vertexCount = header.drawVertexCount;
 	
-	// Ensure we have all the required data elements.
-	if (vertData == nil ||
-		faceData == nil ||
-		mtlKeys == nil)
+	materialCount = header.materialCount;
+	for (i = 0; i != materialCount; i++)
 	{
-		OOLog(@"mesh.load.error.badCacheData", @"Ignoring bad cache data for mesh \"%@\".", fileName);
-		return NO;
+		materialKeys[i] = [keys[i] copy];
+		triangle_range[i] = NSMakeRange(header.materialRanges[i][0], header.materialRanges[i][1]);
 	}
 	
-	if (includeNormals)
+	[self calculateBoundingVolumes];
+	
+	OOMeshBinarySection octreeSection = header.sections[kOOMeshSectionOctree];
+	if (header.octreeDepth != 0 && header.octreeDepth == [self octreeDepth])
 	{
-		normData = [dict oo_dataForKey:@"normal data"];
-		tanData = [dict oo_dataForKey:@"tangent data"];
-		if (normData == nil || tanData == nil)
-		{
-			OOLog(@"mesh.load.error.badCacheData", @"Ignoring bad normal/tangent cache data for mesh \"%@\".", fileName);
-			return NO;
-		}
+		octree = [[Octree alloc] initWithBinaryRepresentation:[data subdataWithRange:NSMakeRange(octreeSection.offset, octreeSection.length)]];
 	}
 	
-	// Ensure data objects are of correct size.
-	if ([vertData length] != sizeof *_vertices * vertexCount)  return NO;
-	if ([faceData length] != sizeof *_faces * faceCount)  return NO;
-	if (includeNormals)
+	return YES;
+	
+	OOJS_PROFILE_EXIT
+}
+
+
+- (BOOL)loadData:(NSString *)filename scaleFactor:(float)scale
+{
+	OOJS_PROFILE_ENTER
+	
+	NSString			*path = nil;
+	NSData				*source = nil;
+	NSString			*blobKey = nil;
+	NSData				*cacheData = nil;
+	
+	path = [ResourceManager pathForFileNamed:filename inFolder:@"Models"];
+	if (path != nil)  source = [NSData oo_dataWithOXZFile:path];
+	
+	if ([self loadShippedBinaryForModel:filename source:source scaleFactor:scale])
 	{
-		if ([normData length] != sizeof *_normals * vertexCount)  return NO;
-		if ([tanData length] != sizeof *_tangents * vertexCount)  return NO;
+		PROFILE(@"loaded shipped mesh file");
+		return YES;
 	}
 	
-	// Retain data.
-	_vertices = (Vector *)[vertData bytes];
-	[self setRetainedObject:vertData forKey:@"vertices"];
-	_faces = (OOMeshFace *)[faceData bytes];
-	[self setRetainedObject:faceData forKey:@"faces"];
-	if (includeNormals)
+	if (source == nil)
 	{
-		_normals = (Vector *)[normData bytes];
-		[self setRetainedObject:normData forKey:@"normals"];
-		_tangents = (Vector *)[tanData bytes];
-		[self setRetainedObject:tanData forKey:@"tangents"];
+		// Model not found
+		OOLog(kOOLogMeshDataNotFound, @"***** ERROR: could not find %@", filename);
+		OOStandardsError(@"Model file not found");
+		return NO;
 	}
-	else
+	if ([[filename pathExtension] isEqualToString:@"oomesh"])
 	{
-		_normals = NULL;
-		_tangents = NULL;
+		OOLog(@"mesh.load.failed.badBinary", @"***** ERROR: could not load %@", filename);
+		return NO;
 	}
 	
-	// Copy material keys.
-	materialCount = [mtlKeys count];
-	for (i = 0; i != materialCount; ++i)
+	/*	The converted mesh is cached by content rather than by name, so it
+		survives the data cache being thrown away and is never used for a
+		different model of the same name. The loader revision keeps meshes
+		built by older code from being reused after an upgrade.
+	*/
+	_sourceHash = OOMeshBinarySourceHash([source bytes], [source length]);
+	_sourceScale = scale;
+	blobKey = [NSString stringWithFormat:@"%016llx-%u-%.3f-r%u.oomesh", (unsigned long long)_sourceHash, _normalMode, scale, kOOMeshLoaderRevision];
+	
+	cacheData = [OOCacheManager meshBlobForKey:blobKey];
+	if (cacheData != nil)
 	{
-		key = [mtlKeys oo_stringAtIndex:i];
-		if (key != nil)  materialKeys[i] = [key copy];
-		else
+		OOMeshBinaryHeader header;
+		if ([cacheData length] >= sizeof header)  memcpy(&header, [cacheData bytes], sizeof header);
+		else  header.sourceHash = ~_sourceHash;
+		
+		if (header.sourceHash == _sourceHash && header.scale == scale && header.loaderRevision == kOOMeshLoaderRevision &&
+			[self setModelFromBinaryRepresentation:cacheData name:filename])
 		{
-			OOLog(@"mesh.load.error.badCacheData", @"Ignoring bad cache data for mesh \"%@\".", fileName);
-			return NO;
+			PROFILE(@"loaded from cache");
+			OOLog(@"mesh.load.cached", @"Retrieved mesh \"%@\" from cache.", filename);
+			
+			// If the octree isn't in the file yet, add it when it's built.
+			if (octree == nil && EXPECT(_cacheWriteable))  _meshBlobKey = [blobKey copy];
+			return YES;
 		}
 	}
 	
+	OOLog(@"mesh.load.uncached", @"Mesh \"%@\" is not in cache, loading.", filename);
+	if (![self loadDataFromDATFile:source name:filename scaleFactor:scale])  return NO;
+	
+	// save the resulting data for possible reuse
+	if (EXPECT(_cacheWriteable))
+	{
+		NSData *blob = [self binaryRepresentationWithOctree:nil depth:0];
+		if (blob != nil)
+		{
+			[OOCacheManager setMeshBlob:blob forKey:blobKey];
+			_meshBlobKey = [blobKey copy];
+		}
+		PROFILE(@"saved to cache");
+	}
+	
 	return YES;
 	
 	OOJS_PROFILE_EXIT
 }
 
 
-- (BOOL)loadData:(NSString *)filename scaleFactor:(float)scale
+/*	A .oomesh may be shipped in a Models folder, either alongside the DAT
+	file of the same name or instead of it (in which case the model may also
+	be named with the .oomesh extension). If the DAT file is present, the mesh
+	file is only used if it was built from it. Shipped files are built at
+	scale 1, and rescaled here if necessary.
+*/
+- (BOOL) loadShippedBinaryForModel:(NSString *)filename source:(NSData *)source scaleFactor:(float)scale
+{
+	NSString			*binaryName = nil;
+	NSString			*path = nil;
+	NSData				*data = nil;
+	OOMeshBinaryHeader	header;
+	OOMeshNormalMode	requestedMode = _normalMode;
+	
+	if ([[filename pathExtension] isEqualToString:@"oomesh"])  binaryName = filename;
+	else  binaryName = [[filename stringByDeletingPathExtension] stringByAppendingPathExtension:@"oomesh"];
+	
+	path = [ResourceManager pathForFileNamed:binaryName inFolder:@"Models"];
+	if (path == nil)  return NO;
+	data = [NSData oo_dataWithOXZFile:path];
+	if ([data length] < sizeof header)  return NO;
+	memcpy(&header, [data bytes], sizeof header);
+	
+	if (source != nil && binaryName != filename && header.sourceHash != OOMeshBinarySourceHash([source bytes], [source length]))
+	{
+		OOLogWARN(@"mesh.load.binary.stale", @"Mesh file %@ was not built from the current %@, and will be ignored.", binaryName, filename);
+		return NO;
+	}
+	if (source != nil && header.loaderRevision != kOOMeshLoaderRevision)
+	{
+		OOLog(@"mesh.load.binary.oldRevision", @"Mesh file %@ was built by a different version of the loader; using %@ instead.", binaryName, filename);
+		return NO;
+	}
+	if (header.scale != 1.0f)  return NO;
+	if (header.normalMode != requestedMode && header.normalMode != kNormalModeExplicit)  return NO;
+	
+	if (![self setModelFromBinaryRepresentation:data name:binaryName])  return NO;
+	
+	if (scale != 1.0f)  [self rescaleByFactor:scale];
+	
+	OOLog(@"mesh.load.binary", @"Loaded mesh \"%@\" from %@.", filename, binaryName);
+	return YES;
+}
+
+
+- (BOOL) loadDataFromDATFile:(NSData *)source name:(NSString *)filename scaleFactor:(float)scale
 {
 	OOJS_PROFILE_ENTER
 	
-	NSScanner			*scanner;
-	NSDictionary		*cacheData = nil;
+	OODATTokenizer		tokenizer;
 	BOOL				failFlag = NO;
 	NSString			*failString = @"***** ";
 	unsigned			i, j;
-	NSMutableDictionary	*texFileName2Idx = nil;
-	NSString			*cacheKey = nil;
-	BOOL				using_preloaded = NO;
+	const uint8_t		*materialKeyBytes[kOOMeshMaxMaterials];
+	NSUInteger			materialKeyLengths[kOOMeshMaxMaterials];
 	
-	cacheKey = [NSString stringWithFormat:@"%@:%u:%.3f", filename, _normalMode, scale];
-	cacheData = [OOCacheManager meshDataForName:cacheKey];
-	if (cacheData != nil)
+	if (!OODATTokenizerInit(&tokenizer, source))
 	{
-		if ([self setModelFromModelData:cacheData name:filename])
-		{
-			using_preloaded = YES;
-			PROFILE(@"loaded from cache");
-			OOLog(@"mesh.load.cached", @"Retrieved mesh \"%@\" from cache.", filename);
-		}
+		OOLog(kOOLogMeshDataNotFound, @"***** ERROR: could not read %@", filename);
+		return NO;
 	}
 	
-	if (!using_preloaded)
+	// get number of vertices
+	//
+	if (OODATScanSection(&tokenizer, kOODATSectionNVerts))
 	{
-		OOLog(@"mesh.load.uncached", @"Mesh \"%@\" is not in cache, loading.", cacheKey);
-		
-		NSCharacterSet	*whitespaceCharSet = [NSCharacterSet whitespaceCharacterSet];
-		NSCharacterSet	*whitespaceAndNewlineCharSet = [NSCharacterSet whitespaceAndNewlineCharacterSet];
-#if OOLITE_MAC_OS_X
-		NSCharacterSet	*newlineCharSet = [NSCharacterSet newlineCharacterSet];
-#else
-		static NSCharacterSet *newlineCharSet = nil;
-		if (newlineCharSet == nil)
+		int n_v;
+		if (OODATScanInt(&tokenizer, &n_v))
 		{
-			NSMutableCharacterSet *temp = [[whitespaceAndNewlineCharSet mutableCopy] autorelease];
-			[temp formIntersectionWithCharacterSet:[whitespaceCharSet invertedSet]];
-			newlineCharSet = [temp copy];
+			vertexCount = n_v;
 		}
-#endif
-		
-		texFileName2Idx = [NSMutableDictionary dictionary];
-		
+		else
 		{
-			NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-			NSString *data = [ResourceManager stringFromFilesNamed:filename inFolder:@"Models" cache:NO];
-			if (data == nil)
-			{
-				// Model not found
-				OOLog(kOOLogMeshDataNotFound, @"***** ERROR: could not find %@", filename);
-				OOStandardsError(@"Model file not found");
-				return NO;
-			}
-			
-			// strip out comments and commas between values
-			NSMutableArray *lines = [NSMutableArray arrayWithArray:[data componentsSeparatedByString:@"\n"]];
-			for (i = 0; i < [lines count]; i++)
-			{
-				NSString *line = [lines objectAtIndex:i];
-				NSArray *parts;
-				//
-				// comments
-				//
-				parts = [line componentsSeparatedByString:@"#"];
-				line = parts.firstObject;
-				parts = [line componentsSeparatedByString:@"//"];
-				line = parts.firstObject;
-				//
-				// commas
-				//
-				line = [[line componentsSeparatedByString:@","] componentsJoinedByString:@" "];
-				//
-				[lines replaceObjectAtIndex:i withObject:line];
-			}
-			
-			data = [lines componentsJoinedByString:@"\n"];
-			scanner = [NSScanner scannerWithString:data];
-			
-			[scanner retain];
-			[pool release];
-			[scanner autorelease];
+			failFlag = YES;
+			failString = [NSString stringWithFormat:@"%@Failed to read value of NVERTS (line %lu)\n", failString, (unsigned long)tokenizer.line];
 		}
-		
-		PROFILE(@"finished preprocessing");
-
-		// get number of vertices
-		//
-		[scanner setScanLocation:0];	//reset
-		if ([scanner scanString:@"NVERTS" intoString:NULL])
+	}
+	else
+	{
+		failFlag = YES;
+		failString = [NSString stringWithFormat:@"%@Failed to read NVERTS (line %lu)\n", failString, (unsigned long)tokenizer.line];
+	}
+	
+	if (![self allocateVertexBuffersWithCount:vertexCount])
+	{
+		OOLog(kOOLogAllocationFailure, @"***** ERROR: failed to allocate memory for model %@ (%u vertices).", filename, vertexCount);
+		return NO;
+	}
+	
+	// get number of faces
+	if (OODATScanSection(&tokenizer, kOODATSectionNFaces))
+	{
+		int n_f;
+		if (OODATScanInt(&tokenizer, &n_f))
 		{
-			int n_v;
-			if ([scanner scanInt:&n_v])
-				vertexCount = n_v;
-			else
-			{
-				failFlag = YES;
-				failString = [NSString stringWithFormat:@"%@Failed to read value of NVERTS\n",failString];
-			}
+			faceCount = n_f;
 		}
 		else
 		{
 			failFlag = YES;
-			failString = [NSString stringWithFormat:@"%@Failed to read NVERTS\n",failString];
+			failString = [NSString stringWithFormat:@"%@Failed to read value of NFACES (line %lu)\n", failString, (unsigned long)tokenizer.line];
 		}
-		
-		if (![self allocateVertexBuffersWithCount:vertexCount])
+	}
+	else
+	{
+		failFlag = YES;
+		failString = [NSString stringWithFormat:@"%@Failed to read NFACES (line %lu)\n", failString, (unsigned long)tokenizer.line];
+	}
+	
+	// Allocate face->vertex table.
+	size_t faceRefSize = sizeof (VertexFaceRef) * vertexCount;
+	VertexFaceRef *faceRefs = calloc(1, faceRefSize);
+	if (faceRefs != NULL)
+	{
+		// use an NSData to effectively autorelease it.
+		NSData *faceRefHolder = [NSData dataWithBytesNoCopy:faceRefs length:faceRefSize freeWhenDone:YES];
+		if (faceRefHolder == nil)
 		{
-			OOLog(kOOLogAllocationFailure, @"***** ERROR: failed to allocate memory for model %@ (%u vertices).", filename, vertexCount);
-			return NO;
+			free(faceRefs);
+			faceRefs = NULL;
 		}
-		
-		// get number of faces
-		if ([scanner scanString:@"NFACES" intoString:NULL])
+	}
+	
+	if (faceRefs == NULL || ![self allocateFaceBuffersWithCount:faceCount])
+	{
+		OOLog(kOOLogAllocationFailure, @"***** ERROR: failed to allocate memory for model %@ (%u vertices, %u faces).", filename, vertexCount, faceCount);
+		return NO;
+	}
+	
+	PROFILE(@"finished allocating");
+	
+	// get vertex data
+	if (OODATScanSection(&tokenizer, kOODATSectionVertex))
+	{
+		for (j = 0; j < vertexCount && !failFlag; j++)
 		{
-			int n_f;
-			if ([scanner scanInt:&n_f])
+			Vector v;
+			if (OODATScanVector(&tokenizer, &v))
 			{
-				faceCount = n_f;
+				_vertices[j] = vector_multiply_scalar(v, scale);
 			}
 			else
 			{
 				failFlag = YES;
-				failString = [NSString stringWithFormat:@"%@Failed to read value of NFACES\n",failString];
+				failString = [NSString stringWithFormat:@"%@Failed to read a value for vertex[%d] in %@ (line %lu)\n", failString, j, @"VERTEX", (unsigned long)tokenizer.line];
 			}
 		}
-		else
-		{
-			failFlag = YES;
-			failString = [NSString stringWithFormat:@"%@Failed to read NFACES\n",failString];
-		}
-		
-		// Allocate face->vertex table.
-		size_t faceRefSize = sizeof (VertexFaceRef) * vertexCount;
-		VertexFaceRef *faceRefs = calloc(1, faceRefSize);
-		if (faceRefs != NULL)
+	}
+	else
+	{
+		failFlag = YES;
+		failString = [NSString stringWithFormat:@"%@Failed to find VERTEX data (line %lu)\n", failString, (unsigned long)tokenizer.line];
+	}
+
+	// get face data
+	if (OODATScanSection(&tokenizer, kOODATSectionFaces))
+	{
+		for (j = 0; j < faceCount && !failFlag; j++)
 		{
-			// use an NSData to effectively autorelease it.
-			NSData *faceRefHolder = [NSData dataWithBytesNoCopy:faceRefs length:faceRefSize freeWhenDone:YES];
-			if (faceRefHolder == nil)
+			int r, g, b;
+			Vector normal;
+			int n_v;
+			
+			// colors
+			if (OODATScanInt(&tokenizer, &r) && OODATScanInt(&tokenizer, &g) && OODATScanInt(&tokenizer, &b))
 			{
-				free(faceRefs);
-				faceRefs = NULL;
+				_faces[j].smoothGroup = r;
 			}
-		}
-		
-		if (faceRefs == NULL || ![self allocateFaceBuffersWithCount:faceCount])
-		{
-			OOLog(kOOLogAllocationFailure, @"***** ERROR: failed to allocate memory for model %@ (%u vertices, %u faces).", filename, vertexCount, faceCount);
-			return NO;
-		}
-		
-		// get vertex data
-		if ([scanner scanString:@"VERTEX" intoString:NULL])
-		{
-			for (j = 0; j < vertexCount; j++)
+			else
 			{
-				float x, y, z;
-				if (!failFlag)
-				{
-					if (![scanner scanFloat:&x])  failFlag = YES;
-					if (![scanner scanFloat:&y])  failFlag = YES;
-					if (![scanner scanFloat:&z])  failFlag = YES;
-					if (!failFlag)
-					{
-						_vertices[j] = make_vector(x*scale, y*scale, z*scale);
-					}
-					else
-					{
-						failString = [NSString stringWithFormat:@"%@Failed to read a value for vertex[%d] in %@\n", failString, j, @"VERTEX"];
-					}
-				}
+				failFlag = YES;
+				failString = [NSString stringWithFormat:@"%@Failed to read a color for face[%d] in FACES (line %lu)\n", failString, j, (unsigned long)tokenizer.line];
+				break;
 			}
-		}
-		else
-		{
-			failFlag = YES;
-			failString = [NSString stringWithFormat:@"%@Failed to find VERTEX data\n",failString];
-		}
-
-		// get face data
-		if ([scanner scanString:@"FACES" intoString:NULL])
-		{
-			for (j = 0; j < faceCount; j++)
+			
+			// normal
+			if (OODATScanVector(&tokenizer, &normal))
 			{
-				int r, g, b;
-				float nx, ny, nz;
-				int n_v;
-				if (!failFlag)
-				{
-					// colors
-					if (![scanner scanInt:&r])  failFlag = YES;
-					if (![scanner scanInt:&g])  failFlag = YES;
-					if (![scanner scanInt:&b])  failFlag = YES;
-					if (!failFlag)
-					{
-						_faces[j].smoothGroup = r;
-					}
-					else
-					{
-						failString = [NSString stringWithFormat:@"%@Failed to read a color for face[%d] in FACES\n", failString, j];
-					}
-					
-					// normal
-					if (![scanner scanFloat:&nx])  failFlag = YES;
-					if (![scanner scanFloat:&ny])  failFlag = YES;
-					if (![scanner scanFloat:&nz])  failFlag = YES;
-					if (!failFlag)
-					{
-						_faces[j].normal = vector_normal(make_vector(nx, ny, nz));
-					}
-					else
-					{
-						failString = [NSString stringWithFormat:@"%@Failed to read a normal for face[%d] in FACES\n", failString, j];
-					}
-					
-					// vertices
-					if ([scanner scanInt:&n_v])
-					{
-						if (n_v < 3)
-						{
-							failFlag = YES;
-							failString = [NSString stringWithFormat:@"%@Face[%u] has fewer than three vertices.\n", failString, j];
-						}
-						else if (n_v > 3)
-						{
-							OOLogWARN(@"mesh.load.warning.nonTriangular", @"Face[%u] of %@ has %u vertices specified. Only the first three will be used.", j, baseFile, n_v);
-							n_v = 3;
-						}
-					}
-					else
-					{
-						failFlag = YES;
-						failString = [NSString stringWithFormat:@"%@Failed to read number of vertices for face[%d] in FACES\n", failString, j];
-					}
-					
-					if (!failFlag)
-					{
-						int vi;
-						for (i = 0; (int)i < n_v; i++)
-						{
-							if ([scanner scanInt:&vi])
-							{
-								_faces[j].vertex[i] = vi;
-								if (faceRefs != NULL)  VFRAddFace(&faceRefs[vi], j);
-							}
-							else
-							{
-								failFlag = YES;
-								failString = [NSString stringWithFormat:@"%@Failed to read vertex[%d] for face[%d] in FACES\n", failString, i, j];
-							}
-						}
-					}
-				}
+				_faces[j].normal = vector_normal(normal);
 			}
-		}
-		else
-		{
-			failFlag = YES;
-			failString = [NSString stringWithFormat:@"%@Failed to find FACES data\n",failString];
-		}
-
-		// Get textures data.
-		if ([scanner scanString:@"TEXTURES" intoString:NULL])
-		{
-			for (j = 0; j < faceCount; j++)
+			else
 			{
-				NSString	*materialKey;
-				float	max_x, max_y;
-				float	s, t;
-				if (!failFlag)
-				{
-					// materialKey
-					//
-					[scanner scanCharactersFromSet:whitespaceAndNewlineCharSet intoString:NULL];
-					if (![scanner scanUpToCharactersFromSet:whitespaceCharSet intoString:&materialKey])
-					{
-						failFlag = YES;
-						failString = [NSString stringWithFormat:@"%@Failed to read texture filename for face[%d] in TEXTURES\n", failString, j];
-					}
-					else
-					{
-						NSNumber *index = [texFileName2Idx objectForKey:materialKey];
-						if (index != nil)
-						{
-							_faces[j].materialIndex = [index unsignedIntValue];
-						}
-						else
-						{
-							if (materialCount == kOOMeshMaxMaterials)
-							{
-								OOLog(kOOLogMeshTooManyMaterials, @"***** ERROR: model %@ has too many materials (maximum is %d)", filename, kOOMeshMaxMaterials);
-								return NO;
-							}
-							_faces[j].materialIndex = materialCount;
-							materialKeys[materialCount] = [materialKey retain];
-							index = @(materialCount);
-							[texFileName2Idx setObject:index forKey:materialKey];
-							++materialCount;
-						}
-					}
-
-					// texture size
-					//
-				   if (!failFlag)
-					{
-						if (![scanner scanFloat:&max_x])  failFlag = YES;
-						if (![scanner scanFloat:&max_y])  failFlag = YES;
-						if (failFlag)
-							failString = [NSString stringWithFormat:@"%@Failed to read texture size for max_x and max_y in face[%d] in TEXTURES\n", failString, j];
-					}
-
-					// vertices
-					//
-					if (!failFlag)
-					{
-						for (i = 0; i < 3; i++)
-						{
-							if (![scanner scanFloat:&s])  failFlag = YES;
-							if (![scanner scanFloat:&t])  failFlag = YES;
-							if (!failFlag)
-							{
-								_faces[j].s[i] = s / max_x;
-								_faces[j].t[i] = t / max_y;
-							}
-							else
-								failString = [NSString stringWithFormat:@"%@Failed to read s t coordinates for vertex[%d] in face[%d] in TEXTURES\n", failString, i, j];
-						}
-					}
-				}
+				failFlag = YES;
+				failString = [NSString stringWithFormat:@"%@Failed to read a normal for face[%d] in FACES (line %lu)\n", failString, j, (unsigned long)tokenizer.line];
+				break;
 			}
-		}
-		else
-		{
-			failFlag = YES;
-			failString = [failString stringByAppendingString:@"Failed to find TEXTURES data (will use placeholder material)\n"];
-			materialKeys[0] = @"_oo_placeholder_material";
-			materialCount = 1;
 			
-			for (j = 0; j < faceCount; j++)
+			// vertices
+			if (OODATScanInt(&tokenizer, &n_v))
 			{
-				_faces[j].materialIndex = 0;
+				if (n_v < 3)
+				{
+					failFlag = YES;
+					failString = [NSString stringWithFormat:@"%@Face[%u] has fewer than three vertices (line %lu).\n", failString, j, (unsigned long)tokenizer.line];
+					break;
+				}
+				else if (n_v > 3)
+				{
+					OOLogWARN(@"mesh.load.warning.nonTriangular", @"Face[%u] of %@ has %u vertices specified. Only the first three will be used.", j, baseFile, n_v);
+					n_v = 3;
+				}
 			}
-		}
-		
-		if ([scanner scanString:@"NAMES" intoString:NULL])
-		{
-			unsigned int count;
-			if (![scanner scanInt:(int *)&count])
-			{	
+			else
+			{
 				failFlag = YES;
-				failString = [failString stringByAppendingString:@"Expected count after NAMES\n"];
+				failString = [NSString stringWithFormat:@"%@Failed to read number of vertices for face[%d] in FACES (line %lu)\n", failString, j, (unsigned long)tokenizer.line];
+				break;
 			}
-			else
+			
+			for (i = 0; (int)i < n_v; i++)
 			{
-				for (j = 0; j < count; j++)
+				int vi;
+				if (!OODATScanInt(&tokenizer, &vi))
 				{
-					NSString *name = nil;
-					[scanner scanCharactersFromSet:whitespaceAndNewlineCharSet intoString:NULL];
-					if (![scanner scanUpToCharactersFromSet:newlineCharSet intoString:&name])
-					{
-						failFlag = YES;
-						failString = [failString stringByAppendingString:@"Expected file name\n"];
-					}
-					else
-					{
-						[self renameTexturesFrom:[NSString stringWithFormat:@"%u", j] to:name];
-					}
+					failFlag = YES;
+					failString = [NSString stringWithFormat:@"%@Failed to read vertex[%d] for face[%d] in FACES (line %lu)\n", failString, i, j, (unsigned long)tokenizer.line];
+					break;
+				}
+				if (vi < 0 || (OOMeshVertexCount)vi >= vertexCount)
+				{
+					failFlag = YES;
+					failString = [NSString stringWithFormat:@"%@Vertex[%d] for face[%d] in FACES is out of range (line %lu)\n", failString, i, j, (unsigned long)tokenizer.line];
+					break;
 				}
+				_faces[j].vertex[i] = vi;
+				VFRAddFace(&faceRefs[vi], j);
 			}
 		}
-		
-		BOOL explicitTangents = NO;
-		
-		// Get explicit normals.
-		if ([scanner scanString:@"NORMALS" intoString:NULL])
+	}
+	else
+	{
+		failFlag = YES;
+		failString = [NSString stringWithFormat:@"%@Failed to find FACES data (line %lu)\n", failString, (unsigned long)tokenizer.line];
+	}
+
+	// Get textures data.
+	if (OODATScanSection(&tokenizer, kOODATSectionTextures))
+	{
+		for (j = 0; j < faceCount && !failFlag; j++)
 		{
-			_normalMode = kNormalModeExplicit;
-			if (![self allocateNormalBuffersWithCount:vertexCount])
+			const uint8_t	*keyBytes = NULL;
+			NSUInteger		keyLength;
+			float			max_x, max_y;
+			float			s, t;
+			
+			// materialKey
+			//
+			if (!OODATScanWord(&tokenizer, &keyBytes, &keyLength))
 			{
-				OOLog(kOOLogAllocationFailure, @"***** ERROR: failed to allocate memory for model %@ (%u vertices).", filename, vertexCount);
-				return NO;
+				failFlag = YES;
+				failString = [NSString stringWithFormat:@"%@Failed to read texture filename for face[%d] in TEXTURES (line %lu)\n", failString, j, (unsigned long)tokenizer.line];
+				break;
 			}
 			
-			for (j = 0; j < vertexCount; j++)
+			// Material keys are compared in place; a string is only made for each new one.
+			for (i = 0; i != materialCount; i++)
+			{
+				if (materialKeyLengths[i] == keyLength && memcmp(materialKeyBytes[i], keyBytes, keyLength) == 0)  break;
+			}
+			if (i == materialCount)
 			{
-				float x, y, z;
-				if (!failFlag)
+				if (materialCount == kOOMeshMaxMaterials)
 				{
-					if (![scanner scanFloat:&x])  failFlag = YES;
-					if (![scanner scanFloat:&y])  failFlag = YES;
-					if (![scanner scanFloat:&z])  failFlag = YES;
-					if (!failFlag)
-					{
-						_normals[j] = vector_normal(make_vector(x, y, z));
-					}
-					else
-					{
-						failString = [NSString stringWithFormat:@"%@Failed to read a value for vertex[%d] in %@\n", failString, j, @"NORMALS"];
-					}
+					OOLog(kOOLogMeshTooManyMaterials, @"***** ERROR: model %@ has too many materials (maximum is %d)", filename, kOOMeshMaxMaterials);
+					return NO;
 				}
+				materialKeyBytes[materialCount] = keyBytes;
+				materialKeyLengths[materialCount] = keyLength;
+				materialKeys[materialCount] = [OODATStringWithBytes(keyBytes, keyLength) retain];
+				++materialCount;
 			}
+			_faces[j].materialIndex = i;
 			
-			// Get explicit tangents (only together with vertices).
-			if ([scanner scanString:@"TANGENTS" intoString:NULL])
+			// texture size
+			//
+			if (!OODATScanFloat(&tokenizer, &max_x) || !OODATScanFloat(&tokenizer, &max_y))
+			{
+				failFlag = YES;
+				failString = [NSString stringWithFormat:@"%@Failed to read texture size for max_x and max_y in face[%d] in TEXTURES (line %lu)\n", failString, j, (unsigned long)tokenizer.line];
+				break;
+			}
+			
+			// vertices
+			//
+			for (i = 0; i < 3; i++)
 			{
-				for (j = 0; j < vertexCount; j++)
+				if (OODATScanFloat(&tokenizer, &s) && OODATScanFloat(&tokenizer, &t))
 				{
-					float x, y, z;
-					if (!failFlag)
-					{
-						if (![scanner scanFloat:&x])  failFlag = YES;
-						if (![scanner scanFloat:&y])  failFlag = YES;
-						if (![scanner scanFloat:&z])  failFlag = YES;
-						if (!failFlag)
-						{
-							_tangents[j] = vector_normal(make_vector(x, y, z));
-						}
-						else
-						{
-							failString = [NSString stringWithFormat:@"%@Failed to read a value for vertex[%d] in %@\n", failString, j, @"TANGENTS"];
-						}
-					}
+					_faces[j].s[i] = s / max_x;
+					_faces[j].t[i] = t / max_y;
+				}
+				else
+				{
+					failFlag = YES;
+					failString = [NSString stringWithFormat:@"%@Failed to read s t coordinates for vertex[%d] in face[%d] in TEXTURES (line %lu)\n", failString, i, j, (unsigned long)tokenizer.line];
+					break;
 				}
 			}
 		}
+	}
+	else
+	{
+		failFlag = YES;
+		failString = [NSString stringWithFormat:@"%@Failed to find TEXTURES data at line %lu (will use placeholder material)\n", failString, (unsigned long)tokenizer.line];
+		materialKeys[0] = @"_oo_placeholder_material";
+		materialCount = 1;
 		
-		PROFILE(@"finished parsing");
-		
-		if (IsLegacyNormalMode(_normalMode))
+		for (j = 0; j < faceCount; j++)
 		{
-			[self checkNormalsAndAdjustWinding];
-			PROFILE(@"finished checkNormalsAndAdjustWinding");
+			_faces[j].materialIndex = 0;
 		}
-		if (!explicitTangents)
-		{
-			[self generateFaceTangents];
-			PROFILE(@"finished generateFaceTangents");
+	}
+	
+	if (OODATScanSection(&tokenizer, kOODATSectionNames))
+	{
+		int count;
+		if (!OODATScanInt(&tokenizer, &count))
+		{	
+			failFlag = YES;
+			failString = [NSString stringWithFormat:@"%@Expected count after NAMES (line %lu)\n", failString, (unsigned long)tokenizer.line];
 		}
-		
-		// check for smooth shading and recalculate normals
-		if (_normalMode == kNormalModeSmooth)
+		else
 		{
-			if (![self allocateNormalBuffersWithCount:vertexCount])
+			for (j = 0; j < (unsigned)count; j++)
 			{
-				OOLog(kOOLogAllocationFailure, @"***** ERROR: failed to allocate memory for model %@ (%u vertices).", filename, vertexCount);
-				return NO;
+				NSString *name = OODATScanLine(&tokenizer);
+				if (name == nil)
+				{
+					failFlag = YES;
+					failString = [NSString stringWithFormat:@"%@Expected file name (line %lu)\n", failString, (unsigned long)tokenizer.line];
+					break;
+				}
+				[self renameTexturesFrom:[NSString stringWithFormat:@"%u", j] to:name];
 			}
-			[self calculateVertexNormalsAndTangentsWithFaceRefs:faceRefs];
-			PROFILE(@"finished calculateVertexNormalsAndTangents");
-			
 		}
-		else if (IsPerVertexNormalMode(_normalMode) && !explicitTangents)
+	}
+	
+	BOOL explicitTangents = NO;
+	
+	// Get explicit normals.
+	if (OODATScanSection(&tokenizer, kOODATSectionNormals))
+	{
+		_normalMode = kNormalModeExplicit;
+		if (![self allocateNormalBuffersWithCount:vertexCount])
 		{
-			[self calculateVertexTangentsWithFaceRefs:faceRefs];
-			PROFILE(@"finished calculateVertexTangents");
+			OOLog(kOOLogAllocationFailure, @"***** ERROR: failed to allocate memory for model %@ (%u vertices).", filename, vertexCount);
+			return NO;
 		}
 		
-		// save the resulting data for possible reuse
-		if (EXPECT(_cacheWriteable))
+		for (j = 0; j < vertexCount && !failFlag; j++)
 		{
-			[OOCacheManager setMeshData:[self modelData] forName:cacheKey];
-			PROFILE(@"saved to cache");
+			Vector normal;
+			if (OODATScanVector(&tokenizer, &normal))
+			{
+				_normals[j] = vector_normal(normal);
+			}
+			else
+			{
+				failFlag = YES;
+				failString = [NSString stringWithFormat:@"%@Failed to read a value for vertex[%d] in %@ (line %lu)\n", failString, j, @"NORMALS", (unsigned long)tokenizer.line];
+			}
 		}
 		
-		if (failFlag)
+		// Get explicit tangents (only together with vertices).
+		if (OODATScanSection(&tokenizer, kOODATSectionTangents))
+		{
+			for (j = 0; j < vertexCount && !failFlag; j++)
+			{
+				Vector tangent;
+				if (OODATScanVector(&tokenizer, &tangent))
+				{
+					_tangents[j] = vector_normal(tangent);
+				}
+				else
+				{
+					failFlag = YES;
+					failString = [NSString stringWithFormat:@"%@Failed to read a value for vertex[%d] in %@ (line %lu)\n", failString, j, @"TANGENTS", (unsigned long)tokenizer.line];
+				}
+			}
+		}
+	}
+	
+	PROFILE(@"finished parsing");
+	
+	if (IsLegacyNormalMode(_normalMode))
+	{
+		[self checkNormalsAndAdjustWinding];
+		PROFILE(@"finished checkNormalsAndAdjustWinding");
+	}
+	if (!explicitTangents)
+	{
+		[self generateFaceTangents];
+		PROFILE(@"finished generateFaceTangents");
+	}
+	
+	// check for smooth shading and recalculate normals
+	if (_normalMode == kNormalModeSmooth)
+	{
+		if (![self allocateNormalBuffersWithCount:vertexCount])
 		{
-			OOLog(@"mesh.error", @"%@ ..... from %@ %@", failString, filename, (using_preloaded)? @"(from preloaded data)" :@"(from file)");
+			OOLog(kOOLogAllocationFailure, @"***** ERROR: failed to allocate memory for model %@ (%u vertices).", filename, vertexCount);
+			return NO;
 		}
+		[self calculateVertexNormalsAndTangentsWithFaceRefs:faceRefs];
+		PROFILE(@"finished calculateVertexNormalsAndTangents");
+		
+	}
+	else if (IsPerVertexNormalMode(_normalMode) && !explicitTangents)
+	{
+		[self calculateVertexTangentsWithFaceRefs:faceRefs];
+		PROFILE(@"finished calculateVertexTangents");
+	}
+	
+	if (failFlag)
+	{
+		OOLog(@"mesh.error", @"%@ ..... from %@ (from file)", failString, filename);
 	}
 	
 	[self calculateBoundingVolumes];
@@ -1849,6 +2036,44 @@ static float FaceAreaCorrect(GLuint *vertIndices, Vector *vertices)
 }
 
 
+static GLuint DrawVertexIndex(OOMeshDisplayLists *lists, GLuint *hashTable, NSUInteger hashMask, Vector position, Vector normal, Vector tangent, GLfloat s, GLfloat t)
+{
+	GLfloat		key[11] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, tangent.x, tangent.y, tangent.z, s, t };
+	uint32_t	hash = 2166136261U;
+	unsigned	i;
+	
+	for (i = 0; i < sizeof key; i++)
+	{
+		hash = (hash ^ ((const uint8_t *)key)[i]) * 16777619U;
+	}
+	
+	NSUInteger slot = hash & hashMask;
+	while (hashTable[slot] != 0)
+	{
+		GLuint index = hashTable[slot] - 1;
+		if (vector_equal(lists->vertexArray[index], position) &&
+			vector_equal(lists->normalArray[index], normal) &&
+			vector_equal(lists->tangentArray[index], tangent) &&
+			lists->textureUVArray[index * 2] == s &&
+			lists->textureUVArray[index * 2 + 1] == t)
+		{
+			return index;
+		}
+		slot = (slot + 1) & hashMask;
+	}
+	
+	GLuint index = lists->vertexCount++;
+	lists->vertexArray[index] = position;
+	lists->normalArray[index] = normal;
+	lists->tangentArray[index] = tangent;
+	lists->textureUVArray[index * 2] = s;
+	lists->textureUVArray[index * 2 + 1] = t;
+	hashTable[slot] = index + 1;
+	
+	return index;
+}
+
+
 - (BOOL) setUpVertexArrays
 {
 	OOJS_PROFILE_ENTER
@@ -1885,10 +2110,18 @@ static float FaceAreaCorrect(GLuint *vertIndices, Vector *vertices)
 	}
 
 
+	/*	Corners with the same position, normal, tangent and texture
+		coordinates share a draw vertex. The hash table holds draw vertex
+		indices plus one, or zero for empty slots, and is at most half full.
+	*/
+	NSUInteger hashTableSize = 1;
+	while (hashTableSize < (NSUInteger)faceCount * 6)  hashTableSize <<= 1;
+	GLuint *hashTable = calloc(hashTableSize, sizeof *hashTable);
+	if (hashTable == NULL)  return NO;
+	_displayLists.vertexCount = 0;
+	
 	// base model, flat or smooth shaded, all triangles
 	int tri_index = 0;
-	int uv_index = 0;
-	int vertex_index = 0;
 	
 	// Iterate over material names
 	for (mi = 0; mi != materialCount; ++mi)
@@ -1924,13 +2157,7 @@ static float FaceAreaCorrect(GLuint *vertIndices, Vector *vertices)
 						tangent = _faces[fi].tangent;
 					}
 					
-					// FIXME: avoid redundant vertices so index array is actually useful.
-					_displayLists.indexArray[tri_index++] = vertex_index;
-					_displayLists.normalArray[vertex_index] = normal;
-					_displayLists.tangentArray[vertex_index] = tangent;
-					_displayLists.vertexArray[vertex_index++] = _vertices[v];
-					_displayLists.textureUVArray[uv_index++] = _faces[fi].s[vi];
-					_displayLists.textureUVArray[uv_index++] = _faces[fi].t[vi];
+					_displayLists.indexArray[tri_index++] = DrawVertexIndex(&_displayLists, hashTable, hashTableSize - 1, _vertices[v], normal, tangent, _faces[fi].s[vi], _faces[fi].t[vi]);
 				}
 			}
 		}
@@ -1938,6 +2165,7 @@ static float FaceAreaCorrect(GLuint *vertIndices, Vector *vertices)
 	}
 	
 	_displayLists.count = tri_index;	// total number of triangle vertices
+	free(hashTable);
 	return YES;
 	
 	OOJS_PROFILE_EXIT
@@ -1986,27 +2214,47 @@ static float FaceAreaCorrect(GLuint *vertIndices, Vector *vertices)
 
 - (void) rescaleByFactor:(GLfloat)factor
 {
-	// Rescale base vertices used for geometry calculations.
 	OOMeshVertexCount	i;
-	Vector				*vertex = NULL;
 	
+	/*	The vertex buffers may be shared with the mesh this is a copy of, or
+		mapped from a mesh file, so the rescaled vertices go in new buffers.
+		The retained objects dictionary may also be shared.
+	*/
+	NSMutableDictionary *oldRetainedObjects = _retainedObjects;
+	Vector *oldVertices = _vertices;
+	Vector *oldDrawVertices = _displayLists.vertexArray;
+	_retainedObjects = [oldRetainedObjects mutableCopy];
+	
+	Vector *drawVertices = [self allocateBytesWithSize:sizeof *drawVertices count:_displayLists.vertexCount key:@"vertexArray"];
+	if (drawVertices == NULL || ![self allocateVertexBuffersWithCount:vertexCount])
+	{
+		OOLog(kOOLogAllocationFailure, @"***** ERROR: failed to allocate memory to rescale model %@ (%u vertices).", baseFile, vertexCount);
+		[_retainedObjects release];
+		_retainedObjects = oldRetainedObjects;
+		_vertices = oldVertices;
+		return;
+	}
+	_displayLists.vertexArray = drawVertices;
+	
+	// Rescale base vertices used for geometry calculations.
 	for (i = 0; i < vertexCount; i++)
 	{
-		vertex = &_vertices[i];
-		*vertex = vector_multiply_scalar(*vertex, factor);
+		_vertices[i] = vector_multiply_scalar(oldVertices[i], factor);
 	}
 	
 	// Rescale actual display vertices.
-	for (i = 0; i < _displayLists.count; i++)
+	for (i = 0; i < _displayLists.vertexCount; i++)
 	{
-		vertex = &_displayLists.vertexArray[i];
-		*vertex = vector_multiply_scalar(*vertex, factor);
+		_displayLists.vertexArray[i] = vector_multiply_scalar(oldDrawVertices[i], factor);
 	}
 	
+	[oldRetainedObjects release];
+	
 	[self calculateBoundingVolumes];
 	DESTROY(octree);
 	DESTROY(baseFile);	// Avoid octree cache.
 	DESTROY(baseFileOctreeCacheRef);
+	DESTROY(_meshBlobKey);
 }
 
 
@@ -2031,7 +2279,7 @@ static float FaceAreaCorrect(GLuint *vertIndices, Vector *vertices)
 	
 	// Draw
 	OOGLBEGIN(GL_LINES);
-	for (i = 0; i < _displayLists.count; ++i)
+	for (i = 0; i < _displayLists.vertexCount; ++i)
 	{
 		v = _displayLists.vertexArray[i];
 		n = _displayLists.normalArray[i];
@@ -2173,24 +2421,141 @@ static void Scribble(void *bytes, size_t size)
 	}
 }
 
+
+#ifndef NDEBUG
++ (NSString *) runLoaderBenchmark
+{
+	NSAutoreleasePool		*pool = [[NSAutoreleasePool alloc] init];
+	NSFileManager			*fmgr = [NSFileManager defaultManager];
+	OOProfilingStopwatch	*stopwatch = [OOProfilingStopwatch stopwatch];
+	NSString				*modelsPath = nil;
+	NSString				*folder = nil;
+	NSString				*name = nil;
+	NSUInteger				modelCount = 0, loadCount = 0, failures = 0, mismatches = 0;
+	unsigned long long		textBytes = 0, binaryBytes = 0;
+	OOTimeDelta				textTime = 0, binaryTime = 0;
+	unsigned				smooth;
+	
+	modelsPath = [[ResourceManager builtInPath] stringByAppendingPathComponent:@"Models"];
+	folder = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"oolite-mesh-benchmark-%u", (unsigned)[[NSProcessInfo processInfo] processIdentifier]]];
+	if (![fmgr oo_createDirectoryAtPath:folder attributes:nil])
+	{
+		[pool release];
+		return @"Could not create benchmark folder.";
+	}
+	
+	foreach (name, [[fmgr oo_directoryContentsAtPath:modelsPath] sortedArrayUsingSelector:@selector(compare:)])
+	{
+		if (![[[name pathExtension] lowercaseString] isEqualToString:@"dat"])  continue;
+		NSString *datPath = [modelsPath stringByAppendingPathComponent:name];
+		modelCount++;
+		
+		for (smooth = 0; smooth < 2; smooth++)
+		{
+			NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+			NSString *binaryPath = [folder stringByAppendingPathComponent:[NSString stringWithFormat:@"%@-%u.oomesh", [name stringByDeletingPathExtension], smooth]];
+			OOMesh *textMesh = [[[OOMesh alloc] init] autorelease];
+			OOMesh *binaryMesh = [[[OOMesh alloc] init] autorelease];
+			textMesh->_normalMode = smooth ? kNormalModeSmooth : kNormalModePerFace;
+			textMesh->_cacheWriteable = NO;
+			binaryMesh->_cacheWriteable = NO;
+			
+			[stopwatch reset];
+			NSData *source = [NSData dataWithContentsOfMappedFile:datPath];
+			BOOL OK = [textMesh loadDataFromDATFile:source name:name scaleFactor:1.0f];
+			textTime += [stopwatch reset];
+			
+			NSData *blob = OK ? [textMesh binaryRepresentationWithOctree:nil depth:0] : nil;
+			if (blob == nil || ![blob writeToFile:binaryPath atomically:NO])
+			{
+				failures++;
+				[innerPool release];
+				continue;
+			}
+			textBytes += [source length];
+			binaryBytes += [blob length];
+			
+			[stopwatch reset];
+			NSData *mapped = [NSData dataWithContentsOfMappedFile:binaryPath];
+			OK = [binaryMesh setModelFromBinaryRepresentation:mapped name:name];
+			binaryTime += [stopwatch reset];
+			
+			loadCount++;
+			if (!OK)  failures++;
+			else if (![binaryMesh hasSameDrawDataAsMesh:textMesh])  mismatches++;
+			
+			[innerPool release];
+		}
+	}
+	
+	[fmgr oo_removeItemAtPath:folder];
+	
+	NSString *result = [NSString stringWithFormat:@"%lu models, %lu loads (%.1f MiB DAT, %.1f MiB .oomesh): text %.2f ms, binary %.2f ms%@%@",
+						(unsigned long)modelCount, (unsigned long)loadCount, textBytes / (1024.0 * 1024.0), binaryBytes / (1024.0 * 1024.0),
+						textTime * 1e3, binaryTime * 1e3,
+						(failures == 0) ? @"" : [NSString stringWithFormat:@" ** %lu FAILURES **", (unsigned long)failures],
+						(mismatches == 0) ? @"" : [NSString stringWithFormat:@" ** %lu MISMATCHES **", (unsigned long)mismatches]];
+	OOLog(@"mesh.load.benchmark", @"%@", result);
+	
+	[result retain];
+	[pool release];
+	return [result autorelease];
+}
+
+
+- (BOOL) hasSameDrawDataAsMesh:(OOMesh *)other
+{
+	OOMeshMaterialCount i;
+	
+	if (_normalMode != other->_normalMode ||
+		vertexCount != other->vertexCount ||
+		faceCount != other->faceCount ||
+		materialCount != other->materialCount ||
+		_displayLists.count != other->_displayLists.count ||
+		_displayLists.vertexCount != other->_displayLists.vertexCount)
+	{
+		return NO;
+	}
+	
+	for (i = 0; i != materialCount; i++)
+	{
+		if (![materialKeys[i] isEqualToString:other->materialKeys[i]] ||
+			!NSEqualRanges(triangle_range[i], other->triangle_range[i]))
+		{
+			return NO;
+		}
+	}
+	
+	size_t drawCount = _displayLists.vertexCount;
+	return	memcmp(_vertices, other->_vertices, sizeof *_vertices * vertexCount) == 0 &&
+			memcmp(_faces, other->_faces, sizeof *_faces * faceCount) == 0 &&
+			memcmp(_displayLists.indexArray, other->_displayLists.indexArray, sizeof *_displayLists.indexArray * _displayLists.count) == 0 &&
+			memcmp(_displayLists.textureUVArray, other->_displayLists.textureUVArray, sizeof *_displayLists.textureUVArray * 2 * drawCount) == 0 &&
+			memcmp(_displayLists.vertexArray, other->_displayLists.vertexArray, sizeof *_displayLists.vertexArray * drawCount) == 0 &&
+			memcmp(_displayLists.normalArray, other->_displayLists.normalArray, sizeof *_displayLists.normalArray * drawCount) == 0 &&
+			memcmp(_displayLists.tangentArray, other->_displayLists.tangentArray, sizeof *_displayLists.tangentArray * drawCount) == 0;
+}
+#endif
+
 @end
 
 
-static NSString * const kOOCacheMeshes = @"OOMesh";
+static NSString * const kOOCacheMeshes = @"meshes";
 
 @implementation OOCacheManager (OOMesh)
 
-+ (NSDictionary *)meshDataForName:(NSString *)inShipName
++ (NSData *)meshBlobForKey:(NSString *)inKey
 {
-	return [[self sharedCache] objectForKey:inShipName inCache:kOOCacheMeshes];
+	if (inKey == nil)  return nil;
+	return [[self sharedCache] blobForKey:inKey inStore:kOOCacheMeshes];
 }
 
 
-+ (void)setMeshData:(NSDictionary *)inData forName:(NSString *)inShipName
++ (void)setMeshBlob:(NSData *)inBlob forKey:(NSString *)inKey
 {
-	if (inData != nil && inShipName != nil)
+	if (inBlob != nil && inKey != nil)
 	{
-		[[self sharedCache] setObject:inData forKey:inShipName inCache:kOOCacheMeshes];
+		[[self sharedCache] setBlob:inBlob forKey:inKey inStore:kOOCacheMeshes];
 	}
 }
 
@@ -2228,6 +2593,26 @@ static NSString * const kOOCacheOctrees = @"octrees";
 }
 
 
++ (Octree *)octreeForBlobKey:(NSString *)inKey
+{
+	if (inKey == nil)  return nil;
+	
+	NSData *blob = [[self sharedCache] blobForKey:inKey inStore:kOOCacheOctrees];
+	if (blob == nil)  return nil;
+	
+	return [[[Octree alloc] initWithBinaryRepresentation:blob] autorelease];
+}
+
+
++ (void)setOctree:(Octree *)inOctree forBlobKey:(NSString *)inKey
+{
+	if (inOctree != nil && inKey != nil)
+	{
+		[[self sharedCache] setBlob:[inOctree binaryRepresentation] forKey:inKey inStore:kOOCacheOctrees];
+	}
+}
+
+
 static void VFRAddFace(VertexFaceRef *vfr, NSUInteger index)
 {
 	NSCParameterAssert(vfr != NULL);
@@ -2261,3 +2646,11 @@ static NSUInteger VFRGetFaceAtIndex(VertexFaceRef *vfr, NSUInteger index)
 }
 
 @end
+
+
+#ifndef NDEBUG
+NSString *OOMeshRunLoaderBenchmark(void)
+{
+	return [OOMesh runLoaderBenchmark];
+}
+#endif
@@ -0,0 +1,120 @@
+/*
+
+OOMeshBinaryFormat.h
+
+Layout of .oomesh files, the binary form of a mesh after loading.
+
+An .oomesh holds everything OOMesh computes from a DAT file: the vertex
+positions and faces used for collision and bounds (after winding correction
+and tangent generation), the deduplicated draw arrays (positions, normals,
+tangents and texture coordinates, with an index array grouped by material),
+the material keys and the index range of each material, and optionally the
+collision octree. The arrays are stored in the in-memory layout OOMesh uses,
+each starting on a 16-byte boundary, so loading is a matter of mapping the
+file, checking the header and pointing at the sections; nothing is parsed or
+copied.
+
+Since the arrays are native structures, a file is only usable by a build with
+the same endianness, sizeof (Vector) and sizeof (OOMeshFace); the header
+records all three, and a file that doesn't match is ignored (and, in the cache,
+regenerated from the DAT file).
+
+.oomesh files are written to the "meshes" blob store of the cache, keyed by a
+hash of the DAT file, the normal mode, the scale and the loader revision, and
+may also be shipped next to (or instead of) a DAT file in a Models folder.
+tools/oomeshconv writes the latter.
+
+The blob store outlives both data cache clears and game upgrades, so the
+format version alone can't tell whether a cached file is still what the
+current code would produce. kOOMeshLoaderRevision must be bumped whenever DAT
+loading, draw array building or the octree builder changes its output; cached
+meshes and octrees from another revision are then ignored and rebuilt. A
+shipped file from another revision is only used if there is no DAT file.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOMesh.h"
+
+
+enum
+{
+	kOOMeshBinaryFormatVersion		= 1,
+	kOOMeshLoaderRevision			= 1,
+	kOOMeshBinaryEndianTag			= 0x01020304,
+	kOOMeshBinaryAlignment			= 16
+};
+
+
+//	Sections, in file order.
+enum
+{
+	kOOMeshSectionMaterialKeys,		// materialCount NUL-terminated UTF-8 strings.
+	kOOMeshSectionVertices,			// Vector[vertexCount]
+	kOOMeshSectionFaces,			// OOMeshFace[faceCount]
+	kOOMeshSectionIndices,			// GLuint[indexCount], into the draw arrays.
+	kOOMeshSectionTextureUVs,		// GLfloat[2 * drawVertexCount]
+	kOOMeshSectionDrawVertices,		// Vector[drawVertexCount]
+	kOOMeshSectionDrawNormals,		// Vector[drawVertexCount]
+	kOOMeshSectionDrawTangents,		// Vector[drawVertexCount]
+	kOOMeshSectionOctree,			// Octree -binaryRepresentation, or empty.
+
+	kOOMeshSectionCount
+};
+
+
+typedef struct
+{
+	uint32_t				offset;			// From the start of the file.
+	uint32_t				length;			// In bytes.
+} OOMeshBinarySection;
+
+
+typedef struct
+{
+	char					magic[4];		// "OOMB"
+	uint32_t				formatVersion;
+	uint32_t				endianTag;
+	uint16_t				vectorSize;
+	uint16_t				faceSize;
+	uint64_t				sourceHash;		// 64-bit FNV-1a of the DAT file the mesh was built from.
+	float					scale;
+	uint8_t					normalMode;		// Resulting mode: 0 per-face, 1 smooth, 2 explicit.
+	uint8_t					materialCount;
+	uint8_t					octreeDepth;	// Zero if there is no octree.
+	uint8_t					loaderRevision;	// kOOMeshLoaderRevision of the code that built it.
+	uint32_t				vertexCount;
+	uint32_t				faceCount;
+	uint32_t				drawVertexCount;
+	uint32_t				indexCount;
+	uint32_t				materialRanges[kOOMeshMaxMaterials][2];	// Location and length in the index array.
+	OOMeshBinarySection		sections[kOOMeshSectionCount];
+} OOMeshBinaryHeader;
+
+
+OOINLINE uint64_t OOMeshBinarySourceHash(const void *bytes, size_t length)
+{
+	const uint8_t *p = bytes;
+	uint64_t hash = 14695981039346656037ULL;
+
+	while (length--)  hash = (hash ^ *p++) * 1099511628211ULL;
+	return hash;
+}
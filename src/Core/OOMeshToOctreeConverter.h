@@ -47,6 +47,7 @@ enum
 		uint_fast32_t		count;
 		uint_fast32_t		capacity;
 		uint_fast32_t		pendingCapacity;
+		struct OOMeshToOctreeConverterArena *arena;		// If NULL, triangles is malloced once it outgrows smallData.
 		Triangle			smallData[kOOMeshToOctreeConverterSmallDataCapacity];
 	}					_data;
 }
@@ -57,6 +58,9 @@ enum
 
 - (void) addTriangle:(Triangle)tri;
 
+/*	Build the octree. For large meshes, the subtrees below the top two levels
+	are built in parallel on OOJobPool; the result is the same either way.
+*/
 - (Octree *) findOctreeToDepth:(NSUInteger)depth;
 
 @end
@@ -70,11 +70,35 @@ MA 02110-1301, USA.
 	Profiling shows that over 93 % of nodes use sixteen or fewer triangles in
 	vanilla Oolite. The proportion is lower when using OXPs with more complex
 	models.
+	
+	Large station models still take a noticeable time to convert, so for
+	meshes above kParallelTriangleThreshold the top kParallelLevels levels are
+	split on the calling thread, and the subtrees below them are built as
+	separate jobs on OOJobPool. Since OOOctreeBuilder must be fed in order,
+	each job records its nodes in an OctreeOps list, and the lists are played
+	back into the builder afterwards; a kOpSubtree entry in the top-level list
+	stands for the next job's list. The result is identical to a serial build.
+	
+	Below the top levels, the heap arrays come from an Arena belonging to the
+	job rather than from malloc()/realloc(). Nodes are built depth first, so
+	everything allocated while building a subtree is dead when it's done, and
+	BuildSubOctree() simply rewinds the arena to where it started.
 */
 
 #import "OOMaths.h"
 #import "Octree.h"
 #import "OOLogging.h"
+#import "OOJobPool.h"
+
+
+enum
+{
+	kParallelTriangleThreshold	= 2000,	// Below this, the jobs aren't worth it.
+	kParallelLevels				= 2,	// Up to 64 jobs.
+	
+	kArenaBlockSize				= 256 << 10,
+	kArenaAlignment				= 16
+};
 
 
 // MARK: GeometryData operations.
@@ -104,27 +128,40 @@ MA 02110-1301, USA.
 		The capacity hint passed to InitGeometryData(). Used by
 		AddTriangle_slow().
 	
+	Arena *arena
+		Where AddTriangle_slow() gets heap storage from, or NULL to use
+		malloc().
+	
 	Triangle smallData[]
 		Initial triangle storage. Should not be accessed directly; if it's
 		relevant, triangles points to it.
 */
 typedef struct OOMeshToOctreeConverterInternalData GeometryData;
+typedef struct OOMeshToOctreeConverterArena Arena;
 
 
 /*
-	InitGeometryData(data, capacity)
+	InitGeometryData(data, capacity, arena)
 	
 	Prepare a GeometryData struct for use.
 	The data has to be by reference rather than a return value so that the
 	triangles pointer can be pointed into the struct.
 */
-OOINLINE void InitGeometryData(GeometryData *data, uint_fast32_t capacity);
+OOINLINE void InitGeometryData(GeometryData *data, uint_fast32_t capacity, Arena *arena);
+
+/*
+	MoveGeometryData(dst, src)
+	
+	Move the contents of src into uninitialized dst. Leaves src in an invalid
+	state; it must not be destroyed.
+*/
+OOINLINE void MoveGeometryData(GeometryData *dst, GeometryData *src);
 
 /*
 	DestroyGeometryData(data)
 	
 	Deallocates dynamic storage if necessary. Leaves the GeometryData in an
-	invalid state.
+	invalid state. Arena storage is not released until the arena is rewound.
 */
 OOINLINE void DestroyGeometryData(GeometryData *data);
 
@@ -154,16 +191,115 @@ static NO_INLINE_FUNC void AddTriangle_slow(GeometryData *data, Triangle tri);
 static OOScalar MaxDimensionFromOrigin(GeometryData *data);
 
 /*
-	BuildSubOctree(data, builder, halfWidth, depth)
+	Arena
+	
+	Stack-like allocator for GeometryData storage: a list of blocks, of which
+	the first few are in use. Memory is released by rewinding to an
+	ArenaMark; blocks beyond the mark are kept for reuse until
+	DestroyArena().
+*/
+typedef struct ArenaBlock
+{
+	struct ArenaBlock	*next;
+	size_t				capacity;
+	size_t				used;
+} ArenaBlock;
+
+struct OOMeshToOctreeConverterArena
+{
+	ArenaBlock			*first;
+	ArenaBlock			*current;		// NULL if nothing has been allocated.
+};
+
+typedef struct
+{
+	ArenaBlock			*block;
+	size_t				used;
+} ArenaMark;
+
+static void *ArenaAllocate(Arena *arena, size_t size);
+OOINLINE ArenaMark GetArenaMark(Arena *arena);
+OOINLINE void RewindArena(Arena *arena, ArenaMark mark);
+static void DestroyArena(Arena *arena);
+
+
+/*
+	OctreeOps
+	
+	Record of the calls a subtree build would make to OOOctreeBuilder, so that
+	subtrees built in parallel can be passed to the builder in order.
+*/
+enum
+{
+	kOpEmpty,
+	kOpSolid,
+	kOpBeginInnerNode,
+	kOpEndInnerNode,
+	kOpSubtree		// Stands for the ops of the next SubtreeJob.
+};
+
+typedef struct
+{
+	uint8_t				*ops;
+	size_t				count;
+	size_t				capacity;
+} OctreeOps;
+
+OOINLINE void AddOp(OctreeOps *ops, uint8_t op);
+static NO_INLINE_FUNC void AddOp_slow(OctreeOps *ops, uint8_t op);
+
+
+/*
+	SubtreeJob
+	
+	A subtree below the top levels, built by BuildSubtreeJob() on OOJobPool.
+*/
+typedef struct
+{
+	GeometryData		data;
+	OOScalar			halfWidth;
+	NSUInteger			depth;
+	OctreeOps			ops;
+} SubtreeJob;
+
+static void BuildSubtreeJob(void *context, NSUInteger index);
+
+/*
+	ExpandTopLevels(data, ops, halfWidth, depth, levels, jobs, jobCount)
+	
+	Like BuildSubOctree(), but stops after levels levels and turns each
+	non-trivial subtree below that into a SubtreeJob, appended to jobs.
+*/
+static void ExpandTopLevels(GeometryData *data, OctreeOps *ops, OOScalar halfWidth, NSUInteger depth, unsigned levels, SubtreeJob **jobs, NSUInteger *jobCount);
+
+/*
+	ReplayOps(ops, builder, jobs, nextJob)
+	
+	Pass recorded ops to builder, expanding kOpSubtree from jobs in order.
+*/
+static void ReplayOps(const OctreeOps *ops, OOOctreeBuilder *builder, SubtreeJob **jobs, NSUInteger *nextJob);
+
+/*
+	BuildSubOctree(data, ops, halfWidth, depth, arena)
 	
 	Recursively apply the octree generation algorithm.
 		data: input geometry data.
-		builder: OOOctreeBuilder where results are accumulated. Each call will
-		          write one complete subtree, which may be a single leaf node.
+		ops: OctreeOps where results are accumulated. Each call will write one
+		     complete subtree, which may be a single leaf node.
 		halfWidth: the half-width of the bounding cube of data.
 		depth: recursion limit.
+		arena: storage for child geometry.
+*/
+void BuildSubOctree(GeometryData *data, OctreeOps *ops, OOScalar halfWidth, NSUInteger depth, Arena *arena);
+
+/*
+	SplitOctants(data, children, subHalfWidth, arena)
+	
+	Initialize the eight GeometryDatas in children and divide data among them,
+	in OOOctreeBuilder order (x is the high bit). The caller must destroy the
+	children.
 */
-void BuildSubOctree(GeometryData *data, OOOctreeBuilder *builder, OOScalar halfWidth, NSUInteger depth);
+static void SplitOctants(GeometryData *data, GeometryData children[8], OOScalar subHalfWidth, Arena *arena);
 
 /*
 	SplitGeometry{X|Y|Z}(data, dPlus, dMinus, offset)
@@ -182,17 +318,31 @@ static void SplitGeometryZ(GeometryData *data, GeometryData *dPlus, GeometryData
 
 // MARK: Inline function bodies.
 
-void InitGeometryData(GeometryData *data, uint_fast32_t capacity)
+void InitGeometryData(GeometryData *data, uint_fast32_t capacity, Arena *arena)
 {
 	NSCParameterAssert(data != NULL);
 	
 	data->count = 0;
 	data->capacity = kOOMeshToOctreeConverterSmallDataCapacity;
 	data->pendingCapacity = capacity;
+	data->arena = arena;
 	data->triangles = data->smallData;
 }
 
 
+void MoveGeometryData(GeometryData *dst, GeometryData *src)
+{
+	NSCParameterAssert(dst != NULL && src != NULL);
+	
+	*dst = *src;
+	if (src->triangles == src->smallData)  dst->triangles = dst->smallData;
+	
+#if OO_DEBUG
+	src->triangles = (Triangle *)-1L;
+#endif
+}
+
+
 OOINLINE void DestroyGeometryData(GeometryData *data)
 {
 	NSCParameterAssert(data != 0 && data->capacity >= kOOMeshToOctreeConverterSmallDataCapacity);
@@ -202,7 +352,7 @@ OOINLINE void DestroyGeometryData(GeometryData *data)
 	NSCAssert(data->triangles != kScribbleValue, @"Attempt to destroy a GeometryData twice.");
 #endif
 	
-	if (data->capacity != kOOMeshToOctreeConverterSmallDataCapacity)
+	if (data->capacity != kOOMeshToOctreeConverterSmallDataCapacity && data->arena == NULL)
 	{
 		// If capacity is kOOMeshToOctreeConverterSmallDataCapacity, triangles points to smallData.
 		free(data->triangles);
@@ -229,6 +379,38 @@ OOINLINE void AddTriangle(GeometryData *data, Triangle tri)
 }
 
 
+OOINLINE ArenaMark GetArenaMark(Arena *arena)
+{
+	NSCParameterAssert(arena != NULL);
+	
+	return (ArenaMark){ arena->current, (arena->current != NULL) ? arena->current->used : 0 };
+}
+
+
+OOINLINE void RewindArena(Arena *arena, ArenaMark mark)
+{
+	NSCParameterAssert(arena != NULL);
+	
+	arena->current = mark.block;
+	if (mark.block != NULL)  mark.block->used = mark.used;
+}
+
+
+OOINLINE void AddOp(OctreeOps *ops, uint8_t op)
+{
+	NSCParameterAssert(ops != NULL);
+	
+	if (ops->count < ops->capacity)
+	{
+		ops->ops[ops->count++] = op;
+	}
+	else
+	{
+		AddOp_slow(ops, op);
+	}
+}
+
+
 @implementation OOMeshToOctreeConverter
 
 - (instancetype) initWithCapacity:(NSUInteger)capacity
@@ -238,7 +420,7 @@ OOINLINE void AddTriangle(GeometryData *data, Triangle tri)
 	
 	if ((self = [super init]))
 	{
-		InitGeometryData(&_data, (uint_fast32_t)capacity);
+		InitGeometryData(&_data, (uint_fast32_t)capacity, NULL);
 	}
 	
 	return self;
@@ -278,8 +460,51 @@ OOINLINE void AddTriangle(GeometryData *data, Triangle tri)
 {
 	OOOctreeBuilder *builder = [[[OOOctreeBuilder alloc] init] autorelease];
 	OOScalar halfWidth = 0.5f + MaxDimensionFromOrigin(&_data);	// pad out from geometry by a half meter
+	OctreeOps ops = { NULL, 0, 0 };
+	SubtreeJob *jobs[1 << (3 * kParallelLevels)];
+	NSUInteger jobCount = 0, nextJob = 0, i;
+	OOJobPool *pool = [OOJobPool sharedJobPool];
+	BOOL parallel = _data.count >= kParallelTriangleThreshold && [pool threadCount] > 1;
+	
+	if (parallel)
+	{
+		ExpandTopLevels(&_data, &ops, halfWidth, depth, kParallelLevels, jobs, &jobCount);
+		if (![pool applyFunction:BuildSubtreeJob context:jobs count:jobCount grain:1])
+		{
+			/*	A job that raised left its ops incomplete, and replaying them
+				would produce a corrupt octree (which the caller would then
+				cache). Throw the whole lot away and do it serially; the top
+				level data is untouched by ExpandTopLevels().
+			*/
+			OOLog(@"mesh.octree.parallel.failed", @"***** Parallel octree build failed, rebuilding serially.");
+			free(ops.ops);
+			ops = (OctreeOps){ NULL, 0, 0 };
+			for (i = 0; i < jobCount; i++)
+			{
+				free(jobs[i]->ops.ops);
+				free(jobs[i]);
+			}
+			jobCount = 0;
+			parallel = NO;
+		}
+	}
 	
-	BuildSubOctree(&_data, builder, halfWidth, depth);
+	if (!parallel)
+	{
+		Arena arena = { NULL, NULL };
+		BuildSubOctree(&_data, &ops, halfWidth, depth, &arena);
+		DestroyArena(&arena);
+	}
+	
+	ReplayOps(&ops, builder, jobs, &nextJob);
+	NSAssert(nextJob == jobCount, @"Octree subtree jobs were not all used.");
+	
+	free(ops.ops);
+	for (i = 0; i < jobCount; i++)
+	{
+		free(jobs[i]->ops.ops);
+		free(jobs[i]);
+	}
 	
 	return [builder buildOctreeWithRadius:halfWidth];
 }
@@ -305,7 +530,7 @@ static OOScalar MaxDimensionFromOrigin(GeometryData *data)
 }
 
 
-void BuildSubOctree(GeometryData *data, OOOctreeBuilder *builder, OOScalar halfWidth, NSUInteger depth)
+void BuildSubOctree(GeometryData *data, OctreeOps *ops, OOScalar halfWidth, NSUInteger depth, Arena *arena)
 {
 	NSCParameterAssert(data != NULL);
 	
@@ -314,17 +539,148 @@ void BuildSubOctree(GeometryData *data, OOOctreeBuilder *builder, OOScalar halfW
 	if (data->count == 0)
 	{
 		// No geometry here.
-		[builder writeEmpty];
+		AddOp(ops, kOpEmpty);
 		return;
 	}
 	
 	if (halfWidth <= OCTREE_MIN_HALF_WIDTH || depth <= 0)
 	{
 		// Maximum resolution reached and not full.
-		[builder writeSolid];
+		AddOp(ops, kOpSolid);
 		return;
 	}
+	
+	ArenaMark mark = GetArenaMark(arena);
+	GeometryData children[8];
+	unsigned i;
+	
+	SplitOctants(data, children, subHalfWidth, arena);
+	
+	AddOp(ops, kOpBeginInnerNode);
+	depth--;
+	for (i = 0; i < 8; i++)
+	{
+		BuildSubOctree(&children[i], ops, subHalfWidth, depth, arena);
+	}
+	AddOp(ops, kOpEndInnerNode);
+	
+	for (i = 0; i < 8; i++)
+	{
+		DestroyGeometryData(&children[i]);
+	}
+	RewindArena(arena, mark);
+}
+
+
+static void ExpandTopLevels(GeometryData *data, OctreeOps *ops, OOScalar halfWidth, NSUInteger depth, unsigned levels, SubtreeJob **jobs, NSUInteger *jobCount)
+{
+	NSCParameterAssert(data != NULL && jobs != NULL && jobCount != NULL);
+	
+	OOScalar subHalfWidth = 0.5f * halfWidth;
+	
+	if (data->count == 0)
+	{
+		AddOp(ops, kOpEmpty);
+		return;
+	}
+	
+	if (halfWidth <= OCTREE_MIN_HALF_WIDTH || depth <= 0)
+	{
+		AddOp(ops, kOpSolid);
+		return;
+	}
+	
+	if (levels == 0)
+	{
+		SubtreeJob *job = calloc(1, sizeof *job);
+		if (EXPECT_NOT(job == NULL))
+		{
+			OOLog(kOOLogAllocationFailure, @"%@", @"!!!!! Ran out of memory to allocate more geometry!");
+			exit(EXIT_FAILURE);
+		}
+		
+		MoveGeometryData(&job->data, data);
+		job->halfWidth = halfWidth;
+		job->depth = depth;
+		jobs[(*jobCount)++] = job;
+		
+		AddOp(ops, kOpSubtree);
+		return;
+	}
+	
+	GeometryData children[8];
+	unsigned i;
+	
+	// No arena: the children may be handed over to jobs.
+	SplitOctants(data, children, subHalfWidth, NULL);
+	
+	AddOp(ops, kOpBeginInnerNode);
+	for (i = 0; i < 8; i++)
+	{
+		NSUInteger oldJobCount = *jobCount;
+		ExpandTopLevels(&children[i], ops, subHalfWidth, depth - 1, levels - 1, jobs, jobCount);
+		
+		// If the child was moved into a job, the job now owns its storage.
+		if (*jobCount == oldJobCount)  DestroyGeometryData(&children[i]);
+	}
+	AddOp(ops, kOpEndInnerNode);
+}
+
+
+static void BuildSubtreeJob(void *context, NSUInteger index)
+{
+	SubtreeJob *job = ((SubtreeJob **)context)[index];
+	Arena arena = { NULL, NULL };
+	
+	@try
+	{
+		BuildSubOctree(&job->data, &job->ops, job->halfWidth, job->depth, &arena);
+	}
+	@finally
+	{
+		DestroyGeometryData(&job->data);
+		DestroyArena(&arena);
+	}
+}
+
 
+static void ReplayOps(const OctreeOps *ops, OOOctreeBuilder *builder, SubtreeJob **jobs, NSUInteger *nextJob)
+{
+	NSCParameterAssert(ops != NULL && nextJob != NULL);
+	
+	size_t i;
+	for (i = 0; i < ops->count; i++)
+	{
+		switch (ops->ops[i])
+		{
+			case kOpEmpty:
+				[builder writeEmpty];
+				break;
+				
+			case kOpSolid:
+				[builder writeSolid];
+				break;
+				
+			case kOpBeginInnerNode:
+				[builder beginInnerNode];
+				break;
+				
+			case kOpEndInnerNode:
+				[builder endInnerNode];
+				break;
+				
+			case kOpSubtree:
+				ReplayOps(&jobs[(*nextJob)++]->ops, builder, NULL, nextJob);
+				break;
+		}
+	}
+}
+
+
+static void SplitOctants(GeometryData *data, GeometryData children[8], OOScalar subHalfWidth, Arena *arena)
+{
+	NSCParameterAssert(data != NULL && children != NULL);
+	
 	/*
 		To avoid reallocations, we want a reasonably pessimistic estimate of
 		sub-data size.
@@ -362,21 +718,19 @@ void BuildSubOctree(GeometryData *data, OOOctreeBuilder *builder, OOScalar halfW
 		kFactor = 2
 	};
 	uint_fast32_t subCapacity = data->count * kFactor;
+	unsigned i;
 	
-#define DECL_GEOMETRY(NAME, CAP) GeometryData NAME; InitGeometryData(&NAME, CAP);
+	for (i = 0; i < 8; i++)
+	{
+		InitGeometryData(&children[i], subCapacity, arena);
+	}
 	
-	DECL_GEOMETRY(g_000, subCapacity);
-	DECL_GEOMETRY(g_001, subCapacity);
-	DECL_GEOMETRY(g_010, subCapacity);
-	DECL_GEOMETRY(g_011, subCapacity);
-	DECL_GEOMETRY(g_100, subCapacity);
-	DECL_GEOMETRY(g_101, subCapacity);
-	DECL_GEOMETRY(g_110, subCapacity);
-	DECL_GEOMETRY(g_111, subCapacity);
+#define DECL_GEOMETRY(NAME, CAP) GeometryData NAME; InitGeometryData(&NAME, CAP, arena);
 	
 	DECL_GEOMETRY(g_xx1, subCapacity);
 	DECL_GEOMETRY(g_xx0, subCapacity);
 	
+	// children[] is indexed by octant: x * 4 + y * 2 + z.
 	SplitGeometryZ(data, &g_xx1, &g_xx0, subHalfWidth);
 	if (g_xx0.count != 0)
 	{
@@ -386,11 +740,11 @@ void BuildSubOctree(GeometryData *data, OOOctreeBuilder *builder, OOScalar halfW
 		SplitGeometryY(&g_xx0, &g_x10, &g_x00, subHalfWidth);
 		if (g_x00.count != 0)
 		{
-			SplitGeometryX(&g_x00, &g_100, &g_000, subHalfWidth);
+			SplitGeometryX(&g_x00, &children[4], &children[0], subHalfWidth);
 		}
 		if (g_x10.count != 0)
 		{
-			SplitGeometryX(&g_x10, &g_110, &g_010, subHalfWidth);
+			SplitGeometryX(&g_x10, &children[6], &children[2], subHalfWidth);
 		}
 		DestroyGeometryData(&g_x00);
 		DestroyGeometryData(&g_x10);
@@ -403,11 +757,11 @@ void BuildSubOctree(GeometryData *data, OOOctreeBuilder *builder, OOScalar halfW
 		SplitGeometryY(&g_xx1, &g_x11, &g_x01, subHalfWidth);
 		if (g_x01.count != 0)
 		{
-			SplitGeometryX(&g_x01, &g_101, &g_001, subHalfWidth);
+			SplitGeometryX(&g_x01, &children[5], &children[1], subHalfWidth);
 		}
 		if (g_x11.count != 0)
 		{
-			SplitGeometryX(&g_x11, &g_111, &g_011, subHalfWidth);
+			SplitGeometryX(&g_x11, &children[7], &children[3], subHalfWidth);
 		}
 		DestroyGeometryData(&g_x01);
 		DestroyGeometryData(&g_x11);
@@ -415,26 +769,7 @@ void BuildSubOctree(GeometryData *data, OOOctreeBuilder *builder, OOScalar halfW
 	DestroyGeometryData(&g_xx0);
 	DestroyGeometryData(&g_xx1);
 	
-	[builder beginInnerNode];
-	depth--;
-	BuildSubOctree(&g_000, builder, subHalfWidth, depth);
-	BuildSubOctree(&g_001, builder, subHalfWidth, depth);
-	BuildSubOctree(&g_010, builder, subHalfWidth, depth);
-	BuildSubOctree(&g_011, builder, subHalfWidth, depth);
-	BuildSubOctree(&g_100, builder, subHalfWidth, depth);
-	BuildSubOctree(&g_101, builder, subHalfWidth, depth);
-	BuildSubOctree(&g_110, builder, subHalfWidth, depth);
-	BuildSubOctree(&g_111, builder, subHalfWidth, depth);
-	[builder endInnerNode];
-	
-	DestroyGeometryData(&g_000);
-	DestroyGeometryData(&g_001);
-	DestroyGeometryData(&g_010);
-	DestroyGeometryData(&g_011);
-	DestroyGeometryData(&g_100);
-	DestroyGeometryData(&g_101);
-	DestroyGeometryData(&g_110);
-	DestroyGeometryData(&g_111);
+#undef DECL_GEOMETRY
 }
 
 
@@ -893,7 +1228,11 @@ static void SplitGeometryZ(GeometryData *data, GeometryData *dPlus, GeometryData
 	If no memory has been allocated yet, capacity is
 	kOOMeshToOctreeConverterSmallDataCapacity, triangles points at smallData
 	and pendingCapacity is the capacity passed to InitGeometryData(). Otherwise,
-	triangles is a malloced pointer.
+	triangles is a malloced pointer, or points into the arena.
+	
+	Arena storage can't be grown in place, since sibling GeometryDatas are
+	filled together; a bigger block is allocated and the old one is abandoned
+	until the arena is rewound.
 	
 	This is marked noinline so that the fast path in AddTriangle() can be
 	inlined. Without the attribute, clang (and probably gcc too) will inline
@@ -905,7 +1244,18 @@ static NO_INLINE_FUNC void AddTriangle_slow(GeometryData *data, Triangle tri)
 	NSCParameterAssert(data != NULL);
 	NSCParameterAssert(data->count == data->capacity);
 	
-	if (data->capacity == kOOMeshToOctreeConverterSmallDataCapacity)
+	if (data->arena != NULL)
+	{
+		uint_fast32_t newCapacity = (data->capacity == kOOMeshToOctreeConverterSmallDataCapacity) ?
+			MAX(data->pendingCapacity, (uint_fast32_t)kOOMeshToOctreeConverterSmallDataCapacity * 2) :
+			1 + data->capacity * 2;
+		Triangle *newTriangles = ArenaAllocate(data->arena, newCapacity * sizeof(Triangle));
+		
+		if (newTriangles != NULL)  memcpy(newTriangles, data->triangles, data->count * sizeof(Triangle));
+		data->capacity = newCapacity;
+		data->triangles = newTriangles;
+	}
+	else if (data->capacity == kOOMeshToOctreeConverterSmallDataCapacity)
 	{
 		data->capacity = MAX(data->pendingCapacity, (uint_fast32_t)kOOMeshToOctreeConverterSmallDataCapacity * 2);
 		data->triangles = malloc(data->capacity * sizeof(Triangle));
@@ -928,3 +1278,73 @@ static NO_INLINE_FUNC void AddTriangle_slow(GeometryData *data, Triangle tri)
 	
 	data->triangles[data->count++] = tri;
 }
+
+
+#define ARENA_HEADER_SIZE ((sizeof (ArenaBlock) + kArenaAlignment - 1) & ~(size_t)(kArenaAlignment - 1))
+
+static void *ArenaAllocate(Arena *arena, size_t size)
+{
+	NSCParameterAssert(arena != NULL);
+	
+	size = (size + kArenaAlignment - 1) & ~(size_t)(kArenaAlignment - 1);
+	
+	ArenaBlock *block = arena->current;
+	if (block == NULL || block->capacity - block->used < size)
+	{
+		// Move on to the next block, if there is one and it's big enough; otherwise insert a new one.
+		ArenaBlock *next = (block != NULL) ? block->next : arena->first;
+		if (next == NULL || next->capacity < size)
+		{
+			size_t capacity = MAX((size_t)kArenaBlockSize, size);
+			ArenaBlock *fresh = malloc(ARENA_HEADER_SIZE + capacity);
+			if (EXPECT_NOT(fresh == NULL))  return NULL;
+			
+			fresh->capacity = capacity;
+			fresh->next = next;
+			if (block != NULL)  block->next = fresh;
+			else  arena->first = fresh;
+			next = fresh;
+		}
+		
+		next->used = 0;
+		block = arena->current = next;
+	}
+	
+	void *result = (char *)block + ARENA_HEADER_SIZE + block->used;
+	block->used += size;
+	return result;
+}
+
+
+static void DestroyArena(Arena *arena)
+{
+	NSCParameterAssert(arena != NULL);
+	
+	ArenaBlock *block = arena->first;
+	while (block != NULL)
+	{
+		ArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+	
+	arena->first = NULL;
+	arena->current = NULL;
+}
+
+
+static NO_INLINE_FUNC void AddOp_slow(OctreeOps *ops, uint8_t op)
+{
+	NSCParameterAssert(ops != NULL && ops->count == ops->capacity);
+	
+	ops->capacity = MAX((size_t)256, ops->capacity * 2);
+	ops->ops = realloc(ops->ops, ops->capacity);
+	
+	if (EXPECT_NOT(ops->ops == NULL))
+	{
+		OOLog(kOOLogAllocationFailure, @"%@", @"!!!!! Ran out of memory to allocate octree nodes!");
+		exit(EXIT_FAILURE);
+	}
+	
+	ops->ops[ops->count++] = op;
+}
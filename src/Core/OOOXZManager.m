@@ -41,6 +41,7 @@ MA 02110-1301, USA.
 #import "MyOpenGLView.h"
 
 #import "unzip.h"
+#import "OOZipArchive.h"
 
 #import "OOManifestProperties.h"
 
@@ -748,6 +749,7 @@ static OOOXZManager *sSingleton = nil;
 
 	// delete filename if it exists from OXZ folder
 	NSString *destination = [[self installPath] stringByAppendingPathComponent:filename];
+	[OOZipArchive closeArchiveWithPath:destination];
 	[[NSFileManager defaultManager] oo_removeItemAtPath:destination];
 
 	// move the temp file on to it
@@ -1831,6 +1833,7 @@ static OOOXZManager *sSingleton = nil;
 		return NO;
 	}
 
+	[OOZipArchive closeArchiveWithPath:filename];
 	if (![[NSFileManager defaultManager] oo_removeItemAtPath:filename])
 	{
 		OOLog(kOOOXZErrorLog, @"Unable to remove file %@", filename);
@@ -0,0 +1,121 @@
+/*
+
+OOPhysicsStore.h
+
+Struct-of-arrays store for the kinematic step of ship movement: turning by
+the frame's roll, pitch and yaw, moving along the new forward axis, and
+drifting with velocity.
+
+Entity state stays in Entity's instance variables, which much of the game
+reads and writes directly; the store is staging for one update. When batch
+ship integration is on, the Universe adds each eligible ship to the store
+before updating it, and the ship records its frame's rotation and movement there
+instead of applying them. After the serial update loop, -integrate: copies
+the ships' positions, orientations and velocities into contiguous arrays,
+advances them all in a single pass with no Objective-C messages, and the
+ships pick up the results in -[Entity finishBatchIntegration].
+
+The kernel performs the same operations in the same order as
+-[ShipEntity applyRoll:climb:andYaw:], -[Entity moveForward:] and
+-[Entity applyVelocity:], so the results match the serial path. A ship that
+rotates more than once in an update has every rotation but the last applied
+immediately by -addRotation:atSlot:, normalizing each as the serial path
+does. Forward movement is always along the final orientation, so it only
+matches the serial path when the ship moves after turning. What changes is
+when the motion happens: after every entity has updated, rather than during
+the ship's own update.
+
+This class is *not* thread-safe.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCocoa.h"
+#import "OOMaths.h"
+
+@class Entity;
+
+
+@interface OOPhysicsStore: NSObject
+{
+@private
+	NSUInteger				_count;
+	NSUInteger				_capacity;
+
+	Entity					**_entities;
+
+	// State, gathered by -integrate: and updated in place.
+	OOHPScalar				*_px, *_py, *_pz;
+	OOScalar				*_qw, *_qx, *_qy, *_qz;
+	OOScalar				*_vx, *_vy, *_vz;
+
+	// Motion recorded during the update.
+	OOScalar				*_rw, *_rx, *_ry, *_rz;		// Rotation to apply, left-multiplied.
+	OOHPScalar				*_forward;					// Distance along the rotated forward axis.
+	uint8_t					*_flags;
+}
+
+/*	Forget all entities. Slots handed out before this must not be used
+	again.
+*/
+- (void) removeAllEntities;
+
+@property (readonly) NSUInteger count;
+
+/*	Add an entity, returning its slot: its index plus one, so that 0 can
+	mean "no slot". Entities are retained until -removeAllEntities, so that
+	one left behind by an exception can still be finished.
+*/
+- (NSUInteger) addEntity:(Entity *)entity;
+
+- (Entity *) entityAtIndex:(NSUInteger)index;
+
+// Recording. Repeated calls in one update accumulate.
+- (void) addRotation:(Quaternion)rotation atSlot:(NSUInteger)slot;
+- (void) addForwardDistance:(double)distance atSlot:(NSUInteger)slot;
+- (void) setDriftsAtSlot:(NSUInteger)slot;
+
+/*	Gather each entity's position, orientation and velocity, and apply its
+	recorded motion.
+*/
+- (void) integrate:(OOTimeDelta)delta_t;
+
+/*	Results of -integrate:. The orientation is not normalized, and
+	*outRotated and *outMoved say whether any rotation or movement was
+	recorded.
+*/
+- (void) getPosition:(HPVector *)outPosition
+		 orientation:(Quaternion *)outOrientation
+			 rotated:(BOOL *)outRotated
+			   moved:(BOOL *)outMoved
+			  atSlot:(NSUInteger)slot;
+
+@end
+
+
+#ifndef NDEBUG
+/*	Integrate 1000 synthetic entities for 600 frames, once with per-object
+	messages as in the serial update and once through the store, and compare
+	the time per entity and the results. Logged under
+	"entity.physicsStore.benchmark" and returned as a string.
+*/
+NSString *OOPhysicsStoreRunBenchmark(void);
+#endif
@@ -0,0 +1,426 @@
+/*
+
+OOPhysicsStore.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOPhysicsStore.h"
+#import "Entity.h"
+
+#ifndef NDEBUG
+#import "OOProfilingStopwatch.h"
+#endif
+
+
+enum
+{
+	kFlagRotated				= 0x01,
+	kFlagMovedForward			= 0x02,
+	kFlagDrifts					= 0x04
+};
+
+
+@interface OOPhysicsStore ()
+
+- (void) reserveEntities:(NSUInteger)count;
+
+@end
+
+
+static void IntegrateOrientations(NSUInteger count, OOScalar *qw, OOScalar *qx, OOScalar *qy, OOScalar *qz, const OOScalar *rw, const OOScalar *rx, const OOScalar *ry, const OOScalar *rz);
+static void GetForwardVectors(NSUInteger count, const OOScalar *qw, const OOScalar *qx, const OOScalar *qy, const OOScalar *qz, const uint8_t *flags, OOScalar *fx, OOScalar *fy, OOScalar *fz);
+static void IntegratePositions(NSUInteger count, OOHPScalar *px, OOHPScalar *py, OOHPScalar *pz, const OOScalar *fx, const OOScalar *fy, const OOScalar *fz, const OOHPScalar *forward, const OOScalar *vx, const OOScalar *vy, const OOScalar *vz, const uint8_t *flags, OOHPScalar delta_t);
+
+
+@implementation OOPhysicsStore
+
+- (void) dealloc
+{
+	[self removeAllEntities];
+	free(_entities);
+	free(_px);  free(_py);  free(_pz);
+	free(_qw);  free(_qx);  free(_qy);  free(_qz);
+	free(_vx);  free(_vy);  free(_vz);
+	free(_rw);  free(_rx);  free(_ry);  free(_rz);
+	free(_forward);
+	free(_flags);
+
+	[super dealloc];
+}
+
+
+- (NSString *) description
+{
+	return [NSString stringWithFormat:@"<%@ %p>{%lu entities}", [self class], self, _count];
+}
+
+
+- (void) removeAllEntities
+{
+	NSUInteger i;
+	for (i = 0; i < _count; i++)  [_entities[i] release];
+	_count = 0;
+}
+
+
+- (NSUInteger) count
+{
+	return _count;
+}
+
+
+- (NSUInteger) addEntity:(Entity *)entity
+{
+	NSParameterAssert(entity != nil);
+
+	[self reserveEntities:_count + 1];
+
+	NSUInteger i = _count++;
+	_entities[i] = [entity retain];
+	_rw[i] = 1.0f;
+	_rx[i] = _ry[i] = _rz[i] = 0.0f;
+	_forward[i] = 0.0;
+	_flags[i] = 0;
+
+	return i + 1;
+}
+
+
+- (Entity *) entityAtIndex:(NSUInteger)index
+{
+	NSParameterAssert(index < _count);
+	return _entities[index];
+}
+
+
+- (void) addRotation:(Quaternion)rotation atSlot:(NSUInteger)slot
+{
+	NSParameterAssert(slot != 0 && slot <= _count);
+	NSUInteger i = slot - 1;
+
+	/*	The serial path normalizes after every rotation, so a product of
+		rotations would not round the same way. Instead, a rotation already
+		recorded is applied to the entity now, as -applyRoll:climb:andYaw:
+		would have, and only the latest one is left for the kernel.
+	*/
+	if (_flags[i] & kFlagRotated)
+	{
+		Entity *entity = _entities[i];
+		entity->orientation = quaternion_multiply(make_quaternion(_rw[i], _rx[i], _ry[i], _rz[i]), entity->orientation);
+		[entity orientationChanged];
+	}
+
+	_rw[i] = rotation.w;  _rx[i] = rotation.x;  _ry[i] = rotation.y;  _rz[i] = rotation.z;
+	_flags[i] |= kFlagRotated;
+}
+
+
+- (void) addForwardDistance:(double)distance atSlot:(NSUInteger)slot
+{
+	NSParameterAssert(slot != 0 && slot <= _count);
+	_forward[slot - 1] += distance;
+	_flags[slot - 1] |= kFlagMovedForward;
+}
+
+
+- (void) setDriftsAtSlot:(NSUInteger)slot
+{
+	NSParameterAssert(slot != 0 && slot <= _count);
+	_flags[slot - 1] |= kFlagDrifts;
+}
+
+
+- (void) integrate:(OOTimeDelta)delta_t
+{
+	NSUInteger		i, count = _count;
+	if (count == 0)  return;
+
+	// Gather. This is the only pass that touches the entities.
+	for (i = 0; i < count; i++)
+	{
+		Entity *entity = _entities[i];
+		Quaternion q = entity->orientation;
+		Vector v = [entity velocity];
+
+		_px[i] = entity->position.x;  _py[i] = entity->position.y;  _pz[i] = entity->position.z;
+		_qw[i] = q.w;  _qx[i] = q.x;  _qy[i] = q.y;  _qz[i] = q.z;
+		_vx[i] = v.x;  _vy[i] = v.y;  _vz[i] = v.z;
+	}
+
+	OOScalar *forward = malloc(count * 3 * sizeof *forward);
+	if (EXPECT_NOT(forward == NULL))  [NSException raise:NSMallocException format:@"Failed to allocate memory for physics integration."];
+
+	OOScalar *fx = forward, *fy = forward + count, *fz = forward + 2 * count;
+
+	IntegrateOrientations(count, _qw, _qx, _qy, _qz, _rw, _rx, _ry, _rz);
+	GetForwardVectors(count, _qw, _qx, _qy, _qz, _flags, fx, fy, fz);
+	IntegratePositions(count, _px, _py, _pz, fx, fy, fz, _forward, _vx, _vy, _vz, _flags, delta_t);
+
+	free(forward);
+}
+
+
+- (void) getPosition:(HPVector *)outPosition
+		 orientation:(Quaternion *)outOrientation
+			 rotated:(BOOL *)outRotated
+			   moved:(BOOL *)outMoved
+			  atSlot:(NSUInteger)slot
+{
+	NSParameterAssert(slot != 0 && slot <= _count);
+	NSUInteger i = slot - 1;
+
+	*outPosition = make_HPvector(_px[i], _py[i], _pz[i]);
+	*outOrientation = make_quaternion(_qw[i], _qx[i], _qy[i], _qz[i]);
+	*outRotated = (_flags[i] & kFlagRotated) != 0;
+	*outMoved = (_flags[i] & (kFlagMovedForward | kFlagDrifts)) != 0;
+}
+
+
+- (void) reserveEntities:(NSUInteger)count
+{
+	if (count <= _capacity)  return;
+
+	NSUInteger capacity = MAX(count, MAX(_capacity * 2, (NSUInteger)64));
+	BOOL OK = YES;
+
+#define GROW(array)  do { void *grown = realloc(array, capacity * sizeof *array); if (grown != NULL)  array = grown; else  OK = NO; } while (0)
+	GROW(_entities);
+	GROW(_px);  GROW(_py);  GROW(_pz);
+	GROW(_qw);  GROW(_qx);  GROW(_qy);  GROW(_qz);
+	GROW(_vx);  GROW(_vy);  GROW(_vz);
+	GROW(_rw);  GROW(_rx);  GROW(_ry);  GROW(_rz);
+	GROW(_forward);
+	GROW(_flags);
+#undef GROW
+
+	if (!OK)  [NSException raise:NSMallocException format:@"Failed to allocate memory for physics store."];
+	_capacity = capacity;
+}
+
+@end
+
+
+/*	orientation = rotation * orientation, as quaternion_multiply(). The
+	rotation is the identity for entities that did not turn, which leaves
+	their orientation unchanged; applying it anyway keeps the loop free of
+	branches so that it vectorizes.
+*/
+static void IntegrateOrientations(NSUInteger count, OOScalar *qw, OOScalar *qx, OOScalar *qy, OOScalar *qz, const OOScalar *rw, const OOScalar *rx, const OOScalar *ry, const OOScalar *rz)
+{
+	NSUInteger i;
+
+	for (i = 0; i < count; i++)
+	{
+		OOScalar w = rw[i] * qw[i] - rx[i] * qx[i] - ry[i] * qy[i] - rz[i] * qz[i];
+		OOScalar x = rw[i] * qx[i] + rx[i] * qw[i] + ry[i] * qz[i] - rz[i] * qy[i];
+		OOScalar y = rw[i] * qy[i] + ry[i] * qw[i] + rz[i] * qx[i] - rx[i] * qz[i];
+		OOScalar z = rw[i] * qz[i] + rz[i] * qw[i] + rx[i] * qy[i] - ry[i] * qx[i];
+		qw[i] = w;  qx[i] = x;  qy[i] = y;  qz[i] = z;
+	}
+}
+
+
+/*	Forward vectors of the normalized orientations, as -[Entity moveForward:]
+	sees them after -orientationChanged. Only needed for entities that move
+	forward; the rest get a zero vector.
+*/
+static void GetForwardVectors(NSUInteger count, const OOScalar *qw, const OOScalar *qx, const OOScalar *qy, const OOScalar *qz, const uint8_t *flags, OOScalar *fx, OOScalar *fy, OOScalar *fz)
+{
+	NSUInteger i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (flags[i] & kFlagMovedForward)
+		{
+			Quaternion q = make_quaternion(qw[i], qx[i], qy[i], qz[i]);
+			quaternion_normalize(&q);
+			Vector f = vector_forward_from_quaternion(q);
+			fx[i] = f.x;  fy[i] = f.y;  fz[i] = f.z;
+		}
+		else
+		{
+			fx[i] = fy[i] = fz[i] = 0.0f;
+		}
+	}
+}
+
+
+/*	position += forward * distance, then position += velocity * delta_t for
+	entities that drift. The two steps are added separately, in single
+	precision widened to double, as -moveForward: and -applyVelocity: do, so
+	that rounding matches.
+*/
+static void IntegratePositions(NSUInteger count, OOHPScalar *px, OOHPScalar *py, OOHPScalar *pz, const OOScalar *fx, const OOScalar *fy, const OOScalar *fz, const OOHPScalar *forward, const OOScalar *vx, const OOScalar *vy, const OOScalar *vz, const uint8_t *flags, OOHPScalar delta_t)
+{
+	NSUInteger i;
+
+	for (i = 0; i < count; i++)
+	{
+		OOHPScalar distance = forward[i];
+		OOHPScalar drift = (flags[i] & kFlagDrifts) ? delta_t : 0.0;
+
+		px[i] = px[i] + (OOHPScalar)fx[i] * distance;
+		py[i] = py[i] + (OOHPScalar)fy[i] * distance;
+		pz[i] = pz[i] + (OOHPScalar)fz[i] * distance;
+
+		px[i] = px[i] + (OOHPScalar)vx[i] * drift;
+		py[i] = py[i] + (OOHPScalar)vy[i] * drift;
+		pz[i] = pz[i] + (OOHPScalar)vz[i] * drift;
+	}
+}
+
+
+#ifndef NDEBUG
+
+enum
+{
+	kBenchmarkEntityCount		= 1000,
+	kBenchmarkFrameCount		= 600
+};
+
+
+static uint32_t BenchmarkRandom(uint32_t *state)
+{
+	*state = *state * 1664525 + 1013904223;
+	return *state >> 8;
+}
+
+
+static double BenchmarkRandomUnit(uint32_t *state)
+{
+	return (double)BenchmarkRandom(state) / (double)(1 << 24);
+}
+
+
+static Quaternion BenchmarkRotation(GLfloat roll, GLfloat climb, GLfloat yaw)
+{
+	Quaternion q1 = kIdentityQuaternion;
+	quaternion_rotate_about_z(&q1, -roll);
+	quaternion_rotate_about_x(&q1, -climb);
+	quaternion_rotate_about_y(&q1, -yaw);
+	return q1;
+}
+
+
+/*	Every third entity turns twice per frame, as a ship does when its AI
+	adjusts its attitude after the flight controls have been applied.
+*/
+static BOOL BenchmarkTurnsTwice(NSUInteger index)
+{
+	return (index % 3) == 0;
+}
+
+
+NSString *OOPhysicsStoreRunBenchmark(void)
+{
+	NSAutoreleasePool		*pool = [[NSAutoreleasePool alloc] init];
+	uint32_t				seed = 0x50A50A;
+	NSMutableArray			*serialEntities = [NSMutableArray arrayWithCapacity:kBenchmarkEntityCount];
+	NSMutableArray			*batchEntities = [NSMutableArray arrayWithCapacity:kBenchmarkEntityCount];
+	GLfloat					*rates = malloc(kBenchmarkEntityCount * 3 * sizeof *rates);
+	double					*speeds = malloc(kBenchmarkEntityCount * sizeof *speeds);
+	OOPhysicsStore			*store = [[OOPhysicsStore alloc] init];
+	OOProfilingStopwatch	*stopwatch = [OOProfilingStopwatch stopwatch];
+	OOTimeDelta				delta_t = 1.0 / 60.0, serialTime = 0, batchTime = 0;
+	NSUInteger				i, frame, mismatches = 0;
+
+	for (i = 0; i < kBenchmarkEntityCount; i++)
+	{
+		Entity *serial = [[Entity alloc] init];
+		Entity *batch = [[Entity alloc] init];
+		HPVector position = make_HPvector((BenchmarkRandomUnit(&seed) - 0.5) * 50000.0, (BenchmarkRandomUnit(&seed) - 0.5) * 50000.0, (BenchmarkRandomUnit(&seed) - 0.5) * 50000.0);
+		Vector velocity = make_vector((BenchmarkRandomUnit(&seed) - 0.5) * 100.0, (BenchmarkRandomUnit(&seed) - 0.5) * 100.0, (BenchmarkRandomUnit(&seed) - 0.5) * 100.0);
+
+		[serial setPosition:position];  [batch setPosition:position];
+		[serial setVelocity:velocity];  [batch setVelocity:velocity];
+		[serialEntities addObject:serial];  [batchEntities addObject:batch];
+		[serial release];  [batch release];
+
+		rates[i * 3] = (BenchmarkRandomUnit(&seed) - 0.5) * 2.0;
+		rates[i * 3 + 1] = (BenchmarkRandomUnit(&seed) - 0.5) * 1.0;
+		rates[i * 3 + 2] = (BenchmarkRandomUnit(&seed) - 0.5) * 0.5;
+		speeds[i] = BenchmarkRandomUnit(&seed) * 400.0;
+	}
+
+	for (frame = 0; frame < kBenchmarkFrameCount; frame++)
+	{
+		[stopwatch reset];
+		for (i = 0; i < kBenchmarkEntityCount; i++)
+		{
+			Entity *entity = [serialEntities objectAtIndex:i];
+			Quaternion q1 = BenchmarkRotation(rates[i * 3] * delta_t, rates[i * 3 + 1] * delta_t, rates[i * 3 + 2] * delta_t);
+			[entity setOrientation:quaternion_multiply(q1, [entity orientation])];
+			if (BenchmarkTurnsTwice(i))
+			{
+				q1 = BenchmarkRotation(rates[i * 3 + 2] * delta_t, 0.0f, rates[i * 3] * delta_t);
+				[entity setOrientation:quaternion_multiply(q1, [entity orientation])];
+			}
+			[entity moveForward:delta_t * speeds[i]];
+			[entity applyVelocity:delta_t];
+		}
+		serialTime += [stopwatch reset];
+
+		[store removeAllEntities];
+		for (i = 0; i < kBenchmarkEntityCount; i++)
+		{
+			Entity *entity = [batchEntities objectAtIndex:i];
+			[entity beginBatchIntegrationInStore:store];
+			[store addRotation:BenchmarkRotation(rates[i * 3] * delta_t, rates[i * 3 + 1] * delta_t, rates[i * 3 + 2] * delta_t) atSlot:i + 1];
+			if (BenchmarkTurnsTwice(i))
+			{
+				[store addRotation:BenchmarkRotation(rates[i * 3 + 2] * delta_t, 0.0f, rates[i * 3] * delta_t) atSlot:i + 1];
+			}
+			[entity moveForward:delta_t * speeds[i]];
+			[entity applyVelocity:delta_t];
+		}
+		[store integrate:delta_t];
+		for (i = 0; i < kBenchmarkEntityCount; i++)
+		{
+			[[batchEntities objectAtIndex:i] finishBatchIntegration];
+		}
+		batchTime += [stopwatch reset];
+	}
+
+	for (i = 0; i < kBenchmarkEntityCount; i++)
+	{
+		Entity *serial = [serialEntities objectAtIndex:i];
+		Entity *batch = [batchEntities objectAtIndex:i];
+		if (!HPvector_equal(serial->position, batch->position) || !quaternion_equal(serial->orientation, batch->orientation))  mismatches++;
+	}
+
+	double scale = 1e9 / ((double)kBenchmarkEntityCount * kBenchmarkFrameCount);
+	NSString *result = [NSString stringWithFormat:@"%u entities (a third turning twice) for %u frames: per-object %.1f ns/entity, physics store %.1f ns/entity (%.2fx)%@",
+						kBenchmarkEntityCount, kBenchmarkFrameCount,
+						serialTime * scale, batchTime * scale, (batchTime > 0) ? serialTime / batchTime : 0.0,
+						(mismatches == 0) ? @"" : [NSString stringWithFormat:@" ** %lu MISMATCHES **", mismatches]];
+	OOLog(@"entity.physicsStore.benchmark", @"%@", result);
+
+	[result retain];
+	[store release];
+	free(rates);
+	free(speeds);
+	[pool release];
+
+	return [result autorelease];
+}
+
+#endif
@@ -0,0 +1,96 @@
+/*
+
+OOShadowCache.h
+
+Cheap rejection of sun-occlusion tests, for -[CollisionRegion
+findShadowedEntities].
+
+An occluder can only shade an entity if the occluder's sphere touches the
+ray from the entity towards the sun; this "cone test" is a dot product and
+a few multiplies, and rejects most occluders before the trigonometry of
+shadowAtPointOcclusionToValue(). The distance by which an occluder misses
+the ray is its clearance. Since the sun is far away and most things move
+little between frames, a rejection stays valid until the entity and
+occluder have moved far enough relative to each other to use up the
+clearance, so rejections are cached by (entity, occluder) pair and not
+re-tested until then.
+
+Only rejections are cached. Pairs that pass the cone test get the full test
+every time, as does the last occluder of a shaded entity.
+
+This class is *not* thread-safe.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCocoa.h"
+#import "OOMaths.h"
+#import "OOTypes.h"
+
+@class Entity;
+
+
+typedef struct OOShadowCacheEntry
+{
+	OOUniversalID			entityID;			// NO_TARGET for an empty slot.
+	OOUniversalID			occluderID;
+	uint32_t				lastUsedFrame;
+	GLfloat					clearance;			// Metres by which the occluder missed the ray.
+	GLfloat					occluderRadius;
+	HPVector				entityPosition;		// Positions when the clearance was measured.
+	HPVector				occluderPosition;
+} OOShadowCacheEntry;
+
+
+@interface OOShadowCache: NSObject
+{
+@private
+	OOShadowCacheEntry		*_entries;
+	NSUInteger				_capacity;			// Power of two.
+	NSUInteger				_count;
+	uint32_t				_frame;
+	HPVector				_sunPosition;
+
+	NSUInteger				_cacheHits, _coneRejections, _fullTests;
+	NSUInteger				_lastCacheHits, _lastConeRejections, _lastFullTests;
+}
+
+/*	Start a frame: move this frame's counts to the last-frame counts, and
+	drop entries which were not used in the previous frame if the table is
+	getting full.
+*/
+- (void) beginFrameWithSunPosition:(HPVector)sunPosition;
+
+/*	YES if occluder certainly cannot shade entity, either because a cached
+	rejection is still valid or because the occluder misses the ray to the
+	sun. NO means the caller must do the full test, which is counted.
+*/
+- (BOOL) occluder:(Entity *)occluder cannotShadeEntity:(Entity *)entity;
+
+// Count a full occlusion test made without asking the cache first.
+- (void) noteFullTest;
+
+// Statistics for the last complete frame.
+@property (readonly) NSUInteger cacheHits;
+@property (readonly) NSUInteger coneRejections;
+@property (readonly) NSUInteger fullTests;
+
+@end
@@ -0,0 +1,277 @@
+/*
+
+OOShadowCache.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOShadowCache.h"
+#import "Entity.h"
+
+
+enum
+{
+	kInitialCapacity			= 256
+};
+
+/*	shadowAtPointOcclusionToValue() works in single precision; keep well
+	clear of any case it could call a shadow.
+*/
+#define kClearanceScale			1.001
+#define kClearanceMargin		1.0		// Metres.
+
+
+@interface OOShadowCache ()
+
+- (OOShadowCacheEntry *) entryForEntityID:(OOUniversalID)entityID occluderID:(OOUniversalID)occluderID create:(BOOL)create;
+- (void) rehashWithCapacity:(NSUInteger)capacity keepingUnusedEntries:(BOOL)keepUnused;
+
+@end
+
+
+static OOShadowCacheEntry *FindSlot(OOShadowCacheEntry *entries, NSUInteger capacity, OOUniversalID entityID, OOUniversalID occluderID);
+
+
+OOINLINE NSUInteger HashPair(OOUniversalID entityID, OOUniversalID occluderID)
+{
+	return (entityID * 0x9E3779B1U) ^ (occluderID * 0x85EBCA77U);
+}
+
+
+/*	Distance from the occluder's sphere to the ray from point towards the
+	sun; positive if they don't touch. The ray is not a cone, but
+	shadowAtPointOcclusionToValue() narrows the occluder's apparent size by
+	the sun's, so an occluder that misses the ray can't shade the point.
+	This also covers the case of a point inside a ship's radius but nearer
+	the sun, since the ray's start is then inside the sphere.
+*/
+static OOHPScalar RayClearance(HPVector point, HPVector occluderPosition, OOHPScalar occluderRadius, HPVector sunPosition)
+{
+	HPVector toOccluder = HPvector_subtract(occluderPosition, point);
+	HPVector toSun = HPvector_normal_or_zbasis(HPvector_subtract(sunPosition, point));
+	OOHPScalar along = HPdot_product(toOccluder, toSun);
+	OOHPScalar distance;
+
+	if (along <= 0)  distance = HPmagnitude(toOccluder);
+	else  distance = HPmagnitude(HPtrue_cross_product(toOccluder, toSun));
+
+	return distance - (occluderRadius * kClearanceScale + kClearanceMargin);
+}
+
+
+@implementation OOShadowCache
+
+- (void) dealloc
+{
+	free(_entries);
+
+	[super dealloc];
+}
+
+
+- (NSString *) description
+{
+	return [NSString stringWithFormat:@"<%@ %p>{%lu entries}", [self class], self, _count];
+}
+
+
+- (void) beginFrameWithSunPosition:(HPVector)sunPosition
+{
+	_lastCacheHits = _cacheHits;
+	_lastConeRejections = _coneRejections;
+	_lastFullTests = _fullTests;
+	_cacheHits = _coneRejections = _fullTests = 0;
+	_frame++;
+
+	if (!HPvector_equal(sunPosition, _sunPosition))
+	{
+		// New system, most likely.
+		_sunPosition = sunPosition;
+		if (_entries != NULL)  memset(_entries, 0, _capacity * sizeof *_entries);
+		_count = 0;
+	}
+	else if (_count * 2 >= _capacity)
+	{
+		// Drop stale entries, leaving room for the live ones to double.
+		NSUInteger i, live = 0, capacity = kInitialCapacity;
+		for (i = 0; i < _capacity; i++)
+		{
+			if (_entries[i].entityID != NO_TARGET && _entries[i].lastUsedFrame + 1 >= _frame)  live++;
+		}
+		while (capacity < live * 4)  capacity *= 2;
+		[self rehashWithCapacity:capacity keepingUnusedEntries:NO];
+	}
+}
+
+
+- (BOOL) occluder:(Entity *)occluder cannotShadeEntity:(Entity *)entity
+{
+	OOUniversalID			entityID = [entity universalID];
+	OOUniversalID			occluderID = [occluder universalID];
+	GLfloat					occluderRadius = occluder->collision_radius;
+	HPVector				position = entity->position;
+	HPVector				occluderPosition = occluder->position;
+	OOShadowCacheEntry		*entry = NULL;
+
+	if (entityID != NO_TARGET && occluderID != NO_TARGET)
+	{
+		entry = [self entryForEntityID:entityID occluderID:occluderID create:NO];
+	}
+
+	if (entry != NULL && entry->occluderRadius == occluderRadius)
+	{
+		/*	The occluder has moved relative to the point by drift, and the ray
+			to the sun has turned by an angle whose sine is at most turn. The
+			part of the ray nearest the occluder is no further from the point
+			than the occluder is, and has moved at most 2 sin(angle/2) < 2 turn
+			times that distance.
+		*/
+		HPVector relative = HPvector_subtract(occluderPosition, position);
+		HPVector oldRelative = HPvector_subtract(entry->occluderPosition, entry->entityPosition);
+		OOHPScalar drift = sqrt(HPdistance2(relative, oldRelative));
+		OOHPScalar moved = sqrt(HPdistance2(position, entry->entityPosition));
+		OOHPScalar sunDistance = sqrt(HPdistance2(position, _sunPosition));
+
+		if (moved < sunDistance)
+		{
+			OOHPScalar turn = moved / (sunDistance - moved);
+			if (drift + 2.0 * turn * HPmagnitude(relative) < entry->clearance)
+			{
+				entry->lastUsedFrame = _frame;
+				_cacheHits++;
+				return YES;
+			}
+		}
+	}
+
+	OOHPScalar clearance = RayClearance(position, occluderPosition, occluderRadius, _sunPosition);
+	if (clearance > 0)
+	{
+		if (entry == NULL && entityID != NO_TARGET && occluderID != NO_TARGET)
+		{
+			entry = [self entryForEntityID:entityID occluderID:occluderID create:YES];
+		}
+		if (entry != NULL)
+		{
+			entry->lastUsedFrame = _frame;
+			entry->clearance = clearance;
+			entry->occluderRadius = occluderRadius;
+			entry->entityPosition = position;
+			entry->occluderPosition = occluderPosition;
+		}
+		_coneRejections++;
+		return YES;
+	}
+
+	_fullTests++;
+	return NO;
+}
+
+
+- (void) noteFullTest
+{
+	_fullTests++;
+}
+
+
+- (NSUInteger) cacheHits
+{
+	return _lastCacheHits;
+}
+
+
+- (NSUInteger) coneRejections
+{
+	return _lastConeRejections;
+}
+
+
+- (NSUInteger) fullTests
+{
+	return _lastFullTests;
+}
+
+
+- (OOShadowCacheEntry *) entryForEntityID:(OOUniversalID)entityID occluderID:(OOUniversalID)occluderID create:(BOOL)create
+{
+	if (create && (_count + 1) * 2 > _capacity)
+	{
+		[self rehashWithCapacity:MAX(_capacity * 2, (NSUInteger)kInitialCapacity) keepingUnusedEntries:YES];
+	}
+	if (_capacity == 0)  return NULL;
+
+	OOShadowCacheEntry *entry = FindSlot(_entries, _capacity, entityID, occluderID);
+	if (entry->entityID == NO_TARGET)
+	{
+		if (!create)  return NULL;
+
+		entry->entityID = entityID;
+		entry->occluderID = occluderID;
+		_count++;
+	}
+	return entry;
+}
+
+
+- (void) rehashWithCapacity:(NSUInteger)capacity keepingUnusedEntries:(BOOL)keepUnused
+{
+	OOShadowCacheEntry		*oldEntries = _entries;
+	NSUInteger				i, oldCapacity = _capacity;
+
+	_entries = calloc(capacity, sizeof *_entries);
+	if (_entries == NULL)
+	{
+		_entries = oldEntries;
+		[NSException raise:NSMallocException format:@"Failed to allocate memory for shadow cache."];
+	}
+	_capacity = capacity;
+	_count = 0;
+
+	for (i = 0; i < oldCapacity; i++)
+	{
+		OOShadowCacheEntry *old = &oldEntries[i];
+		if (old->entityID == NO_TARGET)  continue;
+		// Entries not used this frame or last belong to entities that have gone or stopped moving.
+		if (!keepUnused && old->lastUsedFrame + 1 < _frame)  continue;
+
+		*FindSlot(_entries, _capacity, old->entityID, old->occluderID) = *old;
+		_count++;
+	}
+
+	free(oldEntries);
+}
+
+@end
+
+
+// Find the entry for a pair, or the empty slot where it belongs. The table is never more than half full, so there is always a gap.
+static OOShadowCacheEntry *FindSlot(OOShadowCacheEntry *entries, NSUInteger capacity, OOUniversalID entityID, OOUniversalID occluderID)
+{
+	NSUInteger mask = capacity - 1;
+	NSUInteger i = HashPair(entityID, occluderID) & mask;
+
+	for (;;)
+	{
+		OOShadowCacheEntry *entry = &entries[i];
+		if (entry->entityID == NO_TARGET || (entry->entityID == entityID && entry->occluderID == occluderID))  return entry;
+		i = (i + 1) & mask;
+	}
+}
@@ -0,0 +1,113 @@
+/*
+
+OOShipBVH.h
+
+Bounding volume hierarchy over ship bounding spheres, for laser hit-scans.
+
+The tree is rebuilt from scratch with a median split on the longest axis of
+the centroid bounds, down to leaves of a few ships each. Nodes hold axis-
+aligned boxes around the spheres of the ships below them. A ray query walks
+the tree front to back with an explicit stack, skipping any node whose box
+starts beyond the current range; the callback is asked about each ship in a
+leaf that survives, and may shorten the range when it finds a hit, which
+prunes the rest of the walk.
+
+-[Universe firstShipHitByLaserFromShip:...] builds one tree per update, the
+first time a laser is fired. Ships keep moving while the update runs, so each
+sphere is padded by the distance its ship can cover in one frame; the
+callback must test against current positions.
+
+This class is *not* thread-safe.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCocoa.h"
+#import "OOMaths.h"
+
+@class ShipEntity;
+
+
+/*	Called for each body in a leaf the ray reaches. range is the current
+	range; return it unchanged for a miss, or the (smaller) distance of a hit.
+*/
+typedef GLfloat (*OOShipBVHRayCallback)(void *context, NSUInteger bodyIndex, GLfloat range);
+
+
+typedef struct OOShipBVHNode
+{
+	OOHPScalar				min[3], max[3];
+	uint32_t				first;		// Leaf: first entry in _order. Inner node: index of first child; the second follows it.
+	uint32_t				count;		// Leaf: number of bodies. Inner node: 0.
+} OOShipBVHNode;
+
+
+@interface OOShipBVH: NSObject
+{
+@private
+	// Body data, indexed by body index.
+	NSUInteger				_count;
+	NSUInteger				_capacity;
+	HPVector				*_centres;
+	GLfloat					*_radii;
+	ShipEntity				**_ships;
+
+	uint32_t				*_order;
+	OOShipBVHNode			*_nodes;
+	NSUInteger				_nodeCount;
+
+	NSUInteger				_candidateTests;
+}
+
+/*	Rebuild the tree from the given ships. Each sphere is padded by the
+	distance the ship covers in motionTime at its current speed. Ships are
+	not retained.
+*/
+- (void) rebuildWithShips:(ShipEntity **)ships count:(NSUInteger)count motionTime:(OOTimeDelta)motionTime;
+
+/*	Same, for synthetic data (benchmarks and tests). positions and radii must
+	each have count elements. -shipAtIndex: returns nil after this.
+*/
+- (void) rebuildWithPositions:(const HPVector *)positions radii:(const GLfloat *)radii count:(NSUInteger)count;
+
+/*	Walk the bodies whose boxes the ray origin + t * direction, 0 <= t <=
+	range, passes through, nearest node first. direction must be normalized.
+	Returns the range as finally shortened by the callback.
+*/
+- (GLfloat) castRayFrom:(HPVector)origin direction:(Vector)direction range:(GLfloat)range callback:(OOShipBVHRayCallback)callback context:(void *)context;
+
+@property (readonly) NSUInteger bodyCount;
+- (ShipEntity *) shipAtIndex:(NSUInteger)index;
+
+// Number of callbacks in the last ray cast.
+@property (readonly) NSUInteger candidateTestCount;
+
+@end
+
+
+#ifndef NDEBUG
+/*	Fire 10 000 random rays into 500 synthetic ships, with exact ray/sphere
+	tests standing in for the octree, and compare the tree against testing
+	every ship. Results are logged under "collision.laserBVH.benchmark" and
+	returned as a string.
+*/
+NSString *OOShipBVHRunBenchmark(void);
+#endif
@@ -0,0 +1,485 @@
+/*
+
+OOShipBVH.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOShipBVH.h"
+#import "ShipEntity.h"
+#import "OOProfilingStopwatch.h"
+
+
+enum
+{
+	kLeafSize				= 4,
+	kMaxTraversalDepth		= 64		// Median splits halve the body count, so this is never reached.
+};
+
+/*	Ships can speed up during the frame, and the frame's delta_t is not quite
+	the time between this update's build and the last laser fired in it.
+*/
+#define kMotionSlack		1.5f
+
+
+typedef struct
+{
+	uint32_t				node;
+	OOHPScalar				entry;
+} TraversalEntry;
+
+
+@interface OOShipBVH ()
+
+- (void) reserveBodies:(NSUInteger)count;
+- (void) build;
+
+@end
+
+
+@implementation OOShipBVH
+
+- (void) dealloc
+{
+	free(_centres);
+	free(_radii);
+	free(_ships);
+	free(_order);
+	free(_nodes);
+
+	[super dealloc];
+}
+
+
+- (NSString *) description
+{
+	return [NSString stringWithFormat:@"<%@ %p>{%lu bodies, %lu nodes}", [self class], self, _count, _nodeCount];
+}
+
+
+- (void) rebuildWithShips:(ShipEntity **)ships count:(NSUInteger)count motionTime:(OOTimeDelta)motionTime
+{
+	NSUInteger		i;
+
+	[self reserveBodies:count];
+
+	for (i = 0; i < count; i++)
+	{
+		ShipEntity *ship = ships[i];
+		_ships[i] = ship;
+		_centres[i] = ship->position;
+		_radii[i] = ship->collision_radius + kMotionSlack * [ship speed] * motionTime;
+	}
+
+	_count = count;
+	[self build];
+}
+
+
+- (void) rebuildWithPositions:(const HPVector *)positions radii:(const GLfloat *)radii count:(NSUInteger)count
+{
+	NSUInteger		i;
+
+	[self reserveBodies:count];
+
+	for (i = 0; i < count; i++)
+	{
+		_ships[i] = nil;
+		_centres[i] = positions[i];
+		_radii[i] = radii[i];
+	}
+
+	_count = count;
+	[self build];
+}
+
+
+- (NSUInteger) bodyCount
+{
+	return _count;
+}
+
+
+- (ShipEntity *) shipAtIndex:(NSUInteger)index
+{
+	if (EXPECT_NOT(index >= _count))  return nil;
+	return _ships[index];
+}
+
+
+- (NSUInteger) candidateTestCount
+{
+	return _candidateTests;
+}
+
+
+- (void) reserveBodies:(NSUInteger)count
+{
+	if (count <= _capacity)  return;
+
+	NSUInteger capacity = MAX(count, _capacity * 2);
+	_centres = realloc(_centres, capacity * sizeof *_centres);
+	_radii = realloc(_radii, capacity * sizeof *_radii);
+	_ships = realloc(_ships, capacity * sizeof *_ships);
+	_order = realloc(_order, capacity * sizeof *_order);
+	_nodes = realloc(_nodes, 2 * capacity * sizeof *_nodes);
+
+	if (_centres == NULL || _radii == NULL || _ships == NULL || _order == NULL || _nodes == NULL)
+	{
+		[NSException raise:NSMallocException format:@"Failed to allocate memory for laser BVH."];
+	}
+	_capacity = capacity;
+}
+
+
+OOINLINE OOHPScalar CentreOnAxis(const HPVector *centre, unsigned axis)
+{
+	return (axis == 0) ? centre->x : (axis == 1) ? centre->y : centre->z;
+}
+
+
+// Partially sort order[start, end) so that order[nth] is the body it would hold in fully sorted order.
+static void SelectNth(const HPVector *centres, uint32_t *order, NSUInteger start, NSUInteger end, NSUInteger nth, unsigned axis)
+{
+	while (end - start > 1)
+	{
+		OOHPScalar pivot = CentreOnAxis(&centres[order[start + (end - start - 1) / 2]], axis);
+		NSUInteger i = start, j = end - 1;
+
+		for (;;)
+		{
+			while (CentreOnAxis(&centres[order[i]], axis) < pivot)  i++;
+			while (CentreOnAxis(&centres[order[j]], axis) > pivot)  j--;
+			if (i >= j)  break;
+
+			uint32_t temp = order[i];
+			order[i] = order[j];
+			order[j] = temp;
+			i++;
+			j--;
+		}
+
+		if (nth <= j)  end = j + 1;
+		else  start = j + 1;
+	}
+}
+
+
+static void BuildNode(OOShipBVH *self, uint32_t nodeIndex, NSUInteger start, NSUInteger end)
+{
+	OOShipBVHNode	*node = &self->_nodes[nodeIndex];
+	OOHPScalar		centreMin[3], centreMax[3];
+	NSUInteger		i;
+	unsigned		axis;
+
+	for (axis = 0; axis < 3; axis++)
+	{
+		node->min[axis] = centreMin[axis] = INFINITY;
+		node->max[axis] = centreMax[axis] = -INFINITY;
+	}
+
+	for (i = start; i < end; i++)
+	{
+		uint32_t body = self->_order[i];
+		OOHPScalar radius = self->_radii[body];
+		for (axis = 0; axis < 3; axis++)
+		{
+			OOHPScalar c = CentreOnAxis(&self->_centres[body], axis);
+			node->min[axis] = fmin(node->min[axis], c - radius);
+			node->max[axis] = fmax(node->max[axis], c + radius);
+			centreMin[axis] = fmin(centreMin[axis], c);
+			centreMax[axis] = fmax(centreMax[axis], c);
+		}
+	}
+
+	// Split on the axis along which the centres are most spread out.
+	unsigned splitAxis = 0;
+	for (axis = 1; axis < 3; axis++)
+	{
+		if (centreMax[axis] - centreMin[axis] > centreMax[splitAxis] - centreMin[splitAxis])  splitAxis = axis;
+	}
+
+	if (end - start <= kLeafSize || centreMax[splitAxis] <= centreMin[splitAxis])
+	{
+		node->first = (uint32_t)start;
+		node->count = (uint32_t)(end - start);
+		return;
+	}
+
+	NSUInteger mid = start + (end - start) / 2;
+	SelectNth(self->_centres, self->_order, start, end, mid, splitAxis);
+
+	uint32_t children = (uint32_t)self->_nodeCount;
+	self->_nodeCount += 2;
+	node->first = children;
+	node->count = 0;
+
+	BuildNode(self, children, start, mid);
+	BuildNode(self, children + 1, mid, end);
+}
+
+
+- (void) build
+{
+	NSUInteger		i;
+
+	for (i = 0; i < _count; i++)  _order[i] = (uint32_t)i;
+
+	if (_count == 0)
+	{
+		_nodeCount = 0;
+		return;
+	}
+
+	_nodeCount = 1;
+	BuildNode(self, 0, 0, _count);
+}
+
+
+/*	Slab test. Returns the distance along the ray at which it enters the box,
+	or -1 if it misses the box within range.
+*/
+static OOHPScalar RayEntry(const OOShipBVHNode *node, const OOHPScalar origin[3], const OOHPScalar inverse[3], OOHPScalar range)
+{
+	OOHPScalar		tNear = 0.0, tFar = range;
+	unsigned		axis;
+
+	for (axis = 0; axis < 3; axis++)
+	{
+		if (isinf(inverse[axis]))
+		{
+			// Ray parallel to these faces.
+			if (origin[axis] < node->min[axis] || origin[axis] > node->max[axis])  return -1.0;
+			continue;
+		}
+
+		OOHPScalar t1 = (node->min[axis] - origin[axis]) * inverse[axis];
+		OOHPScalar t2 = (node->max[axis] - origin[axis]) * inverse[axis];
+		if (t1 > t2)
+		{
+			OOHPScalar temp = t1;
+			t1 = t2;
+			t2 = temp;
+		}
+
+		if (t1 > tNear)  tNear = t1;
+		if (t2 < tFar)  tFar = t2;
+		if (tNear > tFar)  return -1.0;
+	}
+
+	return tNear;
+}
+
+
+- (GLfloat) castRayFrom:(HPVector)origin direction:(Vector)direction range:(GLfloat)range callback:(OOShipBVHRayCallback)callback context:(void *)context
+{
+	NSParameterAssert(callback != NULL);
+
+	_candidateTests = 0;
+	if (_nodeCount == 0)  return range;
+
+	OOHPScalar o[3] = { origin.x, origin.y, origin.z };
+	OOHPScalar inverse[3] =
+	{
+		(direction.x != 0.0f) ? 1.0 / direction.x : INFINITY,
+		(direction.y != 0.0f) ? 1.0 / direction.y : INFINITY,
+		(direction.z != 0.0f) ? 1.0 / direction.z : INFINITY
+	};
+
+	TraversalEntry	stack[kMaxTraversalDepth];
+	NSUInteger		depth = 0;
+
+	OOHPScalar entry = RayEntry(&_nodes[0], o, inverse, range);
+	if (entry < 0.0)  return range;
+	stack[depth++] = (TraversalEntry){ 0, entry };
+
+	while (depth > 0)
+	{
+		TraversalEntry top = stack[--depth];
+		if (top.entry > range)  continue;	// A hit found since this was pushed is nearer.
+
+		const OOShipBVHNode *node = &_nodes[top.node];
+		if (node->count != 0)
+		{
+			NSUInteger i, end = node->first + node->count;
+			for (i = node->first; i < end; i++)
+			{
+				_candidateTests++;
+				range = callback(context, _order[i], range);
+			}
+			continue;
+		}
+
+		uint32_t nearChild = node->first, farChild = node->first + 1;
+		OOHPScalar nearEntry = RayEntry(&_nodes[nearChild], o, inverse, range);
+		OOHPScalar farEntry = RayEntry(&_nodes[farChild], o, inverse, range);
+		if (farEntry >= 0.0 && (nearEntry < 0.0 || farEntry < nearEntry))
+		{
+			uint32_t tempNode = nearChild;
+			nearChild = farChild;
+			farChild = tempNode;
+			OOHPScalar tempEntry = nearEntry;
+			nearEntry = farEntry;
+			farEntry = tempEntry;
+		}
+
+		// Push the far child first so the near one is popped first.
+		NSAssert(depth + 2 <= kMaxTraversalDepth, @"Laser BVH traversal stack overflow.");
+		if (farEntry >= 0.0)  stack[depth++] = (TraversalEntry){ farChild, farEntry };
+		if (nearEntry >= 0.0)  stack[depth++] = (TraversalEntry){ nearChild, nearEntry };
+	}
+
+	return range;
+}
+
+@end
+
+
+#ifndef NDEBUG
+
+/*	Synthetic dogfight: 500 ships at roughly the density of the collision
+	broadphase benchmark scene, with a few station-sized bodies mixed in.
+	Uses its own LCG so the game's random number generators are left alone.
+*/
+enum
+{
+	kBenchmarkShipCount		= 500,
+	kBenchmarkRayCount		= 10000
+};
+
+#define kBenchmarkRange		15000.0f
+
+
+typedef struct
+{
+	const HPVector			*positions;
+	const GLfloat			*radii;
+	HPVector				origin;
+	Vector					direction;
+	NSUInteger				hitIndex;
+} BenchmarkRay;
+
+
+static uint32_t BenchmarkRandom(uint32_t *state)
+{
+	*state = *state * 1664525 + 1013904223;
+	return *state >> 8;
+}
+
+
+static double BenchmarkRandomUnit(uint32_t *state)
+{
+	return (double)BenchmarkRandom(state) / (double)(1 << 24);
+}
+
+
+// Exact ray/sphere test, standing in for -[ShipEntity doesHitLine:::].
+static GLfloat BenchmarkRayCallback(void *context, NSUInteger bodyIndex, GLfloat range)
+{
+	BenchmarkRay *ray = context;
+	Vector rpos = HPVectorToVector(HPvector_subtract(ray->positions[bodyIndex], ray->origin));
+	GLfloat radius = ray->radii[bodyIndex];
+
+	GLfloat along = dot_product(rpos, ray->direction);
+	GLfloat discriminant = along * along - (magnitude2(rpos) - radius * radius);
+	if (discriminant < 0.0f)  return range;
+
+	GLfloat hit = along - sqrtf(discriminant);
+	if (hit > 0.0f && hit < range)
+	{
+		ray->hitIndex = bodyIndex;
+		return hit;
+	}
+	return range;
+}
+
+
+NSString *OOShipBVHRunBenchmark(void)
+{
+	NSAutoreleasePool		*pool = [[NSAutoreleasePool alloc] init];
+	uint32_t				seed = 0x0011B5A0;
+	HPVector				*positions = malloc(kBenchmarkShipCount * sizeof *positions);
+	GLfloat					*radii = malloc(kBenchmarkShipCount * sizeof *radii);
+	OOShipBVH				*bvh = [[OOShipBVH alloc] init];
+	OOProfilingStopwatch	*stopwatch = [OOProfilingStopwatch stopwatch];
+	NSUInteger				i, j;
+
+	OOHPScalar side = 4000.0 * cbrt(kBenchmarkShipCount / 100.0);
+	for (i = 0; i < kBenchmarkShipCount; i++)
+	{
+		positions[i] = make_HPvector((BenchmarkRandomUnit(&seed) - 0.5) * side,
+									 (BenchmarkRandomUnit(&seed) - 0.5) * side,
+									 (BenchmarkRandomUnit(&seed) - 0.5) * side);
+		if (i % 50 == 49)  radii[i] = 600.0f + 400.0f * BenchmarkRandomUnit(&seed);
+		else  radii[i] = 10.0f + 110.0f * BenchmarkRandomUnit(&seed);
+	}
+
+	[stopwatch reset];
+	[bvh rebuildWithPositions:positions radii:radii count:kBenchmarkShipCount];
+	OOTimeDelta buildTime = [stopwatch reset];
+
+	NSUInteger treeTests = 0, bruteForceTests = 0, hits = 0, mismatches = 0;
+	OOTimeDelta treeTime = 0, bruteForceTime = 0;
+
+	for (i = 0; i < kBenchmarkRayCount; i++)
+	{
+		// Fire from just outside a random ship, in a random direction.
+		NSUInteger shooter = BenchmarkRandom(&seed) % kBenchmarkShipCount;
+		Vector direction = vector_normal_or_zbasis(make_vector(BenchmarkRandomUnit(&seed) - 0.5, BenchmarkRandomUnit(&seed) - 0.5, BenchmarkRandomUnit(&seed) - 0.5));
+		HPVector origin = HPvector_add(positions[shooter], vectorToHPVector(vector_multiply_scalar(direction, radii[shooter] + 1.0f)));
+
+		BenchmarkRay treeRay = { positions, radii, origin, direction, NSNotFound };
+		BenchmarkRay bruteForceRay = treeRay;
+
+		[stopwatch reset];
+		GLfloat treeRange = [bvh castRayFrom:origin direction:direction range:kBenchmarkRange callback:BenchmarkRayCallback context:&treeRay];
+		treeTime += [stopwatch reset];
+		treeTests += [bvh candidateTestCount];
+
+		GLfloat bruteForceRange = kBenchmarkRange;
+		for (j = 0; j < kBenchmarkShipCount; j++)
+		{
+			bruteForceRange = BenchmarkRayCallback(&bruteForceRay, j, bruteForceRange);
+		}
+		bruteForceTime += [stopwatch reset];
+		bruteForceTests += kBenchmarkShipCount;
+
+		if (treeRay.hitIndex != NSNotFound)  hits++;
+		if (treeRay.hitIndex != bruteForceRay.hitIndex || treeRange != bruteForceRange)  mismatches++;
+	}
+
+	NSString *result = [NSString stringWithFormat:@"%u rays into %u ships (tree built in %.3f ms): BVH %.3f ms, %.1f sphere tests/ray; every ship %.3f ms, %.1f sphere tests/ray; %lu hits%@",
+						kBenchmarkRayCount, kBenchmarkShipCount, buildTime * 1000.0,
+						treeTime * 1000.0, (double)treeTests / kBenchmarkRayCount,
+						bruteForceTime * 1000.0, (double)bruteForceTests / kBenchmarkRayCount,
+						hits, (mismatches == 0) ? @"" : [NSString stringWithFormat:@" ** %lu MISMATCHES **", mismatches]];
+	OOLog(@"collision.laserBVH.benchmark", @"%@", result);
+
+	[result retain];
+	[bvh release];
+	free(positions);
+	free(radii);
+	[pool release];
+
+	return [result autorelease];
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*
+
+OOShipNeighbourCache.h
+
+Per-update cache of the ships near each ship, for AI scanner checks such as
+-[ShipEntity checkScanner].
+
+Scanning used to walk the z-sorted entity list outwards from each scanning
+ship, skipping non-ships one at a time, which costs O(N) per scan and O(N²)
+per update in a busy system. Instead, the cache indexes the universe's ships
+once per update, and the first time a ship asks for its neighbours they are
+found through the index, sorted nearest first and kept for the rest of the
+update. Later scans by the same ship that update are array reads.
+
+A list holds every ship in range, centre to centre, when it was made. It is
+not filtered for cloaking or target validity, which change more often than
+once per update and depend on who is looking; callers do that as they read.
+
+The Universe invalidates the cache at the start of each update and whenever
+a ship is added, removed or moved by script.
+
+This class is *not* thread-safe.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCocoa.h"
+#import "OOMaths.h"
+
+@class Entity, ShipEntity, OOEntitySpatialIndex;
+
+
+typedef struct OOShipNeighbour
+{
+	ShipEntity				*ship;
+	GLfloat					distanceSquared;
+} OOShipNeighbour;
+
+
+typedef struct OOShipNeighbourList
+{
+	NSUInteger				start;		// Index in _neighbours.
+	NSUInteger				count;
+	GLfloat					range;
+} OOShipNeighbourList;
+
+
+@interface OOShipNeighbourCache: NSObject
+{
+@private
+	OOEntitySpatialIndex	*_index;
+	BOOL					_valid;
+
+	NSMapTable				*_listIndices;		// ShipEntity * -> index in _lists, plus one.
+	OOShipNeighbourList		*_lists;
+	NSUInteger				_listCount;
+	NSUInteger				_listCapacity;
+
+	OOShipNeighbour			*_neighbours;
+	NSUInteger				_neighbourCount;
+	NSUInteger				_neighbourCapacity;
+
+	Entity					**_candidates;
+	NSUInteger				_candidateCapacity;
+
+	NSUInteger				_listsBuilt;
+	NSUInteger				_listsReused;
+}
+
+@property (readonly, getter=isValid) BOOL valid;
+
+- (void) invalidate;
+
+/*	Index the ships among the given entities, and forget all lists. motionTime
+	is the padding allowed for ships moving after the rebuild, as for
+	OOEntitySpatialIndex. Entities are not retained.
+*/
+- (void) rebuildWithEntities:(Entity **)entities count:(NSUInteger)count motionTime:(OOTimeDelta)motionTime;
+
+/*	Get the ships within range of ship, excluding ship itself, nearest first.
+	The list is made on the first call for ship since the last rebuild, and
+	reused while range is no larger. The returned pointer is valid until the
+	next call.
+*/
+- (NSUInteger) getNeighbours:(const OOShipNeighbour **)outNeighbours ofShip:(ShipEntity *)ship inRange:(GLfloat)range;
+
+// Statistics since the last rebuild.
+@property (readonly) NSUInteger listsBuilt;
+@property (readonly) NSUInteger listsReused;
+
+@end
@@ -0,0 +1,219 @@
+/*
+
+OOShipNeighbourCache.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOShipNeighbourCache.h"
+#import "OOEntitySpatialIndex.h"
+#import "ShipEntity.h"
+
+
+@interface OOShipNeighbourCache ()
+
+- (void) reserveCandidates:(NSUInteger)count;
+- (void) reserveNeighbours:(NSUInteger)count;
+- (NSUInteger) newList;
+
+@end
+
+
+static int CompareNeighbours(const void *a, const void *b);
+
+
+@implementation OOShipNeighbourCache
+
+- (id) init
+{
+	if ((self = [super init]))
+	{
+		_index = [[OOEntitySpatialIndex alloc] init];
+		_listIndices = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks, NSIntegerMapValueCallBacks, 64);
+	}
+	return self;
+}
+
+
+- (void) dealloc
+{
+	[_index release];
+	if (_listIndices != NULL)  NSFreeMapTable(_listIndices);
+	free(_lists);
+	free(_neighbours);
+	free(_candidates);
+
+	[super dealloc];
+}
+
+
+- (NSString *) description
+{
+	return [NSString stringWithFormat:@"<%@ %p>{%lu ships, %lu lists}", [self class], self, [_index entityCount], _listCount];
+}
+
+
+- (BOOL) isValid
+{
+	return _valid;
+}
+
+
+- (void) invalidate
+{
+	_valid = NO;
+}
+
+
+- (NSUInteger) listsBuilt
+{
+	return _listsBuilt;
+}
+
+
+- (NSUInteger) listsReused
+{
+	return _listsReused;
+}
+
+
+- (void) rebuildWithEntities:(Entity **)entities count:(NSUInteger)count motionTime:(OOTimeDelta)motionTime
+{
+	NSUInteger		i, shipCount = 0;
+
+	[self reserveCandidates:count];
+	for (i = 0; i < count; i++)
+	{
+		if (entities[i]->isShip)  _candidates[shipCount++] = entities[i];
+	}
+	[_index rebuildWithEntities:_candidates count:shipCount motionTime:motionTime];
+
+	NSResetMapTable(_listIndices);
+	_listCount = 0;
+	_neighbourCount = 0;
+	_listsBuilt = 0;
+	_listsReused = 0;
+	_valid = YES;
+}
+
+
+- (NSUInteger) getNeighbours:(const OOShipNeighbour **)outNeighbours ofShip:(ShipEntity *)ship inRange:(GLfloat)range
+{
+	NSParameterAssert(outNeighbours != NULL && ship != nil);
+
+	NSUInteger listIndex = (NSUInteger)NSMapGet(_listIndices, ship);
+	GLfloat rangeSq = range * range;
+
+	if (listIndex != 0 && _lists[listIndex - 1].range >= range)
+	{
+		// The list is sorted, so a smaller range is a prefix of it.
+		OOShipNeighbourList *list = &_lists[listIndex - 1];
+		NSUInteger count = list->count;
+		while (count > 0 && _neighbours[list->start + count - 1].distanceSquared >= rangeSq)  count--;
+
+		_listsReused++;
+		*outNeighbours = _neighbours + list->start;
+		return count;
+	}
+
+	if (listIndex == 0)
+	{
+		listIndex = [self newList] + 1;
+		NSMapInsert(_listIndices, ship, (void *)listIndex);
+	}
+
+	// Candidates are based on positions at the rebuild; test them against current positions.
+	NSUInteger i, start = _neighbourCount, found = 0;
+	NSUInteger candidateCount = [_index getEntities:_candidates inSphere:ship->position radius:range];
+	[self reserveNeighbours:_neighbourCount + candidateCount];
+
+	for (i = 0; i < candidateCount; i++)
+	{
+		ShipEntity *other = (ShipEntity *)_candidates[i];
+		if (other == ship || other->zero_index < 0)  continue;
+
+		GLfloat distanceSq = HPdistance2(ship->position, other->position);
+		if (distanceSq < rangeSq)
+		{
+			_neighbours[start + found++] = (OOShipNeighbour){ other, distanceSq };
+		}
+	}
+	qsort(_neighbours + start, found, sizeof *_neighbours, CompareNeighbours);
+	_neighbourCount += found;
+
+	// If this replaces a shorter-range list, the old one's space is left unused until the next rebuild.
+	_lists[listIndex - 1] = (OOShipNeighbourList){ start, found, range };
+	_listsBuilt++;
+
+	*outNeighbours = _neighbours + start;
+	return found;
+}
+
+
+- (NSUInteger) newList
+{
+	if (_listCount == _listCapacity)
+	{
+		NSUInteger capacity = MAX(_listCapacity * 2, (NSUInteger)32);
+		OOShipNeighbourList *lists = realloc(_lists, capacity * sizeof *_lists);
+		if (lists == NULL)  [NSException raise:NSMallocException format:@"Failed to allocate memory for ship neighbour lists."];
+		_lists = lists;
+		_listCapacity = capacity;
+	}
+	return _listCount++;
+}
+
+
+- (void) reserveCandidates:(NSUInteger)count
+{
+	if (count <= _candidateCapacity)  return;
+
+	NSUInteger capacity = MAX(count, _candidateCapacity * 2);
+	Entity **candidates = realloc(_candidates, capacity * sizeof *_candidates);
+	if (candidates == NULL)  [NSException raise:NSMallocException format:@"Failed to allocate memory for ship neighbour cache."];
+	_candidates = candidates;
+	_candidateCapacity = capacity;
+}
+
+
+- (void) reserveNeighbours:(NSUInteger)count
+{
+	if (count <= _neighbourCapacity)  return;
+
+	NSUInteger capacity = MAX(count, _neighbourCapacity * 2);
+	OOShipNeighbour *neighbours = realloc(_neighbours, capacity * sizeof *_neighbours);
+	if (neighbours == NULL)  [NSException raise:NSMallocException format:@"Failed to allocate memory for ship neighbour lists."];
+	_neighbours = neighbours;
+	_neighbourCapacity = capacity;
+}
+
+@end
+
+
+// Nearest first; ties in sorted entity list order, so results don't depend on the index layout.
+static int CompareNeighbours(const void *a, const void *b)
+{
+	const OOShipNeighbour *na = a, *nb = b;
+
+	if (na->distanceSquared < nb->distanceSquared)  return -1;
+	if (na->distanceSquared > nb->distanceSquared)  return 1;
+	return (na->ship->zero_index > nb->ship->zero_index) - (na->ship->zero_index < nb->ship->zero_index);
+}
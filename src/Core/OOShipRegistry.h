@@ -65,3 +65,13 @@ SOFTWARE.
 - (NSString *) randomShipKeyForRole:(NSString *)role;
 
 @end
+
+
+#ifndef NDEBUG
+/*	Build the ship data from scratch, then incrementally from the resulting
+	snapshot and from copies of it altered to look as though entries had been
+	edited, added or removed, and check that every incremental build matches
+	the full build exactly. Returns timings.
+*/
+NSString *OOShipRegistryRunIncrementalCheck(void);
+#endif
@@ -42,16 +42,40 @@ SOFTWARE.
 #import "OOShipLibraryDescriptions.h"
 #import "Universe.h"
 #import "OOJSScript.h"
+#import "OOPListParsing.h"
 
 #import "OODebugStandards.h"
 
+#ifndef NDEBUG
+#import "OOProfilingStopwatch.h"
+#import "legacy_random.h"
+#endif
+
 #define PRELOAD 0
 
+// Use the (presumed) most efficient plist format for each platform.
+#if OOLITE_MAC_OS_X
+#define SNAPSHOT_PLIST_FORMAT	NSPropertyListBinaryFormat_v1_0
+#else
+#define SNAPSHOT_PLIST_FORMAT	NSPropertyListGNUstepBinaryFormat
+#endif
+
 
 static void DumpStringAddrs(NSDictionary *dict, NSString *context);
 static NSComparisonResult SortDemoShipsByName (id a, id b, void* context);
 static NSComparisonResult SortDemoCategoriesByName (id a, id b, void* context);
 
+static NSString *PropertyListFingerprint(id plist);
+static NSString *ShipEntryFingerprint(id entry, id overridesEntry, id shipyardEntry, id shipyardOverridesEntry);
+static NSArray *ShipEntryReferences(id entry, id overridesEntry);
+static void AddReferences(NSMutableDictionary *graph, NSString *shipKey, NSArray *references);
+static NSSet *KeysConnectedToKeys(NSSet *keys, NSDictionary *graph);
+static NSDictionary *SubsetOfDictionary(NSDictionary *dictionary, NSSet *keys);
+static NSString *ModelPath(NSString *modelName);
+static NSString *SnapshotVersion(void);
+static BOOL ModelPathsChanged(NSDictionary *modelPaths);
+static void SetShipRoleWeights(NSMutableDictionary *roleWeights, NSMutableSet *ownedRoles, NSString *shipKey, NSDictionary *shipRoleWeights, BOOL remove);
+
 
 static OOShipRegistry	*sSingleton = nil;
 
@@ -64,21 +88,65 @@ static NSString * const	kDefaultDemoShip = @"coriolis-station";
 static NSString * const	kVisualEffectRegistryCacheName = @"visual effect registry";
 static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 
+/*	The registry snapshot is a blob, so it is kept when the data cache is
+	cleared. It is stored under a fixed key, but is never trusted as a whole:
+	every entry is checked against a fingerprint of the data it was built
+	from before being reused.
+*/
+static NSString * const	kShipRegistrySnapshotKey = @"snapshot.plist";
+enum
+{
+	kShipRegistrySnapshotFormat			= 1
+};
+
+static NSString * const	kSnapshotFormatKey = @"format";
+static NSString * const	kSnapshotVersionKey = @"version";
+static NSString * const	kSnapshotEnforceStandardsKey = @"enforce standards";
+static NSString * const	kSnapshotShipsKey = @"ships";
+static NSString * const	kSnapshotRoleWeightsKey = @"role weights";
+static NSString * const	kSnapshotEffectsFingerprintKey = @"effects fingerprint";
+static NSString * const	kSnapshotEffectsKey = @"effects";
+static NSString * const	kSnapshotEffectModelsKey = @"effect models";
+
+// Keys in each ship's snapshot record.
+static NSString * const	kSnapshotFingerprintKey = @"fingerprint";
+static NSString * const	kSnapshotReferencesKey = @"references";
+static NSString * const	kSnapshotEntryKey = @"entry";
+static NSString * const	kSnapshotModelKey = @"model";
+static NSString * const	kSnapshotModelPathKey = @"model path";
+
 
 @interface OOShipRegistry (OODataLoader)
 
 - (void) loadShipData;
+- (NSDictionary *) loadShipDataWithSnapshot:(NSDictionary *)oldSnapshot rebuiltCount:(NSUInteger *)outRebuiltCount;
+- (void) loadEffectDataWithSnapshot:(NSDictionary *)oldSnapshot intoSnapshot:(NSMutableDictionary *)snapshot;
+- (NSDictionary *) loadRegistrySnapshot;
+- (void) saveRegistrySnapshot:(NSDictionary *)snapshot;
 - (void) loadDemoShipConditions;
 - (void) loadDemoShips;
 - (void) loadCachedRoleProbabilitySets;
 - (void) buildRoleProbabilitySets;
+- (NSMutableDictionary *) buildRoleWeights;
+- (NSMutableDictionary *) roleWeights:(NSDictionary *)oldRoleWeights updatedForShipKeys:(NSSet *)shipKeys oldRecords:(NSDictionary *)oldRecords;
+- (void) setRoleProbabilitySetsFromWeights:(NSDictionary *)roleWeights;
+- (void) setPlayerShipsFromShipyard:(NSDictionary *)shipyard;
+- (void) cacheConditionScripts;
+
+- (BOOL) processShipData:(NSMutableDictionary *)ioData
+			   overrides:(NSDictionary *)overrides
+				shipyard:(NSDictionary *)shipyard
+	   shipyardOverrides:(NSDictionary *)shipyardOverrides
+			  modelNames:(NSMutableDictionary *)outModelNames;
+- (BOOL) processEffectData:(NSMutableDictionary *)ioData modelNames:(NSMutableDictionary *)outModelNames;
 
 - (BOOL) applyLikeShips:(NSMutableDictionary *)ioData withKey:(NSString *)likeKey;
-- (BOOL) loadAndMergeShipyard:(NSMutableDictionary *)ioData;
+- (BOOL) mergeShipyard:(NSDictionary *)shipyard overrides:(NSDictionary *)shipyardOverrides intoShipData:(NSMutableDictionary *)ioData;
 - (BOOL) stripPrivateKeys:(NSMutableDictionary *)ioData;
 - (BOOL) makeShipEntriesMutable:(NSMutableDictionary *)ioData;
-- (BOOL) loadAndApplyShipDataOverrides:(NSMutableDictionary *)ioData;
+- (BOOL) applyShipDataOverrides:(NSDictionary *)overrides toShipData:(NSMutableDictionary *)ioData;
 - (BOOL) canonicalizeAndTagSubentities:(NSMutableDictionary *)ioData;
+- (void) recordModelNames:(NSMutableDictionary *)outModelNames ofEntries:(NSDictionary *)data;
 - (BOOL) removeUnusableEntries:(NSMutableDictionary *)ioData shipMode:(BOOL)shipMode;
 - (BOOL) sanitizeConditions:(NSMutableDictionary *)ioData;
 
@@ -87,7 +155,7 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 #endif
 
 - (NSMutableDictionary *) mergeShip:(NSDictionary *)child withParent:(NSDictionary *)parent;
-- (void) mergeShipRoles:(NSString *)roles forShipKey:(NSString *)shipKey intoProbabilityMap:(NSMutableDictionary *)probabilitySets;
+- (NSDictionary *) roleWeightsForShipKey:(NSString *)shipKey roles:(NSString *)roles;
 
 - (NSDictionary *) canonicalizeSubentityDeclaration:(id)declaration
 											forShip:(NSString *)shipKey
@@ -177,7 +245,8 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 			[NSException raise:@"OOShipRegistryLoadFailure" format:@"Could not load or synthesize any demo ships."];
 		}
 		
-		[self loadCachedRoleProbabilitySets];
+		// If the ship data was rebuilt, -loadShipData has already set up the role probability sets.
+		if (_probabilitySets == nil)  [self loadCachedRoleProbabilitySets];
 		if (_probabilitySets == nil)
 		{
 			[self buildRoleProbabilitySets];
@@ -283,101 +352,415 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 		* Load shipyard.plist, add shipyard data into ship dictionaries, and
 		  create _playerShips array.
 		* Build role->ship type probability sets.
+	
+	The data cache is cleared whenever any OXP changes, so the result is also
+	kept in a snapshot (see -loadShipDataWithSnapshot:rebuiltCount:), and only
+	the entries affected by a change are put through these stages again.
 */
 - (void) loadShipData
 {
+	NSDictionary			*snapshot = nil;
+	
+	snapshot = [self loadShipDataWithSnapshot:[self loadRegistrySnapshot] rebuiltCount:NULL];
+	if (snapshot != nil)  [self saveRegistrySnapshot:snapshot];
+}
+
+
+/*	-loadShipDataWithSnapshot:rebuiltCount:
+	
+	The snapshot has a record for each key in shipdata.plist,
+	shipdata-overrides.plist, shipyard.plist and shipyard-overrides.plist,
+	with a fingerprint of that key's entries in those files, the keys its
+	like_ship and subentities refer to, the model it names and the file that
+	model was found in, and the finished entry if there is one.
+	
+	Entries only affect each other through like_ship and subentity
+	references: a ship inherits from its like_ship chain, is removed if a
+	subentity does not exist, and is tagged as a subentity (so it does not
+	need roles) by the ships that use it. So if nothing in a group of ships
+	connected by references has changed, the entries built from it are the
+	same as last time. Every ship connected to a changed, added or removed
+	entry, through references in either the old or the new data, is rebuilt
+	by the usual stages; everything else is taken from the snapshot. A ship
+	whose model now resolves to a different file counts as changed.
+	
+	With no snapshot, everything is rebuilt. The role probability sets are
+	updated from the role weights in the snapshot for the rebuilt ships only.
+	Returns the new snapshot, or nil on failure.
+*/
+- (NSDictionary *) loadShipDataWithSnapshot:(NSDictionary *)oldSnapshot rebuiltCount:(NSUInteger *)outRebuiltCount
+{
+	NSDictionary			*shipData = nil;
+	NSDictionary			*overrides = nil;
+	NSDictionary			*shipyard = nil;
+	NSDictionary			*shipyardOverrides = nil;
+	NSDictionary			*oldRecords = nil;
+	NSDictionary			*oldRecord = nil;
+	NSDictionary			*oldRoleWeights = nil;
+	NSMutableDictionary		*records = nil;
+	NSMutableDictionary		*record = nil;
+	NSMutableDictionary		*graph = nil;
+	NSMutableSet			*allKeys = nil;
+	NSMutableSet			*changedKeys = nil;
+	NSSet					*rebuildKeys = nil;
+	NSMutableDictionary		*modelNames = nil;
 	NSMutableDictionary		*result = nil;
+	NSMutableDictionary		*roleWeights = nil;
+	NSMutableDictionary		*snapshot = nil;
+	NSString				*shipKey = nil;
+	NSString				*fingerprint = nil;
+	NSString				*modelName = nil;
+	NSArray					*references = nil;
+	NSDictionary			*entry = nil;
+	NSUInteger				rebuiltCount = 0;
 	
-	[_shipData release];
-	_shipData = nil;
-	[_playerShips release];
-	_playerShips = nil;
+	DESTROY(_shipData);
+	DESTROY(_playerShips);
+	DESTROY(_probabilitySets);
+	
+	// Load shipdata.plist and the files applied to it.
+	shipData = [ResourceManager dictionaryFromFilesNamed:@"shipdata.plist"
+												inFolder:@"Config"
+											   mergeMode:MERGE_BASIC
+												   cache:NO];
+	if (shipData == nil)  return nil;
+	
+	DumpStringAddrs(shipData, @"shipdata.plist");
 	
-	// Load shipdata.plist.
-	result = [[[ResourceManager dictionaryFromFilesNamed:@"shipdata.plist"
+	overrides = [ResourceManager dictionaryFromFilesNamed:@"shipdata-overrides.plist"
+												 inFolder:@"Config"
+												mergeMode:MERGE_SMART
+													cache:NO];
+	shipyard = [ResourceManager dictionaryFromFilesNamed:@"shipyard.plist"
 												inFolder:@"Config"
 											   mergeMode:MERGE_BASIC
-												   cache:NO] mutableCopy] autorelease];
-	if (result == nil)  return;
+												   cache:NO];
+	shipyardOverrides = [ResourceManager dictionaryFromFilesNamed:@"shipyard-overrides.plist"
+														 inFolder:@"Config"
+														mergeMode:MERGE_SMART
+															cache:NO];
+	
+	// Fingerprint the data for each key, and build the reference graph.
+	allKeys = [NSMutableSet setWithArray:[shipData allKeys]];
+	[allKeys addObjectsFromArray:[overrides allKeys]];
+	[allKeys addObjectsFromArray:[shipyard allKeys]];
+	[allKeys addObjectsFromArray:[shipyardOverrides allKeys]];
+	
+	records = [NSMutableDictionary dictionaryWithCapacity:[allKeys count]];
+	graph = [NSMutableDictionary dictionaryWithCapacity:[allKeys count]];
+	foreach (shipKey, allKeys)
+	{
+		entry = [shipData objectForKey:shipKey];
+		fingerprint = ShipEntryFingerprint(entry, [overrides objectForKey:shipKey], [shipyard objectForKey:shipKey], [shipyardOverrides objectForKey:shipKey]);
+		record = [NSMutableDictionary dictionaryWithObject:fingerprint forKey:kSnapshotFingerprintKey];
+		
+		references = ShipEntryReferences(entry, [overrides objectForKey:shipKey]);
+		if ([references count] != 0)
+		{
+			[record setObject:references forKey:kSnapshotReferencesKey];
+			AddReferences(graph, shipKey, references);
+		}
+		
+		[records setObject:record forKey:shipKey];
+	}
+	
+	// Work out what needs rebuilding: nil means everything.
+	oldRecords = [oldSnapshot oo_dictionaryForKey:kSnapshotShipsKey];
+	oldRoleWeights = [oldSnapshot oo_dictionaryForKey:kSnapshotRoleWeightsKey];
+	if (oldRecords != nil && oldRoleWeights != nil)
+	{
+		changedKeys = [NSMutableSet set];
+		foreachkey (shipKey, oldRecords)
+		{
+			oldRecord = [oldRecords oo_dictionaryForKey:shipKey];
+			
+			// References that have been removed still connect the entries involved.
+			AddReferences(graph, shipKey, [oldRecord oo_arrayForKey:kSnapshotReferencesKey]);
+			
+			fingerprint = [[records objectForKey:shipKey] objectForKey:kSnapshotFingerprintKey];
+			if (fingerprint == nil || ![fingerprint isEqualToString:[oldRecord oo_stringForKey:kSnapshotFingerprintKey]])
+			{
+				[changedKeys addObject:shipKey];
+			}
+			else
+			{
+				modelName = [oldRecord oo_stringForKey:kSnapshotModelKey];
+				if (modelName != nil && ![ModelPath(modelName) isEqualToString:[oldRecord oo_stringForKey:kSnapshotModelPathKey]])
+				{
+					[changedKeys addObject:shipKey];
+				}
+			}
+		}
+		foreachkey (shipKey, records)
+		{
+			if ([oldRecords oo_dictionaryForKey:shipKey] == nil)  [changedKeys addObject:shipKey];
+		}
+		
+		rebuildKeys = KeysConnectedToKeys(changedKeys, graph);
+	}
+	
+	// Run the changed entries through the usual stages.
+	modelNames = [NSMutableDictionary dictionary];
+	result = [[SubsetOfDictionary(shipData, rebuildKeys) mutableCopy] autorelease];
+	if (![self processShipData:result
+					 overrides:SubsetOfDictionary(overrides, rebuildKeys)
+					  shipyard:SubsetOfDictionary(shipyard, rebuildKeys)
+			 shipyardOverrides:SubsetOfDictionary(shipyardOverrides, rebuildKeys)
+					modelNames:modelNames])
+	{
+		return nil;
+	}
+	
+	// Add the unchanged entries, and complete the new records.
+	foreachkey (shipKey, records)
+	{
+		record = [records objectForKey:shipKey];
+		if (rebuildKeys == nil || [rebuildKeys containsObject:shipKey])
+		{
+			entry = [result objectForKey:shipKey];
+			modelName = [modelNames objectForKey:shipKey];
+			if (modelName != nil)
+			{
+				[record setObject:modelName forKey:kSnapshotModelKey];
+				[record setObject:ModelPath(modelName) forKey:kSnapshotModelPathKey];
+			}
+			rebuiltCount++;
+		}
+		else
+		{
+			oldRecord = [oldRecords oo_dictionaryForKey:shipKey];
+			entry = [oldRecord oo_dictionaryForKey:kSnapshotEntryKey];
+			if (entry != nil)  [result setObject:entry forKey:shipKey];
+			
+			modelName = [oldRecord oo_stringForKey:kSnapshotModelKey];
+			if (modelName != nil)
+			{
+				[record setObject:modelName forKey:kSnapshotModelKey];
+				[record setObject:[oldRecord oo_stringForKey:kSnapshotModelPathKey] forKey:kSnapshotModelPathKey];
+			}
+		}
+		
+		if (entry != nil)  [record setObject:entry forKey:kSnapshotEntryKey];
+	}
+	
+	_shipData = OODeepCopy(result);
+	[[OOCacheManager sharedCache] setObject:_shipData forKey:kShipDataCacheKey inCache:kShipRegistryCacheName];
+	
+	[self setPlayerShipsFromShipyard:shipyard];
+	[self cacheConditionScripts];
+	
+	if (rebuildKeys != nil)
+	{
+		OOLog(@"shipData.load.incremental", @"Rebuilt %lu of %lu ship data entries, reused the rest.", (unsigned long)rebuiltCount, (unsigned long)[records count]);
+		roleWeights = [self roleWeights:oldRoleWeights updatedForShipKeys:rebuildKeys oldRecords:oldRecords];
+	}
+	else
+	{
+		roleWeights = [self buildRoleWeights];
+	}
+	[self setRoleProbabilitySetsFromWeights:roleWeights];
+	
+	OOLog(@"shipData.load.done", @"%@", @"Ship data loaded.");
+	
+	snapshot = [NSMutableDictionary dictionaryWithCapacity:8];
+	[snapshot oo_setUnsignedInteger:kShipRegistrySnapshotFormat forKey:kSnapshotFormatKey];
+	[snapshot setObject:SnapshotVersion() forKey:kSnapshotVersionKey];
+	[snapshot oo_setBool:OOEnforceStandards() forKey:kSnapshotEnforceStandardsKey];
+	[snapshot setObject:records forKey:kSnapshotShipsKey];
+	[snapshot setObject:roleWeights forKey:kSnapshotRoleWeightsKey];
 	
-	DumpStringAddrs(result, @"shipdata.plist");
+	[self loadEffectDataWithSnapshot:oldSnapshot intoSnapshot:snapshot];
 	
+	if (outRebuiltCount != NULL)  *outRebuiltCount = rebuiltCount;
+	return snapshot;
+}
+
+
+/*	Effects are few and seldom change, so effectdata.plist is rebuilt as a
+	whole if it or the location of any model it uses changes.
+*/
+- (void) loadEffectDataWithSnapshot:(NSDictionary *)oldSnapshot intoSnapshot:(NSMutableDictionary *)snapshot
+{
+	NSDictionary			*effectData = nil;
+	NSString				*fingerprint = nil;
+	NSDictionary			*oldModelPaths = nil;
+	NSMutableDictionary		*modelPaths = nil;
+	NSMutableDictionary		*modelNames = nil;
+	NSMutableDictionary		*mutableData = nil;
+	NSDictionary			*result = nil;
+	NSString				*modelName = nil;
+	
+	DESTROY(_effectData);
+	
+	effectData = [ResourceManager dictionaryFromFilesNamed:@"effectdata.plist"
+												  inFolder:@"Config"
+												 mergeMode:MERGE_BASIC
+													 cache:NO];
+	if (effectData == nil)  return;
+	
+	fingerprint = PropertyListFingerprint(effectData);
+	oldModelPaths = [oldSnapshot oo_dictionaryForKey:kSnapshotEffectModelsKey];
+	
+	if ([fingerprint isEqualToString:[oldSnapshot oo_stringForKey:kSnapshotEffectsFingerprintKey]] &&
+		[oldSnapshot oo_dictionaryForKey:kSnapshotEffectsKey] != nil &&
+		oldModelPaths != nil && !ModelPathsChanged(oldModelPaths))
+	{
+		result = [oldSnapshot oo_dictionaryForKey:kSnapshotEffectsKey];
+		modelPaths = [[oldModelPaths mutableCopy] autorelease];
+		OOLog(@"effectData.load.incremental", @"%@", @"Effect data unchanged, reused.");
+	}
+	else
+	{
+		mutableData = [[effectData mutableCopy] autorelease];
+		modelNames = [NSMutableDictionary dictionary];
+		if (![self processEffectData:mutableData modelNames:modelNames])  return;
+		result = mutableData;
+		
+		modelPaths = [NSMutableDictionary dictionaryWithCapacity:[modelNames count]];
+		foreach (modelName, [modelNames allValues])
+		{
+			[modelPaths setObject:ModelPath(modelName) forKey:modelName];
+		}
+	}
+	
+	_effectData = OODeepCopy(result);
+	[[OOCacheManager sharedCache] setObject:_effectData forKey:kVisualEffectDataCacheKey inCache:kVisualEffectRegistryCacheName];
+	
+	[snapshot setObject:fingerprint forKey:kSnapshotEffectsFingerprintKey];
+	[snapshot setObject:_effectData forKey:kSnapshotEffectsKey];
+	[snapshot setObject:modelPaths forKey:kSnapshotEffectModelsKey];
+	
+	OOLog(@"effectData.load.done", @"%@", @"Effect data loaded.");
+}
+
+
+/*	The stages of -loadShipData which work on the ship entries themselves,
+	applied to all of shipdata.plist or to the entries being rebuilt.
+	outModelNames receives the model named by each entry when the models
+	are looked up.
+*/
+- (BOOL) processShipData:(NSMutableDictionary *)ioData
+			   overrides:(NSDictionary *)overrides
+				shipyard:(NSDictionary *)shipyard
+	   shipyardOverrides:(NSDictionary *)shipyardOverrides
+			  modelNames:(NSMutableDictionary *)outModelNames
+{
 	// Make each entry mutable to simplify later stages. Also removes any entries that aren't dictionaries.
-	if (![self makeShipEntriesMutable:result])  return;
+	if (![self makeShipEntriesMutable:ioData])  return NO;
 	OOLog(@"shipData.load.progress", @"%@", @"Finished initial cleanup...");
 	
 	// Apply patches.
-	if (![self loadAndApplyShipDataOverrides:result])  return;
+	if (![self applyShipDataOverrides:overrides toShipData:ioData])  return NO;
 	OOLog(@"shipData.load.progress", @"%@", @"Finished applying patches...");
 	
 	// Strip private keys (anything starting with _oo_).
-	if (![self stripPrivateKeys:result])  return;
+	if (![self stripPrivateKeys:ioData])  return NO;
 	OOLog(@"shipData.load.progress", @"%@", @"Finished stripping private keys...");
 	
 	// Resolve like_ship entries.
-	if (![self applyLikeShips:result withKey:@"like_ship"])  return;
+	if (![self applyLikeShips:ioData withKey:@"like_ship"])  return NO;
 	OOLog(@"shipData.load.progress", @"%@", @"Finished resolving like_ships...");
 	
 	// Clean up subentity declarations and tag subentities so they won't be pruned.
-	if (![self canonicalizeAndTagSubentities:result])  return;
+	if (![self canonicalizeAndTagSubentities:ioData])  return NO;
 	OOLog(@"shipData.load.progress", @"%@", @"Finished cleaning up subentities...");
 	
 	// Clean out templates and invalid entries.
-	if (![self removeUnusableEntries:result shipMode:YES])  return;
+	[self recordModelNames:outModelNames ofEntries:ioData];
+	if (![self removeUnusableEntries:ioData shipMode:YES])  return NO;
 	OOLog(@"shipData.load.progress", @"%@", @"Finished removing invalid entries...");
 	
 	// Add shipyard entries into shipdata entries.
-	if (![self loadAndMergeShipyard:result])  return;
+	if (![self mergeShipyard:shipyard overrides:shipyardOverrides intoShipData:ioData])  return NO;
 	OOLog(@"shipData.load.progress", @"%@", @"Finished adding shipyard entries...");
 	
 	// Sanitize conditions.
-	if (![self sanitizeConditions:result])  return;
+	if (![self sanitizeConditions:ioData])  return NO;
 	OOLog(@"shipData.load.progress", @"%@", @"Finished validating data...");
 	
 #if PRELOAD
 	// Preload and cache meshes.
-	if (![self preloadShipMeshes:result])  return;
+	if (![self preloadShipMeshes:ioData])  return NO;
 	OOLog(@"shipData.load.progress", @"%@", @"Finished loading meshes...");
 #endif
 	
-	_shipData = OODeepCopy(result);
-	[[OOCacheManager sharedCache] setObject:_shipData forKey:kShipDataCacheKey inCache:kShipRegistryCacheName];
-	
-	OOLog(@"shipData.load.done", @"%@", @"Ship data loaded.");
-
-	[_effectData release];
-	_effectData = nil;
+	return YES;
+}
 
-	result = [[[ResourceManager dictionaryFromFilesNamed:@"effectdata.plist"
-												inFolder:@"Config"
-											   mergeMode:MERGE_BASIC
-												   cache:NO] mutableCopy] autorelease];
-	if (result == nil)  return;
 
+- (BOOL) processEffectData:(NSMutableDictionary *)ioData modelNames:(NSMutableDictionary *)outModelNames
+{
 	// Make each entry mutable to simplify later stages. Also removes any entries that aren't dictionaries.
-	if (![self makeShipEntriesMutable:result])  return;
+	if (![self makeShipEntriesMutable:ioData])  return NO;
 	OOLog(@"effectData.load.progress", @"%@", @"Finished initial cleanup...");
 
 	// Strip private keys (anything starting with _oo_).
-	if (![self stripPrivateKeys:result])  return;
+	if (![self stripPrivateKeys:ioData])  return NO;
 	OOLog(@"effectData.load.progress", @"%@", @"Finished stripping private keys...");
 	
 	// Resolve like_effect entries.
-	if (![self applyLikeShips:result withKey:@"like_effect"])  return;
+	if (![self applyLikeShips:ioData withKey:@"like_effect"])  return NO;
 	OOLog(@"effectData.load.progress", @"%@", @"Finished resolving like_effects...");
 	
 	// Clean up subentity declarations and tag subentities so they won't be pruned.
-	if (![self canonicalizeAndTagSubentities:result])  return;
+	if (![self canonicalizeAndTagSubentities:ioData])  return NO;
 	OOLog(@"effectData.load.progress", @"%@", @"Finished cleaning up subentities...");
 	
 	// Clean out templates and invalid entries.
-	if (![self removeUnusableEntries:result shipMode:NO])  return;
+	[self recordModelNames:outModelNames ofEntries:ioData];
+	if (![self removeUnusableEntries:ioData shipMode:NO])  return NO;
 	OOLog(@"effectData.load.progress", @"%@", @"Finished removing invalid entries...");
 	
-	_effectData = OODeepCopy(result);
-	[[OOCacheManager sharedCache] setObject:_effectData forKey:kVisualEffectDataCacheKey inCache:kVisualEffectRegistryCacheName];
+	return YES;
+}
+
+
+/*	-loadRegistrySnapshot
 	
-	OOLog(@"effectData.load.done", @"%@", @"Effect data loaded.");
+	The snapshot is ignored when enforcing OXP standards, so that every
+	problem is reported every time, and if it comes from a different version
+	of Oolite, whose stages may have worked differently.
+*/
+- (NSDictionary *) loadRegistrySnapshot
+{
+	NSData					*data = nil;
+	NSDictionary			*snapshot = nil;
+	
+	if (OOEnforceStandards())  return nil;
+	
+	data = [[OOCacheManager sharedCache] blobForKey:kShipRegistrySnapshotKey inStore:kShipRegistryCacheName];
+	if (data == nil)  return nil;
+	
+	snapshot = OOPropertyListFromData(data, @"ship registry snapshot");
+	if (![snapshot isKindOfClass:[NSDictionary class]] ||
+		[snapshot oo_unsignedIntegerForKey:kSnapshotFormatKey] != kShipRegistrySnapshotFormat ||
+		![[snapshot oo_stringForKey:kSnapshotVersionKey] isEqualToString:SnapshotVersion()] ||
+		[snapshot oo_boolForKey:kSnapshotEnforceStandardsKey])
+	{
+		OOLog(@"shipData.snapshot.ignored", @"%@", @"Ship registry snapshot is not usable, rebuilding all ship data.");
+		return nil;
+	}
+	
+	return snapshot;
+}
+
+
+- (void) saveRegistrySnapshot:(NSDictionary *)snapshot
+{
+	NSString				*errorDesc = nil;
+	NSData					*data = nil;
+	
+	data = [NSPropertyListSerialization dataFromPropertyList:snapshot format:SNAPSHOT_PLIST_FORMAT errorDescription:&errorDesc];
+	if (data == nil)
+	{
+#if OOLITE_RELEASE_PLIST_ERROR_STRINGS
+		[errorDesc autorelease];
+#endif
+		OOLog(@"shipData.snapshot.writeFailed", @"Could not convert ship registry snapshot to property list data: %@", errorDesc);
+		return;
+	}
+	
+	[[OOCacheManager sharedCache] setBlob:data forKey:kShipRegistrySnapshotKey inStore:kShipRegistryCacheName];
 }
 
 
@@ -550,41 +933,141 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 
 - (void) buildRoleProbabilitySets
 {
-	NSMutableDictionary		*probabilitySets = nil;
+	[self setRoleProbabilitySetsFromWeights:[self buildRoleWeights]];
+}
+
+
+/*	Role weights are a dictionary whose keys are roles and whose values map
+	ship keys to weights. They are kept in the registry snapshot, so that
+	only the rebuilt ships' roles need to be updated.
+*/
+- (NSMutableDictionary *) buildRoleWeights
+{
+	NSMutableDictionary		*roleWeights = nil;
+	NSMutableSet			*ownedRoles = nil;
 	NSString				*shipKey = nil;
-	NSDictionary			*shipEntry = nil;
-	NSString				*roles = nil;
-	NSString				*role = nil;
-	OOProbabilitySet		*pset = nil;
-	NSMutableDictionary		*cacheEntry = nil;
 	
-	probabilitySets = [[NSMutableDictionary alloc] init];
+	roleWeights = [NSMutableDictionary dictionary];
+	ownedRoles = [NSMutableSet set];
 	
-	// Build role sets
 	foreachkey (shipKey, _shipData)
 	{
-		shipEntry = [_shipData objectForKey:shipKey];
-		roles = [shipEntry oo_stringForKey:@"roles"];
-		[self mergeShipRoles:roles forShipKey:shipKey intoProbabilityMap:probabilitySets];
+		SetShipRoleWeights(roleWeights, ownedRoles, shipKey, [self roleWeightsForShipKey:shipKey roles:[[_shipData oo_dictionaryForKey:shipKey] oo_stringForKey:@"roles"]], NO);
+	}
+	
+	return roleWeights;
+}
+
+
+- (NSMutableDictionary *) roleWeights:(NSDictionary *)oldRoleWeights updatedForShipKeys:(NSSet *)shipKeys oldRecords:(NSDictionary *)oldRecords
+{
+	NSMutableDictionary		*roleWeights = nil;
+	NSMutableSet			*ownedRoles = nil;
+	NSString				*shipKey = nil;
+	NSDictionary			*oldEntry = nil;
+	NSDictionary			*newEntry = nil;
+	
+	roleWeights = [[oldRoleWeights mutableCopy] autorelease];
+	ownedRoles = [NSMutableSet set];
+	
+	foreach (shipKey, shipKeys)
+	{
+		oldEntry = [[oldRecords oo_dictionaryForKey:shipKey] oo_dictionaryForKey:kSnapshotEntryKey];
+		newEntry = [_shipData oo_dictionaryForKey:shipKey];
+		
+		if (oldEntry != nil)  SetShipRoleWeights(roleWeights, ownedRoles, shipKey, [self roleWeightsForShipKey:shipKey roles:[oldEntry oo_stringForKey:@"roles"]], YES);
+		if (newEntry != nil)  SetShipRoleWeights(roleWeights, ownedRoles, shipKey, [self roleWeightsForShipKey:shipKey roles:[newEntry oo_stringForKey:@"roles"]], NO);
 	}
 	
-	// Convert role sets to immutable form, and build cache entry.
-	// Note: we iterate over a copy of the keys to avoid mutating while iterating.
-	cacheEntry = [NSMutableDictionary dictionaryWithCapacity:[probabilitySets count]];
-	foreachkey (role, probabilitySets)
+	return roleWeights;
+}
+
+
+/*	Ships are added to each set in order of ship key, so that the sets do not
+	depend on the order in which the role weights were built.
+*/
+- (void) setRoleProbabilitySetsFromWeights:(NSDictionary *)roleWeights
+{
+	NSMutableDictionary		*probabilitySets = nil;
+	NSMutableDictionary		*cacheEntry = nil;
+	NSString				*role = nil;
+	NSString				*shipKey = nil;
+	NSDictionary			*weights = nil;
+	OOMutableProbabilitySet	*probSet = nil;
+	OOProbabilitySet		*pset = nil;
+	
+	probabilitySets = [NSMutableDictionary dictionaryWithCapacity:[roleWeights count]];
+	cacheEntry = [NSMutableDictionary dictionaryWithCapacity:[roleWeights count]];
+	
+	foreachkey (role, roleWeights)
 	{
-		pset = [probabilitySets objectForKey:role];
-		pset = [[pset copy] autorelease];
+		weights = [roleWeights oo_dictionaryForKey:role];
+		probSet = [OOMutableProbabilitySet probabilitySet];
+		foreach (shipKey, [[weights allKeys] sortedArrayUsingSelector:@selector(compare:)])
+		{
+			[probSet setWeight:[weights oo_floatForKey:shipKey] forObject:shipKey];
+		}
+		
+		pset = [[probSet copy] autorelease];
 		[probabilitySets setObject:pset forKey:role];
 		[cacheEntry setObject:[pset propertyListRepresentation] forKey:role];
 	}
 	
+	[_probabilitySets release];
 	_probabilitySets = [probabilitySets copy];
-	[probabilitySets release];
 	[[OOCacheManager sharedCache] setObject:cacheEntry forKey:kRoleWeightsCacheKey inCache:kShipRegistryCacheName];
 }
 
 
+- (void) setPlayerShipsFromShipyard:(NSDictionary *)shipyard
+{
+	NSMutableArray			*playerShips = nil;
+	NSString				*shipKey = nil;
+	
+	playerShips = [NSMutableArray arrayWithCapacity:[shipyard count]];
+	foreachkey (shipKey, shipyard)
+	{
+		if ([_shipData objectForKey:shipKey] != nil)  [playerShips addObject:shipKey];
+	}
+	
+	[_playerShips release];
+	_playerShips = [playerShips copy];
+	[[OOCacheManager sharedCache] setObject:_playerShips forKey:kPlayerShipsCacheKey inCache:kShipRegistryCacheName];
+}
+
+
+/*	Get list of condition_scripts used by ships and shipyard entries, in
+	order of ship key.
+*/
+- (void) cacheConditionScripts
+{
+	NSMutableArray			*conditionScripts = nil;
+	NSString				*shipKey = nil;
+	NSDictionary			*shipEntry = nil;
+	NSString				*conditionScript = nil;
+	
+	conditionScripts = [NSMutableArray array];
+	foreach (shipKey, [[_shipData allKeys] sortedArrayUsingSelector:@selector(compare:)])
+	{
+		shipEntry = [_shipData objectForKey:shipKey];
+		
+		conditionScript = [shipEntry oo_stringForKey:@"condition_script"];
+		if (conditionScript != nil && ![conditionScripts containsObject:conditionScript])
+		{
+			[conditionScripts addObject:conditionScript];
+		}
+		
+		conditionScript = [[shipEntry oo_dictionaryForKey:@"_oo_shipyard"] oo_stringForKey:@"condition_script"];
+		if (conditionScript != nil && ![conditionScripts containsObject:conditionScript])
+		{
+			[conditionScripts addObject:conditionScript];
+		}
+	}
+	
+	[[OOCacheManager sharedCache] setObject:conditionScripts forKey:@"ship conditions" inCache:@"condition scripts"];
+}
+
+
 /*	-applyLikeShips:
 	
 	Implement like_ship by copying inherited ship and overwriting with child
@@ -756,18 +1239,12 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 }
 
 
-- (BOOL) loadAndApplyShipDataOverrides:(NSMutableDictionary *)ioData
+- (BOOL) applyShipDataOverrides:(NSDictionary *)overrides toShipData:(NSMutableDictionary *)ioData
 {
 	NSString				*shipKey = nil;
 	NSMutableDictionary		*shipEntry = nil;
-	NSDictionary			*overrides = nil;
 	NSDictionary			*overridesEntry = nil;
 	
-	overrides = [ResourceManager dictionaryFromFilesNamed:@"shipdata-overrides.plist"
-												 inFolder:@"Config"
-												mergeMode:MERGE_SMART
-													cache:NO];
-	
 	foreachkey (shipKey, overrides)
 	{
 		shipEntry = [ioData objectForKey:shipKey];
@@ -813,22 +1290,20 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 }
 
 
-/*	-loadAndMergeShipyard:
+/*	-mergeShipyard:overrides:intoShipData:
 	
-	Load shipyard.plist, add its entries to appropriate shipyard entries as
-	a dictionary under the key "shipyard", and build list of player ships.
-	Before that, we strip out any "shipyard" entries already in shipdata, and
-	apply any shipyard-overrides.plist stuff to shipyard.
+	Add shipyard.plist entries to appropriate shipyard entries as a
+	dictionary under the key "_oo_shipyard". Before that, we strip out any
+	"_oo_shipyard" entries already in shipdata, and apply any
+	shipyard-overrides.plist stuff to shipyard. The list of player ships is
+	built from the finished data by -setPlayerShipsFromShipyard:.
 */
-- (BOOL) loadAndMergeShipyard:(NSMutableDictionary *)ioData
+- (BOOL) mergeShipyard:(NSDictionary *)shipyard overrides:(NSDictionary *)shipyardOverrides intoShipData:(NSMutableDictionary *)ioData
 {
 	NSString				*shipKey = nil;
 	NSMutableDictionary		*shipEntry = nil;
-	NSDictionary			*shipyard = nil;
-	NSDictionary			*shipyardOverrides = nil;
 	NSDictionary			*shipyardEntry = nil;
 	NSDictionary			*shipyardOverridesEntry = nil;
-	NSMutableArray			*playerShips = nil;
 	
 	// Strip out any shipyard stuff in shipdata (there shouldn't be any).
 	foreachkey (shipKey, ioData)
@@ -840,17 +1315,6 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 		}
 	}
 	
-	shipyard = [ResourceManager dictionaryFromFilesNamed:@"shipyard.plist"
-												inFolder:@"Config"
-											   mergeMode:MERGE_BASIC
-												   cache:NO];
-	shipyardOverrides = [ResourceManager dictionaryFromFilesNamed:@"shipyard-overrides.plist"
-														 inFolder:@"Config"
-														mergeMode:MERGE_SMART
-															cache:NO];
-	
-	playerShips = [NSMutableArray arrayWithCapacity:[shipyard count]];
-	
 	// Insert merged shipyard and shipyardOverrides entries.
 	foreachkey (shipKey, shipyard)
 	{
@@ -862,8 +1326,6 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 			shipyardEntry = [shipyardEntry dictionaryByAddingEntriesFromDictionary:shipyardOverridesEntry];
 			
 			[shipEntry setObject:shipyardEntry forKey:@"_oo_shipyard"];
-			
-			[playerShips addObject:shipKey];
 		}
 		else
 		{
@@ -871,9 +1333,6 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 		}
 	}
 	
-	_playerShips = [playerShips copy];
-	[[OOCacheManager sharedCache] setObject:_playerShips forKey:kPlayerShipsCacheKey inCache:kShipRegistryCacheName];
-	
 	return YES;
 }
 
@@ -974,6 +1433,19 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 }
 
 
+- (void) recordModelNames:(NSMutableDictionary *)outModelNames ofEntries:(NSDictionary *)data
+{
+	NSString				*shipKey = nil;
+	NSString				*modelName = nil;
+	
+	foreachkey (shipKey, data)
+	{
+		modelName = [[data oo_dictionaryForKey:shipKey] oo_stringForKey:@"model"];
+		if ([modelName length] != 0)  [outModelNames setObject:modelName forKey:shipKey];
+	}
+}
+
+
 - (BOOL) removeUnusableEntries:(NSMutableDictionary *)ioData shipMode:(BOOL)shipMode
 {
 	NSString				*shipKey = nil;
@@ -1019,7 +1491,6 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 
 /*	Transform conditions, determinant (if conditions array) and
 	shipyard.conditions from hasShipyard to sanitized form.
-  Also get list of condition_scripts
 */
 - (BOOL) sanitizeConditions:(NSMutableDictionary *)ioData
 {
@@ -1029,23 +1500,11 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 	NSArray					*conditions = nil;
 	NSArray					*hasShipyard = nil;
 	NSArray					*shipyardConditions = nil;
-	NSString        *condition_script = nil;
-	NSString        *shipyard_condition_script = nil;
 	
-	NSMutableArray *conditionScripts = [[NSMutableArray alloc] init];
-
 	foreachkey (shipKey, ioData)
 	{
 		shipEntry = [ioData objectForKey:shipKey];
 		conditions = [shipEntry objectForKey:@"conditions"];
-		condition_script = [shipEntry oo_stringForKey:@"condition_script"];
-		if (condition_script != nil)
-		{
-			if (![conditionScripts containsObject:condition_script])
-			{
-				[conditionScripts addObject:condition_script];
-			}
-		}
 
 		hasShipyard = [shipEntry objectForKey:@"has_shipyard"];
 		if (![hasShipyard isKindOfClass:[NSArray class]])  hasShipyard = nil;	// May also be fuzzy boolean
@@ -1055,15 +1514,6 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 			if (![hasShipyard isKindOfClass:[NSArray class]])  hasShipyard = nil;	// May also be fuzzy boolean
 		}
 		shipyardConditions = [[shipEntry oo_dictionaryForKey:@"_oo_shipyard"] objectForKey:@"conditions"];
-		shipyard_condition_script = [[shipEntry oo_dictionaryForKey:@"_oo_shipyard"] oo_stringForKey:@"condition_script"];
-		if (shipyard_condition_script != nil)
-		{
-			if (![conditionScripts containsObject:shipyard_condition_script])
-			{
-				[conditionScripts addObject:shipyard_condition_script];
-			}
-		}
-
 		
 		if (conditions == nil && hasShipyard && shipyardConditions == nil)  continue;
 		
@@ -1141,10 +1591,7 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 			}
 		}
 	}
-
-	[[OOCacheManager sharedCache] setObject:conditionScripts forKey:@"ship conditions" inCache:@"condition scripts"];
-	[conditionScripts release];
-
+	
 	return YES;
 }
 
@@ -1198,21 +1645,19 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 #endif
 
 
-- (void) mergeShipRoles:(NSString *)roles
-			 forShipKey:(NSString *)shipKey
-	 intoProbabilityMap:(NSMutableDictionary *)probabilitySets
+- (NSDictionary *) roleWeightsForShipKey:(NSString *)shipKey roles:(NSString *)roles
 {
 	NSDictionary			*rolesAndWeights = nil;
 	NSString				*role = nil;
-	OOMutableProbabilitySet	*probSet = nil;
+	NSMutableDictionary		*result = nil;
 
 	
-	/*	probabilitySets is a dictionary whose keys are roles and whose values
-		are mutable probability sets, whose values are ship keys.
+	/*	The result is a dictionary whose keys are the ship's roles and whose
+		values are its weights for each role.
 		
-		When creating new ships Oolite looks up this probability map.
-		To upgrade all soliton 'thargon' roles to 'EQ_THARGON' we need
-		to swap these roles here.
+		When creating new ships Oolite looks up the probability sets built
+		from these. To upgrade all soliton 'thargon' roles to 'EQ_THARGON' we
+		need to swap these roles here.
 	*/
 	
 	rolesAndWeights = OOParseRolesFromString(roles);
@@ -1229,17 +1674,13 @@ static NSString * const	kVisualEffectDataCacheKey = @"visual effect data";
 		rolesAndWeights = mutable;
 	}
 	
+	result = [NSMutableDictionary dictionaryWithCapacity:[rolesAndWeights count]];
 	foreachkey (role, rolesAndWeights)
 	{
-		probSet = [probabilitySets objectForKey:role];
-		if (probSet == nil)
-		{
-			probSet = [OOMutableProbabilitySet probabilitySet];
-			[probabilitySets setObject:probSet forKey:role];
-		}
-		
-		[probSet setWeight:[rolesAndWeights oo_floatForKey:role] forObject:shipKey];
+		[result setObject:@([rolesAndWeights oo_floatForKey:role]) forKey:role];
 	}
+	
+	return result;
 }
 
 
@@ -1792,3 +2233,555 @@ static NSComparisonResult SortDemoCategoriesByName (id a, id b, void* context)
 {
 	return [OOShipLibraryCategoryPlural([[a oo_dictionaryAtIndex:0] oo_stringForKey:@"class"]) compare:OOShipLibraryCategoryPlural([[b oo_dictionaryAtIndex:0] oo_stringForKey:@"class"])];
 }
+
+
+/*	Fingerprints are 64-bit FNV-1a hashes of a canonical encoding of a
+	property list, in which dictionaries are sorted by key, so that the
+	fingerprint only depends on the contents and not on how the property list
+	was put together.
+*/
+typedef struct
+{
+	uint64_t				hash;
+	NSMutableData			*data;		// If not nil, the canonical encoding is also collected here.
+} CanonicalPropertyListSink;
+
+#define kFNVOffsetBasis		14695981039346656037ULL
+#define kFNVPrime			1099511628211ULL
+
+
+static void CanonicalAppendBytes(CanonicalPropertyListSink *sink, const void *bytes, size_t length)
+{
+	const uint8_t			*p = bytes;
+	size_t					i;
+	
+	for (i = 0; i < length; i++)
+	{
+		sink->hash = (sink->hash ^ p[i]) * kFNVPrime;
+	}
+	[sink->data appendBytes:bytes length:length];
+}
+
+
+static void CanonicalAppendTag(CanonicalPropertyListSink *sink, char tag, uint64_t value)
+{
+	uint8_t					bytes[9];
+	unsigned				i;
+	
+	bytes[0] = tag;
+	for (i = 0; i < 8; i++)
+	{
+		bytes[i + 1] = (value >> (i * 8)) & 0xFF;
+	}
+	CanonicalAppendBytes(sink, bytes, sizeof bytes);
+}
+
+
+static void CanonicalAppendPropertyList(CanonicalPropertyListSink *sink, id plist)
+{
+	id						element = nil;
+	
+	if (plist == nil || plist == [NSNull null])
+	{
+		CanonicalAppendTag(sink, 'n', 0);
+	}
+	else if ([plist isKindOfClass:[NSString class]])
+	{
+		const char *string = [plist UTF8String];
+		size_t length = strlen(string);
+		CanonicalAppendTag(sink, 's', length);
+		CanonicalAppendBytes(sink, string, length);
+	}
+	else if ([plist isKindOfClass:[NSNumber class]])
+	{
+		const char *type = [plist objCType];
+		if (type[0] == 'f' || type[0] == 'd')
+		{
+			double value = [plist doubleValue];
+			uint64_t bits;
+			memcpy(&bits, &value, sizeof bits);
+			CanonicalAppendTag(sink, 'r', bits);
+		}
+		else
+		{
+			CanonicalAppendTag(sink, 'i', (uint64_t)[plist longLongValue]);
+		}
+	}
+	else if ([plist isKindOfClass:[NSData class]])
+	{
+		CanonicalAppendTag(sink, 'b', [plist length]);
+		CanonicalAppendBytes(sink, [plist bytes], [plist length]);
+	}
+	else if ([plist isKindOfClass:[NSDate class]])
+	{
+		double value = [plist timeIntervalSinceReferenceDate];
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof bits);
+		CanonicalAppendTag(sink, 't', bits);
+	}
+	else if ([plist isKindOfClass:[NSArray class]])
+	{
+		CanonicalAppendTag(sink, 'a', [plist count]);
+		foreach (element, plist)
+		{
+			CanonicalAppendPropertyList(sink, element);
+		}
+	}
+	else if ([plist isKindOfClass:[NSDictionary class]])
+	{
+		CanonicalAppendTag(sink, 'd', [plist count]);
+		foreach (element, [[plist allKeys] sortedArrayUsingSelector:@selector(compare:)])
+		{
+			CanonicalAppendPropertyList(sink, element);
+			CanonicalAppendPropertyList(sink, [plist objectForKey:element]);
+		}
+	}
+	else
+	{
+		// Not a property list type; shouldn't happen.
+		CanonicalAppendTag(sink, 'o', 0);
+		CanonicalAppendPropertyList(sink, [plist description]);
+	}
+}
+
+
+static NSString *FingerprintString(CanonicalPropertyListSink *sink)
+{
+	return [NSString stringWithFormat:@"%016llx", (unsigned long long)sink->hash];
+}
+
+
+static NSString *PropertyListFingerprint(id plist)
+{
+	CanonicalPropertyListSink sink = { kFNVOffsetBasis, nil };
+	
+	CanonicalAppendPropertyList(&sink, plist);
+	return FingerprintString(&sink);
+}
+
+
+static NSString *ShipEntryFingerprint(id entry, id overridesEntry, id shipyardEntry, id shipyardOverridesEntry)
+{
+	CanonicalPropertyListSink sink = { kFNVOffsetBasis, nil };
+	
+	CanonicalAppendPropertyList(&sink, entry);
+	CanonicalAppendPropertyList(&sink, overridesEntry);
+	CanonicalAppendPropertyList(&sink, shipyardEntry);
+	CanonicalAppendPropertyList(&sink, shipyardOverridesEntry);
+	return FingerprintString(&sink);
+}
+
+
+/*	The keys a raw shipdata.plist entry refers to: its like_ship, and the
+	first token of each old-style subentity declaration or the subentity_key
+	of each new-style one. Keys which don't exist are included, so that the
+	entries referring to them are rebuilt if they are added.
+*/
+static NSArray *ShipEntryReferences(id entry, id overridesEntry)
+{
+	NSMutableArray			*result = nil;
+	NSString				*likeShip = nil;
+	id						declaration = nil;
+	id						subentityKey = nil;
+	NSArray					*tokens = nil;
+	
+	if (![entry isKindOfClass:[NSDictionary class]])  return nil;
+	if ([overridesEntry isKindOfClass:[NSDictionary class]])
+	{
+		entry = [entry dictionaryByAddingEntriesFromDictionary:overridesEntry];
+	}
+	
+	result = [NSMutableArray array];
+	
+	likeShip = [entry oo_stringForKey:@"like_ship"];
+	if (likeShip != nil)  [result addObject:likeShip];
+	
+	foreach (declaration, [entry oo_arrayForKey:@"subentities"])
+	{
+		subentityKey = nil;
+		if ([declaration isKindOfClass:[NSString class]])
+		{
+			tokens = ScanTokensFromString(declaration);
+			if ([tokens count] != 0)  subentityKey = [tokens objectAtIndex:0];
+		}
+		else if ([declaration isKindOfClass:[NSDictionary class]])
+		{
+			subentityKey = [declaration objectForKey:@"subentity_key"];
+		}
+		
+		if ([subentityKey isKindOfClass:[NSString class]] && ![subentityKey isEqualToString:@"*FLASHER*"] && ![result containsObject:subentityKey])
+		{
+			[result addObject:subentityKey];
+		}
+	}
+	
+	return result;
+}
+
+
+//	The reference graph is undirected: each key maps to the set of keys it refers to or is referred to by.
+static void AddReferences(NSMutableDictionary *graph, NSString *shipKey, NSArray *references)
+{
+	NSString				*reference = nil;
+	NSMutableSet			*neighbours = nil;
+	
+	foreach (reference, references)
+	{
+		if (![reference isKindOfClass:[NSString class]])  continue;
+		
+		neighbours = [graph objectForKey:shipKey];
+		if (neighbours == nil)
+		{
+			neighbours = [NSMutableSet set];
+			[graph setObject:neighbours forKey:shipKey];
+		}
+		[neighbours addObject:reference];
+		
+		neighbours = [graph objectForKey:reference];
+		if (neighbours == nil)
+		{
+			neighbours = [NSMutableSet set];
+			[graph setObject:neighbours forKey:reference];
+		}
+		[neighbours addObject:shipKey];
+	}
+}
+
+
+static NSSet *KeysConnectedToKeys(NSSet *keys, NSDictionary *graph)
+{
+	NSMutableSet			*result = nil;
+	NSMutableArray			*pending = nil;
+	NSString				*key = nil;
+	NSString				*neighbour = nil;
+	
+	result = [NSMutableSet setWithSet:keys];
+	pending = [NSMutableArray arrayWithArray:[keys allObjects]];
+	
+	while ([pending count] != 0)
+	{
+		key = [[[pending lastObject] retain] autorelease];
+		[pending removeLastObject];
+		
+		foreach (neighbour, [graph objectForKey:key])
+		{
+			if (![result containsObject:neighbour])
+			{
+				[result addObject:neighbour];
+				[pending addObject:neighbour];
+			}
+		}
+	}
+	
+	return result;
+}
+
+
+//	nil keys means all of them.
+static NSDictionary *SubsetOfDictionary(NSDictionary *dictionary, NSSet *keys)
+{
+	NSMutableDictionary		*result = nil;
+	NSString				*key = nil;
+	id						value = nil;
+	
+	if (keys == nil)  return dictionary;
+	
+	result = [NSMutableDictionary dictionaryWithCapacity:[keys count]];
+	foreach (key, keys)
+	{
+		value = [dictionary objectForKey:key];
+		if (value != nil)  [result setObject:value forKey:key];
+	}
+	
+	return result;
+}
+
+
+//	The file a model name resolves to, or an empty string if there isn't one.
+static NSString *ModelPath(NSString *modelName)
+{
+	NSString *path = [ResourceManager pathForFileNamed:modelName inFolder:@"Models"];
+	return (path != nil) ? path : @"";
+}
+
+
+static BOOL ModelPathsChanged(NSDictionary *modelPaths)
+{
+	NSString				*modelName = nil;
+	
+	foreachkey (modelName, modelPaths)
+	{
+		if (![ModelPath(modelName) isEqual:[modelPaths objectForKey:modelName]])  return YES;
+	}
+	
+	return NO;
+}
+
+
+static NSString *SnapshotVersion(void)
+{
+	NSString *version = [[[NSBundle mainBundle] infoDictionary] objectForKey:@"CFBundleVersion"];
+	return (version != nil) ? version : @"";
+}
+
+
+/*	Add a ship's role weights (from -roleWeightsForShipKey:roles:) to, or
+	remove them from, a role weights dictionary. Role weights taken from a
+	snapshot are immutable, so each role's dictionary is copied the first
+	time it is changed; ownedRoles tracks the ones that have been.
+*/
+static void SetShipRoleWeights(NSMutableDictionary *roleWeights, NSMutableSet *ownedRoles, NSString *shipKey, NSDictionary *shipRoleWeights, BOOL remove)
+{
+	NSString				*role = nil;
+	NSMutableDictionary		*weights = nil;
+	
+	foreachkey (role, shipRoleWeights)
+	{
+		if ([ownedRoles containsObject:role])
+		{
+			weights = [roleWeights objectForKey:role];
+		}
+		else
+		{
+			weights = [[[roleWeights oo_dictionaryForKey:role] mutableCopy] autorelease];
+			if (weights == nil)  weights = [NSMutableDictionary dictionary];
+			[roleWeights setObject:weights forKey:role];
+			[ownedRoles addObject:role];
+		}
+		
+		if (remove)  [weights removeObjectForKey:shipKey];
+		else  [weights setObject:[shipRoleWeights objectForKey:role] forKey:shipKey];
+		
+		if ([weights count] == 0)
+		{
+			[roleWeights removeObjectForKey:role];
+			[ownedRoles removeObject:role];
+		}
+	}
+}
+
+
+#ifndef NDEBUG
+
+enum
+{
+	kIncrementalCheckVariants			= 8
+};
+
+
+@interface OOShipRegistry (OOIncrementalCheck)
+
+- (NSDictionary *) registryStateForComparison;
+- (NSDictionary *) perturbedSnapshot:(NSDictionary *)snapshot variant:(unsigned)variant seed:(RANROTSeed *)ioSeed;
+- (NSString *) runIncrementalCheck;
+
+@end
+
+
+static NSData *CanonicalPropertyListData(id plist)
+{
+	CanonicalPropertyListSink sink = { kFNVOffsetBasis, [NSMutableData data] };
+	
+	CanonicalAppendPropertyList(&sink, plist);
+	return sink.data;
+}
+
+
+//	Pass a snapshot through the same serialization as a stored one.
+static NSDictionary *ReloadedSnapshot(NSDictionary *snapshot)
+{
+	NSData *data = [NSPropertyListSerialization dataFromPropertyList:snapshot format:SNAPSHOT_PLIST_FORMAT errorDescription:NULL];
+	return OOPropertyListFromData(data, @"ship registry snapshot");
+}
+
+
+NSString *OOShipRegistryRunIncrementalCheck(void)
+{
+	return [[OOShipRegistry sharedRegistry] runIncrementalCheck];
+}
+
+
+@implementation OOShipRegistry (OOIncrementalCheck)
+
+//	Everything built by -loadShipDataWithSnapshot:rebuiltCount:.
+- (NSDictionary *) registryStateForComparison
+{
+	NSMutableDictionary		*probabilitySets = nil;
+	NSString				*role = nil;
+	id						conditionScripts = nil;
+	
+	probabilitySets = [NSMutableDictionary dictionaryWithCapacity:[_probabilitySets count]];
+	foreachkey (role, _probabilitySets)
+	{
+		[probabilitySets setObject:[[_probabilitySets objectForKey:role] propertyListRepresentation] forKey:role];
+	}
+	
+	conditionScripts = [[OOCacheManager sharedCache] objectForKey:@"ship conditions" inCache:@"condition scripts"];
+	
+	return @{
+		@"ship data": (_shipData != nil) ? (id)_shipData : (id)[NSNull null],
+		@"player ships": (_playerShips != nil) ? (id)_playerShips : (id)[NSNull null],
+		@"effect data": (_effectData != nil) ? (id)_effectData : (id)[NSNull null],
+		@"role probability sets": probabilitySets,
+		@"condition scripts": (conditionScripts != nil) ? conditionScripts : (id)[NSNull null]
+	};
+}
+
+
+/*	Make a snapshot look as though some entries have since been edited,
+	added or removed, or their models moved, so that parts of the data are
+	rebuilt and the rest reused.
+*/
+- (NSDictionary *) perturbedSnapshot:(NSDictionary *)snapshot variant:(unsigned)variant seed:(RANROTSeed *)ioSeed
+{
+	NSMutableDictionary		*result = nil;
+	NSDictionary			*records = nil;
+	NSMutableDictionary		*newRecords = nil;
+	NSMutableDictionary		*roleWeights = nil;
+	NSMutableSet			*ownedRoles = nil;
+	NSArray					*shipKeys = nil;
+	NSString				*shipKey = nil;
+	NSDictionary			*record = nil;
+	NSMutableDictionary		*newRecord = nil;
+	NSDictionary			*entry = nil;
+	NSString				*removedKey = nil;
+	NSString				*removedRoles = @"oo-incremental-check";
+	
+	result = [[snapshot mutableCopy] autorelease];
+	records = [snapshot oo_dictionaryForKey:kSnapshotShipsKey];
+	newRecords = [[records mutableCopy] autorelease];
+	roleWeights = [[[snapshot oo_dictionaryForKey:kSnapshotRoleWeightsKey] mutableCopy] autorelease];
+	ownedRoles = [NSMutableSet set];
+	shipKeys = [[records allKeys] sortedArrayUsingSelector:@selector(compare:)];
+	
+	foreach (shipKey, shipKeys)
+	{
+		record = [records oo_dictionaryForKey:shipKey];
+		switch (RanrotWithSeed(ioSeed) % 32)
+		{
+			case 0:
+				// Edited.
+				newRecord = [[record mutableCopy] autorelease];
+				[newRecord setObject:@"edited" forKey:kSnapshotFingerprintKey];
+				[newRecords setObject:newRecord forKey:shipKey];
+				break;
+				
+			case 1:
+				// Added.
+				entry = [record oo_dictionaryForKey:kSnapshotEntryKey];
+				if (entry != nil)
+				{
+					SetShipRoleWeights(roleWeights, ownedRoles, shipKey, [self roleWeightsForShipKey:shipKey roles:[entry oo_stringForKey:@"roles"]], YES);
+				}
+				[newRecords removeObjectForKey:shipKey];
+				break;
+				
+			case 2:
+				// Model moved.
+				if ([record oo_stringForKey:kSnapshotModelKey] != nil)
+				{
+					newRecord = [[record mutableCopy] autorelease];
+					[newRecord setObject:@"moved" forKey:kSnapshotModelPathKey];
+					[newRecords setObject:newRecord forKey:shipKey];
+				}
+				break;
+		}
+	}
+	
+	// Removed, along with a reference to some other ship.
+	if ([shipKeys count] != 0)
+	{
+		removedKey = [NSString stringWithFormat:@"oo-incremental-check-removed-%u", variant];
+		entry = @{@"roles": removedRoles, @"model": @"oo-incremental-check.dat"};
+		shipKey = [shipKeys objectAtIndex:RanrotWithSeed(ioSeed) % [shipKeys count]];
+		[newRecords setObject:@{kSnapshotFingerprintKey: @"removed", kSnapshotReferencesKey: @[shipKey], kSnapshotEntryKey: entry} forKey:removedKey];
+		SetShipRoleWeights(roleWeights, ownedRoles, removedKey, [self roleWeightsForShipKey:removedKey roles:removedRoles], NO);
+	}
+	
+	if (variant % 2 != 0)
+	{
+		[result setObject:@"edited" forKey:kSnapshotEffectsFingerprintKey];
+	}
+	
+	[result setObject:newRecords forKey:kSnapshotShipsKey];
+	[result setObject:roleWeights forKey:kSnapshotRoleWeightsKey];
+	return result;
+}
+
+
+/*	Build the registry from scratch, then incrementally from its own
+	snapshot and from perturbed copies of it, checking that every
+	incremental build gives exactly the same data as the full build.
+*/
+- (NSString *) runIncrementalCheck
+{
+	NSAutoreleasePool		*pool = [[NSAutoreleasePool alloc] init];
+	OOProfilingStopwatch	*stopwatch = [OOProfilingStopwatch stopwatch];
+	NSDictionary			*snapshot = nil;
+	NSDictionary			*oldSnapshot = nil;
+	NSData					*reference = nil;
+	NSString				*result = nil;
+	NSUInteger				count = 0, unchangedRebuilt = 0, perturbedRebuilt = 0, mismatches = 0;
+	OOTimeDelta				fullTime, unchangedTime = 0, perturbedTime = 0, elapsed;
+	RANROTSeed				seed = MakeRanrotSeed(0x5B1F7E57);
+	unsigned				variant;
+	
+	[stopwatch reset];
+	snapshot = [self loadShipDataWithSnapshot:nil rebuiltCount:NULL];
+	fullTime = [stopwatch reset];
+	
+	if (snapshot != nil)
+	{
+		reference = CanonicalPropertyListData([self registryStateForComparison]);
+		snapshot = ReloadedSnapshot(snapshot);
+	}
+	
+	for (variant = 0; snapshot != nil && variant <= kIncrementalCheckVariants; variant++)
+	{
+		oldSnapshot = (variant == 0) ? snapshot : [self perturbedSnapshot:snapshot variant:variant seed:&seed];
+		
+		[stopwatch reset];
+		if ([self loadShipDataWithSnapshot:oldSnapshot rebuiltCount:&count] == nil)  count = 0;
+		elapsed = [stopwatch reset];
+		
+		if (variant == 0)
+		{
+			unchangedTime = elapsed;
+			unchangedRebuilt = count;
+		}
+		else
+		{
+			perturbedTime += elapsed;
+			perturbedRebuilt += count;
+		}
+		
+		if (![CanonicalPropertyListData([self registryStateForComparison]) isEqualToData:reference])
+		{
+			mismatches++;
+			OOLog(@"shipData.incrementalCheck.mismatch", @"Incremental build from %@ differs from full build.", (variant == 0) ? @"unchanged snapshot" : [NSString stringWithFormat:@"perturbed snapshot %u", variant]);
+		}
+	}
+	
+	if (snapshot == nil)
+	{
+		result = @"Could not build ship data.";
+	}
+	else
+	{
+		if (mismatches != 0)  [self loadShipDataWithSnapshot:nil rebuiltCount:NULL];
+		
+		result = [NSString stringWithFormat:@"%lu ships: full build %.2f ms; unchanged %.2f ms (%lu rebuilt); %u simulated changes %.2f ms on average (%.0f rebuilt on average)%@",
+				  (unsigned long)[_shipData count], fullTime * 1e3, unchangedTime * 1e3, (unsigned long)unchangedRebuilt,
+				  (unsigned)kIncrementalCheckVariants, perturbedTime * 1e3 / kIncrementalCheckVariants, (double)perturbedRebuilt / kIncrementalCheckVariants,
+				  (mismatches == 0) ? @"" : [NSString stringWithFormat:@" ** %lu MISMATCHES **", (unsigned long)mismatches]];
+	}
+	OOLog(@"shipData.incrementalCheck", @"%@", result);
+	
+	[result retain];
+	[pool release];
+	return [result autorelease];
+}
+
+@end
+
+#endif
@@ -103,6 +103,15 @@ typedef NS_OPTIONS(NSUInteger, OOExpandOptions)
 	If <options & kOOExpandBackslashN>, literal \n in strings (i.e., "\\n") are
 	converted to line breaks. This is used for expanding missiontext.plist
 	entries, which may have literal \n especially in XML format.
+	
+	Strings from descriptions.plist are parsed into tokens once and cached,
+	and output is built in a reused UTF-16 buffer. Expansions with no
+	overrides or locals that don't use kOOExpandGoodRNG are memoized by
+	string, seed, system name, options and RNG state - together with the RNG
+	state they leave behind - unless they refer to player or universe state
+	such as mission variables or %H without a system name. In practice this means repeated system
+	description generation is a table lookup. The caches are discarded when
+	descriptions.plist is reloaded.
 */
 NSString *OOExpandDescriptionString(Random_Seed seed, NSString *string, NSDictionary *overrides, NSDictionary *legacyLocals, NSString *systemName, OOExpandOptions options);
 
@@ -149,6 +158,16 @@ NSString *OOGenerateSystemDescription(Random_Seed seed, NSString *name);
 Random_Seed OOStringExpanderDefaultRandomSeed(void);
 
 
+#ifndef NDEBUG
+/*	Generate all 256 x 8 system descriptions with nothing cached, with token
+	lists cached, and memoized, checking that all three agree (including the
+	RNG state left behind). Returns a summary of times and of the number of
+	objects and buffers allocated by the expander itself.
+*/
+NSString *OOStringExpanderRunBenchmark(void);
+#endif
+
+
 // MARK: Danger zone! Everything beyond this point is scary.
 
 /*	Given an argument list, return a dictionary whose keys are the literal
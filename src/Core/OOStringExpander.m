@@ -33,6 +33,10 @@ MA 02110-1301, USA.
 #import "PlayerEntityScriptMethods.h"
 #import "PlayerEntity.h"
 
+#ifndef NDEBUG
+#import "OOProfilingStopwatch.h"
+#endif
+
 // Don't bother with syntax warnings in Deployment builds.
 #define WARNINGS			OOLITE_DEBUG
 
@@ -56,10 +60,38 @@ enum
 		Recursion limit, for much the same purpose. Without it, we crash about
 		22,000 stack frames deep when trying to expand a = "[a]" on a Mac.
 	*/
-	kRecursionLimit				= 100
+	kRecursionLimit				= 100,
+	
+	/*
+		Size of the memo of deterministic expansions (see
+		OOExpandDescriptionString()). Must be a power of two. 4096 covers
+		the 256 x 8 system descriptions with room to spare.
+	*/
+	kMemoCount					= 4096,
+	
+	/*
+		The shared output buffer is released after use if it has grown
+		beyond this many UTF-16 code elements.
+	*/
+	kMaxRetainedBufferCapacity	= 1 << 16,
+	kInitialBufferCapacity		= 1024
 };
 
 
+/*	OOStringExpansionBuffer
+	
+	Growable UTF-16 output buffer. Expansion appends to a single buffer for
+	the whole operation, including recursive expansions, instead of building
+	an NSMutableString at each level.
+*/
+typedef struct
+{
+	unichar				*characters;
+	NSUInteger			length;
+	NSUInteger			capacity;
+} OOStringExpansionBuffer;
+
+
 /*	OOStringExpansionContext
 	
 	Struct used to store context and caches for the entire string expansion
@@ -77,6 +109,10 @@ typedef struct
 	bool				hasPercentR;		// Set to indicate we need an ExpandPercentR() pass.
 	bool				useGoodRNG;
 	bool				disallowPercentI;
+	bool				isVolatile;			// Set if the result depends on anything but the string, seed, system name and RNG state.
+	bool				useCaches;			// Caches are only used on the main thread.
+	
+	OOStringExpansionBuffer *buffer;
 	
 	NSString			*systemNameWithIan;	// Cache for %I
 	NSString			*randomNameN;		// Cache for %N
@@ -94,23 +130,82 @@ static NSString *GetRandomNameN(OOStringExpansionContext *context);		// %N
 static NSString *GetRandomNameR(OOStringExpansionContext *context);		// %R
 static NSArray *GetSystemDescriptions(OOStringExpansionContext *context);
 
-static void AppendCharacters(NSMutableString **result, const unichar *characters, NSUInteger start, NSUInteger end);
+static void BufferAppendCharacters(OOStringExpansionBuffer *buffer, const unichar *characters, NSUInteger count);
+static void BufferAppendString(OOStringExpansionBuffer *buffer, NSString *string);
+static NSString *BufferStringFromIndex(OOStringExpansionBuffer *buffer, NSUInteger start);
 
 static NSString *NewRandomDigrams(OOStringExpansionContext *context);
 static NSString *OldRandomDigrams(void);
 
 
-// Various bits of expansion logic, each with a comment of its very own at the implementation.
-static NSString *Expand(OOStringExpansionContext *context, NSString *string, NSUInteger sizeLimit, NSUInteger recursionLimit);
+/*	OOStringExpansionToken
+	
+	A parsed piece of a string to expand: a run of literal characters, a
+	[key] (with its key string and operators already extracted), a %-escape,
+	a literal "\\n", or one of the malformed constructs the parser warns about.
+	Parsing a token depends only on the characters and the position, so
+	tokens for strings from descriptions.plist are parsed once and cached
+	(see TokensForString()).
+*/
+typedef enum
+{
+	kTokenLiteral,
+	kTokenKey,
+	kTokenPercentEscape,
+	kTokenBackslashN,
+	kTokenUnbalancedClose,
+	kTokenUnbalancedOpen,
+	kTokenEmptyKey
+} OOStringExpansionTokenType;
+
+
+typedef struct
+{
+	OOStringExpansionTokenType type;
+	bool				allDigits;
+	NSUInteger			start;
+	NSUInteger			length;
+	NSUInteger			keyStart;
+	NSUInteger			keyLength;
+	NSString			*key;				// nil for digit keys.
+	NSString			*operators;			// nil if no | operators.
+} OOStringExpansionToken;
+
+
+@interface OOStringExpansionTokens: NSObject
+{
+@public
+	NSString				*_string;
+	unichar					*_characters;
+	NSUInteger				_length;
+	OOStringExpansionToken	*_tokens;
+	NSUInteger				_count;
+}
+
+- (instancetype) initWithString:(NSString *)string;
+
+@end
 
-static NSString *ExpandKey(OOStringExpansionContext *context, const unichar *characters, NSUInteger size, NSUInteger idx, NSUInteger *replaceLength, NSUInteger sizeLimit, NSUInteger recursionLimit);
-static NSString *ExpandDigitKey(OOStringExpansionContext *context, const unichar *characters, NSUInteger keyStart, NSUInteger keyLength, NSUInteger sizeLimit, NSUInteger recursionLimit);
-static NSString *ExpandStringKey(OOStringExpansionContext *context, NSString *key, NSUInteger sizeLimit, NSUInteger recursionLimit);
+
+static OOStringExpansionTokens *TokensForString(OOStringExpansionContext *context, NSString *string);
+static void ParseToken(const unichar *characters, NSUInteger size, NSUInteger idx, OOStringExpansionToken *outToken);
+static void ParseKeyToken(const unichar *characters, NSUInteger size, NSUInteger idx, OOStringExpansionToken *outToken);
+
+
+// Various bits of expansion logic, each with a comment of its very own at the implementation.
+static void Expand(OOStringExpansionContext *context, NSString *string, NSUInteger sizeLimit, NSUInteger recursionLimit);
+static void ExpandDescriptionsString(OOStringExpansionContext *context, NSString *string, NSUInteger sizeLimit, NSUInteger recursionLimit);
+static void ExpandCharacters(OOStringExpansionContext *context, const unichar *characters, NSUInteger size, const OOStringExpansionToken *tokens, NSUInteger tokenCount, NSUInteger sizeLimit, NSUInteger recursionLimit);
+static bool ExpandToken(OOStringExpansionContext *context, const unichar *characters, NSUInteger size, const OOStringExpansionToken *token, NSUInteger *replaceLength, NSUInteger sizeLimit, NSUInteger recursionLimit);
+
+static bool ExpandKey(OOStringExpansionContext *context, const unichar *characters, const OOStringExpansionToken *token, NSUInteger sizeLimit, NSUInteger recursionLimit);
+static bool ExpandDigitKey(OOStringExpansionContext *context, const unichar *characters, NSUInteger keyStart, NSUInteger keyLength, NSUInteger sizeLimit, NSUInteger recursionLimit);
+static bool ExpandStringKey(OOStringExpansionContext *context, NSString *key, NSUInteger sizeLimit, NSUInteger recursionLimit);
 static NSString *ExpandStringKeyOverride(OOStringExpansionContext *context, NSString *key);
 static NSString *ExpandStringKeySpecial(OOStringExpansionContext *context, NSString *key);
 static NSString *ExpandStringKeyKeyboardBinding(OOStringExpansionContext *context, NSString *key);
 static NSMapTable *SpecialSubstitutionSelectors(void);
-static NSString *ExpandStringKeyFromDescriptions(OOStringExpansionContext *context, NSString *key, NSUInteger sizeLimit, NSUInteger recursionLimit);
+static bool ExpandStringKeyFromDescriptions(OOStringExpansionContext *context, NSString *key, NSUInteger sizeLimit, NSUInteger recursionLimit);
 static NSString *ExpandStringKeyMissionVariable(OOStringExpansionContext *context, NSString *key);
 static NSString *ExpandStringKeyLegacyLocalVariable(OOStringExpansionContext *context, NSString *key);
 static NSString *ExpandLegacyScriptSelectorKey(OOStringExpansionContext *context, NSString *key);
@@ -154,6 +249,58 @@ static void SyntaxIssue(OOStringExpansionContext *context, const char *function,
 #endif
 
 
+/*	Caches.
+	
+	Token lists for strings from descriptions.plist, and the memo of
+	deterministic expansions, are only valid for the descriptions dictionary
+	they were built from. CheckCacheValidity() discards them when Universe
+	loads a new one. The dictionary is retained so its address can't be
+	reused while the caches refer to it.
+	
+	The caches are only used on the main thread.
+*/
+typedef struct
+{
+	NSUInteger			hash;
+	NSString			*string;
+	NSString			*systemName;
+	NSString			*result;
+	Random_Seed			seed;
+	RNG_Seed			entryState;
+	RNG_Seed			exitState;
+	OOExpandOptions		options;
+} OOStringExpansionMemo;
+
+
+static NSDictionary				*sCacheDescriptions = nil;
+static NSMapTable				*sTokenCache = NULL;
+static OOStringExpansionMemo	*sMemos = NULL;
+static OOStringExpansionBuffer	sSharedBuffer;
+static bool						sSharedBufferInUse = false;
+#ifndef NDEBUG
+static bool						sMemoizationDisabled = false;
+#else
+#define sMemoizationDisabled	false
+#endif
+
+static struct
+{
+	unsigned long long	expansions;
+	unsigned long long	memoHits;
+	unsigned long long	tokenListsBuilt;
+	unsigned long long	allocations;		// Objects and buffers allocated by the expander itself.
+} sStats;
+
+
+static void CheckCacheValidity(void);
+static void FlushCaches(void);
+static void FlushMemos(void);
+static NSUInteger MemoHash(NSString *string, NSString *systemName, Random_Seed seed, RNG_Seed state, OOExpandOptions options);
+static OOStringExpansionMemo *MemoSlot(NSUInteger hash);
+static NSString *LookUpMemo(NSString *string, NSString *systemName, Random_Seed seed, OOExpandOptions options, NSUInteger hash, RNG_Seed state);
+static void StoreMemo(NSString *string, NSString *systemName, Random_Seed seed, OOExpandOptions options, NSUInteger hash, RNG_Seed entryState, NSString *result);
+
+
 // MARK: -
 // MARK: Public functions
 
@@ -161,6 +308,39 @@ NSString *OOExpandDescriptionString(Random_Seed seed, NSString *string, NSDictio
 {
 	if (string == nil)  return nil;
 	
+	bool mainThread = [NSThread isMainThread];
+	if (mainThread)  CheckCacheValidity();
+	sStats.expansions++;
+	
+	/*	An expansion without overrides or locals, using the seedable RNG, is
+		a function of the string, seed, system name, options and RNG state,
+		unless it touches player or universe state, which the expander
+		flags as volatile. Such expansions are memoized together with the RNG
+		state they leave behind, so a hit is indistinguishable from a miss.
+		The main beneficiary is system description generation, which seeds
+		the RNG from the system seed.
+	*/
+	bool memoize = mainThread && !sMemoizationDisabled && overrides == nil && legacyLocals == nil && !(options & (kOOExpandGoodRNG | kOOExpandReseedRNG));
+	NSUInteger memoHash = 0;
+	RNG_Seed entryState;
+	if (memoize)
+	{
+		entryState = currentRandomSeed();
+		memoHash = MemoHash(string, systemName, seed, entryState, options);
+		NSString *memoized = LookUpMemo(string, systemName, seed, options, memoHash, entryState);
+		if (memoized != nil)  return memoized;
+	}
+	
+	// Use the shared buffer unless it's already in use higher up the stack.
+	OOStringExpansionBuffer localBuffer = { NULL, 0, 0 };
+	bool useSharedBuffer = mainThread && !sSharedBufferInUse;
+	OOStringExpansionBuffer *buffer = useSharedBuffer ? &sSharedBuffer : &localBuffer;
+	if (useSharedBuffer)
+	{
+		sSharedBufferInUse = true;
+		sSharedBuffer.length = 0;
+	}
+	
 	OOStringExpansionContext context =
 	{
 		.seed = seed,
@@ -169,7 +349,9 @@ NSString *OOExpandDescriptionString(Random_Seed seed, NSString *string, NSDictio
 		.legacyLocals = [legacyLocals retain],
 		.isJavaScript = options & kOOExpandForJavaScript,
 		.convertBackslashN = options & kOOExpandBackslashN,
-		.useGoodRNG = options & kOOExpandGoodRNG
+		.useGoodRNG = options & kOOExpandGoodRNG,
+		.useCaches = mainThread,
+		.buffer = buffer
 	};
 	
 	// Avoid recursive %I expansion by pre-seeding cache with literal %I.
@@ -188,14 +370,17 @@ NSString *OOExpandDescriptionString(Random_Seed seed, NSString *string, NSDictio
 	NSString *result = nil, *intermediate = nil;
 	@try
 	{
-		// TODO: profile caching the results. Would need to keep track of whether we've done something nondeterministic (array selection, %R etc).
 		if (options & kOOExpandKey)
 		{
-			intermediate = ExpandStringKey(&context, string, kStackAllocationLimit, kRecursionLimit);
+			if (ExpandStringKey(&context, string, kStackAllocationLimit, kRecursionLimit))
+			{
+				intermediate = BufferStringFromIndex(buffer, 0);
+			}
 		}
 		else
 		{
-			intermediate = Expand(&context, string, kStackAllocationLimit, kRecursionLimit);
+			Expand(&context, string, kStackAllocationLimit, kRecursionLimit);
+			intermediate = BufferStringFromIndex(buffer, 0);
 		}
 		if (!context.hasPercentR)
 		{
@@ -215,6 +400,20 @@ NSString *OOExpandDescriptionString(Random_Seed seed, NSString *string, NSDictio
 		[context.randomNameN release];
 		[context.randomNameR release];
 		[context.systemDescriptions release];
+		
+		if (useSharedBuffer)
+		{
+			if (sSharedBuffer.capacity > kMaxRetainedBufferCapacity)
+			{
+				free(sSharedBuffer.characters);
+				sSharedBuffer = (OOStringExpansionBuffer){ NULL, 0, 0 };
+			}
+			sSharedBufferInUse = false;
+		}
+		else
+		{
+			free(localBuffer.characters);
+		}
 	}
 	
 	if (options & kOOExpandReseedRNG)
@@ -222,7 +421,12 @@ NSString *OOExpandDescriptionString(Random_Seed seed, NSString *string, NSDictio
 		OORestoreRandomState(savedRandomState);
 	}
 	
-	result = [result copy];
+	if (memoize && !context.isVolatile && result != nil)
+	{
+		StoreMemo(string, systemName, seed, options, memoHash, entryState, result);
+	}
+	
+	[result retain];
 	[pool release];
 	return [result autorelease];
 }
@@ -247,138 +451,271 @@ Random_Seed OOStringExpanderDefaultRandomSeed(void)
 
 /*	Expand(context, string, sizeLimit, recursionLimit)
 	
-	Top-level expander. Expands all types of substitution in a string.
+	Top-level expander. Expands all types of substitution in a string,
+	appending the result to context->buffer.
 	
 	<sizeLimit> is the remaining budget for stack allocation of read buffers.
-	(Expand() is the only function that creates such buffers.) <recursionLimit>
-	limits the number of recursive calls of Expand() that are permitted. If one
-	of the limits would be exceeded, Expand() returns the input string unmodified.
+	(Expand() is the only function that creates such buffers; strings with
+	cached tokens are accounted for the same way so the limits behave the
+	same.) <recursionLimit> limits the number of recursive calls of Expand()
+	that are permitted. If one of the limits would be exceeded, the input
+	string is appended unmodified.
 */
-static NSString *Expand(OOStringExpansionContext *context, NSString *string, NSUInteger sizeLimit, NSUInteger recursionLimit)
+static void Expand(OOStringExpansionContext *context, NSString *string, NSUInteger sizeLimit, NSUInteger recursionLimit)
 {
 	NSCParameterAssert(string != nil && context != NULL && sizeLimit <= kStackAllocationLimit);
 	
 	const NSUInteger size = [string length];
 	
 	// Avoid stack overflow.
-	if (EXPECT_NOT(size > sizeLimit || recursionLimit == 0))  return string;
-	sizeLimit -= size;
-	recursionLimit--;
+	if (EXPECT_NOT(size > sizeLimit || recursionLimit == 0))
+	{
+		BufferAppendString(context->buffer, string);
+		return;
+	}
 	
-	// Nothing to expand in an empty string, and the size-1 thing below would be trouble.
-	if (size == 0)  return string;
+	// Nothing to expand in an empty string.
+	if (size == 0)  return;
 	
 	unichar characters[size];
 	[string getCharacters:characters range:(NSRange){ 0, size }];
 	
-	/*	Beginning of current range of non-special characters. If we encounter
-		a substitution, we'll be copying from here forward.
-	*/
-	NSUInteger copyRangeStart = 0;
+	ExpandCharacters(context, characters, size, NULL, 0, sizeLimit - size, recursionLimit - 1);
+}
+
+
+/*	ExpandDescriptionsString(context, string, sizeLimit, recursionLimit)
+	
+	Like Expand(), for strings from descriptions.plist, which are tokenized
+	once and cached.
+*/
+static void ExpandDescriptionsString(OOStringExpansionContext *context, NSString *string, NSUInteger sizeLimit, NSUInteger recursionLimit)
+{
+	NSCParameterAssert(string != nil && context != NULL && sizeLimit <= kStackAllocationLimit);
 	
-	// Mutable string for result if we perform any substitutions.
-	NSMutableString *result = nil;
+	OOStringExpansionTokens *tokens = TokensForString(context, string);
+	if (tokens == nil)
+	{
+		Expand(context, string, sizeLimit, recursionLimit);
+		return;
+	}
 	
-	/*	The iteration limit is size - 1 because every valid substitution is at
-		least 2 characters long. This way, characters[idx + 1] is always valid.
-	*/
-	for (NSUInteger idx = 0; idx < size - 1; idx++)
+	const NSUInteger size = tokens->_length;
+	if (EXPECT_NOT(size > sizeLimit || recursionLimit == 0))
 	{
-		/*	Main parsing loop. If, at the end of the loop, replacement != nil,
-			we copy the characters from copyRangeStart to idx into the result,
-			the insert replacement, and skip replaceLength characters forward
-			(minus one, because idx is incremented by the loop.)
-		*/
-		NSString *replacement = nil;
-		NSUInteger replaceLength = 0;
-		unichar thisChar = characters[idx];
+		BufferAppendString(context->buffer, string);
+		return;
+	}
+	if (size == 0)  return;
+	
+	ExpandCharacters(context, tokens->_characters, size, tokens->_tokens, tokens->_count, sizeLimit - size, recursionLimit - 1);
+}
+
+
+/*	ExpandCharacters(context, characters, size, tokens, tokenCount, sizeLimit, recursionLimit)
+	
+	Main expansion loop. <tokens> is the pre-parsed token list for
+	<characters>, or NULL to parse as we go.
+	
+	If a token can't be expanded - for instance, an unknown key - its first
+	character is copied literally and parsing resumes at the next character,
+	so "[unknown %H]" still expands %H. This takes us off the pre-parsed
+	path; since a token depends only on its position, we parse as we go
+	until we arrive back at the start of a pre-parsed token.
+*/
+static void ExpandCharacters(OOStringExpansionContext *context, const unichar *characters, NSUInteger size, const OOStringExpansionToken *tokens, NSUInteger tokenCount, NSUInteger sizeLimit, NSUInteger recursionLimit)
+{
+	NSCParameterAssert(context != NULL && characters != NULL && size != 0);
+	
+	OOStringExpansionBuffer *buffer = context->buffer;
+	NSUInteger idx = 0, tokenIdx = 0;
+	
+	while (idx < size)
+	{
+		OOStringExpansionToken parsed;
+		const OOStringExpansionToken *token = NULL;
 		
-		if (thisChar == '[')
+		while (tokenIdx < tokenCount && tokens[tokenIdx].start < idx)  tokenIdx++;
+		if (tokenIdx < tokenCount && tokens[tokenIdx].start == idx)
 		{
-			replacement = ExpandKey(context, characters, size, idx, &replaceLength, sizeLimit, recursionLimit);
+			token = &tokens[tokenIdx++];
 		}
-		else if (thisChar == '%')
+		else
 		{
-			replacement = ExpandPercentEscape(context, characters, size, idx, &replaceLength);
+			ParseToken(characters, size, idx, &parsed);
+			token = &parsed;
 		}
-		else if (thisChar == ']')
+		
+		NSUInteger mark = buffer->length;
+		NSUInteger replaceLength = 0;
+		if (!ExpandToken(context, characters, size, token, &replaceLength, sizeLimit, recursionLimit))
 		{
-			SyntaxWarning(context, @"strings.expand.warning.unbalancedClosingBracket", @"%@", @"Unbalanced ] in string.");
+			BufferAppendCharacters(buffer, characters + idx, 1);
+			idx++;
+			continue;
 		}
-		else if (thisChar == '\\' && context->convertBackslashN)
+		
+		/*	If a replacement is "\x7F", eat the following character. This is
+			used in system_description for the one empty string in [22].
+			If the replacement is the entire string, leave it for the caller
+			to deal with.
+		*/
+		if (token->type != kTokenLiteral && buffer->length - mark == 1 && buffer->characters[mark] == 0x7F)
 		{
-			if (characters[idx + 1] == 'n')
+			if (idx + replaceLength < size)
 			{
-				replaceLength = 2;
-				replacement = @"\n";
+				buffer->length = mark;
+				replaceLength++;
+			}
+			else if (idx != 0)
+			{
+				buffer->length = mark;
 			}
-		}
-		else
-		{
-			// No token start character, so we definitely have no replacement.
-			continue;
 		}
 		
-		if (replacement != nil)
+		idx += replaceLength;
+	}
+}
+
+
+/*	ExpandToken(context, characters, size, token, replaceLength, sizeLimit, recursionLimit)
+	
+	Expand one token, appending the result to context->buffer. Returns false,
+	having appended nothing, if there is no substitution for the token.
+	<replaceLength> is set to the number of characters consumed.
+*/
+static bool ExpandToken(OOStringExpansionContext *context, const unichar *characters, NSUInteger size, const OOStringExpansionToken *token, NSUInteger *replaceLength, NSUInteger sizeLimit, NSUInteger recursionLimit)
+{
+	NSCParameterAssert(context != NULL && characters != NULL && token != NULL && replaceLength != NULL);
+	
+	*replaceLength = token->length;
+	
+	switch (token->type)
+	{
+		case kTokenLiteral:
+			BufferAppendCharacters(context->buffer, characters + token->start, token->length);
+			return true;
+			
+		case kTokenKey:
+			return ExpandKey(context, characters, token, sizeLimit, recursionLimit);
+			
+		case kTokenPercentEscape:
 		{
-			/*	If replacement string is "\x7F", eat the following character.
-				This is used in system_description for the one empty string
-				in [22].
-			*/
-			if ([replacement isEqualToString:@"\x7F"] && replaceLength < size)
+			NSString *replacement = ExpandPercentEscape(context, characters, size, token->start, replaceLength);
+			if (replacement == nil)  return false;
+			BufferAppendString(context->buffer, replacement);
+			return true;
+		}
+			
+		case kTokenBackslashN:
+			if (context->convertBackslashN)
 			{
-				replaceLength++;
-				replacement = @"";
+				unichar lineBreak = '\n';
+				BufferAppendCharacters(context->buffer, &lineBreak, 1);
 			}
-			
-			// Avoid copying if we're replacing the entire input string.
-			if (copyRangeStart == 0 && replaceLength == size)
+			else
 			{
-				return replacement;
+				BufferAppendCharacters(context->buffer, characters + token->start, 2);
 			}
+			return true;
 			
-			// Write the pending literal segment to result. This also allocates result if needed.
-			AppendCharacters(&result, characters, copyRangeStart, idx);
+		case kTokenUnbalancedClose:
+			SyntaxWarning(context, @"strings.expand.warning.unbalancedClosingBracket", @"%@", @"Unbalanced ] in string.");
+			return false;
 			
-			[result appendString:replacement];
+		case kTokenUnbalancedOpen:
+			SyntaxWarning(context, @"strings.expand.warning.unbalancedOpeningBracket", @"%@", @"Unbalanced [ in string.");
+			return false;
 			
-			// Skip over replaced part and start a new literal segment.
-			idx += replaceLength - 1;
-			copyRangeStart = idx + 1;
-		}
+		case kTokenEmptyKey:
+			SyntaxWarning(context, @"strings.expand.warning.emptyKey", @"%@", @"Invalid expansion code [] string. (To avoid this message, use %%[%%].)");
+			return false;
 	}
 	
-	if (result != nil)
+	return false;
+}
+
+
+/*	IsTokenStart(characters, size, idx)
+	
+	True if a token other than a literal run starts at <idx>. Every such token
+	is at least two characters long, so the last character never starts one.
+	\n is recognized regardless of kOOExpandBackslashN, so that tokens can be
+	cached independently of options.
+*/
+OOINLINE bool IsTokenStart(const unichar *characters, NSUInteger size, NSUInteger idx)
+{
+	if (idx + 1 >= size)  return false;
+	
+	unichar thisChar = characters[idx];
+	return thisChar == '[' || thisChar == '%' || thisChar == ']' || (thisChar == '\\' && characters[idx + 1] == 'n');
+}
+
+
+/*	ParseToken(characters, size, idx, outToken)
+	
+	Parse the token starting at <idx>. Key and operator strings in the token
+	are autoreleased.
+*/
+static void ParseToken(const unichar *characters, NSUInteger size, NSUInteger idx, OOStringExpansionToken *outToken)
+{
+	NSCParameterAssert(characters != NULL && idx < size && outToken != NULL);
+	
+	*outToken = (OOStringExpansionToken){ .start = idx };
+	
+	if (!IsTokenStart(characters, size, idx))
 	{
-		// Append any trailing literal segment.
-		AppendCharacters(&result, characters, copyRangeStart, size);
+		NSUInteger end = idx + 1;
+		while (end < size && !IsTokenStart(characters, size, end))  end++;
 		
-		// Don't turn result immutable; doing it once at top level is sufficient.
-		return result;
+		outToken->type = kTokenLiteral;
+		outToken->length = end - idx;
+		return;
 	}
-	else
+	
+	switch (characters[idx])
 	{
-		// No substitutions, return original string.
-		return string;
+		case '[':
+			ParseKeyToken(characters, size, idx, outToken);
+			break;
+			
+		case '%':
+			/*	%J### and %G###### are longer; the expansion reports the
+				actual length consumed, this is just where the next cached
+				token starts.
+			*/
+			outToken->type = kTokenPercentEscape;
+			outToken->length = 2;
+			if (characters[idx + 1] == 'J' && size - idx >= 5)  outToken->length = 5;
+			else if (characters[idx + 1] == 'G' && size - idx >= 8)  outToken->length = 8;
+			break;
+			
+		case ']':
+			outToken->type = kTokenUnbalancedClose;
+			outToken->length = 1;
+			break;
+			
+		default:
+			outToken->type = kTokenBackslashN;
+			outToken->length = 2;
 	}
 }
 
 
-/*	ExpandKey(context, characters, size, idx, replaceLength, sizeLimit, recursionLimit)
+/*	ParseKeyToken(characters, size, idx, outToken)
 	
-	Expand a substitution key, i.e. a section surrounded by square brackets.
-	On entry, <idx> is the offset to an opening bracket. ExpandKey() searches
-	for the balancing closing bracket, and if it is found dispatches to either
-	ExpandDigitKey() (for a key consisting only of digits) or ExpandStringKey()
-	(for anything else).
+	Parse a substitution key, i.e. a section surrounded by square brackets.
+	On entry, <idx> is the offset to an opening bracket. ParseKeyToken()
+	searches for the balancing closing bracket and determines whether the key
+	consists only of digits.
 	
 	The key may be terminated by a vertical bar |, followed by an operator. An
 	operator is an identifier, optionally followed by a colon and additional
 	text, and may be terminated with another bar and operator.
 */
-static NSString *ExpandKey(OOStringExpansionContext *context, const unichar *characters, NSUInteger size, NSUInteger idx, NSUInteger *replaceLength, NSUInteger sizeLimit, NSUInteger recursionLimit)
+static void ParseKeyToken(const unichar *characters, NSUInteger size, NSUInteger idx, OOStringExpansionToken *outToken)
 {
-	NSCParameterAssert(context != NULL && characters != NULL && replaceLength != NULL);
+	NSCParameterAssert(characters != NULL && outToken != NULL);
 	NSCParameterAssert(characters[idx] == '[');
 	
 	// Find the balancing close bracket.
@@ -399,39 +736,75 @@ static NSString *ExpandKey(OOStringExpansionContext *context, const unichar *cha
 	// Fail if no balancing bracket.
 	if (EXPECT_NOT(balanceCount != 0))
 	{
-		SyntaxWarning(context, @"strings.expand.warning.unbalancedOpeningBracket", @"%@", @"Unbalanced [ in string.");
-		return nil;
+		outToken->type = kTokenUnbalancedOpen;
+		outToken->length = 1;
+		return;
 	}
 	
 	NSUInteger totalLength = end - idx;
-	*replaceLength = totalLength;
 	NSUInteger keyStart = idx + 1, keyLength = totalLength - 2;
 	if (firstBar != 0)  keyLength = firstBar - idx - 1;
 	
 	if (EXPECT_NOT(keyLength == 0))
 	{
-		SyntaxWarning(context, @"strings.expand.warning.emptyKey", @"%@", @"Invalid expansion code [] string. (To avoid this message, use %%[%%].)");
-		return nil;
+		outToken->type = kTokenEmptyKey;
+		outToken->length = 1;
+		return;
 	}
 	
-	NSString *expanded = nil;
-	if (allDigits)
+	outToken->type = kTokenKey;
+	outToken->length = totalLength;
+	outToken->keyStart = keyStart;
+	outToken->keyLength = keyLength;
+	outToken->allDigits = allDigits;
+	if (!allDigits)
+	{
+		outToken->key = [NSString stringWithCharacters:characters + keyStart length:keyLength];
+		sStats.allocations++;
+	}
+	if (firstBar != 0)
 	{
-		expanded = ExpandDigitKey(context, characters, keyStart, keyLength, sizeLimit, recursionLimit);
+		outToken->operators = [NSString stringWithCharacters:characters + firstBar + 1 length:end - firstBar - 2];
+		sStats.allocations++;
+	}
+}
+
+
+/*	ExpandKey(context, characters, token, sizeLimit, recursionLimit)
+	
+	Expand a parsed substitution key by dispatching to either ExpandDigitKey()
+	(for a key consisting only of digits) or ExpandStringKey() (for anything
+	else), then applying any operators.
+*/
+static bool ExpandKey(OOStringExpansionContext *context, const unichar *characters, const OOStringExpansionToken *token, NSUInteger sizeLimit, NSUInteger recursionLimit)
+{
+	NSCParameterAssert(context != NULL && characters != NULL && token != NULL && token->type == kTokenKey);
+	
+	NSUInteger mark = context->buffer->length;
+	bool found;
+	
+	if (token->allDigits)
+	{
+		found = ExpandDigitKey(context, characters, token->keyStart, token->keyLength, sizeLimit, recursionLimit);
 	}
 	else
 	{
-		NSString *key = [NSString stringWithCharacters:characters + keyStart length:keyLength];
-		expanded = ExpandStringKey(context, key, sizeLimit, recursionLimit);
+		found = ExpandStringKey(context, token->key, sizeLimit, recursionLimit);
 	}
 	
-	if (firstBar != 0)
+	if (token->operators != nil)
 	{
-		NSString *operators = [NSString stringWithCharacters:characters + firstBar + 1 length:end - firstBar - 2];
-		expanded = ApplyOperators(expanded, operators);
+		// Operators work on strings, and are also applied to unknown keys.
+		NSString *expanded = found ? BufferStringFromIndex(context->buffer, mark) : nil;
+		context->buffer->length = mark;
+		
+		expanded = ApplyOperators(expanded, token->operators);
+		if (expanded == nil)  return false;
+		BufferAppendString(context->buffer, expanded);
+		return true;
 	}
 	
-	return expanded;
+	return found;
 }
 
 
@@ -550,9 +923,10 @@ static NSString *ApplyOneOperator(NSString *string, NSString *op, NSString *para
 	Digit-only keys are looked up in the system_description array in
 	descriptions.plist, which is expected to contain only arrays of strings (no
 	loose strings). When an array is retrieved, a string is selected from it
-	at random and the result is expanded recursively by calling Expand().
+	at random and the result is expanded recursively by calling
+	ExpandDescriptionsString().
 */
-static NSString *ExpandDigitKey(OOStringExpansionContext *context, const unichar *characters, NSUInteger keyStart, NSUInteger keyLength, NSUInteger sizeLimit, NSUInteger recursionLimit)
+static bool ExpandDigitKey(OOStringExpansionContext *context, const unichar *characters, NSUInteger keyStart, NSUInteger keyLength, NSUInteger sizeLimit, NSUInteger recursionLimit)
 {
 	NSCParameterAssert(context != NULL && characters != NULL);
 	
@@ -579,7 +953,7 @@ static NSString *ExpandDigitKey(OOStringExpansionContext *context, const unichar
 			// This is out of the scope of whatever triggered it, so shouldn't be a JS warning.
 			OOLogERR(@"strings.expand.invalidData", @"%@", @"descriptions.plist entry system_description must be an array of arrays of strings.");
 		}
-		return nil;
+		return false;
 	}
 	
 	// Select a random sub-entry.
@@ -602,7 +976,9 @@ static NSString *ExpandDigitKey(OOStringExpansionContext *context, const unichar
 	
 	// Look up and recursively expand string.
 	NSString *string = [entry oo_stringAtIndex:selection];
-	return Expand(context, string, sizeLimit, recursionLimit);
+	if (EXPECT_NOT(string == nil))  return false;
+	ExpandDescriptionsString(context, string, sizeLimit, recursionLimit);
+	return true;
 }
 
 
@@ -610,8 +986,9 @@ static NSString *ExpandDigitKey(OOStringExpansionContext *context, const unichar
 	
 	Expand a key (as per ExpandKey()) which doesn't consist entirely of digits.
 	Looks for the key in a number of different places in prioritized order.
+	Returns false, having appended nothing, if the key is unknown.
 */
-static NSString *ExpandStringKey(OOStringExpansionContext *context, NSString *key, NSUInteger sizeLimit, NSUInteger recursionLimit)
+static bool ExpandStringKey(OOStringExpansionContext *context, NSString *key, NSUInteger sizeLimit, NSUInteger recursionLimit)
 {
 	NSCParameterAssert(context != NULL && key != nil);
 	
@@ -621,8 +998,8 @@ static NSString *ExpandStringKey(OOStringExpansionContext *context, NSString *ke
 	// Specials override descriptions.plist.
 	if (result == nil)  result = ExpandStringKeySpecial(context, key);
 
-	// Now try descriptions.plist.
-	if (result == nil)  result = ExpandStringKeyFromDescriptions(context, key, sizeLimit, recursionLimit);
+	// Now try descriptions.plist, which expands directly into the buffer.
+	if (result == nil && ExpandStringKeyFromDescriptions(context, key, sizeLimit, recursionLimit))  return true;
 
 	// For efficiency, descriptions.plist overrides keybindings.
 	// OXPers should therefore avoid oolite_key_ description keys
@@ -642,7 +1019,9 @@ static NSString *ExpandStringKey(OOStringExpansionContext *context, NSString *ke
 	if (result == nil)  ReportWarningForUnknownKey(context, key);
 #endif
 	
-	return result;
+	if (result == nil)  return false;
+	BufferAppendString(context->buffer, result);
+	return true;
 }
 
 
@@ -689,6 +1068,7 @@ static NSString *ExpandStringKeySpecial(OOStringExpansionContext *context, NSStr
 	SEL selector = NSMapGet(specials, key);
 	if (selector != NULL)
 	{
+		context->isVolatile = true;
 		NSCAssert2([PLAYER respondsToSelector:selector], @"Special string expansion selector %@ for [%@] is not implemented.", NSStringFromSelector(selector), key);
 		
 		NSString *result = [PLAYER performSelector:selector];
@@ -712,6 +1092,7 @@ static NSString *ExpandStringKeyKeyboardBinding(OOStringExpansionContext *contex
 	NSCParameterAssert(context != NULL && key != nil);
 	if ([key hasPrefix:@"oolite_key_"])
 	{
+		context->isVolatile = true;
 		NSString *binding = [key substringFromIndex:7];
 		return [PLAYER keyBindingDescription:binding];
 	}
@@ -759,9 +1140,10 @@ static NSMapTable *SpecialSubstitutionSelectors(void)
 	may be single strings or arrays of strings. For arrays, one of the strings
 	is selected at random.
 	
-	Matched strings are expanded recursively by calling Expand().
+	Matched strings are expanded recursively by calling
+	ExpandDescriptionsString().
 */
-static NSString *ExpandStringKeyFromDescriptions(OOStringExpansionContext *context, NSString *key, NSUInteger sizeLimit, NSUInteger recursionLimit)
+static bool ExpandStringKeyFromDescriptions(OOStringExpansionContext *context, NSString *key, NSUInteger sizeLimit, NSUInteger recursionLimit)
 {
 	id value = [[UNIVERSE descriptions] objectForKey:key];
 	if (value != nil)
@@ -776,14 +1158,15 @@ static NSString *ExpandStringKeyFromDescriptions(OOStringExpansionContext *conte
 		{
 			// This is out of the scope of whatever triggered it, so shouldn't be a JS warning.
 			OOLogERR(@"strings.expand.invalidData", @"String expansion value %@ for [%@] from descriptions.plist is not a string or number.", [value shortDescription], key);
-			return nil;
+			return false;
 		}
 		
 		// Expand recursively.
-		return Expand(context, value, sizeLimit, recursionLimit);
+		ExpandDescriptionsString(context, value, sizeLimit, recursionLimit);
+		return true;
 	}
 	
-	return nil;
+	return false;
 }
 
 
@@ -795,6 +1178,7 @@ static NSString *ExpandStringKeyMissionVariable(OOStringExpansionContext *contex
 {
 	if ([key hasPrefix:@"mission_"])
 	{
+		context->isVolatile = true;
 		return [PLAYER missionVariableForKey:key];
 	}
 	
@@ -828,6 +1212,7 @@ static NSString *ExpandLegacyScriptSelectorKey(OOStringExpansionContext *context
 	
 	if (selector != NULL)
 	{
+		context->isVolatile = true;
 		return [[PLAYER performSelector:selector] description];
 	}
 	else
@@ -961,9 +1346,11 @@ static NSString *ExpandPercentEscape(OOStringExpansionContext *context, const un
 			return @"%R";
 			
 		case 'G':
+			context->isVolatile = true;		// System names can be changed by scripts.
 			return ExpandSystemNameForGalaxyEscape(context, characters, size, idx, replaceLength);
 			
 		case 'J':
+			context->isVolatile = true;
 			return ExpandSystemNameEscape(context, characters, size, idx, replaceLength);
 			
 		case '%':
@@ -1130,39 +1517,297 @@ static NSString *ExpandSystemNameEscape(OOStringExpansionContext *context, const
 }
 
 
-static void AppendCharacters(NSMutableString **result, const unichar *characters, NSUInteger start, NSUInteger end)
+// MARK: -
+// MARK: Buffer
+
+
+static void BufferReserve(OOStringExpansionBuffer *buffer, NSUInteger additional)
 {
-	NSCParameterAssert(result != NULL && characters != NULL && start <= end);
+	NSCParameterAssert(buffer != NULL);
+	
+	NSUInteger required = buffer->length + additional;
+	if (EXPECT(required <= buffer->capacity))  return;
 	
-	if (*result == nil)
+	NSUInteger capacity = MAX(buffer->capacity * 2, (NSUInteger)kInitialBufferCapacity);
+	if (capacity < required)  capacity = required;
+	
+	unichar *characters = realloc(buffer->characters, capacity * sizeof *characters);
+	if (EXPECT_NOT(characters == NULL))
 	{
-		// Ensure there is a string. We want this even if the range is empty.
-		*result = [NSMutableString string];
+		[NSException raise:NSMallocException format:@"Could not allocate %lu characters for string expansion.", (unsigned long)capacity];
 	}
 	
-	if (start == end)  return;
+	buffer->characters = characters;
+	buffer->capacity = capacity;
+	sStats.allocations++;
+}
+
+
+static void BufferAppendCharacters(OOStringExpansionBuffer *buffer, const unichar *characters, NSUInteger count)
+{
+	NSCParameterAssert(buffer != NULL && characters != NULL);
+	
+	if (count == 0)  return;
+	BufferReserve(buffer, count);
+	memcpy(buffer->characters + buffer->length, characters, count * sizeof *characters);
+	buffer->length += count;
+}
+
+
+static void BufferAppendString(OOStringExpansionBuffer *buffer, NSString *string)
+{
+	NSCParameterAssert(buffer != NULL);
 	
-	/*	What we want here is a method like -[NSMutableString
-		appendCharacters:(unichar)characters length:(NSUInteger)length], which
-		unfortunately doesn't exist. On Mac OS X, CoreFoundation provides an
-		equivalent. For GNUstep, we have to use a temporary string.
+	NSUInteger count = [string length];
+	if (count == 0)  return;
+	BufferReserve(buffer, count);
+	[string getCharacters:buffer->characters + buffer->length range:(NSRange){ 0, count }];
+	buffer->length += count;
+}
+
+
+static NSString *BufferStringFromIndex(OOStringExpansionBuffer *buffer, NSUInteger start)
+{
+	NSCParameterAssert(buffer != NULL && start <= buffer->length);
+	
+	sStats.allocations++;
+	return [[[NSString alloc] initWithCharacters:buffer->characters + start length:buffer->length - start] autorelease];
+}
+
+
+// MARK: -
+// MARK: Caches
+
+
+@implementation OOStringExpansionTokens
+
+- (instancetype) initWithString:(NSString *)string
+{
+	NSParameterAssert(string != nil);
+	
+	if ((self = [super init]))
+	{
+		_string = [string retain];
+		_length = [string length];
+		sStats.allocations++;
 		
-		TODO: build the output string in a fixed-size stack buffer instead.
-	*/
-#if OOLITE_MAC_OS_X
-	CFStringAppendCharacters((CFMutableStringRef)*result, characters + start, end - start);
-#else
-	NSString *temp = [[NSString alloc] initWithCharacters:characters + start length:end - start];
-	[*result appendString:temp];
-	[temp release];
-#endif
+		if (_length != 0)
+		{
+			NSUInteger capacity = 8, idx = 0;
+			_characters = malloc(_length * sizeof *_characters);
+			_tokens = malloc(capacity * sizeof *_tokens);
+			sStats.allocations += 2;
+			if (_characters == NULL || _tokens == NULL)
+			{
+				[self release];
+				return nil;
+			}
+			[string getCharacters:_characters range:(NSRange){ 0, _length }];
+			
+			while (idx < _length)
+			{
+				if (_count == capacity)
+				{
+					capacity *= 2;
+					OOStringExpansionToken *tokens = realloc(_tokens, capacity * sizeof *_tokens);
+					sStats.allocations++;
+					if (tokens == NULL)
+					{
+						[self release];
+						return nil;
+					}
+					_tokens = tokens;
+				}
+				
+				OOStringExpansionToken *token = &_tokens[_count];
+				ParseToken(_characters, _length, idx, token);
+				[token->key retain];
+				[token->operators retain];
+				_count++;
+				
+				idx += token->length;
+			}
+		}
+	}
+	
+	return self;
+}
+
+
+- (void) dealloc
+{
+	NSUInteger i;
+	for (i = 0; i < _count; i++)
+	{
+		[_tokens[i].key release];
+		[_tokens[i].operators release];
+	}
+	free(_tokens);
+	free(_characters);
+	[_string release];
+	
+	[super dealloc];
+}
+
+
+- (NSString *) descriptionComponents
+{
+	return [NSString stringWithFormat:@"%lu tokens", (unsigned long)_count];
+}
+
+@end
+
+
+/*	TokensForString(context, string)
+	
+	Retrieve the cached token list for a string from descriptions.plist,
+	building it if necessary. Strings are looked up by identity; the token
+	list retains the string, so its address can't be reused while cached.
+*/
+static OOStringExpansionTokens *TokensForString(OOStringExpansionContext *context, NSString *string)
+{
+	NSCParameterAssert(context != NULL && string != nil);
+	
+	if (!context->useCaches)  return nil;
+	
+	if (sTokenCache == NULL)
+	{
+		sTokenCache = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks, NSObjectMapValueCallBacks, 1024);
+	}
+	
+	OOStringExpansionTokens *tokens = NSMapGet(sTokenCache, string);
+	if (tokens == nil)
+	{
+		tokens = [[OOStringExpansionTokens alloc] initWithString:string];
+		if (tokens == nil)  return nil;
+		
+		NSMapInsertKnownAbsent(sTokenCache, string, tokens);
+		[tokens release];
+		sStats.tokenListsBuilt++;
+	}
+	
+	return tokens;
+}
+
+
+static void CheckCacheValidity(void)
+{
+	NSDictionary *descriptions = [UNIVERSE descriptions];
+	if (EXPECT(descriptions == sCacheDescriptions))  return;
+	
+	FlushCaches();
+	[sCacheDescriptions release];
+	sCacheDescriptions = [descriptions retain];
 }
 
 
+static void FlushCaches(void)
+{
+	if (sTokenCache != NULL)  NSResetMapTable(sTokenCache);
+	FlushMemos();
+}
+
+
+static void FlushMemos(void)
+{
+	if (sMemos != NULL)
+	{
+		NSUInteger i;
+		for (i = 0; i < kMemoCount; i++)
+		{
+			[sMemos[i].string release];
+			[sMemos[i].systemName release];
+			[sMemos[i].result release];
+		}
+		memset(sMemos, 0, kMemoCount * sizeof *sMemos);
+	}
+}
+
+
+static NSUInteger MemoHash(NSString *string, NSString *systemName, Random_Seed seed, RNG_Seed state, OOExpandOptions options)
+{
+	NSUInteger hash = [string hash];
+	hash = hash * 31 + [systemName hash];
+	hash = hash * 31 + ((uint32_t)seed.a | (uint32_t)seed.b << 8 | (uint32_t)seed.c << 16 | (uint32_t)seed.d << 24);
+	hash = hash * 31 + ((uint32_t)seed.e | (uint32_t)seed.f << 8);
+	hash = hash * 31 + ((uint32_t)state.a ^ (uint32_t)state.b << 8 ^ (uint32_t)state.c << 16 ^ (uint32_t)state.d << 24);
+	hash = hash * 31 + options;
+	
+	// Mix high bits into the low bits used to pick a slot.
+	hash ^= hash >> 16;
+	hash *= 0x45D9F3B;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+
+static OOStringExpansionMemo *MemoSlot(NSUInteger hash)
+{
+	if (sMemos == NULL)
+	{
+		sMemos = calloc(kMemoCount, sizeof *sMemos);
+		if (sMemos == NULL)  return NULL;
+	}
+	return &sMemos[hash & (kMemoCount - 1)];
+}
+
+
+OOINLINE bool EqualRNGStates(RNG_Seed a, RNG_Seed b)
+{
+	return a.a == b.a && a.b == b.b && a.c == b.c && a.d == b.d;
+}
+
+
+static NSString *LookUpMemo(NSString *string, NSString *systemName, Random_Seed seed, OOExpandOptions options, NSUInteger hash, RNG_Seed state)
+{
+	OOStringExpansionMemo *memo = MemoSlot(hash);
+	if (memo == NULL || memo->result == nil)  return nil;
+	
+	if (memo->hash == hash &&
+		memo->options == options &&
+		equal_seeds(memo->seed, seed) &&
+		EqualRNGStates(memo->entryState, state) &&
+		(memo->string == string || [memo->string isEqualToString:string]) &&
+		(memo->systemName == systemName || [memo->systemName isEqualToString:systemName]))
+	{
+		setRandomSeed(memo->exitState);
+		sStats.memoHits++;
+		return [[memo->result retain] autorelease];
+	}
+	
+	return nil;
+}
+
+
+static void StoreMemo(NSString *string, NSString *systemName, Random_Seed seed, OOExpandOptions options, NSUInteger hash, RNG_Seed entryState, NSString *result)
+{
+	OOStringExpansionMemo *memo = MemoSlot(hash);
+	if (memo == NULL)  return;
+	
+	[memo->string release];
+	[memo->systemName release];
+	[memo->result release];
+	
+	memo->hash = hash;
+	memo->string = [string copy];
+	memo->systemName = [systemName copy];
+	memo->result = [result retain];
+	memo->seed = seed;
+	memo->entryState = entryState;
+	memo->exitState = currentRandomSeed();
+	memo->options = options;
+}
+
+
+// MARK: -
+// MARK: Lazy accessors
+
+
 static NSString *GetSystemName(OOStringExpansionContext *context)
 {
 	NSCParameterAssert(context != NULL);
 	if (context->systemName == nil) {
+		context->isVolatile = true;
 		context->systemName = [[UNIVERSE getSystemName:[PLAYER systemID]] retain];
 	}
 	
@@ -1176,6 +1821,7 @@ static NSString *GetSystemNameIan(OOStringExpansionContext *context)
 	
 	if (context->systemNameWithIan == nil)
 	{
+		context->isVolatile = true;
 		context->systemNameWithIan = [OOExpandWithOptions(context->seed, kOOExpandDisallowPercentI | kOOExpandGoodRNG | kOOExpandKey, @"planetname-possessive") retain];
 	}
 	
@@ -1292,3 +1938,123 @@ static void SyntaxIssue(OOStringExpansionContext *context, const char *function,
 	
 	va_end(args);
 }
+
+
+#ifndef NDEBUG
+
+enum
+{
+	kBenchmarkGalaxyCount	= kOOMaximumGalaxyID + 1,
+	kBenchmarkSystemCount	= kOOMaximumSystemID + 1,
+	kBenchmarkCount			= kBenchmarkGalaxyCount * kBenchmarkSystemCount
+};
+
+
+typedef struct
+{
+	OOTimeDelta				time;
+	unsigned long long		allocations;
+	unsigned long long		memoHits;
+	NSUInteger				mismatches;
+} OOStringExpansionBenchmarkPass;
+
+
+static OOStringExpansionBenchmarkPass RunBenchmarkPass(const Random_Seed *seeds, NSArray *names, NSMutableArray *results, RNG_Seed *exitStates, OOProfilingStopwatch *stopwatch)
+{
+	OOStringExpansionBenchmarkPass pass = { 0, 0, 0, 0 };
+	unsigned long long allocations = sStats.allocations, memoHits = sStats.memoHits;
+	bool reference = [results count] == 0;
+	NSUInteger i;
+	
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	[stopwatch reset];
+	for (i = 0; i < kBenchmarkCount; i++)
+	{
+		NSString *description = OOGenerateSystemDescription(seeds[i], [names objectAtIndex:i]);
+		RNG_Seed exitState = currentRandomSeed();
+		
+		if (reference)
+		{
+			[results addObject:description ?: @""];
+			exitStates[i] = exitState;
+		}
+		else if (![[results objectAtIndex:i] isEqualToString:description ?: @""] || !EqualRNGStates(exitStates[i], exitState))
+		{
+			pass.mismatches++;
+		}
+	}
+	pass.time = [stopwatch reset];
+	[pool release];
+	
+	pass.allocations = sStats.allocations - allocations;
+	pass.memoHits = sStats.memoHits - memoHits;
+	return pass;
+}
+
+
+NSString *OOStringExpanderRunBenchmark(void)
+{
+	NSAutoreleasePool			*pool = [[NSAutoreleasePool alloc] init];
+	OOProfilingStopwatch		*stopwatch = [OOProfilingStopwatch stopwatch];
+	OORandomState				savedRandomState = OOSaveRandomState();
+	OOSystemDescriptionManager	*systemManager = [UNIVERSE systemManager];
+	Random_Seed					*seeds = malloc(kBenchmarkCount * sizeof *seeds);
+	RNG_Seed					*exitStates = malloc(kBenchmarkCount * sizeof *exitStates);
+	NSMutableArray				*names = [NSMutableArray arrayWithCapacity:kBenchmarkCount];
+	NSMutableArray				*results = [NSMutableArray arrayWithCapacity:kBenchmarkCount];
+	bool						wasMemoizationDisabled = sMemoizationDisabled;
+	OOGalaxyID					galaxy;
+	OOSystemID					system;
+	
+	if (seeds == NULL || exitStates == NULL)
+	{
+		free(seeds);
+		free(exitStates);
+		[pool release];
+		return @"Could not allocate benchmark data.";
+	}
+	
+	CheckCacheValidity();
+	for (galaxy = 0; galaxy < kBenchmarkGalaxyCount; galaxy++)
+	{
+		for (system = 0; system < kBenchmarkSystemCount; system++)
+		{
+			seeds[galaxy * kBenchmarkSystemCount + system] = [systemManager getRandomSeedForSystem:system inGalaxy:galaxy];
+			[names addObject:[UNIVERSE getSystemName:system forGalaxy:galaxy] ?: @""];
+		}
+	}
+	
+	// Cold: nothing cached, as on the first expansion after loading.
+	FlushCaches();
+	sMemoizationDisabled = true;
+	OOStringExpansionBenchmarkPass cold = RunBenchmarkPass(seeds, names, results, exitStates, stopwatch);
+	
+	// Token lists cached, no memoization.
+	OOStringExpansionBenchmarkPass tokenized = RunBenchmarkPass(seeds, names, results, exitStates, stopwatch);
+	
+	// Fill the memo, then measure hits.
+	sMemoizationDisabled = false;
+	FlushMemos();
+	OOStringExpansionBenchmarkPass fill = RunBenchmarkPass(seeds, names, results, exitStates, stopwatch);
+	OOStringExpansionBenchmarkPass memoized = RunBenchmarkPass(seeds, names, results, exitStates, stopwatch);
+	
+	sMemoizationDisabled = wasMemoizationDisabled;
+	OORestoreRandomState(savedRandomState);
+	free(seeds);
+	free(exitStates);
+	
+	NSUInteger mismatches = tokenized.mismatches + fill.mismatches + memoized.mismatches;
+	NSString *result = [NSString stringWithFormat:@"%u system descriptions: cold %.2f ms (%llu allocations), cached tokens %.2f ms (%llu allocations), memoized %.2f ms (%llu allocations, %llu hits)%@",
+						kBenchmarkCount,
+						cold.time * 1e3, cold.allocations,
+						tokenized.time * 1e3, tokenized.allocations,
+						memoized.time * 1e3, memoized.allocations, memoized.memoHits,
+						(mismatches == 0) ? @"" : [NSString stringWithFormat:@" ** %lu MISMATCHES **", (unsigned long)mismatches]];
+	OOLog(@"strings.expand.benchmark", @"%@", result);
+	
+	[result retain];
+	[pool release];
+	return [result autorelease];
+}
+
+#endif
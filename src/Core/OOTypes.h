@@ -186,14 +186,25 @@ typedef uint64_t	OOCreditsQuantity;
 typedef uint16_t	OOKeyCode;
 
 
-typedef uint16_t	OOUniversalID;		// Valid IDs range from 100 to 1000.
+/*	A universal ID is a slot index in Universe's UID table in the low bits,
+	and the slot's generation in the high bits. The generation is bumped
+	whenever a slot is freed, so a stale ID no longer resolves to the entity
+	that reused its slot. The player is always MIN_ENTITY_UID. IDs are kept
+	below 2^31 so they survive a round trip through int and -intValue.
+*/
+typedef uint32_t	OOUniversalID;
 
 enum
 {
-	UNIVERSE_MAX_ENTITIES	= 2048,
-	NO_TARGET				= 0,
-	MIN_ENTITY_UID			= 100,
-	MAX_ENTITY_UID			= MIN_ENTITY_UID + UNIVERSE_MAX_ENTITIES + 1
+	UNIVERSE_MAX_ENTITIES			= 1 << 16,	// Sanity limit; entity storage grows on demand up to this.
+	UNIVERSE_DEBRIS_ENTITY_LIMIT	= 2048,		// Explosions shed less debris as the entity count approaches this.
+	NO_TARGET						= 0,
+	MIN_ENTITY_UID					= 100,
+	
+	kOOUniversalIDSlotBits			= 20,
+	kOOUniversalIDGenerationBits	= 11,
+	kOOUniversalIDSlotMask			= (1 << kOOUniversalIDSlotBits) - 1,
+	kOOUniversalIDGenerationMask	= (1 << kOOUniversalIDGenerationBits) - 1
 };
 
 
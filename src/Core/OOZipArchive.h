@@ -0,0 +1,129 @@
+/*
+
+OOZipArchive.h
+
+Read access to the contents of OXZ (zip) files.
+
+An OOZipArchive maps its file and reads the central directory once, building a
+table of entry name -> local header offset, sizes, CRC and compression method.
+Looking an entry up is then a dictionary lookup rather than a scan of the
+central directory by minizip. Stored entries are returned as NSData objects
+pointing into the mapped file, without copying; deflated entries are inflated
+in a single pass into a buffer of the size recorded in the directory, and
+their CRC is checked.
+
+Archives are shared: +archiveWithPath: returns the same object for the same
+path until the archive is closed. An archive is immutable once opened, and the
+mapped file is read without seeking, so any number of threads may read from
+one archive at once; the table of open archives is protected by a lock.
+
+For large deflated entries that are read sequentially, such as music,
+-streamForEntry: returns an OOZipEntryStream, which inflates a chunk at a time
+instead of holding the whole entry in memory.
+
+Entry data keeps the mapped file alive, so an archive must be closed before
+its file is replaced or removed, and on some platforms that will still fail
+while data read from it is in use.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCocoa.h"
+
+@class OOZipEntryStream;
+
+
+@interface OOZipArchive: NSObject
+{
+@private
+	NSString				*_path;
+	NSData					*_mapping;
+	struct OOZipEntry		*_entries;
+	NSUInteger				_entryCount;
+	NSDictionary			*_index;		// Entry name -> NSNumber index into _entries.
+	NSArray					*_entryNames;
+}
+
+//	Shared archive for path, or nil if it can't be opened or isn't a zip file.
++ (OOZipArchive *) archiveWithPath:(NSString *)path;
+
+//	Forget shared archives, so the files will be reread on next use.
++ (void) closeArchiveWithPath:(NSString *)path;
++ (void) closeAllArchives;
+
+@property (readonly, copy) NSString *path;
+@property (readonly) NSUInteger entryCount;
+@property (readonly, copy) NSArray *entryNames;	// In central directory order.
+
+- (BOOL) hasEntry:(NSString *)name;
+- (BOOL) entryIsCompressed:(NSString *)name;
+- (NSData *) dataForEntry:(NSString *)name;
+- (OOZipEntryStream *) streamForEntry:(NSString *)name;
+
+@end
+
+
+/*	Sequential reader for one entry. Each stream has its own read position
+	and inflate state, so it should only be used from one thread at a time.
+	The CRC is checked when the end of the entry is reached.
+*/
+@interface OOZipEntryStream: NSObject
+{
+@private
+	NSData					*_mapping;
+	NSString				*_description;
+	const uint8_t			*_compressed;
+	uint64_t				_compressedSize;
+	uint64_t				_uncompressedSize;
+	uint32_t				_crc;
+	BOOL					_deflated;
+
+	struct z_stream_s		*_stream;
+	uint64_t				_inputUsed;
+	uint64_t				_outputUsed;
+	unsigned long			_runningCRC;
+	BOOL					_failed;
+}
+
+//	Bytes read, 0 at the end of the entry, or -1 if the data is damaged.
+- (NSInteger) readBytes:(void *)buffer maxLength:(NSUInteger)length;
+
+//	Start again from the beginning of the entry.
+- (BOOL) rewind;
+
+@end
+
+
+/*	If path passes through a file with the extension .oxz, return YES and
+	split it into the path of the OXZ and the path inside it. Otherwise,
+	return NO.
+*/
+BOOL OOSplitOXZPath(NSString *path, NSString **outArchivePath, NSString **outEntryName);
+
+
+#ifndef NDEBUG
+/*	Generate 100 OXZs in a temporary folder and read every file in them, as
+	startup does, once with minizip (opening the archive and locating the entry
+	for each file) and once with OOZipArchive, cold and warm. The data read by
+	each method is compared.
+*/
+NSString *OOZipArchiveRunBenchmark(void);
+#endif
@@ -0,0 +1,940 @@
+/*
+
+OOZipArchive.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOZipArchive.h"
+#import <zlib.h>
+
+#ifndef NDEBUG
+#import "unzip.h"
+#import "OOProfilingStopwatch.h"
+#import "NSFileManagerOOExtensions.h"
+#endif
+
+
+static NSString * const kOOLogZipOpenFailed			= @"oxz.archive.open.failed";
+static NSString * const kOOLogZipReadFailed			= @"oxz.archive.read.failed";
+
+
+enum
+{
+	kLocalHeaderSignature			= 0x04034b50,
+	kCentralHeaderSignature			= 0x02014b50,
+	kEndOfCentralDirSignature		= 0x06054b50,
+	kZip64EndLocatorSignature		= 0x07064b50,
+	kZip64EndOfCentralDirSignature	= 0x06064b50,
+
+	kLocalHeaderSize				= 30,
+	kCentralHeaderSize				= 46,
+	kEndOfCentralDirSize			= 22,
+	kZip64EndLocatorSize			= 20,
+	kZip64EndOfCentralDirSize		= 56,
+	kMaxCommentSize					= 0xFFFF,
+
+	kZip64ExtraFieldID				= 0x0001,
+
+	kFlagEncrypted					= 0x0001,
+	kFlagUTF8						= 0x0800,
+
+	kMethodStored					= 0,
+	kMethodDeflated					= 8
+};
+
+
+struct OOZipEntry
+{
+	uint64_t				localHeaderOffset;
+	uint64_t				compressedSize;
+	uint64_t				uncompressedSize;
+	uint32_t				crc;
+	uint16_t				method;
+	uint16_t				flags;
+};
+
+typedef struct OOZipEntry OOZipEntry;
+
+
+/*	Entry data for stored entries: a range of the mapped archive, which it
+	keeps alive.
+*/
+@interface OOZipEntryData: NSData
+{
+@private
+	NSData					*_mapping;
+	const void				*_bytes;
+	NSUInteger				_length;
+}
+
+- (instancetype) initWithMapping:(NSData *)mapping range:(NSRange)range;
+
+@end
+
+
+@interface OOZipArchive (Private)
+
+- (instancetype) initWithPath:(NSString *)path;
+- (BOOL) readCentralDirectory;
+- (const uint8_t *) compressedBytesForEntry:(const OOZipEntry *)entry name:(NSString *)name;
+
+@end
+
+
+@interface OOZipEntryStream (Private)
+
+- (instancetype) initWithMapping:(NSData *)mapping compressedBytes:(const uint8_t *)compressed entry:(const OOZipEntry *)entry description:(NSString *)description;
+
+@end
+
+
+static NSLock				*sArchivesLock = nil;
+static NSMutableDictionary	*sArchives = nil;
+
+
+OOINLINE uint16_t ReadLE16(const uint8_t *bytes)
+{
+	return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+
+OOINLINE uint32_t ReadLE32(const uint8_t *bytes)
+{
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+
+OOINLINE uint64_t ReadLE64(const uint8_t *bytes)
+{
+	return (uint64_t)ReadLE32(bytes) | ((uint64_t)ReadLE32(bytes + 4) << 32);
+}
+
+
+@implementation OOZipArchive
+
++ (void) initialize
+{
+	if (sArchivesLock == nil)
+	{
+		sArchivesLock = [[NSLock alloc] init];
+		sArchives = [[NSMutableDictionary alloc] init];
+	}
+}
+
+
++ (OOZipArchive *) archiveWithPath:(NSString *)path
+{
+	OOZipArchive *result = nil;
+
+	if (path == nil)  return nil;
+
+	[sArchivesLock lock];
+	result = [[sArchives objectForKey:path] retain];
+	if (result == nil)
+	{
+		// Opening under the lock means two threads never parse the same archive.
+		result = [[OOZipArchive alloc] initWithPath:path];
+		if (result != nil)  [sArchives setObject:result forKey:path];
+	}
+	[sArchivesLock unlock];
+
+	return [result autorelease];
+}
+
+
++ (void) closeArchiveWithPath:(NSString *)path
+{
+	if (path == nil)  return;
+
+	[sArchivesLock lock];
+	[sArchives removeObjectForKey:path];
+	[sArchivesLock unlock];
+}
+
+
++ (void) closeAllArchives
+{
+	[sArchivesLock lock];
+	[sArchives removeAllObjects];
+	[sArchivesLock unlock];
+}
+
+
+- (void) dealloc
+{
+	DESTROY(_path);
+	DESTROY(_mapping);
+	DESTROY(_index);
+	DESTROY(_entryNames);
+	free(_entries);
+
+	[super dealloc];
+}
+
+
+- (NSString *) descriptionComponents
+{
+	return [NSString stringWithFormat:@"\"%@\", %lu entries", [_path lastPathComponent], (unsigned long)_entryCount];
+}
+
+
+@synthesize path = _path;
+@synthesize entryCount = _entryCount;
+@synthesize entryNames = _entryNames;
+
+
+- (BOOL) hasEntry:(NSString *)name
+{
+	return name != nil && [_index objectForKey:name] != nil;
+}
+
+
+- (BOOL) entryIsCompressed:(NSString *)name
+{
+	NSNumber *indexNumber = (name != nil) ? [_index objectForKey:name] : nil;
+	return indexNumber != nil && _entries[[indexNumber unsignedIntegerValue]].method != kMethodStored;
+}
+
+
+- (OOZipEntryStream *) streamForEntry:(NSString *)name
+{
+	NSNumber *indexNumber = (name != nil) ? [_index objectForKey:name] : nil;
+	if (indexNumber == nil)  return nil;
+
+	const OOZipEntry *entry = &_entries[[indexNumber unsignedIntegerValue]];
+	const uint8_t *compressed = [self compressedBytesForEntry:entry name:name];
+	if (compressed == NULL)  return nil;
+
+	NSString *description = [NSString stringWithFormat:@"%@ within OXZ at %@", name, _path];
+	return [[[OOZipEntryStream alloc] initWithMapping:_mapping compressedBytes:compressed entry:entry description:description] autorelease];
+}
+
+
+- (NSData *) dataForEntry:(NSString *)name
+{
+	NSNumber *indexNumber = (name != nil) ? [_index objectForKey:name] : nil;
+	if (indexNumber == nil)  return nil;
+
+	const OOZipEntry *entry = &_entries[[indexNumber unsignedIntegerValue]];
+	const uint8_t *compressed = [self compressedBytesForEntry:entry name:name];
+	if (compressed == NULL)  return nil;
+
+	if (entry->method == kMethodStored)
+	{
+		NSRange range = { compressed - (const uint8_t *)[_mapping bytes], (NSUInteger)entry->uncompressedSize };
+		return [[[OOZipEntryData alloc] initWithMapping:_mapping range:range] autorelease];
+	}
+
+	if (entry->uncompressedSize == 0)  return [NSData data];
+	if (entry->compressedSize > UINT_MAX || entry->uncompressedSize > UINT_MAX)
+	{
+		OOLog(kOOLogZipReadFailed, @"Could not read %@ within OXZ at %@: too large.", name, _path);
+		return nil;
+	}
+
+	uint8_t *buffer = malloc((size_t)entry->uncompressedSize);
+	if (buffer == NULL)
+	{
+		OOLog(kOOLogZipReadFailed, @"Could not read %@ within OXZ at %@: out of memory.", name, _path);
+		return nil;
+	}
+
+	z_stream stream;
+	memset(&stream, 0, sizeof stream);
+	stream.next_in = (Bytef *)compressed;
+	stream.avail_in = (uInt)entry->compressedSize;
+	stream.next_out = buffer;
+	stream.avail_out = (uInt)entry->uncompressedSize;
+
+	int err = inflateInit2(&stream, -MAX_WBITS);	// Raw deflate data, no zlib header.
+	if (err == Z_OK)
+	{
+		err = inflate(&stream, Z_FINISH);
+		inflateEnd(&stream);
+	}
+
+	if (err != Z_STREAM_END || stream.total_out != entry->uncompressedSize)
+	{
+		OOLog(kOOLogZipReadFailed, @"Could not read %@ within OXZ at %@ (zlib error %d).", name, _path, err);
+		free(buffer);
+		return nil;
+	}
+	if (crc32(crc32(0, Z_NULL, 0), buffer, (uInt)entry->uncompressedSize) != entry->crc)
+	{
+		OOLog(kOOLogZipReadFailed, @"Could not read %@ within OXZ at %@: checksum mismatch.", name, _path);
+		free(buffer);
+		return nil;
+	}
+
+	return [NSData dataWithBytesNoCopy:buffer length:(NSUInteger)entry->uncompressedSize freeWhenDone:YES];
+}
+
+@end
+
+
+@implementation OOZipArchive (Private)
+
+- (instancetype) initWithPath:(NSString *)path
+{
+	if ((self = [super init]))
+	{
+		_path = [path copy];
+
+		BOOL isDirectory = NO;
+		if (![[NSFileManager defaultManager] fileExistsAtPath:path isDirectory:&isDirectory] || isDirectory)
+		{
+			// Not necessarily an error; callers probe for managed OXZs this way.
+			[self release];
+			return nil;
+		}
+
+		_mapping = [[NSData alloc] initWithContentsOfMappedFile:path];
+		if (_mapping == nil || ![self readCentralDirectory])
+		{
+			OOLog(kOOLogZipOpenFailed, @"Could not open .oxz at %@ as zip file", path);
+			[self release];
+			return nil;
+		}
+	}
+
+	return self;
+}
+
+
+- (BOOL) readCentralDirectory
+{
+	const uint8_t		*bytes = [_mapping bytes];
+	NSUInteger			length = [_mapping length];
+	NSUInteger			eocd, limit;
+	uint64_t			entryCount, dirSize, dirOffset;
+
+	if (length < kEndOfCentralDirSize)  return NO;
+
+	// The end of central directory record is followed only by a comment of up to 64 KiB.
+	eocd = length - kEndOfCentralDirSize;
+	limit = (eocd > kMaxCommentSize) ? eocd - kMaxCommentSize : 0;
+	while (ReadLE32(bytes + eocd) != kEndOfCentralDirSignature)
+	{
+		if (eocd == limit)  return NO;
+		eocd--;
+	}
+
+	entryCount = ReadLE16(bytes + eocd + 10);
+	dirSize = ReadLE32(bytes + eocd + 12);
+	dirOffset = ReadLE32(bytes + eocd + 16);
+
+	if ((entryCount == 0xFFFF || dirSize == 0xFFFFFFFF || dirOffset == 0xFFFFFFFF) &&
+		eocd >= kZip64EndLocatorSize &&
+		ReadLE32(bytes + eocd - kZip64EndLocatorSize) == kZip64EndLocatorSignature)
+	{
+		uint64_t zip64End = ReadLE64(bytes + eocd - kZip64EndLocatorSize + 8);
+		if (length < kZip64EndOfCentralDirSize || zip64End > length - kZip64EndOfCentralDirSize || ReadLE32(bytes + zip64End) != kZip64EndOfCentralDirSignature)  return NO;
+
+		entryCount = ReadLE64(bytes + zip64End + 32);
+		dirSize = ReadLE64(bytes + zip64End + 40);
+		dirOffset = ReadLE64(bytes + zip64End + 48);
+	}
+
+	if (dirOffset > length || dirSize > length - dirOffset)  return NO;
+	if (entryCount > dirSize / kCentralHeaderSize)  return NO;
+
+	_entries = calloc((size_t)entryCount + 1, sizeof *_entries);
+	if (_entries == NULL)  return NO;
+
+	NSMutableDictionary		*index = [NSMutableDictionary dictionaryWithCapacity:(NSUInteger)entryCount];
+	NSMutableArray			*names = [NSMutableArray arrayWithCapacity:(NSUInteger)entryCount];
+	const uint8_t			*cursor = bytes + dirOffset;
+	const uint8_t			*end = cursor + dirSize;
+	uint64_t				i;
+
+	for (i = 0; i < entryCount; i++)
+	{
+		if (end - cursor < kCentralHeaderSize || ReadLE32(cursor) != kCentralHeaderSignature)  return NO;
+
+		OOZipEntry *entry = &_entries[_entryCount];
+		uint16_t nameLength = ReadLE16(cursor + 28);
+		uint16_t extraLength = ReadLE16(cursor + 30);
+		uint16_t commentLength = ReadLE16(cursor + 32);
+		const uint8_t *name = cursor + kCentralHeaderSize;
+		const uint8_t *extra = name + nameLength;
+
+		if (end - name < nameLength + extraLength + commentLength)  return NO;
+
+		entry->flags = ReadLE16(cursor + 8);
+		entry->method = ReadLE16(cursor + 10);
+		entry->crc = ReadLE32(cursor + 16);
+		entry->compressedSize = ReadLE32(cursor + 20);
+		entry->uncompressedSize = ReadLE32(cursor + 24);
+		entry->localHeaderOffset = ReadLE32(cursor + 42);
+
+		// Fields that don't fit are 0xFFFFFFFF here, and given in order in the zip64 extra field.
+		const uint8_t *extraEnd = extra + extraLength;
+		while (extraEnd - extra >= 4)
+		{
+			uint16_t fieldID = ReadLE16(extra);
+			uint16_t fieldLength = ReadLE16(extra + 2);
+			const uint8_t *field = extra + 4;
+			const uint8_t *fieldEnd = field + fieldLength;
+			if (fieldEnd > extraEnd)  break;
+
+			if (fieldID == kZip64ExtraFieldID)
+			{
+				if (entry->uncompressedSize == 0xFFFFFFFF && fieldEnd - field >= 8)  { entry->uncompressedSize = ReadLE64(field); field += 8; }
+				if (entry->compressedSize == 0xFFFFFFFF && fieldEnd - field >= 8)  { entry->compressedSize = ReadLE64(field); field += 8; }
+				if (entry->localHeaderOffset == 0xFFFFFFFF && fieldEnd - field >= 8)  { entry->localHeaderOffset = ReadLE64(field); }
+			}
+			extra = fieldEnd;
+		}
+
+		/*	minizip compared names byte for byte against the UTF-8 path, so
+			decode them as UTF-8 whatever the flag says, falling back to Latin-1
+			for names that aren't valid UTF-8.
+		*/
+		NSString *nameString = [[NSString alloc] initWithBytes:name length:nameLength encoding:NSUTF8StringEncoding];
+		if (nameString == nil)  nameString = [[NSString alloc] initWithBytes:name length:nameLength encoding:NSISOLatin1StringEncoding];
+		if (nameString != nil && [index objectForKey:nameString] == nil)
+		{
+			[index setObject:@(_entryCount) forKey:nameString];
+			[names addObject:nameString];
+			_entryCount++;
+		}
+		[nameString release];
+
+		cursor = name + nameLength + extraLength + commentLength;
+	}
+
+	_index = [index copy];
+	_entryNames = [names copy];
+	return YES;
+}
+
+
+- (const uint8_t *) compressedBytesForEntry:(const OOZipEntry *)entry name:(NSString *)name
+{
+	const uint8_t		*bytes = [_mapping bytes];
+	NSUInteger			length = [_mapping length];
+	uint64_t			offset = entry->localHeaderOffset;
+
+	if (entry->flags & kFlagEncrypted)
+	{
+		OOLog(kOOLogZipReadFailed, @"Could not read %@ within OXZ at %@: encrypted entries are not supported.", name, _path);
+		return NULL;
+	}
+	if (entry->method != kMethodStored && entry->method != kMethodDeflated)
+	{
+		OOLog(kOOLogZipReadFailed, @"Could not read %@ within OXZ at %@: unsupported compression method %u.", name, _path, entry->method);
+		return NULL;
+	}
+	if (entry->method == kMethodStored && entry->compressedSize != entry->uncompressedSize)
+	{
+		OOLog(kOOLogZipReadFailed, @"Could not read %@ within OXZ at %@: inconsistent sizes.", name, _path);
+		return NULL;
+	}
+
+	// The local header's name and extra field lengths can differ from the central directory's.
+	if (length < kLocalHeaderSize || offset > length - kLocalHeaderSize || ReadLE32(bytes + offset) != kLocalHeaderSignature)
+	{
+		OOLog(kOOLogZipReadFailed, @"Could not read %@ within OXZ at %@: bad local header.", name, _path);
+		return NULL;
+	}
+	offset += kLocalHeaderSize + ReadLE16(bytes + offset + 26) + ReadLE16(bytes + offset + 28);
+	if (offset > length || entry->compressedSize > length - offset)
+	{
+		OOLog(kOOLogZipReadFailed, @"Could not read %@ within OXZ at %@: truncated.", name, _path);
+		return NULL;
+	}
+
+	return bytes + offset;
+}
+
+@end
+
+
+@implementation OOZipEntryData
+
+- (instancetype) initWithMapping:(NSData *)mapping range:(NSRange)range
+{
+	if ((self = [super init]))
+	{
+		_mapping = [mapping retain];
+		_bytes = (const uint8_t *)[mapping bytes] + range.location;
+		_length = range.length;
+	}
+	return self;
+}
+
+
+- (void) dealloc
+{
+	DESTROY(_mapping);
+
+	[super dealloc];
+}
+
+
+- (const void *) bytes
+{
+	return _bytes;
+}
+
+
+- (NSUInteger) length
+{
+	return _length;
+}
+
+@end
+
+
+@implementation OOZipEntryStream
+
+- (void) dealloc
+{
+	if (_stream != NULL)
+	{
+		inflateEnd(_stream);
+		free(_stream);
+	}
+	DESTROY(_mapping);
+	DESTROY(_description);
+
+	[super dealloc];
+}
+
+
+- (NSString *) descriptionComponents
+{
+	return [NSString stringWithFormat:@"%@, %llu of %llu bytes read", _description, (unsigned long long)_outputUsed, (unsigned long long)_uncompressedSize];
+}
+
+
+- (NSInteger) readBytes:(void *)buffer maxLength:(NSUInteger)length
+{
+	if (_failed)  return -1;
+
+	uint64_t remaining = _uncompressedSize - _outputUsed;
+	if (length > remaining)  length = (NSUInteger)remaining;
+	if (length > INT_MAX)  length = INT_MAX;
+	if (length == 0)  return 0;
+
+	NSUInteger produced;
+	if (!_deflated)
+	{
+		memcpy(buffer, _compressed + _outputUsed, length);
+		produced = length;
+	}
+	else
+	{
+		_stream->next_out = buffer;
+		_stream->avail_out = (uInt)length;
+		while (_stream->avail_out != 0)
+		{
+			// Feed the input in uInt-sized pieces, so entries over 4 GiB work.
+			if (_stream->avail_in == 0 && _inputUsed < _compressedSize)
+			{
+				uint64_t piece = MIN(_compressedSize - _inputUsed, (uint64_t)UINT_MAX);
+				_stream->next_in = (Bytef *)(_compressed + _inputUsed);
+				_stream->avail_in = (uInt)piece;
+				_inputUsed += piece;
+			}
+
+			int err = inflate(_stream, Z_NO_FLUSH);
+			if (err == Z_STREAM_END)  break;
+			if (err != Z_OK)
+			{
+				OOLog(kOOLogZipReadFailed, @"Could not read %@ (zlib error %d).", _description, err);
+				_failed = YES;
+				return -1;
+			}
+		}
+		produced = length - _stream->avail_out;
+	}
+
+	_runningCRC = crc32(_runningCRC, buffer, (uInt)produced);
+	_outputUsed += produced;
+
+	if (produced < length || (_outputUsed == _uncompressedSize && _runningCRC != _crc))
+	{
+		OOLog(kOOLogZipReadFailed, @"Could not read %@: %@.", _description, (produced < length) ? @"data ends early" : @"checksum mismatch");
+		_failed = YES;
+		return -1;
+	}
+
+	return (NSInteger)produced;
+}
+
+
+- (BOOL) rewind
+{
+	_inputUsed = 0;
+	_outputUsed = 0;
+	_runningCRC = crc32(0, Z_NULL, 0);
+	_failed = NO;
+
+	if (_deflated)
+	{
+		_stream->next_in = Z_NULL;
+		_stream->avail_in = 0;
+		if (inflateReset(_stream) != Z_OK)  _failed = YES;
+	}
+
+	return !_failed;
+}
+
+@end
+
+
+@implementation OOZipEntryStream (Private)
+
+- (instancetype) initWithMapping:(NSData *)mapping compressedBytes:(const uint8_t *)compressed entry:(const OOZipEntry *)entry description:(NSString *)description
+{
+	if ((self = [super init]))
+	{
+		_mapping = [mapping retain];
+		_description = [description copy];
+		_compressed = compressed;
+		_compressedSize = entry->compressedSize;
+		_uncompressedSize = entry->uncompressedSize;
+		_crc = entry->crc;
+		_deflated = (entry->method != kMethodStored);
+		_runningCRC = crc32(0, Z_NULL, 0);
+
+		if (_deflated)
+		{
+			_stream = calloc(1, sizeof *_stream);
+			if (_stream == NULL || inflateInit2(_stream, -MAX_WBITS) != Z_OK)	// Raw deflate data, no zlib header.
+			{
+				free(_stream);
+				_stream = NULL;
+				OOLog(kOOLogZipReadFailed, @"Could not read %@: could not set up decompression.", description);
+				[self release];
+				return nil;
+			}
+		}
+	}
+	return self;
+}
+
+@end
+
+
+BOOL OOSplitOXZPath(NSString *path, NSString **outArchivePath, NSString **outEntryName)
+{
+	NSArray			*components = [path pathComponents];
+	NSUInteger		i, count = [components count];
+
+	for (i = 0; i < count; i++)
+	{
+		if ([[[[components objectAtIndex:i] pathExtension] lowercaseString] isEqualToString:@"oxz"])  break;
+	}
+	// if i == count then the path is entirely uncompressed
+	if (i == count)  return NO;
+
+	// otherwise components 0..i are the OXZ path, and i+1..n are the path inside the OXZ
+	if (outArchivePath != NULL)  *outArchivePath = [NSString pathWithComponents:[components subarrayWithRange:NSMakeRange(0, i + 1)]];
+	if (outEntryName != NULL)  *outEntryName = [NSString pathWithComponents:[components subarrayWithRange:NSMakeRange(i + 1, count - (i + 1))]];
+	return YES;
+}
+
+
+#ifndef NDEBUG
+
+enum
+{
+	kBenchmarkArchiveCount		= 100,
+	kBenchmarkEntryCount		= 120,
+	kBenchmarkEntrySize			= 4096,
+	kBenchmarkBufferSize		= 8192	// As ZIP_BUFFER_SIZE in NSDataOOExtensions.m before OOZipArchive.
+};
+
+
+OOINLINE void AppendLE16(NSMutableData *data, uint16_t value)
+{
+	uint8_t bytes[2] = { value & 0xFF, value >> 8 };
+	[data appendBytes:bytes length:sizeof bytes];
+}
+
+
+OOINLINE void AppendLE32(NSMutableData *data, uint32_t value)
+{
+	AppendLE16(data, value & 0xFFFF);
+	AppendLE16(data, value >> 16);
+}
+
+
+static NSData *BenchmarkEntryContents(NSUInteger archive, NSUInteger entry)
+{
+	NSMutableString *string = [NSMutableString stringWithCapacity:kBenchmarkEntrySize];
+	uint32_t seed = (uint32_t)(archive * 7919 + entry * 104729 + 1);
+
+	// Plist-like text with some variety, so deflate has something to do but not everything.
+	while ([string length] < kBenchmarkEntrySize)
+	{
+		seed = seed * 1664525 + 1013904223;
+		[string appendFormat:@"\t\"key_%u\" = \"value %u for entry %lu\";\n", seed >> 24, seed >> 8, (unsigned long)entry];
+	}
+	return [string dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+
+static NSData *BenchmarkDeflate(NSData *data)
+{
+	z_stream stream;
+	memset(&stream, 0, sizeof stream);
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)  return nil;
+
+	NSMutableData *result = [NSMutableData dataWithLength:deflateBound(&stream, (uLong)[data length])];
+	stream.next_in = (Bytef *)[data bytes];
+	stream.avail_in = (uInt)[data length];
+	stream.next_out = [result mutableBytes];
+	stream.avail_out = (uInt)[result length];
+
+	int err = deflate(&stream, Z_FINISH);
+	[result setLength:stream.total_out];
+	deflateEnd(&stream);
+
+	return (err == Z_STREAM_END) ? result : nil;
+}
+
+
+//	A minimal zip writer: no timestamps, no zip64, every other entry deflated.
+static BOOL WriteBenchmarkArchive(NSString *path, NSArray *names, NSUInteger archive)
+{
+	NSMutableData		*file = [NSMutableData data];
+	NSMutableData		*directory = [NSMutableData data];
+	NSUInteger			i, count = [names count];
+
+	for (i = 0; i < count; i++)
+	{
+		NSData *nameData = [[names objectAtIndex:i] dataUsingEncoding:NSUTF8StringEncoding];
+		NSData *contents = BenchmarkEntryContents(archive, i);
+		uint16_t method = (i % 2) ? kMethodDeflated : kMethodStored;
+		NSData *payload = (method == kMethodDeflated) ? BenchmarkDeflate(contents) : contents;
+		if (payload == nil)  return NO;
+
+		uint32_t crc = (uint32_t)crc32(crc32(0, Z_NULL, 0), [contents bytes], (uInt)[contents length]);
+		uint32_t offset = (uint32_t)[file length];
+
+		AppendLE32(file, kLocalHeaderSignature);
+		AppendLE16(file, 20);						// Version needed.
+		AppendLE16(file, kFlagUTF8);
+		AppendLE16(file, method);
+		AppendLE16(file, 0);						// Time.
+		AppendLE16(file, 0x21);						// Date: 1980-01-01.
+		AppendLE32(file, crc);
+		AppendLE32(file, (uint32_t)[payload length]);
+		AppendLE32(file, (uint32_t)[contents length]);
+		AppendLE16(file, (uint16_t)[nameData length]);
+		AppendLE16(file, 0);						// Extra field length.
+		[file appendData:nameData];
+		[file appendData:payload];
+
+		AppendLE32(directory, kCentralHeaderSignature);
+		AppendLE16(directory, 20);					// Version made by.
+		AppendLE16(directory, 20);					// Version needed.
+		AppendLE16(directory, kFlagUTF8);
+		AppendLE16(directory, method);
+		AppendLE16(directory, 0);
+		AppendLE16(directory, 0x21);
+		AppendLE32(directory, crc);
+		AppendLE32(directory, (uint32_t)[payload length]);
+		AppendLE32(directory, (uint32_t)[contents length]);
+		AppendLE16(directory, (uint16_t)[nameData length]);
+		AppendLE16(directory, 0);					// Extra field length.
+		AppendLE16(directory, 0);					// Comment length.
+		AppendLE16(directory, 0);					// Disk number.
+		AppendLE16(directory, 0);					// Internal attributes.
+		AppendLE32(directory, 0);					// External attributes.
+		AppendLE32(directory, offset);
+		[directory appendData:nameData];
+	}
+
+	uint32_t directoryOffset = (uint32_t)[file length];
+	[file appendData:directory];
+
+	AppendLE32(file, kEndOfCentralDirSignature);
+	AppendLE16(file, 0);
+	AppendLE16(file, 0);
+	AppendLE16(file, (uint16_t)count);
+	AppendLE16(file, (uint16_t)count);
+	AppendLE32(file, (uint32_t)[directory length]);
+	AppendLE32(file, directoryOffset);
+	AppendLE16(file, 0);
+
+	return [file writeToFile:path atomically:NO];
+}
+
+
+//	Read an entry the way NSData +oo_dataWithOXZFile: did before OOZipArchive.
+static NSData *BenchmarkMinizipRead(NSString *archivePath, NSString *name)
+{
+	unzFile uf = unzOpen64([archivePath UTF8String]);
+	if (uf == NULL)  return nil;
+
+	NSMutableData *result = nil;
+	unz_file_info64 fileInfo = {0};
+	if (unzLocateFile(uf, [name UTF8String], 1) == UNZ_OK &&
+		unzGetCurrentFileInfo64(uf, &fileInfo, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK &&
+		unzOpenCurrentFile(uf) == UNZ_OK)
+	{
+		uint8_t buffer[kBenchmarkBufferSize];
+		int read;
+
+		result = [NSMutableData dataWithCapacity:(NSUInteger)fileInfo.uncompressed_size];
+		while ((read = unzReadCurrentFile(uf, buffer, sizeof buffer)) > 0)
+		{
+			[result appendBytes:buffer length:read];
+		}
+		if (read < 0)  result = nil;
+		unzCloseCurrentFile(uf);
+	}
+	unzClose(uf);
+
+	return result;
+}
+
+
+static NSUInteger BenchmarkMinizipListEntries(NSString *archivePath)
+{
+	unzFile uf = unzOpen64([archivePath UTF8String]);
+	NSUInteger count = 0;
+	char name[512];
+
+	if (uf == NULL)  return 0;
+	if (unzGoToFirstFile(uf) == UNZ_OK)
+	{
+		do
+		{
+			unzGetCurrentFileInfo64(uf, NULL, name, sizeof name, NULL, 0, NULL, 0);
+			if ([@(name) length] != 0)  count++;
+		}
+		while (unzGoToNextFile(uf) == UNZ_OK);
+	}
+	unzClose(uf);
+
+	return count;
+}
+
+
+NSString *OOZipArchiveRunBenchmark(void)
+{
+	NSAutoreleasePool		*pool = [[NSAutoreleasePool alloc] init];
+	NSFileManager			*fmgr = [NSFileManager defaultManager];
+	OOProfilingStopwatch	*stopwatch = nil;
+	NSString				*folder = nil;
+	NSMutableArray			*paths = [NSMutableArray arrayWithCapacity:kBenchmarkArchiveCount];
+	NSMutableArray			*names = [NSMutableArray arrayWithCapacity:kBenchmarkEntryCount];
+	NSMutableArray			*expected = [NSMutableArray arrayWithCapacity:kBenchmarkArchiveCount * kBenchmarkEntryCount];
+	NSUInteger				a, e, minizipEntries = 0, archiveEntries = 0, mismatches = 0;
+	unsigned long long		totalBytes = 0;
+	OOTimeDelta				minizipTime, coldTime, warmTime;
+
+	folder = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"oolite-zip-benchmark-%u", (unsigned)[[NSProcessInfo processInfo] processIdentifier]]];
+	if (![fmgr oo_createDirectoryAtPath:folder attributes:nil])
+	{
+		[pool release];
+		return @"Could not create benchmark folder.";
+	}
+
+	[names addObject:@"manifest.plist"];
+	for (e = 1; e < kBenchmarkEntryCount; e++)
+	{
+		static NSString * const folders[] = { @"Config", @"Scripts", @"Textures", @"Models", @"Sounds", @"AIs" };
+		[names addObject:[NSString stringWithFormat:@"%@/file-%03lu.plist", folders[e % (sizeof folders / sizeof *folders)], (unsigned long)e]];
+	}
+
+	for (a = 0; a < kBenchmarkArchiveCount; a++)
+	{
+		NSString *path = [folder stringByAppendingPathComponent:[NSString stringWithFormat:@"benchmark-%03lu.oxz", (unsigned long)a]];
+		if (!WriteBenchmarkArchive(path, names, a))
+		{
+			[fmgr oo_removeItemAtPath:folder];
+			[pool release];
+			return @"Could not write benchmark archives.";
+		}
+		[paths addObject:path];
+		for (e = 0; e < kBenchmarkEntryCount; e++)  [expected addObject:BenchmarkEntryContents(a, e)];
+	}
+
+	// minizip: list each archive, then open it again for each entry.
+	stopwatch = [OOProfilingStopwatch stopwatch];
+	for (a = 0; a < kBenchmarkArchiveCount; a++)
+	{
+		NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+		NSString *path = [paths objectAtIndex:a];
+		minizipEntries += BenchmarkMinizipListEntries(path);
+		for (e = 0; e < kBenchmarkEntryCount; e++)
+		{
+			NSData *data = BenchmarkMinizipRead(path, [names objectAtIndex:e]);
+			if (![data isEqualToData:[expected objectAtIndex:a * kBenchmarkEntryCount + e]])  mismatches++;
+		}
+		[innerPool release];
+	}
+	minizipTime = [stopwatch reset];
+
+	// OOZipArchive, cold: each archive is opened and indexed once.
+	[OOZipArchive closeAllArchives];
+	for (a = 0; a < kBenchmarkArchiveCount; a++)
+	{
+		NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+		OOZipArchive *archive = [OOZipArchive archiveWithPath:[paths objectAtIndex:a]];
+		archiveEntries += [[archive entryNames] count];
+		for (e = 0; e < kBenchmarkEntryCount; e++)
+		{
+			NSData *data = [[OOZipArchive archiveWithPath:[paths objectAtIndex:a]] dataForEntry:[names objectAtIndex:e]];
+			if (![data isEqualToData:[expected objectAtIndex:a * kBenchmarkEntryCount + e]])  mismatches++;
+			totalBytes += [data length];
+		}
+		[innerPool release];
+	}
+	coldTime = [stopwatch reset];
+
+	// Warm: archives already open, as for reads after startup.
+	for (a = 0; a < kBenchmarkArchiveCount; a++)
+	{
+		NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+		for (e = 0; e < kBenchmarkEntryCount; e++)
+		{
+			NSData *data = [[OOZipArchive archiveWithPath:[paths objectAtIndex:a]] dataForEntry:[names objectAtIndex:e]];
+			if ([data length] != [[expected objectAtIndex:a * kBenchmarkEntryCount + e] length])  mismatches++;
+		}
+		[innerPool release];
+	}
+	warmTime = [stopwatch reset];
+
+	for (a = 0; a < kBenchmarkArchiveCount; a++)  [OOZipArchive closeArchiveWithPath:[paths objectAtIndex:a]];
+	[fmgr oo_removeItemAtPath:folder];
+
+	if (minizipEntries != archiveEntries)  mismatches++;
+
+	NSString *result = [NSString stringWithFormat:@"%u OXZs x %u files (%.1f MiB): minizip %.2f ms, OOZipArchive cold %.2f ms, warm %.2f ms%@",
+						kBenchmarkArchiveCount, kBenchmarkEntryCount, totalBytes / (1024.0 * 1024.0),
+						minizipTime * 1e3, coldTime * 1e3, warmTime * 1e3,
+						(mismatches == 0) ? @"" : [NSString stringWithFormat:@" ** %lu MISMATCHES **", (unsigned long)mismatches]];
+	OOLog(@"oxz.archive.benchmark", @"%@", result);
+
+	[result retain];
+	[pool release];
+	return [result autorelease];
+}
+
+#endif	// NDEBUG
@@ -28,6 +28,8 @@ MA 02110-1301, USA.
 #if OO_OXP_VERIFIER_ENABLED
 
 #import "OOFileScannerVerifierStage.h"
+#import "OODATTokenizer.h"
+#import "OOMesh.h"
 
 static NSString * const kStageName	= @"Testing models";
 
@@ -100,8 +102,6 @@ static id NSNULL = nil;
 	NSDictionary				*materials = nil,
 								*shaders = nil;
 	
-	OOLog(@"verifyOXP.models.unimplemented", @"%@", @"TODO: implement model verifier.");
-	
 	foreach (info, _modelsToCheck)
 	@autoreleasepool {
 		name = [info objectForKey:@"name"];
@@ -166,13 +166,173 @@ static id NSNULL = nil;
 @implementation OOModelVerifierStage (OOPrivate)
 
 
+/*	Check the structure of a DAT file, the same way OOMesh reads it. Returns
+	nil if it's OK, or a description of the first error; the tokenizer is
+	left at the line of the error.
+*/
+static NSString *CheckDATFile(OODATTokenizer *tokenizer, NSString *displayName, NSMutableArray *materialKeys, int *outVertexCount, int *outFaceCount)
+{
+	int				vertexCount, faceCount, count, i, j;
+	float			size[2], value;
+	Vector			vector;
+	const uint8_t	*keyBytes = NULL;
+	NSUInteger		keyLength;
+	
+	if (!OODATScanSection(tokenizer, kOODATSectionNVerts))  return @"expected NVERTS";
+	if (!OODATScanInt(tokenizer, &vertexCount) || vertexCount <= 0)  return @"expected a positive vertex count after NVERTS";
+	if (!OODATScanSection(tokenizer, kOODATSectionNFaces))  return @"expected NFACES";
+	if (!OODATScanInt(tokenizer, &faceCount) || faceCount <= 0)  return @"expected a positive face count after NFACES";
+	*outVertexCount = vertexCount;
+	*outFaceCount = faceCount;
+	
+	if (!OODATScanSection(tokenizer, kOODATSectionVertex))  return @"expected VERTEX";
+	for (j = 0; j < vertexCount; j++)
+	{
+		if (!OODATScanVector(tokenizer, &vector))  return [NSString stringWithFormat:@"expected three coordinates for vertex %i", j];
+	}
+	
+	if (!OODATScanSection(tokenizer, kOODATSectionFaces))  return @"expected FACES";
+	for (j = 0; j < faceCount; j++)
+	{
+		if (!OODATScanInt(tokenizer, &i) || !OODATScanInt(tokenizer, &i) || !OODATScanInt(tokenizer, &i))  return [NSString stringWithFormat:@"expected three colour components for face %i", j];
+		if (!OODATScanVector(tokenizer, &vector))  return [NSString stringWithFormat:@"expected a normal for face %i", j];
+		if (!OODATScanInt(tokenizer, &count))  return [NSString stringWithFormat:@"expected a vertex count for face %i", j];
+		if (count < 3)  return [NSString stringWithFormat:@"face %i has fewer than three vertices", j];
+		if (count > 3)
+		{
+			/*	OOMesh only reads the first three indices. The rest are read
+				and skipped here, so that one bad face doesn't turn into
+				errors about the colour and normal of the next.
+			*/
+			OOLog(@"verifyOXP.model.nonTriangular", @"----- WARNING: face %i of model %@ (line %lu) has %i vertices; only triangles are supported, and the game will misread the extra vertex indices.", j, displayName, (unsigned long)tokenizer->line, count);
+		}
+		for (i = 0; i < count; i++)
+		{
+			int index;
+			if (!OODATScanInt(tokenizer, &index))  return [NSString stringWithFormat:@"expected vertex index %i for face %i", i, j];
+			if (index < 0 || index >= vertexCount)  return [NSString stringWithFormat:@"vertex index %i of face %i is out of range", i, j];
+		}
+	}
+	
+	if (!OODATScanSection(tokenizer, kOODATSectionTextures))
+	{
+		// OOMesh loads the model anyway, with the placeholder material on every face.
+		OOLog(@"verifyOXP.model.noTextures", @"----- WARNING: model %@ has no TEXTURES section at line %lu; it will be drawn with a placeholder material.", displayName, (unsigned long)tokenizer->line);
+	}
+	else
+	{
+		for (j = 0; j < faceCount; j++)
+		{
+			if (!OODATScanWord(tokenizer, &keyBytes, &keyLength))  return [NSString stringWithFormat:@"expected a texture name for face %i", j];
+			NSString *key = OODATStringWithBytes(keyBytes, keyLength);
+			if (![materialKeys containsObject:key])
+			{
+				if ([materialKeys count] == kOOMeshMaxMaterials)  return [NSString stringWithFormat:@"too many materials (the maximum is %u)", kOOMeshMaxMaterials];
+				[materialKeys addObject:key];
+			}
+			
+			if (!OODATScanFloat(tokenizer, &size[0]) || !OODATScanFloat(tokenizer, &size[1]))  return [NSString stringWithFormat:@"expected a texture size for face %i", j];
+			if (size[0] == 0.0f || size[1] == 0.0f)  return [NSString stringWithFormat:@"texture size for face %i is zero", j];
+			for (i = 0; i < 6; i++)
+			{
+				if (!OODATScanFloat(tokenizer, &value))  return [NSString stringWithFormat:@"expected three pairs of texture coordinates for face %i", j];
+			}
+		}
+	}
+	
+	if (OODATScanSection(tokenizer, kOODATSectionNames))
+	{
+		if (!OODATScanInt(tokenizer, &count) || count < 0)  return @"expected a count after NAMES";
+		for (j = 0; j < count; j++)
+		{
+			NSString *name = OODATScanLine(tokenizer);
+			if (name == nil)  return [NSString stringWithFormat:@"expected name %i of %i", j + 1, count];
+			
+			NSUInteger keyIndex = [materialKeys indexOfObject:[NSString stringWithFormat:@"%i", j]];
+			if (keyIndex != NSNotFound)  [materialKeys replaceObjectAtIndex:keyIndex withObject:name];
+		}
+	}
+	
+	if (OODATScanSection(tokenizer, kOODATSectionNormals))
+	{
+		for (j = 0; j < vertexCount; j++)
+		{
+			if (!OODATScanVector(tokenizer, &vector))  return [NSString stringWithFormat:@"expected a normal for vertex %i", j];
+		}
+		
+		if (OODATScanSection(tokenizer, kOODATSectionTangents))
+		{
+			for (j = 0; j < vertexCount; j++)
+			{
+				if (!OODATScanVector(tokenizer, &vector))  return [NSString stringWithFormat:@"expected a tangent for vertex %i", j];
+			}
+		}
+	}
+	else if (OODATPeekSection(tokenizer) == kOODATSectionTangents)
+	{
+		return @"TANGENTS without NORMALS will be ignored";
+	}
+	
+	OODATScanSection(tokenizer, kOODATSectionEnd);
+	if (!OODATAtEnd(tokenizer))
+	{
+		OOLog(@"verifyOXP.model.trailingData", @"----- WARNING: model %@ has unexpected data at line %lu, which will be ignored.", displayName, (unsigned long)tokenizer->line);
+	}
+	
+	return nil;
+}
+
+
 - (void)checkModel:(NSString *)name
 				 context:(NSString *)context
 			   materials:(NSDictionary *)materials
 				 shaders:(NSDictionary *)shaders
 {
-	OOLog(@"verifyOXP.verbose.model.unimp", @"- Pretending to verify model %@ referenced in %@.", name, context);
-	// FIXME: this should check DAT files.
+	OOFileScannerVerifierStage	*fileScanner = nil;
+	NSString					*displayName = nil;
+	NSData						*data = nil;
+	OODATTokenizer				tokenizer;
+	NSMutableArray				*materialKeys = nil;
+	NSString					*error = nil;
+	NSString					*key = nil;
+	int							vertexCount = 0, faceCount = 0;
+	
+	fileScanner = [[self verifier] fileScannerStage];
+	displayName = [fileScanner displayNameForFile:name andFolder:@"Models"];
+	
+	if ([[[name pathExtension] lowercaseString] isEqualToString:@"oomesh"])
+	{
+		OOLog(@"verifyOXP.verbose.model.binary", @"- %@ is a binary mesh, not checked.", displayName);
+		return;
+	}
+	
+	data = [fileScanner dataForFile:name inFolder:@"Models" referencedFrom:context checkBuiltIn:YES];
+	if (data == nil)  return;
+	
+	if (!OODATTokenizerInit(&tokenizer, data))
+	{
+		OOLog(@"verifyOXP.model.failed", @"***** ERROR: model %@ could not be read.", displayName);
+		return;
+	}
+	
+	materialKeys = [NSMutableArray array];
+	error = CheckDATFile(&tokenizer, displayName, materialKeys, &vertexCount, &faceCount);
+	if (error != nil)
+	{
+		OOLog(@"verifyOXP.model.failed", @"***** ERROR: model %@, line %lu: %@.", displayName, (unsigned long)tokenizer.line, error);
+		return;
+	}
+	
+	// Material keys with no material or shader definition are texture names.
+	foreach (key, materialKeys)
+	{
+		if ([materials objectForKey:key] == nil && [shaders objectForKey:key] == nil)
+		{
+			[[[self verifier] textureVerifierStage] textureNamed:key usedInContext:displayName];
+		}
+	}
+	
+	OOLog(@"verifyOXP.verbose.model.OK", @"- %@ (%i vertices, %i faces, %lu materials) OK.", displayName, vertexCount, faceCount, (unsigned long)[materialKeys count]);
 }
 
 @end
@@ -4,6 +4,20 @@ Octree.h
 
 Octtree class for collision detection.
 
+Octrees are stored breadth-first as an array of inner nodes. Each inner node
+has an 8-bit mask of occupied (solid or inner) children, an 8-bit mask of
+solid children, and the index of its first inner child; the inner children of
+a node are stored contiguously in octant order, so the index of any inner
+child is firstChild plus the number of inner children before it. Empty and
+solid children take no space of their own. The root is recorded separately,
+since it may be empty or solid.
+
+Line and octree-vs-octree tests walk the tree iteratively with explicit
+stacks and keep no state outside the call, so different octrees (and the same
+octree) may be tested from several threads at once. The per-child tests are
+done eight children at a time, with SSE or NEON where available. Collision
+marking for debug drawing only happens when DEBUG_OCTREE_DRAW is set.
+
 Oolite
 Copyright (C) 2004-2013 Giles C Williams and contributors
 
@@ -41,10 +55,11 @@ MA 02110-1301, USA.
 @private
 	GLfloat				_radius;
 	uint32_t			_nodeCount;
-	const int			*_octree;
+	const struct OOOctreeNode *_nodes;
+	uint8_t				_root;
 	BOOL				_hasCollision;
 	
-	unsigned char		*_collisionOctree;
+	unsigned char		*_collisionMarks;		// One per node: root, then eight child slots per inner node.
 	
 	NSData				*_data;
 }
@@ -54,9 +69,19 @@ MA 02110-1301, USA.
 	
 	Deserialize an octree from cache representation.
 	(To make a new octree, build it with OOOctreeBuilder.)
+	Representations from before the compact format (with no "version") are
+	converted; unknown versions are rejected, so the octree gets rebuilt.
 */
 - (instancetype) initWithDictionary:(NSDictionary *)dictionary;
 
+/*
+	- (id) initWithBinaryRepresentation:
+	
+	Deserialize an octree from -binaryRepresentation. Returns nil if the data
+	is malformed, or was written by a machine of different endianness.
+*/
+- (instancetype) initWithBinaryRepresentation:(NSData *)data;
+
 - (Octree *) octreeScaledBy:(GLfloat)factor;
 
 #ifndef OODEBUGLDRAWING_DISABLE
@@ -71,6 +96,9 @@ MA 02110-1301, USA.
 
 - (NSDictionary *) dictionaryRepresentation;
 
+// A header followed by the nodes, for the octree blob cache.
+- (NSData *) binaryRepresentation;
+
 @property (readonly, atomic) GLfloat volume;
 
 @property (readonly, atomic) Vector randomPoint;
@@ -106,8 +134,10 @@ enum
 	-buildOctreeWithRadius:(GLfloat)radius
 	
 	Generate an octree with the current data in the builder and the specified
-	radius, and clear the builder. If NDEBUG is undefined, throws an exception
-	if the structure of the octree is invalid.
+	radius, and clear the builder. The builder works depth-first; the result
+	is converted to the compact breadth-first form described above. If NDEBUG
+	is undefined, throws an exception if the structure of the octree is
+	invalid.
 */
 - (Octree *) buildOctreeWithRadius:(GLfloat)radius;
 
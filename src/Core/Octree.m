@@ -40,26 +40,67 @@ MA 02110-1301, USA.
 #endif
 
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define OCTREE_SSE 1
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define OCTREE_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+typedef struct OOOctreeNode
+{
+	uint8_t				occupied;		// Bit n set if child n is solid or inner.
+	uint8_t				solid;			// Bit n set if child n is solid.
+	uint16_t			reserved;
+	uint32_t			firstChild;		// Node index of the lowest-numbered inner child; the others follow it.
+} OOOctreeNode;
+
+
+enum
+{
+	kOctreeFormatVersion	= 2,		// Version 1 (no "version" key) was a depth-first array of ints.
+	
+	kOctreeRootEmpty		= 0,
+	kOctreeRootSolid		= 1,
+	kOctreeRootInner		= 2,
+	
+	kOctreeBinaryMagic		= 0x4F4F6374,	// 'OOct'; reads differently with the wrong endianness.
+	
+	kSolidNode				= -1,
+	
+	// Each inner node popped pushes at most eight children.
+	kMaxLineStack			= 1 + 7 * kMaxOctreeDepth,
+	kMaxPairStack			= 1 + 7 * 2 * kMaxOctreeDepth
+};
+
+
+// Header of -binaryRepresentation; the nodes follow it.
 typedef struct
 {
+	uint32_t			magic;
+	uint16_t			version;
+	uint8_t				root;
+	uint8_t				reserved;
 	GLfloat				radius;
-	const int			*octree;
-	unsigned char		*octree_collision;
-} Octree_details;
+	uint32_t			nodeCount;
+} OctreeBinaryHeader;
 
 
-@interface Octree (Private)
+// A node in a traversal: an inner node, or a solid leaf.
+typedef struct
+{
+	int32_t				node;			// Inner node index, or kSolidNode.
+	uint32_t			slot;			// Collision mark index: 0 for the root, 1 + 8 * parent + octant for the rest.
+} NodeRef;
 
-#ifndef OODEBUGLDRAWING_DISABLE
 
-- (void) drawOctreeFromLocation:(uint32_t)loc :(GLfloat)scale :(Vector)offset;
-- (void) drawOctreeCollisionFromLocation:(uint32_t)loc :(GLfloat)scale :(Vector)offset;
+@interface Octree (Private)
 
-@property  BOOL hasCollision;
+- (instancetype) initWithData:(NSData *)data root:(uint8_t)root radius:(GLfloat)radius;
 
-#endif
-
-@property (readonly) Octree_details octreeDetails;
+@property BOOL hasCollision;
 
 @end
 
@@ -67,11 +108,43 @@ typedef struct
 static const int change_oct[] = { 0, 1, 2, 4, 3, 5, 6, 7 };	// used to move from nearest to furthest octant
 
 
-static BOOL isHitByLine(const int *octbuffer, unsigned char *collbuffer, int level, GLfloat rad, Vector v0, Vector v1, Vector off, int face_hit);
-static GLfloat volumeOfOctree(Octree_details octree_details, unsigned depthLimit);
-static Vector randomFullNodeFrom(Octree_details details, Vector offset);
+static NSData *CompactOctreeFromLegacy(const int *legacy, NSUInteger legacyCount, uint8_t *outRoot);
+static BOOL ValidateCompactOctree(NSData *data, uint8_t root);
+
+static GLfloat LineHitDistance(const OOOctreeNode *nodes, NodeRef root, GLfloat radius, Vector v0, Vector v1, unsigned char *marks, BOOL *outTouched);
+static BOOL OctreesIntersect(const OOOctreeNode *axialNodes, NodeRef axialRoot, GLfloat axialRadius, unsigned char *axialMarks,
+							 const OOOctreeNode *otherNodes, NodeRef otherRoot, GLfloat otherRadius, unsigned char *otherMarks,
+							 Vector otherPosition, Triangle other_ijk);
+static GLfloat VolumeOfOctree(const OOOctreeNode *nodes, NodeRef ref, GLfloat radius, unsigned depthLimit);
+static Vector RandomFullNodeFrom(const OOOctreeNode *nodes, NodeRef ref, GLfloat radius, Vector offset);
+
+
+OOINLINE unsigned PopCount8(unsigned x)
+{
+	x = x - ((x >> 1) & 0x55);
+	x = (x & 0x33) + ((x >> 2) & 0x33);
+	return (x + (x >> 4)) & 0x0F;
+}
+
+
+OOINLINE NodeRef ChildRef(const OOOctreeNode *nodes, uint32_t parent, unsigned oct)
+{
+	const OOOctreeNode *node = &nodes[parent];
+	NodeRef ref = { kSolidNode, 1 + 8 * parent + oct };
+	
+	if (!(node->solid & (1 << oct)))
+	{
+		unsigned innerBefore = node->occupied & ~node->solid & ((1 << oct) - 1);
+		ref.node = node->firstChild + PopCount8(innerBefore);
+	}
+	return ref;
+}
+
 
-static BOOL	isHitByOctree(Octree_details axialDetails, Octree_details otherDetails, Vector delta, Triangle other_ijk);
+static Vector offsetForOctant(int oct, GLfloat r)
+{
+	return make_vector((0.5f - (GLfloat)((oct >> 2) & 1)) * r, (0.5f - (GLfloat)((oct >> 1) & 1)) * r, (0.5f - (GLfloat)(oct & 1)) * r);
+}
 
 
 @implementation Octree
@@ -88,21 +161,23 @@ static BOOL	isHitByOctree(Octree_details axialDetails, Octree_details otherDetai
 
 // Designated initializer.
 - (instancetype) initWithData:(NSData *)data
+			   root:(uint8_t)root
 			 radius:(GLfloat)radius
 {
 	if ((self = [super init]))
 	{
 		_data = [data copy];
+		_root = root;
 		_radius = radius;
 		
-		NSUInteger nodeCount = [_data length] / sizeof *_octree;
-		NSParameterAssert(nodeCount < UINT32_MAX);
+		NSUInteger nodeCount = [_data length] / sizeof *_nodes;
+		NSParameterAssert(nodeCount < UINT32_MAX / 8);
 		_nodeCount = (uint32_t)nodeCount;
 		
-		_octree = [_data bytes];
+		_nodes = [_data bytes];
 		
-		_collisionOctree = calloc(1, _nodeCount);
-		if (_octree == NULL || _collisionOctree == NULL)
+		_collisionMarks = calloc(1, 1 + 8 * _nodeCount);
+		if ((_nodes == NULL && _nodeCount != 0) || _collisionMarks == NULL)
 		{
 			[self release];
 			return nil;
@@ -116,21 +191,71 @@ static BOOL	isHitByOctree(Octree_details axialDetails, Octree_details otherDetai
 - (instancetype) initWithDictionary:(NSDictionary *)dict
 {
 	NSData *data = [dict objectForKey:@"octree"];
-	if (![data isKindOfClass:[NSData class]] || ([data length] % sizeof (int)) != 0)
+	if (![data isKindOfClass:[NSData class]])
 	{
 		// Invalid representation.
 		[self release];
 		return nil;
 	}
 	
-	return [self initWithData:data radius:[dict oo_floatForKey:@"radius"]];
+	uint8_t root = kOctreeRootEmpty;
+	unsigned version = [dict oo_unsignedIntForKey:@"version" defaultValue:1];
+	if (version == 1)
+	{
+		// Cached before the compact format; converting is cheaper than rebuilding from the mesh.
+		if (([data length] % sizeof (int)) != 0)  data = nil;
+		else  data = CompactOctreeFromLegacy([data bytes], [data length] / sizeof (int), &root);
+	}
+	else if (version == kOctreeFormatVersion)
+	{
+		root = [dict oo_unsignedIntForKey:@"root" defaultValue:kOctreeRootEmpty];
+		if (!ValidateCompactOctree(data, root))  data = nil;
+	}
+	else
+	{
+		data = nil;
+	}
+	
+	if (data == nil)
+	{
+		[self release];
+		return nil;
+	}
+	
+	return [self initWithData:data root:root radius:[dict oo_floatForKey:@"radius"]];
+}
+
+
+- (instancetype) initWithBinaryRepresentation:(NSData *)data
+{
+	OctreeBinaryHeader header;
+	NSData *nodes = nil;
+	
+	if ([data length] >= sizeof header)
+	{
+		memcpy(&header, [data bytes], sizeof header);
+		if (header.magic == kOctreeBinaryMagic && header.version == kOctreeFormatVersion &&
+			[data length] - sizeof header == (NSUInteger)header.nodeCount * sizeof (OOOctreeNode))
+		{
+			nodes = [data subdataWithRange:NSMakeRange(sizeof header, [data length] - sizeof header)];
+			if (!ValidateCompactOctree(nodes, header.root))  nodes = nil;
+		}
+	}
+	
+	if (nodes == nil)
+	{
+		[self release];
+		return nil;
+	}
+	
+	return [self initWithData:nodes root:header.root radius:header.radius];
 }
 
 
 - (void) dealloc
 {
 	DESTROY(_data);
-	free(_collisionOctree);
+	free(_collisionMarks);
 	
 	[super dealloc];
 }
@@ -148,630 +273,802 @@ static BOOL	isHitByOctree(Octree_details axialDetails, Octree_details otherDetai
 }
 
 
-- (Octree_details) octreeDetails
+OOINLINE NodeRef RootRef(Octree *self)
 {
-	Octree_details details =
-	{
-		.octree = _octree,
-		.radius = _radius,
-		.octree_collision = _collisionOctree
-	};
-	return details;
+	NodeRef ref = { (self->_root == kOctreeRootInner) ? 0 : kSolidNode, 0 };
+	return ref;
 }
 
 
-- (Octree *) octreeScaledBy:(GLfloat)factor
+// Collision marks are only kept up to date for debug drawing, so normal use writes nothing.
+OOINLINE unsigned char *CollisionMarks(Octree *self)
 {
-	// Since octree data is immutable, we can share.
-	return [[[Octree alloc] initWithData:_data radius:_radius * factor] autorelease];
+#ifndef OODEBUGLDRAWING_DISABLE
+	if (EXPECT_NOT(gDebugFlags & DEBUG_OCTREE_DRAW))  return self->_collisionMarks;
+#endif
+	return NULL;
 }
 
 
-static Vector offsetForOctant(int oct, GLfloat r)
+- (Octree *) octreeScaledBy:(GLfloat)factor
 {
-	return make_vector((0.5f - (GLfloat)((oct >> 2) & 1)) * r, (0.5f - (GLfloat)((oct >> 1) & 1)) * r, (0.5f - (GLfloat)(oct & 1)) * r);
+	// Since octree data is immutable, we can share.
+	return [[[Octree alloc] initWithData:_data root:_root radius:_radius * factor] autorelease];
 }
 
 
 #ifndef OODEBUGLDRAWING_DISABLE
 
-- (void) drawOctree
+static void DrawCube(GLfloat scale, Vector offset)
 {
-	OODebugWFState state = OODebugBeginWireframe(NO);
-	
-	OO_ENTER_OPENGL();
-	OOGL(glEnable(GL_BLEND));
-	OOGLBEGIN(GL_LINES);
-	glColor4f(0.4f, 0.4f, 0.4f, 0.5f);
-	
-	// it's a series of cubes
-	[self drawOctreeFromLocation:0 :_radius : kZeroVector];
-	
-	OOGLEND();
-	
-	OODebugEndWireframe(state);
-	OOCheckOpenGLErrors(@"Octree after drawing %@", self);
+	glVertex3f(-scale + offset.x, -scale + offset.y, -scale + offset.z);
+	glVertex3f(-scale + offset.x, scale + offset.y, -scale + offset.z);
+	glVertex3f(-scale + offset.x, scale + offset.y, -scale + offset.z);
+	glVertex3f(scale + offset.x, scale + offset.y, -scale + offset.z);
+	glVertex3f(scale + offset.x, scale + offset.y, -scale + offset.z);
+	glVertex3f(scale + offset.x, -scale + offset.y, -scale + offset.z);
+	glVertex3f(scale + offset.x, -scale + offset.y, -scale + offset.z);
+	glVertex3f(-scale + offset.x, -scale + offset.y, -scale + offset.z);
+	
+	glVertex3f(-scale + offset.x, -scale + offset.y, scale + offset.z);
+	glVertex3f(-scale + offset.x, scale + offset.y, scale + offset.z);
+	glVertex3f(-scale + offset.x, scale + offset.y, scale + offset.z);
+	glVertex3f(scale + offset.x, scale + offset.y, scale + offset.z);
+	glVertex3f(scale + offset.x, scale + offset.y, scale + offset.z);
+	glVertex3f(scale + offset.x, -scale + offset.y, scale + offset.z);
+	glVertex3f(scale + offset.x, -scale + offset.y, scale + offset.z);
+	glVertex3f(-scale + offset.x, -scale + offset.y, scale + offset.z);
+	
+	glVertex3f(-scale + offset.x, -scale + offset.y, -scale + offset.z);
+	glVertex3f(-scale + offset.x, -scale + offset.y, scale + offset.z);
+	
+	glVertex3f(-scale + offset.x, scale + offset.y, -scale + offset.z);
+	glVertex3f(-scale + offset.x, scale + offset.y, scale + offset.z);
+	
+	glVertex3f(scale + offset.x, scale + offset.y, -scale + offset.z);
+	glVertex3f(scale + offset.x, scale + offset.y, scale + offset.z);
+	
+	glVertex3f(scale + offset.x, -scale + offset.y, -scale + offset.z);
+	glVertex3f(scale + offset.x, -scale + offset.y, scale + offset.z);
 }
 
 
-#if 0
-#define OCTREE_COLOR(r, g, b, a) glColor4f(r, g, b, a)
-#else
-#define OCTREE_COLOR(r, g, b, a) do {} while (0)
-#endif
+// Child centre relative to parent centre; the high bit of the octant is x, as in OOOctreeBuilder.
+OOINLINE Vector ChildOffset(unsigned oct, GLfloat sc)
+{
+	return make_vector((oct & 4) ? sc : -sc, (oct & 2) ? sc : -sc, (oct & 1) ? sc : -sc);
+}
 
 
-- (void) drawOctreeFromLocation:(uint32_t)loc :(GLfloat)scale :(Vector)offset
+static void DrawOctreeNode(const OOOctreeNode *nodes, NodeRef ref, GLfloat scale, Vector offset)
 {
-	if (_octree[loc] == 0)
+	if (ref.node == kSolidNode)
 	{
+		DrawCube(scale, offset);
 		return;
 	}
 	
-	OO_ENTER_OPENGL();
-	
-	if (_octree[loc] == -1)	// full
+	GLfloat sc = 0.5f * scale;
+	unsigned oct;
+	for (oct = 0; oct < 8; oct++)
 	{
-		// draw a cube
-		glVertex3f(-scale + offset.x, -scale + offset.y, -scale + offset.z);
-		glVertex3f(-scale + offset.x, scale + offset.y, -scale + offset.z);
-		glVertex3f(-scale + offset.x, scale + offset.y, -scale + offset.z);
-		glVertex3f(scale + offset.x, scale + offset.y, -scale + offset.z);
-		glVertex3f(scale + offset.x, scale + offset.y, -scale + offset.z);
-		glVertex3f(scale + offset.x, -scale + offset.y, -scale + offset.z);
-		glVertex3f(scale + offset.x, -scale + offset.y, -scale + offset.z);
-		glVertex3f(-scale + offset.x, -scale + offset.y, -scale + offset.z);
-		
-			
-		glVertex3f(-scale + offset.x, -scale + offset.y, scale + offset.z);
-		glVertex3f(-scale + offset.x, scale + offset.y, scale + offset.z);
-		glVertex3f(-scale + offset.x, scale + offset.y, scale + offset.z);
-		glVertex3f(scale + offset.x, scale + offset.y, scale + offset.z);
-		glVertex3f(scale + offset.x, scale + offset.y, scale + offset.z);
-		glVertex3f(scale + offset.x, -scale + offset.y, scale + offset.z);
-		glVertex3f(scale + offset.x, -scale + offset.y, scale + offset.z);
-		glVertex3f(-scale + offset.x, -scale + offset.y, scale + offset.z);
-			
-		glVertex3f(-scale + offset.x, -scale + offset.y, -scale + offset.z);
-		glVertex3f(-scale + offset.x, -scale + offset.y, scale + offset.z);
-		
-		glVertex3f(-scale + offset.x, scale + offset.y, -scale + offset.z);
-		glVertex3f(-scale + offset.x, scale + offset.y, scale + offset.z);
-		
-		glVertex3f(scale + offset.x, scale + offset.y, -scale + offset.z);
-		glVertex3f(scale + offset.x, scale + offset.y, scale + offset.z);
-		
-		glVertex3f(scale + offset.x, -scale + offset.y, -scale + offset.z);
-		glVertex3f(scale + offset.x, -scale + offset.y, scale + offset.z);
-	}
-	else if (_octree[loc] > 0)
-	{
-		GLfloat sc = 0.5f * scale;
-		OCTREE_COLOR(0.4f, 0.4f, 0.4f, 0.5f);
-		[self drawOctreeFromLocation:loc + _octree[loc] + 0 :sc :make_vector(offset.x - sc, offset.y - sc, offset.z - sc)];
-		OCTREE_COLOR(0.0f, 0.0f, 1.0f, 0.5f);
-		[self drawOctreeFromLocation:loc + _octree[loc] + 1 :sc :make_vector(offset.x - sc, offset.y - sc, offset.z + sc)];
-		OCTREE_COLOR(0.0f, 1.0f, 0.0f, 0.5f);
-		[self drawOctreeFromLocation:loc + _octree[loc] + 2 :sc :make_vector(offset.x - sc, offset.y + sc, offset.z - sc)];
-		OCTREE_COLOR(0.0f, 1.0f, 1.0f, 0.5f);
-		[self drawOctreeFromLocation:loc + _octree[loc] + 3 :sc :make_vector(offset.x - sc, offset.y + sc, offset.z + sc)];
-		OCTREE_COLOR(1.0f, 0.0f, 0.0f, 0.5f);
-		[self drawOctreeFromLocation:loc + _octree[loc] + 4 :sc :make_vector(offset.x + sc, offset.y - sc, offset.z - sc)];
-		OCTREE_COLOR(1.0f, 0.0f, 1.0f, 0.5f);
-		[self drawOctreeFromLocation:loc + _octree[loc] + 5 :sc :make_vector(offset.x + sc, offset.y - sc, offset.z + sc)];
-		OCTREE_COLOR(1.0f, 1.0f, 0.0f, 0.5f);
-		[self drawOctreeFromLocation:loc + _octree[loc] + 6 :sc :make_vector(offset.x + sc, offset.y + sc, offset.z - sc)];
-		OCTREE_COLOR(1.0f, 1.0f, 1.0f, 0.5f);
-		[self drawOctreeFromLocation:loc + _octree[loc] + 7 :sc :make_vector(offset.x + sc, offset.y + sc, offset.z + sc)];
+		if (nodes[ref.node].occupied & (1 << oct))
+		{
+			DrawOctreeNode(nodes, ChildRef(nodes, ref.node, oct), sc, vector_add(offset, ChildOffset(oct, sc)));
+		}
 	}
 }
 
 
-static BOOL drawTestForCollisions;
-
-- (void) drawOctreeCollisions
+- (void) drawOctree
 {
+	if (_root == kOctreeRootEmpty)  return;
+	
 	OODebugWFState state = OODebugBeginWireframe(NO);
 	
+	OO_ENTER_OPENGL();
+	OOGL(glEnable(GL_BLEND));
+	OOGLBEGIN(GL_LINES);
+	glColor4f(0.4f, 0.4f, 0.4f, 0.5f);
+	
 	// it's a series of cubes
-	drawTestForCollisions = NO;
-	if (_hasCollision)
-	{
-		[self drawOctreeCollisionFromLocation:0 :_radius :kZeroVector];
-	}
-	_hasCollision = drawTestForCollisions;
+	DrawOctreeNode(_nodes, RootRef(self), _radius, kZeroVector);
+	
+	OOGLEND();
 	
 	OODebugEndWireframe(state);
-	OOCheckOpenGLErrors(@"Octree after drawing collisions for %@", self);
+	OOCheckOpenGLErrors(@"Octree after drawing %@", self);
 }
 
 
-- (void) drawOctreeCollisionFromLocation:(uint32_t)loc :(GLfloat)scale :(Vector)offset
+// Returns YES if anything was drawn, i.e. some marks have not faded yet.
+static BOOL DrawOctreeCollisionNode(const OOOctreeNode *nodes, unsigned char *marks, NodeRef ref, GLfloat scale, Vector offset)
 {
-	if (_octree[loc] == 0)
-	{
-		return;
-	}
+	BOOL drewAnything = NO;
 	
-	if ((_octree[loc] != 0)&&(_collisionOctree[loc] != (unsigned char)0))	// full - draw
+	if (marks[ref.slot] != 0)	// marked - draw
 	{
 		OO_ENTER_OPENGL();
 		
-		GLfloat red = (GLfloat)(_collisionOctree[loc])/255.0;
+		GLfloat red = (GLfloat)(marks[ref.slot])/255.0;
 		glColor4f(1.0, 0.0, 0.0, red);	// 50% translucent
 		
-		drawTestForCollisions = YES;
-		_collisionOctree[loc]--;
+		drewAnything = YES;
+		marks[ref.slot]--;
 		
 		// draw a cube
 		OOGL(glDisable(GL_CULL_FACE));		// face culling
 		
 		OOGL(glDisable(GL_TEXTURE_2D));
-
-		OOGLBEGIN(GL_LINE_STRIP);
-			glVertex3f(-scale + offset.x, -scale + offset.y, -scale + offset.z);
-			glVertex3f(-scale + offset.x, scale + offset.y, -scale + offset.z);
-			glVertex3f(scale + offset.x, scale + offset.y, -scale + offset.z);
-			glVertex3f(scale + offset.x, -scale + offset.y, -scale + offset.z);
-			glVertex3f(-scale + offset.x, -scale + offset.y, -scale + offset.z);
-		OOGLEND();
 		
-		OOGLBEGIN(GL_LINE_STRIP);
-			glVertex3f(-scale + offset.x, -scale + offset.y, scale + offset.z);
-			glVertex3f(-scale + offset.x, scale + offset.y, scale + offset.z);
-			glVertex3f(scale + offset.x, scale + offset.y, scale + offset.z);
-			glVertex3f(scale + offset.x, -scale + offset.y, scale + offset.z);
-			glVertex3f(-scale + offset.x, -scale + offset.y, scale + offset.z);
-		OOGLEND();
-			
 		OOGLBEGIN(GL_LINES);
-			glVertex3f(-scale + offset.x, -scale + offset.y, -scale + offset.z);
-			glVertex3f(-scale + offset.x, -scale + offset.y, scale + offset.z);
-			
-			glVertex3f(-scale + offset.x, scale + offset.y, -scale + offset.z);
-			glVertex3f(-scale + offset.x, scale + offset.y, scale + offset.z);
-			
-			glVertex3f(scale + offset.x, scale + offset.y, -scale + offset.z);
-			glVertex3f(scale + offset.x, scale + offset.y, scale + offset.z);
-			
-			glVertex3f(scale + offset.x, -scale + offset.y, -scale + offset.z);
-			glVertex3f(scale + offset.x, -scale + offset.y, scale + offset.z);
+		DrawCube(scale, offset);
 		OOGLEND();
-			
+		
 		OOGL(glEnable(GL_CULL_FACE));		// face culling
 	}
-	if (_octree[loc] > 0)
+	
+	if (ref.node != kSolidNode)
 	{
 		GLfloat sc = 0.5f * scale;
-		[self drawOctreeCollisionFromLocation:loc + _octree[loc] + 0 :sc :make_vector(offset.x - sc, offset.y - sc, offset.z - sc)];
-		[self drawOctreeCollisionFromLocation:loc + _octree[loc] + 1 :sc :make_vector(offset.x - sc, offset.y - sc, offset.z + sc)];
-		[self drawOctreeCollisionFromLocation:loc + _octree[loc] + 2 :sc :make_vector(offset.x - sc, offset.y + sc, offset.z - sc)];
-		[self drawOctreeCollisionFromLocation:loc + _octree[loc] + 3 :sc :make_vector(offset.x - sc, offset.y + sc, offset.z + sc)];
-		[self drawOctreeCollisionFromLocation:loc + _octree[loc] + 4 :sc :make_vector(offset.x + sc, offset.y - sc, offset.z - sc)];
-		[self drawOctreeCollisionFromLocation:loc + _octree[loc] + 5 :sc :make_vector(offset.x + sc, offset.y - sc, offset.z + sc)];
-		[self drawOctreeCollisionFromLocation:loc + _octree[loc] + 6 :sc :make_vector(offset.x + sc, offset.y + sc, offset.z - sc)];
-		[self drawOctreeCollisionFromLocation:loc + _octree[loc] + 7 :sc :make_vector(offset.x + sc, offset.y + sc, offset.z + sc)];
+		unsigned oct;
+		for (oct = 0; oct < 8; oct++)
+		{
+			if (nodes[ref.node].occupied & (1 << oct))
+			{
+				drewAnything |= DrawOctreeCollisionNode(nodes, marks, ChildRef(nodes, ref.node, oct), sc, vector_add(offset, ChildOffset(oct, sc)));
+			}
+		}
 	}
+	
+	return drewAnything;
 }
-#endif // OODEBUGLDRAWING_DISABLE
 
 
-static BOOL isHitByLineSub(const int *octbuffer, unsigned char *collbuffer, int nextLevel, GLfloat rad, GLfloat rd2, Vector v0, Vector v1, int octantMask)
+- (void) drawOctreeCollisions
 {
-	if (octbuffer[nextLevel + octantMask])
+	OODebugWFState state = OODebugBeginWireframe(NO);
+	
+	// it's a series of cubes
+	if (_hasCollision && _root != kOctreeRootEmpty)
 	{
-		Vector moveLine = offsetForOctant(octantMask, rad);
-		return isHitByLine(octbuffer, collbuffer, nextLevel + octantMask, rd2, v0, v1, moveLine, 0);
+		_hasCollision = DrawOctreeCollisionNode(_nodes, _collisionMarks, RootRef(self), _radius, kZeroVector);
 	}
-	else  return NO;
+	
+	OODebugEndWireframe(state);
+	OOCheckOpenGLErrors(@"Octree after drawing collisions for %@", self);
 }
+#endif // OODEBUGLDRAWING_DISABLE
 
 
-static BOOL hasCollided = NO;
-static GLfloat hit_dist = 0.0;
-static BOOL isHitByLine(const int *octbuffer, unsigned char *collbuffer, int level, GLfloat rad, Vector v0, Vector v1, Vector off, int face_hit)
+- (GLfloat) isHitByLine:(Vector)v0 :(Vector)v1
 {
-	// displace the line by the offset
-	Vector u0 = make_vector(v0.x + off.x, v0.y + off.y, v0.z + off.z);
-	Vector u1 = make_vector(v1.x + off.x, v1.y + off.y, v1.z + off.z);
+	if (_root == kOctreeRootEmpty)  return 0.0f;
 	
-	OctreeDebugLog(@"DEBUG octant: [%d] radius: %.2f vs. line: (%.2f, %.2f, %.2f) - (%.2f, %.2f, %.2f)",
-		level, rad, u0.x, u0.y, u0.z, u1.x, u1.y, u1.z);
+	unsigned char *marks = CollisionMarks(self);
+	BOOL touched = NO;
+	if (marks != NULL)  memset(marks, 0, 1 + 8 * _nodeCount);
+	
+	GLfloat result = LineHitDistance(_nodes, RootRef(self), _radius, v0, v1, marks, &touched);
+	OctreeDebugLog(@"DEBUG %@ at distance %.2f", (result != 0.0f) ? @"Hit" : @"Missed", result);
+	
+	if (marks != NULL)  _hasCollision = touched;
+	return result;
+}
 
-	if (octbuffer[level] == 0)
-	{
-		OctreeDebugLog(@"DEBUG Hit an empty octant: [%d]", level);
-		return NO;
-	}
+
+- (BOOL) isHitByOctree:(Octree *)other withOrigin:(Vector)v0 andIJK:(Triangle)ijk
+{
+	return [self isHitByOctree:other withOrigin:v0 andIJK:ijk andScales:1.0f :1.0f];
+}
+
+
+- (BOOL) isHitByOctree:(Octree *)other withOrigin:(Vector)v0 andIJK:(Triangle)ijk andScales:(GLfloat) s1 :(GLfloat)s2
+{
+	if (other == nil)  return NO;
 	
-	if (octbuffer[level] == -1)
+	if (_root == kOctreeRootEmpty)
 	{
-		OctreeDebugLog(@"DEBUG Hit a solid octant: [%d]", level);
-		collbuffer[level] = 2;	// green
-		hit_dist = sqrt(u0.x * u0.x + u0.y * u0.y + u0.z * u0.z);
-		return YES;
+		OctreeDebugLog(@"%@", @"DEBUG Axial octree is empty.");
+		return NO;
 	}
-	
-	int faces = face_hit;
-	if (faces == 0)
-		faces = lineCubeIntersection(u0, u1, rad);
-
-	if (faces == 0)
+	if (other->_root == kOctreeRootEmpty)
 	{
-		OctreeDebugLog(@"----> Line misses octant: [%d].", level);
+		OctreeDebugLog(@"%@", @"DEBUG Other octree is empty.");
 		return NO;
 	}
 	
-	int octantIntersected = 0;
+	unsigned char *marks = CollisionMarks(self);
+	BOOL hit = OctreesIntersect(_nodes, RootRef(self), _radius * s1, marks,
+								other->_nodes, RootRef(other), other->_radius * s2, (marks != NULL) ? other->_collisionMarks : NULL,
+								v0, ijk);
 	
-	if (faces > 0)
+	if (marks != NULL && hit)
 	{
-		Vector vi = lineIntersectionWithFace(u0, u1, faces, rad);
-		
-		if (CUBE_FACE_FRONT & faces)
-			octantIntersected = ((vi.x < 0.0)? 1: 5) + ((vi.y < 0.0)? 0: 2);
-		if (CUBE_FACE_BACK & faces)
-			octantIntersected = ((vi.x < 0.0)? 0: 4) + ((vi.y < 0.0)? 0: 2);
-		
-		if (CUBE_FACE_RIGHT & faces)
-			octantIntersected = ((vi.y < 0.0)? 4: 6) + ((vi.z < 0.0)? 0: 1);
-		if (CUBE_FACE_LEFT & faces)
-			octantIntersected = ((vi.y < 0.0)? 0: 2) + ((vi.z < 0.0)? 0: 1);
-
-		if (CUBE_FACE_TOP & faces)
-			octantIntersected = ((vi.x < 0.0)? 2: 6) + ((vi.z < 0.0)? 0: 1);
-		if (CUBE_FACE_BOTTOM & faces)
-			octantIntersected = ((vi.x < 0.0)? 0: 4) + ((vi.z < 0.0)? 0: 1);
-
-		OctreeDebugLog(@"----> found intersection with face 0x%2x of cube of radius %.2f at (%.2f, %.2f, %.2f) octant:%d",
-				faces, rad, vi.x, vi.y, vi.z, octantIntersected);
-	}
-	else
-	{	
-		OctreeDebugLog(@"----> inside cube of radius %.2f octant:%d", rad, octantIntersected);
+		_hasCollision = YES;
+		[other setHasCollision:YES];
 	}
 	
-	hasCollided = YES;
-	
-	collbuffer[level] = 1;	// red
-	
-	OctreeDebugLog(@"%@", @"----> testing octants...");
-	
-	int nextLevel = level + octbuffer[level];
-		
-	GLfloat rd2 = 0.5f * rad;
-	
-	// first test the intersected octant, then the three adjacent, then the next three adjacent, the finally the diagonal octant
-	int oct0, oct1, oct2, oct3;	// test oct0 then oct1, oct2, oct3 then (7 - oct1), (7 - oct2), (7 - oct3) then (7 - oct0)
-	oct0 = octantIntersected;
-	oct1 = oct0 ^ 0x01;	// adjacent x
-	oct2 = oct0 ^ 0x02;	// adjacent y
-	oct3 = oct0 ^ 0x04;	// adjacent z
-	
-	OctreeDebugLog(@"----> testing first octant hit [+%d]", oct0);
-	if (isHitByLineSub(octbuffer, collbuffer, nextLevel, rad, rd2, u0, u1, oct0))  return YES;	// first octant
-		
-	// test the three adjacent octants
+	return hit;
+}
 
-	OctreeDebugLog(@"----> testing next three octants [+%d] [+%d] [+%d]", oct1, oct2, oct3);
-	if (isHitByLineSub(octbuffer, collbuffer, nextLevel, rad, rd2, u0, u1, oct1))  return YES;	// second octant
-	if (isHitByLineSub(octbuffer, collbuffer, nextLevel, rad, rd2, u0, u1, oct2))  return YES;	// third octant
-	if (isHitByLineSub(octbuffer, collbuffer, nextLevel, rad, rd2, u0, u1, oct3))  return YES;	// fourth octant
-	
-	// go to the next four octants
-	
-	oct0 ^= 0x07;	oct1 ^= 0x07;	oct2 ^= 0x07;	oct3 ^= 0x07;
-	
-	OctreeDebugLog(@"----> testing back three octants [+%d] [+%d] [+%d]", oct1, oct2, oct3);
-	if (isHitByLineSub(octbuffer, collbuffer, nextLevel, rad, rd2, u0, u1, oct1))  return YES;	// fifth octant
-	if (isHitByLineSub(octbuffer, collbuffer, nextLevel, rad, rd2, u0, u1, oct2))  return YES;	// sixth octant
-	if (isHitByLineSub(octbuffer, collbuffer, nextLevel, rad, rd2, u0, u1, oct3))  return YES;	// seventh octant
-	
-	// and check the last octant
-	OctreeDebugLog(@"----> testing final octant [+%d]", oct0);
-	if (isHitByLineSub(octbuffer, collbuffer, nextLevel, rad, rd2, u0, u1, oct0))  return YES;	// last octant
-	
-	return NO;
+
+- (NSDictionary *) dictionaryRepresentation
+{
+	return @{@"octree": _data,
+		@"radius": @(_radius),
+		@"root": @(_root),
+		@"version": @(kOctreeFormatVersion)};
 }
 
-- (GLfloat) isHitByLine:(Vector)v0 :(Vector)v1
+
+- (NSData *) binaryRepresentation
 {
-	memset(_collisionOctree, 0, _nodeCount * sizeof *_collisionOctree);
-	hasCollided = NO;
+	OctreeBinaryHeader header = { kOctreeBinaryMagic, kOctreeFormatVersion, _root, 0, _radius, _nodeCount };
+	NSMutableData *result = [NSMutableData dataWithCapacity:sizeof header + [_data length]];
 	
-	if (isHitByLine(_octree, _collisionOctree, 0, _radius, v0, v1, kZeroVector, 0))
-	{
-		OctreeDebugLog(@"DEBUG Hit at distance %.2f", hit_dist);
-		_hasCollision = hasCollided;
-		return hit_dist;
-	}
-	else
-	{
-		OctreeDebugLog(@"%@", @"DEBUG Missed!");
-		_hasCollision = hasCollided;
-		return 0.0f;
-	}
+	[result appendBytes:&header length:sizeof header];
+	[result appendData:_data];
+	return result;
+}
+
+
+- (GLfloat) volume
+{
+	/*	For backwards compatibility, limit octree iteration for volume
+	 calculation to five levels. Raising the limit means lower calculated
+	 volumes for large ships.
+	 
+	 EMMSTRAN: consider raising the limit but fudging mass lock calculations
+	 to compensate. See http://aegidian.org/bb/viewtopic.php?f=3&t=9176 .
+	 Then again, five levels of iteration might be fine.
+	 -- Ahruman 2011-03-10
+	 */
+	if (_root == kOctreeRootEmpty)  return 0.0f;
+	return VolumeOfOctree(_nodes, RootRef(self), _radius, 5);
 }
 
 
-static BOOL isHitByOctree(Octree_details axialDetails,
-						  Octree_details otherDetails, Vector otherPosition, Triangle other_ijk)
+- (Vector) randomPoint
 {
-	const int *axialBuffer = axialDetails.octree;
-	const int *otherBuffer = otherDetails.octree;
+	if (_root == kOctreeRootEmpty)  return kZeroVector;
+	return RandomFullNodeFrom(_nodes, RootRef(self), _radius, kZeroVector);
+}
 
-	if (axialBuffer[0] == 0)
-	{
-		OctreeDebugLog(@"%@", @"DEBUG Axial octree is empty.");
-		return NO;
-	}
+
+#ifndef NDEBUG
+- (size_t) totalSize
+{
+	return [self oo_objectSize] + [_data oo_objectSize] + [_data length] + 1 + 8 * _nodeCount;
+}
+#endif
+
+@end
+
+
+/*** Conversion and validation ***/
+
+/*	Convert the depth-first int array produced by OOOctreeBuilder (and stored
+	in version 1 caches) to the compact breadth-first form. In the old form,
+	0 is empty, -1 is solid and a positive value is the offset from the node
+	to its block of eight children.
 	
-	if (!otherBuffer)
-	{
-		OctreeDebugLog(@"%@", @"DEBUG Other octree is undefined.");
-		return NO;
-	}
+	Breadth-first order is queue order, so inner nodes are numbered as they
+	are queued. Returns nil if the data is malformed.
+*/
+static NSData *CompactOctreeFromLegacy(const int *legacy, NSUInteger legacyCount, uint8_t *outRoot)
+{
+	NSCParameterAssert(outRoot != NULL);
 	
-	if (otherBuffer[0] == 0)
+	if (legacyCount == 0)  return nil;
+	if (legacy[0] == 0 || legacy[0] == -1)
 	{
-		OctreeDebugLog(@"%@", @"DEBUG Other octree is empty.");
-		return NO;
+		*outRoot = (legacy[0] == 0) ? kOctreeRootEmpty : kOctreeRootSolid;
+		return [NSData data];
 	}
+	if (legacy[0] < 0)  return nil;
 	
-	GLfloat axialRadius = axialDetails.radius;
-	GLfloat otherRadius = otherDetails.radius;
-	
-	if (otherRadius < axialRadius) // test axial cube against other sphere
+	// Every inner node but the root is one of a block of eight.
+	NSUInteger capacity = (legacyCount - 1) / 8 + 1;
+	uint32_t *queue = malloc(capacity * sizeof *queue);
+	OOOctreeNode *nodes = malloc(capacity * sizeof *nodes);
+	if (queue == NULL || nodes == NULL)
 	{
-		// 'crude and simple' - test sphere against cube...
-		if ((otherPosition.x + otherRadius < -axialRadius)||(otherPosition.x - otherRadius > axialRadius)||
-			(otherPosition.y + otherRadius < -axialRadius)||(otherPosition.y - otherRadius > axialRadius)||
-			(otherPosition.z + otherRadius < -axialRadius)||(otherPosition.z - otherRadius > axialRadius))
-		{
-			OctreeDebugLog(@"%@", @"----> Other sphere does not intersect axial cube");
-			return NO;
-		}
-	}
-	else	// test axial sphere against other cube
-	{
-		Vector	d2 = vector_flip(otherPosition);
-		Vector	axialPosition = resolveVectorInIJK(d2, other_ijk);
-		if ((axialPosition.x + axialRadius < -otherRadius)||(axialPosition.x - axialRadius > otherRadius)||
-			(axialPosition.y + axialRadius < -otherRadius)||(axialPosition.y - axialRadius > otherRadius)||
-			(axialPosition.z + axialRadius < -otherRadius)||(axialPosition.z - axialRadius > otherRadius))
-		{
-			OctreeDebugLog(@"%@", @"----> Axial sphere does not intersect other cube");
-			return NO;
-		}
+		free(queue);
+		free(nodes);
+		return nil;
 	}
 	
-	// from here on, this Octree and the other Octree are considered to be intersecting
-	unsigned char	*axialCollisionBuffer = axialDetails.octree_collision;
-	unsigned char	*otherCollisionBuffer = otherDetails.octree_collision;
-	if (axialBuffer[0] == -1)
+	NSUInteger k, count = 1;
+	BOOL OK = YES;
+	queue[0] = 0;
+	
+	for (k = 0; k < count && OK; k++)
 	{
-		// we are SOLID - is the other octree?
-		if (otherBuffer[0] == -1)
+		NSUInteger base = queue[k] + (NSUInteger)legacy[queue[k]];
+		OOOctreeNode node = { 0, 0, 0, (uint32_t)count };
+		unsigned oct;
+		
+		if (base + 8 > legacyCount)
 		{
-			// YES so octrees collide
-			axialCollisionBuffer[0] = (unsigned char)255;	// mark
-			otherCollisionBuffer[0] = (unsigned char)255;	// mark
-			
-			OctreeDebugLog(@"%@", @"DEBUG Octrees collide!");
-			return YES;
+			OK = NO;
+			break;
 		}
-		// the other octree must be decomposed
-		// and each of its octants tested against the axial octree
-		// if any of them collides with this octant
-		// then we have a solid collision
-		
-		OctreeDebugLog(@"%@", @"----> testing other octants...");
-		
-		// work out the nearest octant to the axial octree
-		int	nearest_oct = ((otherPosition.x > 0.0)? 0:4)|((otherPosition.y > 0.0)? 0:2)|((otherPosition.z > 0.0)? 0:1);
 		
-		int				nextLevel = otherBuffer[0];
-		const int		*nextBuffer = &otherBuffer[nextLevel];
-		unsigned char	*nextCollisionBuffer = &otherCollisionBuffer[nextLevel];
-		Octree_details	nextDetails;
-		Vector			voff, nextPosition;
-		unsigned		i, oct;
-		
-		nextDetails.radius = 0.5f * otherRadius;
-		for (i = 0; i < 8; i++)
+		for (oct = 0; oct < 8; oct++)
 		{
-			oct = nearest_oct ^ change_oct[i];	// work from nearest to furthest
-			if (nextBuffer[oct])	// don't test empty octants
+			int value = legacy[base + oct];
+			if (value == 0)  continue;
+			
+			node.occupied |= 1 << oct;
+			if (value == -1)
 			{
-				nextDetails.octree = &nextBuffer[oct];
-				nextDetails.octree_collision = &nextCollisionBuffer[oct];
-				
-				voff = resolveVectorInIJK(offsetForOctant(oct, otherRadius), other_ijk);
-				nextPosition = vector_subtract(otherPosition, voff);
-				if (isHitByOctree(axialDetails, nextDetails, nextPosition, other_ijk))	// test octant
-					return YES;
+				node.solid |= 1 << oct;
+			}
+			else if (value > 0 && count < capacity)
+			{
+				queue[count++] = (uint32_t)(base + oct);
+			}
+			else
+			{
+				OK = NO;
+				break;
 			}
 		}
-		
-		// otherwise
-		return NO;
+		nodes[k] = node;
 	}
-	// we are not solid
-	// we must test each of our octants against
-	// the other octree, if any of them collide
-	// we have a solid collision
 	
-	OctreeDebugLog(@"%@", @"----> testing axial octants...");
+	free(queue);
+	if (!OK)
+	{
+		free(nodes);
+		return nil;
+	}
 	
-	// work out the nearest octant to the other octree
-	int	nearest_oct = ((otherPosition.x > 0.0)? 4:0)|((otherPosition.y > 0.0)? 2:0)|((otherPosition.z > 0.0)? 1:0);
+	OOOctreeNode *resized = realloc(nodes, count * sizeof *nodes);
+	if (resized != NULL)  nodes = resized;
 	
-	int				nextLevel = axialBuffer[0];
-	const int		*nextBuffer = &axialBuffer[nextLevel];
-	unsigned char	*nextCollisionBuffer = &axialCollisionBuffer[nextLevel];
-	Vector			nextPosition;
-	Octree_details	nextDetails;
-	unsigned		i, oct;
+	*outRoot = kOctreeRootInner;
+	return [NSData dataWithBytesNoCopy:nodes length:count * sizeof *nodes freeWhenDone:YES];
+}
+
+
+/*	Check that the nodes form a tree in breadth-first order, with every inner
+	node's children immediately following those of the node before it, and no
+	deeper than OOOctreeBuilder allows. The traversal stacks rely on the
+	depth limit.
+*/
+static BOOL ValidateCompactOctree(NSData *data, uint8_t root)
+{
+	NSUInteger count = [data length] / sizeof (OOOctreeNode);
+	if ([data length] % sizeof (OOOctreeNode) != 0)  return NO;
 	
-	nextDetails.radius = 0.5f * axialRadius;
-	for (i = 0; i < 8; i++)
+	if (root == kOctreeRootEmpty || root == kOctreeRootSolid)  return count == 0;
+	if (root != kOctreeRootInner || count == 0 || count >= UINT32_MAX / 8)  return NO;
+	
+	const OOOctreeNode *nodes = [data bytes];
+	uint8_t *depths = malloc(count);
+	if (depths == NULL)  return NO;
+	
+	NSUInteger k, expected = 1;
+	BOOL OK = YES;
+	depths[0] = 0;
+	
+	for (k = 0; k < count && OK; k++)
 	{
-		oct = nearest_oct ^ change_oct[i];	// work from nearest to furthest
-		if (nextBuffer[oct])	// don't test empty octants
+		const OOOctreeNode *node = &nodes[k];
+		unsigned innerCount = PopCount8(node->occupied & ~node->solid);
+		
+		if ((node->solid & ~node->occupied) != 0)  OK = NO;
+		else if (innerCount != 0)
 		{
-			nextDetails.octree = &nextBuffer[oct];
-			nextDetails.octree_collision = &nextCollisionBuffer[oct];
-			
-			nextPosition = vector_add(otherPosition, offsetForOctant(oct, axialRadius));
-			if (isHitByOctree(nextDetails, otherDetails, nextPosition, other_ijk))
+			if (node->firstChild != expected || expected + innerCount > count || depths[k] + 1 >= kMaxOctreeDepth)
 			{
-				return YES;	// test octant
+				OK = NO;
+			}
+			else
+			{
+				memset(depths + expected, depths[k] + 1, innerCount);
+				expected += innerCount;
 			}
 		}
 	}
-	// otherwise we're done!
-	return NO;
+	
+	free(depths);
+	return OK && expected == count;
 }
 
 
-- (BOOL) isHitByOctree:(Octree *)other withOrigin:(Vector)v0 andIJK:(Triangle)ijk
+/*** Batched child kernels ***/
+
+/*	Four-lane float vectors for the child tests below; each test covers the
+	eight children of a node as two groups of four, split on the x bit. Lane
+	n of a group is the child with y bit (n >> 1) and z bit (n & 1).
+*/
+#if OCTREE_SSE
+
+typedef __m128 Lane4;
+
+OOINLINE Lane4 L4Set(float a, float b, float c, float d)  { return _mm_setr_ps(a, b, c, d); }
+OOINLINE Lane4 L4Splat(float a)  { return _mm_set1_ps(a); }
+OOINLINE Lane4 L4Add(Lane4 a, Lane4 b)  { return _mm_add_ps(a, b); }
+OOINLINE Lane4 L4Min(Lane4 a, Lane4 b)  { return _mm_min_ps(a, b); }
+OOINLINE Lane4 L4Max(Lane4 a, Lane4 b)  { return _mm_max_ps(a, b); }
+OOINLINE Lane4 L4Abs(Lane4 a)  { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+OOINLINE void L4Store(float *out, Lane4 a)  { _mm_storeu_ps(out, a); }
+OOINLINE unsigned L4LessEqualBits(Lane4 a, Lane4 b)  { return (unsigned)_mm_movemask_ps(_mm_cmple_ps(a, b)); }
+
+#elif OCTREE_NEON
+
+typedef float32x4_t Lane4;
+
+OOINLINE Lane4 L4Set(float a, float b, float c, float d)  { float v[4] = { a, b, c, d }; return vld1q_f32(v); }
+OOINLINE Lane4 L4Splat(float a)  { return vdupq_n_f32(a); }
+OOINLINE Lane4 L4Add(Lane4 a, Lane4 b)  { return vaddq_f32(a, b); }
+OOINLINE Lane4 L4Min(Lane4 a, Lane4 b)  { return vminq_f32(a, b); }
+OOINLINE Lane4 L4Max(Lane4 a, Lane4 b)  { return vmaxq_f32(a, b); }
+OOINLINE Lane4 L4Abs(Lane4 a)  { return vabsq_f32(a); }
+OOINLINE void L4Store(float *out, Lane4 a)  { vst1q_f32(out, a); }
+OOINLINE unsigned L4LessEqualBits(Lane4 a, Lane4 b)
 {
-	if (other == nil)  return NO;
+	static const uint32_t kLaneBits[4] = { 1, 2, 4, 8 };
+	uint32x4_t bits = vandq_u32(vcleq_f32(a, b), vld1q_u32(kLaneBits));
+	uint32x2_t sum = vadd_u32(vget_low_u32(bits), vget_high_u32(bits));
+	return vget_lane_u32(vpadd_u32(sum, sum), 0);
+}
+
+#else
+
+typedef struct { float v[4]; } Lane4;
+
+OOINLINE Lane4 L4Set(float a, float b, float c, float d)  { Lane4 r = {{ a, b, c, d }}; return r; }
+OOINLINE Lane4 L4Splat(float a)  { return L4Set(a, a, a, a); }
+OOINLINE Lane4 L4Add(Lane4 a, Lane4 b)  { return L4Set(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]); }
+OOINLINE Lane4 L4Min(Lane4 a, Lane4 b)  { return L4Set(fminf(a.v[0], b.v[0]), fminf(a.v[1], b.v[1]), fminf(a.v[2], b.v[2]), fminf(a.v[3], b.v[3])); }
+OOINLINE Lane4 L4Max(Lane4 a, Lane4 b)  { return L4Set(fmaxf(a.v[0], b.v[0]), fmaxf(a.v[1], b.v[1]), fmaxf(a.v[2], b.v[2]), fmaxf(a.v[3], b.v[3])); }
+OOINLINE Lane4 L4Abs(Lane4 a)  { return L4Set(fabsf(a.v[0]), fabsf(a.v[1]), fabsf(a.v[2]), fabsf(a.v[3])); }
+OOINLINE void L4Store(float *out, Lane4 a)  { memcpy(out, a.v, sizeof a.v); }
+OOINLINE unsigned L4LessEqualBits(Lane4 a, Lane4 b)
+{
+	return (a.v[0] <= b.v[0]) | (a.v[1] <= b.v[1]) << 1 | (a.v[2] <= b.v[2]) << 2 | (a.v[3] <= b.v[3]) << 3;
+}
+
+#endif
+
+
+/*	Slab test of the line origin + t * direction, 0 <= t <= tMax, against the
+	eight children of the cube at centre with the given half width. inverse is
+	1 / direction, with huge values standing in for infinity. Writes each
+	child's entry parameter to outEntry and returns a mask of the children
+	the line passes through.
+*/
+static unsigned LineChildMask(Vector origin, Vector inverse, Vector centre, GLfloat halfWidth, GLfloat tMax, GLfloat outEntry[8])
+{
+	GLfloat xLo = (centre.x - halfWidth - origin.x) * inverse.x, xMid = (centre.x - origin.x) * inverse.x, xHi = (centre.x + halfWidth - origin.x) * inverse.x;
+	GLfloat yLo = (centre.y - halfWidth - origin.y) * inverse.y, yMid = (centre.y - origin.y) * inverse.y, yHi = (centre.y + halfWidth - origin.y) * inverse.y;
+	GLfloat zLo = (centre.z - halfWidth - origin.z) * inverse.z, zMid = (centre.z - origin.z) * inverse.z, zHi = (centre.z + halfWidth - origin.z) * inverse.z;
+	
+	// Near and far parameters of the low and high half on each axis.
+	GLfloat yLoNear = fminf(yLo, yMid), yLoFar = fmaxf(yLo, yMid), yHiNear = fminf(yMid, yHi), yHiFar = fmaxf(yMid, yHi);
+	GLfloat zLoNear = fminf(zLo, zMid), zLoFar = fmaxf(zLo, zMid), zHiNear = fminf(zMid, zHi), zHiFar = fmaxf(zMid, zHi);
 	
-	BOOL hit = isHitByOctree([self octreeDetails], [other octreeDetails], v0, ijk);
+	Lane4 yzNear = L4Max(L4Max(L4Set(yLoNear, yLoNear, yHiNear, yHiNear), L4Set(zLoNear, zHiNear, zLoNear, zHiNear)), L4Splat(0.0f));
+	Lane4 yzFar = L4Min(L4Min(L4Set(yLoFar, yLoFar, yHiFar, yHiFar), L4Set(zLoFar, zHiFar, zLoFar, zHiFar)), L4Splat(tMax));
 	
-	_hasCollision = _hasCollision || hit;
-	[other setHasCollision: [other hasCollision] || hit];
+	Lane4 lowNear = L4Max(yzNear, L4Splat(fminf(xLo, xMid)));
+	Lane4 lowFar = L4Min(yzFar, L4Splat(fmaxf(xLo, xMid)));
+	Lane4 highNear = L4Max(yzNear, L4Splat(fminf(xMid, xHi)));
+	Lane4 highFar = L4Min(yzFar, L4Splat(fmaxf(xMid, xHi)));
 	
-	return hit; 
+	L4Store(outEntry, lowNear);
+	L4Store(outEntry + 4, highNear);
+	return L4LessEqualBits(lowNear, lowFar) | L4LessEqualBits(highNear, highFar) << 4;
 }
 
 
-- (BOOL) isHitByOctree:(Octree *)other withOrigin:(Vector)v0 andIJK:(Triangle)ijk andScales:(GLfloat) s1 :(GLfloat)s2
+/*	For each of the eight children, q = q0 + s.x * fx + s.y * fy + s.z * fz,
+	where each component of s is +0.5 for a clear octant bit and -0.5 for a
+	set one (as in offsetForOctant()). Returns a mask of the children for
+	which |q| <= limit on every axis.
+*/
+static unsigned ChildOverlapMask(Vector q0, Vector fx, Vector fy, Vector fz, GLfloat limit)
 {
-	Octree_details details1 = [self octreeDetails];
-	Octree_details details2 = [other octreeDetails];
-	
-	details1.radius *= s1;
-	details2.radius *= s2;
-	
-	BOOL hit = isHitByOctree(details1, details2, v0, ijk);
+	Lane4 lim = L4Splat(limit);
+	unsigned low = 0x0F, high = 0x0F;
+	unsigned axis;
 	
-	_hasCollision = _hasCollision || hit;
-	[other setHasCollision: [other hasCollision] || hit];
+	for (axis = 0; axis < 3; axis++)
+	{
+		GLfloat q = (axis == 0) ? q0.x : (axis == 1) ? q0.y : q0.z;
+		GLfloat x = 0.5f * ((axis == 0) ? fx.x : (axis == 1) ? fx.y : fx.z);
+		GLfloat y = 0.5f * ((axis == 0) ? fy.x : (axis == 1) ? fy.y : fy.z);
+		GLfloat z = 0.5f * ((axis == 0) ? fz.x : (axis == 1) ? fz.y : fz.z);
+		
+		Lane4 yz = L4Set(y + z, y - z, -y + z, -y - z);
+		low &= L4LessEqualBits(L4Abs(L4Add(yz, L4Splat(q + x))), lim);
+		high &= L4LessEqualBits(L4Abs(L4Add(yz, L4Splat(q - x))), lim);
+	}
 	
-	return hit; 
+	return low | high << 4;
 }
 
 
-- (NSDictionary *) dictionaryRepresentation
+/*** Traversal ***/
+
+OOINLINE GLfloat InverseOrHuge(GLfloat d)
 {
-	return @{@"octree": _data,
-		@"radius": @(_radius)};
+	// A huge finite value rather than infinity, so that 0 * inverse is 0 rather than NaN.
+	if (d == 0.0f)  return 1e30f;
+	return 1.0f / d;
 }
 
 
-static GLfloat volumeOfOctree(Octree_details octree_details, unsigned depthLimit)
+typedef struct
 {
-	const int *octBuffer = octree_details.octree;
-	GLfloat octRadius = octree_details.radius;
+	NodeRef				ref;
+	Vector				centre;
+	GLfloat				halfWidth;
+	GLfloat				entry;
+} LineStackEntry;
+
+
+/*	Find the solid leaf where the line v0..v1 first enters, walking the tree
+	front to back. For compatibility with the old recursive test, the result
+	is the distance from v0 to the centre of that leaf, or 0 for a miss.
+*/
+static GLfloat LineHitDistance(const OOOctreeNode *nodes, NodeRef root, GLfloat radius, Vector v0, Vector v1, unsigned char *marks, BOOL *outTouched)
+{
+	Vector direction = vector_subtract(v1, v0);
+	Vector inverse = make_vector(InverseOrHuge(direction.x), InverseOrHuge(direction.y), InverseOrHuge(direction.z));
 	
-	if (octBuffer[0] == 0)
+	// The root is one of the children of a cube twice its size, centred on one of its corners.
+	GLfloat rootEntries[8];
+	Vector rootCorner = make_vector(-radius, -radius, -radius);
+	if (!(LineChildMask(v0, inverse, rootCorner, 2.0f * radius, 1.0f, rootEntries) & (1 << 7)))
 	{
+		OctreeDebugLog(@"%@", @"----> Line misses root octant.");
 		return 0.0f;
 	}
 	
-	if (octBuffer[0] == -1 || depthLimit == 0)
-	{
-		return octRadius * octRadius * octRadius;
-	}
-	depthLimit--;
+	LineStackEntry	stack[kMaxLineStack];
+	unsigned		depth = 0;
+	GLfloat			bestEntry = INFINITY;
+	Vector			bestCentre = kZeroVector;
+	uint32_t		bestSlot = 0;
 	
-	// We are not empty or solid.
-	// We sum the volume of each of our octants.
-	GLfloat			sumVolume = 0.0f;
-	Octree_details	nextDetails;
-	int				nextLevel = octBuffer[0];
-	const int		*nextBuffer = &octBuffer[nextLevel];
-	unsigned		i;
+	stack[depth++] = (LineStackEntry){ root, kZeroVector, radius, rootEntries[7] };
 	
-	nextDetails.radius = 0.5f * octRadius;
-	nextDetails.octree_collision = NULL;	// Placate static analyzer
-	
-	for (i = 0; i < 8; i++)
+	while (depth > 0)
 	{
-		if (nextBuffer[i])	// don't test empty octants
+		LineStackEntry top = stack[--depth];
+		if (top.entry >= bestEntry)  continue;
+		
+		if (top.ref.node == kSolidNode)
+		{
+			bestEntry = top.entry;
+			bestCentre = top.centre;
+			bestSlot = top.ref.slot;
+			continue;
+		}
+		
+		*outTouched = YES;
+		if (marks != NULL)  marks[top.ref.slot] = 1;	// red
+		
+		const OOOctreeNode *node = &nodes[top.ref.node];
+		GLfloat entries[8];
+		unsigned mask = node->occupied & LineChildMask(v0, inverse, top.centre, top.halfWidth, 1.0f, entries);
+		if (mask == 0)  continue;
+		
+		// Sort the children the line enters, furthest first, so the nearest is popped first.
+		unsigned order[8], count = 0, oct, i;
+		for (oct = 0; oct < 8; oct++)
 		{
-			nextDetails.octree = &nextBuffer[i];
-			sumVolume += volumeOfOctree(nextDetails, depthLimit);
+			if (!(mask & (1 << oct)))  continue;
+			for (i = count; i > 0 && entries[order[i - 1]] < entries[oct]; i--)  order[i] = order[i - 1];
+			order[i] = oct;
+			count++;
+		}
+		
+		GLfloat sc = 0.5f * top.halfWidth;
+		for (i = 0; i < count; i++)
+		{
+			oct = order[i];
+			Vector centre = make_vector(top.centre.x + ((oct & 4) ? sc : -sc), top.centre.y + ((oct & 2) ? sc : -sc), top.centre.z + ((oct & 1) ? sc : -sc));
+			NSCAssert(depth < kMaxLineStack, @"Octree line test stack overflow.");
+			stack[depth++] = (LineStackEntry){ ChildRef(nodes, top.ref.node, oct), centre, sc, entries[oct] };
 		}
 	}
-	return sumVolume;
+	
+	if (isinf(bestEntry))  return 0.0f;
+	
+	if (marks != NULL)  marks[bestSlot] = 2;	// green
+	return magnitude(vector_subtract(v0, bestCentre));
 }
 
 
-- (GLfloat) volume
+typedef struct
 {
-	/*	For backwards compatibility, limit octree iteration for volume
-	 calculation to five levels. Raising the limit means lower calculated
-	 volumes for large ships.
-	 
-	 EMMSTRAN: consider raising the limit but fudging mass lock calculations
-	 to compensate. See http://aegidian.org/bb/viewtopic.php?f=3&t=9176 .
-	 Then again, five levels of iteration might be fine.
-	 -- Ahruman 2011-03-10
-	 */
-	return volumeOfOctree([self octreeDetails], 5);
+	NodeRef				axial, other;
+	GLfloat				axialRadius, otherRadius;
+	Vector				position;		// Of other relative to axial, in axial's frame.
+} OctreePair;
+
+
+// Column n of the matrix applied by resolveVectorInIJK().
+OOINLINE Vector IJKColumn(Triangle ijk, unsigned n)
+{
+	return (n == 0) ? make_vector(ijk.v[0].x, ijk.v[1].x, ijk.v[2].x) :
+		   (n == 1) ? make_vector(ijk.v[0].y, ijk.v[1].y, ijk.v[2].y) :
+					  make_vector(ijk.v[0].z, ijk.v[1].z, ijk.v[2].z);
 }
 
 
-static Vector randomFullNodeFrom(Octree_details details, Vector offset)
+/*	The 'crude and simple' bounds test: the smaller octree's radius, as a
+	sphere, against the larger one's cube.
+*/
+static BOOL PairBoundsOverlap(GLfloat axialRadius, GLfloat otherRadius, Vector otherPosition, Triangle other_ijk)
 {
-	const int *octBuffer = details.octree;
-	GLfloat octRadius = details.radius;
+	Vector p = (otherRadius < axialRadius) ? otherPosition : resolveVectorInIJK(vector_flip(otherPosition), other_ijk);
+	GLfloat limit = axialRadius + otherRadius;
+	return fabsf(p.x) <= limit && fabsf(p.y) <= limit && fabsf(p.z) <= limit;
+}
+
+
+/*	Octree-vs-octree test. Whichever of the pair is not solid is split (the
+	axial one first), and each child that passes the bounds test is pushed,
+	nearest to the other octree last so it is tested first. The bounds tests
+	for all eight children of a split node are done together by
+	ChildOverlapMask(); they are the same tests the old recursive version made
+	on entry to each child.
+*/
+static BOOL OctreesIntersect(const OOOctreeNode *axialNodes, NodeRef axialRoot, GLfloat axialRadius, unsigned char *axialMarks,
+							 const OOOctreeNode *otherNodes, NodeRef otherRoot, GLfloat otherRadius, unsigned char *otherMarks,
+							 Vector otherPosition, Triangle other_ijk)
+{
+	if (!PairBoundsOverlap(axialRadius, otherRadius, otherPosition, other_ijk))
+	{
+		OctreeDebugLog(@"%@", @"----> Octree bounds do not intersect");
+		return NO;
+	}
 	
-	if (octBuffer[0] == 0)  return offset;
-	if (octBuffer[0] == -1)  return offset;
+	// Axes of the other octree as seen by resolveVectorInIJK(), and the same again.
+	Vector resolvedAxes[3], twiceResolvedAxes[3];
+	unsigned n;
+	for (n = 0; n < 3; n++)
+	{
+		resolvedAxes[n] = IJKColumn(other_ijk, n);
+		twiceResolvedAxes[n] = resolveVectorInIJK(resolvedAxes[n], other_ijk);
+	}
 	
-	// We are not empty or solid.
-	// Pick a location from a random octant.
-	Octree_details	nextDetails;
-	int				nextLevel = octBuffer[0];
-	const int		*nextBuffer = &octBuffer[nextLevel];
-	unsigned		i, oct;
+	OctreePair		stack[kMaxPairStack];
+	unsigned		depth = 0;
 	
-	nextDetails.radius = 0.5f * octRadius;
-	nextDetails.octree_collision = NULL;
-	oct = Ranrot() & 7;
+	stack[depth++] = (OctreePair){ axialRoot, otherRoot, axialRadius, otherRadius, otherPosition };
 	
-	for (i = 0; i < 8; i++)
+	while (depth > 0)
 	{
-		int octant = oct ^ i;
-		if (nextBuffer[octant])	// don't test empty octants
+		OctreePair pair = stack[--depth];
+		Vector p = pair.position;
+		unsigned i, oct, mask, nearestOct;
+		
+		if (pair.axial.node == kSolidNode)
+		{
+			if (pair.other.node == kSolidNode)
+			{
+				if (axialMarks != NULL)  axialMarks[pair.axial.slot] = (unsigned char)255;	// mark
+				if (otherMarks != NULL)  otherMarks[pair.other.slot] = (unsigned char)255;	// mark
+				
+				OctreeDebugLog(@"%@", @"DEBUG Octrees collide!");
+				return YES;
+			}
+			
+			// Split the other octree: child positions are p - resolve(offsetForOctant(oct, r)).
+			const OOOctreeNode *node = &otherNodes[pair.other.node];
+			GLfloat r = pair.otherRadius, childRadius = 0.5f * r;
+			Vector fx = vector_multiply_scalar(resolvedAxes[0], -r);
+			Vector fy = vector_multiply_scalar(resolvedAxes[1], -r);
+			Vector fz = vector_multiply_scalar(resolvedAxes[2], -r);
+			
+			if (childRadius < pair.axialRadius)
+			{
+				mask = ChildOverlapMask(p, fx, fy, fz, pair.axialRadius + childRadius);
+			}
+			else
+			{
+				Vector q0 = vector_flip(resolveVectorInIJK(p, other_ijk));
+				mask = ChildOverlapMask(q0, vector_multiply_scalar(twiceResolvedAxes[0], r), vector_multiply_scalar(twiceResolvedAxes[1], r), vector_multiply_scalar(twiceResolvedAxes[2], r), pair.axialRadius + childRadius);
+			}
+			mask &= node->occupied;
+			
+			nearestOct = ((p.x > 0.0)? 0:4)|((p.y > 0.0)? 0:2)|((p.z > 0.0)? 0:1);
+			for (i = 8; i-- > 0; )
+			{
+				oct = nearestOct ^ change_oct[i];	// push furthest first
+				if (!(mask & (1 << oct)))  continue;
+				
+				Vector voff = resolveVectorInIJK(offsetForOctant(oct, r), other_ijk);
+				NSCAssert(depth < kMaxPairStack, @"Octree intersection stack overflow.");
+				stack[depth++] = (OctreePair){ pair.axial, ChildRef(otherNodes, pair.other.node, oct), pair.axialRadius, childRadius, vector_subtract(p, voff) };
+			}
+		}
+		else
 		{
-			nextDetails.octree = &nextBuffer[octant];
-			Vector voff = vector_add(offset, offsetForOctant(octant, octRadius));
-			return randomFullNodeFrom(nextDetails, voff);
+			// Split the axial octree: child positions are p + offsetForOctant(oct, r).
+			const OOOctreeNode *node = &axialNodes[pair.axial.node];
+			GLfloat r = pair.axialRadius, childRadius = 0.5f * r;
+			
+			if (pair.otherRadius < childRadius)
+			{
+				mask = ChildOverlapMask(p, make_vector(r, 0, 0), make_vector(0, r, 0), make_vector(0, 0, r), childRadius + pair.otherRadius);
+			}
+			else
+			{
+				Vector q0 = vector_flip(resolveVectorInIJK(p, other_ijk));
+				mask = ChildOverlapMask(q0, vector_multiply_scalar(resolvedAxes[0], -r), vector_multiply_scalar(resolvedAxes[1], -r), vector_multiply_scalar(resolvedAxes[2], -r), pair.otherRadius + childRadius);
+			}
+			mask &= node->occupied;
+			
+			nearestOct = ((p.x > 0.0)? 4:0)|((p.y > 0.0)? 2:0)|((p.z > 0.0)? 1:0);
+			for (i = 8; i-- > 0; )
+			{
+				oct = nearestOct ^ change_oct[i];	// push furthest first
+				if (!(mask & (1 << oct)))  continue;
+				
+				NSCAssert(depth < kMaxPairStack, @"Octree intersection stack overflow.");
+				stack[depth++] = (OctreePair){ ChildRef(axialNodes, pair.axial.node, oct), pair.other, childRadius, pair.otherRadius, vector_add(p, offsetForOctant(oct, r)) };
+			}
 		}
 	}
-	return offset;
+	
+	return NO;
 }
 
 
-- (Vector) randomPoint
+static GLfloat VolumeOfOctree(const OOOctreeNode *nodes, NodeRef ref, GLfloat radius, unsigned depthLimit)
 {
-	return randomFullNodeFrom([self octreeDetails], kZeroVector);
+	if (ref.node == kSolidNode || depthLimit == 0)
+	{
+		return radius * radius * radius;
+	}
+	depthLimit--;
+	
+	// We are not empty or solid.
+	// We sum the volume of each of our octants.
+	GLfloat			sumVolume = 0.0f;
+	unsigned		i;
+	
+	for (i = 0; i < 8; i++)
+	{
+		if (nodes[ref.node].occupied & (1 << i))	// don't test empty octants
+		{
+			sumVolume += VolumeOfOctree(nodes, ChildRef(nodes, ref.node, i), 0.5f * radius, depthLimit);
+		}
+	}
+	return sumVolume;
 }
 
 
-#ifndef NDEBUG
-- (size_t) totalSize
+static Vector RandomFullNodeFrom(const OOOctreeNode *nodes, NodeRef ref, GLfloat radius, Vector offset)
 {
-	return [self oo_objectSize] + _nodeCount * [_data oo_objectSize] + [_data length] + _nodeCount * sizeof *_collisionOctree;
+	// Descend through a random occupied octant at each level until we reach a solid node.
+	while (ref.node != kSolidNode)
+	{
+		unsigned occupied = nodes[ref.node].occupied;
+		unsigned i, oct = Ranrot() & 7;
+		
+		for (i = 0; i < 8; i++)
+		{
+			if (occupied & (1 << (oct ^ i)))  break;
+		}
+		if (i == 8)  break;
+		
+		oct ^= i;
+		offset = vector_add(offset, offsetForOctant(oct, radius));
+		ref = ChildRef(nodes, ref.node, oct);
+		radius *= 0.5f;
+	}
+	return offset;
 }
-#endif
-
-@end
 
 
 enum
@@ -859,18 +1156,23 @@ OOINLINE void InsertNode(OOOctreeBuilder *self, int value)
 	int *resized = realloc(_octree, dataSize);
 	if (resized == NULL)  resized = _octree;
 	
-	/*	Hand over the bytes to the data object, which will be used directly by
-		the Octree.
-	*/
-	NSData *data = [NSData dataWithBytesNoCopy:resized
-										length:dataSize
-								  freeWhenDone:YES];
+	uint8_t root = kOctreeRootEmpty;
+	NSData *data = CompactOctreeFromLegacy(resized, _nodeCount, &root);
+	free(resized);
 	
 	_octree = NULL;
 	_nodeCount = 0;
 	_capacity = 0;
 	
-	return [[[Octree alloc] initWithData:data radius:radius] autorelease];
+#ifndef NDEBUG
+	if (data == nil || !ValidateCompactOctree(data, root))
+	{
+		[NSException raise:NSInternalInconsistencyException format:@"Octree builder produced an invalid octree."];
+	}
+#endif
+	if (data == nil)  return nil;
+	
+	return [[[Octree alloc] initWithData:data root:root radius:radius] autorelease];
 }
 
 
@@ -37,7 +37,7 @@ MA 02110-1301, USA.
 #import "NSFileManagerOOExtensions.h"
 #import "OldSchoolPropertyListWriting.h"
 #import "OOOXZManager.h"
-#import "unzip.h"
+#import "OOZipArchive.h"
 #import "HeadUpDisplay.h"
 #import "OODebugStandards.h"
 #import "OOSystemDescriptionManager.h"
@@ -109,6 +109,7 @@ static NSMutableDictionary *sStringCache;
 
 + (void) reset
 {
+	[OOZipArchive closeAllArchives];
 	sFirstRun = YES;
 	DESTROY(sUseAddOns);
 	DESTROY(sUseAddOnsParts);
@@ -122,6 +123,7 @@ static NSMutableDictionary *sStringCache;
 
 + (void) resetManifestKnowledgeForOXZManager
 {
+	[OOZipArchive closeAllArchives];
 	DESTROY(sUseAddOns);
 	DESTROY(sUseAddOnsParts);
 	DESTROY(sSearchPaths);
@@ -384,49 +386,32 @@ static NSMutableDictionary *sStringCache;
 
 + (void) preloadFileListFromOXZ:(NSString *)path forFolders:(NSArray *)folders
 {
-	unzFile uf = NULL;
-	const char* zipname = [path UTF8String];
-	char componentName[512];
+	OOZipArchive *archive = [OOZipArchive archiveWithPath:path];
+	NSString *zipEntry = nil;
 
-	if (zipname != NULL)
-	{
-		uf = unzOpen64(zipname);
-	}
-	if (uf == NULL)
+	if (archive == nil)
 	{
 		OOLog(@"resourceManager.error",@"Could not open .oxz at %@ as zip file",path);
 		return;
 	}
-	if (unzGoToFirstFile(uf) == UNZ_OK)
+	foreach (zipEntry, [archive entryNames])
 	{
-		do 
+		NSArray *pathBits = [zipEntry pathComponents];
+		if ([pathBits count] >= 2)
 		{
-			unzGetCurrentFileInfo64(uf, NULL,
-									componentName, 512,
-									NULL, 0,
-									NULL, 0);
-			NSString *zipEntry = @(componentName);
-			NSArray *pathBits = [zipEntry pathComponents];
-			if ([pathBits count] >= 2)
+			NSString *folder = [pathBits oo_stringAtIndex:0];
+			if ([folders containsObject:folder])
 			{
-				NSString *folder = [pathBits oo_stringAtIndex:0];
-				if ([folders containsObject:folder])
-				{
-					NSRange bitRange;
-					bitRange.location = 1;
-					bitRange.length = [pathBits count]-1;
-					NSString *file = [NSString pathWithComponents:[pathBits subarrayWithRange:bitRange]];
-					NSString *fullPath = [[path stringByAppendingPathComponent:folder] stringByAppendingPathComponent:file];
-					
-					[self preloadFilePathFor:file inFolder:folder atPath:fullPath];
-				}
+				NSRange bitRange;
+				bitRange.location = 1;
+				bitRange.length = [pathBits count]-1;
+				NSString *file = [NSString pathWithComponents:[pathBits subarrayWithRange:bitRange]];
+				NSString *fullPath = [[path stringByAppendingPathComponent:folder] stringByAppendingPathComponent:file];
+				
+				[self preloadFilePathFor:file inFolder:folder atPath:fullPath];
 			}
-
-		} 
-		while (unzGoToNextFile(uf) == UNZ_OK);
+		}
 	}
-	unzClose(uf);
-
 }
 
 
@@ -1884,6 +1869,7 @@ static NSString *LogClassKeyRoot(NSString *key)
 	
 	OOLog(@"script.load.world.begin", @"%@", @"Loading world scripts...");
 	
+	OOJSScriptLoadStatistics loadStatisticsBefore = OOJSGetScriptLoadStatistics();
 	loadedScripts = [NSMutableDictionary dictionary];
 	paths = [ResourceManager paths];
 	foreach (path, paths)
@@ -1942,6 +1928,17 @@ static NSString *LogClassKeyRoot(NSString *key)
 		}
 	}
 	
+	OOJSScriptLoadStatistics loadStatistics = OOJSGetScriptLoadStatistics();
+	NSUInteger cachedCount = loadStatistics.cachedCount - loadStatisticsBefore.cachedCount;
+	NSUInteger compiledCount = loadStatistics.compiledCount - loadStatisticsBefore.compiledCount;
+	if (cachedCount + compiledCount != 0)
+	{
+		OOLog(@"script.load.world.compileTime", @"Loaded %lu JavaScript files: %lu from the compiled script cache in %.1f ms, %lu compiled from source in %.1f ms.",
+			  (unsigned long)(cachedCount + compiledCount),
+			  (unsigned long)cachedCount, (loadStatistics.cachedTime - loadStatisticsBefore.cachedTime) * 1000.0,
+			  (unsigned long)compiledCount, (loadStatistics.compiledTime - loadStatisticsBefore.compiledTime) * 1000.0);
+	}
+	
 	return loadedScripts;
 }
 
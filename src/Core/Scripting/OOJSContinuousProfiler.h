@@ -0,0 +1,97 @@
+/*
+
+OOJSContinuousProfiler.h
+
+Continuous profiling of JavaScript and native script functions.
+
+The profiler in OOJSEngineTimeManagement.h profiles a single call from the
+debug console, building an OOTimeProfileEntry for each function as it goes;
+it is too heavy to leave running during play. The continuous profiler is
+meant to be left on. Each function is interned the first time it is called,
+giving it a small integer ID, and each distinct call path is interned as a
+stack node, so the per-call cost is two hash probes, two clock reads and one
+fixed-size record written into a ring buffer allocated up front. Call counts
+and inclusive and exclusive times per function are accumulated alongside.
+
+When the ring buffer is full, the oldest call records are overwritten. The
+per-function totals always cover the whole session.
+
+OOJSWriteContinuousProfile() copies the buffer on the calling thread and
+formats it on a background thread, either as collapsed stacks (one line per
+call path with its exclusive time in microseconds, as read by flamegraph.pl)
+or as Chrome trace event JSON (chrome://tracing, Perfetto and speedscope).
+
+Like the rest of the profiler, this is only available when OOJS_PROFILE is
+set, and JavaScript functions are only seen if MOZ_TRACE_JSCALLS is defined.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOJavaScriptEngine.h"
+
+#if OOJS_PROFILE
+
+
+typedef enum
+{
+	kOOJSProfileFormatCollapsedStacks,
+	kOOJSProfileFormatChromeTrace
+} OOJSProfileFormat;
+
+
+enum
+{
+	kOOJSContinuousProfileDefaultCapacity	= 1 << 18	// Call records; 8 MiB.
+};
+
+
+/*	Start a new session, discarding the previous one. capacity is the number
+	of call records to keep, or 0 for the default. Returns NO if a session is
+	already running or the buffers can't be allocated.
+
+	Ending a session discards calls that are still in progress; the session
+	remains available for OOJSContinuousProfileSummary() and
+	OOJSWriteContinuousProfile() until the next one starts.
+*/
+BOOL OOJSBeginContinuousProfiling(NSUInteger capacity);
+void OOJSEndContinuousProfiling(void);
+BOOL OOJSIsContinuousProfiling(void);
+
+//	Session totals and the maxFunctions functions with the most exclusive time. nil if there is no session.
+NSString *OOJSContinuousProfileSummary(NSUInteger maxFunctions);
+
+/*	Write the call records currently in the buffer to path. The session may
+	still be running. Returns NO if there is no session or the snapshot can't
+	be allocated; the outcome of the write itself is logged.
+*/
+BOOL OOJSWriteContinuousProfile(NSString *path, OOJSProfileFormat format);
+
+
+//	Hooks used by OOJSEngineTimeManagement.m.
+extern BOOL gOOJSContinuousProfiling;
+
+void OOJSContinuousProfilerEnterNative(OOJSProfileStackFrame *frame, const char *function);
+void OOJSContinuousProfilerExitNative(OOJSProfileStackFrame *frame);
+#ifdef MOZ_TRACE_JSCALLS
+void OOJSContinuousProfilerFunctionCallback(JSContext *context, JSFunction *function, JSScript *script, int entering);
+#endif
+
+#endif	// OOJS_PROFILE
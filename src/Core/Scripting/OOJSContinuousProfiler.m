@@ -0,0 +1,696 @@
+/*
+
+OOJSContinuousProfiler.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOJSContinuousProfiler.h"
+
+#if OOJS_PROFILE
+
+#include <jsdbgapi.h>
+#import "OOProfilingStopwatch.h"
+
+
+enum
+{
+	kMaxFunctions			= 1 << 14,
+	kFunctionTableSize		= kMaxFunctions * 2,	// Power of two, at most half full.
+	kMaxStackNodes			= 1 << 16,
+	kStackNodeTableSize		= kMaxStackNodes * 2,	// Power of two, at most half full.
+	kMaxStackDepth			= 256,
+	kMaxRecordCapacity		= 1 << 24,
+
+	kNoEntry				= 0,	// Empty hash table slot; function and node IDs start at 1.
+	kOverflowFunction		= 1,	// Stands in for functions once the function table is full.
+	kRootNode				= 0,
+	kOverflowNode			= 1		// Stands in for call paths once the node table is full.
+};
+
+
+typedef struct
+{
+	const void			*key;			// const char * for native functions, JSScript * for JavaScript functions.
+	unsigned			line;			// Base line number of a JavaScript function's script, 0 for native functions.
+	char				*name;
+	BOOL				isJavaScript;
+	unsigned long long	callCount;
+	double				inclusiveTime;	// Recursive calls are counted once per level.
+	double				exclusiveTime;
+} FunctionInfo;
+
+
+typedef struct
+{
+	uint32_t			parent;
+	uint32_t			function;
+} StackNode;
+
+
+typedef struct
+{
+	uint32_t			node;
+	double				startTime;		// Seconds since the session started.
+	double				inclusiveTime;
+	double				exclusiveTime;
+} CallRecord;
+
+
+typedef struct
+{
+	const void			*key;
+	uint32_t			node;
+	double				startTime;
+	double				childTime;
+} ShadowFrame;
+
+
+BOOL							gOOJSContinuousProfiling = NO;
+
+static BOOL						sHaveSession = NO;
+static BOOL						sResolvingName = NO;	// Name resolution may call profiled functions.
+static uint32_t					sSession;
+static OOHighResTimeValue		sStartTime;
+static double					sDuration;
+
+static FunctionInfo				*sFunctions;
+static uint32_t					*sFunctionTable;
+static uint32_t					sFunctionCount;
+
+static StackNode				*sNodes;
+static uint32_t					*sNodeTable;
+static uint32_t					sNodeCount;
+
+static CallRecord				*sRecords;
+static NSUInteger				sRecordCapacity;
+static NSUInteger				sNextRecord;
+static unsigned long long		sRecordsWritten;
+
+// Frames deeper than kMaxStackDepth are counted in sDepth but not recorded.
+static ShadowFrame				sStack[kMaxStackDepth];
+static uint32_t					sDepth;
+static unsigned long long		sTruncatedCalls;
+
+
+@interface OOJSContinuousProfileWriter: NSObject
+{
+@private
+	NSString					*_path;
+	OOJSProfileFormat			_format;
+
+	CallRecord					*_records;		// Oldest first.
+	NSUInteger					_recordCount;
+	StackNode					*_nodes;
+	uint32_t					_nodeCount;
+	char						**_names;
+	BOOL						*_isJavaScript;
+	uint32_t					_functionCount;
+}
+
+- (instancetype) initWithPath:(NSString *)path format:(OOJSProfileFormat)format;
+
+- (void) writeProfile;
+
+@end
+
+
+static void FreeSession(void);
+static uint32_t AddFunction(uint32_t *slot, const void *key, unsigned line, char *name, BOOL isJavaScript);
+static uint32_t StackNodeFor(uint32_t parent, uint32_t function);
+static void PushFrame(const void *key, uint32_t function);
+static void PopFrame(double now);
+static int CompareByExclusiveTimeReverse(const void *a, const void *b);
+#ifdef MOZ_TRACE_JSCALLS
+static char *CopyJSFunctionName(JSContext *context, JSFunction *function);
+#endif
+
+
+OOINLINE uint32_t HashPointer(const void *pointer)
+{
+	uintptr_t value = (uintptr_t)pointer;
+	return (uint32_t)((value >> 3) ^ (value >> 19)) * 2654435761U;
+}
+
+
+OOINLINE uint32_t HashStackNode(uint32_t parent, uint32_t function)
+{
+	return (parent * 31U + function) * 2654435761U;
+}
+
+
+OOINLINE uint32_t *FunctionSlot(const void *key, unsigned line)
+{
+	uint32_t mask = kFunctionTableSize - 1;
+	uint32_t index = (HashPointer(key) ^ line) & mask;
+
+	for (;;)
+	{
+		uint32_t *slot = &sFunctionTable[index];
+		if (*slot == kNoEntry || (sFunctions[*slot].key == key && sFunctions[*slot].line == line))  return slot;
+		index = (index + 1) & mask;
+	}
+}
+
+
+OOINLINE double SessionTime(void)
+{
+	OOHighResTimeValue now = OOGetHighResTime();
+	double result = OOHighResTimeDeltaInSeconds(sStartTime, now);
+	OODisposeHighResTime(now);
+	return result;
+}
+
+
+BOOL OOJSBeginContinuousProfiling(NSUInteger capacity)
+{
+	if (gOOJSContinuousProfiling)  return NO;
+
+	if (capacity == 0)  capacity = kOOJSContinuousProfileDefaultCapacity;
+	if (capacity > kMaxRecordCapacity)  capacity = kMaxRecordCapacity;
+
+	FreeSession();
+	sFunctions = calloc(kMaxFunctions, sizeof *sFunctions);
+	sFunctionTable = calloc(kFunctionTableSize, sizeof *sFunctionTable);
+	sNodes = malloc(kMaxStackNodes * sizeof *sNodes);
+	sNodeTable = calloc(kStackNodeTableSize, sizeof *sNodeTable);
+	sRecords = malloc(capacity * sizeof *sRecords);
+	if (sFunctions == NULL || sFunctionTable == NULL || sNodes == NULL || sNodeTable == NULL || sRecords == NULL)
+	{
+		FreeSession();
+		return NO;
+	}
+
+	sFunctions[kOverflowFunction] = (FunctionInfo){ .name = strdup("(other functions)") };
+	sFunctionCount = kOverflowFunction + 1;
+	sNodes[kRootNode] = (StackNode){ kRootNode, kNoEntry };
+	sNodeCount = kRootNode + 1;
+	StackNodeFor(kRootNode, kOverflowFunction);		// Becomes kOverflowNode.
+
+	sRecordCapacity = capacity;
+	sNextRecord = 0;
+	sRecordsWritten = 0;
+	sDepth = 0;
+	sTruncatedCalls = 0;
+	sDuration = 0.0;
+	if (++sSession == 0)  sSession = 1;
+	sHaveSession = YES;
+
+	// This should be last for precision.
+	OODisposeHighResTime(sStartTime);
+	sStartTime = OOGetHighResTime();
+	gOOJSContinuousProfiling = YES;
+
+	return YES;
+}
+
+
+void OOJSEndContinuousProfiling(void)
+{
+	if (!gOOJSContinuousProfiling)  return;
+
+	sDuration = SessionTime();
+	gOOJSContinuousProfiling = NO;
+	sDepth = 0;
+}
+
+
+BOOL OOJSIsContinuousProfiling(void)
+{
+	return gOOJSContinuousProfiling;
+}
+
+
+NSString *OOJSContinuousProfileSummary(NSUInteger maxFunctions)
+{
+	if (!sHaveSession)  return nil;
+
+	double duration = gOOJSContinuousProfiling ? SessionTime() : sDuration;
+	NSMutableString *result = [NSMutableString stringWithFormat:
+							   @"Continuous profile (%@): %g ms\n"
+							    "%llu calls, %lu in buffer, %u functions, %u call paths",
+							   gOOJSContinuousProfiling ? @"running" : @"stopped", duration * 1000.0,
+							   sRecordsWritten, (unsigned long)MIN(sRecordsWritten, (unsigned long long)sRecordCapacity),
+							   sFunctionCount - kOverflowFunction - 1, sNodeCount - kOverflowNode - 1];
+	if (sTruncatedCalls != 0)
+	{
+		[result appendFormat:@"\n%llu calls deeper than %u frames were not recorded", sTruncatedCalls, (unsigned)kMaxStackDepth];
+	}
+
+	uint32_t count = sFunctionCount - kOverflowFunction;
+	uint32_t *order = malloc(count * sizeof *order);
+	if (order == NULL)  return result;
+
+	uint32_t i;
+	for (i = 0; i < count; i++)  order[i] = kOverflowFunction + i;
+	qsort(order, count, sizeof *order, CompareByExclusiveTimeReverse);
+
+	if (count > maxFunctions)  count = maxFunctions;
+	if (count != 0)
+	{
+		[result appendString:@"\n                                                        NAME  T    COUNT    TOTAL     SELF   SELF%"];
+	}
+	for (i = 0; i < count; i++)
+	{
+		FunctionInfo *function = &sFunctions[order[i]];
+		if (function->callCount == 0)  break;
+
+		[result appendFormat:@"\n%60s  %c%9llu %8.2f %8.2f   %5.1f",
+		 function->name ?: "(unknown)",
+		 function->isJavaScript ? 'J' : 'N',
+		 function->callCount, function->inclusiveTime * 1000.0, function->exclusiveTime * 1000.0,
+		 duration > 0.0 ? function->exclusiveTime * 100.0 / duration : 0.0];
+	}
+
+	free(order);
+	return result;
+}
+
+
+BOOL OOJSWriteContinuousProfile(NSString *path, OOJSProfileFormat format)
+{
+	if (!sHaveSession || path == nil)  return NO;
+
+	OOJSContinuousProfileWriter *writer = [[OOJSContinuousProfileWriter alloc] initWithPath:path format:format];
+	if (writer == nil)  return NO;
+
+	[NSThread detachNewThreadSelector:@selector(writeProfile) toTarget:writer withObject:nil];
+	[writer release];
+	return YES;
+}
+
+
+void OOJSContinuousProfilerEnterNative(OOJSProfileStackFrame *frame, const char *function)
+{
+	if (EXPECT_NOT(sResolvingName))  return;
+
+	uint32_t *slot = FunctionSlot(function, 0);
+	uint32_t functionID = *slot;
+	if (EXPECT_NOT(functionID == kNoEntry))
+	{
+		functionID = AddFunction(slot, function, 0, strdup(function), NO);
+	}
+
+	frame->continuousSession = sSession;
+	frame->continuousDepth = sDepth;
+	PushFrame(function, functionID);
+}
+
+
+void OOJSContinuousProfilerExitNative(OOJSProfileStackFrame *frame)
+{
+	if (!gOOJSContinuousProfiling || frame->continuousSession != sSession)  return;
+
+	// As in OOJSProfileExit(), there may be JavaScript frames left on top.
+	double now = SessionTime();
+	while (sDepth > frame->continuousDepth)  PopFrame(now);
+}
+
+
+#ifdef MOZ_TRACE_JSCALLS
+/*	JavaScript functions are identified by their script rather than by the
+	JSFunction, since each evaluation of a closure creates a new JSFunction
+	sharing the same script, and a collected JSFunction's address can be
+	reused by an unrelated function. The base line number guards against a
+	collected script's address being reused by a script elsewhere.
+*/
+void OOJSContinuousProfilerFunctionCallback(JSContext *context, JSFunction *function, JSScript *script, int entering)
+{
+	if (EXPECT_NOT(sResolvingName))  return;
+
+	const void *key = script;
+	unsigned line = 0;
+	if (EXPECT(script != NULL))  line = JS_GetScriptBaseLineNumber(context, script);
+	else  key = function;
+
+	if (entering > 0)
+	{
+		uint32_t *slot = FunctionSlot(key, line);
+		uint32_t functionID = *slot;
+		if (EXPECT_NOT(functionID == kNoEntry))
+		{
+			functionID = AddFunction(slot, key, line, CopyJSFunctionName(context, function), YES);
+		}
+
+		PushFrame(key, functionID);
+	}
+	else
+	{
+		// Ignore exits from functions entered before the session started.
+		if (sDepth != 0 && (sDepth > kMaxStackDepth || sStack[sDepth - 1].key == key))
+		{
+			PopFrame(SessionTime());
+		}
+	}
+}
+
+
+static char *CopyJSFunctionName(JSContext *context, JSFunction *function)
+{
+	sResolvingName = YES;
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+
+	NSString *name = nil;
+	JSString *jsName = JS_GetFunctionId(function);
+	if (jsName != NULL)  name = OOStringFromJSString(context, jsName);
+	if (name == nil)  name = @"<anonymous>";
+
+	JSStackFrame *frame = NULL;
+	if (JS_FrameIterator(context, &frame) != NULL)
+	{
+		NSString *location = OOJSDescribeLocation(context, frame);
+		if (location != nil)  name = [NSString stringWithFormat:@"(%@) %@", location, name];
+	}
+
+	char *result = strdup([name UTF8String]);
+
+	[pool release];
+	sResolvingName = NO;
+	return result;
+}
+#endif
+
+
+static void FreeSession(void)
+{
+	uint32_t i;
+	if (sFunctions != NULL)
+	{
+		for (i = 0; i < sFunctionCount; i++)  free(sFunctions[i].name);
+	}
+
+	free(sFunctions);
+	free(sFunctionTable);
+	free(sNodes);
+	free(sNodeTable);
+	free(sRecords);
+
+	sFunctions = NULL;
+	sFunctionTable = NULL;
+	sNodes = NULL;
+	sNodeTable = NULL;
+	sRecords = NULL;
+	sFunctionCount = 0;
+	sNodeCount = 0;
+	sHaveSession = NO;
+}
+
+
+static uint32_t AddFunction(uint32_t *slot, const void *key, unsigned line, char *name, BOOL isJavaScript)
+{
+	if (EXPECT_NOT(sFunctionCount == kMaxFunctions))
+	{
+		free(name);
+		return kOverflowFunction;
+	}
+
+	uint32_t functionID = sFunctionCount++;
+	sFunctions[functionID] = (FunctionInfo){ .key = key, .line = line, .name = name, .isJavaScript = isJavaScript };
+	*slot = functionID;
+	return functionID;
+}
+
+
+static uint32_t StackNodeFor(uint32_t parent, uint32_t function)
+{
+	uint32_t mask = kStackNodeTableSize - 1;
+	uint32_t index = HashStackNode(parent, function) & mask;
+
+	for (;;)
+	{
+		uint32_t node = sNodeTable[index];
+		if (node == kNoEntry)  break;
+		if (sNodes[node].parent == parent && sNodes[node].function == function)  return node;
+		index = (index + 1) & mask;
+	}
+
+	if (EXPECT_NOT(sNodeCount == kMaxStackNodes))  return kOverflowNode;
+
+	uint32_t node = sNodeCount++;
+	sNodes[node] = (StackNode){ parent, function };
+	sNodeTable[index] = node;
+	return node;
+}
+
+
+static void PushFrame(const void *key, uint32_t function)
+{
+	if (EXPECT(sDepth < kMaxStackDepth))
+	{
+		uint32_t parent = (sDepth != 0) ? sStack[sDepth - 1].node : kRootNode;
+		ShadowFrame *frame = &sStack[sDepth];
+
+		frame->key = key;
+		frame->node = StackNodeFor(parent, function);
+		frame->childTime = 0.0;
+		frame->startTime = SessionTime();	// Last, for precision.
+	}
+	else
+	{
+		sTruncatedCalls++;
+	}
+
+	sDepth++;
+}
+
+
+static void PopFrame(double now)
+{
+	NSCParameterAssert(sDepth != 0);
+
+	if (EXPECT_NOT(--sDepth >= kMaxStackDepth))  return;
+
+	ShadowFrame *frame = &sStack[sDepth];
+	double inclusiveTime = now - frame->startTime;
+	double exclusiveTime = inclusiveTime - frame->childTime;
+	if (sDepth != 0)  sStack[sDepth - 1].childTime += inclusiveTime;
+
+	FunctionInfo *function = &sFunctions[sNodes[frame->node].function];
+	function->callCount++;
+	function->inclusiveTime += inclusiveTime;
+	function->exclusiveTime += exclusiveTime;
+
+	sRecords[sNextRecord] = (CallRecord){ frame->node, frame->startTime, inclusiveTime, exclusiveTime };
+	if (++sNextRecord == sRecordCapacity)  sNextRecord = 0;
+	sRecordsWritten++;
+}
+
+
+static int CompareByExclusiveTimeReverse(const void *a, const void *b)
+{
+	double timeA = sFunctions[*(const uint32_t *)a].exclusiveTime;
+	double timeB = sFunctions[*(const uint32_t *)b].exclusiveTime;
+
+	if (timeA < timeB)  return 1;
+	if (timeA > timeB)  return -1;
+	return 0;
+}
+
+
+static void WriteCollapsedStackName(FILE *file, const char *name)
+{
+	// Semicolons separate frames and newlines separate stacks.
+	for (; *name != '\0'; name++)
+	{
+		char c = *name;
+		if (c == ';')  c = ':';
+		else if (c == '\n' || c == '\r')  c = ' ';
+		putc(c, file);
+	}
+}
+
+
+static void WriteJSONString(FILE *file, const char *string)
+{
+	putc('"', file);
+	for (; *string != '\0'; string++)
+	{
+		unsigned char c = *string;
+		if (c == '"' || c == '\\')  fprintf(file, "\\%c", c);
+		else if (c < 0x20)  fprintf(file, "\\u%04x", c);
+		else  putc(c, file);
+	}
+	putc('"', file);
+}
+
+
+@implementation OOJSContinuousProfileWriter
+
+- (instancetype) initWithPath:(NSString *)path format:(OOJSProfileFormat)format
+{
+	if ((self = [super init]))
+	{
+		_path = [path copy];
+		_format = format;
+
+		// Snapshot the session; it may carry on while we write, or be replaced.
+		_recordCount = (NSUInteger)MIN(sRecordsWritten, (unsigned long long)sRecordCapacity);
+		_nodeCount = sNodeCount;
+		_functionCount = sFunctionCount;
+
+		_records = malloc(_recordCount * sizeof *_records);
+		_nodes = malloc(_nodeCount * sizeof *_nodes);
+		_names = calloc(_functionCount, sizeof *_names);
+		_isJavaScript = calloc(_functionCount, sizeof *_isJavaScript);
+		if ((_records == NULL && _recordCount != 0) || _nodes == NULL || _names == NULL || _isJavaScript == NULL)
+		{
+			[self release];
+			return nil;
+		}
+
+		if (_recordCount < sRecordCapacity)
+		{
+			memcpy(_records, sRecords, _recordCount * sizeof *_records);
+		}
+		else
+		{
+			NSUInteger olderCount = sRecordCapacity - sNextRecord;
+			memcpy(_records, sRecords + sNextRecord, olderCount * sizeof *_records);
+			memcpy(_records + olderCount, sRecords, sNextRecord * sizeof *_records);
+		}
+		memcpy(_nodes, sNodes, _nodeCount * sizeof *_nodes);
+
+		uint32_t i;
+		for (i = kOverflowFunction; i < _functionCount; i++)
+		{
+			_names[i] = strdup(sFunctions[i].name ?: "(unknown)");
+			_isJavaScript[i] = sFunctions[i].isJavaScript;
+		}
+	}
+
+	return self;
+}
+
+
+- (void) dealloc
+{
+	uint32_t i;
+	if (_names != NULL)
+	{
+		for (i = 0; i < _functionCount; i++)  free(_names[i]);
+	}
+
+	free(_records);
+	free(_nodes);
+	free(_names);
+	free(_isJavaScript);
+	DESTROY(_path);
+
+	[super dealloc];
+}
+
+
+- (const char *) nameOfNode:(uint32_t)node
+{
+	const char *name = _names[_nodes[node].function];
+	return name ?: "(unknown)";
+}
+
+
+- (BOOL) writeCollapsedStacksToFile:(FILE *)file
+{
+	double *selfTimes = calloc(_nodeCount, sizeof *selfTimes);
+	if (selfTimes == NULL)  return NO;
+
+	NSUInteger i;
+	for (i = 0; i < _recordCount; i++)
+	{
+		selfTimes[_records[i].node] += _records[i].exclusiveTime;
+	}
+
+	// Nodes are only created for frames within kMaxStackDepth.
+	uint32_t path[kMaxStackDepth];
+	uint32_t node;
+	for (node = kRootNode + 1; node < _nodeCount; node++)
+	{
+		unsigned long long microseconds = llround(selfTimes[node] * 1e6);
+		if (microseconds == 0)  continue;
+
+		unsigned depth = 0;
+		uint32_t current;
+		for (current = node; current != kRootNode && depth < kMaxStackDepth; current = _nodes[current].parent)
+		{
+			path[depth++] = current;
+		}
+
+		while (depth--)
+		{
+			WriteCollapsedStackName(file, [self nameOfNode:path[depth]]);
+			if (depth != 0)  putc(';', file);
+		}
+		fprintf(file, " %llu\n", microseconds);
+	}
+
+	free(selfTimes);
+	return !ferror(file);
+}
+
+
+- (BOOL) writeChromeTraceToFile:(FILE *)file
+{
+	fputs("{\"traceEvents\":[", file);
+
+	NSUInteger i;
+	for (i = 0; i < _recordCount; i++)
+	{
+		CallRecord *record = &_records[i];
+
+		fputs(i == 0 ? "\n{\"name\":" : ",\n{\"name\":", file);
+		WriteJSONString(file, [self nameOfNode:record->node]);
+		fprintf(file, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1,\"args\":{\"self\":%.3f}}",
+				_isJavaScript[_nodes[record->node].function] ? "js" : "native",
+				record->startTime * 1e6, record->inclusiveTime * 1e6, record->exclusiveTime * 1e6);
+	}
+
+	fputs("\n],\"displayTimeUnit\":\"ms\"}\n", file);
+	return !ferror(file);
+}
+
+
+- (void) writeProfile
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+
+	BOOL OK = NO;
+	FILE *file = fopen([_path fileSystemRepresentation], "w");
+	if (file != NULL)
+	{
+		if (_format == kOOJSProfileFormatChromeTrace)  OK = [self writeChromeTraceToFile:file];
+		else  OK = [self writeCollapsedStacksToFile:file];
+
+		if (fclose(file) != 0)  OK = NO;
+	}
+
+	if (OK)
+	{
+		OOLog(@"script.javaScript.profile.write", @"Wrote %lu profiled calls to %@.", (unsigned long)_recordCount, _path);
+	}
+	else
+	{
+		OOLogERR(@"script.javaScript.profile.write.failed", @"Could not write JavaScript profile to %@.", _path);
+	}
+
+	[pool release];
+}
+
+@end
+
+#endif	// OOJS_PROFILE
@@ -176,6 +176,8 @@ struct OOJSProfileStackFrame
 	OOTimeDelta				subTime;		// Time spent in subroutine calls.
 	OOTimeDelta				*total;			// Pointer to accumulator for this type of frame.
 	void (*cleanup)(OOJSProfileStackFrame *);	// Cleanup function if needed (used for JS frames).
+	uint32_t				continuousSession;	// Continuous profiler session the frame was entered in, or 0.
+	uint32_t				continuousDepth;	// Continuous profiler stack depth on entry.
 };
 
 
@@ -27,6 +27,7 @@ SOFTWARE.
 
 #include <jsdbgapi.h>
 #import "OOJSEngineTimeManagement.h"
+#import "OOJSContinuousProfiler.h"
 #import "OOProfilingStopwatch.h"
 #import "OOJSScript.h"
 #import "OOCollectionExtractors.h"
@@ -462,9 +463,15 @@ static void TraceEnterJSFunction(JSContext *context, JSFunction *function, OOTim
 
 static void FunctionCallback(JSFunction *function, JSScript *script, JSContext *context, int entering)
 {
-	if (EXPECT(!sProfiling))  return;
+	if (EXPECT(!sProfiling && !gOOJSContinuousProfiling))  return;
 	if (EXPECT_NOT(function == NULL))  return;
 	
+	if (gOOJSContinuousProfiling && JS_GetFunctionNative(context, function) == NULL)
+	{
+		OOJSContinuousProfilerFunctionCallback(context, function, script, entering);
+	}
+	if (!sProfiling)  return;
+	
 	// Ignore native functions. Ours get their own entries anyway, SpiderMonkey's are elided.
 	if (!sTracing && JS_GetFunctionNative(context, function) != NULL)  return;
 	
@@ -526,6 +533,10 @@ static void FunctionCallback(JSFunction *function, JSScript *script, JSContext *
 
 void OOJSProfileEnter(OOJSProfileStackFrame *frame, const char *function)
 {
+	frame->continuousSession = 0;
+	frame->continuousDepth = 0;
+	if (EXPECT_NOT(gOOJSContinuousProfiling))  OOJSContinuousProfilerEnterNative(frame, function);
+	
 	if (EXPECT(!sProfiling))  return;
 	if (EXPECT_NOT(sTracing))
 	{
@@ -540,7 +551,9 @@ void OOJSProfileEnter(OOJSProfileStackFrame *frame, const char *function)
 		.key = function,
 		.function = function,
 		.startTime = OOGetHighResTime(),
-		.total = &sProfilerTotalNativeTime
+		.total = &sProfilerTotalNativeTime,
+		.continuousSession = frame->continuousSession,
+		.continuousDepth = frame->continuousDepth
 	};
 	sProfileStack = frame;
 }
@@ -548,6 +561,8 @@ void OOJSProfileEnter(OOJSProfileStackFrame *frame, const char *function)
 
 void OOJSProfileExit(OOJSProfileStackFrame *frame)
 {
+	if (EXPECT_NOT(frame->continuousSession != 0))  OOJSContinuousProfilerExitNative(frame);
+	
 	if (EXPECT(!sProfiling))  return;
 	
 	OOHighResTimeValue	now = OOGetHighResTime();
@@ -321,6 +321,7 @@ static JSBool EntitySetProperty(JSContext *context, JSObject *this, jsid propID,
 			if (JSValueToHPVector(context, *value, &hpvValue))
 			{
 				[entity setPosition:hpvValue];
+				[UNIVERSE noteEntityRepositioned:entity];
 				if ([entity isShip])
 				{
 					[(ShipEntity *)entity resetExhaustPlumes];
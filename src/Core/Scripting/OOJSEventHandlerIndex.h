@@ -0,0 +1,77 @@
+/*
+
+OOJSEventHandlerIndex.h
+
+Per-event lists of the scripts in a fixed set that handle the event, so that
+dispatching an event to the world scripts only calls into scripts that
+define a handler for it.
+
+A list is built the first time its event is dispatched, by asking each
+script whether it has a property of that name, and rebuilt when
+OOJSScriptPropertyGeneration() says a property of that name has since been
+added to or deleted from a script. A script which sets an existing handler
+property to a non-function stays in the list; -callMethod:... then does
+nothing, as before. Non-JavaScript scripts never handle events.
+
+The index counts calls made and calls avoided, for the debug console.
+
+This class is *not* thread-safe.
+
+
+JavaScript support for Oolite
+Copyright (C) 2007-2013 David Taylor and Jens Ayton.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOJSScript.h"
+
+
+@interface OOJSEventHandlerIndex: NSObject
+{
+@private
+	NSArray					*_scripts;
+	NSMapTable				*_lists;			// JSID_BITS(event) -> OOJSEventHandlerList
+
+	unsigned long long		_callsMade;
+	unsigned long long		_callsAvoided;
+	NSUInteger				_listsBuilt;
+}
+
+- (instancetype) initWithScripts:(NSArray *)scripts;
+
+/*	The scripts that may handle eventID, in the order given to
+	-initWithScripts:. Requires a request on context.
+*/
+- (NSArray *) scriptsHandlingEvent:(jsid)eventID inContext:(JSContext *)context;
+
+/*	Call eventID on each script that handles it, with the time limiter set
+	to limit for each call, as -[PlayerEntity doWorldScriptEvent:...] did
+	for every script.
+*/
+- (void) dispatchEvent:(jsid)eventID
+			 inContext:(JSContext *)context
+		 withArguments:(jsval *)argv
+				 count:(uintN)argc
+			 timeLimit:(OOTimeDelta)limit;
+
+// Statistics since the index was created.
+@property (readonly) unsigned long long callsMade;
+@property (readonly) unsigned long long callsAvoided;
+@property (readonly) NSUInteger listsBuilt;
+
+@end
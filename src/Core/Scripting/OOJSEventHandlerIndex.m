@@ -0,0 +1,155 @@
+/*
+
+OOJSEventHandlerIndex.m
+
+
+JavaScript support for Oolite
+Copyright (C) 2007-2013 David Taylor and Jens Ayton.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOJSEventHandlerIndex.h"
+#import "OOJSEngineTimeManagement.h"
+
+
+@interface OOJSEventHandlerList: NSObject
+{
+@public
+	NSArray					*scripts;
+	uint32_t				generation;
+}
+@end
+
+
+@implementation OOJSEventHandlerIndex
+
+- (instancetype) initWithScripts:(NSArray *)scripts
+{
+	if ((self = [super init]))
+	{
+		_scripts = [scripts copy];
+		_lists = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks, NSObjectMapValueCallBacks, 64);
+	}
+	return self;
+}
+
+
+- (void) dealloc
+{
+	DESTROY(_scripts);
+	if (_lists != NULL)  NSFreeMapTable(_lists);
+
+	[super dealloc];
+}
+
+
+- (NSString *) descriptionComponents
+{
+	return [NSString stringWithFormat:@"%lu scripts, %lu events", [_scripts count], NSCountMapTable(_lists)];
+}
+
+
+- (NSArray *) scriptsHandlingEvent:(jsid)eventID inContext:(JSContext *)context
+{
+	NSParameterAssert(context != NULL && JS_IsInRequest(context));
+
+	void					*key = (void *)JSID_BITS(eventID);
+	OOJSEventHandlerList	*list = NSMapGet(_lists, key);
+	uint32_t				generation = OOJSScriptPropertyGeneration(eventID);
+
+	if (list == nil || list->generation != generation)
+	{
+		NSMutableArray		*handlers = [NSMutableArray array];
+		OOScript			*script = nil;
+
+		foreach (script, _scripts)
+		{
+			if ([script isKindOfClass:[OOJSScript class]] && [(OOJSScript *)script hasMethod:eventID inContext:context])
+			{
+				[handlers addObject:script];
+			}
+		}
+
+		if (list == nil)
+		{
+			list = [[OOJSEventHandlerList alloc] init];
+			NSMapInsert(_lists, key, list);
+			[list release];
+		}
+		[list->scripts release];
+		list->scripts = [handlers copy];
+		list->generation = generation;
+		_listsBuilt++;
+	}
+
+	NSUInteger count = [list->scripts count];
+	_callsMade += count;
+	_callsAvoided += [_scripts count] - count;
+
+	// A handler may define or delete handlers, replacing the list.
+	return [[list->scripts retain] autorelease];
+}
+
+
+- (void) dispatchEvent:(jsid)eventID
+			 inContext:(JSContext *)context
+		 withArguments:(jsval *)argv
+				 count:(uintN)argc
+			 timeLimit:(OOTimeDelta)limit
+{
+	OOJSScript				*script = nil;
+
+	foreach (script, [self scriptsHandlingEvent:eventID inContext:context])
+	{
+		OOJSStartTimeLimiterWithTimeLimit(limit);
+		[script callMethod:eventID inContext:context withArguments:argv count:argc result:NULL];
+		OOJSStopTimeLimiter();
+	}
+}
+
+
+- (unsigned long long) callsMade
+{
+	return _callsMade;
+}
+
+
+- (unsigned long long) callsAvoided
+{
+	return _callsAvoided;
+}
+
+
+- (NSUInteger) listsBuilt
+{
+	return _listsBuilt;
+}
+
+@end
+
+
+@implementation OOJSEventHandlerList
+
+- (void) dealloc
+{
+	[scripts release];
+
+	[super dealloc];
+}
+
+@end
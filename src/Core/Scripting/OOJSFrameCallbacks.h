@@ -34,3 +34,28 @@ void InitOOJSFrameCallbacks(JSContext *context, JSObject *global);
 void OOJSFrameCallbacksInvoke(OOTimeDelta delta);
 
 void OOJSFrameCallbacksRemoveAll(void);
+
+
+/*	Scheduling
+	
+	addFrameCallback() takes an optional options object:
+	  priority: callbacks with higher priority run first in each frame
+	            (default 0).
+	  rate:     calls per second of real time; absent or 0 for every frame.
+	            Callbacks with the same rate are spread across frames rather
+	            than all running in the same one. The callback's argument is
+	            the game time elapsed since it last ran.
+	  deferrable: whether the callback may be postponed when the frame
+	            callback budget is exceeded (default true).
+	
+	The budget is the time frame callbacks may take in one frame, in seconds,
+	or 0 for no limit (the default, set by the frame-callback-budget user
+	default in milliseconds). Once it has been used up, the remaining
+	deferrable callbacks are postponed to the next frame. A callback is never
+	postponed twice in a row.
+*/
+OOTimeDelta OOJSFrameCallbacksGetBudget(void);
+void OOJSFrameCallbacksSetBudget(OOTimeDelta budget);
+
+//	Array of dictionaries describing each callback and its timing, in run order.
+NSArray *OOJSFrameCallbacksStatistics(void);
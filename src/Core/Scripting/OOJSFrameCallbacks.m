@@ -27,7 +27,9 @@ SOFTWARE.
 
 #import "OOJSFrameCallbacks.h"
 #import "OOJSEngineTimeManagement.h"
+#import "OOJSScript.h"
 #import "OOCollectionExtractors.h"
+#import "OOProfilingStopwatch.h"
 
 
 /*
@@ -76,11 +78,30 @@ enum
 };
 
 
+typedef struct
+{
+	int32					priority;
+	OOTimeDelta				interval;		// Real time between calls, or 0 for every frame.
+	BOOL					deferrable;
+} CallbackOptions;
+
+
 typedef struct
 {
 	jsval					callback;
 	uint32					trackingID;
-	uint32					_padding;
+	CallbackOptions			options;
+	NSString				*owner;			// Name of the script that added the callback.
+	
+	OOTimeDelta				nextDue;		// sClock time of next call, for callbacks with an interval.
+	OOTimeDelta				pendingDelta;	// Game time since last call.
+	BOOL					deferred;		// Postponed in the last frame it was due.
+	
+	// Statistics.
+	unsigned long long		callCount;
+	unsigned long long		deferralCount;
+	OOTimeDelta				totalTime;
+	OOTimeDelta				maxTime;
 } CallbackEntry;
 
 
@@ -91,6 +112,9 @@ static NSUInteger		sHighWaterMark;	// Number of slots which are GC roots.
 static NSMutableArray	*sDeferredOps;	// Deferred adds/removes while running.
 static uint32			sNextID;
 static BOOL				sRunning;
+static OOTimeDelta		sClock;			// Real time accumulated by OOJSFrameCallbacksInvoke().
+static OOTimeDelta		sBudget;
+static unsigned			sSpreadCounter;
 
 
 // Methods
@@ -100,7 +124,8 @@ static JSBool GlobalIsValidFrameCallback(JSContext *context, uintN argc, jsval *
 
 
 // Internals
-static BOOL AddCallback(JSContext *context, jsval callback, uint32 trackingID, NSString **errorString);
+static BOOL GetCallbackOptions(JSContext *context, jsval value, CallbackOptions *outOptions);
+static BOOL AddCallback(JSContext *context, jsval callback, uint32 trackingID, CallbackOptions options, NSString *owner, NSString **errorString);
 static BOOL GrowCallbackList(JSContext *context, NSString **errorString);
 
 static BOOL GetIndexForTrackingID(uint32 trackingID, NSUInteger *outIndex);
@@ -108,7 +133,7 @@ static BOOL GetIndexForTrackingID(uint32 trackingID, NSUInteger *outIndex);
 static BOOL RemoveCallbackWithTrackingID(JSContext *context, uint32 trackingID);
 static void RemoveCallbackAtIndex(JSContext *context, NSUInteger index);
 
-static void QueueDeferredOperation(NSString *opType, uint32 trackingID, OOJSValue *value);
+static void QueueDeferredOperation(NSString *opType, uint32 trackingID, OOJSValue *value, CallbackOptions options, NSString *owner);
 static void RunDeferredOperations(JSContext *context);
 
 
@@ -126,6 +151,8 @@ void InitOOJSFrameCallbacks(JSContext *context, JSObject *global)
 	// Set randomish initial ID to catch bad habits.
 	sNextID =  [[NSDate date] timeIntervalSinceReferenceDate];
 #endif
+	
+	sBudget = fmax([[NSUserDefaults standardUserDefaults] oo_doubleForKey:@"frame-callback-budget"] / 1000.0, 0.0);
 }
 
 
@@ -133,40 +160,75 @@ void OOJSFrameCallbacksInvoke(OOTimeDelta inDeltaT)
 {
 	NSCAssert1(!sRunning, @"%s cannot be called while frame callbacks are running.", __PRETTY_FUNCTION__);
 	
+	sClock += inDeltaT;
+	
 	if (sCount != 0)
 	{
 		const OOTimeDelta	delta = inDeltaT * [UNIVERSE timeAccelerationFactor];
 		JSContext			*context = OOJSAcquireContext();
 		jsval				deltaVal, result;
+		OOTimeDelta			frameTime = 0.0;
 		NSUInteger			i;
 		
-		if (EXPECT(JS_NewNumberValue(context, delta, &deltaVal)))
+		// Block mutations.
+		sRunning = YES;
+		
+		/*
+			The watchdog timer only fires once per second in deployment builds,
+			but in testrelease builds at least we can keep them on a short leash.
+		*/
+		OOJSStartTimeLimiterWithTimeLimit(0.1);
+		
+		for (i = 0; i < sCount; i++)
 		{
-			// Block mutations.
-			sRunning = YES;
+			CallbackEntry *entry = &sCallbacks[i];
+			entry->pendingDelta += delta;
 			
-			/*
-				The watchdog timer only fires once per second in deployment builds,
-				but in testrelease builds at least we can keep them on a short leash.
-			*/
-			OOJSStartTimeLimiterWithTimeLimit(0.1);
+			if (entry->options.interval > 0.0 && entry->nextDue > sClock)  continue;
 			
-			for (i = 0; i < sCount; i++)
+			if (sBudget > 0.0 && frameTime > sBudget && entry->options.deferrable && !entry->deferred)
 			{
-				// TODO: remove out of scope callbacks - post MNSR!
-				JS_CallFunctionValue(context, NULL, sCallbacks[i].callback, 1, &deltaVal, &result);
-				JS_ReportPendingException(context);
+				entry->deferred = YES;
+				entry->deferralCount++;
+				continue;
 			}
+			entry->deferred = NO;
 			
-			OOJSStopTimeLimiter();
-			sRunning = NO;
+			if (EXPECT_NOT(!JS_NewNumberValue(context, entry->pendingDelta, &deltaVal)))  continue;
+			entry->pendingDelta = 0.0;
 			
-			if (EXPECT_NOT(sDeferredOps != NULL))
+			OOHighResTimeValue startTime = OOGetHighResTime();
+			
+			// TODO: remove out of scope callbacks - post MNSR!
+			JS_CallFunctionValue(context, NULL, entry->callback, 1, &deltaVal, &result);
+			JS_ReportPendingException(context);
+			
+			OOHighResTimeValue endTime = OOGetHighResTime();
+			OOTimeDelta time = OOHighResTimeDeltaInSeconds(startTime, endTime);
+			OODisposeHighResTime(startTime);
+			OODisposeHighResTime(endTime);
+			
+			frameTime += time;
+			entry->callCount++;
+			entry->totalTime += time;
+			entry->maxTime = fmax(entry->maxTime, time);
+			
+			if (entry->options.interval > 0.0)
 			{
-				RunDeferredOperations(context);
-				DESTROY(sDeferredOps);
+				// Keep to the callback's phase, skipping calls missed while paused or postponed.
+				OOTimeDelta interval = entry->options.interval;
+				entry->nextDue += interval * (floor((sClock - entry->nextDue) / interval) + 1.0);
 			}
 		}
+		
+		OOJSStopTimeLimiter();
+		sRunning = NO;
+		
+		if (EXPECT_NOT(sDeferredOps != NULL))
+		{
+			RunDeferredOperations(context);
+			DESTROY(sDeferredOps);
+		}
 		OOJSRelinquishContext(context);
 	}
 }
@@ -185,9 +247,47 @@ void OOJSFrameCallbacksRemoveAll(void)
 }
 
 
+OOTimeDelta OOJSFrameCallbacksGetBudget(void)
+{
+	return sBudget;
+}
+
+
+void OOJSFrameCallbacksSetBudget(OOTimeDelta budget)
+{
+	sBudget = fmax(budget, 0.0);
+}
+
+
+NSArray *OOJSFrameCallbacksStatistics(void)
+{
+	NSMutableArray *result = [NSMutableArray arrayWithCapacity:sCount];
+	NSUInteger i;
+	
+	for (i = 0; i < sCount; i++)
+	{
+		CallbackEntry *entry = &sCallbacks[i];
+		OOTimeDelta interval = entry->options.interval;
+		
+		[result addObject:@{@"trackingID": @(entry->trackingID),
+							@"owner": entry->owner ?: @"",
+							@"priority": @(entry->options.priority),
+							@"rate": @(interval > 0.0 ? 1.0 / interval : 0.0),
+							@"deferrable": @(entry->options.deferrable),
+							@"callCount": @(entry->callCount),
+							@"deferralCount": @(entry->deferralCount),
+							@"totalTime": @(entry->totalTime),
+							@"averageTime": @(entry->callCount != 0 ? entry->totalTime / entry->callCount : 0.0),
+							@"maxTime": @(entry->maxTime)}];
+	}
+	
+	return result;
+}
+
+
 // MARK: Methods
 
-// addFrameCallback(callback : Function) : Number
+// addFrameCallback(callback : Function [, options : Object]) : Number
 static JSBool GlobalAddFrameCallback(JSContext *context, uintN argc, jsval *vp)
 {
 	OOJS_NATIVE_ENTER(context)
@@ -200,6 +300,14 @@ static JSBool GlobalAddFrameCallback(JSContext *context, uintN argc, jsval *vp)
 		return NO;
 	}
 	
+	CallbackOptions options;
+	if (EXPECT_NOT(!GetCallbackOptions(context, argc > 1 ? OOJS_ARGV[1] : JSVAL_VOID, &options)))
+	{
+		OOJSReportBadArguments(context, nil, @"addFrameCallback", 1, OOJS_ARGV + 1, nil, @"options object");
+		return NO;
+	}
+	NSString *owner = [[OOJSScript currentlyRunningScript] name];
+	
 	// Assign a tracking ID.
 	uint32 trackingID = sNextID ^ kIDScrambleMask;
 	sNextID += kIDIncrement;
@@ -208,7 +316,7 @@ static JSBool GlobalAddFrameCallback(JSContext *context, uintN argc, jsval *vp)
 	{
 		// Add to list immediately.
 		NSString *errorString = nil;
-		if (EXPECT_NOT(!AddCallback(context, callback, trackingID, &errorString)))
+		if (EXPECT_NOT(!AddCallback(context, callback, trackingID, options, owner, &errorString)))
 		{
 			OOJSReportError(context, @"%@", errorString);
 			return NO;
@@ -218,7 +326,7 @@ static JSBool GlobalAddFrameCallback(JSContext *context, uintN argc, jsval *vp)
 	{
 		// Defer mutations during callback invocation.
 		FCBLog(@"script.frameCallback.debug.add.deferred", @"Deferring addition of frame callback with tracking ID %u.", trackingID);
-		QueueDeferredOperation(@"add", trackingID, [OOJSValue valueWithJSValue:callback inContext:context]);
+		QueueDeferredOperation(@"add", trackingID, [OOJSValue valueWithJSValue:callback inContext:context], options, owner);
 	}
 	
 	OOJS_RETURN_INT(trackingID);
@@ -252,7 +360,7 @@ static JSBool GlobalRemoveFrameCallback(JSContext *context, uintN argc, jsval *v
 	{
 		// Defer mutations during callback invocation.
 		FCBLog(@"script.frameCallback.debug.remove.deferred", @"Deferring removal of frame callback with tracking ID %u.", trackingID);
-		QueueDeferredOperation(@"remove", trackingID, nil);
+		QueueDeferredOperation(@"remove", trackingID, nil, (CallbackOptions){ 0 }, nil);
 	}
 	
 	OOJS_RETURN_VOID;
@@ -288,7 +396,42 @@ static JSBool GlobalIsValidFrameCallback(JSContext *context, uintN argc, jsval *
 
 // MARK: Internals
 
-static BOOL AddCallback(JSContext *context, jsval callback, uint32 trackingID, NSString **errorString)
+static BOOL GetCallbackOptions(JSContext *context, jsval value, CallbackOptions *outOptions)
+{
+	NSCParameterAssert(outOptions != NULL);
+	
+	*outOptions = (CallbackOptions){ .priority = 0, .interval = 0.0, .deferrable = YES };
+	if (JSVAL_IS_VOID(value) || JSVAL_IS_NULL(value))  return YES;
+	if (!JSVAL_IS_OBJECT(value))  return NO;
+	
+	JSObject	*object = JSVAL_TO_OBJECT(value);
+	jsval		property;
+	jsdouble	number;
+	JSBool		flag;
+	
+	if (JS_GetProperty(context, object, "priority", &property) && !JSVAL_IS_VOID(property))
+	{
+		if (!JS_ValueToNumber(context, property, &number) || isnan(number))  return NO;
+		outOptions->priority = (int32)fmax(fmin(number, INT32_MAX), INT32_MIN);
+	}
+	
+	if (JS_GetProperty(context, object, "rate", &property) && !JSVAL_IS_VOID(property))
+	{
+		if (!JS_ValueToNumber(context, property, &number) || isnan(number) || number < 0.0)  return NO;
+		if (number > 0.0)  outOptions->interval = 1.0 / number;
+	}
+	
+	if (JS_GetProperty(context, object, "deferrable", &property) && !JSVAL_IS_VOID(property))
+	{
+		if (!JS_ValueToBoolean(context, property, &flag))  return NO;
+		outOptions->deferrable = flag;
+	}
+	
+	return YES;
+}
+
+
+static BOOL AddCallback(JSContext *context, jsval callback, uint32 trackingID, CallbackOptions options, NSString *owner, NSString **errorString)
 {
 	NSCParameterAssert(context != NULL && JS_IsInRequest(context));
 	NSCParameterAssert(errorString != NULL);
@@ -301,11 +444,10 @@ static BOOL AddCallback(JSContext *context, jsval callback, uint32 trackingID, N
 	
 	FCBLog(@"script.frameCallback.debug.add", @"Adding frame callback with tracking ID %u.", trackingID);
 	
-	sCallbacks[sCount].callback = callback;
 	if (sCount >= sHighWaterMark)
 	{
 		// If we haven't used this slot before, root it.
-		
+		sCallbacks[sCount].callback = JSVAL_NULL;
 		if (EXPECT_NOT(!OOJSAddGCValueRoot(context, &sCallbacks[sCount].callback, "frame callback")))
 		{
 			*errorString = @"Failed to add GC root for frame callback.";
@@ -315,7 +457,30 @@ static BOOL AddCallback(JSContext *context, jsval callback, uint32 trackingID, N
 		sHighWaterMark = sCount + 1;
 	}
 	
-	sCallbacks[sCount].trackingID = trackingID;
+	// Keep the list sorted by priority, in order of addition within a priority.
+	NSUInteger index = sCount;
+	while (index != 0 && sCallbacks[index - 1].options.priority < options.priority)  index--;
+	memmove(&sCallbacks[index + 1], &sCallbacks[index], (sCount - index) * sizeof *sCallbacks);
+	
+	CallbackEntry *entry = &sCallbacks[index];
+	*entry = (CallbackEntry)
+	{
+		.callback = callback,
+		.trackingID = trackingID,
+		.options = options,
+		.owner = [owner copy]
+	};
+	
+	if (options.interval > 0.0)
+	{
+		/*	Spread the first calls of rate-limited callbacks over their
+			interval, stepping by the golden ratio so that any number of them
+			stay roughly evenly spaced.
+		*/
+		double phase = fmod(sSpreadCounter++ * 0.6180339887498949, 1.0);
+		entry->nextDue = sClock + options.interval * phase;
+	}
+	
 	sCount++;
 	
 	return YES;
@@ -420,10 +585,12 @@ static void RemoveCallbackAtIndex(JSContext *context, NSUInteger index)
 	
 	FCBLog(@"script.frameCallback.debug.remove", @"Removing frame callback with tracking ID %u.", sCallbacks[index].trackingID);
 	
-	// Overwrite entry to be removed with last entry, and decrement count.
+	// Close the gap, keeping priority order, and decrement count.
+	[sCallbacks[index].owner release];
 	sCount--;
-	sCallbacks[index] = sCallbacks[sCount];
+	memmove(&sCallbacks[index], &sCallbacks[index + 1], (sCount - index) * sizeof *sCallbacks);
 	sCallbacks[sCount].callback = JSVAL_NULL;
+	sCallbacks[sCount].owner = nil;
 	
 #if DEBUG_FCB_SIMPLE_TRACKING_IDS
 	if (sCount == 0)
@@ -435,14 +602,16 @@ static void RemoveCallbackAtIndex(JSContext *context, NSUInteger index)
 }
 
 
-static void QueueDeferredOperation(NSString *opType, uint32 trackingID, OOJSValue *value)
+static void QueueDeferredOperation(NSString *opType, uint32 trackingID, OOJSValue *value, CallbackOptions options, NSString *owner)
 {
 	NSCAssert1(sRunning, @"%s can only be called while frame callbacks are running.", __PRETTY_FUNCTION__);
 	
 	if (sDeferredOps == nil)  sDeferredOps = [[NSMutableArray alloc] init];
 	[sDeferredOps addObject:@{@"operation": opType,
 							 @"trackingID": @(trackingID),
-							 @"value": value}];
+							 @"value": value ?: (id)[NSNull null],
+							 @"options": [NSValue valueWithBytes:&options objCType:@encode(CallbackOptions)],
+							 @"owner": owner ?: @""}];
 }
 
 
@@ -460,10 +629,12 @@ static void RunDeferredOperations(JSContext *context)
 		
 		if ([opType isEqualToString:@"add"])
 		{
-			OOJSValue	*callbackObj = [operation objectForKey:@"value"];
-			NSString	*errorString = nil;
+			OOJSValue		*callbackObj = [operation objectForKey:@"value"];
+			NSString		*errorString = nil;
+			CallbackOptions	options;
 			
-			if (!AddCallback(context, OOJSValueFromNativeObject(context, callbackObj), trackingID, &errorString))
+			[[operation objectForKey:@"options"] getValue:&options];
+			if (!AddCallback(context, OOJSValueFromNativeObject(context, callbackObj), trackingID, options, [operation objectForKey:@"owner"], &errorString))
 			{
 				OOLogWARN(@"script.frameCallback.deferredAdd.failed", @"Deferred frame callback insertion failed: %@", errorString);
 			}
@@ -0,0 +1,73 @@
+/*
+
+OOJSPrivatePool.h
+
+Fixed-size allocator for the private data of small, short-lived JavaScript
+objects such as Vector3D and Quaternion.
+
+Scripts create these objects at a high rate (ship.position.add(...) makes
+several per call), and allocating each private with malloc() and releasing
+it with free() in the finalizer is a noticeable part of their cost. A pool
+carves elements out of slabs and keeps released elements on a free list,
+so steady-state allocation is a pointer pop and finalization a pointer push.
+
+Slabs are never returned to the system; a pool's footprint is bounded by the
+peak number of live elements. Pools are only used from the JavaScript
+engine's context, which runs (and finalizes) on the main thread, so a single
+free list per pool serves as the per-context list and no locking is done.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOCocoa.h"
+
+
+typedef struct OOJSPrivatePoolElement OOJSPrivatePoolElement;
+typedef struct OOJSPrivatePoolSlab OOJSPrivatePoolSlab;
+
+
+typedef struct OOJSPrivatePool
+{
+	const char					*name;
+	size_t						elementSize;
+	OOJSPrivatePoolElement		*freeList;
+	OOJSPrivatePoolSlab			*slabs;
+
+	// Statistics.
+	NSUInteger					slabCount;
+	NSUInteger					liveCount;
+	NSUInteger					peakLiveCount;
+	unsigned long long			allocations;
+} OOJSPrivatePool;
+
+
+//	Static initializer: static OOJSPrivatePool sPool = OOJS_PRIVATE_POOL_INIT("Vector3D", sizeof (HPVector));
+#define OOJS_PRIVATE_POOL_INIT(NAME, SIZE)  { (NAME), (SIZE), NULL, NULL, 0, 0, 0, 0 }
+
+
+//	Returns NULL on allocation failure. The contents are undefined.
+void *OOJSPrivatePoolAllocate(OOJSPrivatePool *pool)  NONNULL_FUNC;
+
+//	element must have come from the same pool. NULL is ignored.
+void OOJSPrivatePoolRelease(OOJSPrivatePool *pool, void *element)  GCC_ATTR((nonnull (1)));
+
+//	One-line summary of a pool's statistics, for the debug console.
+NSString *OOJSPrivatePoolDescription(const OOJSPrivatePool *pool)  NONNULL_FUNC;
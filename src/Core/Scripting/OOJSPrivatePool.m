@@ -0,0 +1,118 @@
+/*
+
+OOJSPrivatePool.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOJSPrivatePool.h"
+
+
+enum
+{
+	kElementsPerSlab		= 256,
+	kElementAlignment		= 8
+};
+
+
+struct OOJSPrivatePoolElement
+{
+	OOJSPrivatePoolElement	*next;
+};
+
+
+struct OOJSPrivatePoolSlab
+{
+	OOJSPrivatePoolSlab		*next;
+	double					elements[];		// double for alignment.
+};
+
+
+OOINLINE size_t StrideForPool(const OOJSPrivatePool *pool)
+{
+	size_t size = pool->elementSize;
+	if (size < sizeof (OOJSPrivatePoolElement))  size = sizeof (OOJSPrivatePoolElement);
+	return (size + kElementAlignment - 1) & ~(size_t)(kElementAlignment - 1);
+}
+
+
+static BOOL AddSlab(OOJSPrivatePool *pool)
+{
+	size_t					stride = StrideForPool(pool);
+	OOJSPrivatePoolSlab		*slab = malloc(sizeof *slab + stride * kElementsPerSlab);
+	if (EXPECT_NOT(slab == NULL))  return NO;
+
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+	pool->slabCount++;
+
+	// Thread the new elements onto the free list, lowest address first.
+	char *base = (char *)slab->elements;
+	unsigned i = kElementsPerSlab;
+	while (i--)
+	{
+		OOJSPrivatePoolElement *element = (OOJSPrivatePoolElement *)(base + i * stride);
+		element->next = pool->freeList;
+		pool->freeList = element;
+	}
+
+	return YES;
+}
+
+
+void *OOJSPrivatePoolAllocate(OOJSPrivatePool *pool)
+{
+	NSCParameterAssert(pool->elementSize != 0);
+
+	if (pool->freeList == NULL)
+	{
+		if (EXPECT_NOT(!AddSlab(pool)))  return NULL;
+	}
+
+	OOJSPrivatePoolElement *element = pool->freeList;
+	pool->freeList = element->next;
+
+	pool->allocations++;
+	pool->liveCount++;
+	if (pool->peakLiveCount < pool->liveCount)  pool->peakLiveCount = pool->liveCount;
+
+	return element;
+}
+
+
+void OOJSPrivatePoolRelease(OOJSPrivatePool *pool, void *element)
+{
+	if (element == NULL)  return;
+	NSCParameterAssert(pool->liveCount != 0);
+
+	OOJSPrivatePoolElement *freed = element;
+	freed->next = pool->freeList;
+	pool->freeList = freed;
+	pool->liveCount--;
+}
+
+
+NSString *OOJSPrivatePoolDescription(const OOJSPrivatePool *pool)
+{
+	return [NSString stringWithFormat:@"%s: %lu live (peak %lu) in %lu slabs of %u, %llu allocations, %llu malloc calls avoided",
+			pool->name, (unsigned long)pool->liveCount, (unsigned long)pool->peakLiveCount,
+			(unsigned long)pool->slabCount, (unsigned)kElementsPerSlab, pool->allocations, pool->allocations - pool->slabCount];
+}
@@ -31,6 +31,9 @@ MA 02110-1301, USA.
 
 void InitOOJSQuaternion(JSContext *context, JSObject *global);
 
+//	Statistics for the pool Quaternion privates are allocated from, for the debug console.
+NSString *JSQuaternionPrivatePoolDescription(void);
+
 
 JSObject *JSQuaternionWithQuaternion(JSContext *context, Quaternion quaternion)  NONNULL_FUNC;
 
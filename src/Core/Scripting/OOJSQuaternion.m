@@ -24,6 +24,7 @@ MA 02110-1301, USA.
 
 #import "OOJSQuaternion.h"
 #import "OOJavaScriptEngine.h"
+#import "OOJSPrivatePool.h"
 
 #if OOLITE_GNUSTEP
 #import <GNUstepBase/GSObjCRuntime.h>
@@ -37,6 +38,7 @@ MA 02110-1301, USA.
 
 
 static JSObject *sQuaternionPrototype;
+static OOJSPrivatePool		sQuaternionPool = OOJS_PRIVATE_POOL_INIT("Quaternion", sizeof (Quaternion));
 
 
 static BOOL GetThisQuaternion(JSContext *context, JSObject *quaternionObj, Quaternion *outQuaternion, NSString *method)  NONNULL_FUNC;
@@ -142,6 +144,12 @@ void InitOOJSQuaternion(JSContext *context, JSObject *global)
 }
 
 
+NSString *JSQuaternionPrivatePoolDescription(void)
+{
+	return OOJSPrivatePoolDescription(&sQuaternionPool);
+}
+
+
 JSObject *JSQuaternionWithQuaternion(JSContext *context, Quaternion quaternion)
 {
 	OOJS_PROFILE_ENTER
@@ -149,7 +157,7 @@ JSObject *JSQuaternionWithQuaternion(JSContext *context, Quaternion quaternion)
 	JSObject				*result = NULL;
 	Quaternion				*private = NULL;
 	
-	private = malloc(sizeof *private);
+	private = OOJSPrivatePoolAllocate(&sQuaternionPool);
 	if (EXPECT_NOT(private == NULL))  return NULL;
 	
 	*private = quaternion;
@@ -160,7 +168,7 @@ JSObject *JSQuaternionWithQuaternion(JSContext *context, Quaternion quaternion)
 		if (!JS_SetPrivate(context, result, private))  result = NULL;
 	}
 	
-	if (EXPECT_NOT(result == NULL)) free(private);
+	if (EXPECT_NOT(result == NULL)) OOJSPrivatePoolRelease(&sQuaternionPool, private);
 	
 	return result;
 	
@@ -531,7 +539,7 @@ static void QuaternionFinalize(JSContext *context, JSObject *this)
 	private = JS_GetInstancePrivate(context, this, &sQuaternionClass, NULL);
 	if (private != NULL)
 	{
-		free(private);
+		OOJSPrivatePoolRelease(&sQuaternionPool, private);
 	}
 }
 
@@ -544,17 +552,21 @@ static JSBool QuaternionConstruct(JSContext *context, uintN argc, jsval *vp)
 	Quaternion				*private = NULL;
 	JSObject				*this = NULL;
 	
-	private = malloc(sizeof *private);
+	private = OOJSPrivatePoolAllocate(&sQuaternionPool);
 	if (EXPECT_NOT(private == NULL))  return NO;
 	
 	this = JS_NewObject(context, &sQuaternionClass, NULL, NULL);
-	if (EXPECT_NOT(this == NULL))  return NO;
+	if (EXPECT_NOT(this == NULL))
+	{
+		OOJSPrivatePoolRelease(&sQuaternionPool, private);
+		return NO;
+	}
 	
 	if (argc != 0)
 	{
 		if (EXPECT_NOT(!QuaternionFromArgumentListNoErrorInternal(context, argc, OOJS_ARGV, &quaternion, NULL, YES)))
 		{
-			free(private);
+			OOJSPrivatePoolRelease(&sQuaternionPool, private);
 			OOJSReportBadArguments(context, NULL, NULL, argc, OOJS_ARGV,
 								   @"Could not construct quaternion from parameters",
 								   @"Quaternion, Entity or array of four numbers");
@@ -566,7 +578,7 @@ static JSBool QuaternionConstruct(JSContext *context, uintN argc, jsval *vp)
 	
 	if (!JS_SetPrivate(context, this, private))
 	{
-		free(private);
+		OOJSPrivatePoolRelease(&sQuaternionPool, private);
 		return NO;
 	}
 	
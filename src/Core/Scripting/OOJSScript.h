@@ -70,6 +70,12 @@ static NSString * const kLocalManifestProperty = @"oolite_manifest_identifier";
 	  withArguments:(jsval *)argv count:(intN)argc
 			 result:(jsval *)outResult;
 
+/*	YES if the script or its prototype chain has a property with this ID, so
+	that -callMethod:... may find a handler. Doesn't call getters.
+	Requires a request on context.
+*/
+- (BOOL) hasMethod:(jsid)methodID inContext:(JSContext *)context;
+
 - (id) propertyWithID:(jsid)propID inContext:(JSContext *)context;
 // Set a property which can be modified or deleted by the script.
 - (BOOL) setProperty:(id)value withID:(jsid)propID inContext:(JSContext *)context;
@@ -96,3 +102,27 @@ static NSString * const kLocalManifestProperty = @"oolite_manifest_identifier";
 
 void InitOOJSScript(JSContext *context, JSObject *global);
 
+
+/*	A counter which changes whenever a property with the given ID is added
+	to or deleted from any script object. Properties with other IDs may
+	share a counter, so a change means only that the handlers for the ID may
+	have changed.
+*/
+uint32_t OOJSScriptPropertyGeneration(jsid propID);
+
+
+
+/*	Running totals for script files loaded by OOJSScript, split by whether
+	the compiled script came from the compiled script cache or was compiled
+	from source. Times include reading the file and, for compiled scripts,
+	writing the cache entry.
+*/
+typedef struct
+{
+	NSUInteger				cachedCount;
+	NSUInteger				compiledCount;
+	OOTimeDelta				cachedTime;
+	OOTimeDelta				compiledTime;
+} OOJSScriptLoadStatistics;
+
+OOJSScriptLoadStatistics OOJSGetScriptLoadStatistics(void);
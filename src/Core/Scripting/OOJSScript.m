@@ -41,10 +41,37 @@ MA 02110-1301, USA.
 #import "OOCollectionExtractors.h"
 #import "OOPListParsing.h"
 #import "OODebugStandards.h"
+#import "OOProfilingStopwatch.h"
 
 #if OO_CACHE_JS_SCRIPTS
 #include <jsxdrapi.h>
 #import "OOCacheManager.h"
+
+
+/*	Compiled scripts are stored one per file in the "compiled scripts" blob
+	store, named by a hash of the script's path and source. The path is
+	included because the compiled form records it for error reporting. Each
+	file starts with a header identifying the SpiderMonkey build that wrote
+	it, since XDR data can only be read by the same bytecode version.
+	Editing a script orphans its old file, so the store is pruned of scripts
+	not loaded this session whenever the data cache is cleared.
+*/
+static NSString * const kOOCacheCompiledScripts = @"compiled scripts";
+
+enum
+{
+	kCompiledScriptFormatVersion	= 1
+};
+
+typedef struct
+{
+	char					magic[4];			// "OJSC"
+	uint32_t				formatVersion;
+	uint32_t				bytecodeVersion;	// JSXDR_BYTECODE_VERSION
+	uint32_t				dataLength;
+	uint64_t				buildIdentity;
+	uint64_t				sourceHash;
+} OOCompiledScriptHeader;
 #endif
 
 
@@ -65,14 +92,33 @@ static void AddStackToArrayReversed(NSMutableArray *array, RunningStack *stack);
 static JSScript *LoadScriptWithName(JSContext *context, NSString *path, JSObject *object, JSObject **outScriptObject, NSString **outErrorMessage);
 
 #if OO_CACHE_JS_SCRIPTS
-static NSData *CompiledScriptData(JSContext *context, JSScript *script);
-static JSScript *ScriptWithCompiledData(JSContext *context, NSData *data);
+static uint64_t CompiledScriptSourceHash(NSString *path, NSData *source);
+static NSData *CompiledScriptData(JSContext *context, JSScript *script, uint64_t sourceHash);
+static JSScript *ScriptWithCompiledData(JSContext *context, NSData *data, uint64_t sourceHash);
 #endif
 
+static OOJSScriptLoadStatistics sLoadStatistics;
+
 static NSString *StrippedName(NSString *string);
 
 
 static JSBool ScriptAddProperty(JSContext *context, JSObject *this, jsid propID, jsval *value);
+static JSBool ScriptDeleteProperty(JSContext *context, JSObject *this, jsid propID, jsval *value);
+
+
+enum
+{
+	kPropertyGenerationCount		= 256		// Power of two.
+};
+
+static uint32_t			sPropertyGenerations[kPropertyGenerationCount];
+
+
+OOINLINE uint32_t *PropertyGenerationForID(jsid propID)
+{
+	uintptr_t bits = (uintptr_t)JSID_BITS(propID);
+	return &sPropertyGenerations[((bits >> 3) ^ (bits >> 11)) & (kPropertyGenerationCount - 1)];
+}
 
 
 static JSClass sScriptClass =
@@ -81,7 +127,7 @@ static JSClass sScriptClass =
 	JSCLASS_HAS_PRIVATE,
 	
 	ScriptAddProperty,
-	JS_PropertyStub,
+	ScriptDeleteProperty,
 	JS_PropertyStub,
 	JS_StrictPropertyStub,
 	JS_EnumerateStub,
@@ -453,6 +499,21 @@ static JSFunctionSpec sScriptMethods[] =
 }
 
 
+- (BOOL) hasMethod:(jsid)methodID inContext:(JSContext *)context
+{
+	NSParameterAssert(context != NULL && JS_IsInRequest(context));
+	if (_jsSelf == NULL)  return NO;
+	
+	JSBool found = NO;
+	if (!JS_HasPropertyById(context, _jsSelf, methodID, &found))
+	{
+		JS_ClearPendingException(context);
+		return NO;
+	}
+	return found;
+}
+
+
 - (id) propertyWithID:(jsid)propID inContext:(JSContext *)context
 {
 	NSParameterAssert(context != NULL && JS_IsInRequest(context));
@@ -666,8 +727,17 @@ void InitOOJSScript(JSContext *context, JSObject *global)
 }
 
 
+uint32_t OOJSScriptPropertyGeneration(jsid propID)
+{
+	return *PropertyGenerationForID(propID);
+}
+
+
 static JSBool ScriptAddProperty(JSContext *context, JSObject *this, jsid propID, jsval *value)
 {
+	// Event handler indices watch for new properties.
+	(*PropertyGenerationForID(propID))++;
+	
 	// Complain about attempts to set the property tickle.
 	if (JSID_IS_STRING(propID))
 	{
@@ -684,6 +754,13 @@ static JSBool ScriptAddProperty(JSContext *context, JSObject *this, jsid propID,
 }
 
 
+static JSBool ScriptDeleteProperty(JSContext *context, JSObject *this, jsid propID, jsval *value)
+{
+	(*PropertyGenerationForID(propID))++;
+	return YES;
+}
+
+
 static void AddStackToArrayReversed(NSMutableArray *array, RunningStack *stack)
 {
 	if (stack != NULL)
@@ -696,32 +773,19 @@ static void AddStackToArrayReversed(NSMutableArray *array, RunningStack *stack)
 
 static JSScript *LoadScriptWithName(JSContext *context, NSString *path, JSObject *object, JSObject **outScriptObject, NSString **outErrorMessage)
 {
-#if OO_CACHE_JS_SCRIPTS
-	OOCacheManager				*cache = nil;
-#endif
 	NSString					*fileContents = nil;
 	NSData						*data = nil;
 	JSScript					*script = NULL;
+	BOOL						cached = NO;
 	
 	NSCParameterAssert(outScriptObject != NULL && outErrorMessage != NULL);
 	*outErrorMessage = nil;
 	
-#if OO_CACHE_JS_SCRIPTS
-	// Look for cached compiled script
-	cache = [OOCacheManager sharedCache];
-	data = [cache objectForKey:path inCache:@"compiled JavaScript scripts"];
-	if (data != nil)
-	{
-		script = ScriptWithCompiledData(context, data);
-	}
-#endif
+	OOHighResTimeValue startTime = OOGetHighResTime();
 	
-	if (script == NULL)
+	fileContents = [NSString stringWithContentsOfUnicodeFile:path];
+	if (fileContents != nil) 
 	{
-		fileContents = [NSString stringWithContentsOfUnicodeFile:path];
-
-		if (fileContents != nil) 
-		{
 #ifndef NDEBUG
 		/* FIXME: this isn't strictly the right test, since strict
 		 * mode can be enabled with this string within a function
@@ -738,35 +802,114 @@ static JSScript *LoadScriptWithName(JSContext *context, NSString *path, JSObject
 			}
 		}
 #endif
-			data = [fileContents utf16DataWithBOM:NO];
-		}
-		if (data == nil)  *outErrorMessage = @"could not load file";
-		else
-		{
-			script = JS_CompileUCScript(context, object, [data bytes], [data length] / sizeof(unichar), [path UTF8String], 1);
-			if (script != NULL)  *outScriptObject = JS_NewScriptObject(context, script);
-			else  *outErrorMessage = @"compilation failed";
-		}
+		data = [fileContents utf16DataWithBOM:NO];
+	}
+	if (data == nil)
+	{
+		*outErrorMessage = @"could not load file";
+		OODisposeHighResTime(startTime);
+		return NULL;
+	}
+	
+#if OO_CACHE_JS_SCRIPTS
+	// Look for cached compiled script. Reading the source is much cheaper than compiling it.
+	OOCacheManager *cache = [OOCacheManager sharedCache];
+	[cache pruneBlobStoreWhenCleared:kOOCacheCompiledScripts];
+	uint64_t sourceHash = CompiledScriptSourceHash(path, data);
+	NSString *cacheKey = [NSString stringWithFormat:@"%016llx.jsc", (unsigned long long)sourceHash];
+	
+	script = ScriptWithCompiledData(context, [cache blobForKey:cacheKey inStore:kOOCacheCompiledScripts], sourceHash);
+	cached = (script != NULL);
+#endif
+	
+	if (script == NULL)
+	{
+		script = JS_CompileUCScript(context, object, [data bytes], [data length] / sizeof(unichar), [path UTF8String], 1);
+		if (script == NULL)  *outErrorMessage = @"compilation failed";
 		
 #if OO_CACHE_JS_SCRIPTS
 		if (script != NULL)
 		{
 			// Write compiled script to cache
-			data = CompiledScriptData(context, script);
-			[cache setObject:data forKey:path inCache:@"compiled JavaScript scripts"];
+			NSData *compiledData = CompiledScriptData(context, script, sourceHash);
+			if (compiledData != nil)  [cache setBlob:compiledData forKey:cacheKey inStore:kOOCacheCompiledScripts];
 		}
 #endif
 	}
 	
+	if (script != NULL)  *outScriptObject = JS_NewScriptObject(context, script);
+	
+	OOHighResTimeValue endTime = OOGetHighResTime();
+	OOTimeDelta time = OOHighResTimeDeltaInSeconds(startTime, endTime);
+	OODisposeHighResTime(startTime);
+	OODisposeHighResTime(endTime);
+	
+	if (cached)
+	{
+		sLoadStatistics.cachedCount++;
+		sLoadStatistics.cachedTime += time;
+	}
+	else if (script != NULL)
+	{
+		sLoadStatistics.compiledCount++;
+		sLoadStatistics.compiledTime += time;
+	}
+	
 	return script;
 }
 
 
+OOJSScriptLoadStatistics OOJSGetScriptLoadStatistics(void)
+{
+	return sLoadStatistics;
+}
+
+
 #if OO_CACHE_JS_SCRIPTS
-static NSData *CompiledScriptData(JSContext *context, JSScript *script)
+static uint64_t CompiledScriptSourceHash(NSString *path, NSData *source)
+{
+	// 64-bit FNV-1a of the path followed by the UTF-16 source.
+	uint64_t hash = 14695981039346656037ULL;
+	const uint8_t *bytes = (const uint8_t *)[path UTF8String];
+	
+	for (; *bytes != 0; bytes++)  hash = (hash ^ *bytes) * 1099511628211ULL;
+	hash *= 1099511628211ULL;	// Terminator, so the path and source can't run together.
+	
+	NSUInteger i, length = [source length];
+	bytes = [source bytes];
+	for (i = 0; i < length; i++)  hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	
+	return hash;
+}
+
+
+static uint64_t CompiledScriptBuildIdentity(void)
+{
+	static uint64_t identity = 0;
+	
+	if (identity == 0)
+	{
+		// FNV-1a of the SpiderMonkey version string, pointer size and byte order.
+		uint64_t hash = 14695981039346656037ULL;
+		const uint8_t *bytes = (const uint8_t *)JS_GetImplementationVersion();
+		for (; *bytes != 0; bytes++)  hash = (hash ^ *bytes) * 1099511628211ULL;
+		
+		uint32_t layout = (uint32_t)sizeof (void *) << 8 | (uint32_t)(NSHostByteOrder() & 0xFF);
+		bytes = (const uint8_t *)&layout;
+		unsigned i;
+		for (i = 0; i < sizeof layout; i++)  hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		
+		identity = hash ?: 1;
+	}
+	
+	return identity;
+}
+
+
+static NSData *CompiledScriptData(JSContext *context, JSScript *script, uint64_t sourceHash)
 {
 	JSXDRState					*xdr = NULL;
-	NSData						*result = nil;
+	NSMutableData				*result = nil;
 	uint32						length;
 	void						*bytes = NULL;
 	
@@ -778,7 +921,19 @@ static NSData *CompiledScriptData(JSContext *context, JSScript *script)
 			bytes = JS_XDRMemGetData(xdr, &length);
 			if (bytes != NULL)
 			{
-				result = [NSData dataWithBytes:bytes length:length];
+				OOCompiledScriptHeader header =
+				{
+					.magic = { 'O', 'J', 'S', 'C' },
+					.formatVersion = kCompiledScriptFormatVersion,
+					.bytecodeVersion = JSXDR_BYTECODE_VERSION,
+					.dataLength = length,
+					.buildIdentity = CompiledScriptBuildIdentity(),
+					.sourceHash = sourceHash
+				};
+				
+				result = [NSMutableData dataWithCapacity:sizeof header + length];
+				[result appendBytes:&header length:sizeof header];
+				[result appendBytes:bytes length:length];
 			}
 		}
 		JS_XDRDestroy(xdr);
@@ -788,20 +943,34 @@ static NSData *CompiledScriptData(JSContext *context, JSScript *script)
 }
 
 
-static JSScript *ScriptWithCompiledData(JSContext *context, NSData *data)
+static JSScript *ScriptWithCompiledData(JSContext *context, NSData *data, uint64_t sourceHash)
 {
 	JSXDRState					*xdr = NULL;
 	JSScript					*result = NULL;
+	OOCompiledScriptHeader		header;
 	
 	if (data == nil)  return NULL;
 	
+	// Anything written by a different build, or for different source, is stale; it will be overwritten.
+	NSUInteger length = [data length];
+	if (length < sizeof header)  return NULL;
+	[data getBytes:&header length:sizeof header];
+	
+	if (memcmp(header.magic, "OJSC", 4) != 0 ||
+		header.formatVersion != kCompiledScriptFormatVersion ||
+		header.bytecodeVersion != JSXDR_BYTECODE_VERSION ||
+		header.buildIdentity != CompiledScriptBuildIdentity() ||
+		header.sourceHash != sourceHash ||
+		header.dataLength != length - sizeof header)
+	{
+		OODebugLog(@"script.javaScript.cache.stale", @"Ignoring out of date compiled script %016llx.", (unsigned long long)sourceHash);
+		return NULL;
+	}
+	
 	xdr = JS_XDRNewMem(context, JSXDR_DECODE);
 	if (xdr != NULL)
 	{
-		NSUInteger length = [data length];
-		if (EXPECT_NOT(length > UINT32_MAX))  return NULL;
-		
-		JS_XDRMemSetData(xdr, (void *)[data bytes], (uint32_t)length);
+		JS_XDRMemSetData(xdr, (void *)((const char *)[data bytes] + sizeof header), header.dataLength);
 		if (!JS_XDRScript(xdr, &result))  result = NULL;
 		
 		JS_XDRMemSetData(xdr, NULL, 0);	// Don't let it be freed by XDRDestroy
@@ -61,6 +61,24 @@ static NSArray *FindJSVisibleEntities(EntityFilterPredicate predicate, void *par
 static NSArray *FindShips(EntityFilterPredicate predicate, void *parameter, Entity *relativeTo, double range);
 static NSComparisonResult CompareEntitiesByDistance(id a, id b, void *relativeTo);
 
+// Support for queryEntities().
+enum
+{
+	kMaxQueryScanClasses		= 16
+};
+
+typedef struct
+{
+	NSSet				*roles;
+	NSSet				*primaryRoles;
+	OOScanClass			scanClasses[kMaxQueryScanClasses];
+	unsigned			scanClassCount;
+} EntityQueryParameter;
+
+static BOOL EntityQueryPredicate(Entity *entity, void *parameter);
+static BOOL GetQueryRoleSet(JSContext *context, JSObject *query, const char *key, NSSet **outSet);
+static BOOL GetQueryScanClasses(JSContext *context, JSObject *query, EntityQueryParameter *ioParam);
+
 static JSBool SystemAddShipsOrGroup(JSContext *context, uintN argc, jsval *vp, BOOL isGroup);
 static JSBool SystemAddShipsOrGroupToRoute(JSContext *context, uintN argc, jsval *vp, BOOL isGroup);
 
@@ -79,6 +97,7 @@ static JSBool SystemShipsWithPrimaryRole(JSContext *context, uintN argc, jsval *
 static JSBool SystemShipsWithRole(JSContext *context, uintN argc, jsval *vp);
 static JSBool SystemEntitiesWithScanClass(JSContext *context, uintN argc, jsval *vp);
 static JSBool SystemFilteredEntities(JSContext *context, uintN argc, jsval *vp);
+static JSBool SystemQueryEntities(JSContext *context, uintN argc, jsval *vp);
 
 static JSBool SystemLocationFromCode(JSContext *context, uintN argc, jsval *vp);
 static JSBool SystemAddShips(JSContext *context, uintN argc, jsval *vp);
@@ -206,6 +225,7 @@ static JSFunctionSpec sSystemMethods[] =
 	{ "entitiesWithScanClass",			SystemEntitiesWithScanClass,		1 },
 	{ "filteredEntities",				SystemFilteredEntities,				2 },
 	{ "locationFromCode",				SystemLocationFromCode,				1 },
+	{ "queryEntities",					SystemQueryEntities,				1 },
 	// scrambledPseudoRandomNumber is implemented in oolite-global-prefix.js
 	{ "sendAllShipsAway",				SystemSendAllShipsAway,				1 },
 	{ "setPopulator",					SystemSetPopulator,					2 },
@@ -915,6 +935,125 @@ static JSBool SystemFilteredEntities(JSContext *context, uintN argc, jsval *vp)
 }
 
 
+/*	queryEntities(query : Object) : Array (Entity)
+	
+	Declarative counterpart to filteredEntities(), evaluated entirely in
+	native code. Recognised query properties, all optional:
+		roles : String or Array (String)		ships with any of these roles
+		primaryRoles : String or Array (String)	ships with one of these primary roles
+		scanClass : String or Array (String)	entities with one of these scan classes
+		near : Entity							reference entity, excluded from results
+		range : Number							maximum distance from near
+		sortBy : String							"distance" from near, or "none"
+		limit : Number							maximum number of results, after sorting
+	
+	As with filteredEntities(), there is no implicit reference entity: without
+	near, range is measured from the system origin, no entity is excluded and
+	results are in the universe's entity list order. sortBy defaults to
+	"distance" when near is given and "none" otherwise; asking for "distance"
+	without near is an error. A property getter that throws aborts the query
+	with its exception.
+*/
+static JSBool SystemQueryEntities(JSContext *context, uintN argc, jsval *vp)
+{
+	OOJS_NATIVE_ENTER(context)
+	
+	JSObject				*query = NULL;
+	EntityQueryParameter	queryParam = { nil, nil, { 0 }, 0 };
+	Entity					*reference = nil;
+	double					range = -1;
+	int						sortByDistance = -1;	// -1: not specified.
+	jsdouble				limit = -1;
+	jsval					value;
+	NSMutableArray			*result = nil;
+	
+	if (argc < 1 || JSVAL_IS_NULL(OOJS_ARGV[0]) || !JSVAL_IS_OBJECT(OOJS_ARGV[0]))
+	{
+		OOJSReportBadArguments(context, @"System", @"queryEntities", argc, OOJS_ARGV, nil, @"query object");
+		return NO;
+	}
+	query = JSVAL_TO_OBJECT(OOJS_ARGV[0]);
+	
+	if (EXPECT_NOT(!GetQueryRoleSet(context, query, "roles", &queryParam.roles)))  return NO;
+	if (EXPECT_NOT(!GetQueryRoleSet(context, query, "primaryRoles", &queryParam.primaryRoles)))  return NO;
+	if (EXPECT_NOT(!GetQueryScanClasses(context, query, &queryParam)))  return NO;
+	
+	if (EXPECT_NOT(!JS_GetProperty(context, query, "near", &value)))  return NO;
+	if (!JSVAL_IS_VOID(value))
+	{
+		if (EXPECT_NOT(JSVAL_IS_NULL(value) || !JSValueToEntity(context, value, &reference)))
+		{
+			OOJSReportBadArguments(context, @"System", @"queryEntities", 1, &value, @"Invalid near", @"entity");
+			return NO;
+		}
+	}
+	if (EXPECT_NOT(!JS_GetProperty(context, query, "range", &value)))  return NO;
+	if (!JSVAL_IS_VOID(value))
+	{
+		if (EXPECT_NOT(!JS_ValueToNumber(context, value, &range) || isnan(range)))
+		{
+			OOJSReportBadArguments(context, @"System", @"queryEntities", 1, &value, @"Invalid range", @"number");
+			return NO;
+		}
+	}
+	if (EXPECT_NOT(!JS_GetProperty(context, query, "sortBy", &value)))  return NO;
+	if (!JSVAL_IS_VOID(value))
+	{
+		NSString *sortBy = OOStringFromJSValue(context, value);
+		if ([sortBy isEqualToString:@"none"])  sortByDistance = NO;
+		else if ([sortBy isEqualToString:@"distance"])  sortByDistance = YES;
+		else
+		{
+			OOJSReportBadArguments(context, @"System", @"queryEntities", 1, &value, @"Invalid sortBy", @"\"distance\" or \"none\"");
+			return NO;
+		}
+	}
+	if (EXPECT_NOT(!JS_GetProperty(context, query, "limit", &value)))  return NO;
+	if (!JSVAL_IS_VOID(value))
+	{
+		if (EXPECT_NOT(!JS_ValueToNumber(context, value, &limit) || !(limit >= 0)))
+		{
+			OOJSReportBadArguments(context, @"System", @"queryEntities", 1, &value, @"Invalid limit", @"non-negative number");
+			return NO;
+		}
+	}
+	
+	if (sortByDistance == -1)  sortByDistance = (reference != nil);
+	else if (EXPECT_NOT(sortByDistance && reference == nil))
+	{
+		OOJSReportError(context, @"System.queryEntities(): sortBy \"distance\" requires near.");
+		return NO;
+	}
+	
+	OOJS_BEGIN_FULL_NATIVE(context)
+	BinaryOperationPredicateParameter param =
+	{
+		JSEntityIsJavaScriptSearchablePredicate, NULL,
+		EntityQueryPredicate, &queryParam
+	};
+	result = [UNIVERSE findEntitiesMatchingPredicate:ANDPredicate
+										   parameter:&param
+											 inRange:range
+											ofEntity:reference];
+	
+	if (sortByDistance && [result count] > 1)
+	{
+		[result sortUsingFunction:CompareEntitiesByDistance context:reference];
+	}
+	if (limit >= 0 && [result count] > limit)
+	{
+		NSUInteger keep = (NSUInteger)limit;
+		[result removeObjectsInRange:NSMakeRange(keep, [result count] - keep)];
+	}
+	OOJS_END_FULL_NATIVE
+	
+	if (result == nil)  result = [NSMutableArray array];
+	OOJS_RETURN_OBJECT(result);
+	
+	OOJS_NATIVE_EXIT
+}
+
+
 // locationFromCode(populator_named_region : String)
 static JSBool SystemLocationFromCode(JSContext *context, uintN argc, jsval *vp)
 {
@@ -1631,6 +1770,122 @@ static NSArray *FindShips(EntityFilterPredicate predicate, void *parameter, Enti
 }
 
 
+static BOOL EntityQueryPredicate(Entity *entity, void *parameter)
+{
+	EntityQueryParameter	*query = parameter;
+	
+	if (query->scanClassCount != 0)
+	{
+		OOScanClass			scanClass = [entity scanClass];
+		unsigned			i;
+		
+		for (i = 0; i < query->scanClassCount; i++)
+		{
+			if (query->scanClasses[i] == scanClass)  break;
+		}
+		if (i == query->scanClassCount)  return NO;
+	}
+	
+	if (query->roles != nil || query->primaryRoles != nil)
+	{
+		if (!IsShipPredicate(entity, NULL))  return NO;
+		if (query->roles != nil && !HasRoleInSetPredicate(entity, query->roles))  return NO;
+		if (query->primaryRoles != nil && !HasPrimaryRoleInSetPredicate(entity, query->primaryRoles))  return NO;
+	}
+	
+	return YES;
+}
+
+
+/*	Accepts a string or an array of strings; leaves *outSet nil if key is
+	absent. Returns NO with an exception pending if the property can't be read.
+*/
+static BOOL GetQueryRoleSet(JSContext *context, JSObject *query, const char *key, NSSet **outSet)
+{
+	jsval				value;
+	id					object = nil;
+	
+	if (EXPECT_NOT(!JS_GetProperty(context, query, key, &value)))  return NO;
+	if (JSVAL_IS_VOID(value))  return YES;
+	
+	if (JSVAL_IS_STRING(value))
+	{
+		*outSet = [NSSet setWithObject:OOStringFromJSValue(context, value)];
+		return YES;
+	}
+	
+	if (OOJSValueIsArray(context, value))
+	{
+		object = OOJSNativeObjectFromJSValue(context, value);
+		if ([object isKindOfClass:[NSArray class]])
+		{
+			id element = nil;
+			foreach (element, object)
+			{
+				if (![element isKindOfClass:[NSString class]])
+				{
+					object = nil;
+					break;
+				}
+			}
+		}
+		else
+		{
+			object = nil;
+		}
+	}
+	
+	if (EXPECT_NOT(object == nil))
+	{
+		OOJSReportBadArguments(context, @"System", @"queryEntities", 1, &value, [NSString stringWithFormat:@"Invalid %s", key], @"string or array of strings");
+		return NO;
+	}
+	
+	*outSet = [NSSet setWithArray:object];
+	return YES;
+}
+
+
+static BOOL GetQueryScanClasses(JSContext *context, JSObject *query, EntityQueryParameter *ioParam)
+{
+	jsval				value, element;
+	jsuint				i, count = 1;
+	JSObject			*array = NULL;
+	OOScanClass			scanClass;
+	
+	if (EXPECT_NOT(!JS_GetProperty(context, query, "scanClass", &value)))  return NO;
+	if (JSVAL_IS_VOID(value))  return YES;
+	
+	if (OOJSValueIsArray(context, value))
+	{
+		array = JSVAL_TO_OBJECT(value);
+		if (!JS_GetArrayLength(context, array, &count))  return NO;
+	}
+	
+	for (i = 0; i < count; i++)
+	{
+		if (array != NULL)
+		{
+			if (!JS_GetElement(context, array, i, &element))  return NO;
+		}
+		else
+		{
+			element = value;
+		}
+		
+		scanClass = OOScanClassFromJSValue(context, element);
+		if (EXPECT_NOT(scanClass == CLASS_NOT_SET || ioParam->scanClassCount == kMaxQueryScanClasses))
+		{
+			OOJSReportBadArguments(context, @"System", @"queryEntities", 1, &value, @"Invalid scanClass", @"scan class string or array of scan class strings");
+			return NO;
+		}
+		ioParam->scanClasses[ioParam->scanClassCount++] = scanClass;
+	}
+	
+	return YES;
+}
+
+
 static NSComparisonResult CompareEntitiesByDistance(id a, id b, void *relativeTo)
 {
 	OOJS_PROFILE_ENTER
@@ -31,6 +31,9 @@ MA 02110-1301, USA.
 
 void InitOOJSVector(JSContext *context, JSObject *global);
 
+//	Statistics for the pool Vector3D privates are allocated from, for the debug console.
+NSString *JSVectorPrivatePoolDescription(void);
+
 
 JSObject *JSVectorWithVector(JSContext *context, Vector vector)  NONNULL_FUNC;
 JSObject *JSVectorWithHPVector(JSContext *context, HPVector vector)  NONNULL_FUNC;
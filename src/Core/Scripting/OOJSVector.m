@@ -24,6 +24,7 @@ MA 02110-1301, USA.
 
 #import "OOJSVector.h"
 #import "OOJavaScriptEngine.h"
+#import "OOJSPrivatePool.h"
 
 #if OOLITE_GNUSTEP
 #import <GNUstepBase/GSObjCRuntime.h>
@@ -37,6 +38,7 @@ MA 02110-1301, USA.
 
 
 static JSObject *sVectorPrototype;
+static OOJSPrivatePool		sVectorPool = OOJS_PRIVATE_POOL_INIT("Vector3D", sizeof (HPVector));
 
 
 static BOOL GetThisVector(JSContext *context, JSObject *vectorObj, HPVector *outVector, NSString *method)  NONNULL_FUNC;
@@ -156,6 +158,12 @@ void InitOOJSVector(JSContext *context, JSObject *global)
 }
 
 
+NSString *JSVectorPrivatePoolDescription(void)
+{
+	return OOJSPrivatePoolDescription(&sVectorPool);
+}
+
+
 JSObject *JSVectorWithVector(JSContext *context, Vector vector)
 {
 	OOJS_PROFILE_ENTER
@@ -163,7 +171,7 @@ JSObject *JSVectorWithVector(JSContext *context, Vector vector)
 	JSObject				*result = NULL;
 	HPVector					*private = NULL;
 	
-	private = malloc(sizeof *private);
+	private = OOJSPrivatePoolAllocate(&sVectorPool);
 	if (EXPECT_NOT(private == NULL))  return NULL;
 	
 	*private = vectorToHPVector(vector);
@@ -174,7 +182,7 @@ JSObject *JSVectorWithVector(JSContext *context, Vector vector)
 		if (EXPECT_NOT(!JS_SetPrivate(context, result, private)))  result = NULL;
 	}
 	
-	if (EXPECT_NOT(result == NULL)) free(private);
+	if (EXPECT_NOT(result == NULL)) OOJSPrivatePoolRelease(&sVectorPool, private);
 	
 	return result;
 	
@@ -206,7 +214,7 @@ JSObject *JSVectorWithHPVector(JSContext *context, HPVector vector)
 	JSObject				*result = NULL;
 	HPVector					*private = NULL;
 	
-	private = malloc(sizeof *private);
+	private = OOJSPrivatePoolAllocate(&sVectorPool);
 	if (EXPECT_NOT(private == NULL))  return NULL;
 	
 	*private = vector;
@@ -217,7 +225,7 @@ JSObject *JSVectorWithHPVector(JSContext *context, HPVector vector)
 		if (EXPECT_NOT(!JS_SetPrivate(context, result, private)))  result = NULL;
 	}
 	
-	if (EXPECT_NOT(result == NULL)) free(private);
+	if (EXPECT_NOT(result == NULL)) OOJSPrivatePoolRelease(&sVectorPool, private);
 	
 	return result;
 	
@@ -599,7 +607,7 @@ static void VectorFinalize(JSContext *context, JSObject *this)
 	private = JS_GetInstancePrivate(context, this, &sVectorClass, NULL);
 	if (private != NULL)
 	{
-		free(private);
+		OOJSPrivatePoolRelease(&sVectorPool, private);
 	}
 	
 	OOJS_PROFILE_EXIT_VOID
@@ -614,17 +622,21 @@ static JSBool VectorConstruct(JSContext *context, uintN argc, jsval *vp)
 	HPVector					*private = NULL;
 	JSObject				*this = NULL;
 	
-	private = malloc(sizeof *private);
+	private = OOJSPrivatePoolAllocate(&sVectorPool);
 	if (EXPECT_NOT(private == NULL))  return NO;
 	
 	this = JS_NewObject(context, &sVectorClass, NULL, NULL);
-	if (EXPECT_NOT(this == NULL))  return NO;
+	if (EXPECT_NOT(this == NULL))
+	{
+		OOJSPrivatePoolRelease(&sVectorPool, private);
+		return NO;
+	}
 	
 	if (argc != 0)
 	{
 		if (EXPECT_NOT(!VectorFromArgumentListNoErrorInternal(context, argc, OOJS_ARGV, &vector, NULL, YES)))
 		{
-			free(private);
+			OOJSPrivatePoolRelease(&sVectorPool, private);
 			OOJSReportBadArguments(context, NULL, NULL, argc, OOJS_ARGV,
 								   @"Could not construct vector from parameters",
 								   @"Vector, Entity or array of three numbers");
@@ -636,7 +648,7 @@ static JSBool VectorConstruct(JSContext *context, uintN argc, jsval *vp)
 	
 	if (EXPECT_NOT(!JS_SetPrivate(context, this, private)))
 	{
-		free(private);
+		OOJSPrivatePoolRelease(&sVectorPool, private);
 		return NO;
 	}
 	
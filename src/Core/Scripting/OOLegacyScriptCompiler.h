@@ -0,0 +1,117 @@
+/*
+
+OOLegacyScriptCompiler.h
+
+Compiled form of sanitized legacy scripts (see OOLegacyScriptWhitelist.h).
+
+Interpreting a sanitized script resolves every selector from its string and
+parses every numeric or list operand on each evaluation. The compiled form
+does that once: selectors are resolved, operands with no selector
+components are joined and pre-parsed as numbers, booleans and oneof lists,
+and mission/local variable names are kept apart from method selectors.
+
+Compiled scripts are built from sanitized scripts, which remain the form
+cached by OOCacheManager, since selectors cannot be stored in a property
+list. They are executed by -[PlayerEntity runCompiledScriptActions:...] and
+behave exactly like the sanitized scripts they are compiled from.
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "PlayerEntityLegacyScriptEngine.h"
+
+@class OOLegacyConditionList, OOLegacyActionList;
+
+
+typedef struct
+{
+	SEL						selector;		// NULL for literals.
+	NSString				*literal;
+} OOLegacyOperand;
+
+
+typedef struct
+{
+	OOOperationType			opType;
+	OOComparisonType		comparator;
+	SEL						selector;		// For OP_STRING, OP_NUMBER and OP_BOOL.
+	NSString				*variableName;	// For OP_MISSION_VAR and OP_LOCAL_VAR.
+	NSArray					*source;		// The sanitized condition, for error messages.
+
+	NSUInteger				operandCount;
+	OOLegacyOperand			*operands;
+
+	// Pre-parsed right-hand side, if no operand is a selector.
+	BOOL					rhsIsConstant;
+	NSString				*constantRHS;
+	double					constantNumber;
+	BOOL					constantFlag;
+	NSArray					*constantStrings;		// Trimmed oneof items.
+	NSUInteger				constantNumberCount;
+	double					*constantNumbers;		// Numeric oneof items.
+} OOLegacyCondition;
+
+
+typedef struct
+{
+	BOOL					isConditional;
+
+	// Conditional statements.
+	OOLegacyConditionList	*conditions;
+	OOLegacyActionList		*ifTrue;
+	OOLegacyActionList		*ifFalse;
+
+	// Action statements.
+	SEL						selector;
+	NSString				*argument;		// nil for methods without an argument.
+	NSArray					*source;		// The sanitized statement.
+} OOLegacyStatement;
+
+
+@interface OOLegacyConditionList: NSObject
+{
+@private
+	OOLegacyCondition		*_conditions;
+	NSUInteger				_count;
+}
+
+@property (readonly) NSUInteger count;
+- (const OOLegacyCondition *) conditions;
+
+@end
+
+
+@interface OOLegacyActionList: NSObject
+{
+@private
+	OOLegacyStatement		*_statements;
+	NSUInteger				_count;
+}
+
+@property (readonly) NSUInteger count;
+- (const OOLegacyStatement *) statements;
+
+@end
+
+
+//	Compile sanitized scripts and conditions. Return nil if given nil.
+OOLegacyActionList *OOCompileLegacyScript(NSArray *sanitizedScript);
+OOLegacyConditionList *OOCompileLegacyScriptConditions(NSArray *sanitizedConditions);
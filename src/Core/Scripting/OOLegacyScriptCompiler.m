@@ -0,0 +1,298 @@
+/*
+
+OOLegacyScriptCompiler.m
+
+
+Oolite
+Copyright (C) 2004-2013 Giles C Williams and contributors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+MA 02110-1301, USA.
+
+*/
+
+#import "OOLegacyScriptCompiler.h"
+#import "OOCollectionExtractors.h"
+
+
+@interface OOLegacyConditionList (Private)
+
+- (instancetype) initWithSanitizedConditions:(NSArray *)conditions;
+
+@end
+
+
+@interface OOLegacyActionList (Private)
+
+- (instancetype) initWithSanitizedScript:(NSArray *)script;
+
+@end
+
+
+static void CompileCondition(NSArray *sanitized, OOLegacyCondition *outCondition);
+static void ReleaseCondition(OOLegacyCondition *condition);
+static void CompileStatement(NSArray *sanitized, OOLegacyStatement *outStatement);
+static void ReleaseStatement(OOLegacyStatement *statement);
+
+
+OOLegacyActionList *OOCompileLegacyScript(NSArray *sanitizedScript)
+{
+	if (sanitizedScript == nil)  return nil;
+	return [[[OOLegacyActionList alloc] initWithSanitizedScript:sanitizedScript] autorelease];
+}
+
+
+OOLegacyConditionList *OOCompileLegacyScriptConditions(NSArray *sanitizedConditions)
+{
+	if (sanitizedConditions == nil)  return nil;
+	return [[[OOLegacyConditionList alloc] initWithSanitizedConditions:sanitizedConditions] autorelease];
+}
+
+
+@implementation OOLegacyConditionList
+
+- (instancetype) initWithSanitizedConditions:(NSArray *)conditions
+{
+	if ((self = [super init]))
+	{
+		_count = [conditions count];
+		if (_count != 0)
+		{
+			_conditions = calloc(_count, sizeof *_conditions);
+			if (_conditions == NULL)
+			{
+				[self release];
+				return nil;
+			}
+
+			NSUInteger i;
+			for (i = 0; i < _count; i++)
+			{
+				CompileCondition([conditions oo_arrayAtIndex:i], &_conditions[i]);
+			}
+		}
+	}
+	return self;
+}
+
+
+- (void) dealloc
+{
+	NSUInteger i;
+	for (i = 0; i < _count; i++)  ReleaseCondition(&_conditions[i]);
+	free(_conditions);
+
+	[super dealloc];
+}
+
+
+- (NSString *) descriptionComponents
+{
+	return [NSString stringWithFormat:@"%lu conditions", (unsigned long)_count];
+}
+
+
+@synthesize count = _count;
+
+
+- (const OOLegacyCondition *) conditions
+{
+	return _conditions;
+}
+
+@end
+
+
+@implementation OOLegacyActionList
+
+- (instancetype) initWithSanitizedScript:(NSArray *)script
+{
+	if ((self = [super init]))
+	{
+		_count = [script count];
+		if (_count != 0)
+		{
+			_statements = calloc(_count, sizeof *_statements);
+			if (_statements == NULL)
+			{
+				[self release];
+				return nil;
+			}
+
+			NSUInteger i;
+			for (i = 0; i < _count; i++)
+			{
+				CompileStatement([script oo_arrayAtIndex:i], &_statements[i]);
+			}
+		}
+	}
+	return self;
+}
+
+
+- (void) dealloc
+{
+	NSUInteger i;
+	for (i = 0; i < _count; i++)  ReleaseStatement(&_statements[i]);
+	free(_statements);
+
+	[super dealloc];
+}
+
+
+- (NSString *) descriptionComponents
+{
+	return [NSString stringWithFormat:@"%lu statements", (unsigned long)_count];
+}
+
+
+@synthesize count = _count;
+
+
+- (const OOLegacyStatement *) statements
+{
+	return _statements;
+}
+
+@end
+
+
+static void CompileCondition(NSArray *sanitized, OOLegacyCondition *outCondition)
+{
+	NSArray					*operands = nil;
+	NSString				*selectorString = nil;
+	NSUInteger				i;
+
+	outCondition->source = [sanitized retain];
+	outCondition->opType = [sanitized oo_unsignedIntAtIndex:0];
+	if (outCondition->opType == OP_FALSE)  return;
+
+	selectorString = [sanitized oo_stringAtIndex:2];
+	outCondition->comparator = [sanitized oo_unsignedIntAtIndex:3];
+	operands = [sanitized oo_arrayAtIndex:4];
+
+	if (outCondition->opType == OP_MISSION_VAR || outCondition->opType == OP_LOCAL_VAR)
+	{
+		outCondition->variableName = [selectorString copy];
+	}
+	else
+	{
+		outCondition->selector = NSSelectorFromString(selectorString);
+	}
+
+	/*	Each operand is (isSelector, string). As in
+		-expandScriptRightHandSide:, the right-hand side is the operands'
+		values joined with spaces.
+	*/
+	outCondition->operandCount = [operands count];
+	outCondition->rhsIsConstant = YES;
+	if (outCondition->operandCount != 0)
+	{
+		outCondition->operands = calloc(outCondition->operandCount, sizeof *outCondition->operands);
+		if (outCondition->operands == NULL)  [NSException raise:NSMallocException format:@"Could not compile legacy script condition."];
+	}
+
+	NSMutableArray *literals = [NSMutableArray arrayWithCapacity:outCondition->operandCount];
+	for (i = 0; i < outCondition->operandCount; i++)
+	{
+		NSArray *operand = [operands oo_arrayAtIndex:i];
+		NSString *string = [operand oo_stringAtIndex:1 defaultValue:@""];
+
+		if ([[operand objectAtIndex:0] boolValue])
+		{
+			outCondition->operands[i].selector = NSSelectorFromString(string);
+			outCondition->rhsIsConstant = NO;
+		}
+		else
+		{
+			outCondition->operands[i].literal = [string copy];
+			[literals addObject:string];
+		}
+	}
+
+	if (outCondition->rhsIsConstant)
+	{
+		NSString *rhs = [literals componentsJoinedByString:@" "];
+
+		outCondition->constantRHS = [rhs copy];
+		outCondition->constantNumber = [rhs doubleValue];
+		outCondition->constantFlag = [rhs isEqualToString:@"YES"];
+
+		if (outCondition->comparator == COMPARISON_ONEOF)
+		{
+			NSArray *items = [rhs componentsSeparatedByString:@","];
+			NSMutableArray *trimmed = [NSMutableArray arrayWithCapacity:[items count]];
+			NSCharacterSet *whitespace = [NSCharacterSet whitespaceCharacterSet];
+
+			outCondition->constantNumberCount = [items count];
+			outCondition->constantNumbers = malloc(outCondition->constantNumberCount * sizeof *outCondition->constantNumbers);
+			if (outCondition->constantNumbers == NULL)  [NSException raise:NSMallocException format:@"Could not compile legacy script condition."];
+
+			for (i = 0; i < outCondition->constantNumberCount; i++)
+			{
+				NSString *item = [items objectAtIndex:i];
+				[trimmed addObject:[item stringByTrimmingCharactersInSet:whitespace]];
+				outCondition->constantNumbers[i] = [item doubleValue];	// Untrimmed, as when interpreted.
+			}
+			outCondition->constantStrings = [trimmed copy];
+		}
+	}
+}
+
+
+static void ReleaseCondition(OOLegacyCondition *condition)
+{
+	NSUInteger i;
+	for (i = 0; i < condition->operandCount; i++)  [condition->operands[i].literal release];
+	free(condition->operands);
+	free(condition->constantNumbers);
+
+	[condition->variableName release];
+	[condition->source release];
+	[condition->constantRHS release];
+	[condition->constantStrings release];
+}
+
+
+static void CompileStatement(NSArray *sanitized, OOLegacyStatement *outStatement)
+{
+	/*	Sanitized statements are (true, conditions, trueActions, falseActions)
+		or (false, selector [, argument]); see OOLegacyScriptWhitelist.h.
+	*/
+	outStatement->source = [sanitized retain];
+	outStatement->isConditional = [[sanitized objectAtIndex:0] boolValue];
+
+	if (outStatement->isConditional)
+	{
+		outStatement->conditions = [OOCompileLegacyScriptConditions([sanitized oo_arrayAtIndex:1]) retain];
+		outStatement->ifTrue = [OOCompileLegacyScript([sanitized oo_arrayAtIndex:2]) retain];
+		outStatement->ifFalse = [OOCompileLegacyScript([sanitized oo_arrayAtIndex:3]) retain];
+	}
+	else
+	{
+		outStatement->selector = NSSelectorFromString([sanitized oo_stringAtIndex:1]);
+		if ([sanitized count] > 2)  outStatement->argument = [[sanitized oo_stringAtIndex:2] copy];
+	}
+}
+
+
+static void ReleaseStatement(OOLegacyStatement *statement)
+{
+	[statement->conditions release];
+	[statement->ifTrue release];
+	[statement->ifFalse release];
+	[statement->argument release];
+	[statement->source release];
+}
@@ -32,14 +32,23 @@ MA 02110-1301, USA.
 
 #import "OOScript.h"
 
+@class OOLegacyActionList;
+
 
 @interface OOPListScript: OOScript
 {
 @private
 	NSArray					*_script;
+	OOLegacyActionList		*_compiledScript;
 	NSDictionary			*_metadata;
 }
 
 + (NSArray *)scriptsInPListFile:(NSString *)filePath;
 
+/*	The sanitized script is what is cached; the compiled script is built from
+	it when the script is loaded, and is what -runWithTarget: executes.
+*/
+- (NSArray *) sanitizedScript;
+- (OOLegacyActionList *) compiledScript;
+
 @end
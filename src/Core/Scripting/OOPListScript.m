@@ -26,6 +26,7 @@ MA 02110-1301, USA.
 #import "OOPListParsing.h"
 #import "PlayerEntityLegacyScriptEngine.h"
 #import "OOLegacyScriptWhitelist.h"
+#import "OOLegacyScriptCompiler.h"
 #import "OOCacheManager.h"
 #import "OOCollectionExtractors.h"
 
@@ -69,6 +70,7 @@ static NSString * const kCacheName			= @"sanitized legacy scripts";
 - (void)dealloc
 {
 	[_script release];
+	[_compiledScript release];
 	[_metadata release];
 	
 	[super dealloc];
@@ -99,6 +101,18 @@ static NSString * const kCacheName			= @"sanitized legacy scripts";
 }
 
 
+- (NSArray *) sanitizedScript
+{
+	return _script;
+}
+
+
+- (OOLegacyActionList *) compiledScript
+{
+	return _compiledScript;
+}
+
+
 - (void)runWithTarget:(Entity *)target
 {
 	if (target != nil && ![target isKindOfClass:[ShipEntity class]])
@@ -110,9 +124,9 @@ static NSString * const kCacheName			= @"sanitized legacy scripts";
 	OOLog(@"script.legacy.run", @"Running script %@", [self displayName]);
 	OOLogIndentIf(@"script.legacy.run");
 	
-	[PLAYER runScriptActions:_script
-			 withContextName:[self name]
-				   forTarget:(ShipEntity *)target];
+	[PLAYER runCompiledScriptActions:_compiledScript
+					 withContextName:[self name]
+						   forTarget:(ShipEntity *)target];
 	
 	OOLogOutdentIf(@"script.legacy.run");
 }
@@ -195,6 +209,7 @@ static NSString * const kCacheName			= @"sanitized legacy scripts";
 	if (self != nil)
 	{
 		_script = [script retain];
+		_compiledScript = [OOCompileLegacyScript(script) retain];
 		if (name != nil)
 		{
 			if (metadata == nil)  metadata = @{kMDKeyName: name};
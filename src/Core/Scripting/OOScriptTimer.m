@@ -26,14 +26,73 @@ MA 02110-1301, USA.
 #import "OOScriptTimer.h"
 #import "Universe.h"
 #import "OOLogging.h"
+
+#ifndef NDEBUG
 #import "OOPriorityQueue.h"
+#import "OOProfilingStopwatch.h"
+#endif
+
+
+/*	Timing wheel
+	
+	Level 0 has one slot per tick for the next 64 ticks, and each slot of
+	level n spans 64^n ticks. A timer is filed at the lowest level whose
+	span covers its distance from the current tick, in the slot selected by
+	its own tick, and is moved down ("cascaded") when the current tick
+	reaches the start of its slot. Timers further away than the top level
+	covers (about 73 hours of game time) wait in an overflow list, which is
+	re-filed each time the top level wraps.
+	
+	Stretches with nothing filed at the lower levels are skipped, so large
+	jumps in game time cost at most a few iterations per level. If game
+	time goes backwards, the wheel is rebuilt around the new time.
+*/
+enum
+{
+	kWheelLevels			= 4,
+	kWheelSlotBits			= 6,
+	kWheelSlots				= 1 << kWheelSlotBits,
+	kWheelSlotMask			= kWheelSlots - 1
+};
+
+#define kWheelTicksPerSecond	64.0
+
+
+enum
+{
+	// Values of _wheelState.
+	kTimerNotQueued,
+	kTimerInWheel,
+	kTimerDeferred,			// In sDeferredTimers.
+	kTimerDue				// In the list of timers being fired.
+};
+
+
+typedef struct
+{
+	OOScriptTimer			*slots[kWheelLevels][kWheelSlots];
+	OOScriptTimer			*overflow;
+	NSUInteger				levelCounts[kWheelLevels + 1];
+	NSUInteger				count;
+	uint64_t				currentTick;	// Slots for earlier ticks have been drained.
+} OOTimerWheel;
 
 
-static OOPriorityQueue	*sTimers;
+static OOTimerWheel		sWheel;
+static unsigned long long sNextSequence;
 
 // During an update, new timers must be deferred to avoid an infinite loop.
 static BOOL				sUpdating;
 static NSMutableArray	*sDeferredTimers;
+static NSArray			*sDueTimers;
+
+
+static uint64_t TickForTime(OOTimeAbsolute time);
+static void WheelInsert(OOTimerWheel *wheel, OOScriptTimer *timer);
+static void WheelRemove(OOTimerWheel *wheel, OOScriptTimer *timer);
+static void WheelCollectDue(OOTimerWheel *wheel, OOTimeAbsolute now, NSMutableArray *due);
+static void WheelDetachAll(OOTimerWheel *wheel, NSMutableArray *timers);
+static NSComparisonResult CompareTimersForFiring(id a, id b, void *context);
 
 
 @implementation OOScriptTimer
@@ -128,15 +187,19 @@ static NSMutableArray	*sDeferredTimers;
 	if (_isScheduled)  return YES;
 	if (![self isValidForScheduling])  return NO;
 	
+	_wheelSequence = sNextSequence++;
+	
 	if (EXPECT(!sUpdating))
 	{
-		if (EXPECT_NOT(sTimers == nil))  sTimers = [[OOPriorityQueue alloc] initWithComparator:@selector(compareByNextFireTime:)];
-		[sTimers addObject:self];
+		// An empty wheel has no position to keep, so start it at the current time.
+		if (sWheel.count == 0)  sWheel.currentTick = TickForTime([UNIVERSE getTime]);
+		WheelInsert(&sWheel, self);
 	}
 	else
 	{
 		if (sDeferredTimers == nil)  sDeferredTimers = [[NSMutableArray alloc] init];
 		[sDeferredTimers addObject:self];
+		_wheelState = kTimerDeferred;
 	}
 	
 	_isScheduled = YES;
@@ -146,9 +209,19 @@ static NSMutableArray	*sDeferredTimers;
 
 - (void) unscheduleTimer
 {
-	[sTimers removeExactObject:self];
 	_isScheduled = NO;
 	_hasBeenRun = NO;
+	
+	if (_wheelState == kTimerInWheel)
+	{
+		// May release the last reference to self.
+		WheelRemove(&sWheel, self);
+	}
+	else
+	{
+		// Deferred and due timers are skipped when their lists are processed.
+		_wheelState = kTimerNotQueued;
+	}
 }
 
 
@@ -158,51 +231,72 @@ static NSMutableArray	*sDeferredTimers;
 + (void) updateTimers
 {
 	OOScriptTimer		*timer = nil;
-	OOTimeAbsolute		now;
+	NSMutableArray		*due = nil;
+	NSArray				*outerDueTimers = sDueTimers;
+	BOOL				outerUpdating = sUpdating;
 	
 	sUpdating = YES;
 	
-	now = [UNIVERSE getTime];
-	for (;;)
+	due = [NSMutableArray array];
+	WheelCollectDue(&sWheel, [UNIVERSE getTime], due);
+	[due sortUsingFunction:CompareTimersForFiring context:NULL];
+	sDueTimers = due;
+	
+	foreach (timer, due)
 	{
-		timer = [sTimers peekAtNextObject];
-		if (timer == nil || now < [timer nextTime])  break;
-		
-		[sTimers removeNextObject];
+		// Unscheduled (and possibly rescheduled) by an earlier timer.
+		if (timer->_wheelState != kTimerDue)  continue;
+		timer->_wheelState = kTimerNotQueued;
 		
 		// Must fire before rescheduling so that the timer callback can stop itself. -- Ahruman 2011-01-01
 		[timer timerFired];
 		
 		timer->_hasBeenRun = YES;
 		
-		if (timer->_isScheduled)
+		if (timer->_isScheduled && timer->_wheelState == kTimerNotQueued)
 		{
 			timer->_isScheduled = NO;
 			[timer scheduleTimer];
 		}
 	}
 	
-	if (sDeferredTimers != nil)
+	sDueTimers = outerDueTimers;
+	
+	if (sDeferredTimers != nil && !outerUpdating)
 	{
-		[sTimers addObjects:sDeferredTimers];
+		if (sWheel.count == 0)  sWheel.currentTick = TickForTime([UNIVERSE getTime]);
+		foreach (timer, sDeferredTimers)
+		{
+			// A timer unscheduled and rescheduled while deferred appears twice.
+			if (timer->_wheelState == kTimerDeferred)  WheelInsert(&sWheel, timer);
+		}
 		DESTROY(sDeferredTimers);
 	}
 	
-	sUpdating = NO;
+	sUpdating = outerUpdating;
 }
 
 
 + (void) noteGameReset
 {
-	NSArray				*timers = nil;
+	NSMutableArray		*timers = [NSMutableArray array];
 	OOScriptTimer		*timer = nil;
 	
-	// Intermediate array is required so we don't get stuck in an endless loop over reinserted timers. Note that -sortedObjects also clears the queue!
-	timers = [sTimers sortedObjects];
+	WheelDetachAll(&sWheel, timers);
 	foreach (timer, timers)
 	{
 		timer->_isScheduled = NO;
 	}
+	
+	// Timers due in an update in progress have been taken out of the wheel, but not yet fired.
+	foreach (timer, sDueTimers)
+	{
+		if (timer->_wheelState == kTimerDue)
+		{
+			timer->_wheelState = kTimerNotQueued;
+			timer->_isScheduled = NO;
+		}
+	}
 }
 
 
@@ -249,3 +343,463 @@ static NSMutableArray	*sDeferredTimers;
 }
 
 @end
+
+
+static uint64_t TickForTime(OOTimeAbsolute time)
+{
+	if (!(time > 0.0))  return 0;
+	return (uint64_t)floor(time * kWheelTicksPerSecond);
+}
+
+
+static void WheelLink(OOTimerWheel *wheel, OOScriptTimer *timer)
+{
+	uint64_t			tick = TickForTime(timer->_nextTime);
+	uint64_t			delta;
+	unsigned			level;
+	OOScriptTimer		**head = NULL;
+	
+	// Overdue timers go in the current slot and fire at the next update.
+	if (tick < wheel->currentTick)  tick = wheel->currentTick;
+	delta = tick - wheel->currentTick;
+	
+	for (level = 0; level < kWheelLevels; level++)
+	{
+		if (delta < (1ULL << (kWheelSlotBits * (level + 1))))  break;
+	}
+	
+	if (level < kWheelLevels)  head = &wheel->slots[level][(tick >> (kWheelSlotBits * level)) & kWheelSlotMask];
+	else  head = &wheel->overflow;
+	
+	timer->_wheelHead = head;
+	timer->_wheelLevel = level;
+	timer->_wheelPrev = nil;
+	timer->_wheelNext = *head;
+	if (*head != nil)  (*head)->_wheelPrev = timer;
+	*head = timer;
+	
+	wheel->levelCounts[level]++;
+	wheel->count++;
+}
+
+
+static void WheelUnlink(OOTimerWheel *wheel, OOScriptTimer *timer)
+{
+	if (timer->_wheelPrev != nil)  timer->_wheelPrev->_wheelNext = timer->_wheelNext;
+	else  *timer->_wheelHead = timer->_wheelNext;
+	if (timer->_wheelNext != nil)  timer->_wheelNext->_wheelPrev = timer->_wheelPrev;
+	
+	timer->_wheelNext = nil;
+	timer->_wheelPrev = nil;
+	timer->_wheelHead = NULL;
+	
+	wheel->levelCounts[timer->_wheelLevel]--;
+	wheel->count--;
+}
+
+
+// The wheel holds a reference to each timer in it.
+static void WheelInsert(OOTimerWheel *wheel, OOScriptTimer *timer)
+{
+	[timer retain];
+	WheelLink(wheel, timer);
+	timer->_wheelState = kTimerInWheel;
+}
+
+
+static void WheelRemove(OOTimerWheel *wheel, OOScriptTimer *timer)
+{
+	WheelUnlink(wheel, timer);
+	timer->_wheelState = kTimerNotQueued;
+	[timer release];
+}
+
+
+static void WheelCascade(OOTimerWheel *wheel, uint64_t tick)
+{
+	unsigned			level;
+	OOScriptTimer		**head = NULL;
+	OOScriptTimer		*timer = nil, *next = nil;
+	
+	for (level = 1; level <= kWheelLevels; level++)
+	{
+		if (level < kWheelLevels)  head = &wheel->slots[level][(tick >> (kWheelSlotBits * level)) & kWheelSlotMask];
+		else  head = &wheel->overflow;
+		
+		/*	Timers a whole turn of this level away, and overflow timers still
+			out of range, are filed back into the same list, at its head; the
+			walk continues from the saved next pointer, so it sees each once.
+		*/
+		for (timer = *head; timer != nil; timer = next)
+		{
+			next = timer->_wheelNext;
+			WheelUnlink(wheel, timer);
+			WheelLink(wheel, timer);
+		}
+		
+		// Higher levels only cascade when this level wraps.
+		if (level == kWheelLevels || ((tick >> (kWheelSlotBits * level)) & kWheelSlotMask) != 0)  break;
+	}
+}
+
+
+static void WheelRebuild(OOTimerWheel *wheel, uint64_t tick)
+{
+	NSMutableArray		*timers = [NSMutableArray arrayWithCapacity:wheel->count];
+	OOScriptTimer		*timer = nil;
+	
+	WheelDetachAll(wheel, timers);
+	wheel->currentTick = tick;
+	foreach (timer, timers)
+	{
+		WheelInsert(wheel, timer);
+	}
+}
+
+
+/*	Advance the wheel to now, moving timers with nextTime <= now into due.
+	Their reference is transferred to due. The slot for now's tick is only
+	partly drained, so the wheel stays on that tick.
+*/
+static void WheelCollectDue(OOTimerWheel *wheel, OOTimeAbsolute now, NSMutableArray *due)
+{
+	uint64_t			target = TickForTime(now);
+	uint64_t			tick, next, span;
+	unsigned			level;
+	OOScriptTimer		*timer = nil;
+	
+	if (target < wheel->currentTick)  WheelRebuild(wheel, target);
+	if (wheel->count == 0)
+	{
+		wheel->currentTick = target;
+		return;
+	}
+	
+	tick = wheel->currentTick;
+	for (;;)
+	{
+		/*	WheelLink() files timers relative to currentTick, so it must be
+			the tick being processed when cascading. Otherwise, after a skip
+			or a long frame, a cascaded timer looks a whole turn further away
+			than it is, goes back into the slot just emptied, and waits a full
+			turn of that level.
+		*/
+		wheel->currentTick = tick;
+		if ((tick & kWheelSlotMask) == 0)  WheelCascade(wheel, tick);
+		
+		timer = wheel->slots[0][tick & kWheelSlotMask];
+		while (timer != nil)
+		{
+			OOScriptTimer *nextTimer = timer->_wheelNext;
+			if (timer->_nextTime <= now)
+			{
+				[due addObject:timer];
+				WheelRemove(wheel, timer);
+				timer->_wheelState = kTimerDue;
+			}
+			timer = nextTimer;
+		}
+		
+		if (tick == target)  break;
+		
+		// Skip to the next tick with anything to drain or cascade.
+		next = tick + 1;
+		if (wheel->count == 0)  next = target;
+		else if (wheel->levelCounts[0] == 0)
+		{
+			for (level = 1; level < kWheelLevels && wheel->levelCounts[level] == 0; level++)  {}
+			span = 1ULL << (kWheelSlotBits * level);
+			next = (tick | (span - 1)) + 1;
+		}
+		tick = (next < target) ? next : target;
+	}
+	
+	wheel->currentTick = target;
+}
+
+
+static void WheelDetachAll(OOTimerWheel *wheel, NSMutableArray *timers)
+{
+	unsigned			level, slot;
+	OOScriptTimer		*timer = nil;
+	
+	for (level = 0; level <= kWheelLevels; level++)
+	{
+		for (slot = 0; slot < kWheelSlots; slot++)
+		{
+			OOScriptTimer **head = (level < kWheelLevels) ? &wheel->slots[level][slot] : &wheel->overflow;
+			while ((timer = *head) != nil)
+			{
+				[timers addObject:timer];
+				WheelRemove(wheel, timer);
+			}
+			if (level == kWheelLevels)  break;
+		}
+	}
+}
+
+
+static NSComparisonResult CompareTimersForFiring(id a, id b, void *context)
+{
+	OOScriptTimer		*ta = a, *tb = b;
+	
+	if (ta->_nextTime < tb->_nextTime)  return NSOrderedAscending;
+	if (ta->_nextTime > tb->_nextTime)  return NSOrderedDescending;
+	if (ta->_wheelSequence < tb->_wheelSequence)  return NSOrderedAscending;
+	if (ta->_wheelSequence > tb->_wheelSequence)  return NSOrderedDescending;
+	return NSOrderedSame;
+}
+
+
+#ifndef NDEBUG
+
+enum
+{
+	kBenchmarkTimerCount		= 50000,
+	kBenchmarkFrameCount		= 600,
+	kBenchmarkSparseTimerCount	= 300,
+	kBenchmarkSparseFrameCount	= 20000
+};
+
+#define kBenchmarkFrameLength	(1.0 / 60.0)
+
+
+@interface OOScriptTimerBenchmarkTimer: OOScriptTimer
+@end
+
+
+@implementation OOScriptTimerBenchmarkTimer
+
+- (void) timerFired
+{
+}
+
+@end
+
+
+// As -isValidForScheduling, but for a simulated time.
+static void BenchmarkReschedule(OOScriptTimer *timer, OOTimeAbsolute now)
+{
+	OOTimeDelta interval = [timer interval];
+	timer->_nextTime += ceil((now - timer->_nextTime) / interval) * interval;
+	if (timer->_nextTime <= now)  timer->_nextTime += interval;
+}
+
+
+OOINLINE double BenchmarkRandom(uint32_t *seed)
+{
+	*seed = *seed * 1664525 + 1013904223;
+	return (double)(*seed >> 8) / (double)(1 << 24);
+}
+
+
+/*	Fill in frame end times after base: fixed 60 fps frames, or frames of
+	1/30 s to 1/2 s, which cross tick and level boundaries without landing
+	on them.
+*/
+static void BenchmarkFrameTimes(OOTimeAbsolute *frameTimes, NSUInteger frameCount, OOTimeAbsolute base, BOOL variable, uint32_t seed)
+{
+	static const OOTimeDelta kVariableFrameLengths[] = { 1.0 / 30.0, 1.0 / 20.0, 0.1, 0.25, 0.5 };
+	NSUInteger i;
+	
+	for (i = 0; i < frameCount; i++)
+	{
+		if (variable)  base += kVariableFrameLengths[(NSUInteger)(BenchmarkRandom(&seed) * sizeof kVariableFrameLengths / sizeof *kVariableFrameLengths)];
+		else  base += kBenchmarkFrameLength;
+		frameTimes[i] = base;
+	}
+}
+
+
+/*	Run timerCount repeating timers with intervals in [minInterval,
+	maxInterval) over the given frames, once in a timer wheel and once in a
+	priority queue, and return the number of mismatches: frames where the two
+	fired different timers, timers fired out of order, and timers the wheel
+	fired in a later frame than the first one ending at or after their time.
+*/
+static NSUInteger BenchmarkRun(NSUInteger timerCount, OOTimeDelta minInterval, OOTimeDelta maxInterval, OOTimeAbsolute base, const OOTimeAbsolute *frameTimes, NSUInteger frameCount, uint32_t seed, OOTimeDelta *outWheelTime, OOTimeDelta *outQueueTime, NSUInteger *outFired, NSUInteger *outLate)
+{
+	NSMutableArray			*timers = [NSMutableArray arrayWithCapacity:timerCount];
+	NSMutableArray			*due = [NSMutableArray array];
+	OOTimeAbsolute			*firstTimes = malloc(timerCount * sizeof *firstTimes);
+	NSUInteger				*wheelFired = calloc(frameCount, sizeof *wheelFired);
+	unsigned long long		*wheelChecksums = calloc(frameCount, sizeof *wheelChecksums);
+	OOTimerWheel			*wheel = calloc(1, sizeof *wheel);
+	OOProfilingStopwatch	*stopwatch = [OOProfilingStopwatch stopwatch];
+	OOTimeDelta				wheelTime = 0, queueTime = 0;
+	OOTimeAbsolute			now, previous;
+	NSUInteger				i, frame, totalFired = 0, late = 0, mismatches = 0;
+	OOScriptTimer			*timer = nil;
+	
+	if (firstTimes == NULL || wheelFired == NULL || wheelChecksums == NULL || wheel == NULL)
+	{
+		free(firstTimes);
+		free(wheelFired);
+		free(wheelChecksums);
+		free(wheel);
+		return NSNotFound;
+	}
+	
+	for (i = 0; i < timerCount; i++)
+	{
+		OOTimeDelta interval = minInterval + (maxInterval - minInterval) * BenchmarkRandom(&seed);
+		firstTimes[i] = base + interval * BenchmarkRandom(&seed);
+		
+		timer = [[OOScriptTimerBenchmarkTimer alloc] initWithNextTime:firstTimes[i] interval:interval];
+		timer->_wheelSequence = i;
+		[timers addObject:timer];
+		[timer release];
+	}
+	
+	// Timer wheel.
+	wheel->currentTick = TickForTime(base);
+	foreach (timer, timers)  WheelInsert(wheel, timer);
+	
+	previous = base;
+	for (frame = 0; frame < frameCount; frame++)
+	{
+		now = frameTimes[frame];
+		OOTimeAbsolute lastTime = -INFINITY;
+		
+		[stopwatch reset];
+		WheelCollectDue(wheel, now, due);
+		[due sortUsingFunction:CompareTimersForFiring context:NULL];
+		foreach (timer, due)
+		{
+			timer->_wheelState = kTimerNotQueued;
+			[timer timerFired];
+			if (timer->_nextTime < lastTime)  mismatches++;		// Firing order.
+			if (timer->_nextTime <= previous)  late++;			// Should have fired last frame or earlier.
+			lastTime = timer->_nextTime;
+			wheelFired[frame]++;
+			wheelChecksums[frame] += timer->_wheelSequence;
+			
+			BenchmarkReschedule(timer, now);
+			WheelInsert(wheel, timer);
+		}
+		[due removeAllObjects];
+		wheelTime += [stopwatch reset];
+		
+		totalFired += wheelFired[frame];
+		previous = now;
+	}
+	
+	[due removeAllObjects];
+	WheelDetachAll(wheel, due);
+	[due removeAllObjects];
+	
+	// Priority queue, as before.
+	OOPriorityQueue *queue = [[OOPriorityQueue alloc] initWithComparator:@selector(compareByNextFireTime:)];
+	for (i = 0; i < timerCount; i++)
+	{
+		timer = [timers objectAtIndex:i];
+		timer->_nextTime = firstTimes[i];
+		[queue addObject:timer];
+	}
+	
+	for (frame = 0; frame < frameCount; frame++)
+	{
+		NSUInteger fired = 0;
+		unsigned long long checksum = 0;
+		now = frameTimes[frame];
+		
+		[stopwatch reset];
+		for (;;)
+		{
+			timer = [queue peekAtNextObject];
+			if (timer == nil || now < [timer nextTime])  break;
+			
+			[due addObject:timer];
+			[queue removeNextObject];
+			
+			[timer timerFired];
+			fired++;
+			checksum += timer->_wheelSequence;
+		}
+		foreach (timer, due)
+		{
+			BenchmarkReschedule(timer, now);
+			[queue addObject:timer];
+		}
+		[due removeAllObjects];
+		queueTime += [stopwatch reset];
+		
+		if (fired != wheelFired[frame] || checksum != wheelChecksums[frame])  mismatches++;
+	}
+	[queue release];
+	
+	free(firstTimes);
+	free(wheelFired);
+	free(wheelChecksums);
+	free(wheel);
+	
+	*outWheelTime = wheelTime;
+	*outQueueTime = queueTime;
+	*outFired = totalFired;
+	*outLate = late;
+	return mismatches + late;
+}
+
+
+NSString *OOScriptTimerRunBenchmark(void)
+{
+	NSAutoreleasePool		*pool = [[NSAutoreleasePool alloc] init];
+	NSUInteger				frameCount = MAX((NSUInteger)kBenchmarkFrameCount, (NSUInteger)kBenchmarkSparseFrameCount);
+	OOTimeAbsolute			*frameTimes = malloc(frameCount * sizeof *frameTimes);
+	OOTimeAbsolute			base = [UNIVERSE getTime];
+	OOTimeDelta				wheelTime = 0, queueTime = 0, unusedTime;
+	NSUInteger				fired = 0, variableFired = 0, sparseFired = 0;
+	NSUInteger				late = 0, variableLate = 0, sparseLate = 0;
+	NSUInteger				mismatches = 0, result;
+	
+	if (frameTimes == NULL)
+	{
+		[pool release];
+		return @"Could not allocate benchmark data.";
+	}
+	
+	// Timing: dense timers at a steady 60 fps.
+	BenchmarkFrameTimes(frameTimes, kBenchmarkFrameCount, base, NO, 0);
+	result = BenchmarkRun(kBenchmarkTimerCount, 0.05, 5.0, base, frameTimes, kBenchmarkFrameCount, 0x5eed71e5, &wheelTime, &queueTime, &fired, &late);
+	mismatches += result;
+	
+	// Correctness: the same timers with long and uneven frames.
+	if (result != NSNotFound)
+	{
+		BenchmarkFrameTimes(frameTimes, kBenchmarkFrameCount, base, YES, 0x0f4a3e5);
+		result = BenchmarkRun(kBenchmarkTimerCount, 0.05, 5.0, base, frameTimes, kBenchmarkFrameCount, 0x5eed71e5, &unusedTime, &unusedTime, &variableFired, &variableLate);
+		mismatches += result;
+	}
+	
+	/*	Correctness: a few timers up to five minutes apart, so the wheel skips
+		empty stretches and cascades from the higher levels.
+	*/
+	if (result != NSNotFound)
+	{
+		BenchmarkFrameTimes(frameTimes, kBenchmarkSparseFrameCount, base, YES, 0x5a4e5e);
+		result = BenchmarkRun(kBenchmarkSparseTimerCount, 1.0, 300.0, base, frameTimes, kBenchmarkSparseFrameCount, 0x5eed71e5, &unusedTime, &unusedTime, &sparseFired, &sparseLate);
+		mismatches += result;
+	}
+	
+	free(frameTimes);
+	if (result == NSNotFound)
+	{
+		[pool release];
+		return @"Could not allocate benchmark data.";
+	}
+	
+	double scale = 1e6 / kBenchmarkFrameCount;
+	NSString *report = [NSString stringWithFormat:@"%u repeating timers for %u frames, %lu fired: timer wheel %.1f us/frame, priority queue %.1f us/frame (%.1fx); variable frames: %lu fired, %lu late; %u sparse timers for %u variable frames: %lu fired, %lu late%@",
+						kBenchmarkTimerCount, kBenchmarkFrameCount, fired,
+						wheelTime * scale, queueTime * scale, (wheelTime > 0) ? queueTime / wheelTime : 0.0,
+						variableFired, variableLate,
+						kBenchmarkSparseTimerCount, kBenchmarkSparseFrameCount, sparseFired, sparseLate,
+						(mismatches == 0) ? @"" : [NSString stringWithFormat:@" ** %lu MISMATCHES **", mismatches]];
+	OOLog(@"script.timer.benchmark", @"%@", report);
+	
+	[report retain];
+	[pool release];
+	return [report autorelease];
+}
+
+#endif
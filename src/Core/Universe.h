@@ -37,6 +37,7 @@ MA 02110-1301, USA.
 #import "OOEntityWithDrawable.h"
 #import "OOCommodities.h"
 #import "OOSystemDescriptionManager.h"
+#import "OOCollisionBroadphase.h"
 
 #if OOLITE_ESPEAK
 #include <espeak/speak_lib.h>
@@ -45,11 +46,18 @@ MA 02110-1301, USA.
 @class	GameController, CollisionRegion, MyOpenGLView, GuiDisplayGen,
 	Entity, ShipEntity, StationEntity, OOPlanetEntity, OOSunEntity,
 	OOVisualEffectEntity, PlayerEntity, OORoleSet, WormholeEntity, 
-	DockEntity, OOJSScript, OOWaypointEntity, OOSystemDescriptionManager;
+	DockEntity, OOJSScript, OOWaypointEntity, OOSystemDescriptionManager,
+	OOShipBVH, OOEntitySpatialIndex, OOShipNeighbourCache, OOPhysicsStore;
 
 
 typedef BOOL (*EntityFilterPredicate)(Entity *entity, void *parameter);
 
+typedef struct OOEntitySnapshotBuffer
+{
+	Entity					**entities;
+	NSUInteger				capacity;
+} OOEntitySnapshotBuffer;
+
 #ifndef OO_SCANCLASS_TYPE
 #define OO_SCANCLASS_TYPE
 typedef enum OOScanClass OOScanClass;
@@ -172,8 +180,9 @@ enum
 {
 @public
 	// use a sorted list for drawing and other activities
-	Entity					*sortedEntities[UNIVERSE_MAX_ENTITIES + 1];	// One extra for padding; see -doRemoveEntity:.
+	Entity					**sortedEntities;	// Always at least one nil slot past n_entities for padding; see -doRemoveEntity:.
 	unsigned				n_entities;
+	unsigned				sortedEntitiesCapacity;
 	
 	int						cursor_row;
 	
@@ -197,8 +206,18 @@ enum
 	
 	MyOpenGLView			*gameView;
 	
-	int						next_universal_id;
-	Entity					*entity_for_uid[MAX_ENTITY_UID];
+	// Generational UID table, indexed by the slot part of an OOUniversalID.
+	Entity					**_uidEntities;
+	uint16_t				*_uidGenerations;
+	uint32_t				*_uidFreeSlots;
+	uint32_t				_uidSlotCapacity;
+	uint32_t				_uidSlotsUsed;		// High-water mark; slots at or above this have never been handed out.
+	uint32_t				_uidFreeSlotCount;
+	
+	// Reusable buffers for per-frame entity snapshots; see -beginEntitySnapshot:.
+	OOEntitySnapshotBuffer	*_snapshotBuffers;
+	NSUInteger				_snapshotBufferCount;
+	NSUInteger				_snapshotDepth;
 
 	NSMutableArray			*entities;
 	
@@ -303,6 +322,26 @@ enum
 	NSMutableArray			*characterPool;
 	
 	CollisionRegion			*universeRegion;
+	OOCollisionBroadphase	*collisionBroadphase;
+	OOCollisionBroadphaseMode	collisionBroadphaseMode;
+	
+	BOOL					parallelEntityUpdate;
+	BOOL					batchShipIntegration;
+	OOPhysicsStore			*physicsStore;				// Movement of ships in batch integration, this update.
+	
+	// Laser hit-scan tree, built on demand once per update.
+	OOShipBVH				*shipBVH;
+	BOOL					shipBVHValid;
+	
+	// Index for range-limited predicate queries, built on demand once per update.
+	OOEntitySpatialIndex	*entityIndex;
+	BOOL					entityIndexValid;
+	BOOL					entityIndexInUse;			// A nearest-entity search is walking the index.
+	NSUInteger				entityIndexSkips;			// Entity evaluations the index avoided, this update.
+	NSUInteger				lastEntityIndexSkips;		// The same for the last complete update.
+	
+	// Ships near each ship, for AI scanning, built on demand once per update.
+	OOShipNeighbourCache	*shipNeighbourCache;
 	
 	// check and maintain linked lists occasionally
 	BOOL					doLinkedListMaintenanceThisUpdate;
@@ -514,6 +553,14 @@ enum
 - (void) removeAllEntitiesExceptPlayer;
 - (void) removeDemoShips;
 
+/*	Scratch buffers for copying the entity list so it can be walked while it
+	changes. Snapshots nest, and are ended in reverse order. Entities in a
+	snapshot are not retained: an entity removed from the universe is kept
+	alive by entitiesDeadThisUpdate until the end of the next update.
+*/
+- (Entity **) beginEntitySnapshot:(NSUInteger)capacity;
+- (void) endEntitySnapshot:(Entity **)snapshot;
+
 - (ShipEntity *) makeDemoShipWithRole:(NSString *)role spinning:(BOOL)spinning;
 
 - (BOOL) isVectorClearFromEntity:(Entity *) e1 toDistance:(double)dist fromPoint:(HPVector) p2;
@@ -564,12 +611,25 @@ enum
 						  parameter:(void *)parameter
 				   relativeToEntity:(Entity *)entity;
 
+/*	Range-limited searches use spatial indexes which allow for an update's
+	worth of normal motion. Call this when an entity is moved any other way,
+	such as by a script, so they are rebuilt before the next search.
+*/
+- (void) noteEntityRepositioned:(Entity *)entity;
+
+/*	Shared per-update cache of the ships near each ship; see
+	OOShipNeighbourCache.h. It is rebuilt, if needed, before it is returned.
+*/
+- (OOShipNeighbourCache *) shipNeighbourCache;
+
 
 @property (getter=getTime, readonly) OOTimeAbsolute time;
 @property (getter=getTimeDelta, readonly) OOTimeDelta timeDelta;
 
 - (void) findCollisionsAndShadows;
 @property (readonly, copy, atomic) NSString *collisionDescription;
+// Selects the collision broadphase; the sweep-and-prune lists are kept for A/B comparison. Persisted in the "collision-broadphase" default.
+@property (nonatomic) OOCollisionBroadphaseMode collisionBroadphaseMode;
 - (void) dumpCollisions;
 
 @property (nonatomic) OOViewID viewDirection;
@@ -594,6 +654,26 @@ enum
 
 - (void) update:(OOTimeDelta)delta_t;
 
+/*	When on, entities whose canUpdateConcurrently is YES are updated on the
+	OOJobPool after the other entities, instead of in list order. Persisted in
+	the "parallel-entity-update" default.
+*/
+@property (nonatomic) BOOL parallelEntityUpdate;
+
+/*	When on, ships whose canIntegrateInBatch is YES record their movement
+	during the update loop, and it is applied to all of them at once
+	afterwards; see OOPhysicsStore.h. Persisted in the
+	"batch-ship-integration" default.
+*/
+@property (nonatomic) BOOL batchShipIntegration;
+#ifndef NDEBUG
+/*	Build two identical sets of concurrently-updatable effects, run one
+	through the serial path and one through the job pool for the given number
+	of ticks, and compare their positions. Returns a summary.
+*/
+- (NSString *) checkParallelEntityUpdateDeterminism:(NSUInteger)ticks;
+#endif
+
 // Time Acelleration Factor. In deployment builds, this is always 1.0 and -setTimeAccelerationFactor: does nothing.
 @property (atomic) double timeAccelerationFactor;
 
@@ -79,9 +79,17 @@ MA 02110-1301, USA.
 #import "OOLightParticleEntity.h"
 #import "OOFlashEffectEntity.h"
 #import "OOExplosionCloudEntity.h"
+#import "OOSparkEntity.h"
+#import "OOPlasmaBurstEntity.h"
 #import "OOSystemDescriptionManager.h"
 #import "OOMusicController.h"
 #import "OOAsyncWorkManager.h"
+#import "OOJobPool.h"
+#import "OOShipBVH.h"
+#import "OOEntitySpatialIndex.h"
+#import "OOShipNeighbourCache.h"
+#import "OOPhysicsStore.h"
+#import "OOProfilingStopwatch.h"
 #import "OODebugFlags.h"
 #import "OODebugStandards.h"
 #import "OOLoggingExtended.h"
@@ -129,8 +137,21 @@ Entity *gOOJSPlayerIfStale = nil;
 
 
 static BOOL MaintainLinkedLists(Universe* uni);
+OOINLINE void BubbleEntityInSortedList(Universe *uni, Entity *thing);
+static void ConcurrentEntityUpdate(void *context, NSUInteger index);
 OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range);
 
+enum
+{
+	kConcurrentUpdateGrain	= 16	// Entities per job pool chunk in the parallel update stage.
+};
+
+typedef struct
+{
+	Entity					**entities;
+	OOTimeDelta				delta_t;
+} OOConcurrentUpdateJob;
+
 static OOComparisonResult compareName(id dict1, id dict2, void * context);
 static OOComparisonResult comparePrice(id dict1, id dict2, void * context);
 
@@ -184,6 +205,14 @@ static OOComparisonResult comparePrice(id dict1, id dict2, void * context);
 @interface Universe ()
 
 - (BOOL) doRemoveEntity:(Entity *)entity;
+- (BOOL) growSortedEntities;
+- (void) resetUniversalIDs;
+- (OOUniversalID) allocateUniversalIDForEntity:(Entity *)entity;
+- (void) freeUniversalID:(OOUniversalID)uid ofEntity:(Entity *)entity;
+- (OOShipBVH *) shipBVH;
+- (OOEntitySpatialIndex *) entitySpatialIndex;
+- (NSUInteger) getEntities:(Entity ***)outEntities inRange:(double)range ofPoint:(HPVector)point;
+- (void) finishBatchShipIntegration:(OOTimeDelta)delta_t;
 - (void) setUpCargoPods;
 - (void) setUpInitialUniverse;
 - (HPVector) fractionalPositionFrom:(HPVector)point0 to:(HPVector)point1 withFraction:(double)routeFraction;
@@ -307,6 +336,9 @@ static GLfloat	docked_light_specular[4]	= { DOCKED_ILLUM_LEVEL, DOCKED_ILLUM_LEV
 	autoSave = [prefs oo_boolForKey:@"autosave" defaultValue:NO];
 	wireframeGraphics = [prefs oo_boolForKey:@"wireframe-graphics" defaultValue:NO];
 	doProcedurallyTexturedPlanets = [prefs oo_boolForKey:@"procedurally-textured-planets" defaultValue:YES];
+	collisionBroadphaseMode = OOCollisionBroadphaseModeFromString([prefs oo_stringForKey:@"collision-broadphase"]);
+	parallelEntityUpdate = [prefs oo_boolForKey:@"parallel-entity-update" defaultValue:NO];
+	batchShipIntegration = [prefs oo_boolForKey:@"batch-ship-integration" defaultValue:NO];
 	[inGameView setGammaValue:[prefs oo_floatForKey:@"gamma-value" defaultValue:1.0f]];
 	[inGameView setFov:OOClamp_0_max_f([prefs oo_floatForKey:@"fov-value" defaultValue:57.2f], MAX_FOV_DEG) fromFraction:NO];
 	if ([inGameView fov:NO] < MIN_FOV_DEG)  [inGameView setFov:MIN_FOV_DEG fromFraction:NO];
@@ -348,6 +380,7 @@ static GLfloat	docked_light_specular[4]	= { DOCKED_ILLUM_LEVEL, DOCKED_ILLUM_LEV
 	[OOShipRegistry sharedRegistry];
 	
 	entities = [[NSMutableArray arrayWithCapacity:MAX_NUMBER_OF_ENTITIES] retain];
+	[self growSortedEntities];
 	
 	[[GameController sharedController] logProgress:OOExpandKeyRandomized(@"loading-miscellany")];
 	
@@ -444,6 +477,11 @@ static GLfloat	docked_light_specular[4]	= { DOCKED_ILLUM_LEVEL, DOCKED_ILLUM_LEV
 	[activeWormholes release];				
 	[characterPool release];
 	[universeRegion release];
+	[collisionBroadphase release];
+	[shipBVH release];
+	[entityIndex release];
+	[shipNeighbourCache release];
+	[physicsStore release];
 	[cargoPods release];
 
 	DESTROY(_firstBeacon);
@@ -455,6 +493,13 @@ static GLfloat	docked_light_specular[4]	= { DOCKED_ILLUM_LEVEL, DOCKED_ILLUM_LEV
 	
 	[entitiesDeadThisUpdate release];
 	
+	free(sortedEntities);
+	free(_uidEntities);
+	free(_uidGenerations);
+	free(_uidFreeSlots);
+	for (i = 0; i < _snapshotBufferCount; i++)  free(_snapshotBuffers[i].entities);
+	free(_snapshotBuffers);
+	
 	[[OOCacheManager sharedCache] flush];
 	
 #if OOLITE_SPEECH_SYNTH
@@ -4290,6 +4335,8 @@ static const OOMatrix	starboard_matrix =
 	OOLog(@"universe.profile.draw", @"%@", @"Begin draw");
 	if (!no_update)
 	{
+		Entity ** volatile my_entities = NULL;
+		
 		@try
 		{
 			no_update = YES;	// block other attempts to draw
@@ -4298,7 +4345,6 @@ static const OOMatrix	starboard_matrix =
 			Vector			view_dir, view_up;
 			OOMatrix		view_matrix;
 			int				ent_count =	n_entities;
-			Entity			*my_entities[ent_count];
 			int				draw_count = 0;
 			PlayerEntity	*player = PLAYER;
 			Entity			*drawthing = nil;
@@ -4314,7 +4360,8 @@ static const OOMatrix	starboard_matrix =
 				else [UNIVERSE setMainLightPosition:kZeroVector];
 			}
 			wasDisplayGUI = displayGUI;
-			// use a non-mutable copy so this can't be changed under us.
+			// use a snapshot so this can't be changed under us.
+			my_entities = [self beginEntitySnapshot:ent_count];
 			for (i = 0; i < ent_count; i++)
 			{
 				/* BUG: this list is ordered nearest to furthest from
@@ -4325,7 +4372,7 @@ static const OOMatrix	starboard_matrix =
 				Entity *e = sortedEntities[i]; // ordered NEAREST -> FURTHEST AWAY
 				if ([e isVisible])
 				{
-					my_entities[draw_count++] = [[e retain] autorelease];
+					my_entities[draw_count++] = e;
 				}
 			}
 			
@@ -4590,6 +4637,8 @@ static const OOMatrix	starboard_matrix =
 
 			}
 			
+			[self endEntitySnapshot:my_entities];
+			my_entities = NULL;
 
 			/* Reset for HUD drawing */
 			OOGLResetProjection();
@@ -4681,6 +4730,7 @@ static const OOMatrix	starboard_matrix =
 		@catch (NSException *exception)
 		{
 			no_update = NO;	// make sure we don't get stuck in all subsequent frames.
+			if (my_entities != NULL)  [self endEntitySnapshot:my_entities];
 			
 			if ([[exception name] hasPrefix:@"Oolite"])
 			{
@@ -4748,19 +4798,28 @@ static const OOMatrix	starboard_matrix =
 
 - (id)entityForUniversalID:(OOUniversalID)u_id
 {
-	if (u_id == 100)
+	if (u_id == MIN_ENTITY_UID)
 		return PLAYER;	// the player
 	
-	if (MAX_ENTITY_UID < u_id)
+	if (u_id == NO_TARGET)
+		return nil;
+	
+	uint32_t slot = u_id & kOOUniversalIDSlotMask;
+	uint32_t generation = u_id >> kOOUniversalIDSlotBits;
+	if (EXPECT_NOT(generation > kOOUniversalIDGenerationMask))
 	{
 		OOLog(@"universe.badUID", @"Attempt to retrieve entity for out-of-range UID %u. (This is an internal programming error, please report it.)", u_id);
 		return nil;
 	}
 	
-	if ((u_id == NO_TARGET)||(!entity_for_uid[u_id]))
+	// A generation mismatch means the slot has been freed, and possibly reused, since u_id was handed out.
+	if (slot >= _uidSlotsUsed || _uidGenerations[slot] != generation)
+		return nil;
+	
+	Entity *ent = _uidEntities[slot];
+	if (ent == nil)
 		return nil;
 	
-	Entity *ent = entity_for_uid[u_id];
 	if ([ent isEffect])	// effects SHOULD NOT HAVE U_IDs!
 	{
 		return nil;
@@ -4775,6 +4834,160 @@ static const OOMatrix	starboard_matrix =
 }
 
 
+- (BOOL) growSortedEntities
+{
+	unsigned newCapacity = sortedEntitiesCapacity != 0 ? sortedEntitiesCapacity * 2 : 256;
+	if (newCapacity > UNIVERSE_MAX_ENTITIES + 1)  newCapacity = UNIVERSE_MAX_ENTITIES + 1;
+	if (newCapacity <= sortedEntitiesCapacity)  return NO;
+	
+	Entity **newEntities = realloc(sortedEntities, newCapacity * sizeof *newEntities);
+	if (EXPECT_NOT(newEntities == NULL))  return NO;
+	
+	// Everything past n_entities must be nil; see -doRemoveEntity:.
+	memset(newEntities + sortedEntitiesCapacity, 0, (newCapacity - sortedEntitiesCapacity) * sizeof *newEntities);
+	sortedEntities = newEntities;
+	sortedEntitiesCapacity = newCapacity;
+	return YES;
+}
+
+
+- (void) resetUniversalIDs
+{
+	/*	Bump the generation of every slot handed out so far, so that IDs from
+		before the reset can't match an entity added after it. The player
+		slot is exempt, since the player's ID is always MIN_ENTITY_UID.
+	*/
+	uint32_t i;
+	for (i = MIN_ENTITY_UID + 1; i < _uidSlotsUsed; i++)
+	{
+		_uidGenerations[i] = (_uidGenerations[i] + 1) & kOOUniversalIDGenerationMask;
+		_uidEntities[i] = nil;
+	}
+	if (_uidEntities != NULL)  _uidEntities[MIN_ENTITY_UID] = nil;
+	
+	_uidSlotsUsed = MIN_ENTITY_UID + 1;
+	_uidFreeSlotCount = 0;
+}
+
+
+- (OOUniversalID) allocateUniversalIDForEntity:(Entity *)entity
+{
+	uint32_t slot;
+	
+	if (_uidSlotsUsed == 0)  _uidSlotsUsed = MIN_ENTITY_UID + 1;
+	
+	if ([entity isPlayer])
+	{
+		slot = MIN_ENTITY_UID;
+	}
+	else if (_uidFreeSlotCount > 0)
+	{
+		slot = _uidFreeSlots[--_uidFreeSlotCount];
+	}
+	else
+	{
+		if (_uidSlotsUsed > kOOUniversalIDSlotMask)  return NO_TARGET;
+		slot = _uidSlotsUsed;
+	}
+	
+	if (slot >= _uidSlotCapacity)
+	{
+		uint32_t newCapacity = _uidSlotCapacity != 0 ? _uidSlotCapacity * 2 : 1024;
+		while (newCapacity <= slot)  newCapacity *= 2;
+		
+		Entity **newEntities = realloc(_uidEntities, newCapacity * sizeof *newEntities);
+		if (EXPECT_NOT(newEntities == NULL))  return NO_TARGET;
+		_uidEntities = newEntities;
+		uint16_t *newGenerations = realloc(_uidGenerations, newCapacity * sizeof *newGenerations);
+		if (EXPECT_NOT(newGenerations == NULL))  return NO_TARGET;
+		_uidGenerations = newGenerations;
+		// The free list can never hold more than every slot.
+		uint32_t *newFreeSlots = realloc(_uidFreeSlots, newCapacity * sizeof *newFreeSlots);
+		if (EXPECT_NOT(newFreeSlots == NULL))  return NO_TARGET;
+		_uidFreeSlots = newFreeSlots;
+		
+		memset(_uidEntities + _uidSlotCapacity, 0, (newCapacity - _uidSlotCapacity) * sizeof *_uidEntities);
+		memset(_uidGenerations + _uidSlotCapacity, 0, (newCapacity - _uidSlotCapacity) * sizeof *_uidGenerations);
+		_uidSlotCapacity = newCapacity;
+	}
+	
+	if (slot == _uidSlotsUsed)  _uidSlotsUsed++;
+	_uidEntities[slot] = entity;
+	
+	return slot | ((OOUniversalID)_uidGenerations[slot] << kOOUniversalIDSlotBits);
+}
+
+
+- (void) freeUniversalID:(OOUniversalID)uid ofEntity:(Entity *)entity
+{
+	uint32_t slot = uid & kOOUniversalIDSlotMask;
+	if (uid == NO_TARGET || slot >= _uidSlotsUsed)  return;
+	
+	// Only clear the slot if it hasn't been reused, e.g. across -resetUniversalIDs.
+	if (_uidEntities[slot] != entity || _uidGenerations[slot] != (uid >> kOOUniversalIDSlotBits))  return;
+	
+	_uidEntities[slot] = nil;
+	if (slot != MIN_ENTITY_UID)
+	{
+		_uidGenerations[slot] = (_uidGenerations[slot] + 1) & kOOUniversalIDGenerationMask;
+		_uidFreeSlots[_uidFreeSlotCount++] = slot;
+	}
+}
+
+
+- (Entity **) beginEntitySnapshot:(NSUInteger)capacity
+{
+	if (_snapshotDepth == _snapshotBufferCount)
+	{
+		NSUInteger newCount = _snapshotBufferCount + 4;
+		OOEntitySnapshotBuffer *newBuffers = realloc(_snapshotBuffers, newCount * sizeof *newBuffers);
+		if (EXPECT_NOT(newBuffers == NULL))
+		{
+			[NSException raise:NSMallocException format:@"Could not allocate entity snapshot buffer."];
+		}
+		memset(newBuffers + _snapshotBufferCount, 0, (newCount - _snapshotBufferCount) * sizeof *newBuffers);
+		_snapshotBuffers = newBuffers;
+		_snapshotBufferCount = newCount;
+	}
+	
+	OOEntitySnapshotBuffer *buffer = &_snapshotBuffers[_snapshotDepth];
+	if (buffer->capacity < capacity || buffer->entities == NULL)
+	{
+		NSUInteger newCapacity = MAX(capacity, MAX(buffer->capacity * 2, (NSUInteger)256));
+		Entity **newEntities = realloc(buffer->entities, newCapacity * sizeof *newEntities);
+		if (EXPECT_NOT(newEntities == NULL))
+		{
+			[NSException raise:NSMallocException format:@"Could not allocate entity snapshot buffer."];
+		}
+		buffer->entities = newEntities;
+		buffer->capacity = newCapacity;
+	}
+	
+	_snapshotDepth++;
+	return buffer->entities;
+}
+
+
+- (void) endEntitySnapshot:(Entity **)snapshot
+{
+	/*	Pop back to the given snapshot. Normally it is the innermost one; if
+		an exception skipped some -endEntitySnapshot: calls, this also
+		recovers the buffers they left behind.
+	*/
+	NSUInteger depth = _snapshotDepth;
+	while (depth > 0)
+	{
+		depth--;
+		if (_snapshotBuffers[depth].entities == snapshot)
+		{
+			_snapshotDepth = depth;
+			return;
+		}
+	}
+	OOLog(kOOLogInconsistentState, @"***** Universe endEntitySnapshot: called with a buffer that is not an active snapshot. (This is an internal programming error, please report it.)");
+}
+
+
 static BOOL MaintainLinkedLists(Universe *uni)
 {
 	NSCParameterAssert(uni != NULL);
@@ -4914,6 +5127,30 @@ static BOOL MaintainLinkedLists(Universe *uni)
 }
 
 
+OOINLINE void BubbleEntityInSortedList(Universe *uni, Entity *thing)
+{
+	Entity		**sortedEntities = uni->sortedEntities;
+	GLfloat		z_distance = thing->zero_distance;
+	int			index = thing->zero_index;
+	
+	while (index > 0 && z_distance < sortedEntities[index - 1]->zero_distance)
+	{
+		sortedEntities[index] = sortedEntities[index - 1];	// bubble up the list, usually by just one position
+		sortedEntities[index - 1] = thing;
+		thing->zero_index = index - 1;
+		sortedEntities[index]->zero_index = index;
+		index--;
+	}
+}
+
+
+static void ConcurrentEntityUpdate(void *context, NSUInteger index)
+{
+	OOConcurrentUpdateJob *job = context;
+	[job->entities[index] update:job->delta_t];
+}
+
+
 - (BOOL) addEntity:(Entity *) entity
 {
 	if (entity)
@@ -4928,7 +5165,7 @@ static BOOL MaintainLinkedLists(Universe *uni)
 		if ([entities containsObject:entity])
 			return YES;
 		
-		if (n_entities >= UNIVERSE_MAX_ENTITIES - 1)
+		if (n_entities >= UNIVERSE_MAX_ENTITIES - 1 || (n_entities + 2 > sortedEntitiesCapacity && ![self growSortedEntities]))
 		{
 			// throw an exception here...
 			OOLog(@"universe.addEntity.failed", @"***** Universe cannot addEntity:%@ -- Universe is full (%d entities out of %d)", entity, n_entities, UNIVERSE_MAX_ENTITIES);
@@ -4940,26 +5177,19 @@ static BOOL MaintainLinkedLists(Universe *uni)
 		
 		if (![entity isEffect])
 		{
-			unsigned limiter = UNIVERSE_MAX_ENTITIES;
-			while (entity_for_uid[next_universal_id] != nil)	// skip allocated numbers
+			OOUniversalID uid = [self allocateUniversalIDForEntity:entity];
+			if (uid == NO_TARGET)
 			{
-				next_universal_id++;						// increment keeps idkeys unique
-				if (next_universal_id >= MAX_ENTITY_UID)
-				{
-					next_universal_id = MIN_ENTITY_UID;
-				}
-				if (limiter-- == 0)
-				{
-					// Every slot has been tried! This should not happen due to previous test, but there was a problem here in 1.70.
-					OOLog(@"universe.addEntity.failed", @"***** Universe cannot addEntity:%@ -- Could not find free slot for entity.", entity);
-					return NO;
-				}
+				OOLog(@"universe.addEntity.failed", @"***** Universe cannot addEntity:%@ -- Could not find free slot for entity.", entity);
+				return NO;
 			}
-			[entity setUniversalID:next_universal_id];
-			entity_for_uid[next_universal_id] = entity;
+			[entity setUniversalID:uid];
+			entityIndexValid = NO;
 			if ([entity isShip])
 			{
 				se = (ShipEntity *)entity;
+				shipBVHValid = NO;
+				[shipNeighbourCache invalidate];
 				if ([se isBeacon])
 				{
 					[self setNextBeacon:se];
@@ -5232,9 +5462,8 @@ static BOOL MaintainLinkedLists(Universe *uni)
 	
 	int i;
 	int ent_count = n_entities;
-	Entity* my_entities[ent_count];
-	for (i = 0; i < ent_count; i++)
-		my_entities[i] = [sortedEntities[i] retain]; //	retained
+	Entity **my_entities = [self beginEntitySnapshot:ent_count];
+	memcpy(my_entities, sortedEntities, ent_count * sizeof *my_entities);
 	
 	if (v1.x || v1.y || v1.z)
 		f1 = HPvector_normal(v1);   // unit vector in direction of p2 from p1
@@ -5263,15 +5492,13 @@ static BOOL MaintainLinkedLists(Universe *uni)
 				double  dist2 = p0.x * p0.x + p0.y * p0.y + p0.z * p0.z;
 				if (dist2 < cr*cr)
 				{
-					for (i = 0; i < ent_count; i++)
-						[my_entities[i] release]; //	released
+					[self endEntitySnapshot:my_entities];
 					return NO;
 				}
 			}
 		}
 	}
-	for (i = 0; i < ent_count; i++)
-		[my_entities[i] release]; //	released
+	[self endEntitySnapshot:my_entities];
 	return YES;
 }
 
@@ -5294,9 +5521,8 @@ static BOOL MaintainLinkedLists(Universe *uni)
 	Entity* result = nil;
 	int i;
 	int ent_count = n_entities;
-	Entity* my_entities[ent_count];
-	for (i = 0; i < ent_count; i++)
-		my_entities[i] = [sortedEntities[i] retain]; //	retained
+	Entity **my_entities = [self beginEntitySnapshot:ent_count];
+	memcpy(my_entities, sortedEntities, ent_count * sizeof *my_entities);
 	
 	if (v1.x || v1.y || v1.z)
 		f1 = HPvector_normal(v1);   // unit vector in direction of p2 from p1
@@ -5328,8 +5554,7 @@ static BOOL MaintainLinkedLists(Universe *uni)
 			}
 		}
 	}
-	for (i = 0; i < ent_count; i++)
-		[my_entities[i] release]; //	released
+	[self endEntitySnapshot:my_entities];
 	return result;
 }
 
@@ -5348,9 +5573,8 @@ static BOOL MaintainLinkedLists(Universe *uni)
 	HPVector  result = p2;
 	int i;
 	int ent_count = n_entities;
-	Entity* my_entities[ent_count];
-	for (i = 0; i < ent_count; i++)
-		my_entities[i] = [sortedEntities[i] retain];	// retained
+	Entity **my_entities = [self beginEntitySnapshot:ent_count];
+	memcpy(my_entities, sortedEntities, ent_count * sizeof *my_entities);
 	HPVector p1 = e1->position;
 	HPVector v1 = p2;
 	v1.x -= p1.x;   v1.y -= p1.y;   v1.z -= p1.z;   // vector from entity to p2
@@ -5438,8 +5662,7 @@ static BOOL MaintainLinkedLists(Universe *uni)
 			}
 		}
 	}
-	for (i = 0; i < ent_count; i++)
-		[my_entities[i] release]; //	released
+	[self endEntitySnapshot:my_entities];
 	return result;
 }
 
@@ -5505,12 +5728,147 @@ static BOOL MaintainLinkedLists(Universe *uni)
 }
 
 
+typedef struct
+{
+	OOShipBVH			*bvh;
+	ShipEntity			*source;
+	ShipEntity			*parent;
+	HPVector			p0;
+	Vector				r1, u1, f1;
+	ShipEntity			*hitEntity;
+	ShipEntity			*hitSubentity;
+} LaserHitScan;
+
+
+static GLfloat LaserHitScanTestShip(void *context, NSUInteger bodyIndex, GLfloat nearest)
+{
+	LaserHitScan *scan = context;
+	ShipEntity *e2 = [scan->bvh shipAtIndex:bodyIndex];
+	if (e2 == scan->source || e2 == scan->parent || ![e2 canCollide])  return nearest;
+	
+	// check outermost bounding sphere
+	GLfloat cr = e2->collision_radius;
+	Vector rpos = HPVectorToVector(HPvector_subtract(e2->position, scan->p0));
+	Vector v_off = make_vector(dot_product(rpos, scan->r1), dot_product(rpos, scan->u1), dot_product(rpos, scan->f1));
+	if (v_off.z > 0.0 && v_off.z < nearest + cr &&								// ahead AND within range
+		v_off.x < cr && v_off.x > -cr && v_off.y < cr && v_off.y > -cr &&		// AND not off to one side or another
+		v_off.x * v_off.x + v_off.y * v_off.y < cr * cr)						// AND not off to both sides
+	{
+		HPVector p1 = HPvector_add(scan->p0, vectorToHPVector(vector_multiply_scalar(scan->f1, nearest)));	//endpoint
+		ShipEntity *entHit = nil;
+		GLfloat hit = [e2 doesHitLine:scan->p0 :p1 :&entHit];	// octree detection
+		
+		if (hit > 0.0 && hit < nearest)
+		{
+			if ([entHit isSubEntity])
+			{
+				scan->hitSubentity = entHit;
+			}
+			scan->hitEntity = e2;
+			nearest = hit;
+		}
+	}
+	
+	return nearest;
+}
+
+
+- (OOShipBVH *) shipBVH
+{
+	if (!shipBVHValid)
+	{
+		if (shipBVH == nil)  shipBVH = [[OOShipBVH alloc] init];
+		
+		unsigned i, ship_count = 0;
+		ShipEntity **ships = (ShipEntity **)[self beginEntitySnapshot:n_entities];
+		for (i = 0; i < n_entities; i++)
+		{
+			Entity *ent = sortedEntities[i];
+			if ([ent isShip] && [ent canCollide])  ships[ship_count++] = (ShipEntity *)ent;
+		}
+		
+		// During an update, some ships have moved already and some have yet to; allow for a frame's movement.
+		[shipBVH rebuildWithShips:ships count:ship_count motionTime:time_delta];
+		[self endEntitySnapshot:(Entity **)ships];
+		shipBVHValid = YES;
+	}
+	
+	return shipBVH;
+}
+
+
+- (OOEntitySpatialIndex *) entitySpatialIndex
+{
+	if (!entityIndexValid)
+	{
+		if (entityIndex == nil)  entityIndex = [[OOEntitySpatialIndex alloc] init];
+		
+		// As with the laser BVH, allow for a frame's movement.
+		[entityIndex rebuildWithEntities:sortedEntities count:n_entities motionTime:time_delta];
+		entityIndexValid = YES;
+	}
+	
+	return entityIndex;
+}
+
+
+static int CompareZeroIndex(const void *a, const void *b)
+{
+	int indexA = (*(Entity * const *)a)->zero_index;
+	int indexB = (*(Entity * const *)b)->zero_index;
+	return (indexA > indexB) - (indexA < indexB);
+}
+
+
+/*	Get the entities which may be within range of point, in sortedEntities
+	order, in a snapshot which the caller must end with -endEntitySnapshot:.
+	The caller must still test the range against current positions.
+*/
+- (NSUInteger) getEntities:(Entity ***)outEntities inRange:(double)range ofPoint:(HPVector)point
+{
+	OOEntitySpatialIndex *index = [self entitySpatialIndex];
+	Entity **candidates = [self beginEntitySnapshot:[index entityCount]];
+	NSUInteger i, count = 0, found = [index getEntities:candidates inSphere:point radius:range];
+	
+	for (i = 0; i < found; i++)
+	{
+		if (candidates[i]->zero_index >= 0)  candidates[count++] = candidates[i];
+	}
+	qsort(candidates, count, sizeof *candidates, CompareZeroIndex);
+	entityIndexSkips += n_entities - MIN(n_entities, count);
+	
+	*outEntities = candidates;
+	return count;
+}
+
+
+- (void) noteEntityRepositioned:(Entity *)entity
+{
+	entityIndexValid = NO;
+	if ([entity isShip])
+	{
+		shipBVHValid = NO;
+		[shipNeighbourCache invalidate];
+	}
+}
+
+
+- (OOShipNeighbourCache *) shipNeighbourCache
+{
+	if (![shipNeighbourCache isValid])
+	{
+		if (shipNeighbourCache == nil)  shipNeighbourCache = [[OOShipNeighbourCache alloc] init];
+		[shipNeighbourCache rebuildWithEntities:sortedEntities count:n_entities motionTime:time_delta];
+	}
+	
+	return shipNeighbourCache;
+}
+
+
 - (ShipEntity *) firstShipHitByLaserFromShip:(ShipEntity *)srcEntity inDirection:(OOWeaponFacing)direction offset:(Vector)offset gettingRangeFound:(GLfloat *)range_ptr
 {
 	if (srcEntity == nil) return nil;
 	
-	ShipEntity		*hit_entity = nil;
-	ShipEntity		*hit_subentity = nil;
 	HPVector			p0 = [srcEntity position];
 	Quaternion		q1 = [srcEntity normalOrientation];
 	ShipEntity		*parent = [srcEntity parentEntity];
@@ -5525,21 +5883,7 @@ static BOOL MaintainLinkedLists(Universe *uni)
 		if ([parent isPlayer])  q1.w = -q1.w;
 	}
 	
-	double			nearest = [srcEntity weaponRange];
-	int				i;
-	int				ent_count = n_entities;
-	int				ship_count = 0;
-	ShipEntity		*my_entities[ent_count];
-	
-	for (i = 0; i < ent_count; i++)
-	{
-		Entity* ent = sortedEntities[i];
-		if (ent != srcEntity && ent != parent && [ent isShip] && [ent canCollide])
-		{
-			my_entities[ship_count++] = [(ShipEntity *)ent retain];
-		}
-	}
-	
+	GLfloat			nearest = [srcEntity weaponRange];
 	
 	Vector u1, f1, r1;
 	basis_vectors_from_quaternion(q1, &r1, &u1, &f1);
@@ -5565,36 +5909,15 @@ static BOOL MaintainLinkedLists(Universe *uni)
 	}
 	
 	basis_vectors_from_quaternion(q1, &r1, NULL, &f1);
-	HPVector p1 = HPvector_add(p0, vectorToHPVector(vector_multiply_scalar(f1, nearest)));	//endpoint
 	
-	for (i = 0; i < ship_count; i++)
-	{
-		ShipEntity *e2 = my_entities[i];
-		
-		// check outermost bounding sphere
-		GLfloat cr = e2->collision_radius;
-		Vector rpos = HPVectorToVector(HPvector_subtract(e2->position, p0));
-		Vector v_off = make_vector(dot_product(rpos, r1), dot_product(rpos, u1), dot_product(rpos, f1));
-		if (v_off.z > 0.0 && v_off.z < nearest + cr &&								// ahead AND within range
-			v_off.x < cr && v_off.x > -cr && v_off.y < cr && v_off.y > -cr &&		// AND not off to one side or another
-			v_off.x * v_off.x + v_off.y * v_off.y < cr * cr)						// AND not off to both sides
-		{
-			ShipEntity *entHit = nil;
-			GLfloat hit = [(ShipEntity *)e2 doesHitLine:p0 :p1 :&entHit];	// octree detection
-			
-			if (hit > 0.0 && hit < nearest)
-			{
-				if ([entHit isSubEntity])
-				{
-					hit_subentity = entHit;
-				}
-				hit_entity = e2;
-				nearest = hit;
-				p1 = HPvector_add(p0, vectorToHPVector(vector_multiply_scalar(f1, nearest)));
-			}
-		}
-	}
+	/*	Walk the ship tree front to back; each hit shortens the ray, so ships
+		beyond it are never looked at.
+	*/
+	LaserHitScan scan = { [self shipBVH], srcEntity, parent, p0, r1, u1, f1, nil, nil };
+	nearest = [scan.bvh castRayFrom:p0 direction:f1 range:nearest callback:LaserHitScanTestShip context:&scan];
 	
+	ShipEntity *hit_entity = scan.hitEntity;
+	ShipEntity *hit_subentity = scan.hitSubentity;
 	if (hit_entity)
 	{
 		// I think the above code does not guarantee that the closest hit_subentity belongs to the closest hit_entity.
@@ -5606,8 +5929,6 @@ static BOOL MaintainLinkedLists(Universe *uni)
 		}
 	}
 	
-	for (i = 0; i < ship_count; i++)  [my_entities[i] release]; //	released
-	
 	return hit_entity;
 }
 
@@ -5621,13 +5942,13 @@ static BOOL MaintainLinkedLists(Universe *uni)
 	int				i;
 	int				ent_count = n_entities;
 	int				ship_count = 0;
-	Entity			*my_entities[ent_count];
+	Entity			**my_entities = [self beginEntitySnapshot:ent_count];
 	
 	for (i = 0; i < ent_count; i++)
 	{
 		if (([sortedEntities[i] isShip] && ![sortedEntities[i] isPlayer]) || [sortedEntities[i] isWormhole])
 		{
-			my_entities[ship_count++] = [sortedEntities[i] retain];
+			my_entities[ship_count++] = sortedEntities[i];
 		}
 	}
 	
@@ -5689,10 +6010,7 @@ static BOOL MaintainLinkedLists(Universe *uni)
 		}
 	}
 	
-	for (i = 0; i < ship_count; i++)
-	{
-		[my_entities[i] release];
-	}
+	[self endEntitySnapshot:my_entities];
 	
 	return hit_entity;
 }
@@ -5786,6 +6104,13 @@ static BOOL MaintainLinkedLists(Universe *uni)
 }
 
 
+// Below this many entities, a linear scan is as quick as building the spatial index.
+enum
+{
+	kEntityIndexMinimumEntities	= 32
+};
+
+
 - (unsigned) countEntitiesMatchingPredicate:(EntityFilterPredicate)predicate
 								  parameter:(void *)parameter
 									inRange:(double)range
@@ -5800,6 +6125,25 @@ static BOOL MaintainLinkedLists(Universe *uni)
 	if (e1 != nil)  p1 = e1->position;
 	else  p1 = kZeroHPVector;
 	
+	if (range >= 0 && n_entities >= kEntityIndexMinimumEntities && !entityIndexInUse)
+	{
+		// Only entities near the sphere are visited, and the predicate only runs for those inside it.
+		Entity **candidates = NULL;
+		NSUInteger count = [self getEntities:&candidates inRange:range ofPoint:p1];
+		for (i = 0; i < count; i++)
+		{
+			Entity *e2 = candidates[i];
+			cr = range + e2->collision_radius;
+			if (e2 != e1 && HPdistance2(e2->position, p1) - cr * cr < 0 && predicate(e2, parameter))
+			{
+				found++;
+			}
+		}
+		[self endEntitySnapshot:candidates];
+		
+		return found;
+	}
+	
 	for (i = 0; i < n_entities; i++)
 	{
 		Entity *e2 = sortedEntities[i];
@@ -5880,15 +6224,36 @@ OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range)
 	if (e1 != nil)  p1 = [e1 position];
 	else  p1 = kZeroHPVector;
 	
-	for (i = 0; i < n_entities; i++)
+	if (range >= 0 && n_entities >= kEntityIndexMinimumEntities && !entityIndexInUse)
 	{
-		Entity *e2 = sortedEntities[i];
-		
-		if (e1 != e2 &&
-			EntityInRange(p1, e2, range) &&
-			predicate(e2, parameter))
+		// Candidates come back in sortedEntities order, so the result order is unchanged.
+		Entity **candidates = NULL;
+		NSUInteger count = [self getEntities:&candidates inRange:range ofPoint:p1];
+		for (i = 0; i < count; i++)
+		{
+			Entity *e2 = candidates[i];
+			
+			if (e1 != e2 &&
+				EntityInRange(p1, e2, range) &&
+				predicate(e2, parameter))
+			{
+				[result addObject:e2];
+			}
+		}
+		[self endEntitySnapshot:candidates];
+	}
+	else
+	{
+		for (i = 0; i < n_entities; i++)
 		{
-			[result addObject:e2];
+			Entity *e2 = sortedEntities[i];
+			
+			if (e1 != e2 &&
+				EntityInRange(p1, e2, range) &&
+				predicate(e2, parameter))
+			{
+				[result addObject:e2];
+			}
 		}
 	}
 	
@@ -5992,6 +6357,21 @@ OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range)
 	if (entity != nil)  p1 = [entity position];
 	else  p1 = kZeroHPVector;
 	
+	if (n_entities >= kEntityIndexMinimumEntities && !entityIndexInUse)
+	{
+		/*	The predicate is called mid-search, and may itself query the
+			universe; such nested queries use a linear scan, so that the
+			index is not rebuilt under this search.
+		*/
+		OOEntitySpatialIndex *index = [self entitySpatialIndex];
+		entityIndexInUse = YES;
+		result = [index nearestEntityToPoint:p1 excluding:entity filter:predicate parameter:parameter];
+		entityIndexInUse = NO;
+		entityIndexSkips += n_entities - MIN(n_entities, [index visitCount]);
+		
+		return [[result retain] autorelease];
+	}
+	
 	for (i = 0; i < n_entities; i++)
 	{
 		Entity *e2 = sortedEntities[i];
@@ -6054,7 +6434,16 @@ OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range)
 	
 	if (![[self gameController] isGamePaused])
 	{
-		[universeRegion findCollisions];
+		if (collisionBroadphaseMode == kOOCollisionBroadphaseSpatialHash)
+		{
+			if (collisionBroadphase == nil)  collisionBroadphase = [[OOCollisionBroadphase alloc] init];
+			[collisionBroadphase updateWithEntities:sortedEntities count:n_entities];
+			[universeRegion findCollisionsWithBroadphase:collisionBroadphase];
+		}
+		else
+		{
+			[universeRegion findCollisions];
+		}
 	}
 	
 	// do check for entities that can't see the sun!
@@ -6064,8 +6453,183 @@ OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range)
 
 - (NSString*) collisionDescription
 {
-	if (universeRegion != nil)  return [universeRegion collisionDescription];
-	else  return @"-";
+	if (universeRegion == nil)  return @"-";
+	NSString *result = [universeRegion collisionDescription];
+	if (collisionBroadphase != nil)
+	{
+		result = [NSString stringWithFormat:@"%@ - h%lu", result, [collisionBroadphase candidateTestCount]];
+	}
+	// Entity evaluations avoided by the predicate query index in the last update.
+	return [NSString stringWithFormat:@"%@ - q%lu", result, (unsigned long)lastEntityIndexSkips];
+}
+
+
+- (BOOL) parallelEntityUpdate
+{
+	return parallelEntityUpdate;
+}
+
+
+- (void) setParallelEntityUpdate:(BOOL)value
+{
+	value = !!value;
+	if (value == parallelEntityUpdate)  return;
+	
+	parallelEntityUpdate = value;
+	[[NSUserDefaults standardUserDefaults] setBool:value forKey:@"parallel-entity-update"];
+	OOLog(@"universe.update.parallel", @"Parallel entity update %@ (%lu threads).", value ? @"on" : @"off", (unsigned long)[[OOJobPool sharedJobPool] threadCount]);
+}
+
+
+- (void) finishBatchShipIntegration:(OOTimeDelta)delta_t
+{
+	NSUInteger i, count = [physicsStore count];
+	if (count == 0)  return;
+	
+	[physicsStore integrate:delta_t];
+	for (i = 0; i < count; i++)
+	{
+		Entity *thing = [physicsStore entityAtIndex:i];
+		[thing finishBatchIntegration];
+		BubbleEntityInSortedList(self, thing);
+	}
+	[physicsStore removeAllEntities];
+	
+	// Anything built from positions during the update loop is out of date.
+	shipBVHValid = NO;
+	entityIndexValid = NO;
+	[shipNeighbourCache invalidate];
+}
+
+
+- (BOOL) batchShipIntegration
+{
+	return batchShipIntegration;
+}
+
+
+- (void) setBatchShipIntegration:(BOOL)value
+{
+	value = !!value;
+	if (value == batchShipIntegration)  return;
+	
+	batchShipIntegration = value;
+	[[NSUserDefaults standardUserDefaults] setBool:value forKey:@"batch-ship-integration"];
+	OOLog(@"universe.update.batchIntegration", @"Batch ship integration %@.", value ? @"on" : @"off");
+}
+
+
+#ifndef NDEBUG
+static NSArray *MakeDeterminismTestEffects(NSUInteger count, HPVector origin)
+{
+	NSMutableArray	*effects = [NSMutableArray arrayWithCapacity:count];
+	GLfloat			baseColor[4] = { 1.0f, 0.5f, 0.25f, 1.0f };
+	NSUInteger		i;
+	
+	for (i = 0; i < count; i++)
+	{
+		HPVector position = HPvector_add(origin, make_HPvector(randf() * 2000.0 - 1000.0, randf() * 2000.0 - 1000.0, randf() * 2000.0 - 1000.0));
+		Vector velocity = make_vector(randf() * 200.0f - 100.0f, randf() * 200.0f - 100.0f, randf() * 200.0f - 100.0f);
+		Entity *effect = nil;
+		
+		switch (i % 3)
+		{
+			case 0:
+				effect = [[OOParticleSystem alloc] initWithPosition:position velocity:velocity count:8 minSpeed:50.0f maxSpeed:150.0f duration:5.0 baseColor:baseColor];
+				break;
+				
+			case 1:
+				effect = [[OOSparkEntity alloc] initWithPosition:position velocity:velocity duration:5.0 size:4.0f color:[OOColor orangeColor]];
+				break;
+				
+			default:
+				effect = [[OOPlasmaBurstEntity alloc] initWithPosition:position];
+				break;
+		}
+		
+		if (effect != nil)  [effects addObject:effect];
+		[effect release];
+	}
+	
+	return effects;
+}
+
+
+- (NSString *) checkParallelEntityUpdateDeterminism:(NSUInteger)ticks
+{
+	enum { kEffectCount = 600 };
+	const OOTimeDelta delta_t = 1.0 / 60.0;
+	
+	HPVector origin = (PLAYER != nil) ? [PLAYER position] : kZeroHPVector;
+	OORandomState savedRandomState = OOSaveRandomState();
+	
+	ranrot_srand(0x0011AA22);
+	NSArray *serialSet = MakeDeterminismTestEffects(kEffectCount, origin);
+	ranrot_srand(0x0011AA22);
+	NSArray *parallelSet = MakeDeterminismTestEffects(kEffectCount, origin);
+	
+	NSUInteger count = MIN([serialSet count], [parallelSet count]);
+	Entity **serialEntities = [self beginEntitySnapshot:count];
+	Entity **parallelEntities = [self beginEntitySnapshot:count];
+	[serialSet getObjects:serialEntities range:NSMakeRange(0, count)];
+	[parallelSet getObjects:parallelEntities range:NSMakeRange(0, count)];
+	
+	OOConcurrentUpdateJob job = { parallelEntities, delta_t };
+	OOProfilingStopwatch *stopwatch = [OOProfilingStopwatch stopwatch];
+	NSUInteger i, tick, mismatches = 0;
+	OOTimeDelta serialTime = 0.0, parallelTime = 0.0;
+	
+	for (tick = 0; tick < ticks; tick++)
+	{
+		[stopwatch reset];
+		for (i = 0; i < count; i++)  [serialEntities[i] update:delta_t];
+		serialTime += [stopwatch reset];
+		[[OOJobPool sharedJobPool] applyFunction:ConcurrentEntityUpdate context:&job count:count grain:kConcurrentUpdateGrain];
+		parallelTime += [stopwatch reset];
+	}
+	
+	// Bitwise comparison: the point is that thread scheduling must not change the result at all.
+	for (i = 0; i < count; i++)
+	{
+		Entity *a = serialEntities[i], *b = parallelEntities[i];
+		if (memcmp(&a->position, &b->position, sizeof a->position) != 0 ||
+			memcmp(&a->cameraRelativePosition, &b->cameraRelativePosition, sizeof a->cameraRelativePosition) != 0 ||
+			memcmp(&a->collision_radius, &b->collision_radius, sizeof a->collision_radius) != 0)
+		{
+			if (mismatches == 0)
+			{
+				OOLog(@"universe.update.determinism", @"First mismatch at entity %lu (%@): serial %@, parallel %@.", (unsigned long)i, [a class], HPVectorDescription(a->position), HPVectorDescription(b->position));
+			}
+			mismatches++;
+		}
+	}
+	
+	[self endEntitySnapshot:serialEntities];
+	OORestoreRandomState(savedRandomState);
+	
+	NSString *result = [NSString stringWithFormat:@"%lu effects, %lu ticks, %lu threads: %lu mismatches. Serial %.3f ms, parallel %.3f ms.",
+						(unsigned long)count, (unsigned long)ticks, (unsigned long)[[OOJobPool sharedJobPool] threadCount], (unsigned long)mismatches,
+						serialTime * 1000.0, parallelTime * 1000.0];
+	OOLog(@"universe.update.determinism", @"%@", result);
+	return result;
+}
+#endif
+
+
+- (OOCollisionBroadphaseMode) collisionBroadphaseMode
+{
+	return collisionBroadphaseMode;
+}
+
+
+- (void) setCollisionBroadphaseMode:(OOCollisionBroadphaseMode)mode
+{
+	if (mode == collisionBroadphaseMode)  return;
+	
+	collisionBroadphaseMode = mode;
+	if (mode != kOOCollisionBroadphaseSpatialHash)  DESTROY(collisionBroadphase);
+	[[NSUserDefaults standardUserDefaults] setObject:OOStringFromCollisionBroadphaseMode(mode) forKey:@"collision-broadphase"];
+	OOLog(@"collision.broadphase", @"Collision broadphase set to %@.", OOStringFromCollisionBroadphaseMode(mode));
 }
 
 
@@ -6472,15 +7036,13 @@ OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range)
 		}
 
 		unsigned	i, ent_count = n_entities;
-		Entity		*my_entities[ent_count];
+		Entity		**my_entities = [self beginEntitySnapshot:ent_count];
 		
 		[self verifyEntitySessionIDs];
 		
-		// use a retained copy so this can't be changed under us.
-		for (i = 0; i < ent_count; i++)
-		{
-			my_entities[i] = [sortedEntities[i] retain];	// explicitly retain each one
-		}
+		// use a snapshot so this can't be changed under us. Entities removed
+		// during the update are kept alive by entitiesDeadThisUpdate.
+		memcpy(my_entities, sortedEntities, ent_count * sizeof *my_entities);
 		
 		NSString * volatile update_stage = @"initialisation";
 #ifndef NDEBUG
@@ -6498,6 +7060,12 @@ OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range)
 			
 			time_delta = delta_t;
 			universal_time += delta_t;
+			shipBVHValid = NO;
+			entityIndexValid = NO;
+			[shipNeighbourCache invalidate];
+			lastEntityIndexSkips = entityIndexSkips;
+			entityIndexSkips = 0;
+			entityIndexInUse = NO;	// In case a predicate exception left it set.
 			
 			if (EXPECT_NOT([player showDemoShips] && [player guiScreen] == GUI_SCREEN_SHIPLIBRARY))
 			{
@@ -6583,6 +7151,25 @@ OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range)
 			
 			update_stage = @"update:entity";
 			NSMutableSet *zombies = nil;
+			
+			// In parallel mode, entities that can update concurrently are set aside for the integrate stage below.
+			Entity **concurrent_entities = NULL;
+			unsigned concurrent_count = 0;
+			if (parallelEntityUpdate)  concurrent_entities = [self beginEntitySnapshot:ent_count];
+			
+			// In batch mode, eligible ships' movement is recorded here and applied in the integrate stage.
+			OOPhysicsStore *batch_store = nil;
+			if ([physicsStore count] != 0)
+			{
+				// An exception in the last update left ships recording; let them go.
+				[self finishBatchShipIntegration:delta_t];
+			}
+			if (batchShipIntegration)
+			{
+				if (physicsStore == nil)  physicsStore = [[OOPhysicsStore alloc] init];
+				batch_store = physicsStore;
+			}
+			
 			OOLog(@"universe.profile.update", @"%@", update_stage);
 			for (i = 0; i < ent_count; i++)
 			{
@@ -6599,29 +7186,31 @@ OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range)
 					continue;
 				}
 				
+				if (concurrent_entities != NULL && [thing canUpdateConcurrently])
+				{
+					concurrent_entities[concurrent_count++] = thing;
+					continue;
+				}
+				
+				if (batch_store != nil && [thing canIntegrateInBatch])
+				{
+					[thing beginBatchIntegrationInStore:batch_store];
+				}
+				
 				[thing update:delta_t];
 				if (EXPECT_NOT(sessionID != _sessionID))
 				{
 					// Game was reset (in player update); end this update: cycle.
 					break;
 				}
+				[thing finishConcurrentUpdate];
 				
 #ifndef NDEBUG
 				update_stage = @"update:list maintenance [%@]";
 #endif
 				
 				// maintain distance-from-player list
-				GLfloat z_distance = thing->zero_distance;
-				
-				int index = thing->zero_index;
-				while (index > 0 && z_distance < sortedEntities[index - 1]->zero_distance)
-				{
-					sortedEntities[index] = sortedEntities[index - 1];	// bubble up the list, usually by just one position
-					sortedEntities[index - 1] = thing;
-					thing->zero_index = index - 1;
-					sortedEntities[index]->zero_index = index;
-					index--;
-				}
+				BubbleEntityInSortedList(self, thing);
 				
 				// update deterministic AI
 				if ([thing isShip])
@@ -6645,6 +7234,34 @@ OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range)
 		update_stage_param = nil;
 #endif
 			
+			if (concurrent_count != 0 && EXPECT(sessionID == _sessionID))
+			{
+				/*	The integrate stage runs after the serial stage, so these
+					entities see the player's position for this frame, just as
+					they would in list order where the player comes first.
+				*/
+				update_stage = @"update:integrate";
+				OOLog(@"universe.profile.update", @"%@", update_stage);
+				OOConcurrentUpdateJob job = { concurrent_entities, delta_t };
+				[[OOJobPool sharedJobPool] applyFunction:ConcurrentEntityUpdate context:&job count:concurrent_count grain:kConcurrentUpdateGrain];
+				
+				update_stage = @"update:finish";
+				for (i = 0; i < concurrent_count; i++)
+				{
+					Entity *thing = concurrent_entities[i];
+					[thing finishConcurrentUpdate];
+					BubbleEntityInSortedList(self, thing);
+				}
+			}
+			if (concurrent_entities != NULL)  [self endEntitySnapshot:concurrent_entities];
+			
+			if (batch_store != nil && EXPECT(sessionID == _sessionID))
+			{
+				update_stage = @"update:integrate ships";
+				OOLog(@"universe.profile.update", @"%@", update_stage);
+				[self finishBatchShipIntegration:delta_t];
+			}
+			
 			if (zombies != nil)
 			{
 				update_stage = @"shootin' zombies";
@@ -6668,7 +7285,10 @@ OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range)
 			
 			update_stage = @"collision and shadow detection";
 			OOLog(@"universe.profile.update", @"%@", update_stage);
-			[self filterSortedLists];
+			if (collisionBroadphaseMode == kOOCollisionBroadphaseSweepAndPrune)
+			{
+				[self filterSortedLists];
+			}
 			[self findCollisionsAndShadows];
 			
 			// do any required check and maintenance of linked lists
@@ -6691,17 +7311,15 @@ OOINLINE BOOL EntityInRange(HPVector p1, Entity *e2, float range)
 				if (update_stage_param != nil)  update_stage = [NSString stringWithFormat:update_stage, update_stage_param];
 #endif
 				OOLog(kOOLogException, @"***** Exception during [%@] in [Universe update:] : %@ : %@ *****", update_stage, [exception name], [exception reason]);
+				[self endEntitySnapshot:my_entities];
 				@throw exception;
 			}
 		}
 		
-		// dispose of the non-mutable copy and everything it references neatly
+		// dispose of the snapshot
 		update_stage = @"clean up";
 		OOLog(@"universe.profile.update", @"%@", update_stage);
-		for (i = 0; i < ent_count; i++)
-		{
-			[my_entities[i] release];	// explicitly release each one
-		}
+		[self endEntitySnapshot:my_entities];
 		/* Garbage collection is going to result in a significant
 		 * pause when it happens. Doing it here is better than doing
 		 * it in the middle of the update when it might slow a
@@ -9209,12 +9827,12 @@ static OOComparisonResult comparePrice(id dict1, id dict2, void *context)
 	int i;
 	int ent_count = n_entities;
 	int ship_count = 0;
-	ShipEntity* my_ships[ent_count];
+	ShipEntity **my_ships = (ShipEntity **)[self beginEntitySnapshot:ent_count];
 	for (i = 0; i < ent_count; i++)
 	{
 		if (sortedEntities[i]->isShip)
 		{
-			my_ships[ship_count++] = [(ShipEntity *)sortedEntities[i] retain];	// retained
+			my_ships[ship_count++] = (ShipEntity *)sortedEntities[i];
 		}
 	}
 	
@@ -9223,8 +9841,8 @@ static OOComparisonResult comparePrice(id dict1, id dict2, void *context)
 		ShipEntity* se = my_ships[i];
 		[se doScriptEvent:event];
 		if (message != nil)  [[se getAI] reactToMessage:message context:@"global message"];
-		[se release]; //	released
 	}
+	[self endEntitySnapshot:(Entity **)my_ships];
 }
 
 ///////////////////////////////////////
@@ -9540,8 +10158,7 @@ static OOComparisonResult comparePrice(id dict1, id dict2, void *context)
 {
 	[self resetBeacons];
 	
-	next_universal_id = 100;	// start arbitrarily above zero
-	memset(entity_for_uid, 0, sizeof entity_for_uid);
+	[self resetUniversalIDs];
 	
 	[self setMainLightPosition:kZeroVector];
 
@@ -9855,13 +10472,18 @@ static OOComparisonResult comparePrice(id dict1, id dict2, void *context)
 	{
 		doLinkedListMaintenanceThisUpdate = YES;
 	}
+	if ([entity isShip])
+	{
+		shipBVHValid = NO;
+		[shipNeighbourCache invalidate];
+	}
+	entityIndexValid = NO;
 	
 	[entity removeFromLinkedLists];
 	
 	// moved forward ^^
 	// remove from the reference dictionary
-	int old_id = [entity universalID];
-	entity_for_uid[old_id] = nil;
+	[self freeUniversalID:[entity universalID] ofEntity:entity];
 	[entity setUniversalID:NO_TARGET];
 	[entity wasRemovedFromUniverse];
 	
@@ -9904,6 +10526,8 @@ static OOComparisonResult comparePrice(id dict1, id dict2, void *context)
 					it isn't aligned, and the end of it is only live in
 					degenerate cases.
 					-- Ahruman 2012-07-11
+					sortedEntities is now malloced; -growSortedEntities keeps
+					the padding slot.
 				*/
 				sortedEntities[index] = sortedEntities[index + n];	// copy entity[index + n] -> entity[index] (preserves sort order)
 				if (sortedEntities[index])
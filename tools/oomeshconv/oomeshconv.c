@@ -0,0 +1,1036 @@
+/*	oomeshconv
+
+	Convert DAT model files to .oomesh files (see src/Core/OOMeshBinaryFormat.h)
+	so they can be shipped in a Models folder next to, or instead of, the DAT
+	files. The game converts models into its cache by itself; shipping .oomesh
+	files only saves the first conversion, and lets add-ons without a DAT file
+	use models that have been converted elsewhere.
+
+	Usage: oomeshconv [-smooth] [-o <directory>] <file.dat>...
+
+	-smooth corresponds to smooth = yes in shipdata.plist; a model with
+	explicit NORMALS is the same either way. Files are written next to the
+	input unless -o is given.
+
+	This repeats the processing in -[OOMesh loadDataFromDATFile:...] and
+	-[OOMesh setUpVertexArrays], with the same single-precision arithmetic in
+	the same order, so the output matches what the game would cache. When
+	either changes, this must change with it: kLoaderRevision must follow
+	kOOMeshLoaderRevision, and kFormatVersion must be bumped in both places if
+	the layout changes. Unlike the game, it refuses
+	files with errors rather than loading what it can, and writes no octree.
+
+	The output uses the native layout and byte order of the machine running
+	the tool, which must match the game's: 12-byte vectors and 64-byte faces,
+	as in all standard builds.
+*/
+
+// For strdup() and strndup() under -std=c99.
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+
+
+enum
+{
+	kFormatVersion			= 1,
+	kLoaderRevision			= 1,
+	kEndianTag				= 0x01020304,
+	kAlignment				= 16,
+	kMaxMaterials			= 8,
+
+	kNormalModePerFace		= 0,
+	kNormalModeSmooth		= 1,
+	kNormalModeExplicit		= 2
+};
+
+
+enum
+{
+	kSectionMaterialKeys,
+	kSectionVertices,
+	kSectionFaces,
+	kSectionIndices,
+	kSectionTextureUVs,
+	kSectionDrawVertices,
+	kSectionDrawNormals,
+	kSectionDrawTangents,
+	kSectionOctree,
+
+	kSectionCount
+};
+
+
+typedef struct
+{
+	float					x, y, z;
+} Vector;
+
+
+typedef struct
+{
+	uint16_t				smoothGroup;
+	uint8_t					materialIndex;
+	uint32_t				vertex[3];
+
+	Vector					normal;
+	Vector					tangent;
+	float					s[3];
+	float					t[3];
+} Face;
+
+
+typedef struct
+{
+	uint32_t				offset;
+	uint32_t				length;
+} Section;
+
+
+typedef struct
+{
+	char					magic[4];
+	uint32_t				formatVersion;
+	uint32_t				endianTag;
+	uint16_t				vectorSize;
+	uint16_t				faceSize;
+	uint64_t				sourceHash;
+	float					scale;
+	uint8_t					normalMode;
+	uint8_t					materialCount;
+	uint8_t					octreeDepth;
+	uint8_t					loaderRevision;
+	uint32_t				vertexCount;
+	uint32_t				faceCount;
+	uint32_t				drawVertexCount;
+	uint32_t				indexCount;
+	uint32_t				materialRanges[kMaxMaterials][2];
+	Section					sections[kSectionCount];
+} Header;
+
+
+typedef char VectorSizeCheck[(sizeof (Vector) == 12) ? 1 : -1];
+typedef char FaceSizeCheck[(sizeof (Face) == 64) ? 1 : -1];
+
+
+typedef struct
+{
+	uint32_t				count;
+	uint32_t				capacity;
+	uint32_t				*faces;
+} FaceList;
+
+
+typedef struct
+{
+	unsigned				normalMode;
+	uint32_t				vertexCount;
+	uint32_t				faceCount;
+	Vector					*vertices;
+	Vector					*normals;
+	Vector					*tangents;
+	Face					*faces;
+	FaceList				*faceRefs;
+
+	unsigned				materialCount;
+	char					*materialKeys[kMaxMaterials];
+	uint32_t				ranges[kMaxMaterials][2];
+
+	uint32_t				indexCount;
+	uint32_t				drawVertexCount;
+	uint32_t				*indices;
+	float					*uvs;
+	Vector					*drawVertices;
+	Vector					*drawNormals;
+	Vector					*drawTangents;
+} Mesh;
+
+
+typedef struct
+{
+	const char				*cursor;
+	const char				*error;
+} Scanner;
+
+
+static const Vector kZeroVector = { 0.0f, 0.0f, 0.0f };
+static const Vector kBasisXVector = { 1.0f, 0.0f, 0.0f };
+static const Vector kBasisZVector = { 0.0f, 0.0f, 1.0f };
+
+
+static int ConvertFile(const char *path, const char *outDirectory, int smooth);
+
+
+int main(int argc, char *argv[])
+{
+	int			i, smooth = 0, failures = 0, files = 0;
+	const char	*outDirectory = NULL;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-smooth") == 0)  smooth = 1;
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)  outDirectory = argv[++i];
+		else
+		{
+			files++;
+			if (!ConvertFile(argv[i], outDirectory, smooth))  failures++;
+		}
+	}
+
+	if (files == 0)
+	{
+		fprintf(stderr, "Usage: %s [-smooth] [-o <directory>] <file.dat>...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// MARK: Vector maths (as in OOVector.h)
+
+static Vector make_vector(float x, float y, float z)
+{
+	Vector r = { x, y, z };
+	return r;
+}
+
+
+static Vector vector_multiply_scalar(Vector v, float s)
+{
+	return make_vector(v.x * s, v.y * s, v.z * s);
+}
+
+
+static Vector vector_add(Vector a, Vector b)
+{
+	return make_vector(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+
+static Vector vector_subtract(Vector a, Vector b)
+{
+	return make_vector(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+
+static int vector_equal(Vector a, Vector b)
+{
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+
+static float magnitude2(Vector v)
+{
+	return v.x * v.x + v.y * v.y + v.z * v.z;
+}
+
+
+static float dot_product(Vector a, Vector b)
+{
+	return (a.x * b.x) + (a.y * b.y) + (a.z * b.z);
+}
+
+
+static Vector vector_normal_or_fallback(Vector v, Vector fallback)
+{
+	float mag2 = magnitude2(v);
+	if (mag2 == 0.0f)  return fallback;
+	return vector_multiply_scalar(v, 1.0f / sqrt(mag2));
+}
+
+
+static Vector vector_normal(Vector v)
+{
+	return vector_normal_or_fallback(v, kZeroVector);
+}
+
+
+static Vector true_cross_product(Vector a, Vector b)
+{
+	return make_vector((a.y * b.z) - (a.z * b.y),
+					   (a.z * b.x) - (a.x * b.z),
+					   (a.x * b.y) - (a.y * b.x));
+}
+
+
+static Vector normal_to_surface(Vector v1, Vector v2, Vector v3)
+{
+	return vector_normal(true_cross_product(vector_subtract(v2, v1), vector_subtract(v3, v2)));
+}
+
+
+// MARK: Scanning (as OODATTokenizer does it)
+
+/*	Strip comments and replace commas, which the game's tokenizer treats as whitespace. */
+static char *Preprocess(const char *bytes, size_t length)
+{
+	char *result = malloc(length + 1);
+	size_t i, o = 0;
+	int inComment = 0;
+
+	if (result == NULL)  return NULL;
+	for (i = 0; i < length; i++)
+	{
+		char c = bytes[i];
+		if (c == '\n' || c == '\r')  inComment = 0;
+		else if (c == '#' || (c == '/' && i + 1 < length && bytes[i + 1] == '/'))  inComment = 1;
+		if (inComment)  continue;
+		result[o++] = (c == ',') ? ' ' : c;
+	}
+	result[o] = '\0';
+	return result;
+}
+
+
+static int IsSpace(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+
+static int IsNewline(char c)
+{
+	return c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+
+static void SkipWhitespace(Scanner *scanner)
+{
+	while (IsSpace(*scanner->cursor) || IsNewline(*scanner->cursor))  scanner->cursor++;
+}
+
+
+static int ScanKeyword(Scanner *scanner, const char *keyword)
+{
+	size_t length = strlen(keyword);
+	SkipWhitespace(scanner);
+	if (strncasecmp(scanner->cursor, keyword, length) != 0)  return 0;
+	scanner->cursor += length;
+	return 1;
+}
+
+
+static int ScanInt(Scanner *scanner, long *outValue)
+{
+	char *end = NULL;
+	SkipWhitespace(scanner);
+	if (!isdigit((unsigned char)scanner->cursor[0]) &&
+		!((scanner->cursor[0] == '-' || scanner->cursor[0] == '+') && isdigit((unsigned char)scanner->cursor[1])))
+	{
+		return 0;
+	}
+	*outValue = strtol(scanner->cursor, &end, 10);
+	scanner->cursor = end;
+	return 1;
+}
+
+
+static int ScanFloat(Scanner *scanner, float *outValue)
+{
+	const char *p;
+	char *end = NULL;
+
+	SkipWhitespace(scanner);
+	p = scanner->cursor;
+	if (*p == '-' || *p == '+')  p++;
+	if (!isdigit((unsigned char)*p) && !(*p == '.' && isdigit((unsigned char)p[1])))  return 0;
+
+	*outValue = strtod(scanner->cursor, &end);
+	scanner->cursor = end;
+	return 1;
+}
+
+
+//	Characters up to whitespace or a newline, after skipping whitespace and newlines.
+static char *ScanToken(Scanner *scanner)
+{
+	const char *start;
+	SkipWhitespace(scanner);
+	start = scanner->cursor;
+	while (*scanner->cursor != '\0' && !IsSpace(*scanner->cursor) && !IsNewline(*scanner->cursor))  scanner->cursor++;
+	if (scanner->cursor == start)  return NULL;
+	return strndup(start, scanner->cursor - start);
+}
+
+
+//	Characters up to the end of the line, after skipping whitespace and newlines.
+static char *ScanLine(Scanner *scanner)
+{
+	const char *start;
+	SkipWhitespace(scanner);
+	start = scanner->cursor;
+	while (*scanner->cursor != '\0' && !IsNewline(*scanner->cursor))  scanner->cursor++;
+	if (scanner->cursor == start)  return NULL;
+	return strndup(start, scanner->cursor - start);
+}
+
+
+static int Fail(Scanner *scanner, const char *error)
+{
+	if (scanner->error == NULL)  scanner->error = error;
+	return 0;
+}
+
+
+static int ScanVector(Scanner *scanner, Vector *outVector, const char *error)
+{
+	float x, y, z;
+	if (!ScanFloat(scanner, &x) || !ScanFloat(scanner, &y) || !ScanFloat(scanner, &z))  return Fail(scanner, error);
+	*outVector = make_vector(x, y, z);
+	return 1;
+}
+
+
+static void AddFaceRef(FaceList *list, uint32_t face)
+{
+	if (list->count == list->capacity)
+	{
+		list->capacity = list->capacity ? list->capacity * 2 : 8;
+		list->faces = realloc(list->faces, sizeof *list->faces * list->capacity);
+		if (list->faces == NULL)  abort();
+	}
+	list->faces[list->count++] = face;
+}
+
+
+// MARK: Loading (as -[OOMesh loadDataFromDATFile:...])
+
+static int ParseMesh(Mesh *mesh, Scanner *scanner)
+{
+	long		value;
+	uint32_t	i, j;
+
+	if (!ScanKeyword(scanner, "NVERTS") || !ScanInt(scanner, &value) || value <= 0)  return Fail(scanner, "Failed to read NVERTS");
+	mesh->vertexCount = value;
+	if (!ScanKeyword(scanner, "NFACES") || !ScanInt(scanner, &value) || value <= 0)  return Fail(scanner, "Failed to read NFACES");
+	mesh->faceCount = value;
+
+	mesh->vertices = calloc(mesh->vertexCount, sizeof *mesh->vertices);
+	mesh->faces = calloc(mesh->faceCount, sizeof *mesh->faces);
+	mesh->faceRefs = calloc(mesh->vertexCount, sizeof *mesh->faceRefs);
+	if (mesh->vertices == NULL || mesh->faces == NULL || mesh->faceRefs == NULL)  return Fail(scanner, "Out of memory");
+
+	if (!ScanKeyword(scanner, "VERTEX"))  return Fail(scanner, "Failed to find VERTEX data");
+	for (j = 0; j < mesh->vertexCount; j++)
+	{
+		if (!ScanVector(scanner, &mesh->vertices[j], "Failed to read a value in VERTEX"))  return 0;
+	}
+
+	if (!ScanKeyword(scanner, "FACES"))  return Fail(scanner, "Failed to find FACES data");
+	for (j = 0; j < mesh->faceCount; j++)
+	{
+		long r, g, b, n_v;
+		Vector normal;
+
+		if (!ScanInt(scanner, &r) || !ScanInt(scanner, &g) || !ScanInt(scanner, &b))  return Fail(scanner, "Failed to read a color in FACES");
+		mesh->faces[j].smoothGroup = r;
+		if (!ScanVector(scanner, &normal, "Failed to read a normal in FACES"))  return 0;
+		mesh->faces[j].normal = vector_normal(normal);
+
+		if (!ScanInt(scanner, &n_v))  return Fail(scanner, "Failed to read number of vertices in FACES");
+		if (n_v < 3)  return Fail(scanner, "Face has fewer than three vertices");
+		if (n_v > 3)
+		{
+			// As in the game, only three are read, and the rest are parsed as the next face.
+			fprintf(stderr, "warning: face %u has %ld vertices specified. Only the first three will be used.\n", j, n_v);
+			n_v = 3;
+		}
+		for (i = 0; i < 3; i++)
+		{
+			if (!ScanInt(scanner, &value))  return Fail(scanner, "Failed to read a vertex index in FACES");
+			if (value < 0 || value >= (long)mesh->vertexCount)  return Fail(scanner, "Vertex index out of range in FACES");
+			mesh->faces[j].vertex[i] = value;
+			AddFaceRef(&mesh->faceRefs[value], j);
+		}
+	}
+
+	if (!ScanKeyword(scanner, "TEXTURES"))  return Fail(scanner, "Failed to find TEXTURES data (the game would use a placeholder material)");
+	for (j = 0; j < mesh->faceCount; j++)
+	{
+		float max_x, max_y, s, t;
+		char *key = ScanToken(scanner);
+		if (key == NULL)  return Fail(scanner, "Failed to read texture filename in TEXTURES");
+
+		for (i = 0; i < mesh->materialCount; i++)
+		{
+			if (strcmp(mesh->materialKeys[i], key) == 0)  break;
+		}
+		if (i == mesh->materialCount)
+		{
+			if (mesh->materialCount == kMaxMaterials)  return Fail(scanner, "Too many materials (maximum is 8)");
+			mesh->materialKeys[mesh->materialCount++] = key;
+		}
+		else
+		{
+			free(key);
+		}
+		mesh->faces[j].materialIndex = i;
+
+		if (!ScanFloat(scanner, &max_x) || !ScanFloat(scanner, &max_y))  return Fail(scanner, "Failed to read texture size in TEXTURES");
+		for (i = 0; i < 3; i++)
+		{
+			if (!ScanFloat(scanner, &s) || !ScanFloat(scanner, &t))  return Fail(scanner, "Failed to read s t coordinates in TEXTURES");
+			mesh->faces[j].s[i] = s / max_x;
+			mesh->faces[j].t[i] = t / max_y;
+		}
+	}
+
+	if (ScanKeyword(scanner, "NAMES"))
+	{
+		long count;
+		if (!ScanInt(scanner, &count))  return Fail(scanner, "Expected count after NAMES");
+		for (j = 0; j < (uint32_t)count; j++)
+		{
+			char number[16];
+			char *name = ScanLine(scanner);
+			if (name == NULL)  return Fail(scanner, "Expected file name in NAMES");
+
+			snprintf(number, sizeof number, "%u", j);
+			for (i = 0; i < mesh->materialCount; i++)
+			{
+				if (strcmp(mesh->materialKeys[i], number) == 0)
+				{
+					free(mesh->materialKeys[i]);
+					mesh->materialKeys[i] = strdup(name);
+				}
+			}
+			free(name);
+		}
+	}
+
+	if (ScanKeyword(scanner, "NORMALS"))
+	{
+		mesh->normalMode = kNormalModeExplicit;
+		mesh->normals = calloc(mesh->vertexCount, sizeof *mesh->normals);
+		mesh->tangents = calloc(mesh->vertexCount, sizeof *mesh->tangents);
+		if (mesh->normals == NULL || mesh->tangents == NULL)  return Fail(scanner, "Out of memory");
+
+		for (j = 0; j < mesh->vertexCount; j++)
+		{
+			Vector normal;
+			if (!ScanVector(scanner, &normal, "Failed to read a value in NORMALS"))  return 0;
+			mesh->normals[j] = vector_normal(normal);
+		}
+
+		/*	Explicit tangents are read, but the game then replaces them with
+			generated ones, so they are only checked here.
+		*/
+		if (ScanKeyword(scanner, "TANGENTS"))
+		{
+			for (j = 0; j < mesh->vertexCount; j++)
+			{
+				Vector tangent;
+				if (!ScanVector(scanner, &tangent, "Failed to read a value in TANGENTS"))  return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+
+static void CheckNormalsAndAdjustWinding(Mesh *mesh)
+{
+	uint32_t i;
+
+	for (i = 0; i < mesh->faceCount; i++)
+	{
+		Face *face = &mesh->faces[i];
+		Vector v0 = mesh->vertices[face->vertex[0]];
+		Vector v1 = mesh->vertices[face->vertex[1]];
+		Vector v2 = mesh->vertices[face->vertex[2]];
+		Vector norm = face->normal;
+		Vector calculatedNormal = normal_to_surface(v2, v1, v0);
+
+		if (vector_equal(norm, kZeroVector))
+		{
+			norm = vector_subtract(kZeroVector, calculatedNormal);
+			face->normal = norm;
+		}
+
+		if (norm.x * calculatedNormal.x < 0 || norm.y * calculatedNormal.y < 0 || norm.z * calculatedNormal.z < 0)
+		{
+			uint32_t v = face->vertex[0];
+			float f;
+			face->vertex[0] = face->vertex[2];
+			face->vertex[2] = v;
+			f = face->s[0];  face->s[0] = face->s[2];  face->s[2] = f;
+			f = face->t[0];  face->t[0] = face->t[2];  face->t[2] = f;
+		}
+	}
+}
+
+
+static void GenerateFaceTangents(Mesh *mesh)
+{
+	uint32_t i;
+
+	for (i = 0; i < mesh->faceCount; i++)
+	{
+		Face *face = &mesh->faces[i];
+		Vector vAB = vector_subtract(mesh->vertices[face->vertex[1]], mesh->vertices[face->vertex[0]]);
+		Vector vAC = vector_subtract(mesh->vertices[face->vertex[2]], mesh->vertices[face->vertex[0]]);
+		Vector nA = face->normal;
+
+		Vector vProjAB = vector_subtract(vAB, vector_multiply_scalar(nA, dot_product(nA, vAB)));
+		Vector vProjAC = vector_subtract(vAC, vector_multiply_scalar(nA, dot_product(nA, vAC)));
+
+		float dsAB = face->s[1] - face->s[0];
+		float dsAC = face->s[2] - face->s[0];
+		float dtAB = face->t[1] - face->t[0];
+		float dtAC = face->t[2] - face->t[0];
+
+		if (dsAC * dtAB > dsAB * dtAC)
+		{
+			face->tangent = vector_normal(vector_subtract(vector_multiply_scalar(vProjAC, dtAB), vector_multiply_scalar(vProjAB, dtAC)));
+		}
+		else
+		{
+			face->tangent = vector_normal(vector_subtract(vector_multiply_scalar(vProjAB, dtAC), vector_multiply_scalar(vProjAC, dtAB)));
+		}
+	}
+}
+
+
+static float FaceArea(const uint32_t *vertIndices, const Vector *vertices)
+{
+	float a2 = magnitude2(vector_subtract(vertices[vertIndices[0]], vertices[vertIndices[1]]));
+	float b2 = magnitude2(vector_subtract(vertices[vertIndices[1]], vertices[vertIndices[2]]));
+	float c2 = magnitude2(vector_subtract(vertices[vertIndices[2]], vertices[vertIndices[0]]));
+	return sqrt((2.0f * (a2 * b2 + b2 * c2 + c2 * a2) - (a2 * a2 + b2 * b2 +c2 * c2)) * 0.0625f);
+}
+
+
+static float FaceAreaCorrect(const uint32_t *vertIndices, const Vector *vertices)
+{
+	Vector AB = vector_subtract(vertices[vertIndices[1]], vertices[vertIndices[0]]);
+	Vector AC = vector_subtract(vertices[vertIndices[2]], vertices[vertIndices[0]]);
+	return sqrt(magnitude2(true_cross_product(AB, AC)));
+}
+
+
+static int CalculateVertexNormalsAndTangents(Mesh *mesh)
+{
+	uint32_t i, k;
+	float *area = malloc(sizeof *area * mesh->faceCount);
+
+	mesh->normals = calloc(mesh->vertexCount, sizeof *mesh->normals);
+	mesh->tangents = calloc(mesh->vertexCount, sizeof *mesh->tangents);
+	if (area == NULL || mesh->normals == NULL || mesh->tangents == NULL)  return 0;
+
+	for (i = 0; i < mesh->faceCount; i++)  area[i] = FaceArea(mesh->faces[i].vertex, mesh->vertices);
+	for (i = 0; i < mesh->vertexCount; i++)
+	{
+		Vector normal_sum = kZeroVector;
+		Vector tangent_sum = kZeroVector;
+		FaceList *refs = &mesh->faceRefs[i];
+
+		for (k = 0; k < refs->count; k++)
+		{
+			uint32_t j = refs->faces[k];
+			float t = area[j];
+			normal_sum = vector_add(normal_sum, vector_multiply_scalar(mesh->faces[j].normal, t));
+			tangent_sum = vector_add(tangent_sum, vector_multiply_scalar(mesh->faces[j].tangent, t));
+		}
+
+		normal_sum = vector_normal_or_fallback(normal_sum, kBasisZVector);
+		tangent_sum = vector_subtract(tangent_sum, vector_multiply_scalar(normal_sum, dot_product(tangent_sum, normal_sum)));
+		tangent_sum = vector_normal_or_fallback(tangent_sum, kBasisXVector);
+
+		mesh->normals[i] = normal_sum;
+		mesh->tangents[i] = tangent_sum;
+	}
+
+	free(area);
+	return 1;
+}
+
+
+static int CalculateVertexTangents(Mesh *mesh)
+{
+	uint32_t i, k;
+	float *area = malloc(sizeof *area * mesh->faceCount);
+	if (area == NULL)  return 0;
+
+	for (i = 0; i < mesh->faceCount; i++)  area[i] = FaceAreaCorrect(mesh->faces[i].vertex, mesh->vertices);
+	for (i = 0; i < mesh->vertexCount; i++)
+	{
+		Vector tangent_sum = kZeroVector;
+		FaceList *refs = &mesh->faceRefs[i];
+
+		for (k = 0; k < refs->count; k++)
+		{
+			uint32_t j = refs->faces[k];
+			tangent_sum = vector_add(tangent_sum, vector_multiply_scalar(mesh->faces[j].tangent, area[j]));
+		}
+
+		tangent_sum = vector_subtract(tangent_sum, vector_multiply_scalar(mesh->normals[i], dot_product(mesh->normals[i], tangent_sum)));
+		tangent_sum = vector_normal_or_fallback(tangent_sum, kBasisXVector);
+
+		mesh->tangents[i] = tangent_sum;
+	}
+
+	free(area);
+	return 1;
+}
+
+
+// MARK: Draw arrays (as -[OOMesh setUpVertexArrays])
+
+static void GetNormalAndTangent(const Mesh *mesh, uint32_t v_index, uint16_t smoothGroup, Vector *outNormal, Vector *outTangent)
+{
+	uint32_t j;
+	Vector normal_sum = kZeroVector;
+	Vector tangent_sum = kZeroVector;
+
+	for (j = 0; j < mesh->faceCount; j++)
+	{
+		const Face *face = &mesh->faces[j];
+		if (face->smoothGroup == smoothGroup && (face->vertex[0] == v_index || face->vertex[1] == v_index || face->vertex[2] == v_index))
+		{
+			float area = FaceArea(face->vertex, mesh->vertices);
+			normal_sum = vector_add(normal_sum, vector_multiply_scalar(face->normal, area));
+			tangent_sum = vector_add(tangent_sum, vector_multiply_scalar(face->tangent, area));
+		}
+	}
+
+	*outNormal = vector_normal_or_fallback(normal_sum, kBasisZVector);
+	*outTangent = vector_normal_or_fallback(tangent_sum, kBasisXVector);
+}
+
+
+static uint32_t DrawVertexIndex(Mesh *mesh, uint32_t *hashTable, size_t hashMask, Vector position, Vector normal, Vector tangent, float s, float t)
+{
+	float		key[11] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, tangent.x, tangent.y, tangent.z, s, t };
+	uint32_t	hash = 2166136261U, index;
+	unsigned	i;
+	size_t		slot;
+
+	for (i = 0; i < sizeof key; i++)  hash = (hash ^ ((const uint8_t *)key)[i]) * 16777619U;
+
+	for (slot = hash & hashMask; hashTable[slot] != 0; slot = (slot + 1) & hashMask)
+	{
+		index = hashTable[slot] - 1;
+		if (vector_equal(mesh->drawVertices[index], position) &&
+			vector_equal(mesh->drawNormals[index], normal) &&
+			vector_equal(mesh->drawTangents[index], tangent) &&
+			mesh->uvs[index * 2] == s &&
+			mesh->uvs[index * 2 + 1] == t)
+		{
+			return index;
+		}
+	}
+
+	index = mesh->drawVertexCount++;
+	mesh->drawVertices[index] = position;
+	mesh->drawNormals[index] = normal;
+	mesh->drawTangents[index] = tangent;
+	mesh->uvs[index * 2] = s;
+	mesh->uvs[index * 2 + 1] = t;
+	hashTable[slot] = index + 1;
+	return index;
+}
+
+
+static int SetUpVertexArrays(Mesh *mesh)
+{
+	uint32_t	fi, vi, mi, count = mesh->faceCount * 3;
+	size_t		hashTableSize = 1;
+	uint32_t	*hashTable = NULL;
+	char		*isEdgeVertex = calloc(mesh->vertexCount, 1);
+	float		*smoothGroup = malloc(sizeof *smoothGroup * mesh->vertexCount);
+	int			perVertex = mesh->normalMode != kNormalModePerFace;
+
+	while (hashTableSize < (size_t)mesh->faceCount * 6)  hashTableSize <<= 1;
+	hashTable = calloc(hashTableSize, sizeof *hashTable);
+	mesh->indices = malloc(sizeof *mesh->indices * count);
+	mesh->uvs = malloc(sizeof *mesh->uvs * 2 * count);
+	mesh->drawVertices = malloc(sizeof *mesh->drawVertices * count);
+	mesh->drawNormals = malloc(sizeof *mesh->drawNormals * count);
+	mesh->drawTangents = malloc(sizeof *mesh->drawTangents * count);
+	if (isEdgeVertex == NULL || smoothGroup == NULL || hashTable == NULL || mesh->indices == NULL ||
+		mesh->uvs == NULL || mesh->drawVertices == NULL || mesh->drawNormals == NULL || mesh->drawTangents == NULL)
+	{
+		return 0;
+	}
+
+	for (vi = 0; vi < mesh->vertexCount; vi++)  smoothGroup[vi] = -1;
+	if (mesh->normalMode == kNormalModeSmooth)
+	{
+		for (fi = 0; fi < mesh->faceCount; fi++)
+		{
+			float rv = mesh->faces[fi].smoothGroup;
+			for (vi = 0; vi < 3; vi++)
+			{
+				uint32_t v = mesh->faces[fi].vertex[vi];
+				if (smoothGroup[v] < 0.0)  smoothGroup[v] = rv;
+				else if (smoothGroup[v] != rv)  isEdgeVertex[v] = 1;
+			}
+		}
+	}
+
+	for (mi = 0; mi != mesh->materialCount; mi++)
+	{
+		mesh->ranges[mi][0] = mesh->indexCount;
+		for (fi = 0; fi < mesh->faceCount; fi++)
+		{
+			const Face *face = &mesh->faces[fi];
+			if (face->materialIndex != mi)  continue;
+
+			for (vi = 0; vi < 3; vi++)
+			{
+				uint32_t v = face->vertex[vi];
+				Vector normal, tangent;
+
+				if (!perVertex)
+				{
+					normal = face->normal;
+					tangent = face->tangent;
+				}
+				else if (isEdgeVertex[v])
+				{
+					GetNormalAndTangent(mesh, v, face->smoothGroup, &normal, &tangent);
+				}
+				else
+				{
+					normal = mesh->normals[v];
+					tangent = mesh->tangents[v];
+				}
+
+				mesh->indices[mesh->indexCount++] = DrawVertexIndex(mesh, hashTable, hashTableSize - 1, mesh->vertices[v], normal, tangent, face->s[vi], face->t[vi]);
+			}
+		}
+		mesh->ranges[mi][1] = mesh->indexCount - mesh->ranges[mi][0];
+	}
+
+	free(isEdgeVertex);
+	free(smoothGroup);
+	free(hashTable);
+	return 1;
+}
+
+
+// MARK: Output
+
+static uint64_t SourceHash(const void *bytes, size_t length)
+{
+	const uint8_t *p = bytes;
+	uint64_t hash = 14695981039346656037ULL;
+	while (length--)  hash = (hash ^ *p++) * 1099511628211ULL;
+	return hash;
+}
+
+
+static uint64_t Align(uint64_t offset)
+{
+	return (offset + kAlignment - 1) & ~(uint64_t)(kAlignment - 1);
+}
+
+
+static int WriteMesh(const Mesh *mesh, uint64_t sourceHash, const char *path)
+{
+	Header		header;
+	char		*keys = NULL;
+	size_t		keysLength = 0;
+	uint8_t		*bytes = NULL;
+	uint64_t	offset;
+	unsigned	i;
+	FILE		*file = NULL;
+	int			OK;
+
+	for (i = 0; i < mesh->materialCount; i++)  keysLength += strlen(mesh->materialKeys[i]) + 1;
+	keys = malloc(keysLength);
+	if (keys == NULL)  return 0;
+	for (i = 0, offset = 0; i < mesh->materialCount; i++)
+	{
+		size_t length = strlen(mesh->materialKeys[i]) + 1;
+		memcpy(keys + offset, mesh->materialKeys[i], length);
+		offset += length;
+	}
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, "OOMB", sizeof header.magic);
+	header.formatVersion = kFormatVersion;
+	header.endianTag = kEndianTag;
+	header.vectorSize = sizeof (Vector);
+	header.faceSize = sizeof (Face);
+	header.sourceHash = sourceHash;
+	header.scale = 1.0f;
+	header.normalMode = mesh->normalMode;
+	header.loaderRevision = kLoaderRevision;
+	header.materialCount = mesh->materialCount;
+	header.vertexCount = mesh->vertexCount;
+	header.faceCount = mesh->faceCount;
+	header.drawVertexCount = mesh->drawVertexCount;
+	header.indexCount = mesh->indexCount;
+	memcpy(header.materialRanges, mesh->ranges, sizeof header.materialRanges);
+
+	const void *sectionBytes[kSectionCount] =
+	{
+		keys, mesh->vertices, mesh->faces, mesh->indices, mesh->uvs,
+		mesh->drawVertices, mesh->drawNormals, mesh->drawTangents, NULL
+	};
+	size_t sectionLengths[kSectionCount] =
+	{
+		keysLength,
+		sizeof (Vector) * mesh->vertexCount,
+		sizeof (Face) * mesh->faceCount,
+		sizeof (uint32_t) * mesh->indexCount,
+		sizeof (float) * 2 * mesh->drawVertexCount,
+		sizeof (Vector) * mesh->drawVertexCount,
+		sizeof (Vector) * mesh->drawVertexCount,
+		sizeof (Vector) * mesh->drawVertexCount,
+		0
+	};
+
+	offset = Align(sizeof header);
+	for (i = 0; i < kSectionCount; i++)
+	{
+		header.sections[i].offset = offset;
+		header.sections[i].length = sectionLengths[i];
+		offset = Align(offset + sectionLengths[i]);
+	}
+	if (offset > UINT32_MAX)
+	{
+		free(keys);
+		return 0;
+	}
+
+	bytes = calloc(1, offset);
+	if (bytes == NULL)
+	{
+		free(keys);
+		return 0;
+	}
+	memcpy(bytes, &header, sizeof header);
+	for (i = 0; i < kSectionCount; i++)
+	{
+		if (sectionLengths[i] != 0)  memcpy(bytes + header.sections[i].offset, sectionBytes[i], sectionLengths[i]);
+	}
+
+	file = fopen(path, "wb");
+	OK = file != NULL && fwrite(bytes, offset, 1, file) == 1;
+	if (file != NULL && fclose(file) != 0)  OK = 0;
+
+	free(bytes);
+	free(keys);
+	return OK;
+}
+
+
+static char *OutputPath(const char *path, const char *outDirectory)
+{
+	const char	*name = strrchr(path, '/');
+	const char	*dot = NULL;
+	size_t		baseLength;
+	char		*result = NULL;
+
+	name = (name != NULL) ? name + 1 : path;
+	dot = strrchr(name, '.');
+	baseLength = (dot != NULL) ? (size_t)(dot - name) : strlen(name);
+
+	if (outDirectory == NULL)
+	{
+		size_t dirLength = name - path;
+		result = malloc(dirLength + baseLength + sizeof ".oomesh");
+		if (result != NULL)  sprintf(result, "%.*s%.*s.oomesh", (int)dirLength, path, (int)baseLength, name);
+	}
+	else
+	{
+		result = malloc(strlen(outDirectory) + 1 + baseLength + sizeof ".oomesh");
+		if (result != NULL)  sprintf(result, "%s/%.*s.oomesh", outDirectory, (int)baseLength, name);
+	}
+	return result;
+}
+
+
+static int ConvertFile(const char *path, const char *outDirectory, int smooth)
+{
+	FILE		*file = NULL;
+	char		*bytes = NULL, *text = NULL, *outPath = NULL;
+	long		length;
+	const char	*start;
+	Mesh		mesh;
+	Scanner		scanner;
+	int			OK = 0;
+	unsigned	i;
+
+	memset(&mesh, 0, sizeof mesh);
+	mesh.normalMode = smooth ? kNormalModeSmooth : kNormalModePerFace;
+
+	file = fopen(path, "rb");
+	if (file == NULL || fseek(file, 0, SEEK_END) != 0 || (length = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0)
+	{
+		fprintf(stderr, "%s: could not open file.\n", path);
+		if (file != NULL)  fclose(file);
+		return 0;
+	}
+	bytes = malloc(length + 1);
+	if (bytes == NULL || fread(bytes, 1, length, file) != (size_t)length)
+	{
+		fprintf(stderr, "%s: could not read file.\n", path);
+		fclose(file);
+		free(bytes);
+		return 0;
+	}
+	fclose(file);
+
+	start = bytes;
+	if (length >= 2 && (((uint8_t)bytes[0] == 0xFF && (uint8_t)bytes[1] == 0xFE) || ((uint8_t)bytes[0] == 0xFE && (uint8_t)bytes[1] == 0xFF)))
+	{
+		fprintf(stderr, "%s: UTF-16 files are not supported; convert to UTF-8 first.\n", path);
+		free(bytes);
+		return 0;
+	}
+	if (length >= 3 && (uint8_t)bytes[0] == 0xEF && (uint8_t)bytes[1] == 0xBB && (uint8_t)bytes[2] == 0xBF)  start += 3;
+
+	text = Preprocess(start, length - (start - bytes));
+	scanner.cursor = text;
+	scanner.error = NULL;
+
+	if (text != NULL && ParseMesh(&mesh, &scanner))
+	{
+		OK = 1;
+		if (mesh.normalMode != kNormalModeExplicit)  CheckNormalsAndAdjustWinding(&mesh);
+		GenerateFaceTangents(&mesh);
+		if (mesh.normalMode == kNormalModeSmooth)  OK = CalculateVertexNormalsAndTangents(&mesh);
+		else if (mesh.normalMode == kNormalModeExplicit)  OK = CalculateVertexTangents(&mesh);
+		if (OK)  OK = SetUpVertexArrays(&mesh);
+		if (!OK)  scanner.error = "Out of memory";
+	}
+
+	if (OK)
+	{
+		outPath = OutputPath(path, outDirectory);
+		OK = outPath != NULL && WriteMesh(&mesh, SourceHash(bytes, length), outPath);
+		if (OK)  printf("%s -> %s (%u vertices, %u faces, %u draw vertices)\n", path, outPath, mesh.vertexCount, mesh.faceCount, mesh.drawVertexCount);
+		else  fprintf(stderr, "%s: could not write %s.\n", path, outPath ? outPath : "output");
+	}
+	else
+	{
+		fprintf(stderr, "%s: %s.\n", path, scanner.error ? scanner.error : "could not read model");
+	}
+
+	for (i = 0; i < mesh.vertexCount && mesh.faceRefs != NULL; i++)  free(mesh.faceRefs[i].faces);
+	for (i = 0; i < mesh.materialCount; i++)  free(mesh.materialKeys[i]);
+	free(mesh.faceRefs);
+	free(mesh.vertices);
+	free(mesh.normals);
+	free(mesh.tangents);
+	free(mesh.faces);
+	free(mesh.indices);
+	free(mesh.uvs);
+	free(mesh.drawVertices);
+	free(mesh.drawNormals);
+	free(mesh.drawTangents);
+	free(outPath);
+	free(text);
+	free(bytes);
+	return OK;
+}